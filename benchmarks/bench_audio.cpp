@@ -0,0 +1,69 @@
+/**
+ * @file benchmarks/bench_audio.cpp
+ * @brief Benchmark the Opus encode loop of src/audio.*.
+ */
+// standard includes
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+// lib includes
+#include <benchmark/benchmark.h>
+#include <opus/opus_multistream.h>
+
+// local includes
+#include <src/utility.h>
+
+namespace {
+  using opus_t = util::safe_ptr<OpusMSEncoder, opus_multistream_encoder_destroy>;
+
+  constexpr auto SAMPLE_RATE = 48000;
+
+  /**
+   * @brief Encode packets of a stream configuration the way audio::encodeThread() does.
+   * The arguments are the channels, streams, coupled streams, bitrate, complexity and packet duration in ms.
+   */
+  void opus_encode(benchmark::State &state) {
+    auto channels = (int) state.range(0);
+    auto streams = (int) state.range(1);
+    auto coupled_streams = (int) state.range(2);
+    auto frame_size = (int) state.range(5) * SAMPLE_RATE / 1000;
+
+    std::vector<std::uint8_t> mapping(channels);
+    for (int x = 0; x < channels; ++x) {
+      mapping[x] = x;
+    }
+
+    int err;
+    opus_t opus {opus_multistream_encoder_create(SAMPLE_RATE, channels, streams, coupled_streams, mapping.data(), OPUS_APPLICATION_RESTRICTED_LOWDELAY, &err)};
+    if (!opus) {
+      state.SkipWithError(opus_strerror(err));
+      return;
+    }
+
+    opus_multistream_encoder_ctl(opus.get(), OPUS_SET_BITRATE((int) state.range(3)));
+    opus_multistream_encoder_ctl(opus.get(), OPUS_SET_VBR(0));
+    opus_multistream_encoder_ctl(opus.get(), OPUS_SET_COMPLEXITY((int) state.range(4)));
+
+    // A tone per channel, so the encoder has something to work with
+    std::vector<float> samples(frame_size * channels);
+    for (int x = 0; x < frame_size; ++x) {
+      for (int c = 0; c < channels; ++c) {
+        samples[x * channels + c] = 0.5f * std::sin(x * (c + 1) * 0.05f);
+      }
+    }
+
+    std::vector<std::uint8_t> packet(1400);
+    for (auto _ : state) {
+      benchmark::DoNotOptimize(opus_multistream_encode_float(opus.get(), samples.data(), frame_size, packet.data(), packet.size()));
+    }
+
+    state.SetItemsProcessed(state.iterations() * frame_size);
+  }
+
+  // Stereo, high quality stereo and 5.1 as in audio::stream_configs, with 5 ms packets
+  BENCHMARK(opus_encode)
+    ->Args({2, 1, 1, 96000, 10, 5})
+    ->Args({2, 1, 1, 512000, 10, 5})
+    ->Args({6, 4, 2, 256000, 8, 5});
+}  // namespace
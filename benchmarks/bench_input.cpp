@@ -0,0 +1,100 @@
+/**
+ * @file benchmarks/bench_input.cpp
+ * @brief Benchmark merging input messages in src/input.* before they go to the OS.
+ */
+// standard includes
+#include <cstdint>
+#include <cstring>
+
+// lib includes
+#include <benchmark/benchmark.h>
+#include <boost/endian/conversion.hpp>
+#include <moonlight-common-c/src/Input.h>
+#include <moonlight-common-c/src/Limelight.h>
+
+// local includes
+#include <src/utility.h>
+
+namespace input {
+  // Mirrors input.cpp
+  enum class batch_result_e {
+    batched,
+    not_batchable,
+    terminate_batch,
+  };
+
+  batch_result_e batch(PNV_INPUT_HEADER dest, PNV_INPUT_HEADER src);
+}  // namespace input
+
+namespace {
+  template<class T>
+  T make_packet(std::uint32_t magic) {
+    T packet {};
+    packet.header.size = util::endian::big<std::uint32_t>(sizeof(T) - sizeof(packet.header.size));
+    packet.header.magic = util::endian::little(magic);
+    return packet;
+  }
+
+  void store(netfloat &f, float value) {
+    boost::endian::endian_store<float, sizeof(float), boost::endian::order::little>(f, value);
+  }
+
+  /**
+   * @brief Merge a later message into an earlier one, restoring the earlier one every round.
+   */
+  template<class T>
+  void run(benchmark::State &state, const T &dest, const T &src) {
+    auto merged = dest;
+    auto later = src;
+
+    for (auto _ : state) {
+      std::memcpy(&merged, &dest, sizeof(T));
+      benchmark::DoNotOptimize(input::batch(&merged.header, &later.header));
+      benchmark::ClobberMemory();
+    }
+  }
+
+  void batch_mouse(benchmark::State &state) {
+    auto dest = make_packet<NV_REL_MOUSE_MOVE_PACKET>(MOUSE_MOVE_REL_MAGIC_GEN5);
+    dest.deltaX = util::endian::big<std::int16_t>(3);
+    auto src = dest;
+
+    run(state, dest, src);
+  }
+
+  BENCHMARK(batch_mouse);
+
+  void batch_touch(benchmark::State &state) {
+    auto dest = make_packet<SS_TOUCH_PACKET>(SS_TOUCH_MAGIC);
+    dest.eventType = LI_TOUCH_EVENT_MOVE;
+    store(dest.x, 0.25f);
+    auto src = dest;
+    store(src.x, 0.5f);
+
+    run(state, dest, src);
+  }
+
+  BENCHMARK(batch_touch);
+
+  void batch_controller(benchmark::State &state) {
+    auto dest = make_packet<NV_MULTI_CONTROLLER_PACKET>(MULTI_CONTROLLER_MAGIC_GEN5);
+    dest.activeGamepadMask = util::endian::little<std::int16_t>(1);
+    auto src = dest;
+    src.leftStickX = util::endian::little<std::int16_t>(1024);
+
+    run(state, dest, src);
+  }
+
+  BENCHMARK(batch_controller);
+
+  void batch_motion(benchmark::State &state) {
+    auto dest = make_packet<SS_CONTROLLER_MOTION_PACKET>(SS_CONTROLLER_MOTION_MAGIC);
+    dest.motionType = LI_MOTION_TYPE_GYRO;
+    auto src = dest;
+    store(src.x, 1.0f);
+
+    run(state, dest, src);
+  }
+
+  BENCHMARK(batch_motion);
+}  // namespace
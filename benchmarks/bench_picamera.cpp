@@ -0,0 +1,391 @@
+/**
+ * @file benchmarks/bench_picamera.cpp
+ * @brief Benchmark the PiCamera capture backend against a v4l2loopback device.
+ */
+#if defined(__linux__) && defined(SUNSHINE_BUILD_PICAMERA)
+  // standard includes
+  #include <algorithm>
+  #include <atomic>
+  #include <chrono>
+  #include <cstdint>
+  #include <cstdlib>
+  #include <cstring>
+  #include <filesystem>
+  #include <map>
+  #include <new>
+  #include <string>
+  #include <thread>
+  #include <utility>
+  #include <vector>
+
+  // platform includes
+  #include <fcntl.h>
+  #include <linux/videodev2.h>
+  #include <sys/ioctl.h>
+  #include <unistd.h>
+
+  // lib includes
+  #include <benchmark/benchmark.h>
+  #include <nlohmann/json.hpp>
+extern "C" {
+  #include <libavcodec/avcodec.h>
+}
+
+  // local includes
+  #include <src/platform/linux/picamera_capture.h>
+  #include <src/stat_trackers.h>
+  #include <src/trace.h>
+  #include <src/utility.h>
+  #include <src/video.h>
+
+namespace {
+  std::atomic<std::uint64_t> allocations;
+}  // namespace
+
+// Every allocation of the process is counted, to catch the capture loop allocating per frame
+void *operator new(std::size_t size) {
+  allocations.fetch_add(1, std::memory_order_relaxed);
+  if (auto ptr = std::malloc(size ? size : 1)) {
+    return ptr;
+  }
+
+  throw std::bad_alloc {};
+}
+
+void operator delete(void *ptr) noexcept {
+  std::free(ptr);
+}
+
+void operator delete(void *ptr, std::size_t) noexcept {
+  std::free(ptr);
+}
+
+namespace {
+  using namespace std::literals;
+
+  constexpr std::uint32_t fourccs[] {
+    V4L2_PIX_FMT_NV12,
+    V4L2_PIX_FMT_YUYV,
+    V4L2_PIX_FMT_MJPEG,
+  };
+
+  // Modes of a USB webcam and of the Pi camera modules
+  constexpr std::pair<int, int> sizes[] {
+    {640, 480},
+    {1280, 720},
+    {1920, 1080},
+  };
+
+  constexpr int FRAMERATE = 60;
+
+  // Distinct frames the feeder cycles through, so the decoder can't take shortcuts
+  constexpr int FRAME_COUNT = 8;
+
+  /**
+   * @brief Find the v4l2loopback node to feed, `SUNSHINE_BENCH_V4L2LOOPBACK` picks one if there are several.
+   */
+  std::string loopback_node() {
+    if (auto node = std::getenv("SUNSHINE_BENCH_V4L2LOOPBACK")) {
+      return node;
+    }
+
+    std::error_code ec;
+    for (auto &entry : std::filesystem::directory_iterator {"/dev", ec}) {
+      auto path = entry.path().string();
+      if (entry.path().filename().string().rfind("video", 0) != 0) {
+        continue;
+      }
+
+      auto fd = open(path.c_str(), O_RDWR | O_NONBLOCK);
+      if (fd < 0) {
+        continue;
+      }
+
+      v4l2_capability caps {};
+      auto is_loopback = ioctl(fd, VIDIOC_QUERYCAP, &caps) == 0 && std::strcmp((const char *) caps.driver, "v4l2 loopback") == 0;
+      close(fd);
+
+      if (is_loopback) {
+        return path;
+      }
+    }
+
+    return {};
+  }
+
+  std::vector<std::uint8_t> make_raw_frame(std::uint32_t fourcc, int width, int height, int index) {
+    std::vector<std::uint8_t> frame;
+    if (fourcc == V4L2_PIX_FMT_NV12) {
+      frame.resize(width * height * 3 / 2);
+      for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+          frame[y * width + x] = (std::uint8_t) (x + y + index * 16);
+        }
+      }
+      std::memset(frame.data() + width * height, 128 + index, width * height / 2);
+    } else {
+      frame.resize(width * height * 2);
+      for (std::size_t x = 0; x < frame.size(); x += 2) {
+        frame[x] = (std::uint8_t) (x / 2 + index * 16);
+        frame[x + 1] = (std::uint8_t) (128 + index);
+      }
+    }
+
+    return frame;
+  }
+
+  /**
+   * @brief Encode the test frames with the MJPEG encoder of libavcodec.
+   * @return The frames, or nothing if libavcodec was built without it.
+   */
+  std::vector<std::vector<std::uint8_t>> make_mjpeg_frames(int width, int height) {
+    auto codec = avcodec_find_encoder(AV_CODEC_ID_MJPEG);
+    if (!codec) {
+      return {};
+    }
+
+    auto ctx = avcodec_alloc_context3(codec);
+    auto frame = av_frame_alloc();
+    auto packet = av_packet_alloc();
+    auto fg = util::fail_guard([&]() {
+      av_packet_free(&packet);
+      av_frame_free(&frame);
+      avcodec_free_context(&ctx);
+    });
+
+    ctx->width = width;
+    ctx->height = height;
+    ctx->pix_fmt = AV_PIX_FMT_YUVJ420P;
+    ctx->time_base = {1, FRAMERATE};
+    if (avcodec_open2(ctx, codec, nullptr) < 0) {
+      return {};
+    }
+
+    frame->width = width;
+    frame->height = height;
+    frame->format = AV_PIX_FMT_YUVJ420P;
+    if (av_frame_get_buffer(frame, 0) < 0) {
+      return {};
+    }
+
+    std::vector<std::vector<std::uint8_t>> frames;
+    for (int index = 0; index < FRAME_COUNT; ++index) {
+      for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+          frame->data[0][y * frame->linesize[0] + x] = (std::uint8_t) (x + y + index * 16);
+        }
+      }
+      for (int y = 0; y < height / 2; ++y) {
+        std::memset(frame->data[1] + y * frame->linesize[1], 128 + index, width / 2);
+        std::memset(frame->data[2] + y * frame->linesize[2], 128 - index, width / 2);
+      }
+      frame->pts = index;
+
+      if (avcodec_send_frame(ctx, frame) < 0 || avcodec_receive_packet(ctx, packet) < 0) {
+        return {};
+      }
+      frames.emplace_back(packet->data, packet->data + packet->size);
+      av_packet_unref(packet);
+    }
+
+    return frames;
+  }
+
+  /**
+   * @brief Writes test frames to the output side of a v4l2loopback device.
+   */
+  class feeder_t {
+  public:
+    ~feeder_t() {
+      stop();
+      if (fd >= 0) {
+        close(fd);
+      }
+    }
+
+    bool open(const std::string &node, std::uint32_t fourcc, int width, int height) {
+      if (fourcc == V4L2_PIX_FMT_MJPEG) {
+        frames = make_mjpeg_frames(width, height);
+      } else {
+        for (int index = 0; index < FRAME_COUNT; ++index) {
+          frames.emplace_back(make_raw_frame(fourcc, width, height, index));
+        }
+      }
+      if (frames.empty()) {
+        return false;
+      }
+
+      fd = ::open(node.c_str(), O_RDWR);
+      if (fd < 0) {
+        return false;
+      }
+
+      std::size_t sizeimage = 0;
+      for (auto &frame : frames) {
+        sizeimage = std::max(sizeimage, frame.size());
+      }
+
+      v4l2_format format {};
+      format.type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
+      format.fmt.pix.width = width;
+      format.fmt.pix.height = height;
+      format.fmt.pix.pixelformat = fourcc;
+      format.fmt.pix.field = V4L2_FIELD_NONE;
+      format.fmt.pix.bytesperline = fourcc == V4L2_PIX_FMT_YUYV ? width * 2 : fourcc == V4L2_PIX_FMT_NV12 ? width : 0;
+      format.fmt.pix.sizeimage = sizeimage;
+      if (ioctl(fd, VIDIOC_S_FMT, &format) < 0) {
+        return false;
+      }
+
+      v4l2_streamparm parm {};
+      parm.type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
+      parm.parm.output.timeperframe = {1, FRAMERATE};
+      ioctl(fd, VIDIOC_S_PARM, &parm);
+
+      return true;
+    }
+
+    /**
+     * @brief Write the next frame.
+     * @return The time just before the frame was written.
+     */
+    std::chrono::steady_clock::time_point write() {
+      auto &frame = frames[next++ % frames.size()];
+      auto now = std::chrono::steady_clock::now();
+      (void) ::write(fd, frame.data(), frame.size());
+      return now;
+    }
+
+    /**
+     * @brief Write frames at the frame rate until stop(), the backend needs them while it opens the camera.
+     */
+    void start() {
+      running = true;
+      thread = std::thread {[this]() {
+        auto next_frame = std::chrono::steady_clock::now();
+        while (running) {
+          write();
+          next_frame += 1000000us / FRAMERATE;
+          std::this_thread::sleep_until(next_frame);
+        }
+      }};
+    }
+
+    void stop() {
+      running = false;
+      if (thread.joinable()) {
+        thread.join();
+      }
+    }
+
+  private:
+    int fd {-1};
+    std::vector<std::vector<std::uint8_t>> frames;
+    std::size_t next {0};
+    std::atomic<bool> running {false};
+    std::thread thread;
+  };
+
+  /**
+   * @brief Average duration of each camera stage recorded in the trace, in microseconds.
+   */
+  std::map<std::string, double> stage_times() {
+    std::map<std::string, std::pair<double, int>> totals;
+    for (auto &event : nlohmann::json::parse(trace::dump())["traceEvents"]) {
+      auto &[total, count] = totals[event["name"].get<std::string>()];
+      total += event["dur"].get<double>();
+      ++count;
+    }
+
+    std::map<std::string, double> averages;
+    for (auto &[name, total] : totals) {
+      averages[name] = total.first / total.second;
+    }
+
+    return averages;
+  }
+
+  void picamera_capture(benchmark::State &state) {
+    auto fourcc = fourccs[state.range(0)];
+    auto [width, height] = sizes[state.range(1)];
+
+    auto node = loopback_node();
+    if (node.empty()) {
+      state.SkipWithError("No v4l2loopback device, load the module or set SUNSHINE_BENCH_V4L2LOOPBACK");
+      return;
+    }
+
+    feeder_t feeder;
+    if (!feeder.open(node, fourcc, width, height)) {
+      state.SkipWithError("Couldn't set the format of the v4l2loopback device");
+      return;
+    }
+    feeder.start();
+
+    // Refresh the capabilities the backend cached for the node, the format changed
+    platf::picamera::display_names();
+
+    video::config_t config {width, height, FRAMERATE, FRAMERATE * 100, 10000, 1, 0, 1 << 1, 0, 0, 0, 0};
+    auto display = platf::picamera::create_display(platf::mem_type_e::system, node, config);
+    if (!display) {
+      feeder.stop();
+      state.SkipWithError("The PiCamera backend couldn't open the v4l2loopback device");
+      return;
+    }
+
+    auto img = display->alloc_img();
+    if (display->dummy_img(img.get())) {
+      feeder.stop();
+      state.SkipWithError("The PiCamera backend couldn't prime an image");
+      return;
+    }
+
+    // From here on every frame is written just before it's captured, so reading it doesn't include waiting for it
+    feeder.stop();
+
+    stat_trackers::latency_histogram_t latency;
+    std::chrono::steady_clock::time_point written;
+    auto pull = [&img](std::shared_ptr<platf::img_t> &img_out) {
+      img_out = img;
+      return true;
+    };
+    auto push = [&](std::shared_ptr<platf::img_t> &&img_out, bool frame_captured) {
+      // Frames the feeder queued while the backend was opening the camera are older than the write
+      if (!frame_captured || (img_out->frame_timestamp && *img_out->frame_timestamp < written)) {
+        return true;
+      }
+
+      latency.record(std::chrono::steady_clock::now() - img_out->frame_timestamp.value_or(written));
+      return false;
+    };
+
+    trace::set_enabled(true);
+    auto allocations_before = allocations.load(std::memory_order_relaxed);
+    for (auto _ : state) {
+      written = feeder.write();
+      bool cursor = false;
+      if (display->capture(push, pull, &cursor) != platf::capture_e::ok) {
+        state.SkipWithError("Capture failed");
+        break;
+      }
+    }
+    auto frame_allocations = allocations.load(std::memory_order_relaxed) - allocations_before;
+    trace::set_enabled(false);
+
+    auto times = stage_times();
+    state.counters["read_us"] = times["camera_read"];
+    state.counters["decode_us"] = times["camera_decode"];
+    state.counters["scale_us"] = times["camera_scale"];
+    state.counters["allocs_per_frame"] = (double) frame_allocations / std::max<std::int64_t>(state.iterations(), 1);
+
+    auto counts = latency.snapshot();
+    state.counters["latency_p50_ms"] = stat_trackers::latency_histogram_t::percentile(counts, 0.5);
+    state.counters["latency_p99_ms"] = stat_trackers::latency_histogram_t::percentile(counts, 0.99);
+
+    state.SetItemsProcessed(state.iterations());
+    state.SetLabel(fourcc == V4L2_PIX_FMT_NV12 ? "NV12" : fourcc == V4L2_PIX_FMT_YUYV ? "YUYV" : "MJPEG");
+  }
+
+  BENCHMARK(picamera_capture)->ArgsProduct({{0, 1, 2}, {0, 1, 2}})->UseRealTime();
+}  // namespace
+#endif
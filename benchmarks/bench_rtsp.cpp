@@ -0,0 +1,99 @@
+/**
+ * @file benchmarks/bench_rtsp.cpp
+ * @brief Benchmark parsing the RTSP requests of the handshake in src/rtsp.*.
+ */
+extern "C" {
+#include <moonlight-common-c/src/Limelight-internal.h>
+#include <moonlight-common-c/src/Rtsp.h>
+}
+
+// standard includes
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// lib includes
+#include <benchmark/benchmark.h>
+
+namespace rtsp_stream {
+  std::unordered_map<std::string_view, std::string_view> parse_sdp(const std::string_view &payload, std::string_view &client);
+}  // namespace rtsp_stream
+
+namespace {
+  // The attributes of the ANNOUNCE Moonlight sends for a 1080p60 stream, each line ends with a space
+  constexpr std::string_view SDP =
+    "v=0\r\n"
+    "o=android 0 14 IN IPv4 192.168.1.20\r\n"
+    "s=NVIDIA Streaming Client\r\n"
+    "a=x-ml-general.featureFlags:3 \r\n"
+    "a=x-ml-video.configuredBitrateKbps:20000 \r\n"
+    "a=x-nv-aqos.packetDuration:5 \r\n"
+    "a=x-nv-aqos.qosTrafficType:4 \r\n"
+    "a=x-nv-audio.surround.AudioQuality:0 \r\n"
+    "a=x-nv-audio.surround.channelMask:3 \r\n"
+    "a=x-nv-audio.surround.numChannels:2 \r\n"
+    "a=x-nv-general.featureFlags:167 \r\n"
+    "a=x-nv-general.useReliableUdp:13 \r\n"
+    "a=x-nv-video[0].clientRefreshRateX100:6000 \r\n"
+    "a=x-nv-video[0].clientViewportHt:1080 \r\n"
+    "a=x-nv-video[0].clientViewportWd:1920 \r\n"
+    "a=x-nv-video[0].dynamicRangeMode:0 \r\n"
+    "a=x-nv-video[0].encoderCscMode:0 \r\n"
+    "a=x-nv-video[0].maxFPS:60 \r\n"
+    "a=x-nv-video[0].maxNumReferenceFrames:1 \r\n"
+    "a=x-nv-video[0].packetSize:1024 \r\n"
+    "a=x-nv-video[0].videoEncoderSlicesPerFrame:1 \r\n"
+    "a=x-nv-vqos[0].bitStreamFormat:1 \r\n"
+    "a=x-nv-vqos[0].bw.maximumBitrateKbps:20000 \r\n"
+    "a=x-nv-vqos[0].fec.minRequiredFecPackets:2 \r\n"
+    "a=x-nv-vqos[0].qosTrafficType:5 \r\n"
+    "a=x-ss-general.encryptionEnabled:7 \r\n"
+    "a=x-ss-video[0].chromaSamplingType:0 \r\n"
+    "a=x-ss-video[0].intraRefresh:0 \r\n"
+    "t=0 0\r\n"
+    "m=video 47998  \r\n";
+
+  std::string announce() {
+    return "ANNOUNCE streamid=control/13/0 RTSP/1.0\r\n"
+           "CSeq: 6\r\n"
+           "X-GS-ClientVersion: 14\r\n"
+           "Host: 192.168.1.10\r\n"
+           "Content-type: application/sdp\r\n"
+           "Content-length: " +
+           std::to_string(SDP.size()) + "\r\n\r\n" + std::string {SDP};
+  }
+
+  void rtsp_parse_message(benchmark::State &state) {
+    auto message = announce();
+
+    // The parser copies the message, the buffer it's given is never modified
+    for (auto _ : state) {
+      RTSP_MESSAGE msg {};
+      if (parseRtspMessage(&msg, message.data(), (int) message.size())) {
+        state.SkipWithError("Malformed RTSP message");
+        break;
+      }
+
+      benchmark::DoNotOptimize(msg.payload);
+      freeMessage(&msg);
+    }
+
+    state.SetBytesProcessed(state.iterations() * message.size());
+  }
+
+  BENCHMARK(rtsp_parse_message);
+
+  void rtsp_parse_sdp(benchmark::State &state) {
+    std::string_view client;
+
+    for (auto _ : state) {
+      auto args = rtsp_stream::parse_sdp(SDP, client);
+      benchmark::DoNotOptimize(args.size());
+    }
+
+    state.SetBytesProcessed(state.iterations() * SDP.size());
+  }
+
+  BENCHMARK(rtsp_parse_sdp);
+}  // namespace
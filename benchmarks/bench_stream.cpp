@@ -0,0 +1,138 @@
+/**
+ * @file benchmarks/bench_stream.cpp
+ * @brief Benchmark the per-packet work of src/stream.*: FEC, shard headers, AEAD sealing and control messages.
+ */
+// standard includes
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <string_view>
+#include <vector>
+
+// lib includes
+#include <benchmark/benchmark.h>
+
+// local includes
+extern "C" {
+#include <src/rswrapper.h>
+}
+#include <src/crypto.h>
+
+namespace stream {
+  void concat_and_insert(std::vector<uint8_t> &result, uint64_t insert_size, uint64_t slice_size, const std::string_view &data1, const std::string_view &data2);
+  int decrypt_control(crypto::cipher::gcm_t &cipher, crypto::aes_t &iv, bool v2, const std::string_view &message, std::vector<uint8_t> &plaintext);
+
+  namespace fec {
+    std::shared_ptr<reed_solomon> cached_coder(size_t data_shards, size_t parity_shards);
+  }
+}  // namespace stream
+
+namespace {
+  // The shard size of a video stream with the default packet size
+  constexpr auto BLOCKSIZE = 1024;
+
+  // Parity of a FEC block as a percentage of its data shards, the default of Moonlight is 20
+  void fec_encode(benchmark::State &state) {
+    auto data_shards = (int) state.range(0);
+    auto parity_shards = std::max(2, (int) (data_shards * state.range(1) / 100));
+
+    auto rs = stream::fec::cached_coder(data_shards, parity_shards);
+
+    std::vector<std::uint8_t> payload((data_shards + parity_shards) * BLOCKSIZE);
+    for (std::size_t x = 0; x < payload.size(); ++x) {
+      payload[x] = (std::uint8_t) (x * 31);
+    }
+
+    std::vector<std::uint8_t *> shards;
+    for (int x = 0; x < data_shards + parity_shards; ++x) {
+      shards.emplace_back(&payload[x * BLOCKSIZE]);
+    }
+
+    for (auto _ : state) {
+      reed_solomon_encode(rs.get(), shards.data(), data_shards + parity_shards, BLOCKSIZE);
+      benchmark::ClobberMemory();
+    }
+
+    state.SetBytesProcessed(state.iterations() * data_shards * BLOCKSIZE);
+    state.SetLabel(reed_solomon_isa);
+  }
+
+  BENCHMARK(fec_encode)->ArgsProduct({{4, 40, 80, 170}, {20, 50}});
+
+  void concat_and_insert(benchmark::State &state) {
+    // An RTP header and a video frame header in front of every shard of a frame
+    constexpr auto HEADER_SIZE = 16 + 8;
+
+    std::vector<char> frame(state.range(0));
+    std::vector<std::uint8_t> result;
+
+    for (auto _ : state) {
+      stream::concat_and_insert(result, HEADER_SIZE, BLOCKSIZE - HEADER_SIZE, std::string_view {frame.data(), frame.size()}, {});
+      benchmark::DoNotOptimize(result.data());
+    }
+
+    state.SetBytesProcessed(state.iterations() * frame.size());
+  }
+
+  BENCHMARK(concat_and_insert)->Arg(16 * 1024)->Arg(256 * 1024);
+
+  // Sealing a video shard with each AEAD the host can negotiate, the label tells if the CPU has AES instructions
+  void gcm_seal(benchmark::State &state) {
+    auto aead = (crypto::cipher::aead_e) state.range(1);
+    crypto::cipher::gcm_t cipher {crypto::aes_t(16, 0x42), false, aead};
+    crypto::aes_t iv(12);
+
+    std::vector<char> plaintext(state.range(0));
+    std::vector<std::uint8_t> sealed(crypto::cipher::round_to_pkcs7_padded(plaintext.size()) + crypto::cipher::tag_size);
+
+    for (auto _ : state) {
+      ++iv[0];
+      benchmark::DoNotOptimize(cipher.encrypt(std::string_view {plaintext.data(), plaintext.size()}, sealed.data(), &iv));
+    }
+
+    state.SetBytesProcessed(state.iterations() * plaintext.size());
+    state.SetLabel(aead == crypto::cipher::aead_e::chacha20_poly1305 ? "chacha20-poly1305" : (crypto::aes_hardware() ? "aes-128-gcm" : "aes-128-gcm, software AES"));
+  }
+
+  BENCHMARK(gcm_seal)->ArgsProduct({{64, BLOCKSIZE}, {(int) crypto::cipher::aead_e::aes_128_gcm, (int) crypto::cipher::aead_e::chacha20_poly1305}});
+
+  // The decryption every message of the encrypted control stream goes through before it's dispatched,
+  // most are input of a few dozen bytes
+  void control_decrypt(benchmark::State &state) {
+    auto v2 = (bool) state.range(1);
+
+    crypto::cipher::gcm_t cipher {crypto::aes_t(16, 0x42), false};
+    // The IV of the first message from the client, see decrypt_control()
+    crypto::aes_t iv(v2 ? 12 : 16);
+    if (v2) {
+      iv[10] = 'C';
+      iv[11] = 'C';
+    }
+
+    // A secondary header followed by the payload, sealed the way a client would
+    std::vector<char> plaintext(4 + state.range(0));
+    std::vector<std::uint8_t> message(8 + plaintext.size() + crypto::cipher::tag_size);
+
+    auto bytes = cipher.encrypt(std::string_view {plaintext.data(), plaintext.size()}, message.data() + 8, &iv);
+    std::uint16_t length = bytes + crypto::cipher::tag_size + 4;
+    message[0] = 0x01;
+    std::copy_n((std::uint8_t *) &length, sizeof(length), &message[2]);
+
+    crypto::aes_t incoming_iv;
+    std::vector<std::uint8_t> decrypted;
+    for (auto _ : state) {
+      if (stream::decrypt_control(cipher, incoming_iv, v2, std::string_view {(char *) message.data(), message.size()}, decrypted)) {
+        state.SkipWithError("Couldn't decrypt the control message");
+        break;
+      }
+
+      benchmark::DoNotOptimize(decrypted.data());
+    }
+
+    state.SetItemsProcessed(state.iterations());
+    state.SetBytesProcessed(state.iterations() * message.size());
+    state.SetLabel(v2 ? "v2 IV" : "legacy IV");
+  }
+
+  BENCHMARK(control_decrypt)->ArgsProduct({{16, 64, 256}, {0, 1}});
+}  // namespace
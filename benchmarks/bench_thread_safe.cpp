@@ -0,0 +1,77 @@
+/**
+ * @file benchmarks/bench_thread_safe.cpp
+ * @brief Benchmark the queues of src/thread_safe.h and the timers of src/task_pool.h.
+ */
+// standard includes
+#include <chrono>
+#include <memory>
+#include <vector>
+
+// lib includes
+#include <benchmark/benchmark.h>
+
+// local includes
+#include <src/task_pool.h>
+#include <src/thread_safe.h>
+
+using namespace std::literals;
+
+namespace {
+  // Raise a batch of elements, then pop them all, like a broadcast thread catching up
+  void queue_raise_pop(benchmark::State &state) {
+    auto batch = (int) state.range(0);
+    safe::queue_t<std::unique_ptr<int>> queue {(std::uint32_t) batch + 1};
+
+    for (auto _ : state) {
+      for (int x = 0; x < batch; ++x) {
+        queue.raise(std::make_unique<int>(x));
+      }
+      for (int x = 0; x < batch; ++x) {
+        benchmark::DoNotOptimize(queue.pop());
+      }
+    }
+
+    state.SetItemsProcessed(state.iterations() * batch);
+  }
+
+  BENCHMARK(queue_raise_pop)->Arg(1)->Arg(32)->Arg(1024);
+
+  // The per-frame poll of an event nobody raised
+  void event_poll(benchmark::State &state) {
+    safe::event_t<bool> event;
+
+    for (auto _ : state) {
+      benchmark::DoNotOptimize(event.pop(0ms));
+    }
+  }
+
+  BENCHMARK(event_poll);
+
+  void task_pool_push_pop(benchmark::State &state) {
+    task_pool_util::TaskPool pool;
+
+    for (auto _ : state) {
+      pool.push([]() {});
+      (*pool.pop())->run();
+    }
+  }
+
+  BENCHMARK(task_pool_push_pop);
+
+  // Push back one of many pending timers, like a key repeat
+  void task_pool_delay(benchmark::State &state) {
+    task_pool_util::TaskPool pool;
+
+    std::vector<task_pool_util::TaskPool::task_id_t> ids;
+    for (int x = 0; x < state.range(0); ++x) {
+      ids.emplace_back(pool.pushDelayed([]() {}, 1h + x * 1ms).task_id);
+    }
+
+    std::size_t next = 0;
+    for (auto _ : state) {
+      pool.delay(ids[next++ % ids.size()], 2h);
+    }
+  }
+
+  BENCHMARK(task_pool_delay)->Arg(16)->Arg(4096);
+}  // namespace
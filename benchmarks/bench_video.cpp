@@ -0,0 +1,154 @@
+/**
+ * @file benchmarks/bench_video.cpp
+ * @brief Benchmark the CPU work of a captured frame: cursor blending and the conversion to YUV.
+ */
+// standard includes
+#include <cstdint>
+#include <iterator>
+#include <utility>
+#include <vector>
+
+// lib includes
+#include <benchmark/benchmark.h>
+extern "C" {
+#include <libswscale/swscale.h>
+}
+
+// local includes
+#include <src/platform/cursor_blend.h>
+#include <src/utility.h>
+#include <src/video_convert.h>
+
+namespace {
+  using sws_t = util::safe_ptr<SwsContext, sws_freeContext>;
+
+  // Frame sizes of a Pi 4 and Pi 5 class stream
+  constexpr std::pair<int, int> sizes[] {
+    {1280, 720},
+    {1920, 1080},
+  };
+
+  std::vector<std::uint8_t> make_image(int width, int height) {
+    std::vector<std::uint8_t> image(width * height * 4);
+    for (std::size_t x = 0; x < image.size(); ++x) {
+      image[x] = (std::uint8_t) (x * 7 + x / 4096);
+    }
+
+    return image;
+  }
+
+  void blend_cursor(benchmark::State &state) {
+    auto size = (int) state.range(0);
+
+    std::vector<std::uint32_t> image(1920 * 1080);
+    std::vector<std::uint32_t> cursor(size * size);
+    for (std::size_t x = 0; x < cursor.size(); ++x) {
+      // Premultiplied, with a mix of transparent, translucent and opaque pixels
+      std::uint32_t alpha = (x * 5) & 0xFF;
+      cursor[x] = alpha << 24 | (alpha / 2) << 16 | (alpha / 3) << 8 | alpha / 4;
+    }
+
+    for (auto _ : state) {
+      platf::blend_cursor(&image[500 * 1920 + 500], 1920, cursor.data(), size, size, size);
+      benchmark::ClobberMemory();
+    }
+
+    state.SetItemsProcessed(state.iterations() * size * size);
+  }
+
+  BENCHMARK(blend_cursor)->Arg(32)->Arg(64)->Arg(256);
+
+  void convert_nv12(benchmark::State &state) {
+    auto [width, height] = sizes[state.range(0)];
+    auto image = make_image(width, height);
+    auto coefficients = video::convert::coefficients_from_colorspace({video::colorspace_e::rec709, false, 8});
+
+    std::vector<std::uint8_t> y(width * height), uv(width * height / 2);
+    std::uint8_t *planes[] {y.data(), uv.data()};
+    int pitches[] {width, width};
+
+    for (auto _ : state) {
+      video::convert::bgr0_to_nv12(image.data(), width * 4, planes, pitches, width, height, coefficients);
+      benchmark::ClobberMemory();
+    }
+
+    state.SetItemsProcessed(state.iterations() * width * height);
+    state.SetLabel(video::convert::accelerated ? "simd" : "scalar");
+  }
+
+  BENCHMARK(convert_nv12)->DenseRange(0, std::size(sizes) - 1);
+
+  // What convert_nv12 replaces, with the flags video.cpp gives libswscale
+  void sws_nv12(benchmark::State &state) {
+    auto [width, height] = sizes[state.range(0)];
+    auto image = make_image(width, height);
+
+    sws_t sws {sws_getContext(width, height, AV_PIX_FMT_BGR0, width, height, AV_PIX_FMT_NV12, SWS_LANCZOS | SWS_ACCURATE_RND, nullptr, nullptr, nullptr)};
+    if (!sws) {
+      state.SkipWithError("Couldn't create the libswscale context");
+      return;
+    }
+
+    std::vector<std::uint8_t> y(width * height), uv(width * height / 2);
+    const std::uint8_t *src[] {image.data()};
+    int src_pitches[] {width * 4};
+    std::uint8_t *planes[] {y.data(), uv.data()};
+    int pitches[] {width, width};
+
+    for (auto _ : state) {
+      sws_scale(sws.get(), src, src_pitches, 0, height, planes, pitches);
+      benchmark::ClobberMemory();
+    }
+
+    state.SetItemsProcessed(state.iterations() * width * height);
+  }
+
+  BENCHMARK(sws_nv12)->DenseRange(0, std::size(sizes) - 1);
+
+  // A YUYV camera frame, the image is only repacked
+  void yuyv_nv12(benchmark::State &state) {
+    auto [width, height] = sizes[state.range(0)];
+    auto image = make_image(width / 2, height);
+
+    std::vector<std::uint8_t> y(width * height), uv(width * height / 2);
+    std::uint8_t *planes[] {y.data(), uv.data()};
+    int pitches[] {width, width};
+
+    for (auto _ : state) {
+      video::convert::yuyv_to_nv12(image.data(), width * 2, planes, pitches, width, height);
+      benchmark::ClobberMemory();
+    }
+
+    state.SetItemsProcessed(state.iterations() * width * height);
+    state.SetLabel(video::convert::accelerated ? "simd" : "scalar");
+  }
+
+  BENCHMARK(yuyv_nv12)->DenseRange(0, std::size(sizes) - 1);
+
+  // What yuyv_nv12 replaces
+  void sws_yuyv_nv12(benchmark::State &state) {
+    auto [width, height] = sizes[state.range(0)];
+    auto image = make_image(width / 2, height);
+
+    sws_t sws {sws_getContext(width, height, AV_PIX_FMT_YUYV422, width, height, AV_PIX_FMT_NV12, SWS_LANCZOS | SWS_ACCURATE_RND, nullptr, nullptr, nullptr)};
+    if (!sws) {
+      state.SkipWithError("Couldn't create the libswscale context");
+      return;
+    }
+
+    std::vector<std::uint8_t> y(width * height), uv(width * height / 2);
+    const std::uint8_t *src[] {image.data()};
+    int src_pitches[] {width * 2};
+    std::uint8_t *planes[] {y.data(), uv.data()};
+    int pitches[] {width, width};
+
+    for (auto _ : state) {
+      sws_scale(sws.get(), src, src_pitches, 0, height, planes, pitches);
+      benchmark::ClobberMemory();
+    }
+
+    state.SetItemsProcessed(state.iterations() * width * height);
+  }
+
+  BENCHMARK(sws_yuyv_nv12)->DenseRange(0, std::size(sizes) - 1);
+}  // namespace
@@ -176,7 +176,47 @@ if(${SUNSHINE_ENABLE_PICAMERA})
     add_compile_definitions(SUNSHINE_BUILD_PICAMERA)
     list(APPEND PLATFORM_TARGET_FILES
             "${CMAKE_SOURCE_DIR}/src/platform/linux/picamera_capture.h"
-            "${CMAKE_SOURCE_DIR}/src/platform/linux/picamera_capture.cpp")
+            "${CMAKE_SOURCE_DIR}/src/platform/linux/picamera_capture.cpp"
+            "${CMAKE_SOURCE_DIR}/src/platform/linux/frame_tap.h"
+            "${CMAKE_SOURCE_DIR}/src/platform/linux/frame_tap.cpp"
+            "${CMAKE_SOURCE_DIR}/src/platform/linux/picamera_composite.h"
+            "${CMAKE_SOURCE_DIR}/src/platform/linux/picamera_composite.cpp"
+            "${CMAKE_SOURCE_DIR}/src/platform/linux/v4l2.h"
+            "${CMAKE_SOURCE_DIR}/src/platform/linux/v4l2.cpp")
+
+    # libcamera
+    if(${SUNSHINE_ENABLE_LIBCAMERA})
+        pkg_check_modules(LIBCAMERA libcamera)
+    else()
+        set(LIBCAMERA_FOUND OFF)
+    endif()
+    if(LIBCAMERA_FOUND)
+        add_compile_definitions(SUNSHINE_BUILD_LIBCAMERA)
+        include_directories(SYSTEM ${LIBCAMERA_INCLUDE_DIRS})
+        list(APPEND PLATFORM_LIBRARIES ${LIBCAMERA_LIBRARIES})
+        list(APPEND PLATFORM_TARGET_FILES
+                "${CMAKE_SOURCE_DIR}/src/platform/linux/libcamera_capture.h"
+                "${CMAKE_SOURCE_DIR}/src/platform/linux/libcamera_capture.cpp")
+    else()
+        message(STATUS "libcamera not found, CSI cameras are captured through V4L2 only")
+    endif()
+endif()
+
+# pipewire
+if(${SUNSHINE_ENABLE_PIPEWIRE})
+    pkg_check_modules(PIPEWIRE libpipewire-0.3)
+else()
+    set(PIPEWIRE_FOUND OFF)
+endif()
+if(PIPEWIRE_FOUND)
+    add_compile_definitions(SUNSHINE_BUILD_PIPEWIRE)
+    include_directories(SYSTEM ${PIPEWIRE_INCLUDE_DIRS})
+    list(APPEND PLATFORM_LIBRARIES ${PIPEWIRE_LIBRARIES})
+    list(APPEND PLATFORM_TARGET_FILES
+            "${CMAKE_SOURCE_DIR}/src/platform/linux/pipewire.h"
+            "${CMAKE_SOURCE_DIR}/src/platform/linux/pipewire.cpp")
+else()
+    message(STATUS "PipeWire not found, audio is captured through PulseAudio only")
 endif()
 
 # tray icon
@@ -224,7 +264,9 @@ list(APPEND SUNSHINE_EXTERNAL_LIBRARIES inputtino::libinputtino)
 file(GLOB_RECURSE INPUTTINO_SOURCES
         ${CMAKE_SOURCE_DIR}/src/platform/linux/input/inputtino*.h
         ${CMAKE_SOURCE_DIR}/src/platform/linux/input/inputtino*.cpp)
-list(APPEND PLATFORM_TARGET_FILES ${INPUTTINO_SOURCES})
+list(APPEND PLATFORM_TARGET_FILES ${INPUTTINO_SOURCES}
+        "${CMAKE_SOURCE_DIR}/src/platform/linux/input/actuator.h"
+        "${CMAKE_SOURCE_DIR}/src/platform/linux/input/actuator.cpp")
 
 # build libevdev before the libinputtino target
 if(EXTERNAL_PROJECT_LIBEVDEV_USED)
@@ -241,10 +283,14 @@ endif ()
 
 list(APPEND PLATFORM_TARGET_FILES
         "${CMAKE_SOURCE_DIR}/src/platform/linux/publish.cpp"
+        "${CMAKE_SOURCE_DIR}/src/platform/linux/mdns.h"
+        "${CMAKE_SOURCE_DIR}/src/platform/linux/mdns.cpp"
         "${CMAKE_SOURCE_DIR}/src/platform/linux/graphics.h"
         "${CMAKE_SOURCE_DIR}/src/platform/linux/graphics.cpp"
         "${CMAKE_SOURCE_DIR}/src/platform/linux/misc.h"
         "${CMAKE_SOURCE_DIR}/src/platform/linux/misc.cpp"
+        "${CMAKE_SOURCE_DIR}/src/platform/linux/uring.h"
+        "${CMAKE_SOURCE_DIR}/src/platform/linux/uring.cpp"
         "${CMAKE_SOURCE_DIR}/src/platform/linux/audio.cpp"
         "${CMAKE_SOURCE_DIR}/third-party/glad/src/egl.c"
         "${CMAKE_SOURCE_DIR}/third-party/glad/src/gl.c"
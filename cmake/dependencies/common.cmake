@@ -50,6 +50,7 @@ if(NOT DEFINED FFMPEG_PREPARED_BINARIES)
                 "${FFMPEG_PREPARED_BINARIES}/lib/libhdr10plus.a")
     endif()
     set(FFMPEG_LIBRARIES
+            "${FFMPEG_PREPARED_BINARIES}/lib/libavformat.a"
             "${FFMPEG_PREPARED_BINARIES}/lib/libavcodec.a"
             "${FFMPEG_PREPARED_BINARIES}/lib/libswscale.a"
             "${FFMPEG_PREPARED_BINARIES}/lib/libavutil.a"
@@ -61,6 +62,7 @@ if(NOT DEFINED FFMPEG_PREPARED_BINARIES)
             ${FFMPEG_PLATFORM_LIBRARIES})
 else()
     set(FFMPEG_LIBRARIES
+        "${FFMPEG_PREPARED_BINARIES}/lib/libavformat.a"
         "${FFMPEG_PREPARED_BINARIES}/lib/libavcodec.a"
         "${FFMPEG_PREPARED_BINARIES}/lib/libswscale.a"
         "${FFMPEG_PREPARED_BINARIES}/lib/libavutil.a"
@@ -9,6 +9,8 @@ set(SUNSHINE_PUBLISHER_ISSUE_URL "https://app.lizardbyte.dev/support"
 
 option(BUILD_DOCS "Build documentation" ON)
 option(BUILD_TESTS "Build tests" ON)
+option(BUILD_BENCHMARKS "Build the micro-benchmarks of the hot paths." OFF)
+option(BUILD_FUZZERS "Build the libFuzzer harnesses of the protocol parsers, requires Clang." OFF)
 option(NPM_OFFLINE "Use offline npm packages. You must ensure packages are in your npm cache." OFF)
 
 option(BUILD_WERROR "Enable -Werror flag." OFF)
@@ -18,6 +20,8 @@ option(SUNSHINE_CONFIGURE_ONLY "Configure special files only, then exit." OFF)
 
 option(SUNSHINE_ENABLE_TRAY "Enable system tray icon." ON)
 
+option(SUNSHINE_ENABLE_VERBOSE_LOG "Keep verbose log messages in non-debug builds." OFF)
+
 option(SUNSHINE_SYSTEM_WAYLAND_PROTOCOLS "Use system installation of wayland-protocols rather than the submodule." OFF)
 
 if(APPLE)
@@ -66,4 +70,8 @@ elseif(UNIX)  # Linux
             "Enable X11 grab if available." ON)
     option(SUNSHINE_ENABLE_PICAMERA
             "Enable Raspberry Pi camera capture backend." ON)
+    option(SUNSHINE_ENABLE_LIBCAMERA
+            "Enable capturing CSI cameras through libcamera if available." ON)
+    option(SUNSHINE_ENABLE_PIPEWIRE
+            "Enable native PipeWire audio capture if available." ON)
 endif()
@@ -0,0 +1,76 @@
+/**
+ * @file fuzz/fuzz_control.cpp
+ * @brief Fuzz the decryption of encrypted control stream messages.
+ */
+// standard includes
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+// local includes
+#include <src/crypto.h>
+
+namespace stream {
+  int decrypt_control(crypto::cipher::gcm_t &cipher, crypto::aes_t &iv, bool v2, const std::string_view &message, std::vector<uint8_t> &plaintext);
+}  // namespace stream
+
+namespace {
+  // A message of the encrypted control stream, starting with its type
+  constexpr std::size_t HEADER_SIZE = 2 + 2 + 4;
+}  // namespace
+
+extern "C" int LLVMFuzzerTestOneInput(const std::uint8_t *data, std::size_t size) {
+  if (size < 1) {
+    return 0;
+  }
+
+  // The first byte picks the IV construction and whether the rest is sealed with the key of the session
+  auto v2 = data[0] & 0x1;
+  auto seal = data[0] & 0x2;
+  std::string_view input {(const char *) data + 1, size - 1};
+
+  static crypto::cipher::gcm_t cipher {crypto::aes_t(16, 0x42), false};
+  static crypto::aes_t iv;
+  static std::vector<uint8_t> plaintext;
+
+  if (!seal) {
+    // Anything off the wire, nearly always rejected by its length or its tag
+    stream::decrypt_control(cipher, iv, v2, input, plaintext);
+    return 0;
+  }
+
+  // A message the client encrypted, to get past the tag with a payload of any length
+  std::vector<std::uint8_t> message(HEADER_SIZE + crypto::cipher::round_to_pkcs7_padded(input.size()) + crypto::cipher::tag_size);
+
+  std::uint32_t seq = input.size();
+  if (v2) {
+    iv.assign(12, 0);
+    std::copy_n((std::uint8_t *) &seq, sizeof(seq), std::begin(iv));
+    iv[10] = 'C';
+    iv[11] = 'C';
+  } else {
+    iv.assign(16, 0);
+    iv[0] = (std::uint8_t) seq;
+  }
+
+  auto bytes = cipher.encrypt(input, message.data() + HEADER_SIZE, &iv);
+  if (bytes < 0) {
+    return 0;
+  }
+
+  // The length in the header counts the sequence number and the tag along with the cipher
+  if ((std::size_t) bytes + crypto::cipher::tag_size + sizeof(seq) > UINT16_MAX) {
+    return 0;
+  }
+  std::uint16_t length = bytes + crypto::cipher::tag_size + sizeof(seq);
+
+  message[0] = 0x01;
+  message[1] = 0x00;
+  std::copy_n((std::uint8_t *) &length, sizeof(length), &message[2]);
+  std::copy_n((std::uint8_t *) &seq, sizeof(seq), &message[4]);
+
+  stream::decrypt_control(cipher, iv, v2, std::string_view {(const char *) message.data(), HEADER_SIZE - sizeof(seq) + length}, plaintext);
+  return 0;
+}
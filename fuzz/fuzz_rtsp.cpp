@@ -0,0 +1,38 @@
+/**
+ * @file fuzz/fuzz_rtsp.cpp
+ * @brief Fuzz the RTSP parser and the SDP attributes of an ANNOUNCE request.
+ */
+extern "C" {
+#include <moonlight-common-c/src/Limelight-internal.h>
+#include <moonlight-common-c/src/Rtsp.h>
+}
+
+// standard includes
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace rtsp_stream {
+  std::unordered_map<std::string_view, std::string_view> parse_sdp(const std::string_view &payload, std::string_view &client);
+}  // namespace rtsp_stream
+
+extern "C" int LLVMFuzzerTestOneInput(const std::uint8_t *data, std::size_t size) {
+  // The parser takes a mutable buffer, a copy keeps reads past the input visible to the sanitizer
+  std::vector<char> message {(const char *) data, (const char *) data + size};
+
+  RTSP_MESSAGE msg {};
+  if (parseRtspMessage(&msg, message.data(), (int) message.size())) {
+    return 0;
+  }
+
+  // Whatever the request, its payload is what cmd_announce would parse
+  if (msg.payload) {
+    std::string_view client;
+    rtsp_stream::parse_sdp(std::string_view {msg.payload, (std::size_t) msg.payloadLength}, client);
+  }
+
+  freeMessage(&msg);
+  return 0;
+}
@@ -167,12 +167,14 @@ function add_arch_deps() {
     'git'
     'graphviz'
     'libayatana-appindicator'
+    'libcamera'
     'libcap'
     'libdrm'
     'libevdev'
     'libmfx'
     'libnotify'
     'libpulse'
+    'pipewire'
     'libva'
     'libx11'
     'libxcb'
@@ -218,6 +220,7 @@ function add_debian_based_deps() {
     "g++-${gcc_version}"
     "git"
     "graphviz"
+    "libcamera-dev"  # PiCamera
     "libcap-dev"  # KMS
     "libcurl4-openssl-dev"
     "libdrm-dev"  # KMS
@@ -227,12 +230,14 @@ function add_debian_based_deps() {
     "libnotify-dev"
     "libnuma-dev"
     "libopus-dev"
+    "libpipewire-0.3-dev"
     "libpulse-dev"
     "libssl-dev"
     "libsystemd-dev"
     "libudev-dev"
     "libwayland-dev"  # Wayland
     "libx11-dev"  # X11
+    "libxcb-damage0-dev"  # X11
     "libxcb-shm0-dev"  # X11
     "libxcb-xfixes0-dev"  # X11
     "libxcb1-dev"  # X11
@@ -290,6 +295,7 @@ function add_fedora_deps() {
     "graphviz"
     "libappindicator-gtk3-devel"
     "libappstream-glib"
+    "libcamera-devel"  # PiCamera
     "libcap-devel"
     "libcurl-devel"
     "libdrm-devel"
@@ -311,6 +317,7 @@ function add_fedora_deps() {
     "numactl-devel"
     "openssl-devel"
     "opus-devel"
+    "pipewire-devel"
     "pulseaudio-libs-devel"
     "rpm-build"  # if you want to build an RPM binary package
     "wget"  # necessary for cuda install with `run` file
@@ -3,6 +3,12 @@
  * @brief Definitions for audio capture and encoding.
  */
 // standard includes
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <sstream>
 #include <thread>
 
 // lib includes
@@ -13,14 +19,26 @@
 #include "config.h"
 #include "globals.h"
 #include "logging.h"
+#include "memory_budget.h"
+#include "metrics.h"
 #include "platform/common.h"
+#include "stat_trackers.h"
 #include "thread_safe.h"
 #include "utility.h"
 
 namespace audio {
   using namespace std::literals;
   using opus_t = util::safe_ptr<OpusMSEncoder, opus_multistream_encoder_destroy>;
-  using sample_queue_t = std::shared_ptr<safe::queue_t<std::vector<float>>>;
+
+  /**
+   * @brief A captured frame and when its first sample was captured.
+   */
+  struct sample_frame_t {
+    std::vector<float> samples;
+    std::chrono::steady_clock::time_point capture_timestamp;
+  };
+
+  using sample_ring_t = std::shared_ptr<safe::ring_t<sample_frame_t>>;
 
   static int start_audio_control(audio_ctx_t &ctx);
   static void stop_audio_control(audio_ctx_t &);
@@ -30,6 +48,27 @@ namespace audio {
 
   constexpr auto SAMPLE_RATE = 48000;
 
+  // Captured frames that can wait for the encoder before new frames are dropped
+  constexpr auto SAMPLE_FRAMES = 32;
+
+  // Encoded packets that can be in flight before new packets are allocated
+  constexpr auto PACKET_BUFFERS = 32;
+  constexpr auto MAX_PACKET_SIZE = 1400;
+
+  constexpr auto MAX_COMPLEXITY = 10;
+
+  // Share of each packet's duration that encoding may take before complexity is lowered
+  constexpr auto HIGH_ENCODE_LOAD = 0.25;
+
+  // Share below which encoding counts as cheap enough to raise complexity
+  constexpr auto LOW_ENCODE_LOAD = 0.1;
+
+  // Encode load is averaged over this long
+  constexpr auto ENCODE_LOAD_WINDOW = 1s;
+
+  // Cheap windows in a row before complexity goes up
+  constexpr auto CALM_WINDOWS = 5;
+
   // NOTE: If you adjust the bitrates listed here, make sure to update the
   // corresponding bitrate adjustment logic in rtsp_stream::cmd_announce()
   opus_stream_config_t stream_configs[MAX_STREAM_CONFIG] {
@@ -40,6 +79,7 @@ namespace audio {
       1,
       platf::speaker::map_stereo,
       96000,
+      10,
     },
     {
       SAMPLE_RATE,
@@ -48,6 +88,7 @@ namespace audio {
       1,
       platf::speaker::map_stereo,
       512000,
+      10,
     },
     {
       SAMPLE_RATE,
@@ -56,6 +97,7 @@ namespace audio {
       2,
       platf::speaker::map_surround51,
       256000,
+      8,
     },
     {
       SAMPLE_RATE,
@@ -64,6 +106,7 @@ namespace audio {
       0,
       platf::speaker::map_surround51,
       1536000,
+      8,
     },
     {
       SAMPLE_RATE,
@@ -72,6 +115,7 @@ namespace audio {
       3,
       platf::speaker::map_surround71,
       450000,
+      6,
     },
     {
       SAMPLE_RATE,
@@ -80,63 +124,234 @@ namespace audio {
       0,
       platf::speaker::map_surround71,
       2048000,
+      6,
     },
   };
 
-  void encodeThread(sample_queue_t samples, config_t config, void *channel_data) {
-    auto packets = mail::man->queue<packet_t>(mail::audio_packets);
+  /**
+   * @brief Capture and encoding shared by every session streaming the same audio configuration.
+   * Encryption and RTP sequencing stay per session, in the broadcast thread.
+   */
+  struct pipeline_t {
+    config_t config;
+
+    // Raised once the last session is gone
+    std::shared_ptr<safe::event_t<bool>> shutdown_event = std::make_shared<safe::event_t<bool>>();
+    std::thread thread;
+
+    // channel_data of the sessions each packet goes to
+    std::mutex subscribers_lock;
+    std::vector<void *> subscribers;
+
+    // Loss the client of each subscriber is expected to see, the encoder is tuned for the lossiest of them
+    std::map<void *, int> expected_loss;
+    std::atomic<int> loss_percentage {0};
+
+    // Written by the encode thread, read by encode_stats()
+    std::mutex stats_lock;
+    encode_stats_t stats {};
+  };
+
+  static std::mutex pipelines_lock;
+  static std::map<std::string, std::shared_ptr<pipeline_t>> pipelines;
+
+  /**
+   * @brief Sessions can share a pipeline if everything that changes the captured or encoded audio matches.
+   */
+  static std::string pipeline_key(const config_t &config) {
+    std::stringstream ss;
+    ss << config.packetDuration << '/' << config.channels << '/' << config.flags.to_string();
+
+    if (config.flags[config_t::CUSTOM_SURROUND_PARAMS]) {
+      auto &params = config.customStreamParams;
+      ss << '/' << params.channelCount << '/' << params.streams << '/' << params.coupledStreams;
+      for (int x = 0; x < params.channelCount; ++x) {
+        ss << ',' << (int) params.mapping[x];
+      }
+    }
+
+    return ss.str();
+  }
+
+  /**
+   * @brief Tune the encoder of a pipeline for the lossiest of its subscribers.
+   * @note The caller holds subscribers_lock.
+   */
+  static void update_loss_percentage(pipeline_t &pipeline) {
+    int loss_percentage = 0;
+    for (auto &[subscriber, expected_loss] : pipeline.expected_loss) {
+      loss_percentage = std::max(loss_percentage, expected_loss);
+    }
+    pipeline.loss_percentage = loss_percentage;
+  }
+
+  static buffer_t take_packet_buffer(buffer_pool_t::element_type &packet_pool) {
+    if (packet_pool.peek()) {
+      auto packet = std::move(*packet_pool.pop());
+      packet.fake_resize(MAX_PACKET_SIZE);
+      return packet;
+    }
+
+    return buffer_t {MAX_PACKET_SIZE};
+  }
+
+  static opus_stream_config_t stream_config(const config_t &config) {
     auto stream = stream_configs[map_stream(config.channels, config.flags[config_t::HIGH_QUALITY])];
     if (config.flags[config_t::CUSTOM_SURROUND_PARAMS]) {
       apply_surround_params(stream, config.customStreamParams);
     }
 
-    // Encoding takes place on this thread
-    platf::adjust_thread_priority(platf::thread_priority_e::high);
-
-    opus_t opus {opus_multistream_encoder_create(
-      stream.sampleRate,
-      stream.channelCount,
-      stream.streams,
-      stream.coupledStreams,
-      stream.mapping,
-      OPUS_APPLICATION_RESTRICTED_LOWDELAY,
-      nullptr
-    )};
+    return stream;
+  }
 
-    opus_multistream_encoder_ctl(opus.get(), OPUS_SET_BITRATE(stream.bitrate));
-    opus_multistream_encoder_ctl(opus.get(), OPUS_SET_VBR(0));
+  /**
+   * @brief The Opus encoder of a pipeline, it hands each encoded packet to the sessions subscribed to the pipeline.
+   * Either the encode thread or, with audio_inline_encode, the capture thread owns it.
+   */
+  class encoder_t {
+  public:
+    explicit encoder_t(pipeline_t *pipeline):
+        pipeline {pipeline},
+        stream {stream_config(pipeline->config)},
+        adaptive_complexity {config::audio.opus_complexity < 0},
+        complexity_controller {adaptive_complexity ? stream.complexity : config::audio.opus_complexity, std::chrono::milliseconds {pipeline->config.packetDuration}},
+        frame_size {pipeline->config.packetDuration * stream.sampleRate / 1000} {
+      opus.reset(opus_multistream_encoder_create(
+        stream.sampleRate,
+        stream.channelCount,
+        stream.streams,
+        stream.coupledStreams,
+        stream.mapping,
+        OPUS_APPLICATION_RESTRICTED_LOWDELAY,
+        nullptr
+      ));
+
+      // A configured complexity is used as is, otherwise the profile's complexity follows the encode time
+      auto complexity = adaptive_complexity ? stream.complexity : config::audio.opus_complexity;
+
+      opus_multistream_encoder_ctl(opus.get(), OPUS_SET_BITRATE(stream.bitrate));
+      opus_multistream_encoder_ctl(opus.get(), OPUS_SET_VBR(0));
+      opus_multistream_encoder_ctl(opus.get(), OPUS_SET_COMPLEXITY(complexity));
+
+      BOOST_LOG(info) << "Opus initialized: "sv << stream.sampleRate / 1000 << " kHz, "sv
+                      << stream.channelCount << " channels, "sv
+                      << stream.bitrate / 1000 << " kbps (total), complexity "sv
+                      << complexity << (adaptive_complexity ? " (adaptive)"sv : ""sv) << ", LOWDELAY"sv;
+
+      std::lock_guard lg {pipeline->stats_lock};
+      pipeline->stats.complexity = complexity;
+    }
 
-    BOOST_LOG(info) << "Opus initialized: "sv << stream.sampleRate / 1000 << " kHz, "sv
-                    << stream.channelCount << " channels, "sv
-                    << stream.bitrate / 1000 << " kbps (total), LOWDELAY"sv;
+    /**
+     * @brief Encode a captured frame and queue the packet for every subscriber.
+     * @param sample The frame, it can be reused once this returns.
+     * @return `false` if Opus failed, the audio packets are stopped then.
+     */
+    bool encode(const sample_frame_t &sample) {
+      if (auto next = pipeline->loss_percentage.load(); next != loss_percentage) {
+        loss_percentage = next;
+        opus_multistream_encoder_ctl(opus.get(), OPUS_SET_PACKET_LOSS_PERC(loss_percentage));
+        BOOST_LOG(debug) << "Opus expected packet loss changed to "sv << loss_percentage << '%';
+
+        std::lock_guard lg {pipeline->stats_lock};
+        pipeline->stats.loss_percentage = loss_percentage;
+      }
 
-    auto frame_size = config.packetDuration * stream.sampleRate / 1000;
-    while (auto sample = samples->pop()) {
-      buffer_t packet {1400};
+      auto packet = take_packet_buffer(*packet_pool);
 
-      int bytes = opus_multistream_encode_float(opus.get(), sample->data(), frame_size, std::begin(packet), packet.size());
+      auto encode_start = std::chrono::steady_clock::now();
+      int bytes = opus_multistream_encode_float(opus.get(), sample.samples.data(), frame_size, std::begin(packet), packet.size());
       if (bytes < 0) {
         BOOST_LOG(error) << "Couldn't encode audio: "sv << opus_strerror(bytes);
         packets->stop();
 
-        return;
+        return false;
+      }
+      auto encode_time = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - encode_start);
+      metrics::add(metrics::counter_e::audio_packets_encoded);
+      metrics::add(metrics::counter_e::audio_encode_us, encode_time.count());
+
+      encode_time_tracker.collect_and_callback_on_interval(encode_time.count(), [&](std::int64_t stat_min, std::int64_t stat_max, double stat_avg) {
+        std::lock_guard lg {pipeline->stats_lock};
+        pipeline->stats.encode_us_min = stat_min;
+        pipeline->stats.encode_us_max = stat_max;
+        pipeline->stats.encode_us_avg = stat_avg;
+      }, 1s);
+
+      if (adaptive_complexity && complexity_controller.collect(encode_time)) {
+        auto reduced_bandwidth = complexity_controller.reduced_bandwidth();
+        opus_multistream_encoder_ctl(opus.get(), OPUS_SET_COMPLEXITY(complexity_controller.complexity()));
+        opus_multistream_encoder_ctl(opus.get(), OPUS_SET_MAX_BANDWIDTH(reduced_bandwidth ? OPUS_BANDWIDTH_SUPERWIDEBAND : OPUS_BANDWIDTH_FULLBAND));
+
+        BOOST_LOG(info) << "Opus complexity changed to "sv << complexity_controller.complexity()
+                        << (reduced_bandwidth ? ", bandwidth reduced to superwideband"sv : ""sv);
+
+        std::lock_guard lg {pipeline->stats_lock};
+        pipeline->stats.complexity = complexity_controller.complexity();
+        pipeline->stats.reduced_bandwidth = reduced_bandwidth;
       }
 
       packet.fake_resize(bytes);
-      packets->raise(channel_data, std::move(packet));
-    }
-  }
 
-  void capture(safe::mail_t mail, config_t config, void *channel_data) {
-    auto shutdown_event = mail->event<bool>(mail::shutdown);
-    if (!config::audio.stream) {
-      shutdown_event->view();
-      return;
+      std::lock_guard lg {pipeline->subscribers_lock};
+
+      // Every other session gets a copy, the first one takes the encoded packet
+      for (std::size_t x = 1; x < pipeline->subscribers.size(); ++x) {
+        auto copy = take_packet_buffer(*packet_pool);
+        std::copy(std::begin(packet), std::end(packet), std::begin(copy));
+        copy.fake_resize(bytes);
+
+        packets->raise(pipeline->subscribers[x], packet_buffer_t {std::move(copy), packet_pool, sample.capture_timestamp});
+      }
+
+      if (!pipeline->subscribers.empty()) {
+        packets->raise(pipeline->subscribers.front(), packet_buffer_t {std::move(packet), packet_pool, sample.capture_timestamp});
+      }
+
+      return true;
     }
-    auto stream = stream_configs[map_stream(config.channels, config.flags[config_t::HIGH_QUALITY])];
-    if (config.flags[config_t::CUSTOM_SURROUND_PARAMS]) {
-      apply_surround_params(stream, config.customStreamParams);
+
+  private:
+    pipeline_t *pipeline;
+    opus_stream_config_t stream;
+
+    bool adaptive_complexity;
+    complexity_controller_t complexity_controller;
+    stat_trackers::min_max_avg_tracker<std::int64_t> encode_time_tracker;
+
+    int frame_size;
+
+    opus_t opus;
+    safe::mail_raw_t::queue_t<packet_t> packets = mail::man->queue<packet_t>(mail::audio_packets);
+
+    // Expected loss makes CELT lean less on the previous packets, so a lost packet is concealed with fewer artifacts.
+    // In-band FEC would need SILK, which the low delay application never uses.
+    int loss_percentage = 0;
+
+    // The broadcast thread hands the buffers back once the packets are sent
+    std::shared_ptr<buffer_pool_t::element_type> packet_pool = std::make_shared<buffer_pool_t::element_type>(PACKET_BUFFERS);
+  };
+
+  void encodeThread(sample_ring_t samples, sample_ring_t free_samples, pipeline_t *pipeline) {
+    // Encoding takes place on this thread
+    platf::set_thread_name("audio_encode"s);
+    platf::adjust_thread_priority(platf::thread_priority_e::high);
+
+    encoder_t encoder {pipeline};
+    while (auto sample = samples->pop()) {
+      if (!encoder.encode(*sample)) {
+        return;
+      }
+
+      free_samples->raise(std::move(*sample));
     }
+  }
+
+  static void capturePipeline(pipeline_t *pipeline) {
+    auto &config = pipeline->config;
+    auto &shutdown_event = pipeline->shutdown_event;
+
+    auto stream = stream_config(config);
 
     auto ref = get_audio_ctx_ref();
     if (!ref) {
@@ -203,25 +418,60 @@ namespace audio {
     init_failure_fg.disable();
 
     // Capture takes place on this thread
+    platf::set_thread_name("audio_capture"s);
     platf::adjust_thread_priority(platf::thread_priority_e::critical);
 
-    auto samples = std::make_shared<sample_queue_t::element_type>(30);
-    std::thread thread {encodeThread, samples, config, channel_data};
+    int samples_per_frame = frame_size * stream.channelCount;
+
+    // Encoding inline leaves out the hand-off to the encode thread, each frame is encoded into the one it was captured into
+    std::optional<encoder_t> inline_encoder;
+    sample_frame_t frame;
+
+    sample_ring_t samples;
+    sample_ring_t free_samples;
+    std::int64_t samples_footprint = 0;
+    std::thread thread;
+    if (config::audio.inline_encode) {
+      inline_encoder.emplace(pipeline);
+      frame.samples.resize(samples_per_frame);
+    } else {
+      // Frames go to the encoder through samples and come back through free_samples,
+      // so capture doesn't allocate once the stream is running.
+      auto sample_frames = memory_budget::buffers(memory_budget::subsystem_e::audio_samples, samples_per_frame * sizeof(float), 4, SAMPLE_FRAMES);
+      samples = std::make_shared<sample_ring_t::element_type>(sample_frames);
+      free_samples = std::make_shared<sample_ring_t::element_type>(sample_frames);
+      for (std::size_t x = 0; x < sample_frames; ++x) {
+        free_samples->raise(sample_frame_t {std::vector<float>(samples_per_frame)});
+      }
+      samples_footprint = (std::int64_t) (sample_frames * samples_per_frame * sizeof(float));
+      memory_budget::account(memory_budget::subsystem_e::audio_samples, samples_footprint);
+
+      thread = std::thread {encodeThread, samples, free_samples, pipeline};
+    }
 
     auto fg = util::fail_guard([&]() {
-      samples->stop();
-      thread.join();
+      if (thread.joinable()) {
+        samples->stop();
+        thread.join();
+        memory_budget::account(memory_budget::subsystem_e::audio_samples, -samples_footprint);
+      }
 
       shutdown_event->view();
     });
 
-    int samples_per_frame = frame_size * stream.channelCount;
+    // Captured into while every frame is waiting for the encoder, and then dropped
+    std::vector<float> overflow_buffer(samples_per_frame);
+
+    // Backends don't expose the device clock, sample() returns as soon as the last sample of the frame arrived
+    auto frame_duration = std::chrono::milliseconds {config.packetDuration};
 
     while (!shutdown_event->peek()) {
-      std::vector<float> sample_buffer;
-      sample_buffer.resize(samples_per_frame);
+      if (frame.samples.empty() && free_samples->peek()) {
+        frame = std::move(*free_samples->pop());
+      }
 
-      auto status = mic->sample(sample_buffer);
+      bool dropped = frame.samples.empty();
+      auto status = mic->sample(dropped ? overflow_buffer : frame.samples);
       switch (status) {
         case platf::capture_e::ok:
           break;
@@ -241,7 +491,139 @@ namespace audio {
           return;
       }
 
-      samples->raise(std::move(sample_buffer));
+      if (dropped) {
+        continue;
+      }
+
+      frame.capture_timestamp = std::chrono::steady_clock::now() - frame_duration;
+      if (!inline_encoder) {
+        samples->raise(std::move(frame));
+      } else if (!inline_encoder->encode(frame)) {
+        return;
+      }
+    }
+  }
+
+  void capture(safe::mail_t mail, config_t config, void *channel_data) {
+    auto shutdown_event = mail->event<bool>(mail::shutdown);
+    if (!config::audio.stream) {
+      shutdown_event->view();
+      return;
+    }
+
+    auto key = pipeline_key(config);
+
+    std::shared_ptr<pipeline_t> pipeline;
+    {
+      std::lock_guard lg {pipelines_lock};
+
+      auto &shared = pipelines[key];
+      if (!shared) {
+        shared = std::make_shared<pipeline_t>();
+        shared->config = config;
+        shared->thread = std::thread {capturePipeline, shared.get()};
+      }
+      pipeline = shared;
+
+      std::lock_guard subscribers_lg {pipeline->subscribers_lock};
+      pipeline->subscribers.emplace_back(channel_data);
+      if (pipeline->subscribers.size() > 1) {
+        BOOST_LOG(info) << "Sharing audio stream ["sv << key << "] between "sv << pipeline->subscribers.size() << " sessions"sv;
+      }
+    }
+
+    shutdown_event->view();
+
+    std::lock_guard lg {pipelines_lock};
+    {
+      std::lock_guard subscribers_lg {pipeline->subscribers_lock};
+      std::erase(pipeline->subscribers, channel_data);
+      if (pipeline->expected_loss.erase(channel_data)) {
+        update_loss_percentage(*pipeline);
+      }
+      if (!pipeline->subscribers.empty()) {
+        return;
+      }
+    }
+
+    // A new session with this configuration has to wait for the old sink to be released
+    pipelines.erase(key);
+    pipeline->shutdown_event->raise(true);
+    pipeline->thread.join();
+  }
+
+  complexity_controller_t::complexity_controller_t(int complexity, std::chrono::microseconds packet_duration):
+      packet_duration {packet_duration},
+      level {std::clamp(complexity, 0, MAX_COMPLEXITY)},
+      packets_per_window {(int) std::max<std::int64_t>(1, std::chrono::microseconds {ENCODE_LOAD_WINDOW} / packet_duration)} {
+  }
+
+  bool complexity_controller_t::collect(std::chrono::microseconds encode_time) {
+    total_encode_time += encode_time;
+    if (++packets < packets_per_window) {
+      return false;
+    }
+
+    auto load = (double) total_encode_time.count() / (packets * packet_duration.count());
+    packets = 0;
+    total_encode_time = {};
+
+    if (load < LOW_ENCODE_LOAD) {
+      if (level < MAX_COMPLEXITY && ++calm_windows >= CALM_WINDOWS) {
+        calm_windows = 0;
+        ++level;
+        return true;
+      }
+
+      return false;
+    }
+
+    calm_windows = 0;
+    if (load > HIGH_ENCODE_LOAD && level >= 0) {
+      // Back off faster than we recover, a late packet is an audible gap
+      level = level > 0 ? std::max(level - 2, 0) : -1;
+      return true;
+    }
+
+    return false;
+  }
+
+  int complexity_controller_t::complexity() const {
+    return std::max(level, 0);
+  }
+
+  bool complexity_controller_t::reduced_bandwidth() const {
+    return level < 0;
+  }
+
+  std::optional<encode_stats_t> encode_stats(void *channel_data) {
+    std::lock_guard lg {pipelines_lock};
+    for (auto &[key, pipeline] : pipelines) {
+      {
+        std::lock_guard subscribers_lg {pipeline->subscribers_lock};
+        if (std::find(std::begin(pipeline->subscribers), std::end(pipeline->subscribers), channel_data) == std::end(pipeline->subscribers)) {
+          continue;
+        }
+      }
+
+      std::lock_guard stats_lg {pipeline->stats_lock};
+      return pipeline->stats;
+    }
+
+    return std::nullopt;
+  }
+
+  void expect_loss(void *channel_data, int loss_percentage) {
+    std::lock_guard lg {pipelines_lock};
+    for (auto &[key, pipeline] : pipelines) {
+      std::lock_guard subscribers_lg {pipeline->subscribers_lock};
+      if (std::find(std::begin(pipeline->subscribers), std::end(pipeline->subscribers), channel_data) == std::end(pipeline->subscribers)) {
+        continue;
+      }
+
+      pipeline->expected_loss[channel_data] = std::clamp(loss_percentage, 0, 100);
+      update_loss_percentage(*pipeline);
+      return;
     }
   }
 
@@ -10,6 +10,8 @@
 #include "utility.h"
 
 #include <bitset>
+#include <chrono>
+#include <optional>
 
 namespace audio {
   enum stream_config_e : int {
@@ -29,6 +31,7 @@ namespace audio {
     int coupledStreams;
     const std::uint8_t *mapping;
     int bitrate;
+    int complexity;  ///< Opus complexity the encoder starts at, adjusted to the encode time unless it's configured
   };
 
   struct stream_params_t {
@@ -69,9 +72,114 @@ namespace audio {
   };
 
   using buffer_t = util::buffer_t<std::uint8_t>;
-  using packet_t = std::pair<void *, buffer_t>;
+  using buffer_pool_t = std::shared_ptr<safe::ring_t<buffer_t>>;
+
+  /**
+   * @brief An encoded audio packet, whose buffer goes back to the encoder's pool when it's destroyed.
+   * Copies own a buffer of their own and aren't returned to the pool.
+   */
+  class packet_buffer_t: public buffer_t {
+  public:
+    packet_buffer_t() = default;
+    packet_buffer_t(packet_buffer_t &&) noexcept = default;
+    packet_buffer_t &operator=(packet_buffer_t &&) noexcept = default;
+
+    packet_buffer_t(const packet_buffer_t &o):
+        buffer_t {o},
+        capture_timestamp {o.capture_timestamp} {
+    }
+
+    packet_buffer_t(buffer_t &&buffer, buffer_pool_t pool, std::chrono::steady_clock::time_point capture_timestamp):
+        buffer_t {std::move(buffer)},
+        capture_timestamp {capture_timestamp},
+        pool {std::move(pool)} {
+    }
+
+    ~packet_buffer_t() {
+      if (pool && begin()) {
+        // A full or stopped pool drops the buffer instead
+        pool->raise(std::move(*(buffer_t *) this));
+      }
+    }
+
+    std::chrono::steady_clock::time_point capture_timestamp;  ///< When the first sample of the packet was captured
+
+  private:
+    buffer_pool_t pool;
+  };
+
+  using packet_t = std::pair<void *, packet_buffer_t>;
   using audio_ctx_ref_t = safe::shared_t<audio_ctx_t>::ptr_t;
 
+  /**
+   * @brief Lowers the Opus complexity while encoding takes too large a share of each packet's duration.
+   * Once complexity can't go lower, the encoded bandwidth is reduced as well.
+   * Complexity goes up one step at a time, up to the Opus maximum of 10, once encoding has been cheap for a while.
+   */
+  class complexity_controller_t {
+  public:
+    /**
+     * @param complexity Complexity to start at.
+     * @param packet_duration Duration of the audio in each packet.
+     */
+    complexity_controller_t(int complexity, std::chrono::microseconds packet_duration);
+
+    /**
+     * @brief Account for the encoding of one packet.
+     * @param encode_time Time it took to encode the packet.
+     * @return `true` if complexity() or reduced_bandwidth() changed.
+     */
+    bool collect(std::chrono::microseconds encode_time);
+
+    int complexity() const;
+    bool reduced_bandwidth() const;
+
+  private:
+    std::chrono::microseconds packet_duration;
+
+    // Complexity, or -1 once the bandwidth is reduced as well
+    int level;
+
+    int packets_per_window;
+    int packets = 0;
+    std::chrono::microseconds total_encode_time {};
+    int calm_windows = 0;
+  };
+
+  /**
+   * @brief Snapshot of the Opus encoder a session receives audio from.
+   */
+  struct encode_stats_t {
+    std::int64_t encode_us_min;  ///< Time spent encoding each packet, over the last second
+    std::int64_t encode_us_max;
+    double encode_us_avg;
+    int complexity;
+    bool reduced_bandwidth;
+    int loss_percentage;  ///< Packet loss the encoder is tuned for
+  };
+
+  /**
+   * @brief Get the encoder statistics of the audio stream of a session.
+   * @param channel_data The channel_data the session passed to capture().
+   * @return The statistics, or std::nullopt if the session isn't receiving audio.
+   */
+  std::optional<encode_stats_t> encode_stats(void *channel_data);
+
+  /**
+   * @brief Tell the audio encoder of a session how much packet loss to expect on the way to its client.
+   * An encoder shared by several sessions is tuned for the lossiest of them.
+   * @param channel_data The channel_data the session passed to capture().
+   * @param loss_percentage Expected packet loss, 0 on a clean link.
+   */
+  void expect_loss(void *channel_data, int loss_percentage);
+
+  /**
+   * @brief Stream audio to a session until its shutdown event is raised.
+   * Sessions with the same audio configuration share a single capture and Opus encoder.
+   * @param mail The session's mail.
+   * @param config The audio configuration negotiated with the client.
+   * @param channel_data Tags the session's packets in the audio packet queue.
+   */
   void capture(safe::mail_t mail, config_t config, void *channel_data);
 
   /**
@@ -11,6 +11,12 @@ extern "C" {
 #include <libavutil/pixdesc.h>
 }
 
+// standard includes
+#include <map>
+#include <mutex>
+#include <string>
+#include <string_view>
+
 // local includes
 #include "cbs.h"
 #include "logging.h"
@@ -79,6 +85,84 @@ namespace cbs {
     return data;
   }
 
+  namespace {
+    /**
+     * @brief Find the parameter sets at the start of a packet, up to its first slice.
+     * @param packet The packet, in Annex B format.
+     * @param codec_id AV_CODEC_ID_H264 or AV_CODEC_ID_H265.
+     * @return The parameter sets, or the whole packet if it holds no slice.
+     */
+    std::string_view parameter_sets(const AVPacket *packet, AVCodecID codec_id) {
+      std::string_view data {(const char *) packet->data, (std::size_t) packet->size};
+
+      for (auto pos = data.find("\x00\x00\x01"sv); pos != std::string_view::npos && pos + 3 < data.size(); pos = data.find("\x00\x00\x01"sv, pos + 3)) {
+        auto header = (std::uint8_t) data[pos + 3];
+        auto type = codec_id == AV_CODEC_ID_H264 ? header & 0x1F : (header >> 1) & 0x3F;
+
+        // Slices are types 1 to 5 in H.264 and below 32 in HEVC
+        auto slice = codec_id == AV_CODEC_ID_H264 ? type >= 1 && type <= 5 : type < 32;
+        if (slice) {
+          // Leave the zero byte of a 4 byte start code out as well
+          return data.substr(0, pos > 0 && data[pos - 1] == 0 ? pos - 1 : pos);
+        }
+      }
+
+      return data;
+    }
+
+    /**
+     * @brief Read the parameter sets of a packet, without splitting the slices after them.
+     * @param ctx The context to read with.
+     * @param frag Receives the parameter sets.
+     * @param prefix The parameter sets, from parameter_sets().
+     * @return 0 on success, a negative AVERROR on failure.
+     */
+    int read_parameter_sets(cbs::ctx_t &ctx, cbs::frag_t &frag, std::string_view prefix) {
+      auto view = av_packet_alloc();
+      view->data = (std::uint8_t *) prefix.data();
+      view->size = (int) prefix.size();
+
+      // Without a buffer to reference, the data is copied into the fragment
+      auto err = ff_cbs_read_packet(ctx.get(), &frag, view);
+
+      view->data = nullptr;
+      view->size = 0;
+      av_packet_free(&view);
+
+      return err;
+    }
+
+    /**
+     * @brief Find the first unit of a type in a fragment.
+     * @return The content of the unit, or nullptr if the fragment holds none.
+     */
+    template<class T>
+    T *find_unit(cbs::frag_t &frag, CodedBitstreamUnitType type) {
+      for (int x = 0; x < frag.nb_units; ++x) {
+        if (frag.units[x].type == type) {
+          return (T *) frag.units[x].content;
+        }
+      }
+
+      return nullptr;
+    }
+
+    /**
+     * @brief Key the rewritten parameter sets by the ones the encoder emitted and what is written into them.
+     * Every session of an encoder configuration emits the same parameter sets, so only the first one has to rewrite them.
+     */
+    std::string cache_key(std::string_view prefix, const AVCodecContext *avctx) {
+      auto key = std::to_string(avctx->refs) + ':' + std::to_string(avctx->color_range) + ':' + std::to_string(avctx->color_primaries) + ':' +
+                 std::to_string(avctx->color_trc) + ':' + std::to_string(avctx->colorspace) + ':';
+      key.append(prefix);
+      return key;
+    }
+
+    std::mutex cache_mutex;
+    std::map<std::string, h264_t> h264_cache;
+    std::map<std::string, hevc_t> hevc_cache;
+  }  // namespace
+
   util::buffer_t<std::uint8_t> write(std::uint8_t nal, void *uh, AVCodecID codec_id) {
     cbs::ctx_t cbs_ctx;
     ff_cbs_init(&cbs_ctx, codec_id, nullptr);
@@ -87,6 +171,15 @@ namespace cbs {
   }
 
   h264_t make_sps_h264(const AVCodecContext *avctx, const AVPacket *packet) {
+    auto prefix = parameter_sets(packet, AV_CODEC_ID_H264);
+    auto key = cache_key(prefix, avctx);
+    {
+      std::lock_guard lock {cache_mutex};
+      if (auto cached = h264_cache.find(key); cached != std::end(h264_cache)) {
+        return cached->second;
+      }
+    }
+
     cbs::ctx_t ctx;
     if (ff_cbs_init(&ctx, AV_CODEC_ID_H264, nullptr)) {
       return {};
@@ -94,7 +187,7 @@ namespace cbs {
 
     cbs::frag_t frag;
 
-    int err = ff_cbs_read_packet(ctx.get(), &frag, packet);
+    int err = read_parameter_sets(ctx, frag, prefix);
     if (err < 0) {
       char err_str[AV_ERROR_MAX_STRING_SIZE] {0};
       BOOST_LOG(error) << "Couldn't read packet: "sv << av_make_error_string(err_str, AV_ERROR_MAX_STRING_SIZE, err);
@@ -102,7 +195,12 @@ namespace cbs {
       return {};
     }
 
-    auto sps_p = ((CodedBitstreamH264Context *) ctx->priv_data)->active_sps;
+    // No slice was read, so there is no active SPS to take
+    auto sps_p = find_unit<H264RawSPS>(frag, H264_NAL_SPS);
+    if (!sps_p) {
+      BOOST_LOG(error) << "Couldn't find the SPS in the IDR frame"sv;
+      return {};
+    }
 
     // This is a very large struct that cannot safely be stored on the stack
     auto sps = std::make_unique<H264RawSPS>(*sps_p);
@@ -136,13 +234,26 @@ namespace cbs {
     cbs::ctx_t write_ctx;
     ff_cbs_init(&write_ctx, AV_CODEC_ID_H264, nullptr);
 
-    return h264_t {
+    h264_t h264 {
       write(write_ctx, sps->nal_unit_header.nal_unit_type, (void *) &sps->nal_unit_header, AV_CODEC_ID_H264),
       write(ctx, sps_p->nal_unit_header.nal_unit_type, (void *) &sps_p->nal_unit_header, AV_CODEC_ID_H264)
     };
+
+    std::lock_guard lock {cache_mutex};
+    h264_cache.insert_or_assign(std::move(key), h264);
+    return h264;
   }
 
   hevc_t make_sps_hevc(const AVCodecContext *avctx, const AVPacket *packet) {
+    auto prefix = parameter_sets(packet, AV_CODEC_ID_H265);
+    auto key = cache_key(prefix, avctx);
+    {
+      std::lock_guard lock {cache_mutex};
+      if (auto cached = hevc_cache.find(key); cached != std::end(hevc_cache)) {
+        return cached->second;
+      }
+    }
+
     cbs::ctx_t ctx;
     if (ff_cbs_init(&ctx, AV_CODEC_ID_H265, nullptr)) {
       return {};
@@ -150,7 +261,7 @@ namespace cbs {
 
     cbs::frag_t frag;
 
-    int err = ff_cbs_read_packet(ctx.get(), &frag, packet);
+    int err = read_parameter_sets(ctx, frag, prefix);
     if (err < 0) {
       char err_str[AV_ERROR_MAX_STRING_SIZE] {0};
       BOOST_LOG(error) << "Couldn't read packet: "sv << av_make_error_string(err_str, AV_ERROR_MAX_STRING_SIZE, err);
@@ -158,8 +269,13 @@ namespace cbs {
       return {};
     }
 
-    auto vps_p = ((CodedBitstreamH265Context *) ctx->priv_data)->active_vps;
-    auto sps_p = ((CodedBitstreamH265Context *) ctx->priv_data)->active_sps;
+    // No slice was read, so there are no active parameter sets to take
+    auto vps_p = find_unit<H265RawVPS>(frag, HEVC_NAL_VPS);
+    auto sps_p = find_unit<H265RawSPS>(frag, HEVC_NAL_SPS);
+    if (!vps_p || !sps_p) {
+      BOOST_LOG(error) << "Couldn't find the VPS and SPS in the IDR frame"sv;
+      return {};
+    }
 
     // These are very large structs that cannot safely be stored on the stack
     auto sps = std::make_unique<H265RawSPS>(*sps_p);
@@ -201,7 +317,7 @@ namespace cbs {
     cbs::ctx_t write_ctx;
     ff_cbs_init(&write_ctx, AV_CODEC_ID_H265, nullptr);
 
-    return hevc_t {
+    hevc_t hevc {
       nal_t {
         write(write_ctx, vps->nal_unit_header.nal_unit_type, (void *) &vps->nal_unit_header, AV_CODEC_ID_H265),
         write(ctx, vps_p->nal_unit_header.nal_unit_type, (void *) &vps_p->nal_unit_header, AV_CODEC_ID_H265),
@@ -212,6 +328,10 @@ namespace cbs {
         write(ctx, sps_p->nal_unit_header.nal_unit_type, (void *) &sps_p->nal_unit_header, AV_CODEC_ID_H265),
       },
     };
+
+    std::lock_guard lock {cache_mutex};
+    hevc_cache.insert_or_assign(std::move(key), hevc);
+    return hevc;
   }
 
   /**
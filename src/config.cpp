@@ -4,10 +4,12 @@
  */
 // standard includes
 #include <algorithm>
+#include <cstdio>
 #include <filesystem>
 #include <fstream>
 #include <functional>
 #include <iostream>
+#include <set>
 #include <thread>
 #include <unordered_map>
 #include <utility>
@@ -26,6 +28,7 @@
 #include "nvhttp.h"
 #include "platform/common.h"
 #include "rtsp.h"
+#include "trace.h"
 #include "utility.h"
 
 #ifdef _WIN32
@@ -64,6 +67,20 @@ namespace config {
       return nvenc::nvenc_two_pass::quarter_resolution;
     }
 
+    nvenc::nvenc_split_encode split_encode_from_view(const std::string_view &preset) {
+      if (preset == "disabled") {
+        return nvenc::nvenc_split_encode::disabled;
+      }
+      if (preset == "auto") {
+        return nvenc::nvenc_split_encode::automatic;
+      }
+      if (preset == "enabled") {
+        return nvenc::nvenc_split_encode::enabled;
+      }
+      BOOST_LOG(warning) << "config: unknown nvenc_split_encode value: " << preset;
+      return nvenc::nvenc_split_encode::automatic;
+    }
+
   }  // namespace nv
 
   namespace amd {
@@ -352,6 +369,17 @@ namespace config {
 #undef _CONVERT_
       return 11;  // Default to superfast
     }
+
+    video_t::sw_t::profile_e profile_from_view(const std::string_view value) {
+#define _CONVERT_2_ARG_(str, val) \
+  if (value == #str##sv) \
+  return video_t::sw_t::profile_e::val
+      _CONVERT_2_ARG_(auto, automatic);
+      _CONVERT_2_ARG_(default, standard);
+      _CONVERT_2_ARG_(sliced, sliced);
+#undef _CONVERT_2_ARG_
+      return video_t::sw_t::profile_e::automatic;  // Default to this if value is invalid
+    }
   }  // namespace sw
 
   namespace dd {
@@ -441,10 +469,14 @@ namespace config {
     0,  // av1_mode
 
     2,  // min_threads
+    false,  // intra_refresh
+    true,  // hdr_tone_map
     {
       "superfast"s,  // preset
       "zerolatency"s,  // tune
       11,  // superfast
+      video_t::sw_t::profile_e::automatic,  // profile
+      false,  // gpu_convert
     },  // software
 
     {},  // nv
@@ -463,6 +495,7 @@ namespace config {
       (int) amd::usage_h264_e::ultralowlatency,  // usage (h264)
       (int) amd::usage_hevc_e::ultralowlatency,  // usage (hevc)
       (int) amd::usage_av1_e::ultralowlatency,  // usage (av1)
+      false,  // usage (auto)
       (int) amd::rc_h264_e::vbr_latency,  // rate control (h264)
       (int) amd::rc_hevc_e::vbr_latency,  // rate control (hevc)
       (int) amd::rc_av1_e::vbr_latency,  // rate control (av1)
@@ -486,8 +519,17 @@ namespace config {
       false,  // strict_rc_buffer
     },  // vaapi
 
+    {
+      false,  // low_latency
+      false,  // passthrough
+      {},  // composite
+      "grid"s,  // composite_layout
+      {},  // frame_tap
+    },  // picamera
+
     {},  // capture
     {},  // encoder
+    false,  // lazy_encoder_probe
     {},  // adapter_name
     {},  // output_name
 
@@ -505,7 +547,10 @@ namespace config {
     },  // display_device
 
     0,  // max_bitrate
-    0  // minimum_fps_target (0 = framerate)
+    0,  // minimum_fps_target (0 = framerate)
+    false,  // skip_unchanged_frames
+    false,  // adaptive_quality
+    80  // thermal_limit
   };
 
   audio_t audio {
@@ -513,17 +558,40 @@ namespace config {
     {},  // virtual_sink
     true,  // stream audio
     true,  // install_steam_drivers
+    -1,  // opus_complexity
+    false,  // inline_encode
   };
 
   stream_t stream {
     10s,  // ping_timeout
+    0ms,  // resume_grace_period
 
     APPS_JSON_PATH,
 
     20,  // fecPercentage
 
+    false,  // adaptive_fec
+    5,  // fec_percentage_min
+    50,  // fec_percentage_max
+    50,  // fec_percentage_key_frame
+
+    false,  // adaptive_bitrate
+    false,  // learn_client_profiles
+    false,  // align_client_vsync
+    0ms,  // max_frame_latency
+    false,  // bandwidth_probe
+    false,  // path_mtu_probe
+
     ENCRYPTION_MODE_NEVER,  // lan_encryption_mode
     ENCRYPTION_MODE_OPPORTUNISTIC,  // wan_encryption_mode
+    false,  // chacha20_video
+
+    false,  // kernel_pacing
+    false,  // zerocopy_send
+    false,  // video_fanout
+    0,  // video_send_threads
+    0,  // rtsp_egress_port
+    {},  // simulcast
   };
 
   nvhttp_t nvhttp {
@@ -531,6 +599,7 @@ namespace config {
 
     PRIVATE_KEY_FILE,
     CERTIFICATE_FILE,
+    "rsa",  // cert_key_type
 
     platf::get_host_name(),  // sunshine_name,
     "sunshine_state.json"s,  // file_state
@@ -555,6 +624,8 @@ namespace config {
     true,  // client gamepads with motion events are emulated as DS4
     true,  // client gamepads with touchpads are emulated as DS4
     true,  // ds5_inputtino_randomize_mac
+    0,  // gamepad_pool_size
+    {},  // actuator_map
 
     true,  // keyboard enabled
     true,  // mouse enabled
@@ -562,6 +633,10 @@ namespace config {
     true,  // always send scancodes
     true,  // high resolution scrolling
     true,  // native pen/touch support
+
+    false,  // realtime_thread
+    0us,  // mouse_coalesce_window
+    0us,  // gamepad_report_interval
   };
 
   sunshine_t sunshine {
@@ -576,9 +651,22 @@ namespace config {
     {},  // cmd args
     47989,  // Base port number
     "ipv4",  // Address family
+    4,  // http_threads
+    2,  // web_ui_threads
     platf::appdata().string() + "/sunshine.log",  // log file
     false,  // notify_pre_releases
     true,  // system_tray
+    false,  // pipeline_trace
+    false,  // metrics
+    {},  // dvr_file
+    256,  // dvr_size
+    10,  // dvr_key_frame_interval
+    false,  // realtime_pipeline
+    {},  // pipeline_cpus
+    false,  // performance_governor
+    -1,  // cpu_dma_latency
+    false,  // disable_wifi_power_save
+    0,  // memory_budget
     {},  // prep commands
   };
 
@@ -925,6 +1013,29 @@ namespace config {
     }
   }
 
+  void simulcast_rungs_f(std::unordered_map<std::string, std::string> &vars, const std::string &name, std::vector<stream_t::simulcast_rung_t> &input) {
+    if (vars.find(name) == std::end(vars)) {
+      return;
+    }
+
+    std::vector<std::string> list;
+    list_string_f(vars, name, list);
+
+    input.clear();
+    for (auto &el : list) {
+      // WIDTHxHEIGHT@KBPS
+      stream_t::simulcast_rung_t rung;
+      char end;
+      if (std::sscanf(el.c_str(), "%dx%d@%d%c", &rung.width, &rung.height, &rung.bitrate, &end) != 3 ||
+          rung.width <= 0 || rung.height <= 0 || rung.bitrate <= 0) {
+        BOOST_LOG(warning) << "config: ignoring simulcast rung ["sv << el << "], expected WIDTHxHEIGHT@KBPS"sv;
+        continue;
+      }
+
+      input.emplace_back(rung);
+    }
+  }
+
   void list_prep_cmd_f(std::unordered_map<std::string, std::string> &vars, const std::string &name, std::vector<prep_cmd_t> &input) {
     std::string string;
     string_f(vars, name, string);
@@ -946,8 +1057,10 @@ namespace config {
       auto do_cmd = prep_cmd.get_optional<std::string>("do"s);
       auto undo_cmd = prep_cmd.get_optional<std::string>("undo"s);
       auto elevated = prep_cmd.get_optional<bool>("elevated"s);
+      auto parallel = prep_cmd.get_optional<bool>("parallel"s);
 
       input.emplace_back(do_cmd.value_or(""), undo_cmd.value_or(""), elevated.value_or(false));
+      input.back().parallel = parallel.value_or(false);
     }
   }
 
@@ -1040,39 +1153,32 @@ namespace config {
     return opts;
   }
 
-  void apply_config(std::unordered_map<std::string, std::string> &&vars) {
-#ifndef __ANDROID__
-    // TODO: Android can possibly support this
-    if (!fs::exists(stream.file_apps.c_str())) {
-      fs::copy_file(SUNSHINE_ASSETS_DIR "/apps.json", stream.file_apps);
-      fs::permissions(
-        stream.file_apps,
-        fs::perms::owner_read | fs::perms::owner_write,
-        fs::perm_options::add
-      );
-    }
-#endif
-
-    for (auto &[name, val] : vars) {
-      BOOST_LOG(info) << "config: '"sv << name << "' = "sv << val;
-      modified_config_settings[name] = val;
-    }
-
+  /**
+   * @brief Apply the settings the encoders are opened with.
+   * reload() applies them while no client is streaming, the encoders are probed again before the next stream.
+   */
+  void apply_encoder_config(std::unordered_map<std::string, std::string> &vars) {
     int_f(vars, "qp", video.qp);
     int_between_f(vars, "hevc_mode", video.hevc_mode, {0, 3});
     int_between_f(vars, "av1_mode", video.av1_mode, {0, 3});
     int_f(vars, "min_threads", video.min_threads);
+    bool_f(vars, "intra_refresh", video.intra_refresh);
+    bool_f(vars, "hdr_tone_map", video.hdr_tone_map);
     string_f(vars, "sw_preset", video.sw.sw_preset);
     if (!video.sw.sw_preset.empty()) {
       video.sw.svtav1_preset = sw::svtav1_preset_from_view(video.sw.sw_preset);
     }
     string_f(vars, "sw_tune", video.sw.sw_tune);
+    generic_f(vars, "sw_profile", video.sw.profile, sw::profile_from_view);
+    bool_f(vars, "sw_gpu_convert", video.sw.gpu_convert);
 
     int_between_f(vars, "nvenc_preset", video.nv.quality_preset, {1, 7});
     int_between_f(vars, "nvenc_vbv_increase", video.nv.vbv_percentage_increase, {0, 400});
     bool_f(vars, "nvenc_spatial_aq", video.nv.adaptive_quantization);
     generic_f(vars, "nvenc_twopass", video.nv.two_pass, nv::twopass_from_view);
     bool_f(vars, "nvenc_h264_cavlc", video.nv.h264_cavlc);
+    bool_f(vars, "nvenc_subframe", video.nv.subframe_readback);
+    generic_f(vars, "nvenc_split_encode", video.nv.split_encode, nv::split_encode_from_view);
     bool_f(vars, "nvenc_realtime_hags", video.nv_realtime_hags);
     bool_f(vars, "nvenc_opengl_vulkan_on_dxgi", video.nv_opengl_vulkan_on_dxgi);
     bool_f(vars, "nvenc_latency_over_power", video.nv_sunshine_high_power_mode);
@@ -1110,6 +1216,7 @@ namespace config {
 
     std::string usage;
     string_f(vars, "amd_usage", usage);
+    video.amd.amd_usage_auto = usage == "auto"sv;
     if (!usage.empty()) {
       video.amd.amd_usage_h264 = amd::usage_from_view<amd::usage_h264_e>(usage, video.amd.amd_usage_h264);
       video.amd.amd_usage_hevc = amd::usage_from_view<amd::usage_hevc_e>(usage, video.amd.amd_usage_hevc);
@@ -1129,8 +1236,158 @@ namespace config {
 
     string_f(vars, "capture", video.capture);
     string_f(vars, "encoder", video.encoder);
+    bool_f(vars, "lazy_encoder_probe", video.lazy_encoder_probe);
     string_f(vars, "adapter_name", video.adapter_name);
     string_f(vars, "output_name", video.output_name);
+    bool_f(vars, "picamera_low_latency", video.picamera.low_latency);
+    list_string_f(vars, "picamera_composite", video.picamera.composite);
+    string_restricted_f(vars, "picamera_composite_layout", video.picamera.composite_layout, {"grid"sv, "pip"sv});
+    string_f(vars, "picamera_frame_tap", video.picamera.frame_tap);
+  }
+
+  /**
+   * @brief Apply the settings that reload() can change while clients are streaming.
+   */
+  void apply_live_config(std::unordered_map<std::string, std::string> &vars) {
+    int_f(vars, "max_bitrate", video.max_bitrate);
+    double_between_f(vars, "minimum_fps_target", video.minimum_fps_target, {0.0, 1000.0});
+    bool_f(vars, "skip_unchanged_frames", video.skip_unchanged_frames);
+    bool_f(vars, "adaptive_quality", video.adaptive_quality);
+    int_between_f(vars, "thermal_limit", video.thermal_limit, {40, 110});
+    bool_f(vars, "picamera_passthrough", video.picamera.passthrough);
+
+    int to = -1;
+    int_between_f(vars, "ping_timeout", to, {-1, std::numeric_limits<int>::max()});
+    if (to != -1) {
+      stream.ping_timeout = std::chrono::milliseconds(to);
+    }
+
+    int resume_grace_period = -1;
+    int_between_f(vars, "resume_grace_period", resume_grace_period, {0, 600000});
+    if (resume_grace_period != -1) {
+      stream.resume_grace_period = std::chrono::milliseconds(resume_grace_period);
+    }
+
+    int_between_f(vars, "fec_percentage", stream.fec_percentage, {1, 255});
+    bool_f(vars, "adaptive_fec", stream.adaptive_fec);
+    int_between_f(vars, "fec_percentage_min", stream.fec_percentage_min, {1, 255});
+    int_between_f(vars, "fec_percentage_max", stream.fec_percentage_max, {1, 255});
+    stream.fec_percentage_max = std::max(stream.fec_percentage_min, stream.fec_percentage_max);
+    int_between_f(vars, "fec_percentage_key_frame", stream.fec_percentage_key_frame, {0, 255});
+    bool_f(vars, "adaptive_bitrate", stream.adaptive_bitrate);
+    bool_f(vars, "learn_client_profiles", stream.learn_client_profiles);
+    bool_f(vars, "align_client_vsync", stream.align_client_vsync);
+
+    int max_frame_latency = -1;
+    int_between_f(vars, "max_frame_latency", max_frame_latency, {0, 1000});
+    if (max_frame_latency != -1) {
+      stream.max_frame_latency = std::chrono::milliseconds(max_frame_latency);
+    }
+
+    to = std::numeric_limits<int>::min();
+    int_f(vars, "back_button_timeout", to);
+
+    if (to > std::numeric_limits<int>::min()) {
+      input.back_button_timeout = std::chrono::milliseconds {to};
+    }
+
+    double repeat_frequency {0};
+    double_between_f(vars, "key_repeat_frequency", repeat_frequency, {0, std::numeric_limits<double>::max()});
+
+    if (repeat_frequency > 0) {
+      config::input.key_repeat_period = std::chrono::duration<double> {1 / repeat_frequency};
+    }
+
+    to = -1;
+    int_f(vars, "key_repeat_delay", to);
+    if (to >= 0) {
+      input.key_repeat_delay = std::chrono::milliseconds {to};
+    }
+
+    to = -1;
+    int_between_f(vars, "mouse_coalesce_window", to, {0, 10000});
+    if (to >= 0) {
+      input.mouse_coalesce_window = std::chrono::microseconds {to};
+    }
+
+    to = -1;
+    int_between_f(vars, "gamepad_report_interval", to, {0, 100000});
+    if (to >= 0) {
+      input.gamepad_report_interval = std::chrono::microseconds {to};
+    }
+
+    bool_f(vars, "ds4_back_as_touchpad_click", input.ds4_back_as_touchpad_click);
+    bool_f(vars, "motion_as_ds4", input.motion_as_ds4);
+    bool_f(vars, "touchpad_as_ds4", input.touchpad_as_ds4);
+
+    bool_f(vars, "mouse", input.mouse);
+    bool_f(vars, "keyboard", input.keyboard);
+    bool_f(vars, "controller", input.controller);
+
+    bool_f(vars, "always_send_scancodes", input.always_send_scancodes);
+
+    bool_f(vars, "high_resolution_scrolling", input.high_resolution_scrolling);
+    bool_f(vars, "native_pen_touch", input.native_pen_touch);
+
+    std::string log_level_string;
+    string_f(vars, "min_log_level", log_level_string);
+
+    if (!log_level_string.empty()) {
+      if (log_level_string == "verbose"sv) {
+        sunshine.min_log_level = 0;
+      } else if (log_level_string == "debug"sv) {
+        sunshine.min_log_level = 1;
+      } else if (log_level_string == "info"sv) {
+        sunshine.min_log_level = 2;
+      } else if (log_level_string == "warning"sv) {
+        sunshine.min_log_level = 3;
+      } else if (log_level_string == "error"sv) {
+        sunshine.min_log_level = 4;
+      } else if (log_level_string == "fatal"sv) {
+        sunshine.min_log_level = 5;
+      } else if (log_level_string == "none"sv) {
+        sunshine.min_log_level = 6;
+      } else {
+        // accept digit directly
+        auto val = log_level_string[0];
+        if (val >= '0' && val < '7') {
+          sunshine.min_log_level = val - '0';
+        }
+      }
+    }
+
+    bool_f(vars, "pipeline_trace", sunshine.pipeline_trace);
+    bool_f(vars, "metrics", sunshine.metrics);
+    string_f(vars, "dvr_file", sunshine.dvr_file);
+    int_between_f(vars, "dvr_size", sunshine.dvr_size, {1, 65536});
+    int_between_f(vars, "dvr_key_frame_interval", sunshine.dvr_key_frame_interval, {0, 3600});
+    bool_f(vars, "realtime_pipeline", sunshine.realtime_pipeline);
+    list_int_f(vars, "pipeline_cpus", sunshine.pipeline_cpus);
+    bool_f(vars, "performance_governor", sunshine.performance_governor);
+    int_between_f(vars, "cpu_dma_latency", sunshine.cpu_dma_latency, {-1, 1000000});
+    bool_f(vars, "disable_wifi_power_save", sunshine.disable_wifi_power_save);
+    int_between_f(vars, "memory_budget", sunshine.memory_budget, {-1, 65536});
+  }
+
+  void apply_config(std::unordered_map<std::string, std::string> &&vars) {
+#ifndef __ANDROID__
+    // TODO: Android can possibly support this
+    if (!fs::exists(stream.file_apps.c_str())) {
+      fs::copy_file(SUNSHINE_ASSETS_DIR "/apps.json", stream.file_apps);
+      fs::permissions(
+        stream.file_apps,
+        fs::perms::owner_read | fs::perms::owner_write,
+        fs::perm_options::add
+      );
+    }
+#endif
+
+    for (auto &[name, val] : vars) {
+      BOOST_LOG(info) << "config: '"sv << name << "' = "sv << val;
+      modified_config_settings[name] = val;
+    }
+
+    apply_encoder_config(vars);
 
     generic_f(vars, "dd_configuration_option", video.dd.configuration_option, dd::config_option_from_view);
     generic_f(vars, "dd_resolution_option", video.dd.resolution_option, dd::resolution_option_from_view);
@@ -1153,11 +1410,11 @@ namespace config {
       video.dd.wa.hdr_toggle_delay = std::chrono::milliseconds {value};
     }
 
-    int_f(vars, "max_bitrate", video.max_bitrate);
-    double_between_f(vars, "minimum_fps_target", video.minimum_fps_target, {0.0, 1000.0});
+    apply_live_config(vars);
 
     path_f(vars, "pkey", nvhttp.pkey);
     path_f(vars, "cert", nvhttp.cert);
+    string_restricted_f(vars, "cert_key_type", nvhttp.cert_key_type, {"rsa"sv, "ecdsa"sv});
     string_f(vars, "sunshine_name", nvhttp.sunshine_name);
     path_f(vars, "log_path", config::sunshine.log_file);
     path_f(vars, "file_state", nvhttp.file_state);
@@ -1173,20 +1430,24 @@ namespace config {
     string_f(vars, "virtual_sink", audio.virtual_sink);
     bool_f(vars, "stream_audio", audio.stream);
     bool_f(vars, "install_steam_audio_drivers", audio.install_steam_drivers);
+    int_between_f(vars, "opus_complexity", audio.opus_complexity, {-1, 10});
+    bool_f(vars, "audio_inline_encode", audio.inline_encode);
 
     string_restricted_f(vars, "origin_web_ui_allowed", nvhttp.origin_web_ui_allowed, {"pc"sv, "lan"sv, "wan"sv});
 
-    int to = -1;
-    int_between_f(vars, "ping_timeout", to, {-1, std::numeric_limits<int>::max()});
-    if (to != -1) {
-      stream.ping_timeout = std::chrono::milliseconds(to);
-    }
-
     int_between_f(vars, "lan_encryption_mode", stream.lan_encryption_mode, {0, 2});
     int_between_f(vars, "wan_encryption_mode", stream.wan_encryption_mode, {0, 2});
+    bool_f(vars, "chacha20_video", stream.chacha20_video);
+    bool_f(vars, "kernel_pacing", stream.kernel_pacing);
+    bool_f(vars, "zerocopy_send", stream.zerocopy_send);
+    bool_f(vars, "bandwidth_probe", stream.bandwidth_probe);
+    bool_f(vars, "path_mtu_probe", stream.path_mtu_probe);
+    bool_f(vars, "video_fanout", stream.video_fanout);
+    int_between_f(vars, "video_send_threads", stream.video_send_threads, {0, 16});
+    int_between_f(vars, "rtsp_egress_port", stream.rtsp_egress_port, {0, 65535});
+    simulcast_rungs_f(vars, "simulcast", stream.simulcast);
 
     path_f(vars, "file_apps", stream.file_apps);
-    int_between_f(vars, "fec_percentage", stream.fec_percentage, {1, 255});
 
     map_int_int_f(vars, "keybindings"s, input.keybindings);
 
@@ -1199,40 +1460,12 @@ namespace config {
       input.keybindings.emplace(0xA5, 0x5B);
     }
 
-    to = std::numeric_limits<int>::min();
-    int_f(vars, "back_button_timeout", to);
-
-    if (to > std::numeric_limits<int>::min()) {
-      input.back_button_timeout = std::chrono::milliseconds {to};
-    }
-
-    double repeat_frequency {0};
-    double_between_f(vars, "key_repeat_frequency", repeat_frequency, {0, std::numeric_limits<double>::max()});
-
-    if (repeat_frequency > 0) {
-      config::input.key_repeat_period = std::chrono::duration<double> {1 / repeat_frequency};
-    }
-
-    to = -1;
-    int_f(vars, "key_repeat_delay", to);
-    if (to >= 0) {
-      input.key_repeat_delay = std::chrono::milliseconds {to};
-    }
-
     string_restricted_f(vars, "gamepad"s, input.gamepad, get_supported_gamepad_options());
-    bool_f(vars, "ds4_back_as_touchpad_click", input.ds4_back_as_touchpad_click);
-    bool_f(vars, "motion_as_ds4", input.motion_as_ds4);
-    bool_f(vars, "touchpad_as_ds4", input.touchpad_as_ds4);
     bool_f(vars, "ds5_inputtino_randomize_mac", input.ds5_inputtino_randomize_mac);
+    int_between_f(vars, "gamepad_pool_size", input.gamepad_pool_size, {0, platf::MAX_GAMEPADS});
+    string_f(vars, "actuator_map", input.actuator_map);
 
-    bool_f(vars, "mouse", input.mouse);
-    bool_f(vars, "keyboard", input.keyboard);
-    bool_f(vars, "controller", input.controller);
-
-    bool_f(vars, "always_send_scancodes", input.always_send_scancodes);
-
-    bool_f(vars, "high_resolution_scrolling", input.high_resolution_scrolling);
-    bool_f(vars, "native_pen_touch", input.native_pen_touch);
+    bool_f(vars, "realtime_input", input.realtime_thread);
 
     bool_f(vars, "notify_pre_releases", sunshine.notify_pre_releases);
     bool_f(vars, "system_tray", sunshine.system_tray);
@@ -1242,6 +1475,8 @@ namespace config {
     sunshine.port = (std::uint16_t) port;
 
     string_restricted_f(vars, "address_family", sunshine.address_family, {"ipv4"sv, "both"sv});
+    int_between_f(vars, "http_threads", sunshine.http_threads, {1, 16});
+    int_between_f(vars, "web_ui_threads", sunshine.web_ui_threads, {1, 16});
 
     bool upnp = false;
     bool_f(vars, "upnp"s, upnp);
@@ -1275,32 +1510,6 @@ namespace config {
                                                                    "zh_TW"sv,  // Chinese (Traditional)
                                                                  });
 
-    std::string log_level_string;
-    string_f(vars, "min_log_level", log_level_string);
-
-    if (!log_level_string.empty()) {
-      if (log_level_string == "verbose"sv) {
-        sunshine.min_log_level = 0;
-      } else if (log_level_string == "debug"sv) {
-        sunshine.min_log_level = 1;
-      } else if (log_level_string == "info"sv) {
-        sunshine.min_log_level = 2;
-      } else if (log_level_string == "warning"sv) {
-        sunshine.min_log_level = 3;
-      } else if (log_level_string == "error"sv) {
-        sunshine.min_log_level = 4;
-      } else if (log_level_string == "fatal"sv) {
-        sunshine.min_log_level = 5;
-      } else if (log_level_string == "none"sv) {
-        sunshine.min_log_level = 6;
-      } else {
-        // accept digit directly
-        auto val = log_level_string[0];
-        if (val >= '0' && val < '7') {
-          sunshine.min_log_level = val - '0';
-        }
-      }
-    }
 
     auto it = vars.find("flags"s);
     if (it != std::end(vars)) {
@@ -1316,6 +1525,131 @@ namespace config {
     }
   }
 
+  bool is_live_setting(const std::string_view &name) {
+    static const std::set<std::string_view> live_settings {
+      "max_bitrate"sv,
+      "minimum_fps_target"sv,
+      "skip_unchanged_frames"sv,
+      "adaptive_quality"sv,
+      "thermal_limit"sv,
+      "picamera_passthrough"sv,
+      "ping_timeout"sv,
+      "resume_grace_period"sv,
+      "fec_percentage"sv,
+      "adaptive_fec"sv,
+      "fec_percentage_min"sv,
+      "fec_percentage_max"sv,
+      "fec_percentage_key_frame"sv,
+      "adaptive_bitrate"sv,
+      "learn_client_profiles"sv,
+      "align_client_vsync"sv,
+      "max_frame_latency"sv,
+      "back_button_timeout"sv,
+      "key_repeat_frequency"sv,
+      "key_repeat_delay"sv,
+      "mouse_coalesce_window"sv,
+      "gamepad_report_interval"sv,
+      "ds4_back_as_touchpad_click"sv,
+      "motion_as_ds4"sv,
+      "touchpad_as_ds4"sv,
+      "mouse"sv,
+      "keyboard"sv,
+      "controller"sv,
+      "always_send_scancodes"sv,
+      "high_resolution_scrolling"sv,
+      "native_pen_touch"sv,
+      "min_log_level"sv,
+      "pipeline_trace"sv,
+      "metrics"sv,
+    };
+
+    return live_settings.contains(name);
+  }
+
+  bool is_encoder_setting(const std::string_view &name) {
+    static const std::set<std::string_view> encoder_settings {
+      "qp"sv,
+      "hevc_mode"sv,
+      "av1_mode"sv,
+      "min_threads"sv,
+      "intra_refresh"sv,
+      "hdr_tone_map"sv,
+      "capture"sv,
+      "encoder"sv,
+      "adapter_name"sv,
+      "output_name"sv,
+      "picamera_low_latency"sv,
+    };
+
+    if (encoder_settings.contains(name)) {
+      return true;
+    }
+
+    return std::ranges::any_of(encoder_option_prefixes, [&name](auto &prefix) {
+      return name.starts_with(prefix.second);
+    });
+  }
+
+  reload_t reload(bool idle) {
+    reload_t result;
+
+    std::unordered_map<std::string, std::string> vars;
+    try {
+      vars = parse_config(file_handler::read_file(sunshine.config_file.c_str()));
+    } catch (const std::exception &e) {
+      BOOST_LOG(error) << "Couldn't read the config file: "sv << e.what();
+      return result;
+    }
+
+    // Going back to the default value of a setting needs a restart
+    for (auto &[name, _] : modified_config_settings) {
+      if (!vars.contains(name)) {
+        result.restart.emplace_back(name);
+      }
+    }
+
+    std::unordered_map<std::string, std::string> live_vars;
+    std::unordered_map<std::string, std::string> encoder_vars;
+    for (auto &[name, value] : vars) {
+      auto it = modified_config_settings.find(name);
+      if (it != std::end(modified_config_settings) && it->second == value) {
+        continue;
+      }
+
+      if (is_live_setting(name)) {
+        live_vars.emplace(name, value);
+        result.applied.emplace_back(name);
+      } else if (idle && is_encoder_setting(name)) {
+        encoder_vars.emplace(name, value);
+        result.encoder.emplace_back(name);
+      } else {
+        result.restart.emplace_back(name);
+      }
+    }
+
+    for (auto *applied : {&live_vars, &encoder_vars}) {
+      for (auto &[name, val] : *applied) {
+        BOOST_LOG(info) << "config: '"sv << name << "' = "sv << val << " (reloaded)"sv;
+        modified_config_settings[name] = val;
+      }
+    }
+
+    auto min_log_level = sunshine.min_log_level;
+    apply_live_config(live_vars);
+    apply_encoder_config(encoder_vars);
+    if (sunshine.min_log_level != min_log_level) {
+      logging::set_min_log_level(sunshine.min_log_level);
+    }
+    if (live_vars.contains("pipeline_trace")) {
+      trace::set_enabled(sunshine.pipeline_trace);
+    }
+
+    std::ranges::sort(result.applied);
+    std::ranges::sort(result.encoder);
+    std::ranges::sort(result.restart);
+    return result;
+  }
+
   int parse(int argc, char *argv[]) {
     std::unordered_map<std::string, std::string> cmd_vars;
 #ifdef _WIN32
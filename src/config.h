@@ -5,11 +5,14 @@
 #pragma once
 
 // standard includes
+#include <array>
 #include <bitset>
 #include <chrono>
 #include <optional>
 #include <string>
+#include <string_view>
 #include <unordered_map>
+#include <utility>
 #include <vector>
 
 // local includes
@@ -27,11 +30,21 @@ namespace config {
     int av1_mode;
 
     int min_threads;  // Minimum number of threads/slices for CPU encoding
+    bool intra_refresh;  // Recover from packet loss with a rolling intra-refresh instead of an IDR frame
+    bool hdr_tone_map;  // Tone-map an HDR display for SDR clients instead of clipping it
+
+    struct sw_t {
+      enum class profile_e {
+        automatic,  ///< Use the sliced profile for live camera sources, the default profile otherwise.
+        standard,  ///< Use the preset and tune as configured.
+        sliced  ///< Force slice threads, a one frame VBV and intra-refresh for the lowest latency.
+      };
 
-    struct {
       std::string sw_preset;
       std::string sw_tune;
       std::optional<int> svtav1_preset;
+      profile_e profile;
+      bool gpu_convert;  ///< Convert KMS captures on the GPU and only read back the converted planes.
     } sw;
 
     nvenc::nvenc_config nv;
@@ -57,6 +70,7 @@ namespace config {
       std::optional<int> amd_usage_h264;
       std::optional<int> amd_usage_hevc;
       std::optional<int> amd_usage_av1;
+      bool amd_usage_auto;
       std::optional<int> amd_rc_h264;
       std::optional<int> amd_rc_hevc;
       std::optional<int> amd_rc_av1;
@@ -80,8 +94,17 @@ namespace config {
       bool strict_rc_buffer;
     } vaapi;
 
+    struct {
+      bool low_latency;  ///< Capture with as few driver buffers as possible and always deliver the newest frame.
+      bool passthrough;  ///< Stream the H.264 a camera encodes itself instead of decoding and encoding it again.
+      std::vector<std::string> composite;  ///< Cameras the composite display lays out in one frame.
+      std::string composite_layout;  ///< How the composite display lays out the cameras, grid or pip.
+      std::string frame_tap;  ///< Unix socket to share the captured frames with local processes on, empty to disable.
+    } picamera;
+
     std::string capture;
     std::string encoder;
+    bool lazy_encoder_probe;  ///< Probe the encoders when the first client connects instead of at startup.
     std::string adapter_name;
     std::string output_name;
 
@@ -142,6 +165,9 @@ namespace config {
 
     int max_bitrate;  // Maximum bitrate, sets ceiling in kbps for bitrate requested from client
     double minimum_fps_target;  ///< Lowest framerate that will be used when streaming. Range 0-1000, 0 = half of client's requested framerate.
+    bool skip_unchanged_frames;  ///< Don't encode captured frames identical to the previous one, the encoder falls back to minimum_fps_target.
+    bool adaptive_quality;  ///< Lower the frame rate and bitrate of a stream while the host throttles, runs hot or the encoder can't keep up.
+    int thermal_limit;  ///< Temperature in degrees Celsius from which adaptive_quality lowers the quality.
   };
 
   struct audio_t {
@@ -149,6 +175,8 @@ namespace config {
     std::string virtual_sink;
     bool stream;
     bool install_steam_drivers;
+    int opus_complexity;  ///< Opus encoder complexity 0-10, -1 adapts it to the measured encode time
+    bool inline_encode;  ///< Encode on the capture thread instead of handing each frame to an encode thread
   };
 
   constexpr int ENCRYPTION_MODE_NEVER = 0;  // Never use video encryption, even if the client supports it
@@ -158,13 +186,72 @@ namespace config {
   struct stream_t {
     std::chrono::milliseconds ping_timeout;
 
+    // Keep the pipeline of a session paused this long after its client drops off, so the client can reconnect to it
+    std::chrono::milliseconds resume_grace_period;
+
     std::string file_apps;
 
     int fec_percentage;
 
+    // Adapt the FEC percentage of each session to the loss its client reports, within these bounds
+    bool adaptive_fec;
+    int fec_percentage_min;
+    int fec_percentage_max;
+
+    // Lowest FEC percentage of key frames and of the frames that recover from a loss, 0 to treat them like any frame
+    int fec_percentage_key_frame;
+
+    // Lower the bitrate of each session while its client reports loss, and restore it while it doesn't
+    bool adaptive_bitrate;
+
+    // Start the streams of each paired client from the bitrate and FEC percentage its last stream converged on
+    bool learn_client_profiles;
+
+    // Shift the capture of each stream, so its frames keep reaching the client at the same point of its frame interval
+    bool align_client_vsync;
+
+    // Drop frames older than this while newer ones are queued behind them, zero to send every frame
+    std::chrono::milliseconds max_frame_latency;
+
+    // Measure the path to each client on the first frames of its stream, and cap pacing and bitrate to it
+    bool bandwidth_probe;
+
+    // Probe the path MTU to each client when its stream starts, and warn if its video packets are fragmented
+    bool path_mtu_probe;
+
     // Video encryption settings for LAN and WAN streams
     int lan_encryption_mode;
     int wan_encryption_mode;
+
+    // Offer ChaCha20-Poly1305 video encryption, an experimental protocol extension, on hosts without AES instructions
+    bool chacha20_video;
+
+    // Hand video packets to the kernel with transmit times instead of sleeping between batches
+    bool kernel_pacing;
+
+    // Let the kernel send large video batches straight from the shard buffers instead of copying them
+    bool zerocopy_send;
+
+    // Let sessions with the same video configuration share a single encoder
+    bool video_fanout;
+
+    // Threads the video of the sessions is sent from, each session stays on one of them, 0 to pick by CPU count
+    int video_send_threads;
+
+    // Port of the RTSP server that serves the streamed video to standard players, 0 to disable
+    int rtsp_egress_port;
+
+    /**
+     * @brief A resolution and bitrate of the simulcast ladder.
+     */
+    struct simulcast_rung_t {
+      int width;
+      int height;
+      int bitrate;  ///< In Kbps.
+    };
+
+    // Every client streams the closest of these and shares its encoder with the other clients on it
+    std::vector<simulcast_rung_t> simulcast;
   };
 
   struct nvhttp_t {
@@ -175,6 +262,10 @@ namespace config {
     std::string pkey;
     std::string cert;
 
+    // Type of the key generated when pkey and cert don't exist yet:
+    // rsa|ecdsa
+    std::string cert_key_type;
+
     std::string sunshine_name;
 
     std::string file_state;
@@ -194,6 +285,8 @@ namespace config {
     bool motion_as_ds4;
     bool touchpad_as_ds4;
     bool ds5_inputtino_randomize_mac;
+    int gamepad_pool_size;  ///< Virtual gamepads of each type created ahead of time, Linux only
+    std::string actuator_map;  ///< PWM/GPIO outputs driven by the first gamepad, Linux only
 
     bool keyboard;
     bool mouse;
@@ -203,6 +296,10 @@ namespace config {
 
     bool high_resolution_scrolling;
     bool native_pen_touch;
+
+    bool realtime_thread;  ///< Inject input from a thread with real-time scheduling priority
+    std::chrono::microseconds mouse_coalesce_window;  ///< How long relative mouse motion is held back to be sent as one move
+    std::chrono::microseconds gamepad_report_interval;  ///< Shortest time between two reports sent to a virtual gamepad
   };
 
   namespace flag {
@@ -231,6 +328,9 @@ namespace config {
     std::string do_cmd;
     std::string undo_cmd;
     bool elevated;
+
+    // Runs along with the commands next to it that are marked parallel too
+    bool parallel = false;
   };
 
   struct sunshine_t {
@@ -253,10 +353,23 @@ namespace config {
 
     std::uint16_t port;
     std::string address_family;
+    int http_threads;  ///< Threads each Moonlight HTTP(S) server handles requests on
+    int web_ui_threads;  ///< Threads the Web UI server handles requests on
 
     std::string log_file;
     bool notify_pre_releases;
     bool system_tray;
+    bool pipeline_trace;  ///< Record the spans of the pipeline stages, see trace::dump()
+    bool metrics;  ///< Serve the counters of the pipeline on /metrics, see metrics::format()
+    std::string dvr_file;  ///< Ring file the streamed video is mirrored into, empty to disable, see video::dvr::start()
+    int dvr_size;  ///< Size of the DVR ring in MiB
+    int dvr_key_frame_interval;  ///< Seconds between the key frames the DVR asks for, 0 to only use the ones clients ask for
+    bool realtime_pipeline;  ///< Schedule the threads that ask for critical priority in real time, Linux only
+    std::vector<int> pipeline_cpus;  ///< CPUs the capture, encode and send threads run on, empty for any, Linux only
+    bool performance_governor;  ///< Switch the CPU frequency governor to performance while streaming, Linux only
+    int cpu_dma_latency;  ///< CPU wake-up latency in microseconds to request while streaming, -1 for none, Linux only
+    bool disable_wifi_power_save;  ///< Disable power saving of the WLAN interfaces while streaming, Linux only
+    int memory_budget;  ///< MiB the buffer pools may use, -1 for a quarter of the available memory, 0 for no budget
     std::vector<prep_cmd_t> prep_cmds;
   };
 
@@ -269,4 +382,42 @@ namespace config {
 
   int parse(int argc, char *argv[]);
   std::unordered_map<std::string, std::string> parse_config(const std::string_view &file_content);
+
+  /**
+   * @brief The encoders and the prefix of the settings only they use.
+   */
+  inline constexpr std::array<std::pair<std::string_view, std::string_view>, 6> encoder_option_prefixes {{
+    {"nvenc", "nvenc_"},
+    {"quicksync", "qsv_"},
+    {"amdvce", "amd_"},
+    {"software", "sw_"},
+    {"vaapi", "vaapi_"},
+    {"videotoolbox", "vt_"},
+  }};
+
+  /**
+   * @brief Whether reload() can apply the setting while clients are streaming.
+   */
+  bool is_live_setting(const std::string_view &name);
+
+  /**
+   * @brief Whether the setting is used to open the encoders, changing it needs them to be probed again.
+   */
+  bool is_encoder_setting(const std::string_view &name);
+
+  /**
+   * @brief The settings reload() found changed in the config file.
+   */
+  struct reload_t {
+    std::vector<std::string> applied;  ///< Took effect immediately
+    std::vector<std::string> encoder;  ///< Took effect, the encoders need to be probed again
+    std::vector<std::string> restart;  ///< Only take effect after a restart
+  };
+
+  /**
+   * @brief Read the config file again and apply the changed settings that can change at runtime.
+   * @param idle Whether no client is streaming, the encoder settings are only applied then.
+   * @return The changed settings.
+   */
+  reload_t reload(bool idle);
 }  // namespace config
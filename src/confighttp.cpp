@@ -7,10 +7,21 @@
 #define BOOST_BIND_GLOBAL_PLACEHOLDERS
 
 // standard includes
+#include <array>
+#include <charconv>
+#include <chrono>
+#include <condition_variable>
 #include <filesystem>
 #include <format>
 #include <fstream>
+#include <functional>
+#include <memory>
+#include <mutex>
 #include <set>
+#include <shared_mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
 
 // lib includes
 #include <boost/algorithm/string.hpp>
@@ -29,12 +40,18 @@
 #include "globals.h"
 #include "httpcommon.h"
 #include "logging.h"
+#include "metrics.h"
 #include "network.h"
 #include "nvhttp.h"
 #include "platform/common.h"
 #include "process.h"
+#include "rtsp.h"
+#include "stream.h"
+#include "trace.h"
 #include "utility.h"
 #include "uuid.h"
+#include "video.h"
+#include "video_dvr.h"
 
 using namespace std::literals;
 
@@ -129,6 +146,12 @@ namespace confighttp {
     response->write(SimpleWeb::StatusCode::redirection_temporary_redirect, headers);
   }
 
+  // Guards the credentials against a password change, the server handles requests on several threads
+  std::shared_mutex creds_lock;
+
+  // Requests that change files or state run one at a time
+  std::mutex write_lock;
+
   /**
    * @brief Authenticate the user.
    * @param response The HTTP response object.
@@ -145,6 +168,8 @@ namespace confighttp {
       return false;
     }
 
+    std::shared_lock lock {creds_lock};
+
     // If credentials are shown, redirect the user to a /welcome page
     if (config::sunshine.username.empty()) {
       send_redirect(response, request, "/welcome");
@@ -463,13 +488,137 @@ namespace confighttp {
     return *(relPath.begin()) != fs::path("..");
   }
 
+  /**
+   * @brief A web UI asset held in memory, along with the variants the build compressed ahead of time.
+   */
+  struct asset_t {
+    std::string mime_type;
+    std::string etag;
+    std::string identity;
+    std::string gzip;
+    std::string brotli;
+  };
+
+  // Assets by request path, only canonical paths are cached so other spellings can't fill the cache
+  std::mutex assets_lock;
+  std::unordered_map<std::string, std::shared_ptr<const asset_t>> assets;
+
+  /**
+   * @brief Read a whole file in binary mode.
+   * @param path The path of the file.
+   * @return The contents, empty if the file doesn't exist.
+   */
+  std::string read_binary_file(const fs::path &path) {
+    std::ifstream in(path, std::ios::binary);
+    return std::string {std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>()};
+  }
+
+  /**
+   * @brief Load an asset and the `.br` and `.gz` files the web UI build writes next to it.
+   * @param path The path of the asset.
+   * @param mime_type The content type to serve it with.
+   * @return The asset.
+   */
+  std::shared_ptr<const asset_t> load_asset(const fs::path &path, const std::string &mime_type) {
+    auto asset = std::make_shared<asset_t>();
+    asset->mime_type = mime_type;
+    asset->identity = read_binary_file(path);
+    asset->etag = std::format("\"{:016x}\"", std::hash<std::string> {}(asset->identity));
+
+    auto variant = path;
+    if (fs::exists(variant.concat(".br"))) {
+      asset->brotli = read_binary_file(variant);
+    }
+    variant = path;
+    if (fs::exists(variant.concat(".gz"))) {
+      asset->gzip = read_binary_file(variant);
+    }
+
+    return asset;
+  }
+
+  /**
+   * @brief Check if a client accepts a content coding.
+   * @param accept_encoding The Accept-Encoding header of the request.
+   * @param coding The content coding, e.g. `gzip`.
+   * @return `true` if the coding is listed without a zero quality value.
+   */
+  bool accepts_encoding(std::string_view accept_encoding, std::string_view coding) {
+    while (!accept_encoding.empty()) {
+      auto end = accept_encoding.find(',');
+      auto entry = accept_encoding.substr(0, end);
+      accept_encoding = end == std::string_view::npos ? std::string_view {} : accept_encoding.substr(end + 1);
+
+      auto params = entry.find(';');
+      auto name = boost::algorithm::trim_copy(std::string {entry.substr(0, params)});
+      if (!boost::algorithm::iequals(name, coding)) {
+        continue;
+      }
+
+      auto quality = params == std::string_view::npos ? ""s : boost::algorithm::erase_all_copy(std::string {entry.substr(params + 1)}, " ");
+      return quality.rfind("q=0", 0) != 0 || quality.find_first_of("123456789", 3) != std::string::npos;
+    }
+
+    return false;
+  }
+
+  /**
+   * @brief Send an asset, compressed if the client accepts it, or `304` if the client's copy is current.
+   * @param response The HTTP response object.
+   * @param request The HTTP request object.
+   * @param asset The asset.
+   */
+  void send_asset(resp_https_t response, req_https_t request, const asset_t &asset) {
+    SimpleWeb::CaseInsensitiveMultimap headers;
+    headers.emplace("ETag", asset.etag);
+    headers.emplace("Cache-Control", "no-cache");
+    headers.emplace("Vary", "Accept-Encoding");
+    headers.emplace("X-Frame-Options", "DENY");
+    headers.emplace("Content-Security-Policy", "frame-ancestors 'none';");
+
+    auto if_none_match = request->header.find("If-None-Match");
+    if (if_none_match != request->header.end() && if_none_match->second == asset.etag) {
+      response->write(SimpleWeb::StatusCode::redirection_not_modified, headers);
+      return;
+    }
+
+    headers.emplace("Content-Type", asset.mime_type);
+
+    auto accept_encoding = request->header.find("Accept-Encoding");
+    std::string_view accepted = accept_encoding != request->header.end() ? accept_encoding->second : ""sv;
+
+    if (!asset.brotli.empty() && accepts_encoding(accepted, "br"sv)) {
+      headers.emplace("Content-Encoding", "br");
+      response->write(SimpleWeb::StatusCode::success_ok, asset.brotli, headers);
+    } else if (!asset.gzip.empty() && accepts_encoding(accepted, "gzip"sv)) {
+      headers.emplace("Content-Encoding", "gzip");
+      response->write(SimpleWeb::StatusCode::success_ok, asset.gzip, headers);
+    } else {
+      response->write(SimpleWeb::StatusCode::success_ok, asset.identity, headers);
+    }
+  }
+
   /**
    * @brief Get an asset from the node_modules directory.
+   * Assets are read once and served from memory after that.
    * @param response The HTTP response object.
    * @param request The HTTP request object.
    */
   void getNodeModules(resp_https_t response, req_https_t request) {
     print_req(request);
+
+    std::shared_ptr<const asset_t> asset;
+    {
+      std::lock_guard lg {assets_lock};
+      if (auto it = assets.find(request->path); it != assets.end()) {
+        asset = it->second;
+      }
+    }
+    if (asset) {
+      send_asset(response, request, *asset);
+      return;
+    }
+
     fs::path webDirPath(WEB_DIR);
     fs::path nodeModulesPath(webDirPath / "assets");
 
@@ -497,13 +646,14 @@ namespace confighttp {
       return;
     }
 
-    // if it is, set the content type to the mime type
-    SimpleWeb::CaseInsensitiveMultimap headers;
-    headers.emplace("Content-Type", mimeType->second);
-    headers.emplace("X-Frame-Options", "DENY");
-    headers.emplace("Content-Security-Policy", "frame-ancestors 'none';");
-    std::ifstream in(filePath.string(), std::ios::binary);
-    response->write(SimpleWeb::StatusCode::success_ok, in, headers);
+    // if it is, serve it with the mime type
+    asset = load_asset(filePath, mimeType->second);
+    if ("/"s + relPath.generic_string() == request->path) {
+      std::lock_guard lg {assets_lock};
+      assets.emplace(request->path, asset);
+    }
+
+    send_asset(response, request, *asset);
   }
 
   /**
@@ -678,6 +828,7 @@ namespace confighttp {
 
     print_req(request);
 
+    proc::wait_for_launch();
     proc::proc.terminate();
 
     nlohmann::json output_tree;
@@ -761,6 +912,453 @@ namespace confighttp {
     send_response(response, output_tree);
   }
 
+  /**
+   * @brief Get the network statistics of the video stream of every running session.
+   * Counters are totals since the session started. Tracked values hold the minimum,
+   * maximum and average over the last second the session sent frames in. Stage latencies
+   * hold the median and 99th percentile in milliseconds since the session started.
+   * Sessions receiving audio also report the Opus encode time per packet, the complexity it runs at and the packet loss it's tuned for.
+   * @param response The HTTP response object.
+   * @param request The HTTP request object.
+   *
+   * @api_examples{/api/sessions/network| GET| null}
+   */
+  void getNetworkStats(resp_https_t response, req_https_t request) {
+    if (!authenticate(response, request)) {
+      return;
+    }
+
+    print_req(request);
+
+    auto to_json = [](const stream::session::stat_t &stat) {
+      return nlohmann::json {
+        {"min", stat.min},
+        {"max", stat.max},
+        {"avg", stat.avg},
+      };
+    };
+
+    auto percentiles_to_json = [](const stream::session::percentiles_t &percentiles) {
+      return nlohmann::json {
+        {"p50", percentiles.p50},
+        {"p99", percentiles.p99},
+      };
+    };
+
+    nlohmann::json sessions = nlohmann::json::array();
+    for (auto &stats : stream::session::network_stats()) {
+      sessions.push_back({
+        {"launch_session_id", stats.launch_session_id},
+        {"client_address", stats.client_address},
+        {"bytes_sent", stats.bytes_sent},
+        {"packets_sent", stats.packets_sent},
+        {"frames_sent", stats.frames_sent},
+        {"frames_dropped", stats.frames_dropped},
+        {"frames_lost", stats.frames_lost},
+        {"send_batch_fallbacks", stats.send_batch_fallbacks},
+        {"pacing_sleeps", stats.pacing_sleeps},
+        {"send_buffer_full", stats.send_buffer_full},
+        {"fec_percentage", to_json(stats.fec_percentage)},
+        {"batch_size", to_json(stats.batch_size)},
+        {"pacing_sleep_us", to_json(stats.pacing_sleep_us)},
+        {"send_queue_bytes", to_json(stats.send_queue_bytes)},
+        {"encryption_us", to_json(stats.encryption_us)},
+        {"latency_ms", {
+          {"capture", percentiles_to_json(stats.latency.capture)},
+          {"convert", percentiles_to_json(stats.latency.convert)},
+          {"encode", percentiles_to_json(stats.latency.encode)},
+          {"fec", percentiles_to_json(stats.latency.fec)},
+          {"send", percentiles_to_json(stats.latency.send)},
+          {"total", percentiles_to_json(stats.latency.total)},
+          {"vsync_phase_error", percentiles_to_json(stats.latency.vsync_phase_error)},
+        }},
+        {"bitrate", stats.bitrate_kbps},
+        {"path_mtu", stats.path_mtu},
+      });
+
+      if (stats.audio) {
+        sessions.back()["audio"] = {
+          {"encode_us", {
+            {"min", stats.audio->encode_us_min},
+            {"max", stats.audio->encode_us_max},
+            {"avg", stats.audio->encode_us_avg},
+          }},
+          {"complexity", stats.audio->complexity},
+          {"reduced_bandwidth", stats.audio->reduced_bandwidth},
+          {"loss_percentage", stats.audio->loss_percentage},
+        };
+      }
+    }
+
+    nlohmann::json output_tree;
+    output_tree["sessions"] = sessions;
+    output_tree["status"] = true;
+    send_response(response, output_tree);
+  }
+
+  /**
+   * @brief Get the progress of the last app launch.
+   * Launches return to the client before the prep commands finish, `pending` is true until the app started.
+   * `result` is 0 if the app started, it's only meaningful once `pending` is false.
+   * @param response The HTTP response object.
+   * @param request The HTTP request object.
+   *
+   * @api_examples{/api/sessions/launch| GET| null}
+   */
+  void getLaunchStatus(resp_https_t response, req_https_t request) {
+    if (!authenticate(response, request)) {
+      return;
+    }
+
+    print_req(request);
+
+    auto status = proc::launch_status();
+
+    nlohmann::json output_tree;
+    output_tree["app_id"] = status.app_id;
+    output_tree["pending"] = status.pending;
+    output_tree["result"] = status.result;
+    output_tree["prep_cmds_done"] = status.prep_cmds_done;
+    output_tree["prep_cmds_total"] = status.prep_cmds_total;
+    output_tree["status"] = true;
+    send_response(response, output_tree);
+  }
+
+  /**
+   * @brief Subscribers of the live stream health, fed once per second by a single producer thread.
+   */
+  struct live_stats_t {
+    /**
+     * @brief A Web UI page listening to the live stream health.
+     */
+    struct subscriber_t {
+      resp_https_t response;
+      bool sending = false;  ///< The previous event hasn't been written yet, a slow page skips events instead of queueing them
+    };
+
+    std::mutex lock;
+    std::condition_variable stop_cv;
+    bool stopped = false;
+    std::vector<std::shared_ptr<subscriber_t>> subscribers;
+  } live_stats;
+
+  /**
+   * @brief Sample the health of every running session into one event.
+   * @param previous The totals of the previous sample, updated to the current ones.
+   * @param elapsed The time since the previous sample.
+   * @return The event, ready to be written to the subscribers.
+   */
+  std::string sample_live_stats(std::unordered_map<std::uint32_t, stream::session::network_stats_t> &previous, std::chrono::steady_clock::duration elapsed) {
+    auto seconds = std::chrono::duration<double>(elapsed).count();
+
+    std::unordered_map<std::uint32_t, stream::session::network_stats_t> current;
+    nlohmann::json sessions = nlohmann::json::array();
+    for (auto &stats : stream::session::network_stats()) {
+      std::uint64_t frames = 0;
+      std::uint64_t bytes = 0;
+      std::uint64_t frames_lost = 0;
+
+      // The first sample of a session has nothing to compare against
+      auto prev = previous.find(stats.launch_session_id);
+      if (prev != previous.end()) {
+        frames = stats.frames_sent - prev->second.frames_sent;
+        bytes = stats.bytes_sent - prev->second.bytes_sent;
+        frames_lost = stats.frames_lost - prev->second.frames_lost;
+      }
+
+      sessions.push_back({
+        {"launch_session_id", stats.launch_session_id},
+        {"client_address", stats.client_address},
+        {"fps", frames / seconds},
+        {"bitrate_kbps", bytes * 8 / 1000.0 / seconds},
+        {"target_bitrate_kbps", stats.bitrate_kbps},
+        {"encode_latency_ms", stats.latency.encode.p50},
+        {"fec_percentage", stats.fec_percentage.avg},
+        {"frames_lost", frames_lost},
+      });
+
+      current.emplace(stats.launch_session_id, std::move(stats));
+    }
+    previous = std::move(current);
+
+    nlohmann::json event;
+    event["sessions"] = sessions;
+
+    auto thermal = platf::thermal_state();
+    event["temperature"] = thermal.temperature ? nlohmann::json(*thermal.temperature) : nlohmann::json();
+    event["throttled"] = thermal.throttled;
+
+    return "data: " + event.dump() + "\n\n";
+  }
+
+  /**
+   * @brief Push the live stream health to the subscribers once per second until the server stops.
+   * Nothing is sampled while there are no subscribers.
+   */
+  void live_stats_producer() {
+    std::unordered_map<std::uint32_t, stream::session::network_stats_t> previous;
+    auto last_sample = std::chrono::steady_clock::now();
+
+    std::unique_lock ul {live_stats.lock};
+    while (!live_stats.stop_cv.wait_for(ul, 1s, [] {
+      return live_stats.stopped;
+    })) {
+      if (live_stats.subscribers.empty()) {
+        previous.clear();
+        continue;
+      }
+
+      // Sampling takes the session locks, don't hold up new subscribers meanwhile
+      ul.unlock();
+      auto now = std::chrono::steady_clock::now();
+      auto event = sample_live_stats(previous, now - last_sample);
+      last_sample = now;
+      ul.lock();
+
+      for (auto &subscriber : live_stats.subscribers) {
+        if (subscriber->sending) {
+          continue;
+        }
+
+        subscriber->sending = true;
+        *subscriber->response << event;
+        subscriber->response->send([subscriber](const SimpleWeb::error_code &ec) {
+          std::lock_guard lg {live_stats.lock};
+          subscriber->sending = false;
+
+          // The page was closed
+          if (ec) {
+            std::erase(live_stats.subscribers, subscriber);
+          }
+        });
+      }
+    }
+
+    live_stats.subscribers.clear();
+  }
+
+  /**
+   * @brief Stream the health of the running sessions as server-sent events.
+   * Once per second an event is sent with the frame rate, measured and target bitrate, median encode latency,
+   * FEC percentage and frames the client reported lost since the previous event of every session,
+   * as well as the temperature of the host in degrees Celsius (`null` if it isn't reported) and whether it throttles.
+   * All subscribers share the same sample, a subscriber that can't keep up skips events.
+   * @param response The HTTP response object.
+   * @param request The HTTP request object.
+   *
+   * @api_examples{/api/sessions/live| GET| null}
+   */
+  void getLiveStats(resp_https_t response, req_https_t request) {
+    if (!authenticate(response, request)) {
+      return;
+    }
+
+    print_req(request);
+
+    SimpleWeb::CaseInsensitiveMultimap headers;
+    headers.emplace("Content-Type", "text/event-stream");
+    headers.emplace("Cache-Control", "no-cache");
+    headers.emplace("X-Frame-Options", "DENY");
+    headers.emplace("Content-Security-Policy", "frame-ancestors 'none';");
+    response->write(SimpleWeb::StatusCode::success_ok, headers);
+
+    auto subscriber = std::make_shared<live_stats_t::subscriber_t>();
+    subscriber->response = response;
+    subscriber->sending = true;
+
+    std::lock_guard lg {live_stats.lock};
+    live_stats.subscribers.push_back(subscriber);
+
+    // Send the headers right away, so the page knows it's connected before the first event
+    response->send([subscriber](const SimpleWeb::error_code &ec) {
+      std::lock_guard lg {live_stats.lock};
+      subscriber->sending = false;
+      if (ec) {
+        std::erase(live_stats.subscribers, subscriber);
+      }
+    });
+  }
+
+  /**
+   * @brief Change the video bitrate of a running session.
+   * @param response The HTTP response object.
+   * @param request The HTTP request object.
+   * The body for the post request should be JSON serialized in the following format:
+   * @code{.json}
+   * {
+   *  "launch_session_id": <launch session id>,
+   *  "bitrate": <bitrate in kbps>
+   * }
+   * @endcode
+   *
+   * @api_examples{/api/sessions/bitrate| POST| {"launch_session_id":1,"bitrate":10000}}
+   */
+  void setSessionBitrate(resp_https_t response, req_https_t request) {
+    if (!check_content_type(response, request, "application/json")) {
+      return;
+    }
+    if (!authenticate(response, request)) {
+      return;
+    }
+
+    print_req(request);
+
+    std::stringstream ss;
+    ss << request->content.rdbuf();
+
+    try {
+      nlohmann::json output_tree;
+      const nlohmann::json input_tree = nlohmann::json::parse(ss);
+      const std::uint32_t launch_session_id = input_tree.at("launch_session_id");
+      const int bitrate = input_tree.at("bitrate");
+      output_tree["status"] = stream::session::set_bitrate(launch_session_id, bitrate);
+      send_response(response, output_tree);
+    } catch (std::exception &e) {
+      BOOST_LOG(warning) << "SetSessionBitrate: "sv << e.what();
+      bad_request(response, request, e.what());
+    }
+  }
+
+  /**
+   * @brief Get the spans of the last pipeline trace.
+   * @param response The HTTP response object.
+   * @param request The HTTP request object.
+   *
+   * The response is a Chrome JSON trace, it can be opened in Perfetto or chrome://tracing.
+   *
+   * @api_examples{/api/trace| GET| null}
+   */
+  void getTrace(resp_https_t response, req_https_t request) {
+    if (!authenticate(response, request)) {
+      return;
+    }
+
+    print_req(request);
+
+    SimpleWeb::CaseInsensitiveMultimap headers;
+    headers.emplace("Content-Type", "application/json");
+    headers.emplace("Content-Disposition", "attachment; filename=\"sunshine-trace.json\"");
+    headers.emplace("X-Frame-Options", "DENY");
+    headers.emplace("Content-Security-Policy", "frame-ancestors 'none';");
+    response->write(trace::dump(), headers);
+  }
+
+  /**
+   * @brief Start or stop recording a pipeline trace.
+   * @param response The HTTP response object.
+   * @param request The HTTP request object.
+   * The body for the post request should be JSON serialized in the following format:
+   * @code{.json}
+   * {
+   *  "enabled": true
+   * }
+   * @endcode
+   *
+   * Starting a trace discards the previous one. The `pipeline_trace` setting isn't changed.
+   *
+   * @api_examples{/api/trace| POST| {"enabled":true}}
+   */
+  void setTrace(resp_https_t response, req_https_t request) {
+    if (!check_content_type(response, request, "application/json")) {
+      return;
+    }
+    if (!authenticate(response, request)) {
+      return;
+    }
+
+    print_req(request);
+
+    std::stringstream ss;
+    ss << request->content.rdbuf();
+
+    try {
+      nlohmann::json output_tree;
+      const nlohmann::json input_tree = nlohmann::json::parse(ss);
+      trace::set_enabled(input_tree.at("enabled").get<bool>());
+      output_tree["status"] = true;
+      output_tree["enabled"] = trace::enabled();
+      send_response(response, output_tree);
+    } catch (std::exception &e) {
+      BOOST_LOG(warning) << "SetTrace: "sv << e.what();
+      bad_request(response, request, e.what());
+    }
+  }
+
+  /**
+   * @brief Get the counters of the streaming pipeline, the resource usage of Sunshine and the counters of the running sessions.
+   * The metrics are in the Prometheus text exposition format, the endpoint only exists while the `metrics` setting is enabled.
+   * @param response The HTTP response object.
+   * @param request The HTTP request object.
+   *
+   * @api_examples{/metrics| GET| null}
+   */
+  void getMetrics(resp_https_t response, req_https_t request) {
+    if (!config::sunshine.metrics) {
+      not_found(response, request);
+      return;
+    }
+
+    if (!authenticate(response, request)) {
+      return;
+    }
+
+    print_req(request);
+
+    SimpleWeb::CaseInsensitiveMultimap headers;
+    headers.emplace("Content-Type", "text/plain; version=0.0.4");
+    headers.emplace("X-Frame-Options", "DENY");
+    headers.emplace("Content-Security-Policy", "frame-ancestors 'none';");
+    response->write(metrics::format(), headers);
+  }
+
+  /**
+   * @brief Save the last seconds of the streamed video to an MP4 file.
+   * @param response The HTTP response object.
+   * @param request The HTTP request object.
+   * The body for the post request should be JSON serialized in the following format:
+   * @code{.json}
+   * {
+   *  "seconds": 30
+   * }
+   * @endcode
+   *
+   * The clip is cut from the ring file of the `dvr_file` setting and starts at the key frame before the requested
+   * duration, so it can be a little longer. The MP4 file is written next to the ring file, its path is returned in
+   * `file`.
+   *
+   * @api_examples{/api/dvr/clip| POST| {"seconds":30}}
+   */
+  void saveDvrClip(resp_https_t response, req_https_t request) {
+    if (!check_content_type(response, request, "application/json")) {
+      return;
+    }
+    if (!authenticate(response, request)) {
+      return;
+    }
+
+    print_req(request);
+
+    std::stringstream ss;
+    ss << request->content.rdbuf();
+
+    try {
+      nlohmann::json output_tree;
+      const nlohmann::json input_tree = nlohmann::json::parse(ss);
+      auto seconds = input_tree.at("seconds").get<int>();
+      if (seconds <= 0) {
+        bad_request(response, request, "seconds must be positive");
+        return;
+      }
+
+      output_tree["status"] = true;
+      output_tree["file"] = video::dvr::save_clip(std::chrono::seconds {seconds}).string();
+      send_response(response, output_tree);
+    } catch (std::exception &e) {
+      BOOST_LOG(warning) << "SaveDvrClip: "sv << e.what();
+      bad_request(response, request, e.what());
+    }
+  }
+
   /**
    * @brief Unpair a client.
    * @param response The HTTP response object.
@@ -818,6 +1416,7 @@ namespace confighttp {
     print_req(request);
 
     nvhttp::erase_all_clients();
+    proc::wait_for_launch();
     proc::proc.terminate();
 
     nlohmann::json output_tree;
@@ -921,6 +1520,48 @@ namespace confighttp {
     }
   }
 
+  /**
+   * @brief Apply the saved config without restarting Sunshine.
+   * @param response The HTTP response object.
+   * @param request The HTTP request object.
+   * Settings of the stream, the input and the log level take effect immediately.
+   * Encoder settings take effect while no client is streaming, only the encoders they belong to are probed again.
+   * The response lists the settings that need a restart:
+   * @code{.json}
+   * {
+   *   "status": true,
+   *   "applied": ["fec_percentage"],
+   *   "encoder": ["nvenc_preset"],
+   *   "restart": ["port"]
+   * }
+   * @endcode
+   *
+   * @api_examples{/api/config/reload| POST| null}
+   */
+  void reloadConfig(resp_https_t response, req_https_t request) {
+    if (!check_content_type(response, request, "application/json")) {
+      return;
+    }
+    if (!authenticate(response, request)) {
+      return;
+    }
+
+    print_req(request);
+
+    auto idle = rtsp_stream::session_count() == 0;
+    auto result = config::reload(idle);
+    if (!result.encoder.empty() && video::reprobe_encoders()) {
+      BOOST_LOG(error) << "Video failed to find working encoder"sv;
+    }
+
+    nlohmann::json output_tree;
+    output_tree["status"] = true;
+    output_tree["applied"] = result.applied;
+    output_tree["encoder"] = result.encoder;
+    output_tree["restart"] = result.restart;
+    send_response(response, output_tree);
+  }
+
   /**
    * @brief Upload a cover image.
    * @param response The HTTP response object.
@@ -969,11 +1610,15 @@ namespace confighttp {
           bad_request(response, request, "Failed to download cover");
           return;
         }
+        nvhttp::cache_app_image(path, read_binary_file(path));
       } else {
         auto data = SimpleWeb::Crypto::Base64::decode(input_tree.value("data", ""));
 
-        std::ofstream imgfile(path);
-        imgfile.write(data.data(), static_cast<int>(data.size()));
+        {
+          std::ofstream imgfile(path, std::ios::binary);
+          imgfile.write(data.data(), static_cast<int>(data.size()));
+        }
+        nvhttp::cache_app_image(path, std::move(data));
       }
       output_tree["status"] = true;
       output_tree["path"] = path;
@@ -984,11 +1629,196 @@ namespace confighttp {
     }
   }
 
+  /**
+   * @brief A log file being streamed to a client, one block at a time.
+   */
+  struct log_stream_t {
+    std::ifstream file;
+    std::uint64_t remaining;
+
+    // Only messages of at least this severity are sent, in chunked transfer encoding
+    std::optional<int> min_severity;
+
+    // Whether the message of the last line was sent, continuation lines follow it
+    bool keep_message = true;
+
+    // The incomplete last line of the previous block, when filtering
+    std::string partial_line;
+
+    std::array<char, 64 * 1024> block;
+  };
+
+  /**
+   * @brief Parse a single byte range of a Range header.
+   * @param range The value of the Range header.
+   * @param size The size of the file.
+   * @return The range as [begin, end), or `std::nullopt` if it can't be satisfied.
+   */
+  std::optional<std::pair<std::uint64_t, std::uint64_t>> parse_range(std::string_view range, std::uint64_t size) {
+    auto parse = [](std::string_view str, std::uint64_t &value) {
+      auto result = std::from_chars(str.data(), str.data() + str.size(), value);
+      return result.ec == std::errc {} && result.ptr == str.data() + str.size();
+    };
+
+    if (!range.starts_with("bytes="sv)) {
+      return std::nullopt;
+    }
+    range.remove_prefix("bytes="sv.size());
+
+    auto dash = range.find('-');
+    if (dash == std::string_view::npos) {
+      return std::nullopt;
+    }
+
+    std::uint64_t begin;
+    std::uint64_t end;
+
+    // bytes=-N is the last N bytes
+    if (dash == 0) {
+      if (!parse(range.substr(1), end) || end == 0 || size == 0) {
+        return std::nullopt;
+      }
+
+      return std::pair {size - std::min(end, size), size};
+    }
+
+    if (!parse(range.substr(0, dash), begin) || begin >= size) {
+      return std::nullopt;
+    }
+
+    if (dash == range.size() - 1) {
+      return std::pair {begin, size};
+    }
+
+    if (!parse(range.substr(dash + 1), end) || end < begin) {
+      return std::nullopt;
+    }
+
+    return std::pair {begin, std::min(end + 1, size)};
+  }
+
+  /**
+   * @brief Find the end of the last complete line in a part of the log file.
+   * The log is written while it's read, this keeps the line being written for the next request.
+   * @param stream The stream of the log file.
+   * @param begin Start of the part.
+   * @param end End of the part.
+   * @return The end of the last complete line, or `end` if none is found near the end.
+   */
+  std::uint64_t complete_lines_end(log_stream_t &stream, std::uint64_t begin, std::uint64_t end) {
+    auto window = std::min<std::uint64_t>(end - begin, stream.block.size());
+
+    stream.file.seekg(end - window);
+    if (!stream.file.read(stream.block.data(), window)) {
+      stream.file.clear();
+      return end;
+    }
+
+    std::string_view tail {stream.block.data(), window};
+    auto newline = tail.rfind('\n');
+    if (newline == std::string_view::npos) {
+      // Without a line break in the whole part, the only line is the one being written
+      return window == end - begin ? begin : end;
+    }
+
+    return end - window + newline + 1;
+  }
+
+  /**
+   * @brief Keep the lines of a block of the log file that pass the severity filter.
+   * @param stream The stream of the log file.
+   * @param data The block, the last line may be incomplete.
+   * @return The lines to send.
+   */
+  std::string filter_log_lines(log_stream_t &stream, std::string_view data) {
+    std::string lines = std::move(stream.partial_line);
+    lines.append(data);
+
+    std::string filtered;
+    std::string_view view = lines;
+    while (!view.empty()) {
+      auto newline = view.find('\n');
+
+      // Hold back an incomplete line until the next block, unless this is the last one
+      if (newline == std::string_view::npos && stream.remaining > 0) {
+        stream.partial_line = view;
+        break;
+      }
+
+      auto line = view.substr(0, newline == std::string_view::npos ? view.size() : newline + 1);
+      view.remove_prefix(line.size());
+
+      if (auto severity = logging::line_severity(line)) {
+        stream.keep_message = *severity >= *stream.min_severity;
+      }
+
+      if (stream.keep_message) {
+        filtered.append(line);
+      }
+    }
+
+    return filtered;
+  }
+
+  /**
+   * @brief Send the next block of the log file, then schedule the one after it.
+   * @param response The HTTP response object.
+   * @param stream The stream of the log file.
+   */
+  void send_log_block(resp_https_t response, std::shared_ptr<log_stream_t> stream) {
+    auto length = (std::size_t) std::min<std::uint64_t>(stream->remaining, stream->block.size());
+    if (!stream->file.read(stream->block.data(), length)) {
+      // The log file was truncated while it was read
+      BOOST_LOG(warning) << "Couldn't read log file: ["sv << config::sunshine.log_file << ']';
+      length = stream->file.gcount();
+      stream->remaining = length;
+      response->close_connection_after_response = true;
+    }
+    stream->remaining -= length;
+
+    std::string_view data {stream->block.data(), length};
+    if (stream->min_severity) {
+      auto lines = filter_log_lines(*stream, data);
+
+      // An empty chunk would end the response
+      if (!lines.empty()) {
+        *response << std::hex << lines.size() << std::dec << "\r\n"sv << lines << "\r\n"sv;
+      }
+
+      if (stream->remaining == 0) {
+        *response << "0\r\n\r\n"sv;
+      }
+    } else {
+      response->write(data.data(), data.size());
+    }
+
+    if (stream->remaining == 0) {
+      return;
+    }
+
+    response->send([response, stream](const SimpleWeb::error_code &ec) {
+      if (!ec) {
+        send_log_block(response, stream);
+      }
+    });
+  }
+
   /**
    * @brief Get the logs from the log file.
    * @param response The HTTP response object.
    * @param request The HTTP request object.
    *
+   * The log file is streamed, so only a block of it is in memory at a time.
+   * Part of the log can be requested with a single `Range` header, which gets a `206 Partial Content` response.
+   * The query string may contain:
+   * - `offset`: Only send the log from this byte on, leaving out the line that is still being written.
+   *   Use the `X-Log-Offset` header of the previous response to follow the log.
+   *   If the log is shorter than the offset, it was replaced and is sent from the start.
+   * - `level`: Only send messages of at least this level, as a name (e.g. `warning`) or a number.
+   *   Filtered logs are sent in chunked transfer encoding.
+   *
+   * The `X-Log-Offset` header of the response is the end of the part that was sent.
+   *
    * @api_examples{/api/logs| GET| null}
    */
   void getLogs(resp_https_t response, req_https_t request) {
@@ -998,12 +1828,90 @@ namespace confighttp {
 
     print_req(request);
 
-    std::string content = file_handler::read_file(config::sunshine.log_file.c_str());
+    auto stream = std::make_shared<log_stream_t>();
+
+    std::error_code ec;
+    std::uint64_t size = fs::file_size(config::sunshine.log_file, ec);
+    stream->file.open(config::sunshine.log_file, std::ios::binary);
+    if (ec || !stream->file) {
+      BOOST_LOG(warning) << "Couldn't open log file: ["sv << config::sunshine.log_file << ']';
+      not_found(response, request);
+      return;
+    }
+
+    auto args = request->parse_query_string();
+
+    auto level = args.find("level");
+    if (level != args.end()) {
+      constexpr std::string_view levels[] {"verbose"sv, "debug"sv, "info"sv, "warning"sv, "error"sv, "fatal"sv};
+
+      auto name = std::find(std::begin(levels), std::end(levels), level->second);
+      if (name != std::end(levels)) {
+        stream->min_severity = (int) (name - std::begin(levels));
+      } else if (level->second.size() == 1 && level->second[0] >= '0' && level->second[0] <= '5') {
+        stream->min_severity = level->second[0] - '0';
+      } else {
+        bad_request(response, request, "Invalid log level");
+        return;
+      }
+    }
+
+    std::uint64_t begin = 0;
+    std::uint64_t end = size;
+    auto status = SimpleWeb::StatusCode::success_ok;
+
     SimpleWeb::CaseInsensitiveMultimap headers;
     headers.emplace("Content-Type", "text/plain");
     headers.emplace("X-Frame-Options", "DENY");
     headers.emplace("Content-Security-Policy", "frame-ancestors 'none';");
-    response->write(SimpleWeb::StatusCode::success_ok, content, headers);
+
+    auto offset = args.find("offset");
+    auto range_header = request->header.find("range");
+    if (offset != args.end()) {
+      try {
+        begin = std::stoull(offset->second);
+      } catch (const std::exception &) {
+        bad_request(response, request, "Invalid log offset");
+        return;
+      }
+
+      if (begin > size) {
+        begin = 0;
+      }
+      end = complete_lines_end(*stream, begin, size);
+    } else if (range_header != request->header.end() && range_header->second.find(',') == std::string::npos) {
+      auto range = parse_range(range_header->second, size);
+      if (!range) {
+        headers.emplace("Content-Range", std::format("bytes */{}", size));
+        response->write(SimpleWeb::StatusCode::client_error_range_not_satisfiable, headers);
+        return;
+      }
+
+      std::tie(begin, end) = *range;
+      if (!stream->min_severity) {
+        status = SimpleWeb::StatusCode::success_partial_content;
+        headers.emplace("Content-Range", std::format("bytes {}-{}/{}", begin, end - 1, size));
+      }
+    }
+
+    headers.emplace("X-Log-Offset", std::to_string(end));
+    if (stream->min_severity) {
+      headers.emplace("Transfer-Encoding", "chunked");
+    } else {
+      headers.emplace("Content-Length", std::to_string(end - begin));
+    }
+    response->write(status, headers);
+
+    if (begin == end) {
+      if (stream->min_severity) {
+        *response << "0\r\n\r\n"sv;
+      }
+      return;
+    }
+
+    stream->file.seekg(begin);
+    stream->remaining = end - begin;
+    send_log_block(response, stream);
   }
 
   /**
@@ -1057,6 +1965,7 @@ namespace confighttp {
           if (newPassword.empty() || newPassword != confirmPassword) {
             errors.emplace_back("Password Mismatch");
           } else {
+            std::lock_guard lg {creds_lock};
             http::save_user_creds(config::sunshine.credentials_file, newUsername, newPassword);
             http::reload_user_creds(config::sunshine.credentials_file);
             output_tree["status"] = true;
@@ -1171,12 +2080,30 @@ namespace confighttp {
     platf::restart();
   }
 
+  /**
+   * @brief Wrap a handler that changes files or state so it doesn't run alongside another such handler.
+   * @param handler The handler to wrap.
+   * @return The wrapped handler.
+   */
+  auto serialized(void (*handler)(resp_https_t, req_https_t)) {
+    return [handler](resp_https_t response, req_https_t request) {
+      std::lock_guard lg {write_lock};
+      handler(std::move(response), std::move(request));
+    };
+  }
+
   void start() {
     auto shutdown_event = mail::man->event<bool>(mail::shutdown);
 
     auto port_https = net::map_port(PORT_HTTPS);
     auto address_family = net::af_from_enum_string(config::sunshine.address_family);
 
+    if (http::wait_for_creds()) {
+      BOOST_LOG(fatal) << "Couldn't create the credentials of the Configuration HTTPS server"sv;
+      shutdown_event->raise(true);
+      return;
+    }
+
     https_server_t server {config::nvhttp.cert, config::nvhttp.pkey};
     server.default_resource["DELETE"] = [](resp_https_t response, req_https_t request) {
       bad_request(response, request);
@@ -1199,28 +2126,38 @@ namespace confighttp {
     server.resource["^/password/?$"]["GET"] = getPasswordPage;
     server.resource["^/welcome/?$"]["GET"] = getWelcomePage;
     server.resource["^/troubleshooting/?$"]["GET"] = getTroubleshootingPage;
-    server.resource["^/api/pin$"]["POST"] = savePin;
+    server.resource["^/api/pin$"]["POST"] = serialized(savePin);
     server.resource["^/api/apps$"]["GET"] = getApps;
     server.resource["^/api/logs$"]["GET"] = getLogs;
-    server.resource["^/api/apps$"]["POST"] = saveApp;
+    server.resource["^/api/apps$"]["POST"] = serialized(saveApp);
     server.resource["^/api/config$"]["GET"] = getConfig;
-    server.resource["^/api/config$"]["POST"] = saveConfig;
+    server.resource["^/api/config$"]["POST"] = serialized(saveConfig);
+    server.resource["^/api/config/reload$"]["POST"] = serialized(reloadConfig);
     server.resource["^/api/configLocale$"]["GET"] = getLocale;
     server.resource["^/api/restart$"]["POST"] = restart;
-    server.resource["^/api/reset-display-device-persistence$"]["POST"] = resetDisplayDevicePersistence;
-    server.resource["^/api/password$"]["POST"] = savePassword;
-    server.resource["^/api/apps/([0-9]+)$"]["DELETE"] = deleteApp;
-    server.resource["^/api/clients/unpair-all$"]["POST"] = unpairAll;
+    server.resource["^/api/reset-display-device-persistence$"]["POST"] = serialized(resetDisplayDevicePersistence);
+    server.resource["^/api/password$"]["POST"] = serialized(savePassword);
+    server.resource["^/api/apps/([0-9]+)$"]["DELETE"] = serialized(deleteApp);
+    server.resource["^/api/clients/unpair-all$"]["POST"] = serialized(unpairAll);
     server.resource["^/api/clients/list$"]["GET"] = getClients;
-    server.resource["^/api/clients/unpair$"]["POST"] = unpair;
-    server.resource["^/api/apps/close$"]["POST"] = closeApp;
-    server.resource["^/api/covers/upload$"]["POST"] = uploadCover;
+    server.resource["^/api/clients/unpair$"]["POST"] = serialized(unpair);
+    server.resource["^/api/apps/close$"]["POST"] = serialized(closeApp);
+    server.resource["^/api/sessions/network$"]["GET"] = getNetworkStats;
+    server.resource["^/api/sessions/launch$"]["GET"] = getLaunchStatus;
+    server.resource["^/api/sessions/live$"]["GET"] = getLiveStats;
+    server.resource["^/api/sessions/bitrate$"]["POST"] = serialized(setSessionBitrate);
+    server.resource["^/api/trace$"]["GET"] = getTrace;
+    server.resource["^/api/trace$"]["POST"] = serialized(setTrace);
+    server.resource["^/metrics$"]["GET"] = getMetrics;
+    server.resource["^/api/dvr/clip$"]["POST"] = serialized(saveDvrClip);
+    server.resource["^/api/covers/upload$"]["POST"] = serialized(uploadCover);
     server.resource["^/images/sunshine.ico$"]["GET"] = getFaviconImage;
     server.resource["^/images/logo-sunshine-45.png$"]["GET"] = getSunshineLogoImage;
     server.resource["^/assets\\/.+$"]["GET"] = getNodeModules;
     server.config.reuse_address = true;
     server.config.address = net::af_to_any_address_string(address_family);
     server.config.port = port_https;
+    server.config.thread_pool_size = config::sunshine.web_ui_threads;
 
     auto accept_and_run = [&](auto *server) {
       try {
@@ -1239,10 +2176,18 @@ namespace confighttp {
       }
     };
     std::thread tcp {accept_and_run, &server};
+    std::thread live_stats_thread {live_stats_producer};
 
     // Wait for any event
     shutdown_event->view();
 
+    {
+      std::lock_guard lg {live_stats.lock};
+      live_stats.stopped = true;
+    }
+    live_stats.stop_cv.notify_one();
+    live_stats_thread.join();
+
     server.stop();
 
     tcp.join();
@@ -2,13 +2,24 @@
  * @file src/crypto.cpp
  * @brief Definitions for cryptography functions.
  */
+// standard includes
+#include <optional>
+
 // lib includes
+#include <openssl/ec.h>
+#include <openssl/kdf.h>
 #include <openssl/pem.h>
 #include <openssl/rsa.h>
 
 // local includes
 #include "crypto.h"
 
+#if defined(__linux__) && (defined(__aarch64__) || defined(__arm__))
+  // For the AES instructions of ARM CPUs
+  #include <asm/hwcap.h>
+  #include <sys/auxv.h>
+#endif
+
 namespace crypto {
   using asn1_string_t = util::safe_ptr<ASN1_STRING, ASN1_STRING_free>;
 
@@ -17,7 +28,26 @@ namespace crypto {
       _cert_ctx {X509_STORE_CTX_new()} {
   }
 
+  /**
+   * @brief Get the SHA-256 fingerprint of a certificate.
+   * @param cert The certificate.
+   * @return The fingerprint, or `std::nullopt` if it couldn't be computed.
+   */
+  static std::optional<sha256_t> fingerprint(x509_t::element_type *cert) {
+    sha256_t digest;
+    unsigned int length = digest.size();
+    if (X509_digest(cert, EVP_sha256(), digest.data(), &length) != 1) {
+      return std::nullopt;
+    }
+
+    return digest;
+  }
+
   void cert_chain_t::add(x509_t &&cert) {
+    if (auto digest = fingerprint(cert.get())) {
+      _fingerprints.emplace(*digest);
+    }
+
     x509_store_t x509_store {X509_STORE_new()};
 
     X509_STORE_add_cert(x509_store.get(), cert.get());
@@ -26,6 +56,7 @@ namespace crypto {
 
   void cert_chain_t::clear() {
     _certs.clear();
+    _fingerprints.clear();
   }
 
   static int openssl_verify_cb(int ok, X509_STORE_CTX *ctx) {
@@ -57,6 +88,12 @@ namespace crypto {
    * @return nullptr if the certificate is valid, otherwise an error string.
    */
   const char *cert_chain_t::verify(x509_t::element_type *cert) {
+    // An identical certificate is in one of the stores, so it would pass
+    auto digest = fingerprint(cert);
+    if (digest && _fingerprints.count(*digest)) {
+      return nullptr;
+    }
+
     int err_code = 0;
     for (auto &[_, x509_store] : _certs) {
       auto fg = util::fail_guard([this]() {
@@ -74,6 +111,10 @@ namespace crypto {
       auto err = X509_verify_cert(_cert_ctx.get());
 
       if (err == 1) {
+        if (digest) {
+          _fingerprints.emplace(*digest);
+        }
+
         return nullptr;
       }
 
@@ -89,18 +130,22 @@ namespace crypto {
 
   namespace cipher {
 
-    static int init_decrypt_gcm(cipher_ctx_t &ctx, aes_t *key, aes_t *iv, bool padding) {
+    static const EVP_CIPHER *evp_cipher(aead_e aead) {
+      return aead == aead_e::chacha20_poly1305 ? EVP_chacha20_poly1305() : EVP_aes_128_gcm();
+    }
+
+    static int init_decrypt_gcm(cipher_ctx_t &ctx, aes_t *key, aes_t *iv, bool padding, aead_e aead) {
       ctx.reset(EVP_CIPHER_CTX_new());
 
       if (!ctx) {
         return -1;
       }
 
-      if (EVP_DecryptInit_ex(ctx.get(), EVP_aes_128_gcm(), nullptr, nullptr, nullptr) != 1) {
+      if (EVP_DecryptInit_ex(ctx.get(), evp_cipher(aead), nullptr, nullptr, nullptr) != 1) {
         return -1;
       }
 
-      if (EVP_CIPHER_CTX_ctrl(ctx.get(), EVP_CTRL_GCM_SET_IVLEN, iv->size(), nullptr) != 1) {
+      if (EVP_CIPHER_CTX_ctrl(ctx.get(), EVP_CTRL_AEAD_SET_IVLEN, iv->size(), nullptr) != 1) {
         return -1;
       }
 
@@ -112,15 +157,15 @@ namespace crypto {
       return 0;
     }
 
-    static int init_encrypt_gcm(cipher_ctx_t &ctx, aes_t *key, aes_t *iv, bool padding) {
+    static int init_encrypt_gcm(cipher_ctx_t &ctx, aes_t *key, aes_t *iv, bool padding, aead_e aead) {
       ctx.reset(EVP_CIPHER_CTX_new());
 
       // Gen 7 servers use 128-bit AES ECB
-      if (EVP_EncryptInit_ex(ctx.get(), EVP_aes_128_gcm(), nullptr, nullptr, nullptr) != 1) {
+      if (EVP_EncryptInit_ex(ctx.get(), evp_cipher(aead), nullptr, nullptr, nullptr) != 1) {
         return -1;
       }
 
-      if (EVP_CIPHER_CTX_ctrl(ctx.get(), EVP_CTRL_GCM_SET_IVLEN, iv->size(), nullptr) != 1) {
+      if (EVP_CIPHER_CTX_ctrl(ctx.get(), EVP_CTRL_AEAD_SET_IVLEN, iv->size(), nullptr) != 1) {
         return -1;
       }
 
@@ -146,7 +191,7 @@ namespace crypto {
     }
 
     int gcm_t::decrypt(const std::string_view &tagged_cipher, std::vector<std::uint8_t> &plaintext, aes_t *iv) {
-      if (!decrypt_ctx && init_decrypt_gcm(decrypt_ctx, &key, iv, padding)) {
+      if (!decrypt_ctx && init_decrypt_gcm(decrypt_ctx, &key, iv, padding, aead)) {
         return -1;
       }
 
@@ -167,7 +212,7 @@ namespace crypto {
         return -1;
       }
 
-      if (EVP_CIPHER_CTX_ctrl(decrypt_ctx.get(), EVP_CTRL_GCM_SET_TAG, tag.size(), const_cast<char *>(tag.data())) != 1) {
+      if (EVP_CIPHER_CTX_ctrl(decrypt_ctx.get(), EVP_CTRL_AEAD_SET_TAG, tag.size(), const_cast<char *>(tag.data())) != 1) {
         return -1;
       }
 
@@ -185,7 +230,7 @@ namespace crypto {
      * The resulting ciphertext and the GCM tag are written into the tagged_cipher buffer.
      */
     int gcm_t::encrypt(const std::string_view &plaintext, std::uint8_t *tag, std::uint8_t *ciphertext, aes_t *iv) {
-      if (!encrypt_ctx && init_encrypt_gcm(encrypt_ctx, &key, iv, padding)) {
+      if (!encrypt_ctx && init_encrypt_gcm(encrypt_ctx, &key, iv, padding, aead)) {
         return -1;
       }
 
@@ -207,7 +252,7 @@ namespace crypto {
         return -1;
       }
 
-      if (EVP_CIPHER_CTX_ctrl(encrypt_ctx.get(), EVP_CTRL_GCM_GET_TAG, tag_size, tag) != 1) {
+      if (EVP_CIPHER_CTX_ctrl(encrypt_ctx.get(), EVP_CTRL_AEAD_GET_TAG, tag_size, tag) != 1) {
         return -1;
       }
 
@@ -280,28 +325,43 @@ namespace crypto {
      * The resulting ciphertext is written into the cipher buffer.
      */
     int cbc_t::encrypt(const std::string_view &plaintext, std::uint8_t *cipher, aes_t *iv) {
-      if (!encrypt_ctx && init_encrypt_cbc(encrypt_ctx, &key, iv, padding)) {
-        return -1;
+      // The padding is added here, so the context only ever sees whole blocks
+      if (!encrypt_ctx) {
+        if (init_encrypt_cbc(encrypt_ctx, &key, iv, false)) {
+          return -1;
+        }
+        std::copy_n(std::begin(*iv), chain.size(), std::begin(chain));
       }
 
-      // Calling with cipher == nullptr results in a parameter change
-      // without requiring a reallocation of the internal cipher ctx.
-      if (EVP_EncryptInit_ex(encrypt_ctx.get(), nullptr, nullptr, nullptr, iv->data()) != 1) {
-        return false;
+      auto size = plaintext.size();
+      if (padding) {
+        size = (size / 16 + 1) * 16;
+      } else if (size % 16) {
+        return -1;
+      }
+      if (size == 0) {
+        return 0;
       }
 
-      int update_outlen, final_outlen;
+      std::copy(std::begin(plaintext), std::end(plaintext), cipher);
+      std::fill(cipher + plaintext.size(), cipher + size, (std::uint8_t) (size - plaintext.size()));
 
-      // Encrypt into the caller's buffer
-      if (EVP_EncryptUpdate(encrypt_ctx.get(), cipher, &update_outlen, (const std::uint8_t *) plaintext.data(), plaintext.size()) != 1) {
-        return -1;
+      // CBC encrypts the first block XORed with the IV, the context XORs it with the last block it encrypted instead.
+      // Folding both into the block gives the ciphertext a context restarted at the IV would, without restarting it.
+      for (std::size_t x = 0; x < chain.size(); ++x) {
+        cipher[x] ^= (*iv)[x] ^ chain[x];
       }
 
-      if (EVP_EncryptFinal_ex(encrypt_ctx.get(), cipher + update_outlen, &final_outlen) != 1) {
+      // Encrypt in place, a single call per packet
+      int update_outlen;
+      if (EVP_EncryptUpdate(encrypt_ctx.get(), cipher, &update_outlen, cipher, size) != 1 || update_outlen != (int) size) {
+        // The context chains from a block that is unknown now
+        encrypt_ctx.reset();
         return -1;
       }
 
-      return update_outlen + final_outlen;
+      std::copy_n(cipher + size - chain.size(), chain.size(), std::begin(chain));
+      return update_outlen;
     }
 
     ecb_t::ecb_t(const aes_t &key, bool padding):
@@ -312,8 +372,14 @@ namespace crypto {
         cipher_t {nullptr, nullptr, key, padding} {
     }
 
-    gcm_t::gcm_t(const crypto::aes_t &key, bool padding):
-        cipher_t {nullptr, nullptr, key, padding} {
+    gcm_t::gcm_t(const crypto::aes_t &key, bool padding, aead_e aead):
+        cipher_t {nullptr, nullptr, key, padding},
+        aead {aead} {
+      // ChaCha20 takes a 256-bit key
+      if (aead == aead_e::chacha20_poly1305) {
+        auto chacha_key = chacha20_video_key(key);
+        this->key.assign(std::begin(chacha_key), std::end(chacha_key));
+      }
     }
 
   }  // namespace cipher
@@ -334,6 +400,25 @@ namespace crypto {
     return key;
   }
 
+  sha256_t chacha20_video_key(const aes_t &key) {
+    sha256_t derived {};
+
+    pkey_ctx_t ctx {EVP_PKEY_CTX_new_id(EVP_PKEY_HKDF, nullptr)};
+    auto length = derived.size();
+    if (!ctx ||
+        EVP_PKEY_derive_init(ctx.get()) <= 0 ||
+        EVP_PKEY_CTX_set_hkdf_md(ctx.get(), EVP_sha256()) <= 0 ||
+        EVP_PKEY_CTX_set1_hkdf_key(ctx.get(), key.data(), (int) key.size()) <= 0 ||
+        EVP_PKEY_CTX_add1_hkdf_info(ctx.get(), (const unsigned char *) CHACHA20_VIDEO_KEY_INFO.data(), (int) CHACHA20_VIDEO_KEY_INFO.size()) <= 0 ||
+        EVP_PKEY_derive(ctx.get(), derived.data(), &length) <= 0 ||
+        length != derived.size()) {
+      // Only fails when OpenSSL runs out of memory, the client then can't open a single frame sealed with it
+      return {};
+    }
+
+    return derived;
+  }
+
   sha256_t hash(const std::string_view &plaintext) {
     sha256_t hsh;
     EVP_Digest(plaintext.data(), plaintext.size(), hsh.data(), nullptr, EVP_sha256(), nullptr);
@@ -391,6 +476,23 @@ namespace crypto {
     return {(const char *) asn1->data, (std::size_t) asn1->length};
   }
 
+  bool aes_hardware() {
+    static const bool supported = []() {
+#if defined(__x86_64__) || defined(__i386__)
+      return (bool) __builtin_cpu_supports("aes");
+#elif defined(__aarch64__) && defined(__linux__)
+      return (getauxval(AT_HWCAP) & HWCAP_AES) != 0;
+#elif defined(__arm__) && defined(__linux__)
+      return (getauxval(AT_HWCAP2) & HWCAP2_AES) != 0;
+#else
+      // Apple silicon always has them, elsewhere they are assumed
+      return true;
+#endif
+    }();
+
+    return supported;
+  }
+
   std::string rand(std::size_t bytes) {
     std::string r;
     r.resize(bytes);
@@ -424,14 +526,11 @@ namespace crypto {
     return digest;
   }
 
-  creds_t gen_creds(const std::string_view &cn, std::uint32_t key_bits) {
+  /**
+   * @brief Self-sign a certificate for the key.
+   */
+  static creds_t self_sign(const std::string_view &cn, pkey_t &pkey) {
     x509_t x509 {X509_new()};
-    pkey_ctx_t ctx {EVP_PKEY_CTX_new_id(EVP_PKEY_RSA, nullptr)};
-    pkey_t pkey;
-
-    EVP_PKEY_keygen_init(ctx.get());
-    EVP_PKEY_CTX_set_rsa_keygen_bits(ctx.get(), key_bits);
-    EVP_PKEY_keygen(ctx.get(), &pkey);
 
     X509_set_version(x509.get(), 2);
 
@@ -467,6 +566,29 @@ namespace crypto {
     return {pem(x509), pem(pkey)};
   }
 
+  creds_t gen_creds(const std::string_view &cn, std::uint32_t key_bits) {
+    pkey_ctx_t ctx {EVP_PKEY_CTX_new_id(EVP_PKEY_RSA, nullptr)};
+    pkey_t pkey;
+
+    EVP_PKEY_keygen_init(ctx.get());
+    EVP_PKEY_CTX_set_rsa_keygen_bits(ctx.get(), key_bits);
+    EVP_PKEY_keygen(ctx.get(), &pkey);
+
+    return self_sign(cn, pkey);
+  }
+
+  creds_t gen_ecdsa_creds(const std::string_view &cn) {
+    pkey_ctx_t ctx {EVP_PKEY_CTX_new_id(EVP_PKEY_EC, nullptr)};
+    pkey_t pkey;
+
+    EVP_PKEY_keygen_init(ctx.get());
+    EVP_PKEY_CTX_set_ec_paramgen_curve_nid(ctx.get(), NID_X9_62_prime256v1);
+    EVP_PKEY_CTX_set_ec_param_enc(ctx.get(), OPENSSL_EC_NAMED_CURVE);
+    EVP_PKEY_keygen(ctx.get(), &pkey);
+
+    return self_sign(cn, pkey);
+  }
+
   std::vector<uint8_t> sign256(const pkey_t &pkey, const std::string_view &data) {
     return sign(pkey, data, EVP_sha256());
   }
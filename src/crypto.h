@@ -6,6 +6,7 @@
 
 // standard includes
 #include <array>
+#include <set>
 
 // lib includes
 #include <openssl/evp.h>
@@ -44,6 +45,9 @@ namespace crypto {
    */
   sha256_t hash(const std::string_view &plaintext);
 
+  // HKDF info that ties the ChaCha20 key to the video stream of the experimental protocol extension
+  constexpr std::string_view CHACHA20_VIDEO_KEY_INFO {"Sunshine video ChaCha20-Poly1305 v1"};
+
   aes_t gen_aes_key(const std::array<uint8_t, 16> &salt, const std::string_view &pin);
   x509_t x509(const std::string_view &x);
   pkey_t pkey(const std::string_view &k);
@@ -55,8 +59,29 @@ namespace crypto {
 
   creds_t gen_creds(const std::string_view &cn, std::uint32_t key_bits);
 
+  /**
+   * @brief Generate an ECDSA P-256 key with a self-signed certificate.
+   * Much faster to generate than an RSA key, and cheaper during the TLS handshake.
+   */
+  creds_t gen_ecdsa_creds(const std::string_view &cn);
+
   std::string_view signature(const x509_t &x);
 
+  /**
+   * @brief Check if the CPU has instructions for AES, without them AES-GCM is much slower than ChaCha20-Poly1305.
+   * @return `true` if it does, or if it can't be told on this platform.
+   */
+  bool aes_hardware();
+
+  /**
+   * @brief Derive the ChaCha20-Poly1305 key of the video stream from the AES key of the session.
+   * HKDF-SHA256 (RFC 5869) with the AES key as input keying material, no salt,
+   * CHACHA20_VIDEO_KEY_INFO as info and 32 bytes of output.
+   * @param key The AES key of the session.
+   * @return The 256-bit ChaCha20 key.
+   */
+  sha256_t chacha20_video_key(const aes_t &key);
+
   std::string rand(std::size_t bytes);
   std::string rand_alphabet(std::size_t bytes, const std::string_view &alphabet = std::string_view {"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789!%&()=-"});
 
@@ -68,11 +93,21 @@ namespace crypto {
 
     void clear();
 
+    /**
+     * @brief Verify a client certificate against the added certificates.
+     * Certificates are looked up by their SHA-256 fingerprint first, so an added certificate or one that
+     * passed before is accepted without verifying it against every added certificate.
+     * @param cert The certificate to verify.
+     * @return nullptr if the certificate is valid, otherwise an error string.
+     */
     const char *verify(x509_t::element_type *cert);
 
   private:
     std::vector<std::pair<x509_t, x509_store_t>> _certs;
     x509_store_ctx_t _cert_ctx;
+
+    // Fingerprints of the added certificates and of the certificates that passed verification
+    std::set<sha256_t> _fingerprints;
   };
 
   namespace cipher {
@@ -104,13 +139,21 @@ namespace crypto {
       int decrypt(const std::string_view &cipher, std::vector<std::uint8_t> &plaintext);
     };
 
+    /**
+     * @brief The algorithm of an AEAD cipher.
+     */
+    enum class aead_e {
+      aes_128_gcm,  ///< AES-128 in GCM mode
+      chacha20_poly1305,  ///< ChaCha20-Poly1305, keyed with chacha20_video_key() of the AES key
+    };
+
     class gcm_t: public cipher_t {
     public:
       gcm_t() = default;
       gcm_t(gcm_t &&) noexcept = default;
       gcm_t &operator=(gcm_t &&) noexcept = default;
 
-      gcm_t(const crypto::aes_t &key, bool padding = true);
+      gcm_t(const crypto::aes_t &key, bool padding = true, aead_e aead = aead_e::aes_128_gcm);
 
       /**
        * @brief Encrypts the plaintext using AES GCM mode.
@@ -133,6 +176,9 @@ namespace crypto {
       int encrypt(const std::string_view &plaintext, std::uint8_t *tagged_cipher, aes_t *iv);
 
       int decrypt(const std::string_view &cipher, std::vector<std::uint8_t> &plaintext, aes_t *iv);
+
+    private:
+      aead_e aead = aead_e::aes_128_gcm;
     };
 
     class cbc_t: public cipher_t {
@@ -145,13 +191,19 @@ namespace crypto {
 
       /**
        * @brief Encrypts the plaintext using AES CBC mode.
-       * length of cipher must be at least: round_to_pkcs7_padded(plaintext.size())
+       * The context is set up once and never reinitialized, a new IV is folded into the first block instead.
+       * length of cipher must be at least: round_to_pkcs7_padded(plaintext.size() + 1)
+       * Without padding, the plaintext must be a multiple of 16 bytes.
        * @param plaintext The plaintext data to be encrypted.
        * @param cipher The buffer where the resulting ciphertext will be written.
        * @param iv The initialization vector to be used for the encryption.
        * @return The total length of the ciphertext written into cipher. Returns -1 in case of an error.
        */
       int encrypt(const std::string_view &plaintext, std::uint8_t *cipher, aes_t *iv);
+
+    private:
+      // Last block the context encrypted, which it chains the next one from
+      std::array<std::uint8_t, 16> chain {};
     };
   }  // namespace cipher
 }  // namespace crypto
@@ -12,6 +12,7 @@
 #include <display_device/json.h>
 #include <display_device/retry_scheduler.h>
 #include <display_device/settings_manager_interface.h>
+#include <future>
 #include <mutex>
 #include <regex>
 
@@ -40,6 +41,15 @@ namespace display_device {
       std::unique_ptr<RetryScheduler<SettingsManagerInterface>> sm_instance {nullptr};
     } DD_DATA;
 
+    /**
+     * @brief The configuration started by `display_device::configure_display_async(...)`.
+     * It has its own mutex, the task holds the one of DD_DATA while it applies the settings.
+     */
+    struct {
+      std::mutex mutex {};
+      std::shared_future<void> configured {};
+    } PENDING;
+
     /**
      * @brief Helper class for capturing audio context when the API demands it.
      *
@@ -727,6 +737,8 @@ namespace display_device {
     class deinit_t: public platf::deinit_t {
     public:
       ~deinit_t() override {
+        wait_for_configuration();
+
         std::lock_guard lock {DD_DATA.mutex};
         try {
           // This may throw if used incorrectly. At the moment this will not happen, however
@@ -790,12 +802,55 @@ namespace display_device {
                                   {.m_sleep_durations = {DEFAULT_RETRY_INTERVAL}});
   }
 
+  void configure_display_async(const config::video_t &video_config, const rtsp_stream::launch_session_t &session) {
+    // The session may be gone before the task runs, only its parsed configuration is carried over
+    auto result {parse_configuration(video_config, session)};
+    if (std::holds_alternative<failed_to_parse_tag_t>(result)) {
+      // Error already logged, and we also don't want to revert active configuration in case we have any
+      return;
+    }
+
+    std::lock_guard lock {PENDING.mutex};
+    PENDING.configured = std::async(std::launch::async, [previous = PENDING.configured, result = std::move(result)]() {
+      // Configurations of consecutive sessions have to apply in the order they were started
+      if (previous.valid()) {
+        previous.wait();
+      }
+
+      if (const auto *parsed_config {std::get_if<SingleDisplayConfiguration>(&result)}; parsed_config) {
+        configure_display(*parsed_config);
+        return;
+      }
+
+      // Not revert_configuration(), it would wait for this very task
+      std::lock_guard lock {DD_DATA.mutex};
+      revert_configuration_unlocked(revert_option_e::try_indefinitely_with_delay);
+    }).share();
+  }
+
+  void wait_for_configuration() {
+    std::shared_future<void> configured;
+    {
+      std::lock_guard lock {PENDING.mutex};
+      configured = PENDING.configured;
+    }
+
+    if (configured.valid()) {
+      configured.wait();
+    }
+  }
+
   void revert_configuration() {
+    // A configuration still being applied would otherwise land after the revert
+    wait_for_configuration();
+
     std::lock_guard lock {DD_DATA.mutex};
     revert_configuration_unlocked(revert_option_e::try_indefinitely_with_delay);
   }
 
   bool reset_persistence() {
+    wait_for_configuration();
+
     std::lock_guard lock {DD_DATA.mutex};
     if (!DD_DATA.sm_instance) {
       // Platform is not supported, assume success.
@@ -86,6 +86,35 @@ namespace display_device {
    */
   void configure_display(const SingleDisplayConfiguration &config);
 
+  /**
+   * @brief Configure the display device like `configure_display(video_config, session)`, but in the background.
+   *
+   * Changing the display mode can take seconds, the launch of a session carries on meanwhile
+   * and only waits with `wait_for_configuration()` where it needs the new mode, such as before
+   * probing the encoders, starting the app or capturing the display.
+   *
+   * @param video_config User's video related configuration.
+   * @param session Session information, only used before this returns.
+   *
+   * @examples
+   * configure_display_async(config::video, *launch_session);
+   * // ...
+   * wait_for_configuration();
+   * @examples_end
+   */
+  void configure_display_async(const config::video_t &video_config, const rtsp_stream::launch_session_t &session);
+
+  /**
+   * @brief Wait until the configuration started by `configure_display_async(...)` has been applied.
+   * @note Returns right away if no configuration is pending. Retries of a configuration that failed
+   *       due to transient issues are not waited for.
+   *
+   * @examples
+   * wait_for_configuration();
+   * @examples_end
+   */
+  void wait_for_configuration();
+
   /**
    * @brief Revert the display configuration and restore the previous state.
    *
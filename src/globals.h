@@ -5,8 +5,11 @@
 #pragma once
 
 // local includes
+#include "audio.h"
 #include "entry_handler.h"
+#include "input.h"
 #include "thread_pool.h"
+#include "video.h"
 
 /**
  * @brief A thread pool for processing tasks.
@@ -32,29 +35,33 @@ extern nvprefs::nvprefs_interface nvprefs_instance;
  * @brief Handles process-wide communication.
  */
 namespace mail {
-#define MAIL(x) \
-  constexpr auto x = std::string_view { \
-    #x \
-  }
+#define MAIL(x, index, ...) \
+  constexpr safe::mail_id_t<__VA_ARGS__, index> x {}
 
   /**
    * @brief A process-wide communication mechanism.
    */
   extern safe::mail_t man;
 
+  // Every mail has its own slot, see safe::MAX_MAIL
+
   // Global mail
-  MAIL(shutdown);
-  MAIL(broadcast_shutdown);
-  MAIL(video_packets);
-  MAIL(audio_packets);
-  MAIL(switch_display);
+  MAIL(shutdown, 0, safe::signal_t);
+  MAIL(broadcast_shutdown, 1, safe::signal_t);
+  MAIL(video_packets, 2, safe::ring_t<video::packet_t>);
+  MAIL(audio_packets, 3, safe::queue_t<audio::packet_t>);
+  MAIL(switch_display, 4, safe::event_t<int>);
 
   // Local mail
-  MAIL(touch_port);
-  MAIL(idr);
-  MAIL(invalidate_ref_frames);
-  MAIL(gamepad_feedback);
-  MAIL(hdr);
+  MAIL(touch_port, 5, safe::event_t<input::touch_port_t>);
+  MAIL(idr, 6, safe::signal_t);
+  MAIL(invalidate_ref_frames, 7, safe::event_t<std::pair<int64_t, int64_t>>);
+  MAIL(bitrate, 8, safe::event_t<int>);
+  MAIL(gamepad_feedback, 9, safe::queue_t<platf::gamepad_feedback_msg_t>);
+  MAIL(hdr, 10, safe::event_t<video::hdr_info_t>);
+  MAIL(capture_phase, 11, safe::event_t<std::chrono::nanoseconds>);
+  // The touch_port of the encoder a session watches, handed on to its input by the video broadcast thread
+  MAIL(input_touch_port, 12, safe::event_t<input::touch_port_t>);
 #undef MAIL
 
 }  // namespace mail
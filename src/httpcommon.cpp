@@ -6,6 +6,7 @@
 
 // standard includes
 #include <filesystem>
+#include <future>
 #include <utility>
 
 // lib includes
@@ -43,6 +44,9 @@ namespace http {
   std::string unique_id;
   net::net_e origin_web_ui_allowed;
 
+  // Credentials generated while the rest of Sunshine starts, invalid if they already existed
+  std::shared_future<int> creds_generated;
+
   int init() {
     bool clean_slate = config::sunshine.flags[config::flag::FRESH_STATE];
     origin_web_ui_allowed = net::from_enum_string(config::nvhttp.origin_web_ui_allowed);
@@ -54,9 +58,9 @@ namespace http {
       config::nvhttp.pkey = (dir / ("pkey-"s + unique_id)).string();
     }
 
-    if ((!fs::exists(config::nvhttp.pkey) || !fs::exists(config::nvhttp.cert)) &&
-        create_creds(config::nvhttp.pkey, config::nvhttp.cert)) {
-      return -1;
+    if (!fs::exists(config::nvhttp.pkey) || !fs::exists(config::nvhttp.cert)) {
+      // Generating a key takes seconds on slow devices, nothing needs it before the HTTPS servers start
+      creds_generated = std::async(std::launch::async, create_creds, config::nvhttp.pkey, config::nvhttp.cert).share();
     }
     if (!user_creds_exist(config::sunshine.credentials_file)) {
       BOOST_LOG(info) << "Open the Web UI to set your new username and password and getting started";
@@ -66,6 +70,14 @@ namespace http {
     return 0;
   }
 
+  int wait_for_creds() {
+    if (!creds_generated.valid()) {
+      return 0;
+    }
+
+    return creds_generated.get();
+  }
+
   int save_user_creds(const std::string &file, const std::string &username, const std::string &password, bool run_our_mouth) {
     pt::ptree outputTree;
 
@@ -129,7 +141,9 @@ namespace http {
     fs::path pkey_path = pkey;
     fs::path cert_path = cert;
 
-    auto creds = crypto::gen_creds("Sunshine Gamestream Host"sv, 2048);
+    auto creds = config::nvhttp.cert_key_type == "ecdsa"sv ?
+                   crypto::gen_ecdsa_creds("Sunshine Gamestream Host"sv) :
+                   crypto::gen_creds("Sunshine Gamestream Host"sv, 2048);
 
     auto pkey_dir = pkey_path;
     auto cert_dir = cert_path;
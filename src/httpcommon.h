@@ -15,6 +15,12 @@ namespace http {
 
   int init();
   int create_creds(const std::string &pkey, const std::string &cert);
+
+  /**
+   * @brief Wait until the credentials generated by init() are written.
+   * @return 0 once the key and certificate files exist, -1 if they couldn't be created.
+   */
+  int wait_for_creds();
   int save_user_creds(
     const std::string &file,
     const std::string &username,
@@ -9,9 +9,14 @@ extern "C" {
 }
 
 // standard includes
+#include <algorithm>
+#include <array>
+#include <atomic>
 #include <bitset>
 #include <chrono>
 #include <cmath>
+#include <functional>
+#include <future>
 #include <list>
 #include <thread>
 #include <unordered_map>
@@ -26,6 +31,8 @@ extern "C" {
 #include "logging.h"
 #include "platform/common.h"
 #include "thread_pool.h"
+#include "thread_safe.h"
+#include "trace.h"
 #include "utility.h"
 
 // Win32 WHEEL_DELTA constant
@@ -38,6 +45,12 @@ using namespace std::literals;
 namespace input {
 
   constexpr auto MAX_GAMEPADS = std::min((std::size_t) platf::MAX_GAMEPADS, sizeof(std::int16_t) * 8);
+
+  // Batched input messages injected before the platform has to flush what it held back
+  constexpr auto MAX_BATCHES_PER_FLUSH = 64;
+
+  // Input messages and tasks the control stream can get ahead of the input thread
+  constexpr auto MAX_INPUT_TASKS = 1024;
 #define DISABLE_LEFT_BUTTON_DELAY ((thread_pool_util::ThreadPool::task_id_t) 0x01)
 #define ENABLE_LEFT_BUTTON_DELAY nullptr
 
@@ -115,6 +128,8 @@ namespace input {
   static platf::input_t platf_input;
   static std::bitset<platf::MAX_GAMEPADS> gamepadMask {};
 
+  void post(std::function<void()> &&task);
+
   void free_gamepad(platf::input_t &platf_input, int id) {
     platf::gamepad_update(platf_input, id, platf::gamepad_state_t {});
     platf::free_gamepad(platf_input, id);
@@ -132,7 +147,7 @@ namespace input {
 
     ~gamepad_t() {
       if (id >= 0) {
-        task_pool.push([id = this->id]() {
+        post([id = this->id]() {
           free_gamepad(platf_input, id);
         });
       }
@@ -152,6 +167,40 @@ namespace input {
     button_state_e back_button_state;
   };
 
+  /**
+   * @brief Maps a surface of the client onto the touch port.
+   * Scaling to the stream, dropping the letterbox and undoing the scaling of the display happen
+   * in one multiply-add per axis, the result is clamped to the display.
+   */
+  struct touch_transform_t {
+    std::array<float, 2> scale;
+    std::array<float, 2> offset;
+    std::array<float, 2> max;
+
+    /**
+     * @param touch_port The touch port to map onto.
+     * @param size The size of the client's surface.
+     * @param normalize The transformed coordinates are divided by this, to get fractions of the display.
+     */
+    static touch_transform_t make(const input::touch_port_t &touch_port, const std::pair<float, float> &size, const std::pair<float, float> &normalize) {
+      auto scalarX = touch_port.scalar_inv / normalize.first;
+      auto scalarY = touch_port.scalar_inv / normalize.second;
+
+      return {
+        {touch_port.width / size.first * scalarX, touch_port.height / size.second * scalarY},
+        {-touch_port.client_offsetX * scalarX, -touch_port.client_offsetY * scalarY},
+        {(touch_port.width - 2 * touch_port.client_offsetX) * scalarX, (touch_port.height - 2 * touch_port.client_offsetY) * scalarY},
+      };
+    }
+
+    std::pair<float, float> operator()(const std::pair<float, float> &val) const {
+      return {
+        std::clamp(val.first * scale[0] + offset[0], 0.0f, max[0]),
+        std::clamp(val.second * scale[1] + offset[1], 0.0f, max[1]),
+      };
+    }
+  };
+
   struct input_t {
     enum shortkey_e {
       CTRL = 0x1,  ///< Control key
@@ -184,13 +233,26 @@ namespace input {
     safe::mail_raw_t::event_t<input::touch_port_t> touch_port_event;
     platf::feedback_queue_t feedback_queue;
 
-    std::list<std::vector<uint8_t>> input_queue;
-    std::mutex input_queue_lock;
+    struct queued_message_t {
+      std::vector<uint8_t> data;
+      std::chrono::steady_clock::time_point received;
+    };
+
+    // Only touched by the input thread
+    std::list<queued_message_t> input_queue;
 
     thread_pool_util::ThreadPool::task_id_t mouse_left_button_timeout;
 
     input::touch_port_t touch_port;
 
+    // Worked out again only when the touch port or the client's surface changes
+    touch_transform_t mouse_transform {};
+    std::pair<float, float> mouse_client_size {};
+
+    // Touch and pen coordinates come as fractions of the stream and go out as fractions of the display
+    touch_transform_t touch_transform {};
+    std::pair<float, float> contact_area_scalar {};
+
     int32_t accumulated_vscroll_delta;
     int32_t accumulated_hscroll_delta;
   };
@@ -451,56 +513,48 @@ namespace input {
   }
 
   /**
-   * @brief Converts client coordinates on the specified surface into screen coordinates.
+   * @brief Take the latest touch port, and work out the transforms of the absolute input for it.
    * @param input The input context.
-   * @param val The cartesian coordinate pair to convert.
-   * @param size The size of the client's surface containing the value.
-   * @return The host-relative coordinate pair if a touchport is available.
+   * @return `false` if no touch port is available yet.
    */
-  std::optional<std::pair<float, float>> client_to_touchport(std::shared_ptr<input_t> &input, const std::pair<float, float> &val, const std::pair<float, float> &size) {
-    auto &touch_port_event = input->touch_port_event;
-    auto &touch_port = input->touch_port;
-    if (touch_port_event->peek()) {
-      touch_port = *touch_port_event->pop();
+  bool update_touch_port(input_t &input) {
+    auto &touch_port = input.touch_port;
+    if (input.touch_port_event->peek()) {
+      touch_port = *input.touch_port_event->pop();
+
+      input.mouse_client_size = {};
+      if (touch_port) {
+        input.touch_transform = touch_transform_t::make(touch_port, {1.0f, 1.0f}, {(float) touch_port.env_width, (float) touch_port.env_height});
+        input.contact_area_scalar = {(float) touch_port.env_width, (float) touch_port.env_height};
+      }
     }
     if (!touch_port) {
       BOOST_LOG(verbose) << "Ignoring early absolute input without a touch port"sv;
-      return std::nullopt;
+      return false;
     }
 
-    auto scalarX = touch_port.width / size.first;
-    auto scalarY = touch_port.height / size.second;
-
-    float x = std::clamp(val.first, 0.0f, size.first) * scalarX;
-    float y = std::clamp(val.second, 0.0f, size.second) * scalarY;
-
-    auto offsetX = touch_port.client_offsetX;
-    auto offsetY = touch_port.client_offsetY;
-
-    x = std::clamp(x, offsetX, (size.first * scalarX) - offsetX);
-    y = std::clamp(y, offsetY, (size.second * scalarY) - offsetY);
-
-    return std::pair {(x - offsetX) * touch_port.scalar_inv, (y - offsetY) * touch_port.scalar_inv};
+    return true;
   }
 
   /**
-   * @brief Multiply a polar coordinate pair by a cartesian scaling factor.
-   * @param r The radial coordinate.
-   * @param angle The angular coordinate (radians).
-   * @param scalar The scalar cartesian coordinate pair.
-   * @return The scaled radial coordinate.
+   * @brief Converts client coordinates on the specified surface into screen coordinates.
+   * @param input The input context.
+   * @param val The cartesian coordinate pair to convert.
+   * @param size The size of the client's surface containing the value.
+   * @return The host-relative coordinate pair if a touchport is available.
    */
-  float multiply_polar_by_cartesian_scalar(float r, float angle, const std::pair<float, float> &scalar) {
-    // Convert polar to cartesian coordinates
-    float x = r * std::cos(angle);
-    float y = r * std::sin(angle);
+  std::optional<std::pair<float, float>> client_to_touchport(std::shared_ptr<input_t> &input, const std::pair<float, float> &val, const std::pair<float, float> &size) {
+    if (!update_touch_port(*input)) {
+      return std::nullopt;
+    }
 
-    // Scale the values
-    x *= scalar.first;
-    y *= scalar.second;
+    // Clients send the size of their surface with every event, it only changes when their window does
+    if (size != input->mouse_client_size) {
+      input->mouse_transform = touch_transform_t::make(input->touch_port, size, {1.0f, 1.0f});
+      input->mouse_client_size = size;
+    }
 
-    // Convert the result back to a polar radial coordinate
-    return std::sqrt(std::pow(x, 2) + std::pow(y, 2));
+    return input->mouse_transform(val);
   }
 
   std::pair<float, float> scale_client_contact_area(const std::pair<float, float> &val, uint16_t rotation, const std::pair<float, float> &scalar) {
@@ -512,8 +566,16 @@ namespace input {
     float major = val.first;
     float minor = val.second != 0.0f ? val.second : val.first;
 
-    // The minor axis is perpendicular to major axis so the angle must be rotated by 90 degrees
-    return {multiply_polar_by_cartesian_scalar(major, angle, scalar), multiply_polar_by_cartesian_scalar(minor, angle + (M_PI / 2), scalar)};
+    // Scaling an axis in cartesian coordinates scales its length by sqrt((cos * scalar.x)^2 + (sin * scalar.y)^2).
+    // The minor axis is perpendicular to major axis, so sine and cosine trade places for it.
+    auto cos = std::cos(angle);
+    auto cos2 = cos * cos;
+    auto sin2 = 1.0f - cos2;
+
+    auto x2 = scalar.first * scalar.first;
+    auto y2 = scalar.second * scalar.second;
+
+    return {major * std::sqrt(cos2 * x2 + sin2 * y2), minor * std::sqrt(sin2 * x2 + cos2 * y2)};
   }
 
   void passthrough(std::shared_ptr<input_t> &input, PNV_ABS_MOUSE_MOVE_PACKET packet) {
@@ -592,12 +654,13 @@ namespace input {
           return;
         }
         platf::button_mouse(platf_input, BUTTON_LEFT, release);
+        platf::flush_input(platf_input);
 
         mouse_press[BUTTON_LEFT] = false;
         input->mouse_left_button_timeout = nullptr;
       };
 
-      input->mouse_left_button_timeout = task_pool.pushDelayed(std::move(f), 10ms).task_id;
+      input->mouse_left_button_timeout = task_pool.pushDelayed(post, 10ms, std::move(f)).task_id;
 
       return;
     }
@@ -716,7 +779,9 @@ namespace input {
 
     send_key_and_modifiers(key_code, false, flags, synthetic_modifiers);
 
-    key_press_repeat_id = task_pool.pushDelayed(repeat_key, config::input.key_repeat_period, key_code, flags, synthetic_modifiers).task_id;
+    key_press_repeat_id = task_pool.pushDelayed(post, config::input.key_repeat_period, [=]() {
+      repeat_key(key_code, flags, synthetic_modifiers);
+    }).task_id;
   }
 
   void passthrough(std::shared_ptr<input_t> &input, PNV_KEYBOARD_PACKET packet) {
@@ -756,7 +821,9 @@ namespace input {
         }
 
         if (config::input.key_repeat_delay.count() > 0) {
-          key_press_repeat_id = task_pool.pushDelayed(repeat_key, config::input.key_repeat_delay, keyCode, packet->flags, synthetic_modifiers).task_id;
+          key_press_repeat_id = task_pool.pushDelayed(post, config::input.key_repeat_delay, [keyCode, flags = packet->flags, synthetic_modifiers]() {
+            repeat_key(keyCode, flags, synthetic_modifiers);
+          }).task_id;
         }
       } else {
         // Already released
@@ -879,12 +946,13 @@ namespace input {
       return;
     }
 
-    // Convert the client normalized coordinates to touchport coordinates
-    auto coords = client_to_touchport(input, {from_clamped_netfloat(packet->x, 0.0f, 1.0f) * 65535.f, from_clamped_netfloat(packet->y, 0.0f, 1.0f) * 65535.f}, {65535.f, 65535.f});
-    if (!coords) {
+    if (!update_touch_port(*input)) {
       return;
     }
 
+    // Convert the client normalized coordinates to normalized touchport coordinates
+    auto coords = input->touch_transform({from_clamped_netfloat(packet->x, 0.0f, 1.0f), from_clamped_netfloat(packet->y, 0.0f, 1.0f)});
+
     auto &touch_port = input->touch_port;
     platf::touch_port_t abs_port {
       touch_port.offset_x,
@@ -893,10 +961,6 @@ namespace input {
       touch_port.env_height
     };
 
-    // Renormalize the coordinates
-    coords->first /= abs_port.width;
-    coords->second /= abs_port.height;
-
     // Normalize rotation value to 0-359 degree range
     auto rotation = util::endian::little(packet->rotation);
     if (rotation != LI_ROT_UNKNOWN) {
@@ -905,18 +969,18 @@ namespace input {
 
     // Normalize the contact area based on the touchport
     auto contact_area = scale_client_contact_area(
-      {from_clamped_netfloat(packet->contactAreaMajor, 0.0f, 1.0f) * 65535.f,
-       from_clamped_netfloat(packet->contactAreaMinor, 0.0f, 1.0f) * 65535.f},
+      {from_clamped_netfloat(packet->contactAreaMajor, 0.0f, 1.0f),
+       from_clamped_netfloat(packet->contactAreaMinor, 0.0f, 1.0f)},
       rotation,
-      {abs_port.width / 65535.f, abs_port.height / 65535.f}
+      input->contact_area_scalar
     );
 
     platf::touch_input_t touch {
       packet->eventType,
       rotation,
       util::endian::little(packet->pointerId),
-      coords->first,
-      coords->second,
+      coords.first,
+      coords.second,
       from_clamped_netfloat(packet->pressureOrDistance, 0.0f, 1.0f),
       contact_area.first,
       contact_area.second,
@@ -935,12 +999,13 @@ namespace input {
       return;
     }
 
-    // Convert the client normalized coordinates to touchport coordinates
-    auto coords = client_to_touchport(input, {from_clamped_netfloat(packet->x, 0.0f, 1.0f) * 65535.f, from_clamped_netfloat(packet->y, 0.0f, 1.0f) * 65535.f}, {65535.f, 65535.f});
-    if (!coords) {
+    if (!update_touch_port(*input)) {
       return;
     }
 
+    // Convert the client normalized coordinates to normalized touchport coordinates
+    auto coords = input->touch_transform({from_clamped_netfloat(packet->x, 0.0f, 1.0f), from_clamped_netfloat(packet->y, 0.0f, 1.0f)});
+
     auto &touch_port = input->touch_port;
     platf::touch_port_t abs_port {
       touch_port.offset_x,
@@ -949,10 +1014,6 @@ namespace input {
       touch_port.env_height
     };
 
-    // Renormalize the coordinates
-    coords->first /= abs_port.width;
-    coords->second /= abs_port.height;
-
     // Normalize rotation value to 0-359 degree range
     auto rotation = util::endian::little(packet->rotation);
     if (rotation != LI_ROT_UNKNOWN) {
@@ -961,10 +1022,10 @@ namespace input {
 
     // Normalize the contact area based on the touchport
     auto contact_area = scale_client_contact_area(
-      {from_clamped_netfloat(packet->contactAreaMajor, 0.0f, 1.0f) * 65535.f,
-       from_clamped_netfloat(packet->contactAreaMinor, 0.0f, 1.0f) * 65535.f},
+      {from_clamped_netfloat(packet->contactAreaMajor, 0.0f, 1.0f),
+       from_clamped_netfloat(packet->contactAreaMinor, 0.0f, 1.0f)},
       rotation,
-      {abs_port.width / 65535.f, abs_port.height / 65535.f}
+      input->contact_area_scalar
     );
 
     platf::pen_input_t pen {
@@ -973,8 +1034,8 @@ namespace input {
       packet->penButtons,
       packet->tilt,
       rotation,
-      coords->first,
-      coords->second,
+      coords.first,
+      coords.second,
       from_clamped_netfloat(packet->pressureOrDistance, 0.0f, 1.0f),
       contact_area.first,
       contact_area.second,
@@ -1159,6 +1220,11 @@ namespace input {
           auto f = [input, controller = packet->controllerNumber]() {
             auto &gamepad = input->gamepads[controller];
 
+            // Cancelled after the timer already handed the task to the input thread
+            if (!gamepad.back_timeout_id) {
+              return;
+            }
+
             auto &state = gamepad.gamepad_state;
 
             // Force the back button up
@@ -1180,7 +1246,7 @@ namespace input {
             gamepad.back_timeout_id = nullptr;
           };
 
-          gamepad.back_timeout_id = task_pool.pushDelayed(std::move(f), config::input.back_button_timeout).task_id;
+          gamepad.back_timeout_id = task_pool.pushDelayed(post, config::input.back_button_timeout, std::move(f)).task_id;
         }
       } else if (gamepad.back_timeout_id) {
         task_pool.cancel(gamepad.back_timeout_id);
@@ -1209,10 +1275,10 @@ namespace input {
     short deltaX, deltaY;
 
     // Batching is safe as long as the result doesn't overflow a 16-bit integer
-    if (!__builtin_add_overflow(util::endian::big(dest->deltaX), util::endian::big(src->deltaX), &deltaX)) {
+    if (__builtin_add_overflow(util::endian::big(dest->deltaX), util::endian::big(src->deltaX), &deltaX)) {
       return batch_result_e::terminate_batch;
     }
-    if (!__builtin_add_overflow(util::endian::big(dest->deltaY), util::endian::big(src->deltaY), &deltaY)) {
+    if (__builtin_add_overflow(util::endian::big(dest->deltaY), util::endian::big(src->deltaY), &deltaY)) {
       return batch_result_e::terminate_batch;
     }
 
@@ -1249,7 +1315,7 @@ namespace input {
     short scrollAmt;
 
     // Batching is safe as long as the result doesn't overflow a 16-bit integer
-    if (!__builtin_add_overflow(util::endian::big(dest->scrollAmt1), util::endian::big(src->scrollAmt1), &scrollAmt)) {
+    if (__builtin_add_overflow(util::endian::big(dest->scrollAmt1), util::endian::big(src->scrollAmt1), &scrollAmt)) {
       return batch_result_e::terminate_batch;
     }
 
@@ -1269,7 +1335,7 @@ namespace input {
     short scrollAmt;
 
     // Batching is safe as long as the result doesn't overflow a 16-bit integer
-    if (!__builtin_add_overflow(util::endian::big(dest->scrollAmount), util::endian::big(src->scrollAmount), &scrollAmt)) {
+    if (__builtin_add_overflow(util::endian::big(dest->scrollAmount), util::endian::big(src->scrollAmount), &scrollAmt)) {
       return batch_result_e::terminate_batch;
     }
 
@@ -1475,47 +1541,39 @@ namespace input {
   }
 
   /**
-   * @brief Called on a thread pool thread to process an input message.
+   * @brief Batch the next input message with the ones after it and send it to the OS.
    * @param input The input context pointer.
+   * @param received Set to when the first message of the batch was received.
+   * @return `false` if the input queue was empty.
    */
-  void passthrough_next_message(std::shared_ptr<input_t> input) {
-    // 'entry' backs the 'payload' pointer, so they must remain in scope together
-    std::vector<uint8_t> entry;
-    PNV_INPUT_HEADER payload;
-
-    // Lock the input queue while batching, but release it before sending
-    // the input to the OS. This avoids potentially lengthy lock contention
-    // in the control stream thread while input is being processed by the OS.
-    {
-      std::lock_guard<std::mutex> lg(input->input_queue_lock);
-
-      // If all entries have already been processed, nothing to do
-      if (input->input_queue.empty()) {
-        return;
-      }
+  static bool passthrough_next_batch(std::shared_ptr<input_t> &input, std::chrono::steady_clock::time_point &received) {
+    // If all entries have already been processed, nothing to do
+    if (input->input_queue.empty()) {
+      return false;
+    }
 
-      // Pop off the first entry, which we will send
-      entry = input->input_queue.front();
-      payload = (PNV_INPUT_HEADER) entry.data();
-      input->input_queue.pop_front();
-
-      // Try to batch with remaining items on the queue
-      auto i = input->input_queue.begin();
-      while (i != input->input_queue.end()) {
-        auto batchable_entry = *i;
-        auto batchable_payload = (PNV_INPUT_HEADER) batchable_entry.data();
-
-        auto batch_result = batch(payload, batchable_payload);
-        if (batch_result == batch_result_e::terminate_batch) {
-          // Stop batching
-          break;
-        } else if (batch_result == batch_result_e::batched) {
-          // Erase this entry since it was batched
-          i = input->input_queue.erase(i);
-        } else {
-          // We couldn't batch this entry, but try to batch later entries.
-          i++;
-        }
+    // Pop off the first entry, which we will send.
+    // 'entry' backs the 'payload' pointer, so they must remain in scope together
+    auto entry = std::move(input->input_queue.front());
+    auto payload = (PNV_INPUT_HEADER) entry.data.data();
+    input->input_queue.pop_front();
+    received = entry.received;
+
+    // Try to batch with remaining items on the queue
+    auto i = input->input_queue.begin();
+    while (i != input->input_queue.end()) {
+      auto batchable_payload = (PNV_INPUT_HEADER) i->data.data();
+
+      auto batch_result = batch(payload, batchable_payload);
+      if (batch_result == batch_result_e::terminate_batch) {
+        // Stop batching
+        break;
+      } else if (batch_result == batch_result_e::batched) {
+        // Erase this entry since it was batched
+        i = input->input_queue.erase(i);
+      } else {
+        // We couldn't batch this entry, but try to batch later entries.
+        i++;
       }
     }
 
@@ -1569,6 +1627,158 @@ namespace input {
         passthrough(input, (PSS_CONTROLLER_BATTERY_PACKET) payload);
         break;
     }
+
+    return true;
+  }
+
+  /**
+   * @brief Send up to MAX_BATCHES_PER_FLUSH batches of queued input to the OS.
+   * @param input The input context pointer.
+   * @param latency_logger Collects how long each batch waited since it was received.
+   */
+  void passthrough_next_message(std::shared_ptr<input_t> &input, logging::min_max_avg_periodic_logger<double> &latency_logger) {
+    // Drain the queue, so the platform can inject everything that arrived in one go.
+    // The limit keeps a flood of input from holding back the events decoded so far.
+    std::array<std::chrono::steady_clock::time_point, MAX_BATCHES_PER_FLUSH> received;
+    auto inject_start = std::chrono::steady_clock::now();
+    int batches = 0;
+    while (batches < MAX_BATCHES_PER_FLUSH && passthrough_next_batch(input, received[batches])) {
+      ++batches;
+    }
+    batches_injected.store(batches_injected.load(std::memory_order_relaxed) + batches, std::memory_order_relaxed);
+
+    platf::flush_input(platf_input);
+    platf::flush_client_input(input->client_context.get());
+
+    auto now = std::chrono::steady_clock::now();
+    for (int x = 0; x < batches; ++x) {
+      latency_logger.collect_and_log(std::chrono::duration<double, std::milli>(now - received[x]).count());
+      trace::span(trace::stage_e::input_receive, -1, received[x], inject_start);
+    }
+    trace::span(trace::stage_e::input_inject, -1, inject_start, now);
+  }
+
+  /**
+   * @brief Work for the input thread, either an input message or a plain task.
+   */
+  struct input_task_t {
+    std::shared_ptr<input_t> input;  ///< Context the message belongs to, empty for a plain task
+    std::vector<std::uint8_t> message;
+    std::chrono::steady_clock::time_point received;
+    std::function<void()> run;
+  };
+
+  static safe::ring_t<input_task_t> input_tasks {MAX_INPUT_TASKS};
+  static std::thread input_thread;
+
+  // Written by the input thread only
+  static std::atomic<std::uint64_t> messages_received;
+  static std::atomic<std::uint64_t> batches_injected;
+
+  /**
+   * @brief Queue a task for the input thread, waiting for room if the thread is behind.
+   * @param task The task.
+   * @return `false` if the input thread has stopped.
+   */
+  static bool raise_input_task(input_task_t &&task) {
+    while (!input_tasks.raise(std::move(task))) {
+      if (!input_tasks.running()) {
+        return false;
+      }
+
+      std::this_thread::yield();
+    }
+
+    return true;
+  }
+
+  /**
+   * @brief Run a task on the input thread, in order with the input messages.
+   * @param task The task.
+   */
+  void post(std::function<void()> &&task) {
+    // The input thread can't wait on itself for room in the ring
+    if (std::this_thread::get_id() == input_thread.get_id()) {
+      task();
+      return;
+    }
+
+    raise_input_task(input_task_t {nullptr, {}, {}, std::move(task)});
+  }
+
+  /**
+   * @brief Get how much longer relative mouse motion may be held back for more of it to arrive.
+   * A mouse polling at several kHz then moves the cursor once per mouse_coalesce_window instead of once per report.
+   * @param pending The inputs with queued messages.
+   * @return The time left, zero once anything but relative motion is queued.
+   */
+  static std::chrono::steady_clock::duration coalesce_time_left(const std::vector<std::shared_ptr<input_t>> &pending) {
+    auto window = config::input.mouse_coalesce_window;
+    if (window <= 0us || pending.empty()) {
+      return {};
+    }
+
+    auto oldest = std::chrono::steady_clock::time_point::max();
+    for (auto &input : pending) {
+      for (auto &message : input->input_queue) {
+        if (util::endian::little(((PNV_INPUT_HEADER) message.data.data())->magic) != MOUSE_MOVE_REL_MAGIC_GEN5) {
+          return {};
+        }
+
+        oldest = std::min(oldest, message.received);
+      }
+    }
+
+    return oldest + window - std::chrono::steady_clock::now();
+  }
+
+  /**
+   * @brief Inject the input of every client, in the order it was received.
+   * Everything that is queued when the thread wakes up is batched before it goes to the OS.
+   */
+  static void input_thread_main() {
+    if (config::input.realtime_thread) {
+      platf::adjust_thread_priority(platf::thread_priority_e::realtime);
+    }
+
+    logging::min_max_avg_periodic_logger<double> latency_logger {debug, "Input latency", "ms"};
+
+    std::vector<std::shared_ptr<input_t>> pending;
+    auto inject_pending = [&]() {
+      for (auto &input : pending) {
+        while (!input->input_queue.empty()) {
+          passthrough_next_message(input, latency_logger);
+        }
+      }
+      pending.clear();
+    };
+
+    while (auto task = input_tasks.pop()) {
+      while (true) {
+        if (task->run) {
+          // Messages received before the task go to the OS first
+          inject_pending();
+          task->run();
+          platf::flush_input(platf_input);
+        } else {
+          task->input->input_queue.push_back({std::move(task->message), task->received});
+          messages_received.store(messages_received.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+          if (std::find(std::begin(pending), std::end(pending), task->input) == std::end(pending)) {
+            pending.emplace_back(std::move(task->input));
+          }
+        }
+
+        // peek() is false once the ring stops, so pop() won't block here
+        if (!input_tasks.peek() || !(task = input_tasks.pop())) {
+          auto time_left = coalesce_time_left(pending);
+          if (time_left <= 0s || !(task = input_tasks.pop(time_left))) {
+            break;
+          }
+        }
+      }
+
+      inject_pending();
+    }
   }
 
   /**
@@ -1577,19 +1787,36 @@ namespace input {
    * @param input_data The input message.
    */
   void passthrough(std::shared_ptr<input_t> &input, std::vector<std::uint8_t> &&input_data) {
-    {
-      std::lock_guard<std::mutex> lg(input->input_queue_lock);
-      input->input_queue.push_back(std::move(input_data));
-    }
-    task_pool.push(passthrough_next_message, input);
+    raise_input_task(input_task_t {input, std::move(input_data), std::chrono::steady_clock::now(), nullptr});
+  }
+
+  stats_t stats() {
+    return {
+      messages_received.load(std::memory_order_relaxed),
+      batches_injected.load(std::memory_order_relaxed),
+      platf_input ? platf::gamepad_reports_coalesced(platf_input) : 0,
+    };
+  }
+
+  void drain() {
+    // The promise is dropped without a value if the input thread has stopped, which wakes us up all the same
+    auto done = std::make_shared<std::promise<void>>();
+    auto future = done->get_future();
+
+    post([done = std::move(done)]() {
+      done->set_value();
+    });
+
+    future.wait();
   }
 
   void reset(std::shared_ptr<input_t> &input) {
-    task_pool.cancel(key_press_repeat_id);
-    task_pool.cancel(input->mouse_left_button_timeout);
+    // Ensure input is synchronous, by using the input thread. The task ids are written there,
+    // and input the client sent before the reset is handled before anything is released.
+    post([input]() {
+      task_pool.cancel(key_press_repeat_id);
+      task_pool.cancel(input->mouse_left_button_timeout);
 
-    // Ensure input is synchronous, by using the task_pool
-    task_pool.push([]() {
       for (int x = 0; x < mouse_press.size(); ++x) {
         if (mouse_press[x]) {
           platf::button_mouse(platf_input, x, true);
@@ -1605,18 +1832,23 @@ namespace input {
         platf::keyboard_update(platf_input, vk_from_kpid(kp.first) & 0x00FF, true, flags_from_kpid(kp.first));
         key_press[kp.first] = false;
       }
+      platf::flush_input(platf_input);
     });
   }
 
   class deinit_t: public platf::deinit_t {
   public:
     ~deinit_t() override {
+      input_tasks.stop();
+      input_thread.join();
+
       platf_input.reset();
     }
   };
 
   [[nodiscard]] std::unique_ptr<platf::deinit_t> init() {
     platf_input = platf::input();
+    input_thread = std::thread {input_thread_main};
 
     return std::make_unique<deinit_t>();
   }
@@ -1634,16 +1866,16 @@ namespace input {
 
   std::shared_ptr<input_t> alloc(safe::mail_t mail) {
     auto input = std::make_shared<input_t>(
-      mail->event<input::touch_port_t>(mail::touch_port),
+      mail->event<input::touch_port_t>(mail::input_touch_port),
       mail->queue<platf::gamepad_feedback_msg_t>(mail::gamepad_feedback)
     );
 
     // Workaround to ensure new frames will be captured when a client connects
-    task_pool.pushDelayed([]() {
+    task_pool.pushDelayed(post, 100ms, []() {
       platf::move_mouse(platf_input, 1, 1);
       platf::move_mouse(platf_input, -1, -1);
-    },
-                          100ms);
+      platf::flush_input(platf_input);
+    });
 
     return input;
   }
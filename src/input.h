@@ -18,6 +18,26 @@ namespace input {
   void reset(std::shared_ptr<input_t> &input);
   void passthrough(std::shared_ptr<input_t> &input, std::vector<std::uint8_t> &&input_data);
 
+  /**
+   * @brief Counters of the input thread since it started.
+   */
+  struct stats_t {
+    std::uint64_t messages;  ///< Input messages received from the control stream
+    std::uint64_t batches;  ///< Batches the messages were merged into before they went to the OS
+    std::uint64_t gamepad_reports_coalesced;  ///< Gamepad reports the platform merged into later ones or dropped as unchanged
+  };
+
+  /**
+   * @brief Get the counters of the input thread.
+   * @return The counters.
+   */
+  stats_t stats();
+
+  /**
+   * @brief Wait until the input thread has sent every message received so far to the OS.
+   */
+  void drain();
+
   [[nodiscard]] std::unique_ptr<platf::deinit_t> init();
 
   bool probe_gamepads();
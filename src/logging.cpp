@@ -34,9 +34,11 @@ using namespace std::literals;
 
 namespace bl = boost::log;
 
-boost::shared_ptr<boost::log::sinks::asynchronous_sink<boost::log::sinks::text_ostream_backend>> sink;
+boost::shared_ptr<text_sink> sink;
 
+#ifndef SUNSHINE_NO_VERBOSE_LOG
 bl::sources::severity_logger<int> verbose(0);  // Dominating output
+#endif
 bl::sources::severity_logger<int> debug(1);  // Follow what is happening
 bl::sources::severity_logger<int> info(2);  // Should be informed about
 bl::sources::severity_logger<int> warning(3);  // Strange events
@@ -49,6 +51,122 @@ bl::sources::severity_logger<int> tests(10);  // Automatic tests output
 BOOST_LOG_ATTRIBUTE_KEYWORD(severity, "Severity", int)
 
 namespace logging {
+  namespace {
+    std::atomic<std::uint64_t> dropped {0};
+  }  // namespace
+
+  drop_queue_t::drop_queue_t():
+      head {0},
+      tail {0},
+      signalled {0},
+      interrupted {false},
+      reported {0} {
+    for (std::size_t x = 0; x < CAPACITY; ++x) {
+      cells[x].sequence.store(x, std::memory_order_relaxed);
+    }
+  }
+
+  bool drop_queue_t::push(const bl::record_view &rec) {
+    auto pos = tail.load(std::memory_order_relaxed);
+    while (true) {
+      auto &cell = cells[pos & (CAPACITY - 1)];
+      auto diff = (std::intptr_t) cell.sequence.load(std::memory_order_acquire) - (std::intptr_t) pos;
+
+      if (diff == 0) {
+        if (tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+          cell.record = rec;
+          cell.sequence.store(pos + 1, std::memory_order_release);
+          break;
+        }
+      } else if (diff < 0) {
+        // The writer hasn't caught up with the last lap yet
+        return false;
+      } else {
+        pos = tail.load(std::memory_order_relaxed);
+      }
+    }
+
+    if (!signalled.exchange(1, std::memory_order_release)) {
+      signalled.notify_one();
+    }
+    return true;
+  }
+
+  bool drop_queue_t::pop(bl::record_view &rec) {
+    auto pos = head.load(std::memory_order_relaxed);
+    while (true) {
+      auto &cell = cells[pos & (CAPACITY - 1)];
+      auto diff = (std::intptr_t) cell.sequence.load(std::memory_order_acquire) - (std::intptr_t) (pos + 1);
+
+      if (diff == 0) {
+        if (head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+          rec.swap(cell.record);
+          cell.record.reset();
+          cell.sequence.store(pos + CAPACITY, std::memory_order_release);
+          return true;
+        }
+      } else if (diff < 0) {
+        return false;
+      } else {
+        pos = head.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  void drop_queue_t::report_dropped() {
+    auto count = dropped.load(std::memory_order_relaxed);
+    if (count == reported) {
+      return;
+    }
+
+    // Enqueueing never blocks, so the writer can log through its own queue
+    BOOST_LOG(warning) << count - reported << " log messages were dropped, the log couldn't keep up"sv;
+    reported = count;
+  }
+
+  void drop_queue_t::enqueue(const bl::record_view &rec) {
+    if (!push(rec)) {
+      dropped.fetch_add(1, std::memory_order_relaxed);
+    }
+  }
+
+  bool drop_queue_t::try_enqueue(const bl::record_view &rec) {
+    // The core falls back to enqueue() when this fails, that's where the drop is counted
+    return push(rec);
+  }
+
+  bool drop_queue_t::try_dequeue_ready(bl::record_view &rec) {
+    return pop(rec);
+  }
+
+  bool drop_queue_t::try_dequeue(bl::record_view &rec) {
+    return pop(rec);
+  }
+
+  bool drop_queue_t::dequeue_ready(bl::record_view &rec) {
+    while (!pop(rec)) {
+      signalled.wait(0, std::memory_order_acquire);
+      signalled.store(0, std::memory_order_relaxed);
+
+      if (interrupted.exchange(false, std::memory_order_acquire)) {
+        return false;
+      }
+    }
+
+    report_dropped();
+    return true;
+  }
+
+  void drop_queue_t::interrupt_dequeue() {
+    interrupted.store(true, std::memory_order_release);
+    signalled.store(1, std::memory_order_release);
+    signalled.notify_one();
+  }
+
+  std::uint64_t dropped_records() {
+    return dropped.load(std::memory_order_relaxed);
+  }
+
   deinit_t::~deinit_t() {
     deinit();
   }
@@ -181,6 +299,17 @@ namespace logging {
     return std::make_unique<deinit_t>();
   }
 
+  void set_min_log_level(int min_log_level) {
+#ifndef __ANDROID__
+    setup_av_logging(min_log_level);
+    setup_libdisplaydevice_logging(min_log_level);
+#endif
+
+    if (sink) {
+      sink->set_filter(severity >= min_log_level);
+    }
+  }
+
 #ifndef __ANDROID__
   void setup_av_logging(int min_log_level) {
     if (min_log_level >= 1) {
@@ -267,6 +396,32 @@ namespace logging {
       << std::endl;
   }
 
+  std::optional<int> line_severity(std::string_view line) {
+    constexpr std::string_view log_types[] {
+      "Verbose: "sv,
+      "Debug: "sv,
+      "Info: "sv,
+      "Warning: "sv,
+      "Error: "sv,
+      "Fatal: "sv,
+    };
+
+    // [YYYY-mm-dd HH:MM:SS.mmm]: <type>: <message>
+    auto end = line.find("]: "sv);
+    if (!line.starts_with('[') || end == std::string_view::npos) {
+      return std::nullopt;
+    }
+    line.remove_prefix(end + 3);
+
+    for (int x = 0; x < std::size(log_types); ++x) {
+      if (line.starts_with(log_types[x])) {
+        return x;
+      }
+    }
+
+    return std::nullopt;
+  }
+
   std::string bracket(const std::string &input) {
     return "["s + input + "]"s;
   }
@@ -4,13 +4,92 @@
  */
 #pragma once
 
+// standard includes
+#include <atomic>
+#include <cstdint>
+#include <optional>
+#include <string_view>
+
 // lib includes
 #include <boost/log/common.hpp>
 #include <boost/log/sinks.hpp>
 
-using text_sink = boost::log::sinks::asynchronous_sink<boost::log::sinks::text_ostream_backend>;
+namespace logging {
+  /**
+   * @brief Bounded lock-free record queue of the log sink.
+   * Threads that log never block on the writer: when the queue is full the record is dropped and counted,
+   * the writer reports the number of dropped records with the next record it writes.
+   */
+  class drop_queue_t {
+  public:
+    static constexpr std::size_t CAPACITY = 4096;
+
+  protected:
+    drop_queue_t();
+
+    template<typename ArgsT>
+    explicit drop_queue_t(ArgsT const &):
+        drop_queue_t() {
+    }
+
+    void enqueue(boost::log::record_view const &rec);
+    bool try_enqueue(boost::log::record_view const &rec);
+    bool try_dequeue_ready(boost::log::record_view &rec);
+    bool try_dequeue(boost::log::record_view &rec);
+    bool dequeue_ready(boost::log::record_view &rec);
+    void interrupt_dequeue();
+
+  private:
+    struct cell_t {
+      std::atomic<std::size_t> sequence;
+      boost::log::record_view record;
+    };
+
+    bool push(boost::log::record_view const &rec);
+    bool pop(boost::log::record_view &rec);
+    void report_dropped();
+
+    static_assert((CAPACITY & (CAPACITY - 1)) == 0, "The capacity must be a power of two");
+    cell_t cells[CAPACITY];
+
+    alignas(64) std::atomic<std::size_t> head;
+    alignas(64) std::atomic<std::size_t> tail;
+
+    std::atomic<std::uint32_t> signalled;
+    std::atomic<bool> interrupted;
+    std::uint64_t reported;  ///< Dropped records the writer has already reported
+  };
+
+  /**
+   * @brief Stand-in for a logger whose records are compiled out.
+   * `BOOST_LOG()` never opens a record on it, so the streamed expressions aren't evaluated.
+   */
+  struct disabled_logger_t {
+    using char_type = char;
+
+    boost::log::record open_record() const {
+      return {};
+    }
+
+    void push_record(boost::log::record &&) const {
+    }
+  };
+
+  /**
+   * @brief Number of log records dropped because the sink couldn't keep up.
+   * @return The count since startup.
+   */
+  std::uint64_t dropped_records();
+}  // namespace logging
+
+using text_sink = boost::log::sinks::asynchronous_sink<boost::log::sinks::text_ostream_backend, logging::drop_queue_t>;
 
+#ifdef SUNSHINE_NO_VERBOSE_LOG
+// Verbose records are too frequent for release builds, see SUNSHINE_ENABLE_VERBOSE_LOG
+inline constexpr logging::disabled_logger_t verbose;
+#else
 extern boost::log::sources::severity_logger<int> verbose;
+#endif
 extern boost::log::sources::severity_logger<int> debug;
 extern boost::log::sources::severity_logger<int> info;
 extern boost::log::sources::severity_logger<int> warning;
@@ -68,6 +147,12 @@ namespace logging {
    */
   void setup_libdisplaydevice_logging(int min_log_level);
 
+  /**
+   * @brief Change the minimum log level of an initialized logging system.
+   * @param min_log_level The minimum log level to output.
+   */
+  void set_min_log_level(int min_log_level);
+
   /**
    * @brief Flush the log.
    * @examples
@@ -150,6 +235,7 @@ namespace logging {
 
   /**
    * @brief A helper class for tracking and logging short time intervals across a period of time
+   * Besides min/max/avg, the intervals are counted in a latency histogram so the tail is logged as p50/p99.
    * @examples
    * time_delta_periodic_logger logger(debug, "Test duration", 5s);
    * logger.first_point_now();
@@ -160,54 +246,87 @@ namespace logging {
    * // ...
    * logger.second_point_now_and_log();
    * // In the log:
-   * // [2024:01:01:12:00:00]: Debug: Test duration (min/max/avg): 1.23ms/3.21ms/2.31ms
+   * // [2024:01:01:12:00:00]: Debug: Test duration (min/max/avg/p50/p99): 1.23ms/3.21ms/2.31ms/2.38ms/3.34ms
    * @examples_end
    */
   class time_delta_periodic_logger {
   public:
     time_delta_periodic_logger(boost::log::sources::severity_logger<int> &severity, std::string_view message, std::chrono::seconds interval_in_seconds = std::chrono::seconds(20)):
-        logger(severity, message, "ms", interval_in_seconds) {
+        severity(severity),
+        message(message),
+        interval(interval_in_seconds),
+        enabled(config::sunshine.min_log_level <= severity.default_severity()) {
     }
 
     void first_point(const std::chrono::steady_clock::time_point &point) {
-      if (logger.is_enabled()) {
+      if (enabled) {
         point1 = point;
       }
     }
 
     void first_point_now() {
-      if (logger.is_enabled()) {
+      if (enabled) {
         first_point(std::chrono::steady_clock::now());
       }
     }
 
     void second_point_and_log(const std::chrono::steady_clock::time_point &point) {
-      if (logger.is_enabled()) {
-        logger.collect_and_log(std::chrono::duration<double, std::milli>(point - point1).count());
+      if (enabled) {
+        auto print_info = [&](double min_value, double max_value, double avg_value) {
+          using histogram_t = stat_trackers::latency_histogram_t;
+
+          auto counts = histogram.snapshot();
+          auto f = stat_trackers::two_digits_after_decimal();
+          BOOST_LOG(severity.get()) << message << " (min/max/avg/p50/p99): " << f % min_value << "ms/" << f % max_value << "ms/" << f % avg_value << "ms/"
+                                    << f % histogram_t::percentile(counts, 0.5) << "ms/" << f % histogram_t::percentile(counts, 0.99) << "ms";
+          histogram.reset();
+        };
+
+        auto delta = point - point1;
+        tracker.collect_and_callback_on_interval(std::chrono::duration<double, std::milli>(delta).count(), print_info, interval);
+
+        // After the callback, so the sample lands in the same period as in the tracker
+        histogram.record(delta);
       }
     }
 
     void second_point_now_and_log() {
-      if (logger.is_enabled()) {
+      if (enabled) {
         second_point_and_log(std::chrono::steady_clock::now());
       }
     }
 
     void reset() {
-      if (logger.is_enabled()) {
-        logger.reset();
+      if (enabled) {
+        tracker.reset();
+        histogram.reset();
       }
     }
 
     bool is_enabled() const {
-      return logger.is_enabled();
+      return enabled;
     }
 
   private:
+    std::reference_wrapper<boost::log::sources::severity_logger<int>> severity;
+    std::string message;
+    std::chrono::seconds interval;
+    bool enabled;
     std::chrono::steady_clock::time_point point1 = std::chrono::steady_clock::now();
-    min_max_avg_periodic_logger<double> logger;
+    stat_trackers::min_max_avg_tracker<double> tracker;
+
+    // A logger is only used by the thread that owns it, so one shard will do
+    stat_trackers::log_linear_histogram<24, 8, 1> histogram;
   };
 
+  /**
+   * @brief Get the severity of a line of the log file.
+   * @param line A line as written by the formatter.
+   * @return The severity, or `std::nullopt` if the line doesn't start a message,
+   * e.g. the continuation of a multi-line message.
+   */
+  std::optional<int> line_severity(std::string_view line);
+
   /**
    * @brief Enclose string in square brackets.
    * @param input Input string.
@@ -3,9 +3,11 @@
  * @brief Definitions for the main entry point for Sunshine.
  */
 // standard includes
+#include <chrono>
 #include <codecvt>
 #include <csignal>
 #include <fstream>
+#include <future>
 #include <iostream>
 
 // local includes
@@ -16,11 +18,15 @@
 #include "httpcommon.h"
 #include "logging.h"
 #include "main.h"
+#include "memory_budget.h"
 #include "nvhttp.h"
 #include "process.h"
+#include "rtp_egress.h"
 #include "system_tray.h"
+#include "trace.h"
 #include "upnp.h"
 #include "video.h"
+#include "video_dvr.h"
 
 extern "C" {
 #include "rswrapper.h"
@@ -127,7 +133,39 @@ void mainThreadLoop(const std::shared_ptr<safe::event_t<bool>> &shutdown_event)
   }
 }
 
+/**
+ * @brief Logs how long each phase of the startup took, cold boots on slow devices spend most of it in a few of them.
+ */
+class startup_timer_t {
+public:
+  /**
+   * @brief Log the time since the previous phase ended.
+   * @param phase Name of the phase that just ended.
+   */
+  void phase_done(std::string_view phase) {
+    auto now = std::chrono::steady_clock::now();
+    BOOST_LOG(info) << "Startup: "sv << phase << " took "sv << to_ms(now - phase_start) << "ms"sv;
+    phase_start = now;
+  }
+
+  /**
+   * @brief Log the time the whole startup took.
+   */
+  void done() {
+    BOOST_LOG(info) << "Startup finished in "sv << to_ms(std::chrono::steady_clock::now() - start) << "ms"sv;
+  }
+
+private:
+  static auto to_ms(std::chrono::steady_clock::duration duration) {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(duration).count();
+  }
+
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  std::chrono::steady_clock::time_point phase_start = start;
+};
+
 int main(int argc, char *argv[]) {
+  startup_timer_t startup_timer;
   lifetime::argv = argv;
 
   task_pool_util::TaskPool::task_id_t force_shutdown = nullptr;
@@ -171,6 +209,10 @@ int main(int argc, char *argv[]) {
     BOOST_LOG(info) << "config: '"sv << name << "' = "sv << val;
   }
   config::modified_config_settings.clear();
+  startup_timer.phase_done("config and logging"sv);
+
+  // The mail was created before the config was parsed
+  mail::man->depth = memory_budget::queue_depth();
 
   if (!config::sunshine.cmd.name.empty()) {
     auto fn = cmd_to_func.find(config::sunshine.cmd.name);
@@ -195,6 +237,7 @@ int main(int argc, char *argv[]) {
   if (!display_device_deinit_guard) {
     BOOST_LOG(error) << "Display device session failed to initialize"sv;
   }
+  startup_timer.phase_done("display device"sv);
 
 #ifdef _WIN32
   // Modify relevant NVIDIA control panel settings if the system has corresponding gpu
@@ -321,6 +364,7 @@ int main(int argc, char *argv[]) {
 #endif
 
   proc::refresh(config::stream.file_apps);
+  startup_timer.phase_done("apps"sv);
 
   // If any of the following fail, we log an error and continue event though sunshine will not function correctly.
   // This allows access to the UI to fix configuration problems or view the logs.
@@ -334,18 +378,9 @@ int main(int argc, char *argv[]) {
   if (!proc_deinit_guard) {
     BOOST_LOG(error) << "Proc failed to initialize"sv;
   }
+  startup_timer.phase_done("platform"sv);
 
-  reed_solomon_init();
-  auto input_deinit_guard = input::init();
-
-  if (input::probe_gamepads()) {
-    BOOST_LOG(warning) << "No gamepad input is available"sv;
-  }
-
-  if (video::probe_encoders()) {
-    BOOST_LOG(error) << "Video failed to find working encoder"sv;
-  }
-
+  // Missing credentials are generated in the background, while the encoders are probed
   if (http::init()) {
     BOOST_LOG(fatal) << "HTTP interface failed to initialize"sv;
 
@@ -357,6 +392,9 @@ int main(int argc, char *argv[]) {
     return -1;
   }
 
+  startup_timer.phase_done("http"sv);
+
+  // Publishing and port mapping run in the background alongside the probes below
   std::unique_ptr<platf::deinit_t> mDNS;
   auto sync_mDNS = std::async(std::launch::async, [&mDNS]() {
     mDNS = platf::publish::start();
@@ -367,6 +405,33 @@ int main(int argc, char *argv[]) {
     upnp_unmap = upnp::start();
   });
 
+  reed_solomon_init();
+  auto input_deinit_guard = input::init();
+  auto dvr_deinit_guard = video::dvr::start();
+  auto rtp_egress_deinit_guard = rtp_egress::start();
+
+  // Gamepads and encoders don't depend on each other, the encoder probe is the slower one
+  auto gamepads_probed = std::async(std::launch::async, []() {
+    if (input::probe_gamepads()) {
+      BOOST_LOG(warning) << "No gamepad input is available"sv;
+    }
+  });
+
+  if (config::video.lazy_encoder_probe) {
+    BOOST_LOG(info) << "Encoders will be probed when the first client connects"sv;
+  } else {
+    if (video::probe_encoders()) {
+      BOOST_LOG(error) << "Video failed to find working encoder"sv;
+    }
+    rtsp_stream::prebuild_describe_payload();
+  }
+
+  gamepads_probed.wait();
+  startup_timer.phase_done("input and encoders"sv);
+
+  // Started after probing, so the trace only holds streaming sessions
+  trace::set_enabled(config::sunshine.pipeline_trace);
+
   // FIXME: Temporary workaround: Simple-Web_server needs to be updated or replaced
   if (shutdown_event->peek()) {
     return lifetime::desired_exit_code;
@@ -375,6 +440,7 @@ int main(int argc, char *argv[]) {
   std::thread httpThread {nvhttp::start};
   std::thread configThread {confighttp::start};
   std::thread rtspThread {rtsp_stream::start};
+  startup_timer.done();
 
 #ifdef _WIN32
   // If we're using the default port and GameStream is enabled, warn the user
@@ -0,0 +1,133 @@
+/**
+ * @file src/memory_budget.cpp
+ * @brief Definitions for sizing the buffer pools to a memory budget.
+ */
+// standard includes
+#include <algorithm>
+#include <array>
+#include <atomic>
+
+// local includes
+#include "config.h"
+#include "logging.h"
+#include "memory_budget.h"
+#include "platform/common.h"
+
+using namespace std::literals;
+
+namespace memory_budget {
+  namespace {
+    constexpr std::string_view subsystem_names[] {
+      "capture_images"sv,
+      "fec_buffers"sv,
+      "audio_samples"sv,
+    };
+    static_assert(std::size(subsystem_names) == (std::size_t) subsystem_e::_size);
+
+    // Percent of the budget each subsystem gets, the rest is left to the encoded frames waiting to be sent
+    constexpr std::size_t shares[] {
+      60,
+      20,
+      5,
+    };
+    static_assert(std::size(shares) == (std::size_t) subsystem_e::_size);
+
+    // Elements of a mail queue without and with a budget
+    constexpr std::uint32_t QUEUE_DEPTH = 32;
+    constexpr std::uint32_t BUDGET_QUEUE_DEPTH = 8;
+
+    struct counter_t {
+      std::atomic<std::int64_t> current {0};
+      std::atomic<std::int64_t> peak {0};
+    };
+
+    std::array<counter_t, (std::size_t) subsystem_e::_size> footprints;
+
+    // Only warn once that buffers can't be locked
+    std::atomic<bool> lock_failed {false};
+  }  // namespace
+
+  bool enabled() {
+    return config::sunshine.memory_budget != 0;
+  }
+
+  std::optional<std::uint64_t> budget() {
+    if (config::sunshine.memory_budget > 0) {
+      return (std::uint64_t) config::sunshine.memory_budget * 1024 * 1024;
+    }
+
+    if (config::sunshine.memory_budget < 0) {
+      if (auto available = platf::available_memory()) {
+        return *available / 4;
+      }
+    }
+
+    return std::nullopt;
+  }
+
+  std::size_t buffers(subsystem_e subsystem, std::size_t buffer_size, std::size_t minimum, std::size_t maximum) {
+    auto total = budget();
+    if (!total || buffer_size == 0) {
+      return maximum;
+    }
+
+    auto share = *total * shares[(std::size_t) subsystem] / 100;
+    auto count = std::clamp<std::size_t>(share / buffer_size, minimum, maximum);
+
+    BOOST_LOG(debug) << "Memory budget: "sv << count << ' ' << name(subsystem) << " buffers of "sv << buffer_size / 1024 << " KiB"sv;
+    return count;
+  }
+
+  std::uint32_t queue_depth() {
+    return enabled() ? BUDGET_QUEUE_DEPTH : QUEUE_DEPTH;
+  }
+
+  void lock(const void *addr, std::size_t size) {
+    if (!enabled() || size == 0) {
+      return;
+    }
+
+    if (!platf::lock_memory(addr, size) && !lock_failed.exchange(true)) {
+      BOOST_LOG(warning) << "Couldn't lock the stream buffers in RAM, they may be swapped out. Raising RLIMIT_MEMLOCK allows locking them."sv;
+    }
+  }
+
+  void unlock(const void *addr, std::size_t size) {
+    if (!enabled() || size == 0) {
+      return;
+    }
+
+    platf::unlock_memory(addr, size);
+  }
+
+  void account(subsystem_e subsystem, std::int64_t bytes) {
+    auto &footprint = footprints[(std::size_t) subsystem];
+
+    auto current = footprint.current.fetch_add(bytes, std::memory_order_relaxed) + bytes;
+    auto peak = footprint.peak.load(std::memory_order_relaxed);
+    while (current > peak && !footprint.peak.compare_exchange_weak(peak, current, std::memory_order_relaxed)) {
+      // peak was reloaded
+    }
+  }
+
+  footprint_t footprint(subsystem_e subsystem) {
+    auto &footprint = footprints[(std::size_t) subsystem];
+
+    return footprint_t {
+      footprint.current.load(std::memory_order_relaxed),
+      footprint.peak.load(std::memory_order_relaxed),
+    };
+  }
+
+  std::string_view name(subsystem_e subsystem) {
+    return subsystem_names[(std::size_t) subsystem];
+  }
+
+  void log_footprints() {
+    auto &level = enabled() ? info : debug;
+    for (std::size_t x = 0; x < (std::size_t) subsystem_e::_size; ++x) {
+      auto usage = footprint((subsystem_e) x);
+      BOOST_LOG(level) << "Memory of "sv << subsystem_names[x] << ": "sv << usage.current / 1024 << " KiB, peak "sv << usage.peak / 1024 << " KiB"sv;
+    }
+  }
+}  // namespace memory_budget
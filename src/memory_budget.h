@@ -0,0 +1,89 @@
+/**
+ * @file src/memory_budget.h
+ * @brief Declarations for sizing the buffer pools to a memory budget.
+ */
+#pragma once
+
+// standard includes
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string_view>
+
+/**
+ * @brief Sizes the pools of the streaming pipeline for hosts with little RAM, and keeps track of their footprint.
+ */
+namespace memory_budget {
+  enum class subsystem_e : std::uint8_t {
+    capture_images,  ///< Images of the capture pool
+    fec_buffers,  ///< Shard buffers of the FEC blocks of every session
+    audio_samples,  ///< Captured audio frames waiting for the encoder
+    _size
+  };
+
+  /**
+   * @brief Whether the pools are sized to a budget, see the `memory_budget` setting.
+   */
+  bool enabled();
+
+  /**
+   * @brief Get the memory the pools may use.
+   * An automatic budget is a quarter of the memory available when it's asked for.
+   * @return The budget in bytes, or std::nullopt if there is none.
+   */
+  std::optional<std::uint64_t> budget();
+
+  /**
+   * @brief Get how many buffers of a subsystem fit its share of the budget.
+   * @param subsystem The subsystem.
+   * @param buffer_size The size of a single buffer.
+   * @param minimum The fewest buffers the subsystem works with.
+   * @param maximum The buffers the subsystem uses without a budget.
+   * @return The number of buffers, between minimum and maximum.
+   */
+  std::size_t buffers(subsystem_e subsystem, std::size_t buffer_size, std::size_t minimum, std::size_t maximum);
+
+  /**
+   * @brief Get how many elements the mail queues hold.
+   * Encoded frames and audio packets wait in them, fewer of them fit a budget.
+   */
+  std::uint32_t queue_depth();
+
+  /**
+   * @brief Keep a hot buffer in RAM while the budget is enabled, so a stream never waits for it to be swapped in.
+   * @param addr Start of the buffer.
+   * @param size Size of the buffer.
+   */
+  void lock(const void *addr, std::size_t size);
+
+  /**
+   * @brief Release a buffer locked with lock() before it is freed.
+   * @param addr Start of the buffer.
+   * @param size Size of the buffer.
+   */
+  void unlock(const void *addr, std::size_t size);
+
+  /**
+   * @brief Account for memory a subsystem allocated or freed.
+   * @param subsystem The subsystem.
+   * @param bytes The bytes allocated, negative when they are freed.
+   */
+  void account(subsystem_e subsystem, std::int64_t bytes);
+
+  /**
+   * @brief Memory held by a subsystem.
+   */
+  struct footprint_t {
+    std::int64_t current;
+    std::int64_t peak;  ///< Most memory held at once since Sunshine started
+  };
+
+  footprint_t footprint(subsystem_e subsystem);
+
+  std::string_view name(subsystem_e subsystem);
+
+  /**
+   * @brief Log the footprint of every subsystem.
+   */
+  void log_footprints();
+}  // namespace memory_budget
@@ -0,0 +1,163 @@
+/**
+ * @file src/metrics.cpp
+ * @brief Definitions for the process-wide counters exported in the Prometheus text format.
+ */
+// standard includes
+#include <chrono>
+#include <format>
+#include <iterator>
+#include <map>
+#include <string_view>
+
+// local includes
+#include "memory_budget.h"
+#include "metrics.h"
+#include "platform/common.h"
+#include "stream.h"
+
+using namespace std::literals;
+
+namespace metrics {
+  namespace detail {
+    std::array<counter_t, (std::size_t) counter_e::_size> counters;
+    std::array<gauge_t, (std::size_t) gauge_e::_size> gauges;
+  }  // namespace detail
+
+  namespace {
+    struct description_t {
+      std::string_view name;
+      std::string_view help;
+      double scale;  ///< Converts the stored value to the unit of the name
+    };
+
+    constexpr description_t counter_descriptions[] {
+      {"sunshine_frames_captured_total"sv, "Frames the capture backend delivered"sv, 1},
+      {"sunshine_frames_dropped_at_source_total"sv, "Frames the capture backend skipped because every capture image was in use"sv, 1},
+      {"sunshine_frames_encoded_total"sv, "Frames the video encoders finished"sv, 1},
+      {"sunshine_encode_seconds_total"sv, "Time spent encoding video frames"sv, 1e-6},
+      {"sunshine_video_packets_dropped_total"sv, "Encoded frames dropped because the send queue was full"sv, 1},
+      {"sunshine_idr_frames_avoided_total"sv, "Loss reports and key frame requests a key frame already on its way took care of"sv, 1},
+      {"sunshine_video_bytes_sent_total"sv, "Video bytes sent to all clients"sv, 1},
+      {"sunshine_video_datagrams_sent_total"sv, "Video datagrams sent to all clients"sv, 1},
+      {"sunshine_audio_packets_encoded_total"sv, "Opus packets encoded"sv, 1},
+      {"sunshine_audio_encode_seconds_total"sv, "Time spent encoding audio"sv, 1e-6},
+      {"sunshine_audio_packets_sent_total"sv, "Audio packets sent to all clients, without parity"sv, 1},
+    };
+    static_assert(std::size(counter_descriptions) == (std::size_t) counter_e::_size);
+
+    constexpr description_t gauge_descriptions[] {
+      {"sunshine_image_pool_allocated"sv, "Capture images allocated"sv, 1},
+      {"sunshine_image_pool_in_use"sv, "Capture images held by the capture backend or the encoders"sv, 1},
+      {"sunshine_video_packet_queue"sv, "Encoded frames waiting to be sent"sv, 1},
+    };
+    static_assert(std::size(gauge_descriptions) == (std::size_t) gauge_e::_size);
+
+    void header(std::string &out, std::string_view name, std::string_view help, std::string_view type) {
+      std::format_to(std::back_inserter(out), "# HELP {} {}\n# TYPE {} {}\n", name, help, name, type);
+    }
+
+    /**
+     * @brief Escape a label value, thread names may contain anything.
+     */
+    std::string escape_label(std::string_view value) {
+      std::string escaped;
+      for (auto ch : value) {
+        switch (ch) {
+          case '\\':
+            escaped += "\\\\"sv;
+            break;
+          case '"':
+            escaped += "\\\""sv;
+            break;
+          case '\n':
+            escaped += "\\n"sv;
+            break;
+          default:
+            escaped += ch;
+        }
+      }
+
+      return escaped;
+    }
+  }  // namespace
+
+  std::string format() {
+    std::string out;
+    auto inserter = std::back_inserter(out);
+
+    for (std::size_t x = 0; x < std::size(counter_descriptions); ++x) {
+      auto &description = counter_descriptions[x];
+      header(out, description.name, description.help, "counter"sv);
+      std::format_to(inserter, "{} {}\n", description.name, detail::counters[x].value.load(std::memory_order_relaxed) * description.scale);
+    }
+
+    for (std::size_t x = 0; x < std::size(gauge_descriptions); ++x) {
+      auto &description = gauge_descriptions[x];
+      header(out, description.name, description.help, "gauge"sv);
+      std::format_to(inserter, "{} {}\n", description.name, detail::gauges[x].value.load(std::memory_order_relaxed) * description.scale);
+    }
+
+    if (auto resident = platf::resident_memory()) {
+      header(out, "sunshine_resident_memory_bytes"sv, "Memory of the process resident in RAM"sv, "gauge"sv);
+      std::format_to(inserter, "sunshine_resident_memory_bytes {}\n", *resident);
+    }
+
+    constexpr auto subsystems = (std::size_t) memory_budget::subsystem_e::_size;
+    header(out, "sunshine_pool_memory_bytes"sv, "Memory held by the buffer pools of each subsystem"sv, "gauge"sv);
+    for (std::size_t x = 0; x < subsystems; ++x) {
+      auto subsystem = (memory_budget::subsystem_e) x;
+      std::format_to(inserter, "sunshine_pool_memory_bytes{{subsystem=\"{}\"}} {}\n", memory_budget::name(subsystem), memory_budget::footprint(subsystem).current);
+    }
+    header(out, "sunshine_pool_memory_peak_bytes"sv, "Most memory the buffer pools of each subsystem held at once"sv, "gauge"sv);
+    for (std::size_t x = 0; x < subsystems; ++x) {
+      auto subsystem = (memory_budget::subsystem_e) x;
+      std::format_to(inserter, "sunshine_pool_memory_peak_bytes{{subsystem=\"{}\"}} {}\n", memory_budget::name(subsystem), memory_budget::footprint(subsystem).peak);
+    }
+
+    // The pipeline threads of every session share their names
+    std::map<std::string, std::chrono::nanoseconds> cpu_times;
+    for (auto &thread : platf::thread_cpu_times()) {
+      cpu_times[thread.name] += thread.cpu_time;
+    }
+    if (!cpu_times.empty()) {
+      header(out, "sunshine_thread_cpu_seconds_total"sv, "CPU time spent by the threads of each name"sv, "counter"sv);
+      for (auto &[name, cpu_time] : cpu_times) {
+        std::format_to(inserter, "sunshine_thread_cpu_seconds_total{{thread=\"{}\"}} {}\n", escape_label(name), std::chrono::duration<double>(cpu_time).count());
+      }
+    }
+
+    auto sessions = stream::session::network_stats();
+    if (sessions.empty()) {
+      return out;
+    }
+
+    auto session_metric = [&](std::string_view name, std::string_view help, std::string_view type, auto &&value) {
+      header(out, name, help, type);
+      for (auto &stats : sessions) {
+        std::format_to(inserter, "{}{{launch_session_id=\"{}\",client=\"{}\"}} {}\n", name, stats.launch_session_id, escape_label(stats.client_address), value(stats));
+      }
+    };
+
+    using stats_t = stream::session::network_stats_t;
+    session_metric("sunshine_session_bytes_sent_total"sv, "Video bytes sent to the client"sv, "counter"sv, [](const stats_t &stats) {
+      return stats.bytes_sent;
+    });
+    session_metric("sunshine_session_frames_sent_total"sv, "Video frames sent to the client"sv, "counter"sv, [](const stats_t &stats) {
+      return stats.frames_sent;
+    });
+    session_metric("sunshine_session_frames_dropped_total"sv, "Frames dropped for waiting too long to be sent"sv, "counter"sv, [](const stats_t &stats) {
+      return stats.frames_dropped;
+    });
+    session_metric("sunshine_session_frames_lost_total"sv, "Frames the client reported lost"sv, "counter"sv, [](const stats_t &stats) {
+      return stats.frames_lost;
+    });
+    session_metric("sunshine_session_bitrate_kbps"sv, "Bitrate the encoder of the session runs at"sv, "gauge"sv, [](const stats_t &stats) {
+      return stats.bitrate_kbps;
+    });
+    session_metric("sunshine_session_fec_percentage"sv, "Average FEC percentage over the last second"sv, "gauge"sv, [](const stats_t &stats) {
+      return stats.fec_percentage.avg;
+    });
+
+    return out;
+  }
+}  // namespace metrics
@@ -0,0 +1,86 @@
+/**
+ * @file src/metrics.h
+ * @brief Declarations for the process-wide counters exported in the Prometheus text format.
+ */
+#pragma once
+
+// standard includes
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+/**
+ * @brief Counters and gauges of the streaming pipeline, updated without a lock and only formatted when scraped.
+ */
+namespace metrics {
+  enum class counter_e : std::uint8_t {
+    frames_captured,  ///< Frames the capture backend delivered
+    frames_dropped_at_source,  ///< Frames the capture backend skipped because every capture image was in use
+    frames_encoded,  ///< Frames the encoders finished
+    encode_us,  ///< Time spent encoding frames, its rate is the utilisation of the encoders
+    video_packets_dropped,  ///< Encoded frames dropped because the send queue was full
+    idr_frames_avoided,  ///< Loss reports and key frame requests a key frame already on its way took care of
+    video_bytes_sent,
+    video_datagrams_sent,
+    audio_packets_encoded,
+    audio_encode_us,
+    audio_packets_sent,
+    _size
+  };
+
+  enum class gauge_e : std::uint8_t {
+    image_pool_allocated,  ///< Capture images allocated
+    image_pool_in_use,  ///< Capture images held by the capture backend or the encoders
+    video_packet_queue,  ///< Encoded frames waiting to be sent
+    _size
+  };
+
+  namespace detail {
+    // Every value on its own cache line, the threads updating them don't share any
+    struct alignas(64) counter_t {
+      std::atomic<std::uint64_t> value {0};
+    };
+
+    struct alignas(64) gauge_t {
+      std::atomic<std::int64_t> value {0};
+    };
+
+    extern std::array<counter_t, (std::size_t) counter_e::_size> counters;
+    extern std::array<gauge_t, (std::size_t) gauge_e::_size> gauges;
+  }  // namespace detail
+
+  /**
+   * @brief Add to a counter.
+   * @param counter The counter.
+   * @param value The amount to add.
+   */
+  inline void add(counter_e counter, std::uint64_t value = 1) {
+    detail::counters[(std::size_t) counter].value.fetch_add(value, std::memory_order_relaxed);
+  }
+
+  /**
+   * @brief Set a gauge.
+   * @param gauge The gauge.
+   * @param value The current value.
+   */
+  inline void set(gauge_e gauge, std::int64_t value) {
+    detail::gauges[(std::size_t) gauge].value.store(value, std::memory_order_relaxed);
+  }
+
+  /**
+   * @brief Read a counter.
+   * @param counter The counter.
+   * @return The total since Sunshine started.
+   */
+  inline std::uint64_t get(counter_e counter) {
+    return detail::counters[(std::size_t) counter].value.load(std::memory_order_relaxed);
+  }
+
+  /**
+   * @brief Format the counters, the resource usage of the process and the counters of the running sessions.
+   * The CPU time of the threads is reported per thread name, threads sharing a name are summed.
+   * @return The metrics in the Prometheus text exposition format.
+   */
+  std::string format();
+}  // namespace metrics
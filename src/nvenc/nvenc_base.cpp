@@ -6,6 +6,8 @@
 #include "nvenc_base.h"
 
 // standard includes
+#include <algorithm>
+#include <chrono>
 #include <format>
 
 // local includes
@@ -20,12 +22,19 @@
 // - NV_ENC_*_VER definitions where the value inside NVENCAPI_STRUCT_VERSION() was increased
 // - Incompatible struct changes in nvEncodeAPI.h (fields removed, semantics changed, etc.)
 // - Test both old and new drivers with all supported codecs
-#if NVENCAPI_VERSION != MAKE_NVENC_VER(12U, 0U)
+// v12.1 only raised NV_ENC_INITIALIZE_PARAMS and NV_ENC_RECONFIGURE_PARAMS (which embeds it) for splitEncodeMode,
+// so they're pinned to the v12.0 layout unless split frame encoding asks for v12.1
+#if NVENCAPI_VERSION != MAKE_NVENC_VER(12U, 1U)
   #error Check and update NVENC code for backwards compatibility!
 #endif
 
+using namespace std::literals;
+
 namespace {
 
+  // Roughly what one NVENC engine keeps up with at P1, 4K at 120 fps
+  constexpr uint64_t split_encode_pixel_rate = 3840ull * 2160 * 120;
+
   GUID quality_preset_guid_from_number(unsigned number) {
     if (number > 7) {
       number = 7;
@@ -56,6 +65,44 @@ namespace {
     }
   };
 
+  std::string status_string(NVENCSTATUS status) {
+    switch (status) {
+#define nvenc_status_case(x) \
+  case x: \
+    return #x;
+      nvenc_status_case(NV_ENC_SUCCESS);
+      nvenc_status_case(NV_ENC_ERR_NO_ENCODE_DEVICE);
+      nvenc_status_case(NV_ENC_ERR_UNSUPPORTED_DEVICE);
+      nvenc_status_case(NV_ENC_ERR_INVALID_ENCODERDEVICE);
+      nvenc_status_case(NV_ENC_ERR_INVALID_DEVICE);
+      nvenc_status_case(NV_ENC_ERR_DEVICE_NOT_EXIST);
+      nvenc_status_case(NV_ENC_ERR_INVALID_PTR);
+      nvenc_status_case(NV_ENC_ERR_INVALID_EVENT);
+      nvenc_status_case(NV_ENC_ERR_INVALID_PARAM);
+      nvenc_status_case(NV_ENC_ERR_INVALID_CALL);
+      nvenc_status_case(NV_ENC_ERR_OUT_OF_MEMORY);
+      nvenc_status_case(NV_ENC_ERR_ENCODER_NOT_INITIALIZED);
+      nvenc_status_case(NV_ENC_ERR_UNSUPPORTED_PARAM);
+      nvenc_status_case(NV_ENC_ERR_LOCK_BUSY);
+      nvenc_status_case(NV_ENC_ERR_NOT_ENOUGH_BUFFER);
+      nvenc_status_case(NV_ENC_ERR_INVALID_VERSION);
+      nvenc_status_case(NV_ENC_ERR_MAP_FAILED);
+      nvenc_status_case(NV_ENC_ERR_NEED_MORE_INPUT);
+      nvenc_status_case(NV_ENC_ERR_ENCODER_BUSY);
+      nvenc_status_case(NV_ENC_ERR_EVENT_NOT_REGISTERD);
+      nvenc_status_case(NV_ENC_ERR_GENERIC);
+      nvenc_status_case(NV_ENC_ERR_INCOMPATIBLE_CLIENT_KEY);
+      nvenc_status_case(NV_ENC_ERR_UNIMPLEMENTED);
+      nvenc_status_case(NV_ENC_ERR_RESOURCE_REGISTER_FAILED);
+      nvenc_status_case(NV_ENC_ERR_RESOURCE_NOT_REGISTERED);
+      nvenc_status_case(NV_ENC_ERR_RESOURCE_NOT_MAPPED);
+      // Newer versions of sdk may add more constants, look for them at the end of NVENCSTATUS enum
+#undef nvenc_status_case
+      default:
+        return std::to_string(status);
+    }
+  }
+
   bool equal_guids(const GUID &guid1, const GUID &guid2) {
     return std::memcmp(&guid1, &guid2, sizeof(GUID)) == 0;
   }
@@ -102,6 +149,18 @@ namespace nvenc {
     // to maximize driver compatibility. AV1 was introduced in SDK v12.0.
     minimum_api_version = (client_config.videoFormat <= 1) ? MAKE_NVENC_VER(11U, 0U) : MAKE_NVENC_VER(12U, 0U);
 
+    // Split frame encoding came with v12.1 and only works for HEVC and AV1.
+    // HEVC sub-frame readback needs the slices of one engine in order, so it wins.
+    bool split_encode = false;
+    if (client_config.videoFormat == 2 || (client_config.videoFormat == 1 && !config.subframe_readback)) {
+      auto pixel_rate = (uint64_t) client_config.width * client_config.height * client_config.framerate;
+      split_encode = config.split_encode == nvenc_split_encode::enabled ||
+                     (config.split_encode == nvenc_split_encode::automatic && pixel_rate >= split_encode_pixel_rate);
+    }
+    if (split_encode) {
+      minimum_api_version = MAKE_NVENC_VER(12U, 1U);
+    }
+
     if (!nvenc && !init_library()) {
       return false;
     }
@@ -117,6 +176,7 @@ namespace nvenc {
     encoder_params.height = client_config.height;
     encoder_params.buffer_format = buffer_format;
     encoder_params.rfi = true;
+    encoder_params.video_format = client_config.videoFormat;
 
     NV_ENC_OPEN_ENCODE_SESSION_EX_PARAMS session_params = {min_struct_version(NV_ENC_OPEN_ENCODE_SESSION_EX_PARAMS_VER)};
     session_params.device = device;
@@ -139,7 +199,7 @@ namespace nvenc {
       return false;
     }
 
-    NV_ENC_INITIALIZE_PARAMS init_params = {min_struct_version(NV_ENC_INITIALIZE_PARAMS_VER)};
+    NV_ENC_INITIALIZE_PARAMS init_params = {min_struct_version(NV_ENC_INITIALIZE_PARAMS_VER, 5, 5)};
 
     switch (client_config.videoFormat) {
       case 0:
@@ -219,6 +279,21 @@ namespace nvenc {
     init_params.enableEncodeAsync = async_event_handle ? 1 : 0;
     init_params.enableWeightedPrediction = config.weighted_prediction && get_encoder_cap(NV_ENC_CAPS_SUPPORT_WEIGHTED_PREDICTION);
 
+    // Let the driver pick how many engines share a frame, a single engine gains nothing from it.
+    // The field is reserved in the v12.0 struct, so it stays zero unless v12.1 was requested.
+    if (split_encode && get_encoder_cap(NV_ENC_CAPS_NUM_ENCODER_ENGINES) > 1) {
+      init_params.splitEncodeMode = NV_ENC_SPLIT_AUTO_FORCED_MODE;
+    }
+
+    // Reading back by slices polls the frame for finished slices, the async event tells when the last one is done
+    encoder_params.subframe_slices = 0;
+    if (config.subframe_readback && client_config.videoFormat != 2 && async_event_handle) {
+      encoder_params.subframe_slices = std::max<uint32_t>(client_config.slicesPerFrame, max_slice_groups);
+      init_params.enableSubFrameWrite = 1;
+      init_params.reportSliceOffsets = 1;
+      slice_offsets.resize(((encoder_params.width + 15) / 16) * ((encoder_params.height + 15) / 16));
+    }
+
     init_params.encodeWidth = encoder_params.width;
     init_params.darWidth = encoder_params.width;
     init_params.encodeHeight = encoder_params.height;
@@ -263,7 +338,7 @@ namespace nvenc {
       format_config.repeatSPSPPS = 1;
       format_config.idrPeriod = NVENC_INFINITE_GOPLENGTH;
       format_config.sliceMode = 3;
-      format_config.sliceModeData = client_config.slicesPerFrame;
+      format_config.sliceModeData = encoder_params.subframe_slices ? encoder_params.subframe_slices : client_config.slicesPerFrame;
       if (buffer_is_yuv444()) {
         format_config.chromaFormatIDC = 3;
       }
@@ -285,6 +360,29 @@ namespace nvenc {
       L0_option = NV_ENC_NUM_REF_FRAMES_1;
     };
 
+    auto set_intra_refresh_if_enabled = [&](auto &format_config) {
+      if (client_config.enableIntraRefresh != 1) {
+        return;
+      }
+
+      if (!get_encoder_cap(NV_ENC_CAPS_SUPPORT_INTRA_REFRESH)) {
+        BOOST_LOG(error) << "NvEnc: Client asked for intra-refresh but the encoder does not support intra-refresh";
+        return;
+      }
+
+      format_config.enableIntraRefresh = 1;
+      format_config.intraRefreshPeriod = 300;
+      format_config.intraRefreshCnt = 299;
+      if (get_encoder_cap(NV_ENC_CAPS_SINGLE_SLICE_INTRA_REFRESH)) {
+        format_config.singleSliceIntraRefresh = 1;
+      } else {
+        BOOST_LOG(warning) << "NvEnc: Single Slice Intra Refresh not supported";
+      }
+
+      // Heal from loss over a quarter second instead of sending a full IDR frame
+      encoder_params.intra_refresh_frames = std::max(client_config.framerate / 4, 1);
+    };
+
     auto set_minqp_if_enabled = [&](int value) {
       if (config.enable_min_qp) {
         enc_config.rcParams.enableMinQP = 1;
@@ -321,6 +419,7 @@ namespace nvenc {
           set_ref_frames(format_config.maxNumRefFrames, format_config.numRefL0, 5);
           set_minqp_if_enabled(config.min_qp_h264);
           fill_h264_hevc_vui(format_config.h264VUIParameters);
+          set_intra_refresh_if_enabled(format_config);
           break;
         }
 
@@ -335,20 +434,7 @@ namespace nvenc {
           set_ref_frames(format_config.maxNumRefFramesInDPB, format_config.numRefL0, 5);
           set_minqp_if_enabled(config.min_qp_hevc);
           fill_h264_hevc_vui(format_config.hevcVUIParameters);
-          if (client_config.enableIntraRefresh == 1) {
-            if (get_encoder_cap(NV_ENC_CAPS_SUPPORT_INTRA_REFRESH)) {
-              format_config.enableIntraRefresh = 1;
-              format_config.intraRefreshPeriod = 300;
-              format_config.intraRefreshCnt = 299;
-              if (get_encoder_cap(NV_ENC_CAPS_SINGLE_SLICE_INTRA_REFRESH)) {
-                format_config.singleSliceIntraRefresh = 1;
-              } else {
-                BOOST_LOG(warning) << "NvEnc: Single Slice Intra Refresh not supported";
-              }
-            } else {
-              BOOST_LOG(error) << "NvEnc: Client asked for intra-refresh but the encoder does not support intra-refresh";
-            }
-          }
+          set_intra_refresh_if_enabled(format_config);
           break;
         }
 
@@ -391,6 +477,11 @@ namespace nvenc {
       return false;
     }
 
+    initialized_params = init_params;
+    initialized_config = enc_config;
+    initialized_params.encodeConfig = &initialized_config;
+    encoder_params.dynamic_bitrate = get_encoder_cap(NV_ENC_CAPS_SUPPORT_DYN_BITRATE_CHANGE);
+
     if (async_event_handle) {
       NV_ENC_EVENT_PARAMS event_params = {min_struct_version(NV_ENC_EVENT_PARAMS_VER)};
       event_params.completionEvent = async_event_handle;
@@ -400,12 +491,15 @@ namespace nvenc {
       }
     }
 
-    NV_ENC_CREATE_BITSTREAM_BUFFER create_bitstream_buffer = {min_struct_version(NV_ENC_CREATE_BITSTREAM_BUFFER_VER)};
-    if (nvenc_failed(nvenc->nvEncCreateBitstreamBuffer(encoder, &create_bitstream_buffer))) {
-      BOOST_LOG(error) << "NvEnc: NvEncCreateBitstreamBuffer() failed: " << last_nvenc_error_string;
-      return false;
+    for (auto &output_bitstream : output_bitstreams) {
+      NV_ENC_CREATE_BITSTREAM_BUFFER create_bitstream_buffer = {min_struct_version(NV_ENC_CREATE_BITSTREAM_BUFFER_VER)};
+      if (nvenc_failed(nvenc->nvEncCreateBitstreamBuffer(encoder, &create_bitstream_buffer))) {
+        BOOST_LOG(error) << "NvEnc: NvEncCreateBitstreamBuffer() failed: " << last_nvenc_error_string;
+        return false;
+      }
+      output_bitstream = create_bitstream_buffer.bitstreamBuffer;
     }
-    output_bitstream = create_bitstream_buffer.bitstreamBuffer;
+    next_output_bitstream = 0;
 
     if (!create_and_register_input_buffer()) {
       return false;
@@ -440,6 +534,9 @@ namespace nvenc {
       if (encoder_params.rfi) {
         extra += " rfi";
       }
+      if (encoder_params.intra_refresh_frames) {
+        extra += " intra-refresh";
+      }
       if (init_params.enableWeightedPrediction) {
         extra += " weighted-prediction";
       }
@@ -452,21 +549,45 @@ namespace nvenc {
       if (config.insert_filler_data) {
         extra += " filler-data";
       }
+      if (encoder_params.subframe_slices) {
+        extra += std::format(" subframe={}", encoder_params.subframe_slices);
+      }
+      if (init_params.splitEncodeMode == NV_ENC_SPLIT_AUTO_FORCED_MODE) {
+        extra += " split-encode";
+      }
 
       BOOST_LOG(info) << "NvEnc: created encoder " << video_format_string << quality_preset_string_from_guid(init_params.presetGUID) << extra;
     }
 
     encoder_state = {};
+
+    completion.input_busy = false;
+    completion.failed = false;
+    completion.stop = false;
+    completion.thread = std::thread {&nvenc_base::retrieve_frames, this};
+
     fail_guard.disable();
     return true;
   }
 
   void nvenc_base::destroy_encoder() {
-    if (output_bitstream) {
-      if (nvenc_failed(nvenc->nvEncDestroyBitstreamBuffer(encoder, output_bitstream))) {
-        BOOST_LOG(error) << "NvEnc: NvEncDestroyBitstreamBuffer() failed: " << last_nvenc_error_string;
+    if (completion.thread.joinable()) {
+      // The completion thread retrieves what's still in flight before it exits
+      {
+        std::lock_guard lg {completion.lock};
+        completion.stop = true;
+      }
+      completion.cv.notify_all();
+      completion.thread.join();
+    }
+
+    for (auto &output_bitstream : output_bitstreams) {
+      if (output_bitstream) {
+        if (nvenc_failed(nvenc->nvEncDestroyBitstreamBuffer(encoder, output_bitstream))) {
+          BOOST_LOG(error) << "NvEnc: NvEncDestroyBitstreamBuffer() failed: " << last_nvenc_error_string;
+        }
+        output_bitstream = nullptr;
       }
-      output_bitstream = nullptr;
     }
     if (encoder && async_event_handle) {
       NV_ENC_EVENT_PARAMS event_params = {min_struct_version(NV_ENC_EVENT_PARAMS_VER)};
@@ -492,17 +613,31 @@ namespace nvenc {
     encoder_params = {};
   }
 
-  nvenc_encoded_frame nvenc_base::encode_frame(uint64_t frame_index, bool force_idr) {
+  bool nvenc_base::submit_frame(uint64_t frame_index, bool force_idr, encoded_frame_cb_t on_encoded) {
     if (!encoder) {
-      return {};
+      return false;
     }
 
     assert(registered_input_buffer);
-    assert(output_bitstream);
+
+    {
+      // Wait for the input surface and for a free output bitstream
+      std::unique_lock ul {completion.lock};
+      if (!completion.cv.wait_for(ul, 100ms, [&]() {
+            return completion.failed || (!completion.input_busy && completion.frames.size() < pipeline_depth);
+          })) {
+        BOOST_LOG(error) << "NvEnc: frame " << frame_index << " submit wait timeout";
+        return false;
+      }
+
+      if (completion.failed) {
+        return false;
+      }
+    }
 
     if (!synchronize_input_buffer()) {
       BOOST_LOG(error) << "NvEnc: failed to synchronize input buffer";
-      return {};
+      return false;
     }
 
     NV_ENC_MAP_INPUT_RESOURCE mapped_input_buffer = {min_struct_version(NV_ENC_MAP_INPUT_RESOURCE_VER)};
@@ -510,7 +645,7 @@ namespace nvenc {
 
     if (nvenc_failed(nvenc->nvEncMapInputResource(encoder, &mapped_input_buffer))) {
       BOOST_LOG(error) << "NvEnc: NvEncMapInputResource() failed: " << last_nvenc_error_string;
-      return {};
+      return false;
     }
     auto unmap_guard = util::fail_guard([&] {
       if (nvenc_failed(nvenc->nvEncUnmapInputResource(encoder, mapped_input_buffer.mappedResource))) {
@@ -518,6 +653,8 @@ namespace nvenc {
       }
     });
 
+    auto output_bitstream = output_bitstreams[next_output_bitstream];
+
     NV_ENC_PIC_PARAMS pic_params = {min_struct_version(NV_ENC_PIC_PARAMS_VER, 4, 6)};
     pic_params.inputWidth = encoder_params.width;
     pic_params.inputHeight = encoder_params.height;
@@ -529,32 +666,37 @@ namespace nvenc {
     pic_params.outputBitstream = output_bitstream;
     pic_params.completionEvent = async_event_handle;
 
+    if (encoder_state.intra_refresh_pending && !force_idr) {
+      if (encoder_params.video_format == 0) {
+        pic_params.codecPicParams.h264PicParams.forceIntraRefreshWithFrameCnt = encoder_params.intra_refresh_frames;
+      } else {
+        pic_params.codecPicParams.hevcPicParams.forceIntraRefreshWithFrameCnt = encoder_params.intra_refresh_frames;
+      }
+    }
+    encoder_state.intra_refresh_pending = false;
+
     if (nvenc_failed(nvenc->nvEncEncodePicture(encoder, &pic_params))) {
       BOOST_LOG(error) << "NvEnc: NvEncEncodePicture() failed: " << last_nvenc_error_string;
-      return {};
+      return false;
     }
 
-    NV_ENC_LOCK_BITSTREAM lock_bitstream = {min_struct_version(NV_ENC_LOCK_BITSTREAM_VER, 1, 2)};
-    lock_bitstream.outputBitstream = output_bitstream;
-    lock_bitstream.doNotWait = async_event_handle ? 1 : 0;
+    // The completion thread unmaps the input once the encoder is done with it
+    unmap_guard.disable();
 
-    if (async_event_handle && !wait_for_async_event(100)) {
-      BOOST_LOG(error) << "NvEnc: frame " << frame_index << " encode wait timeout";
-      return {};
+    {
+      std::lock_guard lg {completion.lock};
+      completion.frames.emplace_back(pending_frame_t {
+        output_bitstream,
+        mapped_input_buffer.mappedResource,
+        frame_index,
+        encoder_state.rfi_needs_confirmation,
+        std::move(on_encoded),
+      });
+      completion.input_busy = true;
     }
+    completion.cv.notify_all();
 
-    if (nvenc_failed(nvenc->nvEncLockBitstream(encoder, &lock_bitstream))) {
-      BOOST_LOG(error) << "NvEnc: NvEncLockBitstream() failed: " << last_nvenc_error_string;
-      return {};
-    }
-
-    auto data_pointer = (uint8_t *) lock_bitstream.bitstreamBufferPtr;
-    nvenc_encoded_frame encoded_frame {
-      {data_pointer, data_pointer + lock_bitstream.bitstreamSizeInBytes},
-      lock_bitstream.outputTimeStamp,
-      lock_bitstream.pictureType == NV_ENC_PIC_TYPE_IDR,
-      encoder_state.rfi_needs_confirmation,
-    };
+    next_output_bitstream = (next_output_bitstream + 1) % pipeline_depth;
 
     if (encoder_state.rfi_needs_confirmation) {
       // Invalidation request has been fulfilled, and video network packet will be marked as such
@@ -563,24 +705,207 @@ namespace nvenc {
 
     encoder_state.last_encoded_frame_index = frame_index;
 
-    if (encoded_frame.idr) {
-      BOOST_LOG(debug) << "NvEnc: idr frame " << encoded_frame.frame_index;
+    return true;
+  }
+
+  bool nvenc_base::wait_for_input() {
+    std::unique_lock ul {completion.lock};
+    if (!completion.cv.wait_for(ul, 100ms, [&]() {
+          return completion.failed || !completion.input_busy;
+        })) {
+      BOOST_LOG(error) << "NvEnc: input surface wait timeout";
+      return false;
     }
 
-    if (nvenc_failed(nvenc->nvEncUnlockBitstream(encoder, lock_bitstream.outputBitstream))) {
-      BOOST_LOG(error) << "NvEnc: NvEncUnlockBitstream() failed: " << last_nvenc_error_string;
+    return !completion.failed;
+  }
+
+  void nvenc_base::retrieve_frames() {
+    std::unique_lock ul {completion.lock};
+
+    while (true) {
+      completion.cv.wait(ul, [&]() {
+        return completion.stop || !completion.frames.empty();
+      });
+
+      if (completion.frames.empty()) {
+        return;
+      }
+
+      // Only this thread removes frames, so the reference stays valid without the lock
+      auto &frame = completion.frames.front();
+      ul.unlock();
+
+      if (encoder_params.subframe_slices) {
+        auto ok = retrieve_slice_groups(frame);
+
+        if (auto status = nvenc->nvEncUnmapInputResource(encoder, frame.mapped_input); status != NV_ENC_SUCCESS) {
+          BOOST_LOG(error) << "NvEnc: NvEncUnmapInputResource() failed: " << status_string(status);
+        }
+
+        ul.lock();
+        completion.input_busy = false;
+        completion.failed = completion.failed || !ok;
+        completion.frames.pop_front();
+        completion.cv.notify_all();
+        continue;
+      }
+
+      bool ok = true;
+      if (async_event_handle && !wait_for_async_event(100)) {
+        BOOST_LOG(error) << "NvEnc: frame " << frame.frame_index << " encode wait timeout";
+        ok = false;
+      }
+
+      NV_ENC_LOCK_BITSTREAM lock_bitstream = {min_struct_version(NV_ENC_LOCK_BITSTREAM_VER, 1, 2)};
+      lock_bitstream.outputBitstream = frame.output_bitstream;
+      lock_bitstream.doNotWait = async_event_handle ? 1 : 0;
+
+      // Without an async event, locking the bitstream is what waits for the encoder
+      NVENCSTATUS status = NV_ENC_SUCCESS;
+      if (ok && (status = nvenc->nvEncLockBitstream(encoder, &lock_bitstream)) != NV_ENC_SUCCESS) {
+        BOOST_LOG(error) << "NvEnc: NvEncLockBitstream() failed: " << status_string(status);
+        ok = false;
+      }
+
+      if ((status = nvenc->nvEncUnmapInputResource(encoder, frame.mapped_input)) != NV_ENC_SUCCESS) {
+        BOOST_LOG(error) << "NvEnc: NvEncUnmapInputResource() failed: " << status_string(status);
+      }
+
+      // The next frame can be written into the input surface while this one is copied out
+      ul.lock();
+      completion.input_busy = false;
+      completion.failed = completion.failed || !ok;
+      ul.unlock();
+      completion.cv.notify_all();
+
+      nvenc_encoded_frame encoded_frame;
+      if (ok) {
+        encoded_frame = {
+          {(const uint8_t *) lock_bitstream.bitstreamBufferPtr, lock_bitstream.bitstreamSizeInBytes},
+          lock_bitstream.outputTimeStamp,
+          lock_bitstream.pictureType == NV_ENC_PIC_TYPE_IDR,
+          frame.after_ref_frame_invalidation,
+        };
+
+        if (encoded_frame.idr) {
+          BOOST_LOG(debug) << "NvEnc: idr frame " << encoded_frame.frame_index;
+        }
+
+        encoder_state.frame_size_logger.collect_and_log(encoded_frame.data.size() / 1000.);
+      }
+
+      // The bitstream is copied straight out of the locked buffer
+      frame.on_encoded(std::move(encoded_frame));
+
+      if (ok && (status = nvenc->nvEncUnlockBitstream(encoder, lock_bitstream.outputBitstream)) != NV_ENC_SUCCESS) {
+        BOOST_LOG(error) << "NvEnc: NvEncUnlockBitstream() failed: " << status_string(status);
+      }
+
+      ul.lock();
+      completion.frames.pop_front();
+      completion.cv.notify_all();
+    }
+  }
+
+  bool nvenc_base::retrieve_slice_groups(pending_frame_t &frame) {
+    auto slices = encoder_params.subframe_slices;
+    auto groups = std::min(slices, max_slice_groups);
+    auto timeout = std::chrono::steady_clock::now() + 100ms;
+
+    uint32_t group = 0;
+    uint32_t group_start = 0;
+    bool complete = false;
+
+    while (group < groups) {
+      // Checked before locking, so the lock sees every slice once the frame is done
+      complete = complete || wait_for_async_event(0);
+      if (!complete && std::chrono::steady_clock::now() > timeout) {
+        BOOST_LOG(error) << "NvEnc: frame " << frame.frame_index << " encode wait timeout";
+        break;
+      }
+
+      NV_ENC_LOCK_BITSTREAM lock_bitstream = {min_struct_version(NV_ENC_LOCK_BITSTREAM_VER, 1, 2)};
+      lock_bitstream.outputBitstream = frame.output_bitstream;
+      lock_bitstream.doNotWait = 1;
+      lock_bitstream.sliceOffsets = slice_offsets.data();
+
+      auto status = nvenc->nvEncLockBitstream(encoder, &lock_bitstream);
+      if (!complete && (status == NV_ENC_ERR_LOCK_BUSY || status == NV_ENC_ERR_ENCODER_BUSY)) {
+        std::this_thread::yield();
+        continue;
+      }
+      if (status != NV_ENC_SUCCESS) {
+        BOOST_LOG(error) << "NvEnc: NvEncLockBitstream() failed: " << status_string(status);
+        break;
+      }
+
+      // A group is done once the slice after it is, the last one once the frame is.
+      // If the encoder made fewer slices than asked for, the groups it didn't fill are handed on empty.
+      while (group < groups) {
+        auto next_slice = (group + 1) * slices / groups;
+        auto last_group = group + 1 == groups;
+        if (!complete && (last_group || lock_bitstream.numSlices < next_slice)) {
+          break;
+        }
+
+        auto group_end = !last_group && lock_bitstream.numSlices > next_slice ? slice_offsets[next_slice] : lock_bitstream.bitstreamSizeInBytes;
+        group_end = std::clamp(group_end, group_start, lock_bitstream.bitstreamSizeInBytes);
+
+        frame.on_encoded({
+          {(const uint8_t *) lock_bitstream.bitstreamBufferPtr + group_start, group_end - group_start},
+          lock_bitstream.outputTimeStamp,
+          lock_bitstream.pictureType == NV_ENC_PIC_TYPE_IDR,
+          frame.after_ref_frame_invalidation,
+          (int) group,
+          (int) groups,
+        });
+
+        group_start = group_end;
+        ++group;
+      }
+
+      if (complete) {
+        if (lock_bitstream.pictureType == NV_ENC_PIC_TYPE_IDR) {
+          BOOST_LOG(debug) << "NvEnc: idr frame " << lock_bitstream.outputTimeStamp;
+        }
+        encoder_state.frame_size_logger.collect_and_log(lock_bitstream.bitstreamSizeInBytes / 1000.);
+      }
+
+      if ((status = nvenc->nvEncUnlockBitstream(encoder, lock_bitstream.outputBitstream)) != NV_ENC_SUCCESS) {
+        BOOST_LOG(error) << "NvEnc: NvEncUnlockBitstream() failed: " << status_string(status);
+        break;
+      }
     }
 
-    encoder_state.frame_size_logger.collect_and_log(encoded_frame.data.size() / 1000.);
+    if (group == 0) {
+      frame.on_encoded({});
+    }
 
-    return encoded_frame;
+    return group == groups;
   }
 
   bool nvenc_base::invalidate_ref_frames(uint64_t first_frame, uint64_t last_frame) {
-    if (!encoder || !encoder_params.rfi) {
+    if (!encoder) {
       return false;
     }
 
+    // Start an intra-refresh wave instead of the IDR frame the caller would fall back to
+    auto intra_refresh_or_idr = [&]() {
+      if (!encoder_params.intra_refresh_frames) {
+        return false;
+      }
+
+      BOOST_LOG(debug) << "NvEnc: recovering with a " << encoder_params.intra_refresh_frames << " frame intra-refresh";
+      encoder_state.intra_refresh_pending = true;
+      encoder_state.rfi_needs_confirmation = true;
+      return true;
+    };
+
+    if (!encoder_params.rfi) {
+      return intra_refresh_or_idr();
+    }
+
     if (first_frame >= encoder_state.last_rfi_range.first &&
         last_frame <= encoder_state.last_rfi_range.second) {
       BOOST_LOG(debug) << "NvEnc: rfi request " << first_frame << "-" << last_frame << " already done";
@@ -591,7 +916,7 @@ namespace nvenc {
 
     if (last_frame < first_frame) {
       BOOST_LOG(error) << "NvEnc: invaid rfi request " << first_frame << "-" << last_frame << ", generating IDR";
-      return false;
+      return intra_refresh_or_idr();
     }
 
     BOOST_LOG(debug) << "NvEnc: rfi request " << first_frame << "-" << last_frame << " expanding to last encoded frame " << encoder_state.last_encoded_frame_index;
@@ -601,58 +926,49 @@ namespace nvenc {
 
     if (last_frame - first_frame + 1 >= encoder_params.ref_frames_in_dpb) {
       BOOST_LOG(debug) << "NvEnc: rfi request too large, generating IDR";
-      return false;
+      return intra_refresh_or_idr();
     }
 
     for (auto i = first_frame; i <= last_frame; i++) {
       if (nvenc_failed(nvenc->nvEncInvalidateRefFrames(encoder, i))) {
         BOOST_LOG(error) << "NvEnc: NvEncInvalidateRefFrames() " << i << " failed: " << last_nvenc_error_string;
-        return false;
+        return intra_refresh_or_idr();
       }
     }
 
     return true;
   }
 
-  bool nvenc_base::nvenc_failed(NVENCSTATUS status) {
-    auto status_string = [](NVENCSTATUS status) -> std::string {
-      switch (status) {
-#define nvenc_status_case(x) \
-  case x: \
-    return #x;
-        nvenc_status_case(NV_ENC_SUCCESS);
-        nvenc_status_case(NV_ENC_ERR_NO_ENCODE_DEVICE);
-        nvenc_status_case(NV_ENC_ERR_UNSUPPORTED_DEVICE);
-        nvenc_status_case(NV_ENC_ERR_INVALID_ENCODERDEVICE);
-        nvenc_status_case(NV_ENC_ERR_INVALID_DEVICE);
-        nvenc_status_case(NV_ENC_ERR_DEVICE_NOT_EXIST);
-        nvenc_status_case(NV_ENC_ERR_INVALID_PTR);
-        nvenc_status_case(NV_ENC_ERR_INVALID_EVENT);
-        nvenc_status_case(NV_ENC_ERR_INVALID_PARAM);
-        nvenc_status_case(NV_ENC_ERR_INVALID_CALL);
-        nvenc_status_case(NV_ENC_ERR_OUT_OF_MEMORY);
-        nvenc_status_case(NV_ENC_ERR_ENCODER_NOT_INITIALIZED);
-        nvenc_status_case(NV_ENC_ERR_UNSUPPORTED_PARAM);
-        nvenc_status_case(NV_ENC_ERR_LOCK_BUSY);
-        nvenc_status_case(NV_ENC_ERR_NOT_ENOUGH_BUFFER);
-        nvenc_status_case(NV_ENC_ERR_INVALID_VERSION);
-        nvenc_status_case(NV_ENC_ERR_MAP_FAILED);
-        nvenc_status_case(NV_ENC_ERR_NEED_MORE_INPUT);
-        nvenc_status_case(NV_ENC_ERR_ENCODER_BUSY);
-        nvenc_status_case(NV_ENC_ERR_EVENT_NOT_REGISTERD);
-        nvenc_status_case(NV_ENC_ERR_GENERIC);
-        nvenc_status_case(NV_ENC_ERR_INCOMPATIBLE_CLIENT_KEY);
-        nvenc_status_case(NV_ENC_ERR_UNIMPLEMENTED);
-        nvenc_status_case(NV_ENC_ERR_RESOURCE_REGISTER_FAILED);
-        nvenc_status_case(NV_ENC_ERR_RESOURCE_NOT_REGISTERED);
-        nvenc_status_case(NV_ENC_ERR_RESOURCE_NOT_MAPPED);
-        // Newer versions of sdk may add more constants, look for them at the end of NVENCSTATUS enum
-#undef nvenc_status_case
-        default:
-          return std::to_string(status);
-      }
-    };
+  bool nvenc_base::set_bitrate(uint32_t bitrate_kbps) {
+    if (!encoder || !encoder_params.dynamic_bitrate) {
+      return false;
+    }
+
+    auto enc_config = initialized_config;
+    auto &rc_params = enc_config.rcParams;
+
+    // Scale the VBV with the bitrate, so it keeps holding the same number of frames
+    if (rc_params.vbvBufferSize) {
+      rc_params.vbvBufferSize = (uint64_t) rc_params.vbvBufferSize * bitrate_kbps * 1000 / rc_params.averageBitRate;
+    }
+    rc_params.averageBitRate = bitrate_kbps * 1000;
+
+    NV_ENC_RECONFIGURE_PARAMS reconfigure_params = {min_struct_version(NV_ENC_RECONFIGURE_PARAMS_VER, 1, 1)};
+    reconfigure_params.reInitEncodeParams = initialized_params;
+    reconfigure_params.reInitEncodeParams.encodeConfig = &enc_config;
+    reconfigure_params.resetEncoder = 0;
+    reconfigure_params.forceIDR = 0;
+
+    if (nvenc_failed(nvenc->nvEncReconfigureEncoder(encoder, &reconfigure_params))) {
+      BOOST_LOG(error) << "NvEnc: NvEncReconfigureEncoder() failed: " << last_nvenc_error_string;
+      return false;
+    }
 
+    initialized_config = enc_config;
+    return true;
+  }
+
+  bool nvenc_base::nvenc_failed(NVENCSTATUS status) {
     last_nvenc_error_string.clear();
     if (status != NV_ENC_SUCCESS) {
       /* This API function gives broken strings more often than not
@@ -675,8 +991,8 @@ namespace nvenc {
     version &= ~NVENCAPI_VERSION;
     version |= minimum_api_version;
 
-    // If there's a struct version override, apply that too
-    if (v11_struct_version || v12_struct_version) {
+    // If there's a struct version override for an older API than the headers, apply that too
+    if ((v11_struct_version || v12_struct_version) && minimum_api_version != NVENCAPI_VERSION) {
       version &= ~(0xFFu << 16);
       version |= (((minimum_api_version & 0xFF) >= 12) ? v12_struct_version : v11_struct_version) << 16;
     }
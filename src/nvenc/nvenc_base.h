@@ -4,6 +4,15 @@
  */
 #pragma once
 
+// standard includes
+#include <array>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
 // lib includes
 #include <ffnvcodec/nvEncodeAPI.h>
 
@@ -51,14 +60,29 @@ namespace nvenc {
     void destroy_encoder();
 
     /**
-     * @brief Encode the next frame using platform-specific input surface.
+     * @brief Receives encoded frames, called from the completion thread.
+     */
+    using encoded_frame_cb_t = std::function<void(nvenc_encoded_frame &&)>;
+
+    /**
+     * @brief Submit the next frame in the platform-specific input surface for encoding, without waiting for it.
+     *        A completion thread retrieves the bitstream, so retrieving a frame overlaps with the submission of the next one.
      * @param frame_index Frame index that uniquely identifies the frame.
      *        Afterwards serves as parameter for `invalidate_ref_frames()`.
      *        No restrictions on the first frame index, but later frame indexes must be subsequent.
      * @param force_idr Whether to encode frame as forced IDR.
-     * @return Encoded frame.
+     * @param on_encoded Receives the encoded frame, or an empty frame if it couldn't be retrieved.
+     *        The frame data points into the locked bitstream, so it must be copied before returning.
+     * @return `true` on success, `false` on error.
      */
-    nvenc_encoded_frame encode_frame(uint64_t frame_index, bool force_idr);
+    bool submit_frame(uint64_t frame_index, bool force_idr, encoded_frame_cb_t on_encoded);
+
+    /**
+     * @brief Wait until the encoder is done reading the input surface.
+     *        Must be called before the next frame is written into the input surface.
+     * @return `true` on success, `false` on timeout or if retrieving an earlier frame failed.
+     */
+    bool wait_for_input();
 
     /**
      * @brief Perform reference frame invalidation (RFI) procedure.
@@ -69,6 +93,13 @@ namespace nvenc {
      */
     bool invalidate_ref_frames(uint64_t first_frame, uint64_t last_frame);
 
+    /**
+     * @brief Change the bitrate of the running encoder, without an IDR frame.
+     * @param bitrate_kbps The new bitrate in kilobits per second.
+     * @return `true` on success, `false` if the encoder can't change its bitrate.
+     */
+    bool set_bitrate(uint32_t bitrate_kbps);
+
   protected:
     /**
      * @brief Required. Used for loading NvEnc library and setting `nvenc` variable with `NvEncodeAPICreateInstance()`.
@@ -86,7 +117,7 @@ namespace nvenc {
     virtual bool create_and_register_input_buffer() = 0;
 
     /**
-     * @brief Optional. Override if you must perform additional operations on the registered input surface in the beginning of `encode_frame()`.
+     * @brief Optional. Override if you must perform additional operations on the registered input surface in the beginning of `submit_frame()`.
      *        Typically used for interop copy.
      * @return `true` on success, `false` on error
      */
@@ -111,7 +142,7 @@ namespace nvenc {
      * @details Reducing the struct versions maximizes driver compatibility by avoiding needless API breaks.
      * @param version The raw structure version from `NVENCAPI_STRUCT_VERSION()`.
      * @param v11_struct_version Optionally specifies the struct version to use with v11 SDK major versions.
-     * @param v12_struct_version Optionally specifies the struct version to use with v12 SDK major versions.
+     * @param v12_struct_version Optionally specifies the struct version to use with v12 SDK versions older than the headers.
      * @return A suitable struct version for the active codec.
      */
     uint32_t min_struct_version(uint32_t version, uint32_t v11_struct_version = 0, uint32_t v12_struct_version = 0);
@@ -126,6 +157,10 @@ namespace nvenc {
       NV_ENC_BUFFER_FORMAT buffer_format = NV_ENC_BUFFER_FORMAT_UNDEFINED;
       uint32_t ref_frames_in_dpb = 0;
       bool rfi = false;
+      int video_format = 0;
+      uint32_t intra_refresh_frames = 0;  // Length of an on-demand intra-refresh wave, 0 if intra-refresh is disabled
+      bool dynamic_bitrate = false;
+      uint32_t subframe_slices = 0;  // Slices per frame when frames are read back by slices, 0 if they're read back whole
     } encoder_params;
 
     std::string last_nvenc_error_string;
@@ -141,12 +176,55 @@ namespace nvenc {
                                          ///< Can be set in constructor or `init_library()`, must override `wait_for_async_event()`.
 
   private:
-    NV_ENC_OUTPUT_PTR output_bitstream = nullptr;
+    // Output bitstreams that can be waiting for retrieval at once
+    static constexpr std::size_t pipeline_depth = 3;
+
+    // Every group of slices read back is sent as one FEC block, and a frame has at most 4 of them
+    static constexpr uint32_t max_slice_groups = 4;
+
+    struct pending_frame_t {
+      NV_ENC_OUTPUT_PTR output_bitstream;
+      NV_ENC_INPUT_PTR mapped_input;
+      uint64_t frame_index;
+      bool after_ref_frame_invalidation;
+      encoded_frame_cb_t on_encoded;
+    };
+
+    /**
+     * @brief Body of the completion thread, retrieves the submitted frames in order.
+     */
+    void retrieve_frames();
+
+    /**
+     * @brief Poll a frame for finished slices and hand them on in groups, while the encoder works on the rest.
+     * @param frame The frame, its callback is invoked once for every group.
+     * @return `true` once the whole frame was handed on, `false` on error or timeout.
+     */
+    bool retrieve_slice_groups(pending_frame_t &frame);
+
+    std::array<NV_ENC_OUTPUT_PTR, pipeline_depth> output_bitstreams = {};
+    std::vector<uint32_t> slice_offsets;  ///< Receives the slice offsets when reading back by slices, one entry per macroblock
+    std::size_t next_output_bitstream = 0;
     uint32_t minimum_api_version = 0;
 
+    struct {
+      std::mutex lock;
+      std::condition_variable cv;
+      std::deque<pending_frame_t> frames;  ///< Submitted frames, the oldest one is being retrieved
+      bool input_busy = false;  ///< The encoder can still be reading the input surface
+      bool failed = false;
+      bool stop = false;
+      std::thread thread;
+    } completion;
+
+    // What the encoder was initialized with, reconfiguration starts from these
+    NV_ENC_INITIALIZE_PARAMS initialized_params = {};
+    NV_ENC_CONFIG initialized_config = {};
+
     struct {
       uint64_t last_encoded_frame_index = 0;
       bool rfi_needs_confirmation = false;
+      bool intra_refresh_pending = false;
       std::pair<uint64_t, uint64_t> last_rfi_range;
       logging::min_max_avg_periodic_logger<double> frame_size_logger = {debug, "NvEnc: encoded frame sizes in kB", ""};
     } encoder_state;
@@ -12,6 +12,12 @@ namespace nvenc {
     full_resolution,  ///< Better overall statistics, slower and uses more extra vram
   };
 
+  enum class nvenc_split_encode {
+    disabled,  ///< Every frame is encoded by a single NVENC engine
+    automatic,  ///< Split frames across the NVENC engines when the pixel rate is too high for one of them
+    enabled,  ///< Always split frames across the NVENC engines
+  };
+
   /**
    * @brief NVENC encoder configuration.
    */
@@ -48,6 +54,12 @@ namespace nvenc {
 
     // Add filler data to encoded frames to stay at target bitrate, mainly for testing
     bool insert_filler_data = false;
+
+    // Read back and send groups of slices while the rest of the frame is still being encoded, H.264 and HEVC only
+    bool subframe_readback = false;
+
+    // Encode parts of each frame on separate NVENC engines in parallel, HEVC and AV1 only, needs a GPU with several engines
+    nvenc_split_encode split_encode = nvenc_split_encode::automatic;
   };
 
 }  // namespace nvenc
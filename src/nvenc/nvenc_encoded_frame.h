@@ -6,7 +6,7 @@
 
 // standard includes
 #include <cstdint>
-#include <vector>
+#include <span>
 
 namespace nvenc {
 
@@ -14,10 +14,12 @@ namespace nvenc {
    * @brief Encoded frame.
    */
   struct nvenc_encoded_frame {
-    std::vector<uint8_t> data;
+    std::span<const uint8_t> data;  ///< The locked output bitstream, only valid until the callback returns
     uint64_t frame_index = 0;
     bool idr = false;
     bool after_ref_frame_invalidation = false;
+    int slice_group = 0;  ///< Part of the frame, frames read back by slices arrive in several parts
+    int slice_groups = 1;  ///< Number of parts the frame arrives in
   };
 
 }  // namespace nvenc
@@ -6,9 +6,15 @@
 #define BOOST_BIND_GLOBAL_PLACEHOLDERS
 
 // standard includes
+#include <deque>
 #include <filesystem>
 #include <format>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <optional>
 #include <string>
+#include <unordered_map>
 #include <utility>
 
 // lib includes
@@ -57,13 +63,21 @@ namespace nvhttp {
       context.use_private_key_file(private_key_file, boost::asio::ssl::context::pem);
     }
 
-    std::function<int(SSL *)> verify;
+    std::function<int(SSL *, const boost::asio::ip::address &)> verify;
     std::function<void(std::shared_ptr<Response>, std::shared_ptr<Request>)> on_verify_failed;
 
   protected:
     boost::asio::ssl::context context;
 
     void after_bind() override {
+      // Moonlight opens a new connection for most requests, resumed TLS sessions skip the full handshake.
+      // The peer certificate is kept in the session, so resumed connections are still verified below.
+      // With client certificates, OpenSSL only resumes sessions that have a session ID context.
+      constexpr std::string_view session_id_context = "sunshine-nvhttp"sv;
+      SSL_CTX_set_session_id_context(context.native_handle(), (const unsigned char *) session_id_context.data(), session_id_context.size());
+      SSL_CTX_set_session_cache_mode(context.native_handle(), SSL_SESS_CACHE_SERVER);
+      SSL_CTX_set_timeout(context.native_handle(), std::chrono::duration_cast<std::chrono::seconds>(1h).count());
+
       if (verify) {
         context.set_verify_mode(boost::asio::ssl::verify_peer | boost::asio::ssl::verify_fail_if_no_peer_cert | boost::asio::ssl::verify_client_once);
         context.set_verify_callback([](int verified, boost::asio::ssl::verify_context &ctx) {
@@ -102,7 +116,9 @@ namespace nvhttp {
               return;
             }
             if (!ec) {
-              if (verify && !verify(session->connection->socket->native_handle())) {
+              SimpleWeb::error_code ec;
+              auto address = session->connection->socket->lowest_layer().remote_endpoint(ec).address();
+              if (verify && !verify(session->connection->socket->native_handle(), address)) {
                 this->write(session, on_verify_failed);
               } else {
                 this->read(session);
@@ -130,6 +146,7 @@ namespace nvhttp {
     std::string name;
     std::string uuid;
     std::string cert;
+    std::optional<stream_profile_t> profile;
   };
 
   struct client_t {
@@ -139,8 +156,60 @@ namespace nvhttp {
   // uniqueID, session
   std::unordered_map<std::string, pair_session_t> map_id_sess;
   client_t client_root;
+
+  // Guards map_id_sess, client_root and cert_chain, the servers handle requests on several threads
+  std::mutex clients_lock;
+
+  // Address and UUID of the paired clients whose certificates were verified last, guarded by clients_lock
+  std::deque<std::pair<std::string, std::string>> verified_clients;
+
+  // Launch, resume and cancel change the running app, they run one at a time
+  std::mutex launch_lock;
   std::atomic<uint32_t> session_id_counter;
 
+  // Contents of file_state as last read or written, unset if the file couldn't be read
+  std::optional<pt::ptree> state_tree;
+
+  /**
+   * @brief Serialized responses, keyed by everything they are built from.
+   * Clients poll serverinfo and applist, so the XML is only rebuilt when something in the key changes.
+   */
+  class response_cache_t {
+  public:
+    // A key per local address and pairing state, for HTTP and HTTPS
+    static constexpr std::size_t max_entries = 16;
+
+    std::optional<std::string> find(const std::string &key) {
+      std::lock_guard lg {mutex};
+
+      auto it = bodies.find(key);
+      if (it == std::end(bodies)) {
+        return std::nullopt;
+      }
+
+      return it->second;
+    }
+
+    std::string insert(std::string &&key, std::string body) {
+      std::lock_guard lg {mutex};
+
+      // Keys of a stale state are never looked up again
+      if (bodies.size() >= max_entries) {
+        bodies.clear();
+      }
+
+      bodies.insert_or_assign(std::move(key), body);
+      return body;
+    }
+
+  private:
+    std::mutex mutex;
+    std::unordered_map<std::string, std::string> bodies;
+  };
+
+  response_cache_t serverinfo_cache;
+  response_cache_t applist_cache;
+
   using args_t = SimpleWeb::CaseInsensitiveMultimap;
   using resp_https_t = std::shared_ptr<typename SimpleWeb::ServerBase<SunshineHTTPS>::Response>;
   using req_https_t = std::shared_ptr<typename SimpleWeb::ServerBase<SunshineHTTPS>::Request>;
@@ -164,18 +233,34 @@ namespace nvhttp {
     return it->second;
   }
 
-  void save_state() {
-    pt::ptree root;
+  /**
+   * @brief Build the certificate chain from the paired clients.
+   */
+  void load_cert_chain() {
+    cert_chain.clear();
+    for (auto &named_cert : client_root.named_devices) {
+      cert_chain.add(crypto::x509(named_cert.cert));
+    }
+  }
 
-    if (fs::exists(config::nvhttp.file_state)) {
-      try {
-        pt::read_json(config::nvhttp.file_state, root);
-      } catch (std::exception &e) {
-        BOOST_LOG(error) << "Couldn't read "sv << config::nvhttp.file_state << ": "sv << e.what();
-        return;
+  void save_state() {
+    // Other keys of the file are kept, only the root node is written again
+    if (!state_tree) {
+      pt::ptree root;
+
+      if (fs::exists(config::nvhttp.file_state)) {
+        try {
+          pt::read_json(config::nvhttp.file_state, root);
+        } catch (std::exception &e) {
+          BOOST_LOG(error) << "Couldn't read "sv << config::nvhttp.file_state << ": "sv << e.what();
+          return;
+        }
       }
+
+      state_tree = std::move(root);
     }
 
+    auto root = *state_tree;
     root.erase("root"s);
 
     root.put("root.uniqueid", http::unique_id);
@@ -188,22 +273,42 @@ namespace nvhttp {
       named_cert_node.put("name"s, named_cert.name);
       named_cert_node.put("cert"s, named_cert.cert);
       named_cert_node.put("uuid"s, named_cert.uuid);
+      if (named_cert.profile) {
+        auto &profile = *named_cert.profile;
+        named_cert_node.put("profile.bitrate_kbps"s, profile.bitrate_kbps);
+        named_cert_node.put("profile.fec_percentage"s, profile.fec_percentage);
+        named_cert_node.put("profile.packet_size"s, profile.packet_size);
+        named_cert_node.put("profile.path_mtu"s, profile.path_mtu);
+      }
       named_cert_nodes.push_back(std::make_pair(""s, named_cert_node));
     }
     root.add_child("root.named_devices"s, named_cert_nodes);
 
+    // Write a new file and swap it in, so the old state survives a failed write
+    auto file_tmp = config::nvhttp.file_state + ".tmp"s;
     try {
-      pt::write_json(config::nvhttp.file_state, root);
+      pt::write_json(file_tmp, root);
     } catch (std::exception &e) {
-      BOOST_LOG(error) << "Couldn't write "sv << config::nvhttp.file_state << ": "sv << e.what();
+      BOOST_LOG(error) << "Couldn't write "sv << file_tmp << ": "sv << e.what();
+      return;
+    }
+
+    std::error_code ec;
+    fs::rename(file_tmp, config::nvhttp.file_state, ec);
+    if (ec) {
+      BOOST_LOG(error) << "Couldn't replace "sv << config::nvhttp.file_state << ": "sv << ec.message();
+      fs::remove(file_tmp, ec);
       return;
     }
+
+    state_tree = std::move(root);
   }
 
   void load_state() {
     if (!fs::exists(config::nvhttp.file_state)) {
       BOOST_LOG(info) << "File "sv << config::nvhttp.file_state << " doesn't exist"sv;
       http::unique_id = uuid_util::uuid_t::generate().string();
+      state_tree = pt::ptree {};
       return;
     }
 
@@ -213,8 +318,10 @@ namespace nvhttp {
     } catch (std::exception &e) {
       BOOST_LOG(error) << "Couldn't read "sv << config::nvhttp.file_state << ": "sv << e.what();
 
+      state_tree.reset();
       return;
     }
+    state_tree = tree;
 
     auto unique_id_p = tree.get_optional<std::string>("root.uniqueid");
     if (!unique_id_p) {
@@ -251,17 +358,22 @@ namespace nvhttp {
         named_cert.name = el.get_child("name").get_value<std::string>();
         named_cert.cert = el.get_child("cert").get_value<std::string>();
         named_cert.uuid = el.get_child("uuid").get_value<std::string>();
+        if (auto profile_node = el.get_child_optional("profile")) {
+          stream_profile_t profile;
+          profile.bitrate_kbps = profile_node->get("bitrate_kbps"s, 0);
+          profile.fec_percentage = profile_node->get("fec_percentage"s, -1);
+          profile.packet_size = profile_node->get("packet_size"s, 0);
+          profile.path_mtu = profile_node->get("path_mtu"s, 0);
+          named_cert.profile = profile;
+        }
         client.named_devices.emplace_back(named_cert);
       }
     }
 
-    // Empty certificate chain and import certs from file
-    cert_chain.clear();
-    for (auto &named_cert : client.named_devices) {
-      cert_chain.add(crypto::x509(named_cert.cert));
-    }
-
     client_root = client;
+
+    // Empty certificate chain and import certs from file
+    load_cert_chain();
   }
 
   void add_authorized_client(const std::string &name, std::string &&cert) {
@@ -277,6 +389,44 @@ namespace nvhttp {
     }
   }
 
+  /**
+   * @brief Remember which paired client a verified connection came from.
+   * Moonlight sends the same uniqueid from every client, only the certificate tells them apart.
+   */
+  void add_verified_client(const boost::asio::ip::address &address, X509 *x509) {
+    constexpr std::size_t max_entries = 32;
+
+    for (auto &named_cert : client_root.named_devices) {
+      if (X509_cmp(crypto::x509(named_cert.cert).get(), x509)) {
+        continue;
+      }
+
+      auto address_str = net::addr_to_normalized_string(address);
+      std::erase_if(verified_clients, [&](const auto &entry) {
+        return entry.first == address_str;
+      });
+      verified_clients.emplace_back(std::move(address_str), named_cert.uuid);
+      if (verified_clients.size() > max_entries) {
+        verified_clients.pop_front();
+      }
+
+      return;
+    }
+  }
+
+  std::string verified_client(const boost::asio::ip::address &address) {
+    std::lock_guard lg {clients_lock};
+
+    auto address_str = net::addr_to_normalized_string(address);
+    for (auto &[client_address, uuid] : verified_clients) {
+      if (client_address == address_str) {
+        return uuid;
+      }
+    }
+
+    return {};
+  }
+
   std::shared_ptr<rtsp_stream::launch_session_t> make_launch_session(bool host_audio, const args_t &args) {
     auto launch_session = std::make_shared<rtsp_stream::launch_session_t>();
 
@@ -548,6 +698,8 @@ namespace nvhttp {
   void pair(std::shared_ptr<safe::queue_t<crypto::x509_t>> &add_cert, std::shared_ptr<typename SimpleWeb::ServerBase<T>::Response> response, std::shared_ptr<typename SimpleWeb::ServerBase<T>::Request> request) {
     print_req<T>(request);
 
+    std::lock_guard lg {clients_lock};
+
     pt::ptree tree;
 
     auto fg = util::fail_guard([&]() {
@@ -627,6 +779,8 @@ namespace nvhttp {
   }
 
   bool pin(std::string pin, std::string name) {
+    std::lock_guard lg {clients_lock};
+
     pt::ptree tree;
     if (map_id_sess.empty()) {
       return false;
@@ -689,6 +843,52 @@ namespace nvhttp {
     }
 
     auto local_endpoint = request->local_endpoint();
+    auto local_address = net::addr_to_normalized_string(local_endpoint.address());
+
+    // The codecs advertised below come from the probe, which waited for the first client
+    if (config::video.lazy_encoder_probe && rtsp_stream::session_count() == 0 && video::probe_encoders_lazily()) {
+      BOOST_LOG(error) << "Video failed to find working encoder"sv;
+    }
+
+    uint32_t codec_mode_flags = SCM_H264;
+    if (video::last_encoder_probe_supported_yuv444_for_codec[0]) {
+      codec_mode_flags |= SCM_H264_HIGH8_444;
+    }
+    if (video::active_hevc_mode >= 2) {
+      codec_mode_flags |= SCM_HEVC;
+      if (video::last_encoder_probe_supported_yuv444_for_codec[1]) {
+        codec_mode_flags |= SCM_HEVC_REXT8_444;
+      }
+    }
+    if (video::active_hevc_mode >= 3) {
+      codec_mode_flags |= SCM_HEVC_MAIN10;
+      if (video::last_encoder_probe_supported_yuv444_for_codec[1]) {
+        codec_mode_flags |= SCM_HEVC_REXT10_444;
+      }
+    }
+    if (video::active_av1_mode >= 2) {
+      codec_mode_flags |= SCM_AV1_MAIN8;
+      if (video::last_encoder_probe_supported_yuv444_for_codec[2]) {
+        codec_mode_flags |= SCM_AV1_HIGH8_444;
+      }
+    }
+    if (video::active_av1_mode >= 3) {
+      codec_mode_flags |= SCM_AV1_MAIN10;
+      if (video::last_encoder_probe_supported_yuv444_for_codec[2]) {
+        codec_mode_flags |= SCM_AV1_HIGH10_444;
+      }
+    }
+
+    auto current_appid = proc::proc.running();
+
+    // Everything the response is built from, the MAC address follows from the local address
+    auto key = std::format("{}/{}/{}/{}/{}/{}", std::is_same_v<SunshineHTTPS, T>, pair_status, local_address, current_appid, codec_mode_flags, video::active_hevc_mode);
+    response->close_connection_after_response = true;
+
+    if (auto body = serverinfo_cache.find(key)) {
+      response->write(*body);
+      return;
+    }
 
     pt::ptree tree;
 
@@ -705,7 +905,7 @@ namespace nvhttp {
     // Only include the MAC address for requests sent from paired clients over HTTPS.
     // For HTTP requests, use a placeholder MAC address that Moonlight knows to ignore.
     if constexpr (std::is_same_v<SunshineHTTPS, T>) {
-      tree.put("root.mac", platf::get_mac_address(net::addr_to_normalized_string(local_endpoint.address())));
+      tree.put("root.mac", platf::get_mac_address(local_address));
     } else {
       tree.put("root.mac", "00:00:00:00:00:00");
     }
@@ -722,40 +922,11 @@ namespace nvhttp {
     if (local_endpoint.address().is_v6() && !local_endpoint.address().to_v6().is_v4_mapped()) {
       tree.put("root.LocalIP", "127.0.0.1");
     } else {
-      tree.put("root.LocalIP", net::addr_to_normalized_string(local_endpoint.address()));
+      tree.put("root.LocalIP", local_address);
     }
 
-    uint32_t codec_mode_flags = SCM_H264;
-    if (video::last_encoder_probe_supported_yuv444_for_codec[0]) {
-      codec_mode_flags |= SCM_H264_HIGH8_444;
-    }
-    if (video::active_hevc_mode >= 2) {
-      codec_mode_flags |= SCM_HEVC;
-      if (video::last_encoder_probe_supported_yuv444_for_codec[1]) {
-        codec_mode_flags |= SCM_HEVC_REXT8_444;
-      }
-    }
-    if (video::active_hevc_mode >= 3) {
-      codec_mode_flags |= SCM_HEVC_MAIN10;
-      if (video::last_encoder_probe_supported_yuv444_for_codec[1]) {
-        codec_mode_flags |= SCM_HEVC_REXT10_444;
-      }
-    }
-    if (video::active_av1_mode >= 2) {
-      codec_mode_flags |= SCM_AV1_MAIN8;
-      if (video::last_encoder_probe_supported_yuv444_for_codec[2]) {
-        codec_mode_flags |= SCM_AV1_HIGH8_444;
-      }
-    }
-    if (video::active_av1_mode >= 3) {
-      codec_mode_flags |= SCM_AV1_MAIN10;
-      if (video::last_encoder_probe_supported_yuv444_for_codec[2]) {
-        codec_mode_flags |= SCM_AV1_HIGH10_444;
-      }
-    }
     tree.put("root.ServerCodecModeSupport", codec_mode_flags);
 
-    auto current_appid = proc::proc.running();
     tree.put("root.PairStatus", pair_status);
     tree.put("root.currentgame", current_appid);
     tree.put("root.state", current_appid > 0 ? "SUNSHINE_SERVER_BUSY" : "SUNSHINE_SERVER_FREE");
@@ -763,11 +934,12 @@ namespace nvhttp {
     std::ostringstream data;
 
     pt::write_xml(data, tree);
-    response->write(data.str());
-    response->close_connection_after_response = true;
+    response->write(serverinfo_cache.insert(std::move(key), data.str()));
   }
 
   nlohmann::json get_all_clients() {
+    std::lock_guard lg {clients_lock};
+
     nlohmann::json named_cert_nodes = nlohmann::json::array();
     client_t &client = client_root;
     for (auto &named_cert : client.named_devices) {
@@ -783,15 +955,15 @@ namespace nvhttp {
   void applist(resp_https_t response, req_https_t request) {
     print_req<SunshineHTTPS>(request);
 
-    pt::ptree tree;
+    auto key = std::format("{}/{}", proc::apps_generation.load(), video::active_hevc_mode);
+    response->close_connection_after_response = true;
 
-    auto g = util::fail_guard([&]() {
-      std::ostringstream data;
+    if (auto body = applist_cache.find(key)) {
+      response->write(*body);
+      return;
+    }
 
-      pt::write_xml(data, tree);
-      response->write(data.str());
-      response->close_connection_after_response = true;
-    });
+    pt::ptree tree;
 
     auto &apps = tree.add_child("root", pt::ptree {});
 
@@ -806,6 +978,11 @@ namespace nvhttp {
 
       apps.push_back(std::make_pair("App", std::move(app)));
     }
+
+    std::ostringstream data;
+
+    pt::write_xml(data, tree);
+    response->write(applist_cache.insert(std::move(key), data.str()));
   }
 
   void launch(bool &host_audio, resp_https_t response, req_https_t request) {
@@ -852,15 +1029,16 @@ namespace nvhttp {
 
     host_audio = util::from_view(get_arg(args, "localAudioPlayMode"));
     auto launch_session = make_launch_session(host_audio, args);
+    launch_session->client_uuid = verified_client(request->remote_endpoint().address());
 
     if (rtsp_stream::session_count() == 0) {
       // The display should be restored in case something fails as there are no other sessions.
       revert_display_configuration = true;
 
       // We want to prepare display only if there are no active sessions at
-      // the moment. This should be done before probing encoders as it could
-      // change the active displays.
-      display_device::configure_display(config::video, *launch_session);
+      // the moment. Probing the encoders waits for it as it could change the
+      // active displays, the rest of the launch carries on meanwhile.
+      display_device::configure_display_async(config::video, *launch_session);
 
       // Probe encoders again before streaming to ensure our chosen
       // encoder matches the active GPU (which could have changed
@@ -887,7 +1065,9 @@ namespace nvhttp {
     }
 
     if (appid > 0) {
-      auto err = proc::proc.execute(appid, launch_session);
+      // Prep commands can take long, the client gets its response while they run.
+      // Only the first video frame waits for the app.
+      auto err = proc::execute_async(appid, launch_session);
       if (err) {
         tree.put("root.<xmlattr>.status_code", err);
         tree.put("root.<xmlattr>.status_message", "Failed to start the specified application");
@@ -956,12 +1136,13 @@ namespace nvhttp {
       host_audio = util::from_view(get_arg(args, "localAudioPlayMode"));
     }
     const auto launch_session = make_launch_session(host_audio, args);
+    launch_session->client_uuid = verified_client(request->remote_endpoint().address());
 
     if (no_active_sessions) {
       // We want to prepare display only if there are no active sessions at
-      // the moment. This should be done before probing encoders as it could
-      // change the active displays.
-      display_device::configure_display(config::video, *launch_session);
+      // the moment. Probing the encoders waits for it as it could change the
+      // active displays, the rest of the launch carries on meanwhile.
+      display_device::configure_display_async(config::video, *launch_session);
 
       // Probe encoders again before streaming to ensure our chosen
       // encoder matches the active GPU (which could have changed
@@ -1019,6 +1200,7 @@ namespace nvhttp {
 
     rtsp_stream::terminate_sessions();
 
+    proc::wait_for_launch();
     if (proc::proc.running() > 0) {
       proc::proc.terminate();
     }
@@ -1027,17 +1209,85 @@ namespace nvhttp {
     display_device::revert_configuration();
   }
 
+  /**
+   * @brief An app image held in memory.
+   */
+  struct app_image_t {
+    std::string data;
+    std::string etag;
+    fs::file_time_type last_write_time;
+  };
+
+  // App images by path, an entry is read again once its file changes
+  std::mutex app_images_lock;
+  std::unordered_map<std::string, std::shared_ptr<const app_image_t>> app_images;
+
+  /**
+   * @brief Make a cache entry for the contents of an app image.
+   * @param path The path of the image, its last write time is kept to notice changes.
+   * @param data The contents of the image.
+   * @return The entry.
+   */
+  std::shared_ptr<const app_image_t> make_app_image(const std::string &path, std::string data) {
+    std::error_code ec;
+    auto image = std::make_shared<app_image_t>();
+    image->etag = std::format("\"{:016x}\"", std::hash<std::string> {}(data));
+    image->data = std::move(data);
+    image->last_write_time = fs::last_write_time(path, ec);
+
+    return image;
+  }
+
+  void cache_app_image(const std::string &path, std::string data) {
+    auto image = make_app_image(path, std::move(data));
+
+    std::lock_guard lg {app_images_lock};
+    app_images.insert_or_assign(path, std::move(image));
+  }
+
+  /**
+   * @brief Get an app image from the cache, reading it from disk if it isn't cached or its file changed.
+   * @param path The path of the image.
+   * @return The image.
+   */
+  std::shared_ptr<const app_image_t> get_app_image(const std::string &path) {
+    std::error_code ec;
+    auto last_write_time = fs::last_write_time(path, ec);
+
+    {
+      std::lock_guard lg {app_images_lock};
+      if (auto it = app_images.find(path); it != app_images.end() && it->second->last_write_time == last_write_time) {
+        return it->second;
+      }
+    }
+
+    std::ifstream in(path, std::ios::binary);
+    auto image = make_app_image(path, std::string {std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>()});
+
+    std::lock_guard lg {app_images_lock};
+    app_images.insert_or_assign(path, image);
+    return image;
+  }
+
   void appasset(resp_https_t response, req_https_t request) {
     print_req<SunshineHTTPS>(request);
 
     auto args = request->parse_query_string();
-    auto app_image = proc::proc.get_app_image(util::from_view(get_arg(args, "appid")));
+    auto image = get_app_image(proc::proc.get_app_image(util::from_view(get_arg(args, "appid"))));
 
-    std::ifstream in(app_image, std::ios::binary);
+    // Moonlight fetches the box art of every app in turn, the connection stays open for the next one
     SimpleWeb::CaseInsensitiveMultimap headers;
+    headers.emplace("ETag", image->etag);
+    headers.emplace("Cache-Control", "no-cache");
+
+    auto if_none_match = request->header.find("If-None-Match");
+    if (if_none_match != request->header.end() && if_none_match->second == image->etag) {
+      response->write(SimpleWeb::StatusCode::redirection_not_modified, headers);
+      return;
+    }
+
     headers.emplace("Content-Type", "image/png");
-    response->write(SimpleWeb::StatusCode::success_ok, in, headers);
-    response->close_connection_after_response = true;
+    response->write(SimpleWeb::StatusCode::success_ok, image->data, headers);
   }
 
   void setup(const std::string &pkey, const std::string &cert) {
@@ -1058,6 +1308,12 @@ namespace nvhttp {
       load_state();
     }
 
+    if (http::wait_for_creds()) {
+      BOOST_LOG(fatal) << "Couldn't create the credentials of the nvhttp server"sv;
+      shutdown_event->raise(true);
+      return;
+    }
+
     auto pkey = file_handler::read_file(config::nvhttp.pkey.c_str());
     auto cert = file_handler::read_file(config::nvhttp.cert.c_str());
     setup(pkey, cert);
@@ -1072,7 +1328,7 @@ namespace nvhttp {
     http_server_t http_server;
 
     // Verify certificates after establishing connection
-    https_server.verify = [add_cert](SSL *ssl) {
+    https_server.verify = [add_cert](SSL *ssl, const boost::asio::ip::address &address) {
       crypto::x509_t x509 {
 #if OPENSSL_VERSION_MAJOR >= 3
         SSL_get1_peer_certificate(ssl)
@@ -1095,6 +1351,7 @@ namespace nvhttp {
         BOOST_LOG(debug) << subject_name << " -- "sv << (verified ? "verified"sv : "denied"sv);
       });
 
+      std::lock_guard lg {clients_lock};
       while (add_cert->peek()) {
         char subject_name[256];
 
@@ -1114,6 +1371,10 @@ namespace nvhttp {
 
       verified = 1;
 
+      if (config::stream.learn_client_profiles) {
+        add_verified_client(address, x509.get());
+      }
+
       return verified;
     };
 
@@ -1140,16 +1401,23 @@ namespace nvhttp {
     https_server.resource["^/applist$"]["GET"] = applist;
     https_server.resource["^/appasset$"]["GET"] = appasset;
     https_server.resource["^/launch$"]["GET"] = [&host_audio](auto resp, auto req) {
+      std::lock_guard lg {launch_lock};
       launch(host_audio, resp, req);
     };
     https_server.resource["^/resume$"]["GET"] = [&host_audio](auto resp, auto req) {
+      std::lock_guard lg {launch_lock};
       resume(host_audio, resp, req);
     };
-    https_server.resource["^/cancel$"]["GET"] = cancel;
+    https_server.resource["^/cancel$"]["GET"] = [](auto resp, auto req) {
+      std::lock_guard lg {launch_lock};
+      cancel(resp, req);
+    };
 
     https_server.config.reuse_address = true;
     https_server.config.address = net::af_to_any_address_string(address_family);
     https_server.config.port = port_https;
+    // A launch blocks its thread until the app started, the others keep answering polls
+    https_server.config.thread_pool_size = config::sunshine.http_threads;
 
     http_server.default_resource["GET"] = not_found<SimpleWeb::HTTP>;
     http_server.resource["^/serverinfo$"]["GET"] = serverinfo<SimpleWeb::HTTP>;
@@ -1160,6 +1428,7 @@ namespace nvhttp {
     http_server.config.reuse_address = true;
     http_server.config.address = net::af_to_any_address_string(address_family);
     http_server.config.port = port_http;
+    http_server.config.thread_pool_size = config::sunshine.http_threads;
 
     auto accept_and_run = [&](auto *http_server) {
       try {
@@ -1189,6 +1458,8 @@ namespace nvhttp {
   }
 
   void erase_all_clients() {
+    std::lock_guard lg {clients_lock};
+
     client_t client;
     client_root = client;
     cert_chain.clear();
@@ -1196,6 +1467,8 @@ namespace nvhttp {
   }
 
   bool unpair_client(const std::string_view uuid) {
+    std::lock_guard lg {clients_lock};
+
     bool removed = false;
     client_t &client = client_root;
     for (auto it = client.named_devices.begin(); it != client.named_devices.end();) {
@@ -1208,7 +1481,34 @@ namespace nvhttp {
     }
 
     save_state();
-    load_state();
+    load_cert_chain();
     return removed;
   }
+
+  std::optional<stream_profile_t> get_stream_profile(std::string_view uuid) {
+    std::lock_guard lg {clients_lock};
+
+    for (auto &named_cert : client_root.named_devices) {
+      if (named_cert.uuid == uuid) {
+        return named_cert.profile;
+      }
+    }
+
+    return std::nullopt;
+  }
+
+  void save_stream_profile(std::string_view uuid, const stream_profile_t &profile) {
+    std::lock_guard lg {clients_lock};
+
+    for (auto &named_cert : client_root.named_devices) {
+      if (named_cert.uuid == uuid) {
+        named_cert.profile = profile;
+
+        if (!config::sunshine.flags[config::flag::FRESH_STATE]) {
+          save_state();
+        }
+        return;
+      }
+    }
+  }
 }  // namespace nvhttp
@@ -6,7 +6,9 @@
 #pragma once
 
 // standard includes
+#include <optional>
 #include <string>
+#include <string_view>
 
 // lib includes
 #include <boost/property_tree/ptree.hpp>
@@ -59,6 +61,13 @@ namespace nvhttp {
    */
   void setup(const std::string &pkey, const std::string &cert);
 
+  /**
+   * @brief Put the contents of an app image into the cache appasset() serves box art from.
+   * @param path The path of the image on disk.
+   * @param data The contents of the image.
+   */
+  void cache_app_image(const std::string &path, std::string data);
+
   class SunshineHTTPS: public SimpleWeb::HTTPS {
   public:
     SunshineHTTPS(boost::asio::io_context &io_context, boost::asio::ssl::context &ctx):
@@ -200,4 +209,28 @@ namespace nvhttp {
    * @examples_end
    */
   void erase_all_clients();
+
+  /**
+   * @brief Stream settings that worked for a paired client, learned at the end of its last stream.
+   */
+  struct stream_profile_t {
+    int bitrate_kbps {};  ///< Bitrate adaptive bitrate settled on, 0 if unknown
+    int fec_percentage {-1};  ///< FEC percentage adaptive FEC settled on, -1 if unknown
+    int packet_size {};  ///< Packet size the client requested when the path MTU was probed
+    int path_mtu {};  ///< Probed path MTU, 0 if unknown
+  };
+
+  /**
+   * @brief Get the stream profile learned for a paired client.
+   * @param uuid The UUID of the client.
+   * @return The profile, or `std::nullopt` if nothing was learned yet.
+   */
+  std::optional<stream_profile_t> get_stream_profile(std::string_view uuid);
+
+  /**
+   * @brief Store the stream profile learned for a paired client, it is dropped when the client is unpaired.
+   * @param uuid The UUID of the client.
+   * @param profile The learned profile.
+   */
+  void save_stream_profile(std::string_view uuid, const stream_profile_t &profile);
 }  // namespace nvhttp
@@ -5,11 +5,15 @@
 #pragma once
 
 // standard includes
+#include <atomic>
 #include <bitset>
+#include <chrono>
 #include <filesystem>
 #include <functional>
 #include <mutex>
+#include <optional>
 #include <string>
+#include <vector>
 
 // lib includes
 #include <boost/core/noncopyable.hpp>
@@ -232,6 +236,7 @@ namespace platf {
     dxgi,  ///< DXGI
     cuda,  ///< CUDA
     videotoolbox,  ///< VideoToolbox
+    drm,  ///< DRM PRIME
     unknown  ///< Unknown
   };
 
@@ -243,6 +248,7 @@ namespace platf {
     ayuv,  ///< AYUV
     yuv444p16,  ///< Planar 10-bit (shifted to 16-bit) YUV 4:4:4
     y410,  ///< Y410
+    yuyv422,  ///< Packed YUV 4:2:2
     unknown  ///< Unknown
   };
 
@@ -259,6 +265,7 @@ namespace platf {
       _CONVERT(ayuv);
       _CONVERT(yuv444p16);
       _CONVERT(y410);
+      _CONVERT(yuyv422);
       _CONVERT(unknown);
     }
 #undef _CONVERT
@@ -362,6 +369,12 @@ namespace platf {
     virtual ~deinit_t() = default;
   };
 
+  // An area of a captured image, in pixels
+  struct rect_t {
+    int x, y;
+    int width, height;
+  };
+
   struct img_t: std::enable_shared_from_this<img_t> {
   public:
     img_t() = default;
@@ -379,6 +392,19 @@ namespace platf {
 
     std::optional<std::chrono::steady_clock::time_point> frame_timestamp;
 
+    /**
+     * @brief Pixel format of data, unset for the BGR0 images most capture backends produce.
+     * Planes of multi-planar formats follow each other contiguously, the pitch of the
+     * chroma planes is derived from row_pitch the same way V4L2 does for single-planar buffers.
+     */
+    std::optional<pix_fmt_e> pix_fmt;
+
+    /**
+     * @brief Areas that changed since the previous capture, for backends that are told by the compositor.
+     * Unset when the backend doesn't know, an empty list means nothing changed.
+     */
+    std::optional<std::vector<rect_t>> damage;
+
     virtual ~img_t() = default;
   };
 
@@ -431,6 +457,22 @@ namespace platf {
      */
     virtual void init_hwframes(AVHWFramesContext *frames) {};
 
+    /**
+     * @brief Whether later sessions on the same hardware device may reuse the hwframes context.
+     * @note Only meaningful for devices that hand out the same hardware device context to every session.
+     */
+    virtual bool reuse_hwframes() {
+      return false;
+    }
+
+    /**
+     * @brief Whether the device converts images into software frames by itself.
+     * @note Such devices are kept for encoders that take system memory, instead of the CPU conversion.
+     */
+    virtual bool converts_to_system_memory() {
+      return false;
+    }
+
     /**
      * @brief Provides a hook for allow platform-specific code to adjust codec options.
      * @note Implementations may set or modify codec options prior to codec initialization.
@@ -450,6 +492,7 @@ namespace platf {
     virtual bool init_encoder(const video::config_t &client_config, const video::sunshine_colorspace_t &colorspace) = 0;
 
     nvenc::nvenc_base *nvenc = nullptr;
+    bool split_encode = true;  ///< Cleared when the probe found split frame encoding broken for the codec
   };
 
   enum class capture_e : int {
@@ -530,6 +573,57 @@ namespace platf {
       return true;
     }
 
+    /**
+     * @brief Check if the display is a live source such as a camera, rather than a desktop.
+     * Live sources change every frame, so the encoder is tuned for latency over compression.
+     * @return `true` if the display is a live source, `false` otherwise.
+     */
+    virtual bool is_live_source() {
+      return false;
+    }
+
+    /**
+     * @brief Get the rate a live source delivers new frames at.
+     * Encoding faster than the source only repeats its frames, so this caps the minimum framerate of the encoder.
+     * @return Frames per second, or 0 if the source keeps up with the framerate of the stream.
+     */
+    virtual double source_framerate() {
+      return 0.0;
+    }
+
+    /**
+     * @brief Switch to another source without disturbing the encoders.
+     * This only works if the new source delivers images of the same size and format,
+     * so the encode sessions built for this display can carry on with them.
+     * @param display_name The source to switch to.
+     * @param config The video config of the stream.
+     * @return `true` if the display captures from the new source now, `false` if it has to be reinitialized for it.
+     */
+    virtual bool hot_switch(const std::string &display_name, const ::video::config_t &config) {
+      return false;
+    }
+
+    /**
+     * @brief Shift when the following frames are captured, keeping the frame interval.
+     * Backends that pace capture on a timer apply the shift to the next frame they wait for,
+     * backends driven by the source, such as cameras, ignore it.
+     * @param shift How much later to capture, negative to capture earlier.
+     */
+    void shift_phase(std::chrono::nanoseconds shift) {
+      pending_phase_shift.fetch_add(shift.count(), std::memory_order_relaxed);
+    }
+
+    using frame_wanted_cb_t = std::function<bool()>;
+
+    /**
+     * @brief Tell the display whether anyone would take the next frame.
+     * The callback is only called from capture(), on the thread capturing.
+     * @param cb Returns `false` while no free image is left for the frame.
+     */
+    void set_frame_wanted_cb(frame_wanted_cb_t cb) {
+      frame_wanted_cb = std::move(cb);
+    }
+
     virtual ~display_t() = default;
 
     // Offsets for when streaming a specific monitor. By default, they are 0.
@@ -539,8 +633,57 @@ namespace platf {
     int width, height;
 
   protected:
+    /**
+     * @brief Take the shift requested through shift_phase() since the last call.
+     * @return The shift to add to the time the next frame is due.
+     */
+    std::chrono::nanoseconds take_phase_shift() {
+      return std::chrono::nanoseconds {pending_phase_shift.exchange(0, std::memory_order_relaxed)};
+    }
+
+    /**
+     * @brief Check whether the next frame would be taken before grabbing or converting it.
+     * When it isn't, backends skip the frame at the source and push nullptr with frame_captured set to `false`.
+     * @return `false` if the encoders still hold every image.
+     */
+    bool frame_wanted() {
+      return !frame_wanted_cb || frame_wanted_cb();
+    }
+
     // collect capture timing data (at loglevel debug)
     logging::time_delta_periodic_logger sleep_overshoot_logger = {debug, "Frame capture sleep overshoot"};
+
+  private:
+    std::atomic<std::int64_t> pending_phase_shift {0};
+    frame_wanted_cb_t frame_wanted_cb;
+  };
+
+  /**
+   * @brief A capture source whose device encodes the frames itself, such as a camera with H.264 output.
+   * Its frames are streamed as they are, without decoding and encoding them again.
+   */
+  class encoded_display_t {
+  public:
+    /**
+     * @brief Wait for the next frame the device encoded.
+     * @param frame_data Receives the frame in Annex B, its allocation is reused.
+     * @param idr Receives `true` if the frame is a key frame.
+     * @param frame_timestamp Receives the time the frame was captured, if the device knows it.
+     * @retval capture_e::ok When a frame was read
+     * @retval capture_e::timeout When the device delivered something that isn't a frame
+     * @retval capture_e::error On error
+     */
+    virtual capture_e next_frame(std::vector<std::uint8_t> &frame_data, bool &idr, std::optional<std::chrono::steady_clock::time_point> &frame_timestamp) = 0;
+
+    /**
+     * @brief Ask the device to encode the next frame as a key frame.
+     * @return `true` if the device took the request, otherwise the stream recovers at the next periodic key frame.
+     */
+    virtual bool request_idr_frame() = 0;
+
+    virtual ~encoded_display_t() = default;
+
+    int width, height;
   };
 
   class mic_t {
@@ -594,22 +737,113 @@ namespace platf {
   // A list of names of displays accepted as display_name with the mem_type_e
   std::vector<std::string> display_names(mem_type_e hwdevice_type);
 
+  /**
+   * @brief Check if a stream would be captured from a display that encodes it itself.
+   * Only the configuration and the cached capabilities of the display are looked at, nothing is opened.
+   * @param display_name The name of the display, as listed by display_names(mem_type_e::system).
+   * @param config Stream configuration.
+   * @return `true` if encoded_display() should be used instead of display().
+   */
+  bool has_encoded_display(const std::string &display_name, const video::config_t &config);
+
+  /**
+   * @brief Open a display that encodes the stream itself, at exactly the resolution of the stream.
+   * @param display_name The name of the display, as listed by display_names(mem_type_e::system).
+   * @param config Stream configuration.
+   * @return The display, or nullptr if it couldn't be opened.
+   */
+  std::unique_ptr<encoded_display_t> encoded_display(const std::string &display_name, const video::config_t &config);
+
   /**
    * @brief Check if GPUs/drivers have changed since the last call to this function.
    * @return `true` if a change has occurred or if it is unknown whether a change occurred.
    */
   bool needs_encoder_reenumeration();
 
+  /**
+   * @brief Describe the GPUs, drivers and OS build that encoder validation depends on.
+   * @return A string that changes whenever they do, or an empty string if changes can't be detected.
+   */
+  std::string encoder_environment_id();
+
   boost::process::v1::child run_command(bool elevated, bool interactive, const std::string &cmd, boost::filesystem::path &working_dir, const boost::process::v1::environment &env, FILE *file, std::error_code &ec, boost::process::v1::group *group);
 
   enum class thread_priority_e : int {
     low,  ///< Low priority
     normal,  ///< Normal priority
     high,  ///< High priority
-    critical  ///< Critical priority
+    critical,  ///< Critical priority
+    realtime  ///< Real-time scheduling, where the OS allows it
   };
   void adjust_thread_priority(thread_priority_e priority);
 
+  /**
+   * @brief Pin the calling thread to a CPU.
+   * @param cpu The index of the CPU, as the OS numbers them.
+   */
+  void pin_thread(int cpu);
+
+  /**
+   * @brief How hot the host runs and whether it slows itself down, sampled while streaming.
+   */
+  struct thermal_state_t {
+    std::optional<double> temperature;  ///< Hottest thermal zone in degrees Celsius, if the host reports any.
+    bool throttled = false;  ///< The host currently caps its clocks, because of the heat or an unstable supply.
+  };
+
+  /**
+   * @brief Sample the temperature and the throttling of the host.
+   * @return The thermal state, nothing is known where the host doesn't report it.
+   */
+  thermal_state_t thermal_state();
+
+  /**
+   * @brief Name the calling thread, the name shows in the tools of the OS and in the CPU time of the threads.
+   * @param name The name, Linux keeps the first 15 characters.
+   */
+  void set_thread_name(const std::string &name);
+
+  /**
+   * @brief CPU time a thread of the process spent.
+   */
+  struct thread_cpu_time_t {
+    std::string name;
+    std::chrono::nanoseconds cpu_time;  ///< User and system time
+  };
+
+  /**
+   * @brief Sample the CPU time of every thread of the process.
+   * @return The threads, empty where the OS doesn't report them.
+   */
+  std::vector<thread_cpu_time_t> thread_cpu_times();
+
+  /**
+   * @brief Get the memory of the process that is resident in RAM.
+   * @return The resident set size in bytes, if the OS reports it.
+   */
+  std::optional<std::uint64_t> resident_memory();
+
+  /**
+   * @brief Get the memory the OS could hand out without swapping.
+   * @return The available memory in bytes, if the OS reports it.
+   */
+  std::optional<std::uint64_t> available_memory();
+
+  /**
+   * @brief Keep memory in RAM, so touching it never waits for it to be swapped back in.
+   * @param addr Start of the memory.
+   * @param size Size of the memory.
+   * @return `true` if the memory is locked.
+   */
+  bool lock_memory(const void *addr, std::size_t size);
+
+  /**
+   * @brief Let memory locked with lock_memory() be swapped out again.
+   * @param addr Start of the memory.
+   * @param size Size of the memory.
+   */
+  void unlock_memory(const void *addr, std::size_t size);
+
   // Allow OS-specific actions to be taken to prepare for streaming
   void streaming_will_start();
   void streaming_will_stop();
@@ -647,6 +881,17 @@ namespace platf {
     }
   };
 
+  /**
+   * @brief Zero-copy sends on a socket the kernel may still read the buffers of.
+   */
+  struct zerocopy_state_t {
+    // Sends not reported complete yet
+    int pending {};
+
+    // The kernel reported copying the payload anyway, the device can't send from user memory
+    bool copied {};
+  };
+
   struct batched_send_info_t {
     // Optional headers to be prepended to each packet
     const char *headers;
@@ -670,6 +915,15 @@ namespace platf {
     uint16_t target_port;
     boost::asio::ip::address &source_address;
 
+    // Earliest time the kernel may put the batch on the wire.
+    // Only honored on sockets set up with enable_socket_txtime(), ignored otherwise.
+    std::optional<std::chrono::steady_clock::time_point> txtime {};
+
+    // Send large batches without copying them, counting the sends here.
+    // Only honored on sockets set up with enable_socket_zerocopy(), ignored otherwise.
+    // NB: The buffers must not change until wait_zerocopy() has seen the sends complete!
+    zerocopy_state_t *zerocopy {};
+
     /**
      * @brief Returns a payload buffer descriptor for the given payload offset.
      * @param offset The offset in the total payload data (bytes).
@@ -692,6 +946,13 @@ namespace platf {
 
   bool send_batch(batched_send_info_t &send_info);
 
+  /**
+   * @brief Get the largest batch worth handing to send_batch() on the calling thread.
+   * @param block_size Size of each header+payload message block.
+   * @return The number of message blocks.
+   */
+  size_t send_batch_max_blocks(size_t block_size);
+
   struct send_info_t {
     const char *header;
     size_t header_size;
@@ -706,6 +967,31 @@ namespace platf {
 
   bool send(send_info_t &send_info);
 
+  struct recv_batch_info_t {
+    std::uintptr_t native_socket;
+
+    // Room for max_datagrams datagrams of up to max_datagram_size bytes each
+    char *buffers;
+    size_t max_datagram_size;
+    size_t max_datagrams;
+
+    struct datagram_t {
+      size_t size;
+      boost::asio::ip::address address;
+      uint16_t port;
+    };
+
+    // The datagrams received by the last recv_batch() call, stored in order in buffers
+    std::vector<datagram_t> datagrams;
+  };
+
+  /**
+   * @brief Receive the datagrams already waiting on a socket with a single system call, without blocking.
+   * @param recv_info The socket and buffers to receive into.
+   * @return `false` if batched receive isn't supported on this platform.
+   */
+  bool recv_batch(recv_batch_info_t &recv_info);
+
   enum class qos_data_type_e : int {
     audio,  ///< Audio
     video  ///< Video
@@ -721,6 +1007,48 @@ namespace platf {
    */
   std::unique_ptr<deinit_t> enable_socket_qos(uintptr_t native_socket, boost::asio::ip::address &address, uint16_t port, qos_data_type_e data_type, bool dscp_tagging);
 
+  /**
+   * @brief Let the kernel schedule packets sent on the given socket at their batched_send_info_t::txtime.
+   * @param native_socket The native socket handle.
+   * @return `true` if the platform supports transmit times on this socket.
+   * @note Packets are only held back when the egress interface uses a pacing qdisc such as fq.
+   */
+  bool enable_socket_txtime(uintptr_t native_socket);
+
+  /**
+   * @brief Let send_batch() hand the kernel the buffers of a batch instead of a copy of them.
+   * @param native_socket The native socket handle.
+   * @return `true` if the platform supports zero-copy sends on this socket.
+   */
+  bool enable_socket_zerocopy(uintptr_t native_socket);
+
+  /**
+   * @brief Wait until the kernel is done with the buffers of the zero-copy sends on a socket.
+   * @param native_socket The native socket handle.
+   * @param state The sends to wait for, updated with the completions read.
+   * @param timeout How long to wait for the completions.
+   * @return `false` if the sends didn't complete in time.
+   */
+  bool wait_zerocopy(uintptr_t native_socket, zerocopy_state_t &state, std::chrono::milliseconds timeout);
+
+  /**
+   * @brief Get the number of bytes queued on a socket that the kernel hasn't sent yet.
+   * @param native_socket The native socket handle.
+   * @return The queued bytes, or -1 if the platform can't report them.
+   */
+  int socket_send_queue_bytes(uintptr_t native_socket);
+
+  /**
+   * @brief Find the largest IP packet that reaches an address without being fragmented.
+   * Probes with the don't fragment bit set go to the discard port of the address, so routers with a smaller MTU
+   * answer them while the client never sees them.
+   * @param address The destination address.
+   * @param max_size Largest IP packet to try, IP and UDP headers included.
+   * @return The path MTU, or -1 if the platform can't probe the path.
+   * @note Waits up to a few hundred milliseconds for routers to answer.
+   */
+  int probe_path_mtu(const boost::asio::ip::address &address, int max_size);
+
   /**
    * @brief Open a url in the default web browser.
    * @param url The url to open.
@@ -756,6 +1084,20 @@ namespace platf {
   void button_mouse(input_t &input, int button, bool release);
   void scroll(input_t &input, int distance);
   void hscroll(input_t &input, int distance);
+
+  /**
+   * @brief Inject the input events the platform held back to send them together.
+   * Called once the input queue has been drained.
+   * @param input The input_t instance to use.
+   */
+  void flush_input(input_t &input);
+
+  /**
+   * @brief Get how many gamepad reports were never sent to the OS, because they were unchanged or a newer state replaced them.
+   * @param input The input_t instance to use.
+   * @return The number of reports since the input context was created.
+   */
+  std::uint64_t gamepad_reports_coalesced(input_t &input);
   void keyboard_update(input_t &input, uint16_t modcode, bool release, uint8_t flags);
   void gamepad_update(input_t &input, int nr, const gamepad_state_t &gamepad_state);
   void unicode(input_t &input, char *utf8, int size);
@@ -785,6 +1127,13 @@ namespace platf {
    */
   void pen_update(client_input_t *input, const touch_port_t &touch_port, const pen_input_t &pen);
 
+  /**
+   * @brief Inject the touch and pen events of a client the platform held back to send them together.
+   * Called once the input queue has been drained, after flush_input().
+   * @param input The client-specific input context.
+   */
+  void flush_client_input(client_input_t *input);
+
   /**
    * @brief Send a gamepad touch event to the OS.
    * @param input The global input context.
@@ -855,6 +1204,17 @@ namespace platf {
      */
     virtual void sleep_for(const std::chrono::nanoseconds &duration) = 0;
 
+    /**
+     * @brief Sleep until a point in time, unlike repeated sleep_for() calls this doesn't accumulate drift.
+     * @param deadline Wake up time, the call returns right away if it has passed.
+     */
+    virtual void sleep_until(const std::chrono::steady_clock::time_point &deadline) {
+      auto now = std::chrono::steady_clock::now();
+      if (deadline > now) {
+        sleep_for(deadline - now);
+      }
+    }
+
     /**
      * @brief Check if platform-specific timer backend has been initialized successfully
      * @return `true` on success, `false` on error
@@ -862,10 +1222,15 @@ namespace platf {
     virtual operator bool() = 0;
   };
 
+  // How long ahead of their frame time the capture loops wake up to spin, which absorbs the wakeup latency
+  constexpr std::chrono::microseconds CAPTURE_TIMER_SPIN {50};
+
   /**
    * @brief Create platform-specific timer capable of high-precision sleep
+   * @param spin How long before the deadline the timer stops sleeping and spins instead.
+   * Only the Linux timer spins, the others sleep all the way.
    * @return A unique pointer to timer
    */
-  std::unique_ptr<high_precision_timer> create_high_precision_timer();
+  std::unique_ptr<high_precision_timer> create_high_precision_timer(std::chrono::nanoseconds spin = std::chrono::nanoseconds::zero());
 
 }  // namespace platf
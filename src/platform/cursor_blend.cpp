@@ -0,0 +1,159 @@
+/**
+ * @file src/platform/cursor_blend.cpp
+ * @brief Definitions for blending the cursor into captured images in system memory.
+ */
+// standard includes
+#include <algorithm>
+
+// platform includes
+#if defined(__SSE2__)
+  #include <immintrin.h>
+#elif defined(__ARM_NEON)
+  #include <arm_neon.h>
+#endif
+
+// local includes
+#include "cursor_blend.h"
+
+namespace platf {
+  namespace {
+    /**
+     * @brief `(x + 127) / 255` for x up to 255 * 255, without a division.
+     */
+    constexpr std::uint32_t div_255(std::uint32_t x) {
+      x += 127;
+      return (x + 1 + (x >> 8)) >> 8;
+    }
+
+    void blend_row_scalar(std::uint32_t *dst, const std::uint32_t *src, int width) {
+      for (int x = 0; x < width; ++x) {
+        auto cursor = src[x];
+        auto alpha = cursor >> 24;
+
+        if (alpha == 255) {
+          dst[x] = cursor;
+          continue;
+        }
+
+        std::uint32_t pixel = 0;
+        for (int shift = 0; shift < 32; shift += 8) {
+          auto color = ((cursor >> shift) & 0xFF) + div_255(((dst[x] >> shift) & 0xFF) * (255 - alpha));
+          pixel |= std::min<std::uint32_t>(color, 255) << shift;
+        }
+        dst[x] = pixel;
+      }
+    }
+
+#if defined(__SSE2__)
+    __m128i blend_half(__m128i cursor, __m128i image) {
+      // Alpha of each pixel in all four 16 bit lanes of that pixel
+      auto alpha = _mm_shufflehi_epi16(_mm_shufflelo_epi16(cursor, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+      auto x = _mm_add_epi16(_mm_mullo_epi16(image, _mm_sub_epi16(_mm_set1_epi16(255), alpha)), _mm_set1_epi16(127));
+
+      return _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(x, _mm_set1_epi16(1)), _mm_srli_epi16(x, 8)), 8);
+    }
+
+    int blend_row_simd(std::uint32_t *dst, const std::uint32_t *src, int width) {
+      auto zero = _mm_setzero_si128();
+
+      int x = 0;
+      for (; x + 4 <= width; x += 4) {
+        auto cursor = _mm_loadu_si128((const __m128i *) (src + x));
+        auto image = _mm_loadu_si128((const __m128i *) (dst + x));
+
+        auto lo = blend_half(_mm_unpacklo_epi8(cursor, zero), _mm_unpacklo_epi8(image, zero));
+        auto hi = blend_half(_mm_unpackhi_epi8(cursor, zero), _mm_unpackhi_epi8(image, zero));
+
+        _mm_storeu_si128((__m128i *) (dst + x), _mm_adds_epu8(cursor, _mm_packus_epi16(lo, hi)));
+      }
+
+      return x;
+    }
+
+    // Same as above on 8 pixels, unpacking and packing stay within each 128 bit lane
+    __attribute__((target("avx2"))) __m256i blend_half_avx2(__m256i cursor, __m256i image) {
+      auto alpha = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(cursor, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+      auto x = _mm256_add_epi16(_mm256_mullo_epi16(image, _mm256_sub_epi16(_mm256_set1_epi16(255), alpha)), _mm256_set1_epi16(127));
+
+      return _mm256_srli_epi16(_mm256_add_epi16(_mm256_add_epi16(x, _mm256_set1_epi16(1)), _mm256_srli_epi16(x, 8)), 8);
+    }
+
+    __attribute__((target("avx2"))) int blend_row_avx2(std::uint32_t *dst, const std::uint32_t *src, int width) {
+      auto zero = _mm256_setzero_si256();
+
+      int x = 0;
+      for (; x + 8 <= width; x += 8) {
+        auto cursor = _mm256_loadu_si256((const __m256i *) (src + x));
+        auto image = _mm256_loadu_si256((const __m256i *) (dst + x));
+
+        auto lo = blend_half_avx2(_mm256_unpacklo_epi8(cursor, zero), _mm256_unpacklo_epi8(image, zero));
+        auto hi = blend_half_avx2(_mm256_unpackhi_epi8(cursor, zero), _mm256_unpackhi_epi8(image, zero));
+
+        _mm256_storeu_si256((__m256i *) (dst + x), _mm256_adds_epu8(cursor, _mm256_packus_epi16(lo, hi)));
+      }
+
+      // Up to 7 pixels are left, SSE2 takes 4 of them
+      return x + blend_row_simd(dst + x, src + x, width - x);
+    }
+#elif defined(__ARM_NEON)
+    uint16x8_t blend_half(uint8x8_t image, uint8x8_t inverse_alpha) {
+      auto x = vaddq_u16(vmull_u8(image, inverse_alpha), vdupq_n_u16(127));
+
+      return vshrq_n_u16(vaddq_u16(vaddq_u16(x, vdupq_n_u16(1)), vshrq_n_u16(x, 8)), 8);
+    }
+
+    int blend_row_simd(std::uint32_t *dst, const std::uint32_t *src, int width) {
+      int x = 0;
+      for (; x + 4 <= width; x += 4) {
+        auto cursor = vld1q_u32(src + x);
+        auto image = vreinterpretq_u8_u32(vld1q_u32(dst + x));
+
+        // Alpha of each pixel in all four bytes of that pixel, without the AArch64 only table lookups
+        auto alpha = vshrq_n_u32(cursor, 24);
+        alpha = vorrq_u32(alpha, vshlq_n_u32(alpha, 8));
+        alpha = vorrq_u32(alpha, vshlq_n_u32(alpha, 16));
+        auto inverse_alpha = vmvnq_u8(vreinterpretq_u8_u32(alpha));
+
+        auto lo = vmovn_u16(blend_half(vget_low_u8(image), vget_low_u8(inverse_alpha)));
+        auto hi = vmovn_u16(blend_half(vget_high_u8(image), vget_high_u8(inverse_alpha)));
+
+        vst1q_u32(dst + x, vreinterpretq_u32_u8(vqaddq_u8(vreinterpretq_u8_u32(cursor), vcombine_u8(lo, hi))));
+      }
+
+      return x;
+    }
+#else
+    int blend_row_simd(std::uint32_t *, const std::uint32_t *, int) {
+      return 0;
+    }
+#endif
+
+    using blend_row_t = int (*)(std::uint32_t *dst, const std::uint32_t *src, int width);
+
+    blend_row_t select_blend_row() {
+#if defined(__SSE2__)
+      if (__builtin_cpu_supports("avx2")) {
+        return blend_row_avx2;
+      }
+#endif
+
+      return blend_row_simd;
+    }
+  }  // namespace
+
+  void blend_cursor(std::uint32_t *dst, std::ptrdiff_t dst_pitch, const std::uint32_t *src, std::ptrdiff_t src_pitch, int width, int height) {
+    static const auto blend_row = select_blend_row();
+
+    if (width <= 0) {
+      return;
+    }
+
+    for (int y = 0; y < height; ++y) {
+      auto done = blend_row(dst, src, width);
+      blend_row_scalar(dst + done, src + done, width - done);
+
+      dst += dst_pitch;
+      src += src_pitch;
+    }
+  }
+}  // namespace platf
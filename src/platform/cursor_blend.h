@@ -0,0 +1,24 @@
+/**
+ * @file src/platform/cursor_blend.h
+ * @brief Declarations for blending the cursor into captured images in system memory.
+ */
+#pragma once
+
+// standard includes
+#include <cstddef>
+#include <cstdint>
+
+namespace platf {
+  /**
+   * @brief Blend a premultiplied BGRA cursor over a BGRA image.
+   * Only the cursor rectangle is touched, 8 pixels at a time with AVX2 or 4 with SSE2 or NEON where available.
+   * AVX2 is picked at runtime, so builds for older x86 CPUs still use it where it's supported.
+   * @param dst First pixel of the image under the cursor.
+   * @param dst_pitch Pixels per row of the image.
+   * @param src First visible pixel of the cursor.
+   * @param src_pitch Pixels per row of the cursor.
+   * @param width Width of the visible part of the cursor.
+   * @param height Height of the visible part of the cursor.
+   */
+  void blend_cursor(std::uint32_t *dst, std::ptrdiff_t dst_pitch, const std::uint32_t *src, std::ptrdiff_t src_pitch, int width, int height);
+}  // namespace platf
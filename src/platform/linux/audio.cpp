@@ -19,6 +19,10 @@
 #include "src/platform/common.h"
 #include "src/thread_safe.h"
 
+#ifdef SUNSHINE_BUILD_PIPEWIRE
+  #include "pipewire.h"
+#endif
+
 namespace platf {
   using namespace std::literals;
 
@@ -409,6 +413,31 @@ namespace platf {
         return sink_name;
       }
 
+      /**
+       * @brief Check if the PulseAudio server is PipeWire's compatibility layer.
+       * @return `true` if PipeWire serves the PulseAudio clients.
+       */
+      bool is_pipewire_server() {
+        bool pipewire = false;
+        auto alarm = safe::make_alarm<int>();
+
+        cb_simple_t<pa_server_info *> server_f = [&](ctx_t::pointer ctx, const pa_server_info *server_info) {
+          if (!server_info) {
+            BOOST_LOG(error) << "Couldn't get pulseaudio server info: "sv << pa_strerror(pa_context_errno(ctx));
+            alarm->ring(-1);
+            return;
+          }
+
+          // e.g. "PulseAudio (on PipeWire 1.0.5)"
+          pipewire = server_info->server_name && std::string_view {server_info->server_name}.find("PipeWire"sv) != std::string_view::npos;
+          alarm->ring(0);
+        };
+
+        op_t server_op {pa_context_get_server_info(ctx.get(), cb<pa_server_info *>, &server_f)};
+        alarm->wait();
+        return pipewire;
+      }
+
       std::string get_monitor_name(const std::string &sink_name) {
         std::string monitor_name;
         auto alarm = safe::make_alarm<int>();
@@ -456,6 +485,17 @@ namespace platf {
           sink_name = get_default_sink_name();
         }
 
+#ifdef SUNSHINE_BUILD_PIPEWIRE
+        // Capturing natively skips the extra buffering of PipeWire's PulseAudio compatibility layer
+        if (is_pipewire_server()) {
+          if (auto mic = pipewire::microphone(mapping, channels, sample_rate, frame_size, sink_name, continuous_audio)) {
+            return mic;
+          }
+
+          BOOST_LOG(warning) << "Falling back to audio capture through PulseAudio"sv;
+        }
+#endif
+
         return ::platf::microphone(mapping, channels, sample_rate, frame_size, get_monitor_name(sink_name));
       }
 
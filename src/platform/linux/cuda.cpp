@@ -288,25 +288,19 @@ namespace cuda {
       data = (void *) 0x1;
 
       // TODO: Support more than one CUDA device
-      file = std::move(open_drm_fd_for_cuda_device(0));
+      auto file = open_drm_fd_for_cuda_device(0);
       if (file.el < 0) {
         char string[1024];
         BOOST_LOG(error) << "Couldn't open DRM FD for CUDA device: "sv << strerror_r(errno, string, sizeof(string));
         return -1;
       }
 
-      gbm.reset(gbm::create_device(file.el));
-      if (!gbm) {
-        BOOST_LOG(error) << "Couldn't create GBM device: ["sv << util::hex(eglGetError()).to_string_view() << ']';
+      shared_display = egl::shared_display(file.el);
+      if (!shared_display) {
         return -1;
       }
 
-      display = egl::make_display(gbm.get());
-      if (!display) {
-        return -1;
-      }
-
-      auto ctx_opt = egl::make_ctx(display.get());
+      auto ctx_opt = egl::make_ctx(shared_display->display.get());
       if (!ctx_opt) {
         return -1;
       }
@@ -382,23 +376,19 @@ namespace cuda {
 
       if (descriptor.sequence == 0) {
         // For dummy images, use a blank RGB texture instead of importing a DMA-BUF
-        rgb = egl::create_blank(img);
+        blank = egl::create_blank(img);
+        rgb = &blank;
       } else if (descriptor.sequence > sequence) {
         sequence = descriptor.sequence;
 
-        rgb = egl::rgb_t {};
-
-        auto rgb_opt = egl::import_source(display.get(), descriptor.sd);
-
-        if (!rgb_opt) {
+        rgb = sources.import_source(shared_display->display.get(), descriptor.sd);
+        if (!rgb) {
           return -1;
         }
-
-        rgb = std::move(*rgb_opt);
       }
 
       // Perform the color conversion and scaling in GL
-      sws.load_vram(descriptor, offset_x, offset_y, rgb->tex[0]);
+      sws.load_vram(descriptor, offset_x, offset_y, (*rgb)->tex[0], shared_display->display.get());
       sws.convert(nv12->buf);
 
       auto fmt_desc = av_pix_fmt_desc_get(sw_format);
@@ -434,9 +424,7 @@ namespace cuda {
       sws.apply_colorspace(colorspace);
     }
 
-    file_t file;
-    gbm::gbm_t gbm;
-    egl::display_t display;
+    std::shared_ptr<egl::shared_display_t> shared_display;
     egl::ctx_t ctx;
 
     // This must be destroyed before display_t
@@ -450,7 +438,9 @@ namespace cuda {
     int width, height;
 
     std::uint64_t sequence;
-    egl::rgb_t rgb;
+    egl::import_cache_t sources;
+    egl::rgb_t blank;
+    egl::rgb_t *rgb = nullptr;
 
     registered_resource_t y_res;
     registered_resource_t uv_res;
@@ -780,22 +770,33 @@ namespace cuda {
         });
 
         sleep_overshoot_logger.reset();
+        grab_logger.reset();
+        grab_stats = {};
 
         while (true) {
           auto now = std::chrono::steady_clock::now();
           if (next_frame > now) {
-            std::this_thread::sleep_for(next_frame - now);
+            timer->sleep_until(next_frame);
             sleep_overshoot_logger.first_point(next_frame);
             sleep_overshoot_logger.second_point_now_and_log();
           }
 
-          next_frame += delay;
+          next_frame += delay + take_phase_shift();
           if (next_frame < now) {  // some major slowdown happened; we couldn't keep up
             next_frame = now + delay;
           }
 
+          if (!frame_wanted()) {
+            if (!push_captured_image_cb(nullptr, false)) {
+              return platf::capture_e::ok;
+            }
+            continue;
+          }
+
+          // Waits until the desktop changes, the timeout only keeps the loop responsive
           std::shared_ptr<platf::img_t> img_out;
           auto status = snapshot(pull_free_image_cb, img_out, 150ms, *cursor);
+          log_grab_stats(status == platf::capture_e::ok);
           switch (status) {
             case platf::capture_e::reinit:
             case platf::capture_e::error:
@@ -900,9 +901,10 @@ namespace cuda {
         CUdeviceptr device_ptr;
         NVFBC_FRAME_GRAB_INFO info;
 
+        // Returns at once if a frame we haven't seen is ready, otherwise waits for the next one
         NVFBC_TOCUDA_GRAB_FRAME_PARAMS grab {
           NVFBC_TOCUDA_GRAB_FRAME_PARAMS_VER,
-          NVFBC_TOCUDA_GRAB_FLAGS_NOWAIT,
+          NVFBC_TOCUDA_GRAB_FLAGS_NOWAIT_IF_NEW_FRAME_READY,
           &device_ptr,
           &info,
           (std::uint32_t) timeout.count(),
@@ -917,6 +919,17 @@ namespace cuda {
           return platf::capture_e::error;
         }
 
+        // The wait timed out on the frame we already sent
+        if (!info.bIsNewFrame) {
+          return platf::capture_e::timeout;
+        }
+
+        auto frame_timestamp = std::chrono::steady_clock::now();
+        grab_logger.first_point(frame_timestamp);
+        grab_stats.missed += info.dwMissedFrames;
+
+        // The pool never hands out an image an encoder is still converting,
+        // so this copy can't race the conversion of the previous frame
         if (!pull_free_image_cb(img_out)) {
           return platf::capture_e::interrupted;
         }
@@ -925,6 +938,8 @@ namespace cuda {
         if (img->tex.copy((std::uint8_t *) device_ptr, img->height, img->row_pitch)) {
           return platf::capture_e::error;
         }
+        img->frame_timestamp = frame_timestamp;
+        grab_logger.second_point_now_and_log();
 
         return platf::capture_e::ok;
       }
@@ -956,7 +971,36 @@ namespace cuda {
         return 0;
       }
 
+      /**
+       * @brief Count a wakeup of the capture loop and periodically log how many of them brought a new frame.
+       * @param new_frame Whether the desktop changed since the last frame.
+       */
+      void log_grab_stats(bool new_frame) {
+        ++grab_stats.wakeups;
+        grab_stats.new_frames += new_frame;
+
+        auto now = std::chrono::steady_clock::now();
+        if (now - grab_stats.logged < 20s) {
+          return;
+        }
+
+        BOOST_LOG(debug) << "NvFBC capture: "sv << grab_stats.new_frames << '/' << grab_stats.wakeups << " wakeups brought a new frame, "sv
+                         << grab_stats.missed << " frames missed"sv;
+        grab_stats = {};
+        grab_stats.logged = now;
+      }
+
       std::chrono::nanoseconds delay;
+      std::unique_ptr<platf::high_precision_timer> timer = platf::create_high_precision_timer(platf::CAPTURE_TIMER_SPIN);
+
+      logging::time_delta_periodic_logger grab_logger {debug, "NvFBC frame copy"};
+
+      struct {
+        std::uint64_t wakeups;
+        std::uint64_t new_frames;
+        std::uint64_t missed;
+        std::chrono::steady_clock::time_point logged = std::chrono::steady_clock::now();
+      } grab_stats;
 
       bool cursor_visible;
       handle_t handle;
@@ -3,6 +3,7 @@
  * @brief CUDA implementation for Linux.
  */
 // standard includes
+#include <algorithm>
 #include <chrono>
 #include <limits>
 #include <memory>
@@ -116,6 +117,10 @@ namespace cuda {
     CU_CHECK_IGNORE(cudaStreamDestroy(ptr), "Couldn't free cuda stream");
   }
 
+  void freeCudaGraphExec_t::operator()(cudaGraphExec_t ptr) {
+    CU_CHECK_IGNORE(cudaGraphExecDestroy(ptr), "Couldn't free cuda graph");
+  }
+
   stream_t make_stream(int flags) {
     cudaStream_t stream;
 
@@ -314,7 +319,39 @@ namespace cuda {
   }
 
   int sws_t::convert(std::uint8_t *Y, std::uint8_t *UV, std::uint32_t pitchY, std::uint32_t pitchUV, cudaTextureObject_t texture, stream_t::pointer stream) {
-    return convert(Y, UV, pitchY, pitchUV, texture, stream, viewport);
+    auto it = std::find_if(std::begin(graphs), std::end(graphs), [&](const graph_t &graph) {
+      return graph.Y == Y && graph.UV == UV && graph.pitchY == pitchY && graph.pitchUV == pitchUV && graph.texture == texture;
+    });
+
+    if (it != std::end(graphs)) {
+      std::rotate(it, it + 1, std::end(graphs));
+    } else {
+      // Record the launch instead of running it
+      CU_CHECK(cudaStreamBeginCapture(stream, cudaStreamCaptureModeThreadLocal), "Couldn't start capturing the conversion");
+
+      auto status = convert(Y, UV, pitchY, pitchUV, texture, stream, viewport);
+
+      cudaGraph_t graph;
+      CU_CHECK(cudaStreamEndCapture(stream, &graph), "Couldn't capture the conversion");
+      if (status) {
+        CU_CHECK_IGNORE(cudaGraphDestroy(graph), "Couldn't free cuda graph");
+        return -1;
+      }
+
+      cudaGraphExec_t exec;
+      auto result = cudaGraphInstantiate(&exec, graph, 0);
+      CU_CHECK_IGNORE(cudaGraphDestroy(graph), "Couldn't free cuda graph");
+      CU_CHECK(result, "Couldn't instantiate the conversion graph");
+
+      if (graphs.size() == MAX_GRAPHS) {
+        graphs.erase(std::begin(graphs));
+      }
+      graphs.emplace_back(graph_t {Y, UV, pitchY, pitchUV, texture, graph_exec_t {exec}});
+    }
+
+    CU_CHECK(cudaGraphLaunch(graphs.back().exec.get(), stream), "Couldn't launch the conversion graph");
+
+    return 0;
   }
 
   int sws_t::convert(std::uint8_t *Y, std::uint8_t *UV, std::uint32_t pitchY, std::uint32_t pitchUV, cudaTextureObject_t texture, stream_t::pointer stream, const viewport_t &viewport) {
@@ -45,6 +45,7 @@ typedef struct cudaArray *cudaArray_t;
 
   #if !defined(__CUDACC__)
 typedef struct CUstream_st *cudaStream_t;
+typedef struct CUgraphExec_st *cudaGraphExec_t;
 typedef unsigned long long cudaTextureObject_t;
   #else /* defined(__CUDACC__) */
 typedef __location__(device_builtin) struct CUstream_st *cudaStream_t;
@@ -63,8 +64,14 @@ namespace cuda {
     void operator()(cudaStream_t ptr);
   };
 
+  class freeCudaGraphExec_t {
+  public:
+    void operator()(cudaGraphExec_t ptr);
+  };
+
   using ptr_t = std::unique_ptr<void, freeCudaPtr_t>;
   using stream_t = std::unique_ptr<CUstream_st, freeCudaStream_t>;
+  using graph_exec_t = std::unique_ptr<CUgraphExec_st, freeCudaGraphExec_t>;
 
   stream_t make_stream(int flags = 0);
 
@@ -107,8 +114,15 @@ namespace cuda {
      */
     static std::optional<sws_t> make(int in_width, int in_height, int out_width, int out_height, int pitch);
 
-    // Converts loaded image into a CUDevicePtr
+    /**
+     * Converts loaded image into a CUDevicePtr
+     *
+     * The conversion of every pair of image and frame is captured into a CUDA graph once,
+     * after that each frame costs a single graph launch.
+     */
     int convert(std::uint8_t *Y, std::uint8_t *UV, std::uint32_t pitchY, std::uint32_t pitchUV, cudaTextureObject_t texture, stream_t::pointer stream);
+
+    // Converts with a plain kernel launch, for one-off conversions into a different viewport
     int convert(std::uint8_t *Y, std::uint8_t *UV, std::uint32_t pitchY, std::uint32_t pitchUV, cudaTextureObject_t texture, stream_t::pointer stream, const viewport_t &viewport);
 
     void apply_colorspace(const video::sunshine_colorspace_t &colorspace);
@@ -122,6 +136,23 @@ namespace cuda {
     viewport_t viewport;
 
     float scale;
+
+  private:
+    // Enough for every combination of captured image and frame in the hardware frame pool
+    static constexpr std::size_t MAX_GRAPHS = 16;
+
+    struct graph_t {
+      std::uint8_t *Y;
+      std::uint8_t *UV;
+      std::uint32_t pitchY;
+      std::uint32_t pitchUV;
+      cudaTextureObject_t texture;
+
+      graph_exec_t exec;
+    };
+
+    // Least recently used first
+    std::vector<graph_t> graphs;
   };
 }  // namespace cuda
 
@@ -0,0 +1,303 @@
+/**
+ * @file src/platform/linux/frame_tap.cpp
+ * @brief Definitions for the frame tap, which shares captured camera frames with local processes.
+ */
+// standard includes
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <condition_variable>
+#include <cstring>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <vector>
+
+// platform includes
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// local includes
+#include "frame_tap.h"
+#include "misc.h"
+#include "src/logging.h"
+
+using namespace std::literals;
+
+namespace frame_tap {
+  namespace {
+    /**
+     * @brief A frame handed over by publish(), waiting to be copied into the ring.
+     */
+    struct pending_t {
+      frame_t frame;
+      std::span<const std::uint8_t> data;
+      std::shared_ptr<const void> owner;
+    };
+
+    /**
+     * @brief Send a message, with a file descriptor attached if `fd` isn't -1.
+     * @return `true` if the message was sent, `false` if the consumer is gone. A consumer that
+     * doesn't keep up only misses the message.
+     */
+    bool send_message(int consumer, const void *message, std::size_t size, int fd = -1) {
+      iovec iov {(void *) message, size};
+
+      msghdr msg {};
+      msg.msg_iov = &iov;
+      msg.msg_iovlen = 1;
+
+      alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))] {};
+      if (fd >= 0) {
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+
+        auto cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+        std::memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+      }
+
+      return sendmsg(consumer, &msg, MSG_DONTWAIT | MSG_NOSIGNAL) >= 0 || errno == EAGAIN || errno == EWOULDBLOCK;
+    }
+
+    class socket_tap_t: public tap_t {
+    public:
+      socket_tap_t(int fd, std::string path):
+          fd {fd},
+          path {std::move(path)},
+          page_size {(std::uint64_t) sysconf(_SC_PAGESIZE)} {
+        thread = std::thread {&socket_tap_t::run, this};
+      }
+
+      ~socket_tap_t() override {
+        {
+          std::lock_guard lg {mutex};
+          stop = true;
+        }
+        cv.notify_one();
+        thread.join();
+
+        unmap();
+        close(fd);
+        unlink(path.c_str());
+      }
+
+      void publish(std::uint32_t fourcc, int width, int height, std::uint32_t stride, std::span<const std::uint8_t> data, std::chrono::steady_clock::time_point timestamp, std::shared_ptr<const void> owner) override {
+        if (!consumer_count) {
+          return;
+        }
+
+        std::unique_lock ul {mutex, std::try_to_lock};
+
+        // Holding more than one driver buffer could stall the camera, so busy means the frame is skipped
+        if (!ul || pending || copying) {
+          return;
+        }
+
+        auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(timestamp.time_since_epoch()).count();
+        pending = pending_t {
+          {message_e::frame, 0, 0, fourcc, (std::uint32_t) width, (std::uint32_t) height, stride, (std::uint32_t) data.size(), 0, ns},
+          data,
+          std::move(owner),
+        };
+
+        ul.unlock();
+        cv.notify_one();
+      }
+
+    private:
+      void run() {
+        BOOST_LOG(info) << "Frame tap: serving frames on "sv << path;
+
+        while (true) {
+          std::optional<pending_t> next;
+          {
+            std::unique_lock ul {mutex};
+
+            // Consumers are accepted between frames, or every so often while no frames come
+            cv.wait_for(ul, 250ms, [this]() {
+              return stop || pending;
+            });
+
+            if (stop) {
+              break;
+            }
+
+            next = std::move(pending);
+            pending.reset();
+            copying = (bool) next;
+          }
+
+          accept_consumers();
+
+          if (next) {
+            write(*next);
+            next.reset();
+
+            std::lock_guard lg {mutex};
+            copying = false;
+          }
+        }
+
+        consumers.clear();
+        consumer_count = 0;
+      }
+
+      void accept_consumers() {
+        while (true) {
+          file_t consumer {accept4(fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC)};
+          if (consumer.el < 0) {
+            return;
+          }
+
+          if (ring && !send_message(consumer.el, &*ring, sizeof(*ring), memfd.el)) {
+            continue;
+          }
+
+          BOOST_LOG(info) << "Frame tap: consumer connected"sv;
+          consumers.emplace_back(std::move(consumer));
+          consumer_count = consumers.size();
+        }
+      }
+
+      void write(pending_t &next) {
+        auto needed = slot_size(next.frame.size, page_size);
+        if ((!ring || ring->slot_size < needed) && !allocate(needed)) {
+          return;
+        }
+
+        auto &frame = next.frame;
+        frame.generation = ring->generation;
+        frame.sequence = sequence++;
+        frame.slot = (std::uint32_t) (frame.sequence % SLOTS);
+
+        auto slot = mapping + frame.slot * ring->slot_size;
+        std::atomic_ref<std::uint64_t> slot_sequence {((slot_header_t *) slot)->sequence};
+
+        slot_sequence.store(0, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        std::memcpy(slot + DATA_OFFSET, next.data.data(), next.data.size());
+        slot_sequence.store(frame.sequence + 1, std::memory_order_release);
+
+        // The driver buffer goes back to the camera before anyone is told about the frame
+        next.owner.reset();
+
+        broadcast(&frame, sizeof(frame));
+      }
+
+      /**
+       * @brief Replace the ring by one with slots of `needed` bytes, and hand it to every consumer.
+       */
+      bool allocate(std::uint64_t needed) {
+        unmap();
+
+        auto size = needed * SLOTS;
+        file_t new_memfd {memfd_create("sunshine-frame-tap", MFD_CLOEXEC | MFD_ALLOW_SEALING)};
+        if (new_memfd.el < 0 || ftruncate(new_memfd.el, (off_t) size)) {
+          BOOST_LOG(error) << "Frame tap: couldn't allocate "sv << size << " bytes for the ring: "sv << std::strerror(errno);
+          return false;
+        }
+
+        auto ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, new_memfd.el, 0);
+        if (ptr == MAP_FAILED) {
+          BOOST_LOG(error) << "Frame tap: couldn't map the ring: "sv << std::strerror(errno);
+          return false;
+        }
+
+        // Consumers can neither resize the ring nor map it writable, the mapping above stays writable
+        int seals = F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL;
+#ifdef F_SEAL_FUTURE_WRITE
+        seals |= F_SEAL_FUTURE_WRITE;
+#endif
+        fcntl(new_memfd.el, F_ADD_SEALS, seals);
+
+        memfd = std::move(new_memfd);
+        mapping = (std::uint8_t *) ptr;
+        mapping_size = size;
+        ring = ring_t {message_e::ring, VERSION, generation++, SLOTS, needed};
+
+        BOOST_LOG(debug) << "Frame tap: ring of "sv << SLOTS << " slots of "sv << needed << " bytes"sv;
+        broadcast(&*ring, sizeof(*ring), memfd.el);
+        return true;
+      }
+
+      void unmap() {
+        if (mapping) {
+          munmap(mapping, mapping_size);
+          mapping = nullptr;
+        }
+        ring.reset();
+      }
+
+      void broadcast(const void *message, std::size_t size, int attached_fd = -1) {
+        auto gone = std::remove_if(std::begin(consumers), std::end(consumers), [&](const file_t &consumer) {
+          return !send_message(consumer.el, message, size, attached_fd);
+        });
+
+        if (gone != std::end(consumers)) {
+          BOOST_LOG(info) << "Frame tap: consumer disconnected"sv;
+          consumers.erase(gone, std::end(consumers));
+          consumer_count = consumers.size();
+        }
+      }
+
+      int fd;
+      std::string path;
+      std::uint64_t page_size;
+
+      std::mutex mutex;
+      std::condition_variable cv;
+      std::optional<pending_t> pending;
+      bool copying {false};
+      bool stop {false};
+
+      // Only touched by the thread of the tap
+      std::vector<file_t> consumers;
+      std::optional<ring_t> ring;
+      file_t memfd;
+      std::uint8_t *mapping {nullptr};
+      std::uint64_t mapping_size {0};
+      std::uint32_t generation {0};
+      std::uint64_t sequence {0};
+
+      std::atomic<std::size_t> consumer_count {0};
+      std::thread thread;
+    };
+  }  // namespace
+
+  std::uint64_t slot_size(std::uint32_t size, std::uint64_t page_size) {
+    return (DATA_OFFSET + size + page_size - 1) / page_size * page_size;
+  }
+
+  std::unique_ptr<tap_t> start(const std::string &path) {
+    sockaddr_un addr {};
+    if (path.empty() || path.size() >= sizeof(addr.sun_path)) {
+      BOOST_LOG(error) << "Frame tap: invalid socket path "sv << path;
+      return nullptr;
+    }
+
+    auto fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+      BOOST_LOG(error) << "Frame tap: couldn't open a socket: "sv << std::strerror(errno);
+      return nullptr;
+    }
+
+    // A socket left behind by a previous run would fail the bind
+    unlink(path.c_str());
+
+    addr.sun_family = AF_UNIX;
+    std::memcpy(addr.sun_path, path.data(), path.size());
+    if (bind(fd, (sockaddr *) &addr, sizeof(addr)) || listen(fd, 4)) {
+      BOOST_LOG(error) << "Frame tap: couldn't listen on "sv << path << ": "sv << std::strerror(errno);
+      close(fd);
+      return nullptr;
+    }
+
+    return std::make_unique<socket_tap_t>(fd, path);
+  }
+}  // namespace frame_tap
@@ -0,0 +1,115 @@
+/**
+ * @file src/platform/linux/frame_tap.h
+ * @brief Declarations for the frame tap, which shares captured camera frames with local processes.
+ *
+ * Consumers connect to a `SOCK_SEQPACKET` Unix socket. Every message starts with a `message_e`.
+ * A `ring_t` message carries the memfd holding the ring of frames, it's sent when a consumer connects
+ * and whenever the ring is reallocated for larger frames. A `frame_t` message names the slot of the ring
+ * a frame was written to. Slots are reused in turn, so a consumer checks the `sequence` of the slot
+ * header before and after reading to know the frame wasn't overwritten meanwhile.
+ */
+#pragma once
+
+// standard includes
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <string>
+
+namespace frame_tap {
+  /**
+   * @brief Number of frames the ring holds.
+   */
+  constexpr std::uint32_t SLOTS = 4;
+
+  /**
+   * @brief Offset of the frame data from the start of its slot, the slot header comes first.
+   */
+  constexpr std::uint32_t DATA_OFFSET = 64;
+
+  /**
+   * @brief Protocol version.
+   */
+  constexpr std::uint32_t VERSION = 1;
+
+  /**
+   * @brief Type of a message sent to consumers.
+   */
+  enum class message_e : std::uint32_t {
+    ring = 1,  ///< A ring_t, with the memfd of the ring attached.
+    frame = 2,  ///< A frame_t.
+  };
+
+  /**
+   * @brief Layout of the ring.
+   */
+  struct ring_t {
+    message_e type;  ///< Always message_e::ring.
+    std::uint32_t version;  ///< Protocol version, VERSION.
+    std::uint32_t generation;  ///< Bumped whenever the ring is reallocated.
+    std::uint32_t slots;  ///< Number of slots.
+    std::uint64_t slot_size;  ///< Distance between slots, a multiple of the page size.
+  };
+
+  /**
+   * @brief Header at the start of every slot.
+   */
+  struct slot_header_t {
+    std::uint64_t sequence;  ///< 0 while the slot is written, the sequence of its frame + 1 once it's complete.
+  };
+
+  /**
+   * @brief A frame written to the ring.
+   */
+  struct frame_t {
+    message_e type;  ///< Always message_e::frame.
+    std::uint32_t generation;  ///< Generation of the ring the frame was written to.
+    std::uint32_t slot;  ///< Slot holding the frame.
+    std::uint32_t fourcc;  ///< V4L2 pixel format.
+    std::uint32_t width;  ///< Width in pixels.
+    std::uint32_t height;  ///< Height in pixels.
+    std::uint32_t stride;  ///< Bytes per line of the first plane, the other planes follow it.
+    std::uint32_t size;  ///< Bytes of frame data.
+    std::uint64_t sequence;  ///< Frames published since the tap started.
+    std::int64_t timestamp;  ///< Capture time in nanoseconds of CLOCK_MONOTONIC.
+  };
+
+  /**
+   * @brief Size of a slot holding a frame of `size` bytes.
+   * @param size Bytes of frame data.
+   * @param page_size Page size of the host.
+   * @return The slot size, rounded up to a whole page.
+   */
+  std::uint64_t slot_size(std::uint32_t size, std::uint64_t page_size);
+
+  /**
+   * @brief Shares frames with the consumers connected to its socket.
+   */
+  class tap_t {
+  public:
+    virtual ~tap_t() = default;
+
+    /**
+     * @brief Hand a frame to the consumers.
+     * The frame is copied into the ring on the thread of the tap, the capture thread never waits on it.
+     * While no consumer is connected, or the previous frame is still being copied, the frame is skipped.
+     * @param fourcc V4L2 pixel format.
+     * @param width Width in pixels.
+     * @param height Height in pixels.
+     * @param stride Bytes per line of the first plane.
+     * @param data The frame data.
+     * @param timestamp Capture time of the frame.
+     * @param owner Keeps `data` alive until the frame is copied.
+     */
+    virtual void publish(std::uint32_t fourcc, int width, int height, std::uint32_t stride, std::span<const std::uint8_t> data, std::chrono::steady_clock::time_point timestamp, std::shared_ptr<const void> owner) = 0;
+  };
+
+  /**
+   * @brief Start serving frames on a Unix socket.
+   * A stale socket file at the path is replaced, and the file is removed when the tap is destroyed.
+   * @param path Path of the socket.
+   * @return The tap, or nullptr if the socket couldn't be bound.
+   */
+  [[nodiscard]] std::unique_ptr<tap_t> start(const std::string &path);
+}  // namespace frame_tap
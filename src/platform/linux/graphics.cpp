@@ -3,8 +3,17 @@
  * @brief Definitions for graphics related functions.
  */
 // standard includes
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <map>
+#include <mutex>
 #include <fcntl.h>
 
+// platform includes
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+
 // local includes
 #include "graphics.h"
 #include "src/file_handler.h"
@@ -12,6 +21,7 @@
 #include "src/video.h"
 
 extern "C" {
+#include <libavutil/frame.h>
 #include <libavutil/pixdesc.h>
 }
 
@@ -190,6 +200,10 @@ namespace gl {
       ctx.DetachShader(p_handle, frag.handle());
     });
 
+    // Keep the linked binary retrievable for cached()
+    if (ctx.GetProgramBinary) {
+      ctx.ProgramParameteri(program.handle(), GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    }
     ctx.LinkProgram(program.handle());
 
     int status = 0;
@@ -202,6 +216,95 @@ namespace gl {
     return program;
   }
 
+  util::Either<program_t, std::string> program_t::link(const shader_t &comp) {
+    program_t program;
+
+    program._program.el = ctx.CreateProgram();
+
+    ctx.AttachShader(program.handle(), comp.handle());
+
+    auto fg = util::fail_guard([p_handle = program.handle(), &comp]() {
+      ctx.DetachShader(p_handle, comp.handle());
+    });
+
+    // Keep the linked binary retrievable for cached()
+    if (ctx.GetProgramBinary) {
+      ctx.ProgramParameteri(program.handle(), GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    }
+    ctx.LinkProgram(program.handle());
+
+    int status = 0;
+    ctx.GetProgramiv(program.handle(), GL_LINK_STATUS, &status);
+
+    if (!status) {
+      return program.err_str();
+    }
+
+    return program;
+  }
+
+  util::Either<program_t, std::string> program_t::cached(const std::string_view &name, std::span<const source_t> sources) {
+    struct binary_t {
+      GLenum format;
+      std::vector<char> data;
+    };
+
+    static std::mutex binaries_lock;
+    static std::map<std::string, binary_t, std::less<>> binaries;
+
+    // Binaries only load on the driver that produced them
+    std::string key {(const char *) ctx.GetString(GL_RENDERER)};
+    key += '/';
+    key += name;
+
+    bool binary_support = ctx.GetProgramBinary && ctx.ProgramBinary;
+    if (binary_support) {
+      std::lock_guard lg {binaries_lock};
+      if (auto it = binaries.find(key); it != std::end(binaries)) {
+        program_t program;
+        program._program.el = ctx.CreateProgram();
+        ctx.ProgramBinary(program.handle(), it->second.format, it->second.data.data(), it->second.data.size());
+
+        int status = 0;
+        ctx.GetProgramiv(program.handle(), GL_LINK_STATUS, &status);
+        if (status) {
+          return program;
+        }
+
+        // A driver update can reject an old binary, it's simply linked again
+        BOOST_LOG(debug) << "Program binary of "sv << name << " rejected, linking it again"sv;
+        binaries.erase(it);
+      }
+    }
+
+    std::vector<shader_t> shaders;
+    for (auto &source : sources) {
+      auto shader = shader_t::compile(file_handler::read_file(source.path), source.type);
+      if (shader.has_right()) {
+        return std::string {source.path} + ": " + shader.right();
+      }
+      shaders.emplace_back(std::move(shader.left()));
+    }
+
+    auto program = shaders.size() == 1 ? link(shaders[0]) : link(shaders[0], shaders[1]);
+    if (program.has_right() || !binary_support) {
+      return program;
+    }
+
+    int length = 0;
+    ctx.GetProgramiv(program.left().handle(), GL_PROGRAM_BINARY_LENGTH, &length);
+    if (length > 0) {
+      binary_t binary {0, std::vector<char>(length)};
+      ctx.GetProgramBinary(program.left().handle(), length, &length, &binary.format, binary.data.data());
+      binary.data.resize(length);
+
+      std::lock_guard lg {binaries_lock};
+      binaries.insert_or_assign(std::move(key), std::move(binary));
+    }
+
+    return program;
+  }
+
   void program_t::bind(const buffer_t &buffer) {
     ctx.UseProgram(handle());
     auto i = ctx.GetUniformBlockIndex(handle(), buffer.block());
@@ -444,6 +547,50 @@ namespace egl {
     return ctx;
   }
 
+  std::shared_ptr<shared_display_t> shared_display(int render_fd) {
+    static std::mutex lock;
+    static std::map<dev_t, std::weak_ptr<shared_display_t>> displays;
+
+    struct stat st;
+    if (fstat(render_fd, &st)) {
+      char string[1024];
+      BOOST_LOG(error) << "Couldn't stat render device: ["sv << strerror_r(errno, string, sizeof(string)) << ']';
+      return nullptr;
+    }
+
+    std::lock_guard lg {lock};
+
+    auto &weak = displays[st.st_rdev];
+    if (auto display = weak.lock()) {
+      return display;
+    }
+
+    if (!gbm::create_device) {
+      BOOST_LOG(warning) << "libgbm not initialized"sv;
+      return nullptr;
+    }
+
+    auto display = std::make_shared<shared_display_t>();
+    display->file.el = dup(render_fd);
+
+    display->gbm.reset(gbm::create_device(display->file.el));
+    if (!display->gbm) {
+      char string[1024];
+      BOOST_LOG(error) << "Couldn't create GBM device: ["sv << strerror_r(errno, string, sizeof(string)) << ']';
+      return nullptr;
+    }
+
+    display->display = make_display(display->gbm.get());
+    if (!display->display) {
+      return nullptr;
+    }
+
+    BOOST_LOG(debug) << "Set up a shared EGL display for render device "sv << major(st.st_rdev) << ':' << minor(st.st_rdev);
+
+    weak = display;
+    return display;
+  }
+
   struct plane_attr_t {
     EGLAttrib fd;
     EGLAttrib offset;
@@ -559,6 +706,49 @@ namespace egl {
     return rgb;
   }
 
+  rgb_t *import_cache_t::import_source(display_t::pointer egl_display, const surface_descriptor_t &xrgb) {
+    buffer_key_t key {xrgb.fb_id, xrgb.modifier, {}, xrgb.fourcc, xrgb.width, xrgb.height};
+    for (int x = 0; x < 4; ++x) {
+      if (xrgb.fds[x] < 0) {
+        continue;
+      }
+
+      struct stat st;
+      if (!fstat(xrgb.fds[x], &st)) {
+        key.inodes[x] = st.st_ino;
+      }
+      key.pitches[x] = xrgb.pitches[x];
+      key.offsets[x] = xrgb.offsets[x];
+    }
+
+    auto it = std::find_if(std::begin(entries), std::end(entries), [&key](const entry_t &entry) {
+      return entry.key == key;
+    });
+    if (it != std::end(entries)) {
+      entries.splice(std::end(entries), entries, it);
+      return &entries.back().rgb;
+    }
+
+    auto rgb = egl::import_source(egl_display, xrgb);
+    if (!rgb) {
+      return nullptr;
+    }
+
+    if (!key.inodes[0]) {
+      uncached = std::move(*rgb);
+      return &uncached;
+    }
+
+    BOOST_LOG(verbose) << "Imported DMA-BUF of framebuffer ["sv << key.fb_id << "], inode "sv << key.inodes[0];
+
+    if (entries.size() == max_entries) {
+      entries.pop_front();
+    }
+    entries.emplace_back(entry_t {key, std::move(*rgb)});
+
+    return &entries.back().rgb;
+  }
+
   /**
    * @brief Create a black RGB texture of the specified image size.
    * @param img The image to use for texture sizing.
@@ -712,6 +902,39 @@ namespace egl {
 
     program[0].bind(color_matrix);
     program[1].bind(color_matrix);
+    if (compute_program) {
+      compute_program->bind(color_matrix);
+    }
+
+    // Column major, BT.2020 to BT.709 primaries from ITU-R BT.2087
+    static constexpr float bt2020_to_bt709[] {
+      1.6605f, -0.1246f, -0.0182f,
+      -0.5876f, 1.1329f, -0.1006f,
+      -0.0728f, -0.0083f, 1.1187f,
+    };
+    static constexpr float identity[] {
+      1.0f, 0.0f, 0.0f,
+      0.0f, 1.0f, 0.0f,
+      0.0f, 0.0f, 1.0f,
+    };
+    auto gamut = colorspace.colorspace == video::colorspace_e::bt2020sdr ? identity : bt2020_to_bt709;
+
+    // The tone mapping runs in the same pass as the color conversion
+    auto set_tone_map = [&](gl::program_t &program) {
+      gl::ctx.UseProgram(program.handle());
+      gl::ctx.Uniform1i(gl::ctx.GetUniformLocation(program.handle(), "tone_map"), colorspace.tone_map);
+      gl::ctx.UniformMatrix3fv(gl::ctx.GetUniformLocation(program.handle(), "tone_map_gamut"), 1, GL_FALSE, gamut);
+    };
+
+    set_tone_map(program[0]);
+    set_tone_map(program[1]);
+    if (compute_program) {
+      set_tone_map(*compute_program);
+    }
+
+    if (colorspace.tone_map) {
+      BOOST_LOG(info) << "Tone-mapping the HDR display for an SDR stream"sv;
+    }
   }
 
   std::optional<sws_t> sws_t::make(int in_width, int in_height, int out_width, int out_height, gl::tex_t &&tex) {
@@ -740,66 +963,42 @@ namespace egl {
     auto width_i = 1.0f / sws.out_width;
 
     {
-      const char *sources[] {
-        SUNSHINE_SHADERS_DIR "/ConvertUV.frag",
-        SUNSHINE_SHADERS_DIR "/ConvertUV.vert",
-        SUNSHINE_SHADERS_DIR "/ConvertY.frag",
-        SUNSHINE_SHADERS_DIR "/Scene.vert",
-        SUNSHINE_SHADERS_DIR "/Scene.frag",
+      constexpr gl::program_t::source_t y_sources[] {
+        {SUNSHINE_SHADERS_DIR "/Scene.vert", GL_VERTEX_SHADER},
+        {SUNSHINE_SHADERS_DIR "/ConvertY.frag", GL_FRAGMENT_SHADER},
       };
-
-      GLenum shader_type[2] {
-        GL_FRAGMENT_SHADER,
-        GL_VERTEX_SHADER,
+      constexpr gl::program_t::source_t uv_sources[] {
+        {SUNSHINE_SHADERS_DIR "/ConvertUV.vert", GL_VERTEX_SHADER},
+        {SUNSHINE_SHADERS_DIR "/ConvertUV.frag", GL_FRAGMENT_SHADER},
+      };
+      constexpr gl::program_t::source_t cursor_sources[] {
+        {SUNSHINE_SHADERS_DIR "/Scene.vert", GL_VERTEX_SHADER},
+        {SUNSHINE_SHADERS_DIR "/Scene.frag", GL_FRAGMENT_SHADER},
+      };
+      constexpr gl::program_t::source_t overlay_sources[] {
+        {SUNSHINE_SHADERS_DIR "/Overlay.vert", GL_VERTEX_SHADER},
+        {SUNSHINE_SHADERS_DIR "/Scene.frag", GL_FRAGMENT_SHADER},
       };
 
-      constexpr auto count = sizeof(sources) / sizeof(const char *);
-
-      util::Either<gl::shader_t, std::string> compiled_sources[count];
-
-      bool error_flag = false;
-      for (int x = 0; x < count; ++x) {
-        auto &compiled_source = compiled_sources[x];
+      // Y, UV, cursor and overlay shaders
+      std::pair<std::string_view, std::span<const gl::program_t::source_t>> programs[] {
+        {"ConvertY"sv, y_sources},
+        {"ConvertUV"sv, uv_sources},
+        {"Scene"sv, cursor_sources},
+        {"Overlay"sv, overlay_sources},
+      };
 
-        compiled_source = gl::shader_t::compile(file_handler::read_file(sources[x]), shader_type[x % 2]);
+      for (int x = 0; x < 4; ++x) {
+        auto program = gl::program_t::cached(programs[x].first, programs[x].second);
         gl_drain_errors;
 
-        if (compiled_source.has_right()) {
-          BOOST_LOG(error) << sources[x] << ": "sv << compiled_source.right();
-          error_flag = true;
+        if (program.has_right()) {
+          BOOST_LOG(error) << "GL linker: "sv << program.right();
+          return std::nullopt;
         }
-      }
-
-      if (error_flag) {
-        return std::nullopt;
-      }
-
-      auto program = gl::program_t::link(compiled_sources[3].left(), compiled_sources[4].left());
-      if (program.has_right()) {
-        BOOST_LOG(error) << "GL linker: "sv << program.right();
-        return std::nullopt;
-      }
-
-      // Cursor - shader
-      sws.program[2] = std::move(program.left());
 
-      program = gl::program_t::link(compiled_sources[1].left(), compiled_sources[0].left());
-      if (program.has_right()) {
-        BOOST_LOG(error) << "GL linker: "sv << program.right();
-        return std::nullopt;
+        sws.program[x] = std::move(program.left());
       }
-
-      // UV - shader
-      sws.program[1] = std::move(program.left());
-
-      program = gl::program_t::link(compiled_sources[3].left(), compiled_sources[2].left());
-      if (program.has_right()) {
-        BOOST_LOG(error) << "GL linker: "sv << program.right();
-        return std::nullopt;
-      }
-
-      // Y - shader
-      sws.program[0] = std::move(program.left());
     }
 
     auto loc_width_i = gl::ctx.GetUniformLocation(sws.program[1].handle(), "width_i");
@@ -811,6 +1010,12 @@ namespace egl {
     gl::ctx.UseProgram(sws.program[1].handle());
     gl::ctx.Uniform1fv(loc_width_i, 1, &width_i);
 
+    sws.loc_overlay_src = gl::ctx.GetUniformLocation(sws.program[3].handle(), "src");
+    if (sws.loc_overlay_src < 0) {
+      BOOST_LOG(error) << "Couldn't find uniform [src]"sv;
+      return std::nullopt;
+    }
+
     auto color_p = video::color_vectors_from_colorspace({video::colorspace_e::rec601, false, 8}, true);
     std::pair<const char *, std::string_view> members[] {
       std::make_pair("color_vec_y", util::view(color_p->color_vec_y)),
@@ -827,6 +1032,28 @@ namespace egl {
 
     sws.color_matrix = std::move(*color_matrix);
 
+    // Compute shaders are core since OpenGL 4.3
+    if (gl::ctx.VERSION_4_3) {
+      constexpr gl::program_t::source_t sources[] {
+        {SUNSHINE_SHADERS_DIR "/Convert.comp", GL_COMPUTE_SHADER},
+      };
+
+      auto program = gl::program_t::cached("Convert"sv, sources);
+      gl_drain_errors;
+
+      if (program.has_right()) {
+        BOOST_LOG(warning) << "GL linker: "sv << program.right();
+      } else {
+        sws.loc_offset = gl::ctx.GetUniformLocation(program.left().handle(), "offset");
+        sws.loc_size = gl::ctx.GetUniformLocation(program.left().handle(), "size");
+
+        sws.compute_program = std::move(program.left());
+        sws.compute_program->bind(sws.color_matrix);
+      }
+
+      BOOST_LOG(debug) << "Color conversion: "sv << (sws.compute_program ? "compute shader"sv : "fragment shaders"sv);
+    }
+
     sws.tex = std::move(tex);
 
     sws.cursor_framebuffer = gl::frame_buf_t::make(1);
@@ -897,7 +1124,7 @@ namespace egl {
     gl::ctx.TexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, img.width, img.height, GL_BGRA, GL_UNSIGNED_BYTE, img.data);
   }
 
-  void sws_t::load_vram(img_descriptor_t &img, int offset_x, int offset_y, int texture) {
+  void sws_t::load_vram(img_descriptor_t &img, int offset_x, int offset_y, int texture, display_t::pointer egl_display) {
     // When only a sub-part of the image must be encoded...
     const bool copy = offset_x || offset_y || img.sd.width != in_width || img.sd.height != in_height;
     if (copy) {
@@ -910,22 +1137,34 @@ namespace egl {
       loaded_texture = texture;
     }
 
-    if (img.data) {
-      GLenum attachment = GL_COLOR_ATTACHMENT0;
+    const bool overlays = egl_display && !img.overlays.empty();
+    if (!img.data && !overlays) {
+      return;
+    }
 
-      gl::ctx.BindFramebuffer(GL_FRAMEBUFFER, cursor_framebuffer[0]);
-      gl::ctx.UseProgram(program[2].handle());
+    GLenum attachment = GL_COLOR_ATTACHMENT0;
 
-      // When a copy has already been made...
-      if (!copy) {
-        gl::ctx.BindTexture(GL_TEXTURE_2D, texture);
-        gl::ctx.DrawBuffers(1, &attachment);
+    gl::ctx.BindFramebuffer(GL_FRAMEBUFFER, cursor_framebuffer[0]);
+    gl::ctx.UseProgram(program[2].handle());
 
-        gl::ctx.Viewport(0, 0, in_width, in_height);
-        gl::ctx.DrawArrays(GL_TRIANGLES, 0, 3);
+    // When a copy has already been made...
+    if (!copy) {
+      gl::ctx.BindTexture(GL_TEXTURE_2D, texture);
+      gl::ctx.DrawBuffers(1, &attachment);
 
-        loaded_texture = tex[0];
-      }
+      gl::ctx.Viewport(0, 0, in_width, in_height);
+      gl::ctx.DrawArrays(GL_TRIANGLES, 0, 3);
+
+      loaded_texture = tex[0];
+    }
+
+    // Overlay planes are scanned out below the cursor
+    if (overlays) {
+      blend_overlays(img, egl_display);
+    }
+
+    if (img.data) {
+      gl::ctx.UseProgram(program[2].handle());
 
       gl::ctx.BindTexture(GL_TEXTURE_2D, tex[1]);
       if (serial != img.serial) {
@@ -950,13 +1189,104 @@ namespace egl {
       gl::ctx.DrawArrays(GL_TRIANGLES, 0, 3);
 
       gl::ctx.Disable(GL_BLEND);
+    }
+
+    gl::ctx.BindTexture(GL_TEXTURE_2D, 0);
+    gl::ctx.BindFramebuffer(GL_FRAMEBUFFER, 0);
+  }
+
+  /**
+   * @brief Draw the overlay planes of an image over the loaded image, in the same pass as the cursor.
+   * The cursor framebuffer must be bound, with tex[0] holding the image.
+   */
+  void sws_t::blend_overlays(img_descriptor_t &img, display_t::pointer egl_display) {
+    GLenum attachment = GL_COLOR_ATTACHMENT0;
+    gl::ctx.DrawBuffers(1, &attachment);
+    gl::ctx.UseProgram(program[3].handle());
+
+    // KMS blends planes with premultiplied alpha unless told otherwise
+    gl::ctx.BlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+    gl::ctx.Enable(GL_BLEND);
+
+    for (auto &overlay : img.overlays) {
+      std::pair format {overlay.sd.fourcc, overlay.sd.modifier};
+      if (std::find(std::begin(unsupported_overlays), std::end(unsupported_overlays), format) != std::end(unsupported_overlays)) {
+        continue;
+      }
+
+      auto rgb = overlay_sources.import_source(egl_display, overlay.sd);
+      if (!rgb) {
+        BOOST_LOG(warning) << "Couldn't import overlay plane of format "sv << util::view(overlay.sd.fourcc) << ", it's left out of the stream"sv;
+        unsupported_overlays.push_back(format);
+        continue;
+      }
+
+      GLfloat src[] {
+        (GLfloat) overlay.src_x / overlay.sd.width,
+        (GLfloat) overlay.src_y / overlay.sd.height,
+        (GLfloat) overlay.src_w / overlay.sd.width,
+        (GLfloat) overlay.src_h / overlay.sd.height,
+      };
+      gl::ctx.Uniform4fv(loc_overlay_src, 1, src);
 
-      gl::ctx.BindTexture(GL_TEXTURE_2D, 0);
-      gl::ctx.BindFramebuffer(GL_FRAMEBUFFER, 0);
+      gl::ctx.BindTexture(GL_TEXTURE_2D, (*rgb)->tex[0]);
+      gl::ctx.Viewport(overlay.crtc_x, overlay.crtc_y, overlay.crtc_w, overlay.crtc_h);
+      gl::ctx.DrawArrays(GL_TRIANGLES, 0, 3);
     }
+
+    gl::ctx.Disable(GL_BLEND);
+    gl::ctx.BlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+  }
+
+  bool sws_t::convert_compute(gl::frame_buf_t &fb) {
+    gl_drain_errors;
+
+    gl::ctx.BindTexture(GL_TEXTURE_2D, loaded_texture);
+    gl::ctx.UseProgram(compute_program->handle());
+
+    // The planes are the textures attached to the framebuffers
+    for (int x = 0; x < 2; ++x) {
+      GLint texture;
+      GLint format;
+
+      gl::ctx.BindFramebuffer(GL_FRAMEBUFFER, fb[x]);
+      gl::ctx.GetFramebufferAttachmentParameteriv(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + x, GL_FRAMEBUFFER_ATTACHMENT_OBJECT_NAME, &texture);
+      gl::ctx.BindTexture(GL_TEXTURE_2D, texture);
+      gl::ctx.GetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_INTERNAL_FORMAT, &format);
+
+      gl::ctx.BindImageTexture(x, texture, 0, GL_FALSE, 0, GL_WRITE_ONLY, format);
+    }
+    gl::ctx.BindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    gl::ctx.BindTexture(GL_TEXTURE_2D, loaded_texture);
+    gl::ctx.Uniform2i(loc_offset, offsetX, offsetY);
+    gl::ctx.Uniform2i(loc_size, out_width, out_height);
+
+    // Each invocation converts a 2x2 block, in work groups of 8x8 invocations
+    gl::ctx.DispatchCompute((out_width + 15) / 16, (out_height + 15) / 16, 1);
+    gl::ctx.MemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_TEXTURE_FETCH_BARRIER_BIT | GL_FRAMEBUFFER_BARRIER_BIT);
+
+    gl::ctx.BindTexture(GL_TEXTURE_2D, 0);
+
+    // Not every driver can store to imported planes, e.g. because of their format
+    if (auto err = gl::ctx.GetError(); err != GL_NO_ERROR) {
+      BOOST_LOG(warning) << "Compute shader color conversion failed: ["sv << util::hex(err).to_string_view() << "], falling back to fragment shaders"sv;
+      gl_drain_errors;
+
+      compute_program.reset();
+      return false;
+    }
+
+    gl::ctx.Flush();
+
+    return true;
   }
 
   int sws_t::convert(gl::frame_buf_t &fb) {
+    if (compute_program && convert_compute(fb)) {
+      return 0;
+    }
+
     gl::ctx.BindTexture(GL_TEXTURE_2D, loaded_texture);
 
     GLenum attachments[] {
@@ -987,6 +1317,199 @@ namespace egl {
 
     return 0;
   }
+
+  namespace {
+    KITTY_USING_MOVE_T(pack_buffer_t, GLuint, 0, {
+      if (el) {
+        gl::ctx.DeleteBuffers(1, &el);
+      }
+    });
+
+    /**
+     * @brief Converts the captured DMA-BUF on the GPU and reads the planes back into a software frame.
+     * This feeds encoders that take system memory, such as libx264 and V4L2 M2M, without reading back
+     * the whole BGRA image and converting it on the CPU.
+     */
+    class readback_t: public platf::avcodec_encode_device_t {
+    public:
+      int init(int in_width, int in_height, file_t &&render_device, int offset_x, int offset_y) {
+        shared_display = egl::shared_display(render_device.el);
+        if (!shared_display) {
+          return -1;
+        }
+
+        auto ctx_opt = make_ctx(shared_display->display.get());
+        if (!ctx_opt) {
+          return -1;
+        }
+
+        ctx = std::move(*ctx_opt);
+
+        width = in_width;
+        height = in_height;
+        this->offset_x = offset_x;
+        this->offset_y = offset_y;
+        sequence = 0;
+
+        return 0;
+      }
+
+      bool converts_to_system_memory() override {
+        return true;
+      }
+
+      int set_frame(AVFrame *frame, AVBufferRef *hw_frames_ctx) override {
+        this->frame = frame;
+        this->sw_frame.reset(frame);
+
+        if (frame->format != AV_PIX_FMT_NV12 && frame->format != AV_PIX_FMT_YUV420P) {
+          BOOST_LOG(error) << "Unsupported pixel format for GPU conversion to system memory: "sv << frame->format;
+          return -1;
+        }
+
+        if (!frame->buf[0] && av_frame_get_buffer(frame, 0)) {
+          BOOST_LOG(error) << "Couldn't allocate software frame"sv;
+          return -1;
+        }
+
+        auto nv12_opt = create_target(frame->width, frame->height, AV_PIX_FMT_NV12);
+        if (!nv12_opt) {
+          return -1;
+        }
+
+        auto sws_opt = sws_t::make(width, height, frame->width, frame->height, AV_PIX_FMT_NV12);
+        if (!sws_opt) {
+          return -1;
+        }
+
+        nv12 = std::move(*nv12_opt);
+        sws = std::move(*sws_opt);
+
+        // Both planes of the biplanar target, back to back
+        auto size = frame->width * frame->height + (frame->width / 2) * (frame->height / 2) * 2;
+
+        gl::ctx.GenBuffers(1, &pack_buffer.el);
+        gl::ctx.BindBuffer(GL_PIXEL_PACK_BUFFER, pack_buffer.el);
+        gl::ctx.BufferData(GL_PIXEL_PACK_BUFFER, size, nullptr, GL_STREAM_READ);
+        gl::ctx.BindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+        gl_drain_errors;
+
+        return 0;
+      }
+
+      int convert(platf::img_t &img) override {
+        auto &descriptor = (img_descriptor_t &) img;
+
+        if (descriptor.sequence == 0) {
+          // For dummy images, use a blank RGB texture instead of importing a DMA-BUF
+          blank = create_blank(img);
+          rgb = &blank;
+        } else if (descriptor.sequence > sequence) {
+          sequence = descriptor.sequence;
+
+          rgb = sources.import_source(shared_display->display.get(), descriptor.sd);
+          if (!rgb) {
+            return -1;
+          }
+        }
+
+        sws.load_vram(descriptor, offset_x, offset_y, (*rgb)->tex[0], shared_display->display.get());
+        sws.convert(nv12->buf);
+
+        return read_back();
+      }
+
+      void apply_colorspace() override {
+        sws.apply_colorspace(colorspace);
+      }
+
+    private:
+      /**
+       * @brief Copy the converted planes into the software frame.
+       * The planes are packed into a pixel buffer by the GPU, so the only CPU copy left is the one out of
+       * the mapped buffer. The buffer is mapped in the same frame, waiting a frame for it would add a
+       * frame of latency to save a stall that the conversion already mostly covers.
+       */
+      int read_back() {
+        int plane_width[] {frame->width, frame->width / 2};
+        int plane_height[] {frame->height, frame->height / 2};
+        std::ptrdiff_t plane_offset[] {0, (std::ptrdiff_t) frame->width * frame->height};
+
+        gl::ctx.BindBuffer(GL_PIXEL_PACK_BUFFER, pack_buffer.el);
+        gl::ctx.PixelStorei(GL_PACK_ALIGNMENT, 1);
+
+        for (int x = 0; x < 2; ++x) {
+          gl::ctx.BindFramebuffer(GL_READ_FRAMEBUFFER, nv12->buf[x]);
+          gl::ctx.ReadBuffer(GL_COLOR_ATTACHMENT0 + x);
+          gl::ctx.ReadPixels(0, 0, plane_width[x], plane_height[x], x == 0 ? GL_RED : GL_RG, GL_UNSIGNED_BYTE, (void *) plane_offset[x]);
+        }
+
+        gl::ctx.BindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+
+        auto size = plane_offset[1] + (std::ptrdiff_t) plane_width[1] * plane_height[1] * 2;
+        auto planes = (const std::uint8_t *) gl::ctx.MapBufferRange(GL_PIXEL_PACK_BUFFER, 0, size, GL_MAP_READ_BIT);
+        if (!planes) {
+          gl_drain_errors;
+          BOOST_LOG(error) << "Couldn't map the converted frame"sv;
+          gl::ctx.BindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+          return -1;
+        }
+
+        for (int y = 0; y < plane_height[0]; ++y) {
+          std::copy_n(planes + y * plane_width[0], plane_width[0], frame->data[0] + y * frame->linesize[0]);
+        }
+
+        auto uv = planes + plane_offset[1];
+        for (int y = 0; y < plane_height[1]; ++y) {
+          auto row = uv + y * plane_width[1] * 2;
+
+          if (frame->format == AV_PIX_FMT_NV12) {
+            std::copy_n(row, plane_width[1] * 2, frame->data[1] + y * frame->linesize[1]);
+            continue;
+          }
+
+          auto u = frame->data[1] + y * frame->linesize[1];
+          auto v = frame->data[2] + y * frame->linesize[2];
+          for (int x = 0; x < plane_width[1]; ++x) {
+            u[x] = row[x * 2];
+            v[x] = row[x * 2 + 1];
+          }
+        }
+
+        gl::ctx.UnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        gl::ctx.BindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+        return 0;
+      }
+
+      std::shared_ptr<shared_display_t> shared_display;
+      ctx_t ctx;
+
+      frame_t sw_frame;
+
+      sws_t sws;
+      nv12_t nv12;
+      pack_buffer_t pack_buffer;
+
+      import_cache_t sources;
+      rgb_t blank;
+      rgb_t *rgb;
+      std::uint64_t sequence;
+
+      int width, height;
+      int offset_x, offset_y;
+    };
+  }  // namespace
+
+  std::unique_ptr<platf::avcodec_encode_device_t> make_readback_encode_device(int width, int height, file_t &&render_device, int offset_x, int offset_y) {
+    auto device = std::make_unique<readback_t>();
+    if (device->init(width, height, std::move(render_device), offset_x, offset_y)) {
+      return nullptr;
+    }
+
+    return device;
+  }
 }  // namespace egl
 
 void free_frame(AVFrame *frame) {
@@ -5,8 +5,13 @@
 #pragma once
 
 // standard includes
+#include <list>
+#include <memory>
 #include <optional>
+#include <span>
 #include <string_view>
+#include <utility>
+#include <vector>
 
 // lib includes
 #include <glad/egl.h>
@@ -153,6 +158,24 @@ namespace gl {
     std::string err_str();
 
     static util::Either<program_t, std::string> link(const shader_t &vert, const shader_t &frag);
+    static util::Either<program_t, std::string> link(const shader_t &comp);
+
+    /**
+     * @brief A shader source file and the stage it's compiled for.
+     */
+    struct source_t {
+      const char *path;
+      GLenum type;
+    };
+
+    /**
+     * @brief Link a program from its shader files, or load the binary an earlier link left on the same renderer.
+     * Binaries are kept for the lifetime of the process, so later sessions skip compiling and linking.
+     * @param name The name the binary is kept under.
+     * @param sources A compute shader, or a vertex shader followed by a fragment shader.
+     * @return The program, or the error that kept it from being linked.
+     */
+    static util::Either<program_t, std::string> cached(const std::string_view &name, std::span<const source_t> sources);
 
     void bind(const buffer_t &buffer);
 
@@ -235,11 +258,33 @@ namespace egl {
     std::uint64_t modifier;
     std::uint32_t pitches[4];
     std::uint32_t offsets[4];
+
+    // The KMS framebuffer the planes belong to, 0 if the buffer didn't come from KMS
+    std::uint32_t fb_id = 0;
   };
 
   display_t make_display(std::variant<gbm::gbm_t::pointer, wl_display *, _XDisplay *> native_display);
   std::optional<ctx_t> make_ctx(display_t::pointer display);
 
+  /**
+   * @brief A GBM device and the EGL display on it, shared by the encode devices on a render node.
+   * Setting up the display loads and initializes the driver, the slowest part of creating an encode device.
+   * Each encode device still creates its own context, since a context is only current on one thread at a time.
+   */
+  struct shared_display_t {
+    file_t file;
+    gbm::gbm_t gbm;
+    display_t display;
+  };
+
+  /**
+   * @brief Get the display of a render node, setting it up if no encode device uses it yet.
+   * @param render_fd An open render node, the display keeps a duplicate of it.
+   * @return The display, or nullptr if it couldn't be set up.
+   * @note Contexts made on the display must be destroyed before the last reference to it is released.
+   */
+  std::shared_ptr<shared_display_t> shared_display(int render_fd);
+
   std::optional<rgb_t>
     import_source(
       display_t::pointer egl_display,
@@ -248,6 +293,54 @@ namespace egl {
 
   rgb_t create_blank(platf::img_t &img);
 
+  /**
+   * @brief Least recently used cache of imported DMA-BUF sources.
+   * Compositors flip between a handful of buffers, so once each of them has been imported
+   * capturing a frame only has to look up its texture.
+   */
+  class import_cache_t {
+  public:
+    static constexpr std::size_t max_entries = 4;
+
+    /**
+     * @brief Get the imported texture of a DMA-BUF, importing it on a cache miss.
+     * @param egl_display The display to import on.
+     * @param xrgb The DMA-BUF to import.
+     * @return The imported image, or nullptr if the import failed.
+     * It stays valid until the next import.
+     */
+    rgb_t *import_source(display_t::pointer egl_display, const surface_descriptor_t &xrgb);
+
+  private:
+    struct buffer_key_t {
+      std::uint32_t fb_id;
+      std::uint64_t modifier;
+
+      // A recycled framebuffer ID can point to a different buffer, the DMA-BUF inodes can't
+      // be reused as long as the cached image keeps the buffers alive
+      std::uint64_t inodes[4];
+
+      std::uint32_t fourcc;
+      int width;
+      int height;
+      std::uint32_t pitches[4];
+      std::uint32_t offsets[4];
+
+      bool operator==(const buffer_key_t &) const = default;
+    };
+
+    struct entry_t {
+      buffer_key_t key;
+      rgb_t rgb;
+    };
+
+    // Most recently used last
+    std::list<entry_t> entries;
+
+    // Holds the last import of a buffer that can't be identified
+    rgb_t uncached;
+  };
+
   std::optional<nv12_t> import_target(
     display_t::pointer egl_display,
     std::array<file_t, nv12_img_t::num_fds> &&fds,
@@ -274,6 +367,19 @@ namespace egl {
     std::vector<std::uint8_t> buffer;
   };
 
+  /**
+   * @brief A plane scanned out on top of the captured framebuffer, e.g. a video on a KMS overlay plane.
+   */
+  struct overlay_t {
+    surface_descriptor_t sd;
+
+    // Part of the framebuffer the plane shows, in pixels
+    int src_x, src_y, src_w, src_h;
+
+    // Where the plane is scanned out, relative to the captured image
+    int crtc_x, crtc_y, crtc_w, crtc_h;
+  };
+
   // Allow cursor and the underlying image to be kept together
   class img_descriptor_t: public cursor_t {
   public:
@@ -289,10 +395,22 @@ namespace egl {
           sd.fds[x] = -1;
         }
       }
+
+      for (auto &overlay : overlays) {
+        for (auto fd : overlay.sd.fds) {
+          if (fd >= 0) {
+            close(fd);
+          }
+        }
+      }
+      overlays.clear();
     }
 
     surface_descriptor_t sd;
 
+    // Planes to composite over sd, bottom to top. The image owns the file descriptors of their buffers.
+    std::vector<overlay_t> overlays;
+
     // Increment sequence when new rgb_t needs to be created
     std::uint64_t sequence;
   };
@@ -305,11 +423,23 @@ namespace egl {
     // Convert the loaded image into the first two framebuffers
     int convert(gl::frame_buf_t &fb);
 
+    // Convert with a single compute dispatch, returns false if the frame still has to be converted
+    bool convert_compute(gl::frame_buf_t &fb);
+
     // Make an area of the image black
     int blank(gl::frame_buf_t &fb, int offsetX, int offsetY, int width, int height);
 
     void load_ram(platf::img_t &img);
-    void load_vram(img_descriptor_t &img, int offset_x, int offset_y, int texture);
+
+    /**
+     * @brief Load a captured DMA-BUF, with its overlay planes and the cursor blended over it.
+     * @param img The captured image.
+     * @param offset_x Horizontal offset of the image in the captured framebuffer.
+     * @param offset_y Vertical offset of the image in the captured framebuffer.
+     * @param texture The imported framebuffer.
+     * @param egl_display The display to import the overlay planes on, the overlays are left out without one.
+     */
+    void load_vram(img_descriptor_t &img, int offset_x, int offset_y, int texture, display_t::pointer egl_display = nullptr);
 
     void apply_colorspace(const video::sunshine_colorspace_t &colorspace);
 
@@ -321,10 +451,15 @@ namespace egl {
     gl::frame_buf_t cursor_framebuffer;
     gl::frame_buf_t copy_framebuffer;
 
-    // Y - shader, UV - shader, Cursor - shader
-    gl::program_t program[3];
+    // Y - shader, UV - shader, Cursor - shader, Overlay - shader
+    gl::program_t program[4];
+    GLint loc_overlay_src;
     gl::buffer_t color_matrix;
 
+    // Writes both planes at once, only used when the context supports compute shaders
+    std::optional<gl::program_t> compute_program;
+    GLint loc_offset, loc_size;
+
     int out_width, out_height;
     int in_width, in_height;
     int offsetX, offsetY;
@@ -334,7 +469,29 @@ namespace egl {
 
     // Store latest cursor for load_vram
     std::uint64_t serial;
+
+    // Overlay planes flip between buffers of their own, a separate cache keeps them from evicting the framebuffer
+    import_cache_t overlay_sources;
+
+    // Formats and modifiers of overlays the driver couldn't import, they aren't tried again
+    std::vector<std::pair<std::uint32_t, std::uint64_t>> unsupported_overlays;
+
+  private:
+    void blend_overlays(img_descriptor_t &img, display_t::pointer egl_display);
   };
 
+  /**
+   * @brief Create an encode device for encoders that take system memory, converting on the GPU.
+   * Captured DMA-BUFs are converted to NV12 with sws_t, then only the converted planes are read back
+   * into the software frame, as NV12 or YUV420P.
+   * @param width Width of the captured image.
+   * @param height Height of the captured image.
+   * @param render_device The render node to convert on.
+   * @param offset_x Horizontal offset of the image in the captured framebuffer.
+   * @param offset_y Vertical offset of the image in the captured framebuffer.
+   * @return The encode device, or nullptr on failure.
+   */
+  std::unique_ptr<platf::avcodec_encode_device_t> make_readback_encode_device(int width, int height, file_t &&render_device, int offset_x, int offset_y);
+
   bool fail();
 }  // namespace egl
@@ -0,0 +1,315 @@
+/**
+ * @file src/platform/linux/input/actuator.cpp
+ * @brief Definitions for driving PWM and GPIO outputs straight from gamepad input.
+ */
+// standard includes
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <cstring>
+#include <string>
+#include <utility>
+
+// platform includes
+#include <fcntl.h>
+#include <linux/gpio.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+// local includes
+#include "actuator.h"
+#include "src/logging.h"
+
+using namespace std::literals;
+
+namespace platf::actuator {
+  namespace {
+    constexpr std::pair<std::string_view, source_e> axis_names[] {
+      {"ls_x"sv, source_e::ls_x},
+      {"ls_y"sv, source_e::ls_y},
+      {"rs_x"sv, source_e::rs_x},
+      {"rs_y"sv, source_e::rs_y},
+      {"lt"sv, source_e::lt},
+      {"rt"sv, source_e::rt},
+    };
+
+    constexpr std::pair<std::string_view, std::uint32_t> button_names[] {
+      {"up"sv, DPAD_UP},
+      {"down"sv, DPAD_DOWN},
+      {"left"sv, DPAD_LEFT},
+      {"right"sv, DPAD_RIGHT},
+      {"start"sv, START},
+      {"back"sv, BACK},
+      {"ls"sv, LEFT_STICK},
+      {"rs"sv, RIGHT_STICK},
+      {"lb"sv, LEFT_BUTTON},
+      {"rb"sv, RIGHT_BUTTON},
+      {"home"sv, HOME},
+      {"a"sv, A},
+      {"b"sv, B},
+      {"x"sv, X},
+      {"y"sv, Y},
+      {"paddle1"sv, PADDLE1},
+      {"paddle2"sv, PADDLE2},
+      {"paddle3"sv, PADDLE3},
+      {"paddle4"sv, PADDLE4},
+      {"touchpad"sv, TOUCHPAD_BUTTON},
+      {"misc"sv, MISC_BUTTON},
+    };
+
+    std::string_view trim(std::string_view str) {
+      auto begin = str.find_first_not_of(" \t");
+      if (begin == std::string_view::npos) {
+        return {};
+      }
+
+      return str.substr(begin, str.find_last_not_of(" \t") - begin + 1);
+    }
+
+    template<class T>
+    bool parse_number(std::string_view str, T &value) {
+      auto result = std::from_chars(str.data(), str.data() + str.size(), value);
+      return result.ec == std::errc {} && result.ptr == str.data() + str.size();
+    }
+
+    bool parse_control(std::string_view control, mapping_t &mapping) {
+      for (auto &[name, source] : axis_names) {
+        if (control == name) {
+          mapping.source = source;
+          return true;
+        }
+      }
+
+      for (auto &[name, button] : button_names) {
+        if (control == name) {
+          mapping.source = source_e::button;
+          mapping.button = button;
+          return true;
+        }
+      }
+
+      return false;
+    }
+
+    bool parse_output(std::string_view output, mapping_t &mapping) {
+      if (output.starts_with("pwm"sv)) {
+        mapping.output = output_e::pwm;
+        output.remove_prefix(3);
+      } else if (output.starts_with("gpio"sv)) {
+        mapping.output = output_e::gpio;
+        output.remove_prefix(4);
+      } else {
+        return false;
+      }
+
+      auto range = output.find(':');
+      auto address = output.substr(0, range);
+      auto dot = address.find('.');
+      if (dot == std::string_view::npos ||
+          !parse_number(address.substr(0, dot), mapping.chip) ||
+          !parse_number(address.substr(dot + 1), mapping.channel)) {
+        return false;
+      }
+
+      if (range == std::string_view::npos) {
+        return true;
+      }
+
+      // Only PWM outputs have a pulse width range
+      auto limits = output.substr(range + 1);
+      auto colon = limits.find(':');
+      return mapping.output == output_e::pwm &&
+             colon != std::string_view::npos &&
+             parse_number(limits.substr(0, colon), mapping.min_us) &&
+             parse_number(limits.substr(colon + 1), mapping.max_us) &&
+             mapping.min_us <= mapping.max_us &&
+             mapping.max_us <= PWM_PERIOD_US;
+    }
+
+    bool write_sysfs(const std::string &path, std::string_view value) {
+      file_t fd {open(path.c_str(), O_WRONLY | O_CLOEXEC)};
+      if (fd.el < 0) {
+        return false;
+      }
+
+      return write(fd.el, value.data(), value.size()) == (ssize_t) value.size();
+    }
+
+    file_t open_pwm(const mapping_t &mapping) {
+      auto chip = "/sys/class/pwm/pwmchip"s + std::to_string(mapping.chip);
+      auto channel = chip + "/pwm" + std::to_string(mapping.channel);
+
+      if (access(channel.c_str(), F_OK)) {
+        // EBUSY means the channel is already exported
+        if (!write_sysfs(chip + "/export", std::to_string(mapping.channel)) && errno != EBUSY) {
+          BOOST_LOG(warning) << "Couldn't export ["sv << channel << "]: "sv << std::strerror(errno);
+          return {};
+        }
+      }
+
+      // The duty cycle may not exceed the period, so make sure the old one is shorter than both
+      write_sysfs(channel + "/duty_cycle", "0"sv);
+      if (!write_sysfs(channel + "/period", std::to_string(PWM_PERIOD_US * 1000)) ||
+          !write_sysfs(channel + "/enable", "1"sv)) {
+        BOOST_LOG(warning) << "Couldn't enable ["sv << channel << "]: "sv << std::strerror(errno);
+        return {};
+      }
+
+      file_t fd {open((channel + "/duty_cycle").c_str(), O_WRONLY | O_CLOEXEC)};
+      if (fd.el < 0) {
+        BOOST_LOG(warning) << "Couldn't open ["sv << channel << "/duty_cycle]: "sv << std::strerror(errno);
+      }
+
+      return fd;
+    }
+
+    file_t open_gpio(const mapping_t &mapping) {
+      auto path = "/dev/gpiochip"s + std::to_string(mapping.chip);
+      file_t chip {open(path.c_str(), O_RDWR | O_CLOEXEC)};
+      if (chip.el < 0) {
+        BOOST_LOG(warning) << "Couldn't open ["sv << path << "]: "sv << std::strerror(errno);
+        return {};
+      }
+
+      gpio_v2_line_request request {};
+      request.offsets[0] = mapping.channel;
+      request.num_lines = 1;
+      request.config.flags = GPIO_V2_LINE_FLAG_OUTPUT;
+      std::strncpy(request.consumer, "sunshine", sizeof(request.consumer) - 1);
+
+      // The line request outlives the chip fd
+      if (ioctl(chip.el, GPIO_V2_GET_LINE_IOCTL, &request) < 0) {
+        BOOST_LOG(warning) << "Couldn't request line "sv << mapping.channel << " of ["sv << path << "]: "sv << std::strerror(errno);
+        return {};
+      }
+
+      return file_t {request.fd};
+    }
+  }  // namespace
+
+  std::optional<std::vector<mapping_t>> parse_map(std::string_view map) {
+    std::vector<mapping_t> mappings;
+
+    while (!map.empty()) {
+      auto comma = map.find(',');
+      auto entry = trim(map.substr(0, comma));
+      map = comma == std::string_view::npos ? std::string_view {} : map.substr(comma + 1);
+
+      if (entry.empty()) {
+        continue;
+      }
+
+      auto equals = entry.find('=');
+      if (equals == std::string_view::npos) {
+        BOOST_LOG(error) << "Actuator mapping ["sv << entry << "] isn't <control>=<output>"sv;
+        return std::nullopt;
+      }
+
+      mapping_t mapping {};
+      mapping.min_us = 1000;
+      mapping.max_us = 2000;
+
+      if (!parse_control(trim(entry.substr(0, equals)), mapping)) {
+        BOOST_LOG(error) << "Actuator mapping ["sv << entry << "] has an unknown control"sv;
+        return std::nullopt;
+      }
+
+      if (!parse_output(trim(entry.substr(equals + 1)), mapping)) {
+        BOOST_LOG(error) << "Actuator mapping ["sv << entry << "] has an invalid output"sv;
+        return std::nullopt;
+      }
+
+      mappings.emplace_back(mapping);
+    }
+
+    return mappings;
+  }
+
+  double level(const mapping_t &mapping, const gamepad_state_t &state) {
+    auto stick = [](std::int16_t value) {
+      return (value + 32768) / 65535.0;
+    };
+
+    switch (mapping.source) {
+      case source_e::ls_x:
+        return stick(state.lsX);
+      case source_e::ls_y:
+        return stick(state.lsY);
+      case source_e::rs_x:
+        return stick(state.rsX);
+      case source_e::rs_y:
+        return stick(state.rsY);
+      case source_e::lt:
+        return state.lt / 255.0;
+      case source_e::rt:
+        return state.rt / 255.0;
+      case source_e::button:
+        return (state.buttonFlags & mapping.button) ? 1.0 : 0.0;
+    }
+
+    return 0.0;
+  }
+
+  std::uint32_t pulse_ns(const mapping_t &mapping, double level) {
+    auto us = mapping.min_us + std::clamp(level, 0.0, 1.0) * (mapping.max_us - mapping.min_us);
+    return (std::uint32_t) (us * 1000.0 + 0.5);
+  }
+
+  std::unique_ptr<sink_t> sink_t::create(const std::vector<mapping_t> &mappings) {
+    auto sink = std::make_unique<sink_t>();
+
+    for (auto &mapping : mappings) {
+      auto fd = mapping.output == output_e::pwm ? open_pwm(mapping) : open_gpio(mapping);
+      if (fd.el < 0) {
+        continue;
+      }
+
+      sink->outputs.emplace_back(output_t {mapping, std::move(fd)});
+    }
+
+    if (sink->outputs.empty()) {
+      return nullptr;
+    }
+
+    // Start from the neutral position, sticks centered and everything else released
+    sink->update(gamepad_state_t {});
+
+    BOOST_LOG(info) << "Driving "sv << sink->outputs.size() << " actuator output(s) from the first gamepad"sv;
+    return sink;
+  }
+
+  void sink_t::update(const gamepad_state_t &state) {
+    for (auto &output : outputs) {
+      auto value = level(output.mapping, state);
+
+      if (output.mapping.output == output_e::pwm) {
+        auto ns = pulse_ns(output.mapping, value);
+        if (ns == output.value) {
+          continue;
+        }
+
+        // sysfs attributes are rewritten from the start on every write
+        auto str = std::to_string(ns);
+        if (pwrite(output.fd.el, str.data(), str.size(), 0) < 0) {
+          BOOST_LOG(verbose) << "Couldn't set PWM duty cycle: "sv << std::strerror(errno);
+          continue;
+        }
+        output.value = ns;
+      } else {
+        auto high = value >= 0.5 ? 1 : 0;
+        if (high == output.value) {
+          continue;
+        }
+
+        gpio_v2_line_values values {};
+        values.bits = high;
+        values.mask = 1;
+        if (ioctl(output.fd.el, GPIO_V2_LINE_SET_VALUES_IOCTL, &values) < 0) {
+          BOOST_LOG(verbose) << "Couldn't set GPIO line: "sv << std::strerror(errno);
+          continue;
+        }
+        output.value = high;
+      }
+    }
+  }
+}  // namespace platf::actuator
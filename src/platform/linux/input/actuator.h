@@ -0,0 +1,96 @@
+/**
+ * @file src/platform/linux/input/actuator.h
+ * @brief Declarations for driving PWM and GPIO outputs straight from gamepad input.
+ */
+#pragma once
+
+// standard includes
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string_view>
+#include <vector>
+
+// local includes
+#include "src/platform/common.h"
+#include "src/platform/linux/misc.h"
+
+namespace platf::actuator {
+  // Period of the PWM outputs, the frame rate hobby servos and ESCs expect
+  constexpr std::uint32_t PWM_PERIOD_US = 20000;
+
+  enum class source_e {
+    ls_x,  ///< Left stick X axis
+    ls_y,  ///< Left stick Y axis
+    rs_x,  ///< Right stick X axis
+    rs_y,  ///< Right stick Y axis
+    lt,  ///< Left trigger
+    rt,  ///< Right trigger
+    button  ///< One of the gamepad buttons
+  };
+
+  enum class output_e {
+    pwm,  ///< A channel of /sys/class/pwm/pwmchipN
+    gpio  ///< A line of /dev/gpiochipN
+  };
+
+  struct mapping_t {
+    source_e source;
+    std::uint32_t button;  ///< Button flag, for source_e::button
+    output_e output;
+    int chip;
+    int channel;  ///< PWM channel or GPIO line offset
+    std::uint32_t min_us;  ///< PWM pulse width at the lowest input
+    std::uint32_t max_us;  ///< PWM pulse width at the highest input
+  };
+
+  /**
+   * @brief Parse the actuator map of the configuration.
+   * The map is a comma separated list of `<control>=<output>`, for example
+   * `ls_x=pwm0.0:1000:2000,rt=pwm0.1,a=gpio0.17`.
+   * Controls are `ls_x`, `ls_y`, `rs_x`, `rs_y`, `lt`, `rt` or a button name.
+   * Outputs are `pwm<chip>.<channel>[:<min_us>:<max_us>]` or `gpio<chip>.<line>`.
+   * @param map The actuator map.
+   * @return The mappings, or `std::nullopt` if the map is malformed.
+   */
+  std::optional<std::vector<mapping_t>> parse_map(std::string_view map);
+
+  /**
+   * @brief Position of the mapped control, from 0 to 1.
+   * Sticks are centered at 0.5, a GPIO output is high from 0.5 up.
+   */
+  double level(const mapping_t &mapping, const gamepad_state_t &state);
+
+  /**
+   * @brief PWM pulse width for a level, in nanoseconds.
+   */
+  std::uint32_t pulse_ns(const mapping_t &mapping, double level);
+
+  /**
+   * @brief Gamepad output sink that drives the mapped PWM and GPIO outputs.
+   * Every output is written directly from the input thread, without a virtual device in between.
+   */
+  class sink_t {
+  public:
+    /**
+     * @brief Open every output of the mappings.
+     * Outputs that can't be opened are logged and left out.
+     * @return The sink, or nullptr if no output could be opened.
+     */
+    static std::unique_ptr<sink_t> create(const std::vector<mapping_t> &mappings);
+
+    /**
+     * @brief Move the outputs to the new gamepad state, only writing the ones that changed.
+     */
+    void update(const gamepad_state_t &state);
+
+  private:
+    struct output_t {
+      mapping_t mapping;
+      file_t fd;  ///< duty_cycle of a PWM channel, or the line request of a GPIO line
+      std::int64_t value = -1;  ///< Last written pulse width or line value
+    };
+
+    std::vector<output_t> outputs;
+  };
+}  // namespace platf::actuator
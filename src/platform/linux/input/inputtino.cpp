@@ -22,7 +22,9 @@ using namespace std::literals;
 namespace platf {
 
   input_t input() {
-    return {new input_raw_t()};
+    auto raw = new input_raw_t();
+    raw->gamepad_pool = platf::gamepad::create_pool();
+    return {raw};
   }
 
   std::unique_ptr<client_input_t> allocate_client_input_context(input_t &input) {
@@ -41,6 +43,7 @@ namespace platf {
 
   void abs_mouse(input_t &input, const touch_port_t &touch_port, float x, float y) {
     auto raw = (input_raw_t *) input.get();
+    platf::mouse::flush(raw);
     platf::mouse::move_abs(raw, touch_port, x, y);
   }
 
@@ -51,21 +54,37 @@ namespace platf {
 
   void scroll(input_t &input, int high_res_distance) {
     auto raw = (input_raw_t *) input.get();
+    platf::mouse::flush(raw);
     platf::mouse::scroll(raw, high_res_distance);
   }
 
   void hscroll(input_t &input, int high_res_distance) {
     auto raw = (input_raw_t *) input.get();
+    platf::mouse::flush(raw);
     platf::mouse::hscroll(raw, high_res_distance);
   }
 
+  void flush_input(input_t &input) {
+    auto raw = (input_raw_t *) input.get();
+    platf::mouse::flush(raw);
+  }
+
+  std::uint64_t gamepad_reports_coalesced(input_t &input) {
+    // Every gamepad event is written to its uinput device as it arrives
+    return 0;
+  }
+
   void keyboard_update(input_t &input, uint16_t modcode, bool release, uint8_t flags) {
     auto raw = (input_raw_t *) input.get();
+
+    // Modifiers must reach the OS in order with the clicks they modify
+    platf::mouse::flush(raw);
     platf::keyboard::update(raw, modcode, release, flags);
   }
 
   void unicode(input_t &input, char *utf8, int size) {
     auto raw = (input_raw_t *) input.get();
+    platf::mouse::flush(raw);
     platf::keyboard::unicode(raw, utf8, size);
   }
 
@@ -79,6 +98,11 @@ namespace platf {
     platf::pen::update(raw, touch_port, pen);
   }
 
+  void flush_client_input(client_input_t *input) {
+    auto raw = (client_input_raw_t *) input;
+    platf::touch::flush(raw);
+  }
+
   int alloc_gamepad(input_t &input, const gamepad_id_t &id, const gamepad_arrival_t &metadata, feedback_queue_t feedback_queue) {
     auto raw = (input_raw_t *) input.get();
     return platf::gamepad::alloc(raw, id, metadata, feedback_queue);
@@ -0,0 +1,91 @@
+/**
+ * @file src/platform/linux/input/inputtino_batch.cpp
+ * @brief Definitions for writing batches of input events to a virtual device.
+ */
+// standard includes
+#include <cerrno>
+#include <climits>
+
+// platform includes
+#include <fcntl.h>
+#include <sys/ioctl.h>
+
+// local includes
+#include "inputtino_batch.h"
+#include "src/logging.h"
+
+using namespace std::literals;
+
+namespace platf {
+  namespace {
+    bool test_bit(const std::vector<unsigned long> &bits, unsigned int bit) {
+      constexpr auto bits_per_long = sizeof(unsigned long) * CHAR_BIT;
+      return bit / bits_per_long < bits.size() && (bits[bit / bits_per_long] >> (bit % bits_per_long)) & 1;
+    }
+
+    bool supports(int fd, unsigned int type, unsigned int code) {
+      constexpr auto bits_per_long = sizeof(unsigned long) * CHAR_BIT;
+      std::vector<unsigned long> bits((KEY_MAX + bits_per_long) / bits_per_long);
+
+      auto len = ioctl(fd, EVIOCGBIT(type, bits.size() * sizeof(unsigned long)), bits.data());
+      return len > 0 && test_bit(bits, code);
+    }
+  }  // namespace
+
+  bool evdev_batch_t::open(const std::vector<std::string> &nodes, unsigned int type, unsigned int code) {
+    for (auto &node : nodes) {
+      file_t node_fd {::open(node.c_str(), O_WRONLY | O_NONBLOCK | O_CLOEXEC)};
+      if (node_fd.el < 0) {
+        // Without a udev rule granting access, the node is only writable by root
+        BOOST_LOG(debug) << "Couldn't open ["sv << node << "] to batch input events: "sv << errno;
+        continue;
+      }
+
+      if (supports(node_fd.el, type, code)) {
+        fd = std::move(node_fd);
+        return true;
+      }
+    }
+
+    return false;
+  }
+
+  std::optional<input_absinfo> evdev_batch_t::absinfo(unsigned int code) const {
+    input_absinfo info {};
+    if (fd.el < 0 || !supports(fd.el, EV_ABS, code) || ioctl(fd.el, EVIOCGABS(code), &info) < 0) {
+      return std::nullopt;
+    }
+
+    return info;
+  }
+
+  void evdev_batch_t::emit(std::uint16_t type, std::uint16_t code, std::int32_t value) {
+    input_event event {};
+    event.type = type;
+    event.code = code;
+    event.value = value;
+    events.push_back(event);
+  }
+
+  void evdev_batch_t::sync() {
+    if (!events.empty() && events.back().type != EV_SYN) {
+      emit(EV_SYN, SYN_REPORT, 0);
+    }
+  }
+
+  void evdev_batch_t::flush() {
+    if (events.empty()) {
+      return;
+    }
+
+    sync();
+
+    // The kernel takes any number of whole events in one write()
+    auto bytes = events.size() * sizeof(input_event);
+    if (write(fd.el, events.data(), bytes) != (ssize_t) bytes) {
+      BOOST_LOG(warning) << "Couldn't write "sv << events.size() << " input events: "sv << errno;
+    }
+
+    events.clear();
+  }
+}  // namespace platf
@@ -0,0 +1,66 @@
+/**
+ * @file src/platform/linux/input/inputtino_batch.h
+ * @brief Declarations for writing batches of input events to a virtual device.
+ */
+#pragma once
+
+// standard includes
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+// platform includes
+#include <linux/input.h>
+
+// local includes
+#include "src/platform/linux/misc.h"
+
+namespace platf {
+  /**
+   * @brief Input events for one virtual device, held back until they can go out in a single write().
+   * The events are injected through the evdev node of the device, inputtino issues one write() per event.
+   */
+  class evdev_batch_t {
+  public:
+    /**
+     * @brief Open the first of the event nodes of a device that reports an event code.
+     * @param nodes The event nodes of the device, as returned by inputtino.
+     * @param type Event type the node must support, e.g. `EV_REL`.
+     * @param code Event code the node must support, e.g. `REL_X`.
+     * @return `true` if a node could be opened for writing.
+     */
+    bool open(const std::vector<std::string> &nodes, unsigned int type, unsigned int code);
+
+    explicit operator bool() const {
+      return fd.el >= 0;
+    }
+
+    /**
+     * @brief Get the range the device reports an absolute axis in.
+     * @param code Axis code, e.g. `ABS_MT_POSITION_X`.
+     * @return The range, or `std::nullopt` if the node isn't open or lacks the axis.
+     */
+    std::optional<input_absinfo> absinfo(unsigned int code) const;
+
+    /**
+     * @brief Queue an event, it goes out with the next flush().
+     */
+    void emit(std::uint16_t type, std::uint16_t code, std::int32_t value);
+
+    /**
+     * @brief End the events queued so far with a `SYN_REPORT`, a button press and release can't share one report.
+     */
+    void sync();
+
+    /**
+     * @brief Write every queued event with a single write().
+     * Ends the batch with a `SYN_REPORT` if it doesn't already.
+     */
+    void flush();
+
+  private:
+    file_t fd;
+    std::vector<input_event> events;
+  };
+}  // namespace platf
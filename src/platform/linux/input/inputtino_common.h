@@ -4,12 +4,19 @@
  */
 #pragma once
 
+// standard includes
+#include <map>
+#include <optional>
+#include <vector>
+
 // lib includes
 #include <boost/locale.hpp>
 #include <inputtino/input.hpp>
 #include <libevdev/libevdev.h>
 
 // local includes
+#include "actuator.h"
+#include "inputtino_batch.h"
 #include "src/config.h"
 #include "src/logging.h"
 #include "src/platform/common.h"
@@ -18,6 +25,43 @@
 using namespace std::literals;
 
 namespace platf {
+  namespace gamepad {
+    struct pool_t;
+  }  // namespace gamepad
+
+  namespace touch {
+    struct contact_t {
+      int slot;
+      int tracking_id;
+      int x;
+      int y;
+      int pressure;
+    };
+
+    /**
+     * @brief Multitouch state of a touch screen whose contacts are written through its event node.
+     */
+    struct frame_t {
+      // Pointers in contact or hovering, by pointer ID
+      std::map<std::uint32_t, contact_t> contacts;
+
+      // Slots whose tracking ID changed since the last SYN_REPORT, a contact can't begin and end in the same report
+      std::vector<bool> changed_slots;
+
+      // Events were queued since the last SYN_REPORT
+      bool dirty = false;
+
+      int current_slot = -1;
+      int next_tracking_id = 0;
+
+      // Ranges of the axes, as the device reports them
+      input_absinfo x;
+      input_absinfo y;
+      input_absinfo tracking_id;
+      std::optional<input_absinfo> pressure;
+      std::optional<input_absinfo> orientation;
+    };
+  }  // namespace touch
 
   using joypads_t = std::variant<inputtino::XboxOneJoypad, inputtino::SwitchJoypad, inputtino::PS5Joypad>;
 
@@ -48,6 +92,12 @@ namespace platf {
       if (!keyboard) {
         BOOST_LOG(warning) << "Unable to create virtual keyboard: " << keyboard.getErrorMessage();
       }
+
+      if (!config::input.actuator_map.empty()) {
+        if (auto mappings = actuator::parse_map(config::input.actuator_map)) {
+          actuators = actuator::sink_t::create(*mappings);
+        }
+      }
     }
 
     ~input_raw_t() = default;
@@ -56,11 +106,22 @@ namespace platf {
     inputtino::Result<inputtino::Mouse> mouse;
     inputtino::Result<inputtino::Keyboard> keyboard;
 
+    // Relative motion and buttons of the mouse, flushed once the input queue is drained
+    evdev_batch_t mouse_batch;
+    int mouse_batch_open_attempts = 0;
+    std::chrono::steady_clock::time_point mouse_batch_next_open;
+
     /**
      * A list of gamepads that are currently connected.
      * The pointer is shared because that state will be shared with background threads that deal with rumble and LED
      */
     std::vector<std::shared_ptr<joypad_state>> gamepads;
+
+    // Virtual gamepads created ahead of time, nullptr unless gamepad_pool_size is set
+    std::shared_ptr<gamepad::pool_t> gamepad_pool;
+
+    // PWM/GPIO outputs driven by the first gamepad
+    std::unique_ptr<actuator::sink_t> actuators;
   };
 
   struct client_input_raw_t: public client_input_t {
@@ -94,6 +155,12 @@ namespace platf {
     // for each client.
     inputtino::Result<inputtino::TouchScreen> touch;
     inputtino::Result<inputtino::PenTablet> pen;
+
+    // Touch contacts, written as one multitouch frame once the input queue is drained
+    evdev_batch_t touch_batch;
+    int touch_batch_open_attempts = 0;
+    std::chrono::steady_clock::time_point touch_batch_next_open;
+    touch::frame_t touch_frame;
   };
 
   inline float deg2rad(float degree) {
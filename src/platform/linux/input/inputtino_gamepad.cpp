@@ -2,6 +2,13 @@
  * @file src/platform/linux/input/inputtino_gamepad.cpp
  * @brief Definitions for inputtino gamepad input handling.
  */
+// standard includes
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+
 // lib includes
 #include <boost/locale.hpp>
 #include <inputtino/input.hpp>
@@ -53,6 +60,260 @@ namespace platf::gamepad {
     return inputtino::PS5Joypad::create({.name = "Sunshine PS5 (virtual) pad", .vendor_id = 0x054C, .product_id = 0x0CE6, .version = 0x8111, .device_phys = device_mac, .device_uniq = device_mac});
   }
 
+  /**
+   * @brief Create a virtual gamepad.
+   * @param type The type of gamepad.
+   * @param index The gamepad index the DS5 MAC is derived from, -1 for a random MAC.
+   * @return The gamepad, or nullptr if it couldn't be created.
+   */
+  std::unique_ptr<joypads_t> create(ControllerType type, int index) {
+    switch (type) {
+      case XboxOneWired:
+        {
+          auto xOne = create_xbox_one();
+          if (!xOne) {
+            BOOST_LOG(warning) << "Unable to create virtual Xbox One controller: " << xOne.getErrorMessage();
+            return nullptr;
+          }
+          return std::make_unique<joypads_t>(std::move(*xOne));
+        }
+      case SwitchProWired:
+        {
+          auto switchPro = create_switch();
+          if (!switchPro) {
+            BOOST_LOG(warning) << "Unable to create virtual Switch Pro controller: " << switchPro.getErrorMessage();
+            return nullptr;
+          }
+          return std::make_unique<joypads_t>(std::move(*switchPro));
+        }
+      case DualSenseWired:
+        {
+          auto ds5 = create_ds5(index);
+          if (!ds5) {
+            BOOST_LOG(warning) << "Unable to create virtual DualShock 5 controller: " << ds5.getErrorMessage();
+            return nullptr;
+          }
+          return std::make_unique<joypads_t>(std::move(*ds5));
+        }
+    }
+    return nullptr;
+  }
+
+  /**
+   * @brief The kind of gamepad a pool slot holds.
+   */
+  struct pool_key_t {
+    ControllerType type;
+    int index;  ///< Gamepad index the device is reserved for, -1 if any gamepad can use it
+
+    bool operator==(const pool_key_t &) const = default;
+  };
+
+  /**
+   * @brief A virtual gamepad waiting in the pool.
+   */
+  struct pooled_t {
+    pool_key_t key;
+    std::unique_ptr<joypads_t> joypad;
+  };
+
+  struct pool_t {
+    std::vector<pool_key_t> slots;  ///< What the pool should hold, a key is repeated for each device of that kind
+
+    std::mutex mutex;
+    std::vector<pooled_t> devices;
+    bool filling = false;
+  };
+
+  /**
+   * @brief Find a slot of the pool that has no device yet.
+   * @param pool The pool, its mutex locked.
+   * @return The key of the slot.
+   */
+  std::optional<pool_key_t> missing(const pool_t &pool) {
+    std::vector<pool_key_t> held;
+    for (auto &device : pool.devices) {
+      held.emplace_back(device.key);
+    }
+
+    for (auto &slot : pool.slots) {
+      auto it = std::find(std::begin(held), std::end(held), slot);
+      if (it == std::end(held)) {
+        return slot;
+      }
+      held.erase(it);
+    }
+
+    return std::nullopt;
+  }
+
+  /**
+   * @brief Create the devices the pool is missing on a background thread.
+   * @param pool The pool.
+   */
+  void fill(const std::shared_ptr<pool_t> &pool) {
+    {
+      std::lock_guard lg {pool->mutex};
+      if (pool->filling || !missing(*pool)) {
+        return;
+      }
+      pool->filling = true;
+    }
+
+    // Creating a device waits for udev, which takes far longer than the input thread can afford
+    std::thread {[weak = std::weak_ptr {pool}]() {
+      while (true) {
+        std::optional<pool_key_t> key;
+        if (auto pool = weak.lock()) {
+          std::lock_guard lg {pool->mutex};
+          key = missing(*pool);
+          if (!key) {
+            pool->filling = false;
+            return;
+          }
+        } else {
+          return;
+        }
+
+        auto joypad = create(key->type, key->index);
+
+        auto pool = weak.lock();
+        if (!pool) {
+          return;
+        }
+
+        std::lock_guard lg {pool->mutex};
+        if (!joypad) {
+          // Retrying won't help until uinput is fixed, the next gamepad to arrive triggers a new attempt
+          pool->filling = false;
+          return;
+        }
+        pool->devices.push_back({*key, std::move(joypad)});
+      }
+    }}.detach();
+  }
+
+  /**
+   * @brief Get the pool key of a device created for a gamepad.
+   * @param joypad The device.
+   * @param nr The gamepad index it was created for.
+   * @return The key, or std::nullopt if the device can't be handed to another gamepad.
+   */
+  std::optional<pool_key_t> key_of(const joypads_t &joypad, int nr) {
+    if (std::holds_alternative<inputtino::XboxOneJoypad>(joypad)) {
+      return pool_key_t {XboxOneWired, -1};
+    }
+    if (std::holds_alternative<inputtino::SwitchJoypad>(joypad)) {
+      return pool_key_t {SwitchProWired, -1};
+    }
+
+    // A random MAC is meant to differ between gamepads, so the device can't be reused
+    if (config::input.ds5_inputtino_randomize_mac) {
+      return std::nullopt;
+    }
+    return pool_key_t {DualSenseWired, nr};
+  }
+
+  std::shared_ptr<pool_t> create_pool() {
+    auto size = config::input.gamepad_pool_size;
+    if (size <= 0) {
+      return nullptr;
+    }
+
+    auto pool = std::make_shared<pool_t>();
+    auto add = [&](ControllerType type, bool per_index) {
+      for (int x = 0; x < size; ++x) {
+        pool->slots.push_back({type, per_index ? x : -1});
+      }
+    };
+
+    auto any = config::input.gamepad == "auto"sv;
+    if (any || config::input.gamepad == "xone"sv) {
+      add(XboxOneWired, false);
+    }
+    if (any || config::input.gamepad == "ds5"sv) {
+      add(DualSenseWired, !config::input.ds5_inputtino_randomize_mac);
+    }
+    if (any || config::input.gamepad == "switch"sv) {
+      add(SwitchProWired, false);
+    }
+
+    BOOST_LOG(info) << "Creating "sv << pool->slots.size() << " virtual gamepads ahead of time"sv;
+    fill(pool);
+
+    return pool;
+  }
+
+  /**
+   * @brief Take a device of the pool, and have the pool create a replacement.
+   * @param raw The global input context.
+   * @param type The type of gamepad.
+   * @param nr The gamepad index.
+   * @return The device, or nullptr if the pool has none that fits.
+   */
+  std::unique_ptr<joypads_t> take(input_raw_t *raw, ControllerType type, int nr) {
+    if (!raw->gamepad_pool) {
+      return nullptr;
+    }
+
+    std::unique_ptr<joypads_t> joypad;
+    {
+      std::lock_guard lg {raw->gamepad_pool->mutex};
+
+      auto &devices = raw->gamepad_pool->devices;
+      auto it = std::find_if(std::begin(devices), std::end(devices), [&](const pooled_t &device) {
+        return device.key.type == type && (device.key.index == -1 || device.key.index == nr);
+      });
+      if (it != std::end(devices)) {
+        joypad = std::move(it->joypad);
+        devices.erase(it);
+      }
+    }
+
+    fill(raw->gamepad_pool);
+
+    return joypad;
+  }
+
+  /**
+   * @brief Hand a device back to the pool, if the pool is missing a device of its kind.
+   * @param pool The pool.
+   * @param joypad The device of a gamepad that was freed.
+   * @param nr The gamepad index it was created for.
+   */
+  void recycle(const std::shared_ptr<pool_t> &pool, std::unique_ptr<joypads_t> joypad, int nr) {
+    auto key = joypad ? key_of(*joypad, nr) : std::nullopt;
+    if (key) {
+      // Release everything and stop reporting feedback to the client that owned it
+      std::visit([](auto &gc) {
+        gc.set_pressed_buttons(0);
+        gc.set_stick(inputtino::Joypad::LS, 0, 0);
+        gc.set_stick(inputtino::Joypad::RS, 0, 0);
+        gc.set_triggers(0, 0);
+        gc.set_on_rumble([](int, int) {});
+      },
+                 *joypad);
+
+      if (auto ds5 = std::get_if<inputtino::PS5Joypad>(joypad.get())) {
+        ds5->set_on_led([](int, int, int) {});
+        ds5->set_on_trigger_effect([](const inputtino::PS5Joypad::TriggerEffect &) {});
+      }
+
+      std::lock_guard lg {pool->mutex};
+      auto wanted = std::count(std::begin(pool->slots), std::end(pool->slots), *key);
+      auto held = std::count_if(std::begin(pool->devices), std::end(pool->devices), [&](const pooled_t &device) {
+        return device.key == *key;
+      });
+      if (held < wanted) {
+        pool->devices.push_back({*key, std::move(joypad)});
+      }
+    }
+
+    // Devices that weren't taken back are destroyed here, outside of the lock
+    joypad.reset();
+    fill(pool);
+  }
+
   int alloc(input_raw_t *raw, const gamepad_id_t &id, const gamepad_arrival_t &metadata, feedback_queue_t feedback_queue) {
     ControllerType selectedGamepadType;
 
@@ -116,76 +377,64 @@ namespace platf::gamepad {
       gamepad->last_rumble = msg;
     };
 
-    switch (selectedGamepadType) {
-      case XboxOneWired:
-        {
-          auto xOne = create_xbox_one();
-          if (xOne) {
-            (*xOne).set_on_rumble(on_rumble_fn);
-            gamepad->joypad = std::make_unique<joypads_t>(std::move(*xOne));
-            raw->gamepads[id.globalIndex] = std::move(gamepad);
-            return 0;
-          } else {
-            BOOST_LOG(warning) << "Unable to create virtual Xbox One controller: " << xOne.getErrorMessage();
-            return -1;
-          }
-        }
-      case SwitchProWired:
-        {
-          auto switchPro = create_switch();
-          if (switchPro) {
-            (*switchPro).set_on_rumble(on_rumble_fn);
-            gamepad->joypad = std::make_unique<joypads_t>(std::move(*switchPro));
-            raw->gamepads[id.globalIndex] = std::move(gamepad);
-            return 0;
-          } else {
-            BOOST_LOG(warning) << "Unable to create virtual Switch Pro controller: " << switchPro.getErrorMessage();
-            return -1;
-          }
-        }
-      case DualSenseWired:
-        {
-          auto ds5 = create_ds5(id.globalIndex);
-          if (ds5) {
-            (*ds5).set_on_rumble(on_rumble_fn);
-            (*ds5).set_on_led([feedback_queue, idx = id.clientRelativeIndex, gamepad](int r, int g, int b) {
-              // Don't resend duplicate LED data
-              if (gamepad->last_rgb_led.type == platf::gamepad_feedback_e::set_rgb_led && gamepad->last_rgb_led.data.rgb_led.r == r && gamepad->last_rgb_led.data.rgb_led.g == g && gamepad->last_rgb_led.data.rgb_led.b == b) {
-                return;
-              }
-
-              auto msg = gamepad_feedback_msg_t::make_rgb_led(idx, r, g, b);
-              feedback_queue->raise(msg);
-              gamepad->last_rgb_led = msg;
-            });
-
-            (*ds5).set_on_trigger_effect([feedback_queue, idx = id.clientRelativeIndex](const inputtino::PS5Joypad::TriggerEffect &trigger_effect) {
-              feedback_queue->raise(gamepad_feedback_msg_t::make_adaptive_triggers(idx, trigger_effect.event_flags, trigger_effect.type_left, trigger_effect.type_right, trigger_effect.left, trigger_effect.right));
-            });
-
-            // Activate the motion sensors
-            feedback_queue->raise(gamepad_feedback_msg_t::make_motion_event_state(id.clientRelativeIndex, LI_MOTION_TYPE_ACCEL, 100));
-            feedback_queue->raise(gamepad_feedback_msg_t::make_motion_event_state(id.clientRelativeIndex, LI_MOTION_TYPE_GYRO, 100));
-
-            gamepad->joypad = std::make_unique<joypads_t>(std::move(*ds5));
-            raw->gamepads[id.globalIndex] = std::move(gamepad);
-            return 0;
-          } else {
-            BOOST_LOG(warning) << "Unable to create virtual DualShock 5 controller: " << ds5.getErrorMessage();
-            return -1;
-          }
+    auto joypad = take(raw, selectedGamepadType, id.globalIndex);
+    if (joypad) {
+      BOOST_LOG(debug) << "Gamepad " << id.globalIndex << " uses a virtual device created ahead of time"sv;
+    } else {
+      joypad = create(selectedGamepadType, id.globalIndex);
+      if (!joypad) {
+        return -1;
+      }
+    }
+
+    std::visit([&on_rumble_fn](auto &gc) {
+      gc.set_on_rumble(on_rumble_fn);
+    },
+               *joypad);
+
+    if (auto ds5 = std::get_if<inputtino::PS5Joypad>(joypad.get())) {
+      ds5->set_on_led([feedback_queue, idx = id.clientRelativeIndex, gamepad](int r, int g, int b) {
+        // Don't resend duplicate LED data
+        if (gamepad->last_rgb_led.type == platf::gamepad_feedback_e::set_rgb_led && gamepad->last_rgb_led.data.rgb_led.r == r && gamepad->last_rgb_led.data.rgb_led.g == g && gamepad->last_rgb_led.data.rgb_led.b == b) {
+          return;
         }
+
+        auto msg = gamepad_feedback_msg_t::make_rgb_led(idx, r, g, b);
+        feedback_queue->raise(msg);
+        gamepad->last_rgb_led = msg;
+      });
+
+      ds5->set_on_trigger_effect([feedback_queue, idx = id.clientRelativeIndex](const inputtino::PS5Joypad::TriggerEffect &trigger_effect) {
+        feedback_queue->raise(gamepad_feedback_msg_t::make_adaptive_triggers(idx, trigger_effect.event_flags, trigger_effect.type_left, trigger_effect.type_right, trigger_effect.left, trigger_effect.right));
+      });
+
+      // Activate the motion sensors
+      feedback_queue->raise(gamepad_feedback_msg_t::make_motion_event_state(id.clientRelativeIndex, LI_MOTION_TYPE_ACCEL, 100));
+      feedback_queue->raise(gamepad_feedback_msg_t::make_motion_event_state(id.clientRelativeIndex, LI_MOTION_TYPE_GYRO, 100));
     }
-    return -1;
+
+    gamepad->joypad = std::move(joypad);
+    raw->gamepads[id.globalIndex] = std::move(gamepad);
+    return 0;
   }
 
   void free(input_raw_t *raw, int nr) {
-    // This will call the destructor which in turn will stop the background threads for rumble and LED (and ultimately remove the joypad device)
-    raw->gamepads[nr]->joypad.reset();
+    auto joypad = std::move(raw->gamepads[nr]->joypad);
     raw->gamepads[nr].reset();
+
+    // Unless the pool takes it back, this will call the destructor which in turn will stop the background threads
+    // for rumble and LED (and ultimately remove the joypad device)
+    if (raw->gamepad_pool) {
+      recycle(raw->gamepad_pool, std::move(joypad), nr);
+    }
   }
 
   void update(input_raw_t *raw, int nr, const gamepad_state_t &gamepad_state) {
+    // The actuators don't need the virtual gamepad, they work even when it couldn't be created
+    if (nr == 0 && raw->actuators) {
+      raw->actuators->update(gamepad_state);
+    }
+
     auto gamepad = raw->gamepads[nr];
     if (!gamepad) {
       return;
@@ -23,6 +23,13 @@ namespace platf::gamepad {
     SwitchProWired  ///< Switch Pro Wired Controller
   };
 
+  /**
+   * @brief Create the pool of virtual gamepads that are handed out as soon as a gamepad arrives.
+   * The pool holds gamepad_pool_size devices of each type the gamepad setting can pick, and is filled in the background.
+   * @return The pool, or nullptr if gamepad_pool_size is 0.
+   */
+  std::shared_ptr<pool_t> create_pool();
+
   int alloc(input_raw_t *raw, const gamepad_id_t &id, const gamepad_arrival_t &metadata, feedback_queue_t feedback_queue);
 
   void free(input_raw_t *raw, int nr);
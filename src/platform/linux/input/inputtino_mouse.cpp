@@ -18,13 +18,55 @@
 using namespace std::literals;
 
 namespace platf::mouse {
+  // The event nodes show up once udev has processed the new device, so opening them is retried for a while
+  constexpr auto BATCH_OPEN_ATTEMPTS = 10;
+  constexpr auto BATCH_OPEN_INTERVAL = 1s;
+
+  /**
+   * @brief Get the batch for the relative mouse device.
+   * @return The batch, or nullptr if events have to go through inputtino one at a time.
+   */
+  static evdev_batch_t *rel_batch(input_raw_t *raw) {
+    if (!raw->mouse_batch && raw->mouse_batch_open_attempts < BATCH_OPEN_ATTEMPTS) {
+      auto now = std::chrono::steady_clock::now();
+      if (now >= raw->mouse_batch_next_open) {
+        raw->mouse_batch_next_open = now + BATCH_OPEN_INTERVAL;
+        if (raw->mouse_batch.open((*raw->mouse).get_nodes(), EV_REL, REL_X)) {
+          BOOST_LOG(debug) << "Batching relative mouse input"sv;
+        } else if (++raw->mouse_batch_open_attempts == BATCH_OPEN_ATTEMPTS) {
+          BOOST_LOG(info) << "Mouse event node isn't writable, relative mouse input won't be batched"sv;
+        }
+      }
+    }
+
+    return raw->mouse_batch ? &raw->mouse_batch : nullptr;
+  }
 
   void move(input_raw_t *raw, int deltaX, int deltaY) {
     if (raw->mouse) {
+      if (auto batch = rel_batch(raw)) {
+        if (deltaX) {
+          batch->emit(EV_REL, REL_X, deltaX);
+        }
+        if (deltaY) {
+          batch->emit(EV_REL, REL_Y, deltaY);
+        }
+
+        // Each move stays a report of its own, as if inputtino had written it
+        batch->sync();
+        return;
+      }
+
       (*raw->mouse).move(deltaX, deltaY);
     }
   }
 
+  void flush(input_raw_t *raw) {
+    if (raw->mouse_batch) {
+      raw->mouse_batch.flush();
+    }
+  }
+
   void move_abs(input_raw_t *raw, const touch_port_t &touch_port, float x, float y) {
     if (raw->mouse) {
       (*raw->mouse).move_abs(x, y, touch_port.width, touch_port.height);
@@ -34,26 +76,38 @@ namespace platf::mouse {
   void button(input_raw_t *raw, int button, bool release) {
     if (raw->mouse) {
       inputtino::Mouse::MOUSE_BUTTON btn_type;
+      std::uint16_t code;
       switch (button) {
         case BUTTON_LEFT:
           btn_type = inputtino::Mouse::LEFT;
+          code = BTN_LEFT;
           break;
         case BUTTON_MIDDLE:
           btn_type = inputtino::Mouse::MIDDLE;
+          code = BTN_MIDDLE;
           break;
         case BUTTON_RIGHT:
           btn_type = inputtino::Mouse::RIGHT;
+          code = BTN_RIGHT;
           break;
         case BUTTON_X1:
           btn_type = inputtino::Mouse::SIDE;
+          code = BTN_SIDE;
           break;
         case BUTTON_X2:
           btn_type = inputtino::Mouse::EXTRA;
+          code = BTN_EXTRA;
           break;
         default:
           BOOST_LOG(warning) << "Unknown mouse button: " << button;
           return;
       }
+      if (auto batch = rel_batch(raw)) {
+        batch->emit(EV_KEY, code, release ? 0 : 1);
+        batch->sync();
+        return;
+      }
+
       if (release) {
         (*raw->mouse).release(btn_type);
       } else {
@@ -25,5 +25,10 @@ namespace platf::mouse {
 
   void hscroll(input_raw_t *raw, int high_res_distance);
 
+  /**
+   * @brief Write the relative motion and button events held back since the last flush.
+   */
+  void flush(input_raw_t *raw);
+
   util::point_t get_location(input_raw_t *raw);
 }  // namespace platf::mouse
@@ -2,6 +2,10 @@
  * @file src/platform/linux/input/inputtino_touch.cpp
  * @brief Definitions for inputtino touch input handling.
  */
+// standard includes
+#include <algorithm>
+#include <cmath>
+
 // lib includes
 #include <boost/locale.hpp>
 #include <inputtino/input.hpp>
@@ -18,39 +22,252 @@
 using namespace std::literals;
 
 namespace platf::touch {
+  // The event nodes show up once udev has processed the new device, so opening them is retried for a while
+  constexpr auto BATCH_OPEN_ATTEMPTS = 10;
+  constexpr auto BATCH_OPEN_INTERVAL = 1s;
+
+  /**
+   * @brief Convert our 0..360 range to -90..90 relative to Y axis.
+   */
+  static int orientation(std::uint16_t rotation) {
+    int adjusted_angle = rotation;
+
+    if (adjusted_angle > 90 && adjusted_angle < 270) {
+      // Lower hemisphere
+      adjusted_angle = 180 - adjusted_angle;
+    }
+
+    // Wrap the value if it's out of range
+    if (adjusted_angle > 90) {
+      adjusted_angle -= 360;
+    } else if (adjusted_angle < -90) {
+      adjusted_angle += 360;
+    }
+
+    return adjusted_angle;
+  }
+
+  static int scale(const input_absinfo &range, float value) {
+    return range.minimum + (int) std::lround(std::clamp(value, 0.0f, 1.0f) * (range.maximum - range.minimum));
+  }
+
+  /**
+   * @brief Get the batch for the touch screen.
+   * inputtino and the batch each keep their own slots, so the node is only opened while no contact is down.
+   * @return The batch, or nullptr if contacts have to go through inputtino one at a time.
+   */
+  static evdev_batch_t *mt_batch(client_input_raw_t *raw) {
+    auto &frame = raw->touch_frame;
+    if (!raw->touch_batch && raw->touch_batch_open_attempts < BATCH_OPEN_ATTEMPTS && frame.contacts.empty()) {
+      auto now = std::chrono::steady_clock::now();
+      if (now >= raw->touch_batch_next_open) {
+        raw->touch_batch_next_open = now + BATCH_OPEN_INTERVAL;
+        if (raw->touch_batch.open((*raw->touch).get_nodes(), EV_ABS, ABS_MT_SLOT)) {
+          auto slot = raw->touch_batch.absinfo(ABS_MT_SLOT);
+          auto x = raw->touch_batch.absinfo(ABS_MT_POSITION_X);
+          auto y = raw->touch_batch.absinfo(ABS_MT_POSITION_Y);
+          auto tracking_id = raw->touch_batch.absinfo(ABS_MT_TRACKING_ID);
+          if (slot && x && y && tracking_id) {
+            frame.changed_slots.assign(slot->maximum + 1, false);
+            frame.x = *x;
+            frame.y = *y;
+            frame.tracking_id = *tracking_id;
+            frame.pressure = raw->touch_batch.absinfo(ABS_MT_PRESSURE);
+            frame.orientation = raw->touch_batch.absinfo(ABS_MT_ORIENTATION);
+
+            // inputtino may have left the device on any slot
+            frame.current_slot = -1;
+
+            BOOST_LOG(debug) << "Batching touch input over "sv << frame.changed_slots.size() << " slots"sv;
+          } else {
+            BOOST_LOG(info) << "Touch event node lacks the multitouch axes, touch input won't be batched"sv;
+            raw->touch_batch = evdev_batch_t {};
+            raw->touch_batch_open_attempts = BATCH_OPEN_ATTEMPTS;
+          }
+        } else if (++raw->touch_batch_open_attempts == BATCH_OPEN_ATTEMPTS) {
+          BOOST_LOG(info) << "Touch event node isn't writable, touch input won't be batched"sv;
+        }
+      }
+    }
+
+    return raw->touch_batch ? &raw->touch_batch : nullptr;
+  }
+
+  /**
+   * @brief End the multitouch frame queued so far with a `SYN_REPORT`.
+   * The single touch axes and the finger count follow the contacts, like input_mt_report_pointer_emulation() in the kernel.
+   */
+  static void end_report(client_input_raw_t *raw) {
+    auto &frame = raw->touch_frame;
+    auto &batch = raw->touch_batch;
+    if (!frame.dirty) {
+      return;
+    }
+
+    // The kernel drops the events whose value didn't change, or that the device doesn't report
+    auto count = frame.contacts.size();
+    batch.emit(EV_KEY, BTN_TOUCH, count > 0);
+    batch.emit(EV_KEY, BTN_TOOL_FINGER, count == 1);
+    batch.emit(EV_KEY, BTN_TOOL_DOUBLETAP, count == 2);
+    batch.emit(EV_KEY, BTN_TOOL_TRIPLETAP, count == 3);
+    batch.emit(EV_KEY, BTN_TOOL_QUADTAP, count == 4);
+    batch.emit(EV_KEY, BTN_TOOL_QUINTTAP, count >= 5);
+
+    // Single touch follows the oldest contact
+    auto oldest = std::min_element(std::begin(frame.contacts), std::end(frame.contacts), [](const auto &l, const auto &r) {
+      return l.second.tracking_id < r.second.tracking_id;
+    });
+    if (oldest != std::end(frame.contacts)) {
+      batch.emit(EV_ABS, ABS_X, oldest->second.x);
+      batch.emit(EV_ABS, ABS_Y, oldest->second.y);
+      if (frame.pressure) {
+        batch.emit(EV_ABS, ABS_PRESSURE, oldest->second.pressure);
+      }
+    }
+
+    batch.sync();
+
+    std::fill(std::begin(frame.changed_slots), std::end(frame.changed_slots), false);
+    frame.dirty = false;
+  }
+
+  static void select_slot(client_input_raw_t *raw, int slot) {
+    auto &frame = raw->touch_frame;
+    if (frame.current_slot != slot) {
+      raw->touch_batch.emit(EV_ABS, ABS_MT_SLOT, slot);
+      frame.current_slot = slot;
+    }
+  }
+
+  static void place_contact(client_input_raw_t *raw, const touch_input_t &touch) {
+    auto &frame = raw->touch_frame;
+    auto &batch = raw->touch_batch;
+
+    auto it = frame.contacts.find(touch.pointerId);
+    if (it == std::end(frame.contacts)) {
+      std::vector<bool> used(frame.changed_slots.size());
+      for (auto &[_, contact] : frame.contacts) {
+        used[contact.slot] = true;
+      }
+
+      auto free_slot = std::find(std::begin(used), std::end(used), false);
+      if (free_slot == std::end(used)) {
+        BOOST_LOG(warning) << "No free touch slot for pointer "sv << touch.pointerId;
+        return;
+      }
+      int slot = free_slot - std::begin(used);
+
+      // A contact that left this slot in the current report must be seen lifted first
+      if (frame.changed_slots[slot]) {
+        end_report(raw);
+      }
+
+      contact_t contact {};
+      contact.slot = slot;
+      contact.tracking_id = frame.next_tracking_id;
+      frame.next_tracking_id = frame.next_tracking_id < frame.tracking_id.maximum ? frame.next_tracking_id + 1 : 0;
+      it = frame.contacts.emplace(touch.pointerId, contact).first;
+
+      select_slot(raw, slot);
+      batch.emit(EV_ABS, ABS_MT_TRACKING_ID, contact.tracking_id);
+      frame.changed_slots[slot] = true;
+    } else {
+      select_slot(raw, it->second.slot);
+    }
+
+    auto &contact = it->second;
+    contact.x = scale(frame.x, touch.x);
+    contact.y = scale(frame.y, touch.y);
+    batch.emit(EV_ABS, ABS_MT_POSITION_X, contact.x);
+    batch.emit(EV_ABS, ABS_MT_POSITION_Y, contact.y);
+
+    if (frame.pressure) {
+      contact.pressure = scale(*frame.pressure, touch.pressureOrDistance);
+      batch.emit(EV_ABS, ABS_MT_PRESSURE, contact.pressure);
+    }
+    if (frame.orientation && touch.rotation != LI_ROT_UNKNOWN) {
+      batch.emit(EV_ABS, ABS_MT_ORIENTATION, std::clamp(orientation(touch.rotation), frame.orientation->minimum, frame.orientation->maximum));
+    }
+
+    frame.dirty = true;
+  }
+
+  static void release_contact(client_input_raw_t *raw, std::uint32_t pointer_id) {
+    auto &frame = raw->touch_frame;
+
+    auto it = frame.contacts.find(pointer_id);
+    if (it == std::end(frame.contacts)) {
+      return;
+    }
+
+    // A tap that begins and ends in the same report would never be seen
+    auto slot = it->second.slot;
+    if (frame.changed_slots[slot]) {
+      end_report(raw);
+    }
+
+    select_slot(raw, slot);
+    raw->touch_batch.emit(EV_ABS, ABS_MT_TRACKING_ID, -1);
+    frame.changed_slots[slot] = true;
+    frame.contacts.erase(it);
+
+    frame.dirty = true;
+  }
+
   void update(client_input_raw_t *raw, const touch_port_t &touch_port, const touch_input_t &touch) {
-    if (raw->touch) {
+    if (!raw->touch) {
+      return;
+    }
+
+    if (mt_batch(raw)) {
       switch (touch.eventType) {
         case LI_TOUCH_EVENT_HOVER:
         case LI_TOUCH_EVENT_DOWN:
         case LI_TOUCH_EVENT_MOVE:
-          {
-            // Convert our 0..360 range to -90..90 relative to Y axis
-            int adjusted_angle = touch.rotation;
-
-            if (adjusted_angle > 90 && adjusted_angle < 270) {
-              // Lower hemisphere
-              adjusted_angle = 180 - adjusted_angle;
-            }
-
-            // Wrap the value if it's out of range
-            if (adjusted_angle > 90) {
-              adjusted_angle -= 360;
-            } else if (adjusted_angle < -90) {
-              adjusted_angle += 360;
-            }
-            (*raw->touch).place_finger(touch.pointerId, touch.x, touch.y, touch.pressureOrDistance, adjusted_angle);
-            break;
-          }
+          place_contact(raw, touch);
+          break;
         case LI_TOUCH_EVENT_CANCEL:
         case LI_TOUCH_EVENT_UP:
         case LI_TOUCH_EVENT_HOVER_LEAVE:
-          {
-            (*raw->touch).release_finger(touch.pointerId);
-            break;
+          release_contact(raw, touch.pointerId);
+          break;
+        case LI_TOUCH_EVENT_CANCEL_ALL:
+          while (!raw->touch_frame.contacts.empty()) {
+            release_contact(raw, std::begin(raw->touch_frame.contacts)->first);
           }
-          // TODO: LI_TOUCH_EVENT_CANCEL_ALL
+          break;
       }
+
+      return;
+    }
+
+    // Contacts are only tracked here to know when the batch may take over
+    auto &contacts = raw->touch_frame.contacts;
+    switch (touch.eventType) {
+      case LI_TOUCH_EVENT_HOVER:
+      case LI_TOUCH_EVENT_DOWN:
+      case LI_TOUCH_EVENT_MOVE:
+        {
+          contacts.try_emplace(touch.pointerId);
+          (*raw->touch).place_finger(touch.pointerId, touch.x, touch.y, touch.pressureOrDistance, orientation(touch.rotation));
+          break;
+        }
+      case LI_TOUCH_EVENT_CANCEL:
+      case LI_TOUCH_EVENT_UP:
+      case LI_TOUCH_EVENT_HOVER_LEAVE:
+        {
+          contacts.erase(touch.pointerId);
+          (*raw->touch).release_finger(touch.pointerId);
+          break;
+        }
+        // TODO: LI_TOUCH_EVENT_CANCEL_ALL
+    }
+  }
+
+  void flush(client_input_raw_t *raw) {
+    if (raw->touch_batch) {
+      end_report(raw);
+      raw->touch_batch.flush();
     }
   }
 }  // namespace platf::touch
@@ -17,4 +17,9 @@ using namespace std::literals;
 
 namespace platf::touch {
   void update(client_input_raw_t *raw, const touch_port_t &touch_port, const touch_input_t &touch);
+
+  /**
+   * @brief Write the contacts queued since the last flush as one multitouch frame.
+   */
+  void flush(client_input_raw_t *raw);
 }
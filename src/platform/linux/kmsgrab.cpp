@@ -12,6 +12,7 @@
 // platform includes
 #include <drm_fourcc.h>
 #include <linux/dma-buf.h>
+#include <poll.h>
 #include <sys/capability.h>
 #include <sys/mman.h>
 #include <xf86drm.h>
@@ -23,6 +24,7 @@
 #include "src/config.h"
 #include "src/logging.h"
 #include "src/platform/common.h"
+#include "src/platform/cursor_blend.h"
 #include "src/round_robin.h"
 #include "src/utility.h"
 #include "src/video.h"
@@ -352,14 +354,18 @@ namespace platf {
       }
 
       fb_t fb(plane_t::pointer plane) {
+        return fb(plane->fb_id);
+      }
+
+      fb_t fb(std::uint32_t fb_id) {
         cap_sys_admin admin;
 
-        auto fb2 = drmModeGetFB2(fd.el, plane->fb_id);
+        auto fb2 = drmModeGetFB2(fd.el, fb_id);
         if (fb2) {
           return std::make_unique<wrapper_fb>(fb2);
         }
 
-        auto fb = drmModeGetFB(fd.el, plane->fb_id);
+        auto fb = drmModeGetFB(fd.el, fb_id);
         if (fb) {
           return std::make_unique<wrapper_fb>(fb);
         }
@@ -399,6 +405,10 @@ namespace platf {
         return false;
       }
 
+      bool is_overlay(std::uint32_t plane_id) {
+        return prop_value_by_name(plane_props(plane_id), "type"sv) == DRM_PLANE_TYPE_OVERLAY;
+      }
+
       std::optional<std::uint64_t> prop_value_by_name(const std::vector<std::pair<prop_t, std::uint64_t>> &props, std::string_view name) {
         for (auto &[prop, val] : props) {
           if (prop->name == name) {
@@ -498,6 +508,53 @@ namespace platf {
         return props(id, DRM_MODE_OBJECT_PLANE);
       }
 
+      /**
+       * @brief Read the current value of every property of an object with a single ioctl.
+       * Look the values up with snapshot_value(), using the IDs from prop_id().
+       */
+      obj_prop_t snapshot(std::uint32_t id, std::uint32_t type) {
+        return drmModeObjectGetProperties(fd.el, id, type);
+      }
+
+      /**
+       * @brief Get the ID of a property of an object.
+       * The names are only resolved the first time a property of the object is asked for,
+       * property IDs don't change until the card is opened again.
+       * @return The property ID, or `std::nullopt` if the object doesn't have the property.
+       */
+      std::optional<std::uint32_t> prop_id(std::uint32_t id, std::uint32_t type, std::string_view name) {
+        auto ids = prop_ids.find(id);
+        if (ids == std::end(prop_ids)) {
+          ids = prop_ids.emplace(id, std::map<std::string, std::uint32_t, std::less<>> {}).first;
+          for (auto &[prop, val] : props(id, type)) {
+            if (prop) {
+              ids->second.emplace(prop->name, prop->prop_id);
+            }
+          }
+        }
+
+        auto prop = ids->second.find(name);
+        if (prop == std::end(ids->second)) {
+          return std::nullopt;
+        }
+
+        return prop->second;
+      }
+
+      static std::optional<std::uint64_t> snapshot_value(const obj_prop_t &snapshot, std::optional<std::uint32_t> prop_id) {
+        if (!snapshot || !prop_id) {
+          return std::nullopt;
+        }
+
+        for (auto x = 0; x < snapshot->count_props; ++x) {
+          if (snapshot->props[x] == *prop_id) {
+            return snapshot->prop_values[x];
+          }
+        }
+
+        return std::nullopt;
+      }
+
       std::vector<std::pair<prop_t, std::uint64_t>> crtc_props(std::uint32_t id) {
         return props(id, DRM_MODE_OBJECT_CRTC);
       }
@@ -510,6 +567,52 @@ namespace platf {
         return drmModeGetPlane(fd.el, plane_res->planes[index]);
       }
 
+      /**
+       * @brief Wait for the next vblank of a CRTC.
+       * A page flip that completes on this vblank is being scanned out when the call returns.
+       * @param crtc_index Index of the CRTC in the card's resources.
+       * @param timeout How long to wait for the vblank.
+       * @return 0 on vblank, 1 on timeout, -1 if the CRTC can't report vblanks.
+       */
+      int wait_vblank(int crtc_index, std::chrono::milliseconds timeout) {
+        // A vblank that timed out earlier is still on its way, don't queue another one
+        if (!vblank_pending) {
+          drmVBlank vbl {};
+          auto type = DRM_VBLANK_RELATIVE | DRM_VBLANK_EVENT;
+          if (crtc_index == 1) {
+            type |= DRM_VBLANK_SECONDARY;
+          } else if (crtc_index > 1) {
+            type |= (crtc_index << DRM_VBLANK_HIGH_CRTC_SHIFT) & DRM_VBLANK_HIGH_CRTC_MASK;
+          }
+          vbl.request.type = (drmVBlankSeqType) type;
+          vbl.request.sequence = 1;
+
+          if (drmWaitVBlank(fd.el, &vbl)) {
+            BOOST_LOG(debug) << "drmWaitVBlank() failed: "sv << strerror(errno);
+            return -1;
+          }
+          vblank_pending = true;
+        }
+
+        pollfd pfd {fd.el, POLLIN, 0};
+        auto status = poll(&pfd, 1, timeout.count());
+        if (status < 0) {
+          return errno == EINTR ? 1 : -1;
+        }
+        if (status == 0) {
+          // The CRTC is off or blanked, vblanks resume once it's back
+          return 1;
+        }
+
+        // Only our own vblank events arrive on this fd, reading them is all that's needed
+        drmEventContext ctx {};
+        ctx.version = 2;
+        drmHandleEvent(fd.el, &ctx);
+
+        vblank_pending = false;
+        return 0;
+      }
+
       std::uint32_t count() {
         return plane_res->count_planes;
       }
@@ -525,6 +628,12 @@ namespace platf {
       file_t fd;
       file_t render_fd;
       plane_res_t plane_res;
+
+      // A vblank event was requested but hasn't been read yet
+      bool vblank_pending = false;
+
+      // Property IDs by name, for every object prop_id() was asked about
+      std::map<std::uint32_t, std::map<std::string, std::uint32_t, std::less<>>> prop_ids;
     };
 
     std::map<std::uint32_t, monitor_t> map_crtc_to_monitor(const std::vector<connector_t> &connectors) {
@@ -541,10 +650,7 @@ namespace platf {
     }
 
     struct kms_img_t: public img_t {
-      ~kms_img_t() override {
-        delete[] data;
-        data = nullptr;
-      }
+      util::aligned_ptr_t<std::uint8_t> buffer;
     };
 
     void print(plane_t::pointer plane, fb_t::pointer fb, crtc_t::pointer crtc) {
@@ -622,7 +728,8 @@ namespace platf {
               continue;
             }
 
-            if (card.is_cursor(plane->plane_id)) {
+            // Overlay planes are composited into the capture of the primary plane
+            if (card.is_cursor(plane->plane_id) || card.is_overlay(plane->plane_id)) {
               continue;
             }
 
@@ -723,6 +830,12 @@ namespace platf {
             crtc_id = plane->crtc_id;
             crtc_index = card.get_crtc_index_by_id(plane->crtc_id);
 
+            // Without a refresh rate, frames can't be aligned to vblank
+            vblank_interval = {};
+            if (crtc->mode_valid && crtc->mode.vrefresh) {
+              vblank_interval = std::chrono::nanoseconds {1s} / crtc->mode.vrefresh;
+            }
+
             // Find the connector for this CRTC
             kms::conn_type_count_t conn_type_count;
             for (auto &connector : card.monitors(conn_type_count)) {
@@ -731,8 +844,8 @@ namespace platf {
 
                 connector_id = connector.connector_id;
 
-                auto connector_props = card.connector_props(*connector_id);
-                hdr_metadata_blob_id = card.prop_value_by_name(connector_props, "HDR_OUTPUT_METADATA"sv);
+                hdr_metadata_prop_id = card.prop_id(*connector_id, DRM_MODE_OBJECT_CONNECTOR, "HDR_OUTPUT_METADATA"sv);
+                hdr_metadata_blob_id = card.snapshot_value(card.snapshot(*connector_id, DRM_MODE_OBJECT_CONNECTOR), hdr_metadata_prop_id);
               }
             }
 
@@ -770,6 +883,21 @@ namespace platf {
 
           BOOST_LOG(info) << "Found cursor plane ["sv << plane->plane_id << ']';
           cursor_plane_id = plane->plane_id;
+
+          auto cursor_prop = [&](std::string_view name) {
+            return card.prop_id(cursor_plane_id, DRM_MODE_OBJECT_PLANE, name);
+          };
+          cursor_props = {
+            cursor_prop("FB_ID"sv),
+            cursor_prop("CRTC_X"sv),
+            cursor_prop("CRTC_Y"sv),
+            cursor_prop("CRTC_W"sv),
+            cursor_prop("CRTC_H"sv),
+            cursor_prop("SRC_X"sv),
+            cursor_prop("SRC_Y"sv),
+            cursor_prop("SRC_W"sv),
+            cursor_prop("SRC_H"sv),
+          };
           break;
         }
 
@@ -777,6 +905,44 @@ namespace platf {
           BOOST_LOG(warning) << "No KMS cursor plane found. Cursor may not be displayed while streaming!"sv;
         }
 
+        // Look for the overlay planes that can show on this CRTC, video players and compositors put content on them
+        overlay_planes.clear();
+        for (auto plane = std::begin(card); plane != end; ++plane) {
+          if (!(plane->possible_crtcs & (1 << crtc_index)) || !card.is_overlay(plane->plane_id)) {
+            continue;
+          }
+
+          auto overlay_prop = [&](std::string_view name) {
+            return card.prop_id(plane->plane_id, DRM_MODE_OBJECT_PLANE, name);
+          };
+          overlay_plane_t overlay {
+            plane->plane_id,
+            overlay_prop("FB_ID"sv),
+            overlay_prop("CRTC_ID"sv),
+            overlay_prop("CRTC_X"sv),
+            overlay_prop("CRTC_Y"sv),
+            overlay_prop("CRTC_W"sv),
+            overlay_prop("CRTC_H"sv),
+            overlay_prop("SRC_X"sv),
+            overlay_prop("SRC_Y"sv),
+            overlay_prop("SRC_W"sv),
+            overlay_prop("SRC_H"sv),
+            overlay_prop("zpos"sv),
+          };
+
+          // Without atomic mode-setting, the placement of the plane can't be read
+          if (!overlay.fb_id || !overlay.crtc_id || !overlay.crtc_x || !overlay.crtc_y || !overlay.crtc_w || !overlay.crtc_h ||
+              !overlay.src_x || !overlay.src_y || !overlay.src_w || !overlay.src_h) {
+            continue;
+          }
+
+          overlay_planes.push_back(overlay);
+        }
+
+        if (!overlay_planes.empty()) {
+          BOOST_LOG(info) << "Found "sv << overlay_planes.size() << " overlay planes"sv;
+        }
+
         return 0;
       }
 
@@ -860,38 +1026,20 @@ namespace platf {
           return;
         }
 
-        plane_t plane = drmModeGetPlane(card.fd.el, cursor_plane_id);
+        // One ioctl reads the framebuffer, position and size of the cursor plane
+        auto snapshot = card.snapshot(cursor_plane_id, DRM_MODE_OBJECT_PLANE);
 
-        std::optional<std::int32_t> prop_crtc_x;
-        std::optional<std::int32_t> prop_crtc_y;
-        std::optional<std::uint32_t> prop_crtc_w;
-        std::optional<std::uint32_t> prop_crtc_h;
+        auto cursor_fb_id = card.snapshot_value(snapshot, cursor_props.fb_id).value_or(0);
 
-        std::optional<std::uint64_t> prop_src_x;
-        std::optional<std::uint64_t> prop_src_y;
-        std::optional<std::uint64_t> prop_src_w;
-        std::optional<std::uint64_t> prop_src_h;
+        std::optional<std::int32_t> prop_crtc_x = card.snapshot_value(snapshot, cursor_props.crtc_x);
+        std::optional<std::int32_t> prop_crtc_y = card.snapshot_value(snapshot, cursor_props.crtc_y);
+        std::optional<std::uint32_t> prop_crtc_w = card.snapshot_value(snapshot, cursor_props.crtc_w);
+        std::optional<std::uint32_t> prop_crtc_h = card.snapshot_value(snapshot, cursor_props.crtc_h);
 
-        auto props = card.plane_props(cursor_plane_id);
-        for (auto &[prop, val] : props) {
-          if (prop->name == "CRTC_X"sv) {
-            prop_crtc_x = val;
-          } else if (prop->name == "CRTC_Y"sv) {
-            prop_crtc_y = val;
-          } else if (prop->name == "CRTC_W"sv) {
-            prop_crtc_w = val;
-          } else if (prop->name == "CRTC_H"sv) {
-            prop_crtc_h = val;
-          } else if (prop->name == "SRC_X"sv) {
-            prop_src_x = val;
-          } else if (prop->name == "SRC_Y"sv) {
-            prop_src_y = val;
-          } else if (prop->name == "SRC_W"sv) {
-            prop_src_w = val;
-          } else if (prop->name == "SRC_H"sv) {
-            prop_src_h = val;
-          }
-        }
+        std::optional<std::uint64_t> prop_src_x = card.snapshot_value(snapshot, cursor_props.src_x);
+        std::optional<std::uint64_t> prop_src_y = card.snapshot_value(snapshot, cursor_props.src_y);
+        std::optional<std::uint64_t> prop_src_w = card.snapshot_value(snapshot, cursor_props.src_w);
+        std::optional<std::uint64_t> prop_src_h = card.snapshot_value(snapshot, cursor_props.src_h);
 
         if (!prop_crtc_w || !prop_crtc_h || !prop_crtc_x || !prop_crtc_y) {
           BOOST_LOG(error) << "Cursor plane is missing required plane CRTC properties!"sv;
@@ -919,10 +1067,10 @@ namespace platf {
         // true, we'll really have to mmap() the dmabuf and draw that every time.
         bool cursor_dirty = false;
 
-        if (!plane->fb_id) {
+        if (!cursor_fb_id) {
           captured_cursor.visible = false;
           captured_cursor.fb_id = 0;
-        } else if (plane->fb_id != captured_cursor.fb_id) {
+        } else if (cursor_fb_id != captured_cursor.fb_id) {
           BOOST_LOG(debug) << "Refreshing cursor image after FB changed"sv;
           cursor_dirty = true;
         } else if (*prop_src_x != captured_cursor.prop_src_x ||
@@ -935,7 +1083,7 @@ namespace platf {
 
         // If the cursor is dirty, map it so we can download the new image
         if (cursor_dirty) {
-          auto fb = card.fb(plane.get());
+          auto fb = card.fb(cursor_fb_id);
           if (!fb || !fb->handles[0]) {
             // This means the cursor is not currently visible
             captured_cursor.visible = false;
@@ -1031,16 +1179,132 @@ namespace platf {
           captured_cursor.prop_src_y = *prop_src_y;
           captured_cursor.prop_src_w = *prop_src_w;
           captured_cursor.prop_src_h = *prop_src_h;
-          captured_cursor.fb_id = plane->fb_id;
+          captured_cursor.fb_id = cursor_fb_id;
           ++captured_cursor.serial;
         }
       }
 
+      /**
+       * @brief Get the overlay planes scanned out on top of the captured plane.
+       * @param overlays Filled with the overlays, bottom to top. The file descriptors of their buffers are handed over.
+       */
+      void refresh_overlays(std::vector<egl::overlay_t> &overlays) {
+        std::vector<std::pair<std::uint64_t, egl::overlay_t>> visible;
+
+        for (auto &plane : overlay_planes) {
+          // One ioctl reads the framebuffer and placement of the plane
+          auto snapshot = card.snapshot(plane.plane_id, DRM_MODE_OBJECT_PLANE);
+
+          auto fb_id = card.snapshot_value(snapshot, plane.fb_id).value_or(0);
+          if (!fb_id || card.snapshot_value(snapshot, plane.crtc_id) != (std::uint64_t) crtc_id) {
+            continue;
+          }
+
+          auto fb = card.fb(fb_id);
+          if (!fb || !fb->handles[0]) {
+            continue;
+          }
+
+          egl::overlay_t overlay {};
+          auto &sd = overlay.sd;
+          std::fill_n(sd.fds, 4, -1);
+
+          bool complete = true;
+          for (int y = 0; y < 4 && fb->handles[y]; ++y) {
+            sd.fds[y] = card.handleFD(fb->handles[y]).release();
+            sd.offsets[y] = fb->offsets[y];
+            sd.pitches[y] = fb->pitches[y];
+
+            complete = complete && sd.fds[y] >= 0;
+          }
+
+          sd.width = fb->width;
+          sd.height = fb->height;
+          sd.modifier = fb->modifier;
+          sd.fourcc = fb->pixel_format;
+          sd.fb_id = fb->fb_id;
+
+          // The SRC_* properties are in Q16.16 fixed point
+          overlay.src_x = card.snapshot_value(snapshot, plane.src_x).value_or(0) >> 16;
+          overlay.src_y = card.snapshot_value(snapshot, plane.src_y).value_or(0) >> 16;
+          overlay.src_w = card.snapshot_value(snapshot, plane.src_w).value_or(0) >> 16;
+          overlay.src_h = card.snapshot_value(snapshot, plane.src_h).value_or(0) >> 16;
+
+          // CRTC_X and CRTC_Y are signed, a plane may hang off the top left of the CRTC
+          overlay.crtc_x = (std::int32_t) card.snapshot_value(snapshot, plane.crtc_x).value_or(0);
+          overlay.crtc_y = (std::int32_t) card.snapshot_value(snapshot, plane.crtc_y).value_or(0);
+          overlay.crtc_w = card.snapshot_value(snapshot, plane.crtc_w).value_or(0);
+          overlay.crtc_h = card.snapshot_value(snapshot, plane.crtc_h).value_or(0);
+
+          if (!complete || !overlay.src_w || !overlay.src_h || !overlay.crtc_w || !overlay.crtc_h) {
+            for (auto fd : sd.fds) {
+              if (fd >= 0) {
+                close(fd);
+              }
+            }
+            continue;
+          }
+
+          // Without zpos, overlays are stacked in the order of their IDs
+          visible.emplace_back(card.snapshot_value(snapshot, plane.zpos).value_or(0), overlay);
+        }
+
+        std::stable_sort(std::begin(visible), std::end(visible), [](const auto &l, const auto &r) {
+          return l.first < r.first;
+        });
+
+        for (auto &[_, overlay] : visible) {
+          overlays.push_back(overlay);
+        }
+      }
+
+      /**
+       * @brief Wait until the next frame is due and schedule the one after it.
+       * Frames are captured on the vblank closest to their due time, so a page flip is picked up
+       * as soon as it's scanned out. Without vblanks, a timer paces the frames instead.
+       * @param next_frame When the next frame is due, moved to the frame after it.
+       */
+      void wait_for_frame(std::chrono::steady_clock::time_point &next_frame) {
+        auto now = std::chrono::steady_clock::now();
+
+        bool on_vblank = false;
+        if (vblank_interval.count()) {
+          // The first vblank less than half a refresh before the due time is the closest one
+          while (now + vblank_interval / 2 < next_frame) {
+            auto status = card.wait_vblank(crtc_index, std::chrono::duration_cast<std::chrono::milliseconds>(delay) + 1ms);
+            if (status < 0) {
+              BOOST_LOG(info) << "CRTC doesn't report vblanks, capturing on a timer"sv;
+              vblank_interval = {};
+              break;
+            }
+
+            now = std::chrono::steady_clock::now();
+            if (status > 0) {
+              // No vblank for a whole frame means the display is off, the timer takes over for this frame
+              break;
+            }
+          }
+
+          on_vblank = next_frame <= now + vblank_interval / 2;
+        }
+
+        if (!on_vblank && next_frame > now) {
+          timer->sleep_until(next_frame);
+          sleep_overshoot_logger.first_point(next_frame);
+          sleep_overshoot_logger.second_point_now_and_log();
+        }
+
+        next_frame += delay + take_phase_shift();
+        if (next_frame < now) {  // some major slowdown happened; we couldn't keep up
+          next_frame = now + delay;
+        }
+      }
+
       inline capture_e refresh(file_t *file, egl::surface_descriptor_t *sd, std::optional<std::chrono::steady_clock::time_point> &frame_timestamp) {
         // Check for a change in HDR metadata
         if (connector_id) {
-          auto connector_props = card.connector_props(*connector_id);
-          if (hdr_metadata_blob_id != card.prop_value_by_name(connector_props, "HDR_OUTPUT_METADATA"sv)) {
+          auto connector_props = card.snapshot(*connector_id, DRM_MODE_OBJECT_CONNECTOR);
+          if (hdr_metadata_blob_id != card.snapshot_value(connector_props, hdr_metadata_prop_id)) {
             BOOST_LOG(info) << "Reinitializing capture after HDR metadata change"sv;
             return capture_e::reinit;
           }
@@ -1087,6 +1351,7 @@ namespace platf {
         sd->height = fb->height;
         sd->modifier = fb->modifier;
         sd->fourcc = fb->pixel_format;
+        sd->fb_id = fb->fb_id;
 
         if (
           fb->width != img_width ||
@@ -1103,6 +1368,10 @@ namespace platf {
       mem_type_e mem_type;
 
       std::chrono::nanoseconds delay;
+      std::unique_ptr<high_precision_timer> timer = create_high_precision_timer(CAPTURE_TIMER_SPIN);
+
+      // Refresh interval of the CRTC, zero when frames aren't aligned to its vblanks
+      std::chrono::nanoseconds vblank_interval;
 
       int img_width, img_height;
       int img_offset_x, img_offset_y;
@@ -1112,11 +1381,30 @@ namespace platf {
       int crtc_index;
 
       std::optional<uint32_t> connector_id;
+      std::optional<uint32_t> hdr_metadata_prop_id;
       std::optional<uint64_t> hdr_metadata_blob_id;
 
       int cursor_plane_id;
       cursor_t captured_cursor {};
 
+      // Property IDs of the cursor plane, resolved once so every frame only reads the values
+      struct {
+        std::optional<std::uint32_t> fb_id;
+        std::optional<std::uint32_t> crtc_x, crtc_y, crtc_w, crtc_h;
+        std::optional<std::uint32_t> src_x, src_y, src_w, src_h;
+      } cursor_props;
+
+      // Overlay planes that can show on the CRTC, with the IDs of their properties
+      struct overlay_plane_t {
+        std::uint32_t plane_id;
+        std::optional<std::uint32_t> fb_id, crtc_id;
+        std::optional<std::uint32_t> crtc_x, crtc_y, crtc_w, crtc_h;
+        std::optional<std::uint32_t> src_x, src_y, src_w, src_h;
+        std::optional<std::uint32_t> zpos;
+      };
+
+      std::vector<overlay_plane_t> overlay_planes;
+
       card_t card;
     };
 
@@ -1163,17 +1451,13 @@ namespace platf {
         sleep_overshoot_logger.reset();
 
         while (true) {
-          auto now = std::chrono::steady_clock::now();
-
-          if (next_frame > now) {
-            std::this_thread::sleep_for(next_frame - now);
-            sleep_overshoot_logger.first_point(next_frame);
-            sleep_overshoot_logger.second_point_now_and_log();
-          }
+          wait_for_frame(next_frame);
 
-          next_frame += delay;
-          if (next_frame < now) {  // some major slowdown happened; we couldn't keep up
-            next_frame = now + delay;
+          if (!frame_wanted()) {
+            if (!push_captured_image_cb(nullptr, false)) {
+              return platf::capture_e::ok;
+            }
+            continue;
           }
 
           std::shared_ptr<platf::img_t> img_out;
@@ -1221,7 +1505,7 @@ namespace platf {
       void blend_cursor(img_t &img) {
         // TODO: Cursor scaling is not supported in this codepath.
         // We always draw the cursor at the source size.
-        auto pixels = (int *) img.data;
+        auto pixels = (std::uint32_t *) img.data;
 
         int32_t screen_height = img.height;
         int32_t screen_width = img.width;
@@ -1237,33 +1521,17 @@ namespace platf {
 
         auto delta_height = std::min<uint32_t>(captured_cursor.src_h, std::max<int32_t>(0, screen_height - cursor_y)) - cursor_delta_y;
         auto delta_width = std::min<uint32_t>(captured_cursor.src_w, std::max<int32_t>(0, screen_width - cursor_x)) - cursor_delta_x;
-        for (auto y = 0; y < delta_height; ++y) {
-          // Offset into the cursor image to skip drawing the parts of the cursor image that are off screen
-          //
-          // NB: We must access the elements via the data() function because cursor_end may point to the
-          // the first element beyond the valid range of the vector. Using vector's [] operator in that
-          // manner is undefined behavior (and triggers errors when using debug libc++), while doing the
-          // same with an array is fine.
-          auto cursor_begin = (uint32_t *) &captured_cursor.pixels.data()[((y + cursor_delta_y) * captured_cursor.src_w + cursor_delta_x) * 4];
-          auto cursor_end = (uint32_t *) &captured_cursor.pixels.data()[((y + cursor_delta_y) * captured_cursor.src_w + delta_width + cursor_delta_x) * 4];
-
-          auto pixels_begin = &pixels[(y + cursor_y) * (img.row_pitch / img.pixel_pitch) + cursor_x];
-
-          std::for_each(cursor_begin, cursor_end, [&](uint32_t cursor_pixel) {
-            auto colors_in = (uint8_t *) pixels_begin;
-
-            auto alpha = (*(uint *) &cursor_pixel) >> 24u;
-            if (alpha == 255) {
-              *pixels_begin = cursor_pixel;
-            } else {
-              auto colors_out = (uint8_t *) &cursor_pixel;
-              colors_in[0] = colors_out[0] + (colors_in[0] * (255 - alpha) + 255 / 2) / 255;
-              colors_in[1] = colors_out[1] + (colors_in[1] * (255 - alpha) + 255 / 2) / 255;
-              colors_in[2] = colors_out[2] + (colors_in[2] * (255 - alpha) + 255 / 2) / 255;
-            }
-            ++pixels_begin;
-          });
-        }
+
+        // Offset into the cursor image to skip drawing the parts of the cursor image that are off screen
+        auto cursor_pixels = (const std::uint32_t *) captured_cursor.pixels.data();
+        platf::blend_cursor(
+          &pixels[cursor_y * (img.row_pitch / img.pixel_pitch) + cursor_x],
+          img.row_pitch / img.pixel_pitch,
+          &cursor_pixels[cursor_delta_y * captured_cursor.src_w + cursor_delta_x],
+          captured_cursor.src_w,
+          delta_width,
+          delta_height
+        );
       }
 
       capture_e snapshot(const pull_free_image_cb_t &pull_free_image_cb, std::shared_ptr<platf::img_t> &img_out, std::chrono::milliseconds timeout, bool cursor) {
@@ -1277,15 +1545,12 @@ namespace platf {
           return status;
         }
 
-        auto rgb_opt = egl::import_source(display.get(), sd);
-
-        if (!rgb_opt) {
+        auto rgb = sources.import_source(display.get(), sd);
+        if (!rgb) {
           return capture_e::error;
         }
 
-        auto &rgb = *rgb_opt;
-
-        gl::ctx.BindTexture(GL_TEXTURE_2D, rgb->tex[0]);
+        gl::ctx.BindTexture(GL_TEXTURE_2D, (*rgb)->tex[0]);
 
         // Don't remove these lines, see https://github.com/LizardByte/Sunshine/issues/453
         int w, h;
@@ -1297,7 +1562,7 @@ namespace platf {
           return platf::capture_e::interrupted;
         }
 
-        gl::ctx.GetTextureSubImage(rgb->tex[0], 0, img_offset_x, img_offset_y, 0, width, height, 1, GL_BGRA, GL_UNSIGNED_BYTE, img_out->height * img_out->row_pitch, img_out->data);
+        gl::ctx.GetTextureSubImage((*rgb)->tex[0], 0, img_offset_x, img_offset_y, 0, width, height, 1, GL_BGRA, GL_UNSIGNED_BYTE, img_out->height * img_out->row_pitch, img_out->data);
 
         img_out->frame_timestamp = frame_timestamp;
 
@@ -1314,7 +1579,8 @@ namespace platf {
         img->height = height;
         img->pixel_pitch = 4;
         img->row_pitch = img->pixel_pitch * width;
-        img->data = new std::uint8_t[height * img->row_pitch];
+        img->buffer = util::make_aligned<std::uint8_t>(height * img->row_pitch);
+        img->data = img->buffer.get();
 
         return img;
       }
@@ -1326,6 +1592,9 @@ namespace platf {
       gbm::gbm_t gbm;
       egl::display_t display;
       egl::ctx_t ctx;
+
+      // Destroyed before the context its textures live in
+      egl::import_cache_t sources;
     };
 
     class display_vram_t: public display_t {
@@ -1347,6 +1616,10 @@ namespace platf {
         }
 #endif
 
+        if (mem_type == mem_type_e::system) {
+          return egl::make_readback_encode_device(width, height, dup(card.render_fd.el), img_offset_x, img_offset_y);
+        }
+
         BOOST_LOG(error) << "Unsupported pixel format for egl::display_vram_t: "sv << platf::from_pix_fmt(pix_fmt);
         return nullptr;
       }
@@ -1377,17 +1650,13 @@ namespace platf {
         sleep_overshoot_logger.reset();
 
         while (true) {
-          auto now = std::chrono::steady_clock::now();
-
-          if (next_frame > now) {
-            std::this_thread::sleep_for(next_frame - now);
-            sleep_overshoot_logger.first_point(next_frame);
-            sleep_overshoot_logger.second_point_now_and_log();
-          }
+          wait_for_frame(next_frame);
 
-          next_frame += delay;
-          if (next_frame < now) {  // some major slowdown happened; we couldn't keep up
-            next_frame = now + delay;
+          if (!frame_wanted()) {
+            if (!push_captured_image_cb(nullptr, false)) {
+              return platf::capture_e::ok;
+            }
+            continue;
           }
 
           std::shared_ptr<platf::img_t> img_out;
@@ -1430,6 +1699,9 @@ namespace platf {
           return status;
         }
 
+        // The encode device blends them over the framebuffer in its conversion pass
+        refresh_overlays(img->overlays);
+
         img->sequence = ++sequence;
 
         if (cursor && captured_cursor.visible) {
@@ -1486,7 +1758,11 @@ namespace platf {
   }  // namespace kms
 
   std::shared_ptr<display_t> kms_display(mem_type_e hwdevice_type, const std::string &display_name, const ::video::config_t &config) {
-    if (hwdevice_type == mem_type_e::vaapi || hwdevice_type == mem_type_e::cuda) {
+    // The GPU conversion for software encoders only produces 8-bit 4:2:0
+    bool gpu_convert = hwdevice_type == mem_type_e::system && config::video.sw.gpu_convert &&
+                       config.dynamicRange == 0 && config.chromaSamplingType == 0;
+
+    if (hwdevice_type == mem_type_e::vaapi || hwdevice_type == mem_type_e::cuda || gpu_convert) {
       auto disp = std::make_shared<kms::display_vram_t>(hwdevice_type);
 
       if (!disp->init(display_name, config)) {
@@ -1621,7 +1897,8 @@ namespace platf {
           continue;
         }
 
-        if (card.is_cursor(plane->plane_id)) {
+        // Overlay planes are composited into the capture of the primary plane
+        if (card.is_cursor(plane->plane_id) || card.is_overlay(plane->plane_id)) {
           continue;
         }
 
@@ -0,0 +1,735 @@
+/**
+ * @file src/platform/linux/libcamera_capture.cpp
+ * @brief Definitions for the libcamera capture of CSI cameras.
+ */
+// standard includes
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
+
+// platform includes
+#include <drm_fourcc.h>
+#include <sys/mman.h>
+
+// lib includes
+#include <libcamera/libcamera.h>
+
+extern "C" {
+#include <libavutil/hwcontext.h>
+#include <libavutil/hwcontext_drm.h>
+}
+
+// local includes
+#include "libcamera_capture.h"
+#include "src/config.h"
+#include "src/logging.h"
+#include "src/video.h"
+
+using namespace std::literals;
+
+namespace platf::picamera::csi {
+  namespace {
+    // Number of ISP buffers, enough for the encoder to hold a frame while the ISP fills the next ones
+    constexpr unsigned int BUFFER_COUNT = 6;
+
+    // Fewest buffers that keep the ISP streaming, one held by the encoder, one ready and one being filled
+    constexpr unsigned int LOW_LATENCY_BUFFER_COUNT = 3;
+
+    /**
+     * @brief The camera manager of the process, libcamera allows only one at a time.
+     * It's started on first use and kept, starting it enumerates every camera of the system.
+     * @return The camera manager, or nullptr if it couldn't be started.
+     */
+    libcamera::CameraManager *camera_manager() {
+      static std::mutex mutex;
+      static std::unique_ptr<libcamera::CameraManager> manager;
+
+      std::lock_guard lg {mutex};
+      if (!manager) {
+        auto new_manager = std::make_unique<libcamera::CameraManager>();
+        if (auto err = new_manager->start(); err) {
+          BOOST_LOG(warning) << "libcamera: couldn't start the camera manager: "sv << std::strerror(-err);
+          return nullptr;
+        }
+
+        manager = std::move(new_manager);
+      }
+
+      return manager.get();
+    }
+
+    /**
+     * @brief Check if libcamera reaches a camera over USB, from the path in its id.
+     * Ids are built from the device tree path, or the ACPI path on PCs, which only have USB cameras.
+     * @param id The libcamera camera id.
+     * @return `true` for USB cameras.
+     */
+    bool is_usb_camera(const std::string &id) {
+      return id.starts_with('\\') || id.find("usb"sv) != std::string::npos;
+    }
+
+    /**
+     * @brief Map the color range and colorspace the client asked for to the one the ISP outputs.
+     * @param config The stream configuration.
+     * @return The colorspace of the frames.
+     */
+    libcamera::ColorSpace color_space(const ::video::config_t &config) {
+      // The ISP has no BT.2020 for SDR, BT.709 primaries are the closest
+      auto color_space = (config.encoderCscMode >> 1) == 0 ? libcamera::ColorSpace::Smpte170m : libcamera::ColorSpace::Rec709;
+      color_space.range = (config.encoderCscMode & 0x1) ? libcamera::ColorSpace::Range::Full : libcamera::ColorSpace::Range::Limited;
+
+      return color_space;
+    }
+
+    /**
+     * @brief Check if the planes of a buffer follow each other like in a frame of system memory.
+     * @param buffer The buffer.
+     * @param stride Bytes per row of the luma plane.
+     * @param height Rows of the luma plane.
+     * @return `true` if the planes are in one dmabuf without gaps between them.
+     */
+    bool is_contiguous(const libcamera::FrameBuffer &buffer, unsigned int stride, unsigned int height) {
+      auto &planes = buffer.planes();
+
+      auto expected_offset = planes[0].offset;
+      for (std::size_t x = 0; x < planes.size(); ++x) {
+        if (planes[x].fd.get() != planes[0].fd.get() || planes[x].offset != expected_offset) {
+          return false;
+        }
+
+        // The chroma planes are at half the height, NV12 interleaves both at the full stride
+        expected_offset += x == 0 ? stride * height : planes[x].length;
+      }
+
+      return true;
+    }
+
+    class camera_t;
+
+    /**
+     * @brief A completed request lent to an image, it's queued to the camera again once released.
+     */
+    class request_lease_t {
+    public:
+      request_lease_t(std::shared_ptr<camera_t> camera, libcamera::Request *request, libcamera::FrameBuffer *buffer, const std::uint8_t *data):
+          camera {std::move(camera)},
+          request {request},
+          buffer {buffer},
+          data {data} {
+      }
+
+      ~request_lease_t();
+
+      std::shared_ptr<camera_t> camera;
+      libcamera::Request *request;
+      libcamera::FrameBuffer *buffer;
+
+      // Start of the mapping of the buffer
+      const std::uint8_t *data;
+    };
+
+    /**
+     * @brief A camera acquired and streaming one NV12 or YUV420 stream from the ISP.
+     * Requests are completed on a thread of libcamera, capture takes them from the queue of completed requests.
+     */
+    class camera_t: public std::enable_shared_from_this<camera_t> {
+    public:
+      ~camera_t() {
+        if (!camera) {
+          return;
+        }
+
+        if (started) {
+          {
+            std::lock_guard lg {mutex};
+            started = false;
+          }
+
+          // Stopping cancels the requests still queued, they complete before stop() returns
+          camera->stop();
+        }
+
+        camera->requestCompleted.disconnect(this);
+
+        requests.clear();
+        for (auto &[buffer, mapping] : mappings) {
+          munmap(mapping.first, mapping.second);
+        }
+        allocator.reset();
+
+        if (acquired) {
+          camera->release();
+        }
+      }
+
+      /**
+       * @brief Acquire the camera and configure its stream.
+       * @param id The libcamera camera id.
+       * @param config The stream configuration.
+       * @param buffer_count Number of buffers to allocate.
+       * @return `true` if the camera streams at the stream configuration or something close to it.
+       */
+      bool open(const std::string &id, const ::video::config_t &config, unsigned int buffer_count) {
+        auto manager = camera_manager();
+        if (!manager) {
+          return false;
+        }
+
+        camera = manager->get(id);
+        if (!camera) {
+          BOOST_LOG(error) << "libcamera: no camera "sv << id;
+          return false;
+        }
+
+        if (camera->acquire()) {
+          BOOST_LOG(error) << "libcamera: "sv << id << " is in use by another process"sv;
+          return false;
+        }
+        acquired = true;
+
+        std::vector<libcamera::StreamRole> roles {libcamera::StreamRole::VideoRecording};
+        configuration = camera->generateConfiguration(roles);
+        if (!configuration) {
+          BOOST_LOG(error) << "libcamera: "sv << id << " has no video stream"sv;
+          return false;
+        }
+
+        // The ISP scales to the size of the stream, so the encoder gets its frames without converting them
+        auto &stream_config = configuration->at(0);
+        stream_config.pixelFormat = libcamera::formats::NV12;
+        stream_config.size = {(unsigned int) config.width, (unsigned int) config.height};
+        stream_config.bufferCount = buffer_count;
+        stream_config.colorSpace = color_space(config);
+
+        auto status = configuration->validate();
+        if (status == libcamera::CameraConfiguration::Invalid) {
+          BOOST_LOG(error) << "libcamera: "sv << id << " can't stream "sv << config.width << 'x' << config.height;
+          return false;
+        }
+
+        if (stream_config.pixelFormat != libcamera::formats::NV12 && stream_config.pixelFormat != libcamera::formats::YUV420) {
+          BOOST_LOG(error) << "libcamera: "sv << id << " offers "sv << stream_config.pixelFormat.toString() << " instead of NV12 or YUV420"sv;
+          return false;
+        }
+
+        if (status == libcamera::CameraConfiguration::Adjusted) {
+          BOOST_LOG(info) << "libcamera: "sv << id << " adjusted the stream to "sv << stream_config.toString();
+        }
+
+        if (camera->configure(configuration.get())) {
+          BOOST_LOG(error) << "libcamera: couldn't configure "sv << id;
+          return false;
+        }
+
+        stream = stream_config.stream();
+        allocator = std::make_unique<libcamera::FrameBufferAllocator>(camera);
+        if (allocator->allocate(stream) < 0) {
+          BOOST_LOG(error) << "libcamera: couldn't allocate buffers for "sv << id;
+          return false;
+        }
+
+        for (auto &buffer : allocator->buffers(stream)) {
+          // All planes of a buffer are mapped at once, in one piece per dmabuf
+          auto &planes = buffer->planes();
+          std::size_t length = 0;
+          for (auto &plane : planes) {
+            if (plane.fd.get() == planes[0].fd.get()) {
+              length = std::max<std::size_t>(length, plane.offset + plane.length);
+            }
+          }
+
+          auto data = mmap(nullptr, length, PROT_READ, MAP_SHARED, planes[0].fd.get(), 0);
+          if (data == MAP_FAILED) {
+            BOOST_LOG(error) << "libcamera: couldn't map a buffer of "sv << id << ": "sv << std::strerror(errno);
+            return false;
+          }
+          mappings.emplace(buffer.get(), std::pair {data, length});
+          contiguous = contiguous && is_contiguous(*buffer, stream_config.stride, stream_config.size.height);
+
+          auto request = camera->createRequest();
+          if (!request || request->addBuffer(stream, buffer.get())) {
+            BOOST_LOG(error) << "libcamera: couldn't create a request for "sv << id;
+            return false;
+          }
+          requests.emplace_back(std::move(request));
+        }
+
+        camera->requestCompleted.connect(this, &camera_t::complete);
+
+        // The sensor runs at the frame rate of the stream, and no faster
+        std::int64_t frame_time = config.framerateX100 > 0 ? 100'000'000 / config.framerateX100 : 1'000'000 / std::max(1, config.framerate);
+        libcamera::ControlList controls {libcamera::controls::controls};
+        controls.set(libcamera::controls::FrameDurationLimits, libcamera::Span<const std::int64_t, 2>({frame_time, frame_time}));
+
+        if (camera->start(&controls)) {
+          BOOST_LOG(error) << "libcamera: couldn't start "sv << id;
+          return false;
+        }
+        started = true;
+
+        for (auto &request : requests) {
+          if (camera->queueRequest(request.get())) {
+            BOOST_LOG(error) << "libcamera: couldn't queue a request to "sv << id;
+            return false;
+          }
+        }
+
+        return true;
+      }
+
+      /**
+       * @brief Wait for the next frame of the camera.
+       * @param timeout How long to wait for the frame.
+       * @param latest Hand the frames that queued up back to the camera and take only the newest one.
+       * @param lease The completed request, once a frame arrived.
+       * @param dropped Incremented by the number of frames handed back unseen.
+       * @return capture_e::ok with a frame, capture_e::timeout without.
+       */
+      capture_e dequeue(std::chrono::milliseconds timeout, bool latest, std::shared_ptr<request_lease_t> &lease, int &dropped) {
+        std::unique_lock ul {mutex};
+        if (!completed_cv.wait_for(ul, timeout, [this]() {
+              return !completed.empty();
+            })) {
+          return capture_e::timeout;
+        }
+
+        auto request = completed.front();
+        completed.pop_front();
+
+        while (latest && !completed.empty()) {
+          queue(request);
+          request = completed.front();
+          completed.pop_front();
+          ++dropped;
+        }
+        ul.unlock();
+
+        auto buffer = request->findBuffer(stream);
+        if (!buffer || buffer->metadata().status != libcamera::FrameMetadata::FrameSuccess) {
+          requeue(request);
+          return capture_e::timeout;
+        }
+
+        lease = std::make_shared<request_lease_t>(shared_from_this(), request, buffer, (const std::uint8_t *) mappings.at(buffer).first);
+        return capture_e::ok;
+      }
+
+      /**
+       * @brief Queue a request to the camera again, once its frame isn't needed anymore.
+       * @param request The request.
+       */
+      void requeue(libcamera::Request *request) {
+        std::lock_guard lg {mutex};
+        queue(request);
+      }
+
+      const libcamera::StreamConfiguration &stream_config() const {
+        return configuration->at(0);
+      }
+
+      std::shared_ptr<libcamera::Camera> camera;
+
+      // The frames can be read like a frame in system memory
+      bool contiguous {true};
+
+    private:
+      void complete(libcamera::Request *request) {
+        if (request->status() == libcamera::Request::RequestCancelled) {
+          return;
+        }
+
+        {
+          std::lock_guard lg {mutex};
+          completed.emplace_back(request);
+        }
+        completed_cv.notify_one();
+      }
+
+      // Must be called with the mutex held
+      void queue(libcamera::Request *request) {
+        if (!started) {
+          return;
+        }
+
+        request->reuse(libcamera::Request::ReuseBuffers);
+        if (camera->queueRequest(request)) {
+          BOOST_LOG(warning) << "libcamera: couldn't queue a request to "sv << camera->id() << " again"sv;
+        }
+      }
+
+      std::unique_ptr<libcamera::CameraConfiguration> configuration;
+      std::unique_ptr<libcamera::FrameBufferAllocator> allocator;
+      std::vector<std::unique_ptr<libcamera::Request>> requests;
+      std::map<const libcamera::FrameBuffer *, std::pair<void *, std::size_t>> mappings;
+      libcamera::Stream *stream {};
+
+      std::mutex mutex;
+      std::condition_variable completed_cv;
+      std::deque<libcamera::Request *> completed;
+
+      bool acquired {false};
+      bool started {false};
+    };
+
+    request_lease_t::~request_lease_t() {
+      camera->requeue(request);
+    }
+
+    struct csi_img_t: public img_t {
+      ~csi_img_t() override {
+        // data points into the mapping of a buffer owned by the camera
+        data = nullptr;
+      }
+
+      std::shared_ptr<request_lease_t> lease;
+    };
+
+    class dmabuf_encode_device_t: public avcodec_encode_device_t {
+    public:
+      dmabuf_encode_device_t() {
+        data = (void *) init_hw_device;
+      }
+
+      ~dmabuf_encode_device_t() override {
+        av_buffer_unref(&hw_frames_ctx);
+      }
+
+      /**
+       * @brief Create a DRM hwdevice without opening a DRM node.
+       * The encoder only needs the frame descriptors, so no render device is required.
+       */
+      static int init_hw_device(platf::avcodec_encode_device_t *, AVBufferRef **hw_device_buf) {
+        auto buf = av_hwdevice_ctx_alloc(AV_HWDEVICE_TYPE_DRM);
+        if (!buf) {
+          return -1;
+        }
+
+        auto device_ctx = (AVDRMDeviceContext *) ((AVHWDeviceContext *) buf->data)->hwctx;
+        device_ctx->fd = -1;
+
+        if (av_hwdevice_ctx_init(buf) < 0) {
+          av_buffer_unref(&buf);
+          return -1;
+        }
+
+        *hw_device_buf = buf;
+        return 0;
+      }
+
+      int set_frame(AVFrame *frame, AVBufferRef *hw_frames_ctx) override {
+        this->frame = frame;
+        this->hw_frames_ctx = av_buffer_ref(hw_frames_ctx);
+
+        return this->hw_frames_ctx ? 0 : -1;
+      }
+
+      int convert(platf::img_t &img) override {
+        auto csi_img = dynamic_cast<csi_img_t *>(&img);
+        if (!csi_img || !csi_img->lease) {
+          BOOST_LOG(error) << "libcamera: expected an image of the camera"sv;
+          return -1;
+        }
+
+        auto desc = (AVDRMFrameDescriptor *) av_mallocz(sizeof(AVDRMFrameDescriptor));
+        if (!desc) {
+          return -1;
+        }
+
+        // libcamera formats carry the DRM fourcc, the planes tell which dmabuf they're in
+        auto &planes = csi_img->lease->buffer->planes();
+        auto &layer = desc->layers[0];
+        desc->nb_layers = 1;
+        layer.format = pixel_format.fourcc();
+        layer.nb_planes = std::min<int>(planes.size(), AV_DRM_MAX_PLANES);
+
+        for (int x = 0; x < layer.nb_planes; ++x) {
+          auto &plane = planes[x];
+
+          int object = 0;
+          while (object < desc->nb_objects && desc->objects[object].fd != plane.fd.get()) {
+            ++object;
+          }
+          if (object == desc->nb_objects) {
+            desc->objects[object] = {plane.fd.get(), 0, DRM_FORMAT_MOD_LINEAR};
+            ++desc->nb_objects;
+          }
+          desc->objects[object].size = std::max<std::size_t>(desc->objects[object].size, plane.offset + plane.length);
+
+          // NV12 interleaves both chroma planes at the stride of the luma plane
+          auto pitch = x == 0 || pixel_format == libcamera::formats::NV12 ? stride : stride / 2;
+          layer.planes[x] = {object, (ptrdiff_t) plane.offset, (ptrdiff_t) pitch};
+        }
+
+        // The request goes back to the camera once the encoder drops its last reference to the frame
+        auto opaque = new std::shared_ptr<request_lease_t>(csi_img->lease);
+        auto buf = av_buffer_create((std::uint8_t *) desc, sizeof(*desc), release_descriptor, opaque, 0);
+        if (!buf) {
+          delete opaque;
+          av_free(desc);
+          return -1;
+        }
+
+        av_buffer_unref(&frame->buf[0]);
+        frame->buf[0] = buf;
+        frame->data[0] = (std::uint8_t *) desc;
+
+        av_buffer_unref(&frame->hw_frames_ctx);
+        frame->hw_frames_ctx = av_buffer_ref(hw_frames_ctx);
+
+        return 0;
+      }
+
+      libcamera::PixelFormat pixel_format;
+      unsigned int stride {};
+
+    private:
+      static void release_descriptor(void *opaque, std::uint8_t *data) {
+        delete (std::shared_ptr<request_lease_t> *) opaque;
+        av_free(data);
+      }
+
+      AVBufferRef *hw_frames_ctx {};
+    };
+
+    /**
+     * @brief Capture the frames of a CSI camera as the ISP outputs them.
+     * Images point into the buffers libcamera allocated, with DMABUF export the frames never touch the CPU.
+     */
+    class csi_display_t: public display_t {
+    public:
+      bool init(mem_type_e hwdevice_type, const std::string &id, const ::video::config_t &config) {
+        export_dmabuf = hwdevice_type == mem_type_e::drm;
+        low_latency = config::video.picamera.low_latency;
+        delay = std::chrono::nanoseconds {1s} / std::max(1, config.framerate);
+
+        camera = std::make_shared<camera_t>();
+        if (!camera->open(id, config, low_latency ? LOW_LATENCY_BUFFER_COUNT : BUFFER_COUNT)) {
+          return false;
+        }
+
+        if (!export_dmabuf && !camera->contiguous) {
+          BOOST_LOG(error) << "libcamera: the planes of the frames of "sv << id << " aren't laid out like a frame in system memory"sv;
+          return false;
+        }
+
+        auto &stream_config = camera->stream_config();
+        width = (int) stream_config.size.width;
+        height = (int) stream_config.size.height;
+        env_width = width;
+        env_height = height;
+        stride = (int) stream_config.stride;
+        pix_fmt = stream_config.pixelFormat == libcamera::formats::NV12 ? pix_fmt_e::nv12 : pix_fmt_e::yuv420p;
+
+        BOOST_LOG(info) << "libcamera: capturing "sv << stream_config.toString() << " from "sv << id << (export_dmabuf ? " with DMABUF export"sv : ""sv) << (low_latency ? " in low latency mode"sv : ""sv);
+        return true;
+      }
+
+      capture_e capture(const push_captured_image_cb_t &push_captured_image_cb, const pull_free_image_cb_t &pull_free_image_cb, bool *cursor) override {
+        (void) cursor;
+
+        // Allow a few frame intervals before reporting a timeout to the encoder
+        auto timeout = std::chrono::duration_cast<std::chrono::milliseconds>(delay * 4) + 1ms;
+
+        while (true) {
+          if (!frame_wanted()) {
+            auto status = skip_frame(timeout);
+            if (status != capture_e::ok && status != capture_e::timeout) {
+              return status;
+            }
+
+            if (!push_captured_image_cb(nullptr, false)) {
+              return capture_e::ok;
+            }
+            continue;
+          }
+
+          std::shared_ptr<platf::img_t> img_out;
+          if (!pull_free_image_cb(img_out)) {
+            return capture_e::interrupted;
+          }
+
+          auto status = next_frame(*img_out, timeout);
+          if (status == capture_e::ok) {
+            if (!push_captured_image_cb(std::move(img_out), true)) {
+              return capture_e::ok;
+            }
+          } else if (status == capture_e::timeout) {
+            if (!push_captured_image_cb(std::move(img_out), false)) {
+              return capture_e::ok;
+            }
+          } else {
+            return status;
+          }
+        }
+      }
+
+      std::shared_ptr<img_t> alloc_img() override {
+        auto img = std::make_shared<csi_img_t>();
+        img->width = width;
+        img->height = height;
+        img->pixel_pitch = 1;
+        img->row_pitch = stride;
+        img->pix_fmt = pix_fmt;
+
+        imgs.emplace_back(img);
+        return img;
+      }
+
+      int dummy_img(img_t *img) override {
+        // Any frame from the camera will do, images can only point into its buffers
+        if (next_frame(*img, 1s) != capture_e::ok) {
+          BOOST_LOG(error) << "libcamera: no frame from "sv << camera->camera->id() << " to prime the encoder"sv;
+          return -1;
+        }
+
+        return 0;
+      }
+
+      std::unique_ptr<avcodec_encode_device_t> make_avcodec_encode_device(pix_fmt_e) override {
+        if (!export_dmabuf) {
+          return std::make_unique<avcodec_encode_device_t>();
+        }
+
+        auto encode_device = std::make_unique<dmabuf_encode_device_t>();
+        encode_device->pixel_format = camera->stream_config().pixelFormat;
+        encode_device->stride = stride;
+
+        return encode_device;
+      }
+
+      bool is_codec_supported(std::string_view, const ::video::config_t &) override {
+        return true;
+      }
+
+      bool is_live_source() override {
+        return true;
+      }
+
+    private:
+      /**
+       * @brief Hand requests held by idle pool images back to the camera.
+       * The capture pool keeps recently used images around, so without this their
+       * leases would starve the ISP of buffers to fill.
+       */
+      void reclaim_requests() {
+        for (auto it = std::begin(imgs); it != std::end(imgs);) {
+          auto img = it->lock();
+          if (!img) {
+            it = imgs.erase(it);
+            continue;
+          }
+
+          // Only the pool and this function hold the image, so nobody is reading from it
+          if (img.use_count() == 2) {
+            img->lease.reset();
+          }
+
+          ++it;
+        }
+      }
+
+      /**
+       * @brief Hand the next frame straight back to the camera.
+       */
+      capture_e skip_frame(std::chrono::milliseconds timeout) {
+        reclaim_requests();
+
+        int dropped = 0;
+        std::shared_ptr<request_lease_t> lease;
+        return camera->dequeue(timeout, low_latency, lease, dropped);
+      }
+
+      capture_e next_frame(img_t &img, std::chrono::milliseconds timeout) {
+        auto &csi_img = (csi_img_t &) img;
+        csi_img.lease.reset();
+        csi_img.data = nullptr;
+
+        reclaim_requests();
+
+        // Frames that queued up while the encoder was busy are handed straight back to the camera
+        int dropped = 0;
+        std::shared_ptr<request_lease_t> lease;
+        auto status = camera->dequeue(timeout, low_latency, lease, dropped);
+        if (status != capture_e::ok) {
+          return status;
+        }
+
+        if (low_latency) {
+          queue_depth_logger.collect_and_log(dropped + 1);
+        }
+
+        auto &planes = lease->buffer->planes();
+        auto timestamp = lease->buffer->metadata().timestamp;
+
+        csi_img.data = (std::uint8_t *) lease->data + planes[0].offset;
+        csi_img.width = width;
+        csi_img.height = height;
+        csi_img.row_pitch = stride;
+        csi_img.pixel_pitch = 1;
+        csi_img.pix_fmt = pix_fmt;
+
+        // Buffers are timestamped with CLOCK_MONOTONIC when the sensor started sending the frame
+        csi_img.frame_timestamp = timestamp ? std::chrono::steady_clock::time_point {std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::nanoseconds {timestamp})} : std::chrono::steady_clock::now();
+
+        csi_img.lease = std::move(lease);
+        return capture_e::ok;
+      }
+
+      std::shared_ptr<camera_t> camera;
+      std::vector<std::weak_ptr<csi_img_t>> imgs;
+      std::chrono::nanoseconds delay {std::chrono::nanoseconds {1s} / 30};
+      logging::min_max_avg_periodic_logger<int> queue_depth_logger = {debug, "libcamera frames queued", ""};
+      pix_fmt_e pix_fmt {pix_fmt_e::nv12};
+      int stride {};
+      bool export_dmabuf {false};
+      bool low_latency {false};
+    };
+  }  // namespace
+
+  bool is_camera(const std::string &display_name) {
+    return display_name.starts_with(PREFIX);
+  }
+
+  std::vector<std::string> display_names() {
+    std::vector<std::string> names;
+
+    auto manager = camera_manager();
+    if (!manager) {
+      return names;
+    }
+
+    for (auto &camera : manager->cameras()) {
+      if (is_usb_camera(camera->id())) {
+        continue;
+      }
+
+      auto model = camera->properties().get(libcamera::properties::Model);
+      BOOST_LOG(debug) << "libcamera: found "sv << model.value_or("camera"s) << " at "sv << camera->id();
+      names.emplace_back(std::string {PREFIX} + camera->id());
+    }
+
+    return names;
+  }
+
+  std::shared_ptr<display_t> create_display(mem_type_e hwdevice_type, const std::string &display_name, const ::video::config_t &config) {
+    if (!is_camera(display_name)) {
+      return nullptr;
+    }
+
+    auto display = std::make_shared<csi_display_t>();
+    if (!display->init(hwdevice_type, display_name.substr(PREFIX.size()), config)) {
+      return nullptr;
+    }
+
+    return display;
+  }
+}  // namespace platf::picamera::csi
@@ -0,0 +1,45 @@
+/**
+ * @file src/platform/linux/libcamera_capture.h
+ * @brief Declarations for the libcamera capture of CSI cameras.
+ */
+#pragma once
+
+// standard includes
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// local includes
+#include "src/platform/common.h"
+
+namespace platf::picamera::csi {
+  /**
+   * @brief Prefix of the display names of cameras reached through libcamera, followed by the libcamera camera id.
+   */
+  constexpr std::string_view PREFIX = "libcamera:";
+
+  /**
+   * @brief Check if a display name belongs to a camera reached through libcamera.
+   * @param display_name The display name.
+   * @return `true` if the name is one of display_names().
+   */
+  bool is_camera(const std::string &display_name);
+
+  /**
+   * @brief Enumerate the CSI cameras libcamera offers.
+   * USB cameras are left out, the V4L2 path captures them without libcamera.
+   * @return Display names of the cameras found, see PREFIX.
+   */
+  std::vector<std::string> display_names();
+
+  /**
+   * @brief Stream a CSI camera through the ISP, which scales to the resolution of the stream and outputs NV12.
+   * @param hwdevice_type The memory type expected by the encoder.
+   * With `mem_type_e::drm`, the dmabufs libcamera allocated are handed to the encoder without a copy.
+   * @param display_name The display name of the camera.
+   * @param config The stream configuration.
+   * @return The display, or nullptr if the camera couldn't be configured for the stream.
+   */
+  std::shared_ptr<display_t> create_display(mem_type_e hwdevice_type, const std::string &display_name, const ::video::config_t &config);
+}  // namespace platf::picamera::csi
@@ -0,0 +1,415 @@
+/**
+ * @file src/platform/linux/mdns.cpp
+ * @brief Definitions for a minimal mDNS responder, used to publish the service when avahi isn't running.
+ */
+// standard includes
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <thread>
+
+// platform includes
+#include <arpa/inet.h>
+#include <ifaddrs.h>
+#include <net/if.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+// lib includes
+#include <boost/algorithm/string/predicate.hpp>
+
+// local includes
+#include "mdns.h"
+#include "src/logging.h"
+
+using namespace std::literals;
+
+namespace mdns {
+  namespace {
+    constexpr std::uint16_t PORT = 5353;
+    constexpr auto GROUP = "224.0.0.251";
+    constexpr auto DOMAIN = ".local"sv;
+    constexpr auto SERVICES = "_services._dns-sd._udp.local"sv;
+    constexpr auto JOIN_INTERVAL = 10s;
+
+    constexpr std::uint16_t TYPE_A = 1;
+    constexpr std::uint16_t TYPE_PTR = 12;
+    constexpr std::uint16_t TYPE_TXT = 16;
+    constexpr std::uint16_t TYPE_SRV = 33;
+    constexpr std::uint16_t CLASS_IN = 1;
+
+    // Set on the class of records only this host answers for, so caches replace what they hold
+    constexpr std::uint16_t CACHE_FLUSH = 0x8000;
+
+    // Set on the class of a question asking for a unicast response
+    constexpr std::uint16_t UNICAST_RESPONSE = 0x8000;
+
+    std::string service_type() {
+      return SERVICE_TYPE + std::string {DOMAIN};
+    }
+
+    std::string instance_name(const service_t &service) {
+      return service.instance + '.' + service_type();
+    }
+
+    std::string host_name(const service_t &service) {
+      return service.host + std::string {DOMAIN};
+    }
+
+    std::uint16_t read_u16(const std::uint8_t *p) {
+      return (std::uint16_t) ((p[0] << 8) | p[1]);
+    }
+
+    void write_u16(std::vector<std::uint8_t> &out, std::uint16_t value) {
+      out.push_back(value >> 8);
+      out.push_back(value & 0xFF);
+    }
+
+    void write_u32(std::vector<std::uint8_t> &out, std::uint32_t value) {
+      write_u16(out, value >> 16);
+      write_u16(out, value & 0xFFFF);
+    }
+
+    /**
+     * @brief Read a name, following the compression pointers.
+     * @param packet The packet.
+     * @param offset Offset of the name, moved past it.
+     * @return The name, or `std::nullopt` if it runs past the packet or loops.
+     */
+    std::optional<std::string> read_name(std::span<const std::uint8_t> packet, std::size_t &offset) {
+      std::string name;
+      auto pos = offset;
+      bool jumped = false;
+
+      // Every pointer has to go back, which bounds the number of jumps by the packet size
+      auto limit = pos;
+      while (true) {
+        if (pos >= packet.size()) {
+          return std::nullopt;
+        }
+
+        auto length = packet[pos];
+        if ((length & 0xC0) == 0xC0) {
+          if (pos + 1 >= packet.size()) {
+            return std::nullopt;
+          }
+
+          auto target = (std::size_t) (read_u16(&packet[pos]) & 0x3FFF);
+          if (target >= limit) {
+            return std::nullopt;
+          }
+
+          if (!jumped) {
+            offset = pos + 2;
+            jumped = true;
+          }
+          pos = limit = target;
+          continue;
+        }
+
+        if (length == 0) {
+          if (!jumped) {
+            offset = pos + 1;
+          }
+          return name;
+        }
+
+        if (pos + 1 + length > packet.size()) {
+          return std::nullopt;
+        }
+
+        if (!name.empty()) {
+          name += '.';
+        }
+        name.append((const char *) &packet[pos + 1], length);
+        pos += 1 + length;
+      }
+    }
+
+    void write_name(std::vector<std::uint8_t> &out, std::string_view name) {
+      while (!name.empty()) {
+        auto dot = name.find('.');
+        auto label = name.substr(0, dot);
+
+        out.push_back((std::uint8_t) label.size());
+        out.insert(std::end(out), std::begin(label), std::end(label));
+
+        name = dot == std::string_view::npos ? ""sv : name.substr(dot + 1);
+      }
+      out.push_back(0);
+    }
+
+    /**
+     * @brief Append a record, the data is written by the callback.
+     */
+    template<class F>
+    void write_record(std::vector<std::uint8_t> &out, std::string_view name, std::uint16_t type, bool unique, std::uint32_t ttl, F &&write_data) {
+      write_name(out, name);
+      write_u16(out, type);
+      write_u16(out, CLASS_IN | (unique ? CACHE_FLUSH : 0));
+      write_u32(out, ttl);
+
+      auto length_at = out.size();
+      write_u16(out, 0);
+      write_data(out);
+
+      auto length = out.size() - length_at - 2;
+      out[length_at] = length >> 8;
+      out[length_at + 1] = length & 0xFF;
+    }
+
+    std::vector<std::array<std::uint8_t, 4>> host_addresses() {
+      std::vector<std::array<std::uint8_t, 4>> addresses;
+
+      ifaddrs *ifaddr;
+      if (getifaddrs(&ifaddr)) {
+        return addresses;
+      }
+
+      for (auto ifa = ifaddr; ifa; ifa = ifa->ifa_next) {
+        if (!ifa->ifa_addr || ifa->ifa_addr->sa_family != AF_INET || (ifa->ifa_flags & IFF_LOOPBACK) || !(ifa->ifa_flags & IFF_UP)) {
+          continue;
+        }
+
+        std::array<std::uint8_t, 4> address;
+        std::memcpy(address.data(), &((sockaddr_in *) ifa->ifa_addr)->sin_addr, address.size());
+        addresses.push_back(address);
+      }
+
+      freeifaddrs(ifaddr);
+      return addresses;
+    }
+
+    /**
+     * @brief Join the mDNS group on every IPv4 interface that supports multicast.
+     * @return The number of interfaces joined that weren't before.
+     */
+    int join_group(int fd) {
+      ifaddrs *ifaddr;
+      if (getifaddrs(&ifaddr)) {
+        return 0;
+      }
+
+      int joined = 0;
+      for (auto ifa = ifaddr; ifa; ifa = ifa->ifa_next) {
+        if (!ifa->ifa_addr || ifa->ifa_addr->sa_family != AF_INET || !(ifa->ifa_flags & IFF_MULTICAST) || (ifa->ifa_flags & IFF_LOOPBACK)) {
+          continue;
+        }
+
+        ip_mreq mreq {};
+        inet_pton(AF_INET, GROUP, &mreq.imr_multiaddr);
+        mreq.imr_interface = ((sockaddr_in *) ifa->ifa_addr)->sin_addr;
+        if (!setsockopt(fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq))) {
+          ++joined;
+        } else if (errno != EADDRINUSE) {
+          BOOST_LOG(debug) << "mDNS: couldn't join the group on "sv << ifa->ifa_name << ": "sv << std::strerror(errno);
+        }
+      }
+
+      freeifaddrs(ifaddr);
+      return joined;
+    }
+
+    class responder_t: public platf::deinit_t {
+    public:
+      responder_t(int fd, service_t service):
+          fd {fd},
+          service {std::move(service)} {
+        thread = std::thread {&responder_t::run, this};
+      }
+
+      ~responder_t() override {
+        stop = true;
+        thread.join();
+
+        send_multicast(make_response(service, host_addresses(), 0, true));
+        close(fd);
+      }
+
+    private:
+      void send_multicast(const std::vector<std::uint8_t> &packet) {
+        sockaddr_in group {};
+        group.sin_family = AF_INET;
+        group.sin_port = htons(PORT);
+        inet_pton(AF_INET, GROUP, &group.sin_addr);
+
+        sendto(fd, packet.data(), packet.size(), 0, (sockaddr *) &group, sizeof(group));
+      }
+
+      void run() {
+        BOOST_LOG(info) << "mDNS: publishing "sv << instance_name(service);
+
+        // Announce twice, a second apart, so peers that missed the first one still pick it up
+        int announcements = 2;
+        auto next_announcement = std::chrono::steady_clock::now();
+        auto next_join = next_announcement + JOIN_INTERVAL;
+
+        std::array<std::uint8_t, 9000> buffer;
+        while (!stop) {
+          auto now = std::chrono::steady_clock::now();
+          if (now >= next_join) {
+            // Headless devices often start before their network is up
+            if (join_group(fd)) {
+              announcements = 2;
+              next_announcement = now;
+            }
+            next_join = now + JOIN_INTERVAL;
+          }
+
+          if (announcements && now >= next_announcement) {
+            send_multicast(make_response(service, host_addresses(), 0, false));
+            --announcements;
+            next_announcement = now + 1s;
+          }
+
+          pollfd pfd {fd, POLLIN, 0};
+          if (poll(&pfd, 1, 250) <= 0) {
+            continue;
+          }
+
+          sockaddr_in from {};
+          socklen_t from_len = sizeof(from);
+          auto bytes = recvfrom(fd, buffer.data(), buffer.size(), 0, (sockaddr *) &from, &from_len);
+          if (bytes <= 0) {
+            continue;
+          }
+
+          auto query = parse_query({buffer.data(), (std::size_t) bytes});
+          if (!query || !answers(service, *query)) {
+            continue;
+          }
+
+          // Resolvers that aren't mDNS aware query from another port and only take unicast responses
+          auto legacy = ntohs(from.sin_port) != PORT;
+          if (legacy || query->unicast) {
+            auto response = make_response(service, host_addresses(), legacy ? query->id : 0, false);
+            sendto(fd, response.data(), response.size(), 0, (sockaddr *) &from, from_len);
+          } else {
+            send_multicast(make_response(service, host_addresses(), 0, false));
+          }
+        }
+      }
+
+      int fd;
+      service_t service;
+      std::atomic_bool stop {false};
+      std::thread thread;
+    };
+  }  // namespace
+
+  std::optional<query_t> parse_query(std::span<const std::uint8_t> packet) {
+    if (packet.size() < 12) {
+      return std::nullopt;
+    }
+
+    auto flags = read_u16(&packet[2]);
+    if (flags & 0x8000) {
+      // A response, not a query
+      return std::nullopt;
+    }
+
+    query_t query {read_u16(&packet[0]), {}, false};
+
+    std::size_t offset = 12;
+    auto questions = read_u16(&packet[4]);
+    for (int x = 0; x < questions; ++x) {
+      auto name = read_name(packet, offset);
+      if (!name || offset + 4 > packet.size()) {
+        return std::nullopt;
+      }
+
+      query.unicast = query.unicast || (read_u16(&packet[offset + 2]) & UNICAST_RESPONSE);
+      query.names.emplace_back(std::move(*name));
+      offset += 4;
+    }
+
+    return query;
+  }
+
+  bool answers(const service_t &service, const query_t &query) {
+    auto type = service_type();
+    auto instance = instance_name(service);
+    auto host = host_name(service);
+
+    return std::any_of(std::begin(query.names), std::end(query.names), [&](const std::string &name) {
+      return boost::iequals(name, type) || boost::iequals(name, instance) || boost::iequals(name, host) || boost::iequals(name, SERVICES);
+    });
+  }
+
+  std::vector<std::uint8_t> make_response(const service_t &service, const std::vector<std::array<std::uint8_t, 4>> &addresses, std::uint16_t id, bool goodbye) {
+    auto type = service_type();
+    auto instance = instance_name(service);
+    auto host = host_name(service);
+
+    auto host_ttl = goodbye ? 0 : HOST_TTL;
+    auto service_ttl = goodbye ? 0 : SERVICE_TTL;
+
+    std::vector<std::uint8_t> out;
+    write_u16(out, id);
+    write_u16(out, 0x8400);  // Response, authoritative
+    write_u16(out, 0);
+    write_u16(out, (std::uint16_t) (4 + addresses.size()));
+    write_u16(out, 0);
+    write_u16(out, 0);
+
+    write_record(out, SERVICES, TYPE_PTR, false, service_ttl, [&](auto &data) {
+      write_name(data, type);
+    });
+    write_record(out, type, TYPE_PTR, false, service_ttl, [&](auto &data) {
+      write_name(data, instance);
+    });
+    write_record(out, instance, TYPE_SRV, true, host_ttl, [&](auto &data) {
+      write_u16(data, 0);  // Priority
+      write_u16(data, 0);  // Weight
+      write_u16(data, service.port);
+      write_name(data, host);
+    });
+    write_record(out, instance, TYPE_TXT, true, service_ttl, [](auto &data) {
+      // No keys, which still takes a single empty string
+      data.push_back(0);
+    });
+    for (auto &address : addresses) {
+      write_record(out, host, TYPE_A, true, host_ttl, [&](auto &data) {
+        data.insert(std::end(data), std::begin(address), std::end(address));
+      });
+    }
+
+    return out;
+  }
+
+  std::unique_ptr<platf::deinit_t> start(service_t service) {
+    auto fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+      BOOST_LOG(error) << "mDNS: couldn't open a socket: "sv << std::strerror(errno);
+      return nullptr;
+    }
+
+    // Other responders may be listening too
+    int on = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on));
+
+    // Link local only, as RFC 6762 asks for
+    int ttl = 255;
+    setsockopt(fd, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl));
+
+    sockaddr_in addr {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(PORT);
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    if (bind(fd, (sockaddr *) &addr, sizeof(addr))) {
+      BOOST_LOG(error) << "mDNS: couldn't bind port "sv << PORT << ": "sv << std::strerror(errno);
+      close(fd);
+      return nullptr;
+    }
+
+    if (!join_group(fd)) {
+      BOOST_LOG(warning) << "mDNS: no interface to publish the service on yet"sv;
+    }
+
+    return std::make_unique<responder_t>(fd, std::move(service));
+  }
+}  // namespace mdns
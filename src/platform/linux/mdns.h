@@ -0,0 +1,80 @@
+/**
+ * @file src/platform/linux/mdns.h
+ * @brief Declarations for a minimal mDNS responder, used to publish the service when avahi isn't running.
+ */
+#pragma once
+
+// standard includes
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <span>
+#include <string>
+#include <vector>
+
+// local includes
+#include "src/platform/common.h"
+
+namespace mdns {
+  /**
+   * @brief TTL of the records naming the host, it changes addresses more often than the service changes.
+   */
+  constexpr std::uint32_t HOST_TTL = 120;
+
+  /**
+   * @brief TTL of the other records.
+   */
+  constexpr std::uint32_t SERVICE_TTL = 4500;
+
+  /**
+   * @brief The service to answer for.
+   */
+  struct service_t {
+    std::string instance;  ///< Instance name, a single label.
+    std::string host;  ///< Host name, a single label, `.local` is appended.
+    std::uint16_t port;  ///< Port the service listens on.
+  };
+
+  /**
+   * @brief The parts of an mDNS query the responder looks at.
+   */
+  struct query_t {
+    std::uint16_t id;  ///< Query ID, echoed in unicast responses.
+    std::vector<std::string> names;  ///< Names asked for, without a trailing dot.
+    bool unicast;  ///< One of the questions asked for a unicast response.
+  };
+
+  /**
+   * @brief Parse the questions of an mDNS packet.
+   * @param packet The packet.
+   * @return The query, or `std::nullopt` if the packet is a response or malformed.
+   */
+  std::optional<query_t> parse_query(std::span<const std::uint8_t> packet);
+
+  /**
+   * @brief Check if the service answers a query.
+   * @param service The service.
+   * @param query The query.
+   * @return `true` if the query asks for the service type, the service instance, the host or the DNS-SD service list.
+   */
+  bool answers(const service_t &service, const query_t &query);
+
+  /**
+   * @brief Build a response holding all records of the service.
+   * @param service The service.
+   * @param addresses IPv4 addresses of the host.
+   * @param id Query ID, 0 for multicast responses.
+   * @param goodbye Withdraw the records instead, by sending them with a TTL of 0.
+   * @return The packet.
+   */
+  std::vector<std::uint8_t> make_response(const service_t &service, const std::vector<std::array<std::uint8_t, 4>> &addresses, std::uint16_t id, bool goodbye);
+
+  /**
+   * @brief Start answering mDNS queries for the service on all IPv4 interfaces.
+   * The service is announced when it starts, and withdrawn when the returned object is destroyed.
+   * @param service The service.
+   * @return The responder, or nullptr if the mDNS socket couldn't be opened.
+   */
+  [[nodiscard]] std::unique_ptr<platf::deinit_t> start(service_t service);
+}  // namespace mdns
@@ -9,15 +9,33 @@
 #endif
 
 // standard includes
+#include <algorithm>
+#include <cstring>
 #include <fstream>
 #include <iostream>
+#include <optional>
+#include <sstream>
 
 // platform includes
 #include <arpa/inet.h>
 #include <dlfcn.h>
 #include <ifaddrs.h>
+#include <linux/errqueue.h>
+#include <linux/net_tstamp.h>
+#include <linux/sockios.h>
+#include <linux/wireless.h>
 #include <netinet/udp.h>
+#include <poll.h>
+#include <pthread.h>
 #include <pwd.h>
+#include <sched.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sys/timerfd.h>
+#include <sys/utsname.h>
 
 // lib includes
 #include <boost/asio/ip/address.hpp>
@@ -34,6 +52,8 @@
 #include "src/entry_handler.h"
 #include "src/logging.h"
 #include "src/platform/common.h"
+#include "src/platform/synthetic_display.h"
+#include "uring.h"
 #include "vaapi.h"
 
 #ifdef __GNUC__
@@ -272,15 +292,322 @@ namespace platf {
   }
 
   void adjust_thread_priority(thread_priority_e priority) {
-    // Unimplemented
+    int nice_value;
+    int policy = SCHED_OTHER;
+
+    switch (priority) {
+      case thread_priority_e::low:
+        nice_value = 5;
+        break;
+      case thread_priority_e::normal:
+        nice_value = 0;
+        break;
+      case thread_priority_e::high:
+        nice_value = -5;
+        break;
+      case thread_priority_e::critical:
+        nice_value = -10;
+        if (config::sunshine.realtime_pipeline) {
+          policy = SCHED_RR;
+        }
+        break;
+      case thread_priority_e::realtime:
+        nice_value = -10;
+        policy = SCHED_FIFO;
+        break;
+      default:
+        BOOST_LOG(error) << "Unknown thread priority: "sv << (int) priority;
+        return;
+    }
+
+    if (policy != SCHED_OTHER) {
+      sched_param param {};
+      param.sched_priority = sched_get_priority_min(policy);
+      auto err = pthread_setschedparam(pthread_self(), policy, &param);
+      if (err) {
+        // EPERM without CAP_SYS_NICE or an RLIMIT_RTPRIO above 0, the nice value still applies
+        BOOST_LOG(warning) << "Couldn't enable real-time scheduling: "sv << std::strerror(err);
+      }
+    }
+
+    // Linux keeps the nice value per thread, so this only affects the calling thread
+    if (setpriority(PRIO_PROCESS, (id_t) syscall(SYS_gettid), nice_value)) {
+      // EACCES when raising the priority without CAP_SYS_NICE or a high enough RLIMIT_NICE
+      BOOST_LOG(debug) << "Couldn't set the nice value of the thread to "sv << nice_value << ": "sv << std::strerror(errno);
+    }
+
+    // Threads the pipeline starts from here inherit the CPUs
+    auto &cpus = config::sunshine.pipeline_cpus;
+    if (priority >= thread_priority_e::high && !cpus.empty()) {
+      cpu_set_t set;
+      CPU_ZERO(&set);
+      for (auto cpu : cpus) {
+        if (cpu >= 0 && cpu < CPU_SETSIZE) {
+          CPU_SET(cpu, &set);
+        }
+      }
+
+      auto err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+      if (err) {
+        BOOST_LOG(warning) << "Couldn't restrict thread to pipeline_cpus: "sv << std::strerror(err);
+      }
+    }
+  }
+
+  void pin_thread(int cpu) {
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(cpu, &cpus);
+
+    auto err = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+    if (err) {
+      BOOST_LOG(warning) << "Couldn't pin thread to CPU "sv << cpu << ": "sv << std::strerror(err);
+    }
+  }
+
+  thermal_state_t thermal_state() {
+    thermal_state_t state;
+
+    std::error_code ec;
+    for (auto &zone : fs::directory_iterator {"/sys/class/thermal"sv, ec}) {
+      if (!zone.path().filename().string().starts_with("thermal_zone"sv)) {
+        continue;
+      }
+
+      // Millidegrees Celsius
+      std::ifstream in {zone.path() / "temp"sv};
+      long millidegrees;
+      if (in >> millidegrees) {
+        state.temperature = std::max(state.temperature.value_or(millidegrees / 1000.0), millidegrees / 1000.0);
+      }
+    }
+
+    // The firmware of a Raspberry Pi reports the throttling in the low bits: under-voltage, capped frequency,
+    // throttled and the soft temperature limit. The upper bits only tell it happened since boot.
+    std::ifstream throttled {"/sys/devices/platform/soc/soc:firmware/get_throttled"};
+    unsigned int flags;
+    if (throttled >> std::hex >> flags) {
+      state.throttled = flags & 0xF;
+    }
+
+    return state;
+  }
+
+  void set_thread_name(const std::string &name) {
+    // The kernel keeps 15 characters and the terminator
+    pthread_setname_np(pthread_self(), name.substr(0, 15).c_str());
+  }
+
+  std::vector<thread_cpu_time_t> thread_cpu_times() {
+    static const auto ticks_per_second = sysconf(_SC_CLK_TCK);
+
+    std::vector<thread_cpu_time_t> threads;
+
+    std::error_code ec;
+    for (auto &task : fs::directory_iterator {"/proc/self/task"sv, ec}) {
+      // The thread may have exited since the directory was listed
+      std::ifstream in {task.path() / "stat"sv};
+      std::string stat;
+      if (!std::getline(in, stat)) {
+        continue;
+      }
+
+      // The name is in parentheses and may contain spaces and parentheses itself
+      auto open = stat.find('(');
+      auto close = stat.rfind(')');
+      if (open == std::string::npos || close == std::string::npos || close < open) {
+        continue;
+      }
+
+      // The fields after the name start at the 3rd, utime and stime are the 14th and 15th
+      std::istringstream fields {stat.substr(close + 1)};
+      std::string skipped;
+      for (int x = 3; x < 14; ++x) {
+        fields >> skipped;
+      }
+
+      unsigned long long utime;
+      unsigned long long stime;
+      if (!(fields >> utime >> stime)) {
+        continue;
+      }
+
+      threads.emplace_back(thread_cpu_time_t {
+        stat.substr(open + 1, close - open - 1),
+        std::chrono::nanoseconds {(utime + stime) * 1'000'000'000ULL / ticks_per_second},
+      });
+    }
+
+    return threads;
+  }
+
+  std::optional<std::uint64_t> resident_memory() {
+    // Sizes in pages: the total program size, then the resident set
+    std::ifstream in {"/proc/self/statm"};
+    std::uint64_t size;
+    std::uint64_t resident;
+    if (!(in >> size >> resident)) {
+      return std::nullopt;
+    }
+
+    return resident * sysconf(_SC_PAGESIZE);
+  }
+
+  std::optional<std::uint64_t> available_memory() {
+    std::ifstream in {"/proc/meminfo"};
+    std::string line;
+    while (std::getline(in, line)) {
+      // MemAvailable:  123456 kB
+      if (line.starts_with("MemAvailable:"sv)) {
+        return std::stoull(line.substr(line.find(':') + 1)) * 1024;
+      }
+    }
+
+    return std::nullopt;
+  }
+
+  bool lock_memory(const void *addr, std::size_t size) {
+    if (mlock(addr, size)) {
+      BOOST_LOG(debug) << "Couldn't lock "sv << size << " bytes in RAM: "sv << std::strerror(errno);
+      return false;
+    }
+
+    return true;
+  }
+
+  void unlock_memory(const void *addr, std::size_t size) {
+    munlock(addr, size);
+  }
+
+  // Governors of the CPU frequency policies before streaming started
+  static std::vector<std::pair<fs::path, std::string>> previous_governors;
+
+  // The PM QoS request lasts as long as the file stays open
+  static int cpu_dma_latency_fd = -1;
+
+  // Wireless interfaces that had power saving enabled before streaming started
+  static std::vector<std::string> wifi_power_save_interfaces;
+
+  /**
+   * @brief Get or set the power saving of a wireless interface, through the wireless extensions cfg80211 still answers.
+   * @param ifname The interface.
+   * @param enable The power saving to set, or std::nullopt to only get it.
+   * @return Whether power saving is enabled, or std::nullopt if the interface doesn't support it.
+   */
+  static std::optional<bool> wifi_power_save(const std::string &ifname, std::optional<bool> enable) {
+    auto fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+      return std::nullopt;
+    }
+
+    iwreq req {};
+    std::strncpy(req.ifr_name, ifname.c_str(), IFNAMSIZ - 1);
+
+    auto request = SIOCGIWPOWER;
+    if (enable) {
+      req.u.power.disabled = !*enable;
+      req.u.power.flags = IW_POWER_ON;
+      request = SIOCSIWPOWER;
+    }
+
+    auto result = ioctl(fd, request, &req);
+    close(fd);
+    if (result < 0) {
+      return std::nullopt;
+    }
+
+    return enable ? *enable : !req.u.power.disabled;
   }
 
   void streaming_will_start() {
-    // Nothing to do
+    if (config::sunshine.performance_governor) {
+      std::error_code ec;
+      for (auto &policy : fs::directory_iterator {"/sys/devices/system/cpu/cpufreq"sv, ec}) {
+        if (!policy.path().filename().string().starts_with("policy"sv)) {
+          continue;
+        }
+
+        auto path = policy.path() / "scaling_governor"sv;
+        std::string governor;
+        if (!(std::ifstream {path} >> governor) || governor == "performance"sv) {
+          continue;
+        }
+
+        // Writing the governor takes root
+        std::ofstream out {path};
+        if (!(out << "performance"sv << std::flush)) {
+          BOOST_LOG(warning) << "Couldn't switch "sv << policy.path().filename().string() << " to the performance governor"sv;
+          continue;
+        }
+
+        previous_governors.emplace_back(std::move(path), std::move(governor));
+      }
+
+      if (!previous_governors.empty()) {
+        BOOST_LOG(info) << "Switched "sv << previous_governors.size() << " CPU frequency policies to the performance governor"sv;
+      }
+    }
+
+    if (config::sunshine.cpu_dma_latency >= 0) {
+      cpu_dma_latency_fd = open("/dev/cpu_dma_latency", O_WRONLY | O_CLOEXEC);
+
+      std::int32_t latency = config::sunshine.cpu_dma_latency;
+      if (cpu_dma_latency_fd < 0 || write(cpu_dma_latency_fd, &latency, sizeof(latency)) != sizeof(latency)) {
+        BOOST_LOG(warning) << "Couldn't request a CPU wake-up latency of "sv << latency << "us: "sv << std::strerror(errno);
+
+        if (cpu_dma_latency_fd >= 0) {
+          close(cpu_dma_latency_fd);
+          cpu_dma_latency_fd = -1;
+        }
+      } else {
+        BOOST_LOG(info) << "Requested a CPU wake-up latency of "sv << latency << "us"sv;
+      }
+    }
+
+    if (config::sunshine.disable_wifi_power_save) {
+      std::error_code ec;
+      for (auto &interface : fs::directory_iterator {"/sys/class/net"sv, ec}) {
+        if (!fs::exists(interface.path() / "wireless"sv)) {
+          continue;
+        }
+
+        auto ifname = interface.path().filename().string();
+        if (wifi_power_save(ifname, std::nullopt) != true) {
+          continue;
+        }
+
+        if (!wifi_power_save(ifname, false)) {
+          BOOST_LOG(warning) << "Couldn't disable power saving of WLAN interface "sv << ifname << ": "sv << std::strerror(errno);
+          continue;
+        }
+
+        BOOST_LOG(info) << "WLAN interface "sv << ifname << " no longer saves power"sv;
+        wifi_power_save_interfaces.emplace_back(std::move(ifname));
+      }
+    }
   }
 
   void streaming_will_stop() {
-    // Nothing to do
+    for (auto &[path, governor] : previous_governors) {
+      std::ofstream out {path};
+      if (!(out << governor << std::flush)) {
+        BOOST_LOG(warning) << "Couldn't restore the "sv << governor << " governor of "sv << path.parent_path().filename().string();
+      }
+    }
+    previous_governors.clear();
+
+    // Closing the file withdraws our request
+    if (cpu_dma_latency_fd >= 0) {
+      close(cpu_dma_latency_fd);
+      cpu_dma_latency_fd = -1;
+    }
+
+    for (auto &ifname : wifi_power_save_interfaces) {
+      if (!wifi_power_save(ifname, true)) {
+        BOOST_LOG(warning) << "Couldn't enable power saving of WLAN interface "sv << ifname << " again"sv;
+      }
+    }
+    wifi_power_save_interfaces.clear();
   }
 
   void restart_on_exit() {
@@ -358,6 +685,55 @@ namespace platf {
     return saddr_v6;
   }
 
+  // GSO messages send_batch() hands to the kernel in a single io_uring submission
+  constexpr unsigned SEND_RING_ENTRIES = 8;
+
+  // Pinning the pages and reading the completion back costs more than copying smaller messages
+  constexpr size_t ZEROCOPY_MIN_BYTES = 16 * 1024;
+
+  /**
+   * @brief Get the io_uring send_batch() submits to on the calling thread.
+   * @return The ring, or nullptr if io_uring isn't available.
+   */
+  thread_local std::unique_ptr<uring::ring_t> send_ring_ptr;
+  thread_local bool send_ring_initialized = false;
+
+  uring::ring_t *send_ring() {
+    if (!send_ring_initialized) {
+      send_ring_initialized = true;
+
+      send_ring_ptr = uring::ring_t::create(SEND_RING_ENTRIES);
+      if (send_ring_ptr && !send_ring_ptr->supports(IORING_OP_SENDMSG)) {
+        send_ring_ptr.reset();
+      }
+
+      BOOST_LOG(debug) << (send_ring_ptr ? "Batched sends use io_uring"sv : "io_uring isn't available for batched sends"sv);
+    }
+
+    return send_ring_ptr.get();
+  }
+
+  /**
+   * @brief Stop using io_uring for batched sends on the calling thread.
+   * Closing the ring keeps entries it never submitted from going out later, pointing at messages long gone.
+   */
+  void drop_send_ring() {
+    BOOST_LOG(warning) << "Batched sends fall back to sendmsg() on this thread"sv;
+    send_ring_ptr.reset();
+  }
+
+  size_t send_batch_max_blocks(size_t block_size) {
+    // UDP GSO on Linux can't do more than 64K or 64 segments in one message
+    auto blocks_per_msg = std::clamp<size_t>(64 * 1024 / block_size, 1, 64);
+
+    // With io_uring, several GSO messages still take a single system call
+    if (send_ring()) {
+      return blocks_per_msg * SEND_RING_ENTRIES;
+    }
+
+    return blocks_per_msg;
+  }
+
   bool send_batch(batched_send_info_t &send_info) {
     auto sockfd = (int) send_info.native_socket;
     struct msghdr msg = {};
@@ -378,7 +754,7 @@ namespace platf {
     }
 
     union {
-      char buf[CMSG_SPACE(sizeof(uint16_t)) + std::max(CMSG_SPACE(sizeof(struct in_pktinfo)), CMSG_SPACE(sizeof(struct in6_pktinfo)))];
+      char buf[CMSG_SPACE(sizeof(uint16_t)) + CMSG_SPACE(sizeof(uint64_t)) + std::max(CMSG_SPACE(sizeof(struct in_pktinfo)), CMSG_SPACE(sizeof(struct in6_pktinfo)))];
       struct cmsghdr alignment;
     } cmbuf = {};  // Must be zeroed for CMSG_NXTHDR()
 
@@ -388,7 +764,7 @@ namespace platf {
     msg.msg_controllen = sizeof(cmbuf.buf);
 
     // The PKTINFO option will always be first, then we will conditionally
-    // append the UDP_SEGMENT option next if applicable.
+    // append the TXTIME and UDP_SEGMENT options next if applicable.
     auto pktinfo_cm = CMSG_FIRSTHDR(&msg);
     if (send_info.source_address.is_v6()) {
       struct in6_pktinfo pktInfo;
@@ -418,41 +794,208 @@ namespace platf {
       memcpy(CMSG_DATA(pktinfo_cm), &pktInfo, sizeof(pktInfo));
     }
 
+    auto last_cm = pktinfo_cm;
+#ifdef SO_TXTIME
+    if (send_info.txtime) {
+      // steady_clock is CLOCK_MONOTONIC, which is the clock enable_socket_txtime() asks for
+      uint64_t txtime = std::chrono::duration_cast<std::chrono::nanoseconds>(send_info.txtime->time_since_epoch()).count();
+
+      auto txtime_cm = CMSG_NXTHDR(&msg, last_cm);
+      txtime_cm->cmsg_level = SOL_SOCKET;
+      txtime_cm->cmsg_type = SCM_TXTIME;
+      txtime_cm->cmsg_len = CMSG_LEN(sizeof(txtime));
+      memcpy(CMSG_DATA(txtime_cm), &txtime, sizeof(txtime));
+
+      cmbuflen += CMSG_SPACE(sizeof(txtime));
+      last_cm = txtime_cm;
+    }
+#endif
+
     auto const max_iovs_per_msg = send_info.payload_buffers.size() + (send_info.headers ? 1 : 0);
 
 #ifdef UDP_SEGMENT
-    {
-      // UDP GSO on Linux currently only supports sending 64K or 64 segments at a time
-      size_t seg_index = 0;
-      const size_t seg_max = 65536 / 1500;
-      struct iovec iovs[(send_info.headers ? std::min(seg_max, send_info.block_count) : 1) * max_iovs_per_msg];
-      auto msg_size = send_info.header_size + send_info.payload_size;
-      while (seg_index < send_info.block_count) {
-        int iovlen = 0;
-        auto segs_in_batch = std::min(send_info.block_count - seg_index, seg_max);
-        if (send_info.headers) {
-          // Interleave iovs for headers and payloads
-          for (auto i = 0; i < segs_in_batch; i++) {
-            iovs[iovlen].iov_base = (void *) &send_info.headers[(send_info.block_offset + seg_index + i) * send_info.header_size];
-            iovs[iovlen].iov_len = send_info.header_size;
-            iovlen++;
-            auto payload_desc = send_info.buffer_for_payload_offset((send_info.block_offset + seg_index + i) * send_info.payload_size);
-            iovs[iovlen].iov_base = (void *) payload_desc.buffer;
-            iovs[iovlen].iov_len = send_info.payload_size;
-            iovlen++;
+    // UDP GSO on Linux currently only supports sending 64K or 64 segments at a time
+    const size_t seg_max = 65536 / 1500;
+    const size_t iovs_per_gso_msg = (send_info.headers ? std::min(seg_max, send_info.block_count) : 1) * max_iovs_per_msg;
+    auto msg_size = send_info.header_size + send_info.payload_size;
+
+  #ifdef MSG_ZEROCOPY
+    // Once the kernel runs out of room to track pinned pages, the rest of the batch is copied
+    bool zerocopy_refused = false;
+    auto send_flags = [&](size_t segs_in_batch) {
+      return send_info.zerocopy && !zerocopy_refused && segs_in_batch * msg_size >= ZEROCOPY_MIN_BYTES ? MSG_ZEROCOPY : 0;
+    };
+  #else
+    auto send_flags = [](size_t) {
+      return 0;
+    };
+  #endif
+
+    // Describe segs_in_batch segments starting at seg_index as one GSO message
+    auto fill_iovs = [&](struct iovec *iovs, size_t seg_index, size_t segs_in_batch) {
+      int iovlen = 0;
+      if (send_info.headers) {
+        // Interleave iovs for headers and payloads
+        for (auto i = 0; i < segs_in_batch; i++) {
+          iovs[iovlen].iov_base = (void *) &send_info.headers[(send_info.block_offset + seg_index + i) * send_info.header_size];
+          iovs[iovlen].iov_len = send_info.header_size;
+          iovlen++;
+          auto payload_desc = send_info.buffer_for_payload_offset((send_info.block_offset + seg_index + i) * send_info.payload_size);
+          iovs[iovlen].iov_base = (void *) payload_desc.buffer;
+          iovs[iovlen].iov_len = send_info.payload_size;
+          iovlen++;
+        }
+      } else {
+        // Translate buffer descriptors into iovs
+        auto payload_offset = (send_info.block_offset + seg_index) * send_info.payload_size;
+        auto payload_length = payload_offset + (segs_in_batch * send_info.payload_size);
+        while (payload_offset < payload_length) {
+          auto payload_desc = send_info.buffer_for_payload_offset(payload_offset);
+          iovs[iovlen].iov_base = (void *) payload_desc.buffer;
+          iovs[iovlen].iov_len = std::min(payload_desc.size, payload_length - payload_offset);
+          payload_offset += iovs[iovlen].iov_len;
+          iovlen++;
+        }
+      }
+
+      return iovlen;
+    };
+
+    // Segments already sent, the sendmsg() path below picks up where io_uring left off
+    size_t seg_index = 0;
+
+    if (auto ring = send_ring()) {
+      // Every GSO message shares the control messages, so the segment size is only filled in once
+      if (send_info.block_count > 1) {
+        auto cm = CMSG_NXTHDR(&msg, last_cm);
+        cm->cmsg_level = SOL_UDP;
+        cm->cmsg_type = UDP_SEGMENT;
+        cm->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+        *((uint16_t *) CMSG_DATA(cm)) = msg_size;
+      }
+
+      auto fixed_file = ring->register_socket(sockfd);
+
+      bool failed = false;
+      bool ring_failed = false;
+      struct msghdr msgs[SEND_RING_ENTRIES];
+      int results[SEND_RING_ENTRIES];
+      size_t segs[SEND_RING_ENTRIES];
+      int zerocopy_flags[SEND_RING_ENTRIES];
+      struct iovec iovs[SEND_RING_ENTRIES * iovs_per_gso_msg];
+      while (seg_index < send_info.block_count && !failed) {
+        // Queue as many GSO messages as the ring holds, linked so they go out in order
+        unsigned queued = 0;
+        io_uring_sqe *last_sqe = nullptr;
+        for (auto next_seg = seg_index; queued < SEND_RING_ENTRIES && next_seg < send_info.block_count; ++queued) {
+          auto sqe = ring->get_sqe();
+          if (!sqe) {
+            // Send what's queued, the rest goes into the next submission
+            break;
           }
-        } else {
-          // Translate buffer descriptors into iovs
-          auto payload_offset = (send_info.block_offset + seg_index) * send_info.payload_size;
-          auto payload_length = payload_offset + (segs_in_batch * send_info.payload_size);
-          while (payload_offset < payload_length) {
-            auto payload_desc = send_info.buffer_for_payload_offset(payload_offset);
-            iovs[iovlen].iov_base = (void *) payload_desc.buffer;
-            iovs[iovlen].iov_len = std::min(payload_desc.size, payload_length - payload_offset);
-            payload_offset += iovs[iovlen].iov_len;
-            iovlen++;
+
+          auto segs_in_batch = std::min(send_info.block_count - next_seg, seg_max);
+
+          auto &queued_msg = msgs[queued];
+          queued_msg = msg;
+          queued_msg.msg_iov = &iovs[queued * iovs_per_gso_msg];
+          queued_msg.msg_iovlen = fill_iovs(queued_msg.msg_iov, next_seg, segs_in_batch);
+          queued_msg.msg_controllen = segs_in_batch > 1 ? cmbuflen + CMSG_SPACE(sizeof(uint16_t)) : cmbuflen;
+          segs[queued] = segs_in_batch;
+          zerocopy_flags[queued] = send_flags(segs_in_batch);
+          next_seg += segs_in_batch;
+
+          sqe->opcode = IORING_OP_SENDMSG;
+          sqe->fd = fixed_file ? 0 : sockfd;
+          sqe->flags = (fixed_file ? IOSQE_FIXED_FILE : 0) | (next_seg < send_info.block_count ? IOSQE_IO_LINK : 0);
+          sqe->addr = (std::uintptr_t) &queued_msg;
+          sqe->len = 1;
+          sqe->msg_flags = zerocopy_flags[queued];
+          sqe->user_data = queued;
+          last_sqe = sqe;
+        }
+
+        if (!queued) {
+          // The submission queue holds entries that never went out, the ring can't be trusted
+          ring_failed = true;
+          break;
+        }
+
+        // A chain cut short by a full submission queue mustn't link to whatever is submitted next
+        last_sqe->flags &= ~IOSQE_IO_LINK;
+
+        // The messages and iovs live on this stack frame, so every completion must be in before returning
+        ring->submit_and_wait(queued);
+        for (unsigned completed = 0; completed < queued && !ring_failed; ++completed) {
+          io_uring_cqe cqe;
+          if (!ring->wait_cqe(cqe)) {
+            ring_failed = true;
+            break;
+          }
+          results[cqe.user_data] = cqe.res;
+        }
+        if (ring_failed) {
+          // Whatever didn't complete is sent again by sendmsg(), a duplicate is better than a gap
+          break;
+        }
+
+        for (unsigned x = 0; x < queued; ++x) {
+          auto res = results[x];
+  #ifdef MSG_ZEROCOPY
+          if (res == -ENOBUFS && zerocopy_flags[x]) {
+            // Too many pinned pages in flight, copy instead
+            zerocopy_refused = true;
+            break;
+          }
+  #endif
+          if (res == -EAGAIN || res == -ECANCELED) {
+            // The socket buffer is full, wait for space and resend the rest of the batch
+            if (res == -EAGAIN) {
+              struct pollfd pfd;
+
+              pfd.fd = sockfd;
+              pfd.events = POLLOUT;
+
+              if (poll(&pfd, 1, -1) != 1) {
+                BOOST_LOG(warning) << "poll() failed: "sv << errno;
+                failed = true;
+              }
+            }
+            break;
+          }
+
+          if (res < 0) {
+            // Without GSO support, the first message fails and we fall back to the non-GSO path below
+            BOOST_LOG(verbose) << "io_uring sendmsg() failed: "sv << -res;
+            failed = true;
+            break;
+          }
+
+          if (zerocopy_flags[x]) {
+            ++send_info.zerocopy->pending;
+          }
+
+          seg_index += res / msg_size;
+          if (res != segs[x] * msg_size) {
+            // Short send, resend from the first segment that didn't go out
+            break;
           }
         }
+      }
+
+      if (ring_failed) {
+        drop_send_ring();
+      } else if (seg_index != 0) {
+        // If we sent something, return the status and don't fall back to the non-GSO path.
+        return seg_index >= send_info.block_count;
+      }
+    }
+
+    {
+      struct iovec iovs[iovs_per_gso_msg];
+      while (seg_index < send_info.block_count) {
+        auto segs_in_batch = std::min(send_info.block_count - seg_index, seg_max);
+        int iovlen = fill_iovs(iovs, seg_index, segs_in_batch);
 
         msg.msg_iov = iovs;
         msg.msg_iovlen = iovlen;
@@ -462,7 +1005,7 @@ namespace platf {
           msg.msg_controllen = cmbuflen + CMSG_SPACE(sizeof(uint16_t));
 
           // Enable GSO to perform segmentation of our buffer for us
-          auto cm = CMSG_NXTHDR(&msg, pktinfo_cm);
+          auto cm = CMSG_NXTHDR(&msg, last_cm);
           cm->cmsg_level = SOL_UDP;
           cm->cmsg_type = UDP_SEGMENT;
           cm->cmsg_len = CMSG_LEN(sizeof(uint16_t));
@@ -474,8 +1017,17 @@ namespace platf {
         // This will fail if GSO is not available, so we will fall back to non-GSO if
         // it's the first sendmsg() call. On subsequent calls, we will treat errors as
         // actual failures and return to the caller.
-        auto bytes_sent = sendmsg(sockfd, &msg, 0);
+        auto flags = send_flags(segs_in_batch);
+        auto bytes_sent = sendmsg(sockfd, &msg, flags);
         if (bytes_sent < 0) {
+  #ifdef MSG_ZEROCOPY
+          if (errno == ENOBUFS && flags) {
+            // Too many pinned pages in flight, copy instead
+            zerocopy_refused = true;
+            continue;
+          }
+  #endif
+
           // If there's no send buffer space, wait for some to be available
           if (errno == EAGAIN) {
             struct pollfd pfd;
@@ -496,6 +1048,10 @@ namespace platf {
           break;
         }
 
+        if (flags) {
+          ++send_info.zerocopy->pending;
+        }
+
         seg_index += bytes_sent / msg_size;
       }
 
@@ -565,6 +1121,56 @@ namespace platf {
     }
   }
 
+  bool recv_batch(recv_batch_info_t &recv_info) {
+    auto sockfd = (int) recv_info.native_socket;
+
+    struct mmsghdr msgs[recv_info.max_datagrams];
+    struct iovec iovs[recv_info.max_datagrams];
+    struct sockaddr_storage peers[recv_info.max_datagrams];
+    for (size_t i = 0; i < recv_info.max_datagrams; i++) {
+      iovs[i].iov_base = recv_info.buffers + i * recv_info.max_datagram_size;
+      iovs[i].iov_len = recv_info.max_datagram_size;
+
+      msgs[i] = {};
+      msgs[i].msg_hdr.msg_name = &peers[i];
+      msgs[i].msg_hdr.msg_namelen = sizeof(peers[i]);
+      msgs[i].msg_hdr.msg_iov = &iovs[i];
+      msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    recv_info.datagrams.clear();
+
+    int msgs_received = recvmmsg(sockfd, msgs, recv_info.max_datagrams, MSG_DONTWAIT, nullptr);
+    if (msgs_received < 0) {
+      // ICMP errors for earlier sends are reported here too, they don't mean the socket is broken
+      if (errno != EAGAIN && errno != EWOULDBLOCK && errno != ECONNREFUSED && errno != EINTR) {
+        BOOST_LOG(warning) << "recvmmsg() failed: "sv << errno;
+      }
+      return true;
+    }
+
+    for (int i = 0; i < msgs_received; i++) {
+      auto &datagram = recv_info.datagrams.emplace_back();
+      datagram.size = msgs[i].msg_len;
+
+      if (peers[i].ss_family == AF_INET6) {
+        auto peer = (struct sockaddr_in6 *) &peers[i];
+
+        boost::asio::ip::address_v6::bytes_type bytes;
+        memcpy(bytes.data(), &peer->sin6_addr, bytes.size());
+        datagram.address = boost::asio::ip::address_v6 {bytes, peer->sin6_scope_id};
+        datagram.port = ntohs(peer->sin6_port);
+      } else {
+        auto peer = (struct sockaddr_in *) &peers[i];
+
+        datagram.address = boost::asio::ip::address_v4 {ntohl(peer->sin_addr.s_addr)};
+        datagram.port = ntohs(peer->sin_port);
+      }
+    }
+
+    return true;
+  }
+
   bool send(send_info_t &send_info) {
     auto sockfd = (int) send_info.native_socket;
     struct msghdr msg = {};
@@ -765,6 +1371,184 @@ namespace platf {
     return std::make_unique<qos_t>(sockfd, reset_options);
   }
 
+  bool enable_socket_txtime(uintptr_t native_socket) {
+#ifdef SO_TXTIME
+    struct sock_txtime txtime_cfg = {};
+    txtime_cfg.clockid = CLOCK_MONOTONIC;
+    txtime_cfg.flags = 0;
+
+    if (setsockopt((int) native_socket, SOL_SOCKET, SO_TXTIME, &txtime_cfg, sizeof(txtime_cfg)) != 0) {
+      BOOST_LOG(warning) << "Failed to set SO_TXTIME: "sv << std::strerror(errno);
+      return false;
+    }
+
+    return true;
+#else
+    return false;
+#endif
+  }
+
+  bool enable_socket_zerocopy(uintptr_t native_socket) {
+#if defined(SO_ZEROCOPY) && defined(MSG_ZEROCOPY)
+    int enable = 1;
+    if (setsockopt((int) native_socket, SOL_SOCKET, SO_ZEROCOPY, &enable, sizeof(enable)) != 0) {
+      BOOST_LOG(warning) << "Failed to set SO_ZEROCOPY: "sv << errno;
+      return false;
+    }
+
+    return true;
+#else
+    return false;
+#endif
+  }
+
+  bool wait_zerocopy(uintptr_t native_socket, zerocopy_state_t &state, std::chrono::milliseconds timeout) {
+#if defined(SO_ZEROCOPY) && defined(MSG_ZEROCOPY)
+    auto sockfd = (int) native_socket;
+    auto deadline = std::chrono::steady_clock::now() + timeout;
+
+    while (state.pending > 0) {
+      union {
+        char buf[CMSG_SPACE(sizeof(struct sock_extended_err) + sizeof(struct sockaddr_in6))];
+        struct cmsghdr alignment;
+      } cmbuf;
+
+      struct msghdr msg = {};
+      msg.msg_control = cmbuf.buf;
+      msg.msg_controllen = sizeof(cmbuf.buf);
+
+      // The completions are queued as errors, which don't wake up anything but poll()
+      if (recvmsg(sockfd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) {
+        if (errno != EAGAIN) {
+          BOOST_LOG(warning) << "Reading zero-copy completions failed: "sv << errno;
+          return false;
+        }
+
+        auto remaining = std::chrono::ceil<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+        struct pollfd pfd = {sockfd, 0, 0};
+        if (remaining <= 0 || poll(&pfd, 1, (int) remaining) <= 0) {
+          return false;
+        }
+        continue;
+      }
+
+      for (auto cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm)) {
+        if (!(cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR) &&
+            !(cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR)) {
+          continue;
+        }
+
+        auto err = (struct sock_extended_err *) CMSG_DATA(cm);
+        if (err->ee_origin != SO_EE_ORIGIN_ZEROCOPY || err->ee_errno != 0) {
+          continue;
+        }
+
+        // Each notification covers the range of sends [ee_info, ee_data]
+        state.pending = std::max<int>(0, state.pending - (int) (err->ee_data - err->ee_info + 1));
+        if (err->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) {
+          state.copied = true;
+        }
+      }
+    }
+#endif
+
+    return true;
+  }
+
+  int socket_send_queue_bytes(uintptr_t native_socket) {
+    int queued;
+    if (ioctl((int) native_socket, SIOCOUTQ, &queued) != 0) {
+      return -1;
+    }
+
+    return queued;
+  }
+
+  int probe_path_mtu(const boost::asio::ip::address &address, int max_size) {
+    // Nothing listens there, the host either drops the probes or answers port unreachable
+    constexpr std::uint16_t DISCARD_PORT = 9;
+    constexpr int MAX_PROBES = 4;
+    constexpr int PROBE_TIMEOUT_MS = 100;
+
+    auto v4 = address.is_v4() || address.to_v6().is_v4_mapped();
+
+    sockaddr_storage addr {};
+    socklen_t addr_len;
+    if (v4) {
+      auto bytes = address.is_v4() ? address.to_v4().to_bytes() : boost::asio::ip::make_address_v4(boost::asio::ip::v4_mapped, address.to_v6()).to_bytes();
+      auto sin = (sockaddr_in *) &addr;
+      sin->sin_family = AF_INET;
+      sin->sin_port = htons(DISCARD_PORT);
+      std::memcpy(&sin->sin_addr, bytes.data(), bytes.size());
+      addr_len = sizeof(sockaddr_in);
+    } else {
+      auto bytes = address.to_v6().to_bytes();
+      auto sin6 = (sockaddr_in6 *) &addr;
+      sin6->sin6_family = AF_INET6;
+      sin6->sin6_port = htons(DISCARD_PORT);
+      sin6->sin6_scope_id = address.to_v6().scope_id();
+      std::memcpy(&sin6->sin6_addr, bytes.data(), bytes.size());
+      addr_len = sizeof(sockaddr_in6);
+    }
+
+    int sockfd = socket(v4 ? AF_INET : AF_INET6, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (sockfd < 0) {
+      BOOST_LOG(warning) << "Failed to create path MTU probe socket: "sv << errno;
+      return -1;
+    }
+    auto fg = util::fail_guard([sockfd]() {
+      close(sockfd);
+    });
+
+    // Never fragment, the kernel refuses what exceeds the MTU it knows for the route and learns smaller ones from ICMP
+    int level = v4 ? IPPROTO_IP : IPPROTO_IPV6;
+    int mtu_option = v4 ? IP_MTU : IPV6_MTU;
+    int discover = v4 ? IP_PMTUDISC_DO : IPV6_PMTUDISC_DO;
+    if (setsockopt(sockfd, level, v4 ? IP_MTU_DISCOVER : IPV6_MTU_DISCOVER, &discover, sizeof(discover)) != 0) {
+      BOOST_LOG(warning) << "Failed to set path MTU discovery on probe socket: "sv << errno;
+      return -1;
+    }
+    if (connect(sockfd, (sockaddr *) &addr, addr_len) != 0) {
+      BOOST_LOG(warning) << "Failed to connect path MTU probe socket: "sv << errno;
+      return -1;
+    }
+
+    // IP and UDP headers
+    int headers = (v4 ? 20 : 40) + 8;
+    std::vector<char> probe(std::max(max_size - headers, 0));
+
+    auto size = max_size;
+    for (int x = 0; x < MAX_PROBES && size > headers; ++x) {
+      if (::send(sockfd, probe.data(), size - headers, 0) >= 0) {
+        // A router that can't forward the probe answers within a round trip, silence means it got through
+        pollfd pfd {sockfd, 0, 0};
+        if (poll(&pfd, 1, PROBE_TIMEOUT_MS) <= 0) {
+          return size;
+        }
+
+        // Reading the error clears it, port unreachable means the probe arrived whole
+        int error = 0;
+        socklen_t error_len = sizeof(error);
+        getsockopt(sockfd, SOL_SOCKET, SO_ERROR, &error, &error_len);
+        if (error != EMSGSIZE) {
+          return size;
+        }
+      } else if (errno != EMSGSIZE) {
+        BOOST_LOG(debug) << "Failed to send path MTU probe: "sv << errno;
+        return -1;
+      }
+
+      int mtu;
+      socklen_t mtu_len = sizeof(mtu);
+      if (getsockopt(sockfd, level, mtu_option, &mtu, &mtu_len) != 0 || mtu >= size) {
+        return -1;
+      }
+      size = mtu;
+    }
+
+    return size;
+  }
+
   std::string get_host_name() {
     try {
       return boost::asio::ip::host_name();
@@ -791,6 +1575,7 @@ namespace platf {
 #ifdef SUNSHINE_BUILD_PICAMERA
   PICAMERA,  ///< PiCamera
 #endif
+      SYNTHETIC,  ///< Synthetic test pattern
       MAX_FLAGS  ///< The maximum number of flags
     };
   }  // namespace source
@@ -843,8 +1628,7 @@ namespace platf {
   }
 
   std::shared_ptr<display_t> picamera_display(mem_type_e hwdevice_type, const std::string &display_name, const video::config_t &config) {
-    (void) hwdevice_type;
-    return picamera::create_display(display_name, config);
+    return picamera::create_display(hwdevice_type, display_name, config);
   }
 #endif
 
@@ -875,6 +1659,9 @@ namespace platf {
       return picamera_display_names();
     }
 #endif
+    if (sources[source::SYNTHETIC]) {
+      return synthetic::display_names();
+    }
     return {};
   }
 
@@ -887,6 +1674,35 @@ namespace platf {
     return true;
   }
 
+  std::string encoder_environment_id() {
+    struct utsname name;
+    if (uname(&name)) {
+      return {};
+    }
+
+    // Kernel drivers like V4L2 M2M and DRM are versioned with the kernel
+    std::stringstream id;
+    id << name.release << ' ' << name.version << ' ' << name.machine;
+
+    // The board model, so an SD card moved to another Pi is probed again
+    std::ifstream model {"/proc/device-tree/model"};
+    if (model) {
+      id << ' ' << model.rdbuf();
+    }
+
+    // PCI GPUs, platform GPUs like the one on the Pi have no IDs here
+    std::error_code ec;
+    for (auto &entry : fs::directory_iterator {"/sys/class/drm", ec}) {
+      std::ifstream vendor {entry.path() / "device/vendor"};
+      std::ifstream device {entry.path() / "device/device"};
+      if (vendor && device) {
+        id << ' ' << entry.path().filename().string() << '=' << vendor.rdbuf() << ':' << device.rdbuf();
+      }
+    }
+
+    return id.str();
+  }
+
   std::shared_ptr<display_t> display(mem_type_e hwdevice_type, const std::string &display_name, const video::config_t &config) {
 #ifdef SUNSHINE_BUILD_CUDA
     if (sources[source::NVFBC] && hwdevice_type == mem_type_e::cuda) {
@@ -918,6 +1734,30 @@ namespace platf {
       return picamera_display(hwdevice_type, display_name, config);
     }
 #endif
+    if (sources[source::SYNTHETIC]) {
+      return synthetic::display(hwdevice_type, config);
+    }
+
+    return nullptr;
+  }
+
+  bool has_encoded_display(const std::string &display_name, const video::config_t &config) {
+#ifdef SUNSHINE_BUILD_PICAMERA
+    if (sources[source::PICAMERA]) {
+      return picamera::has_encoded_display(display_name, config);
+    }
+#endif
+
+    return false;
+  }
+
+  std::unique_ptr<encoded_display_t> encoded_display(const std::string &display_name, const video::config_t &config) {
+#ifdef SUNSHINE_BUILD_PICAMERA
+    if (sources[source::PICAMERA]) {
+      BOOST_LOG(info) << "Capturing H.264 with PiCamera"sv;
+      return picamera::create_encoded_display(display_name, config);
+    }
+#endif
 
     return nullptr;
   }
@@ -946,6 +1786,10 @@ namespace platf {
     }
 #endif
 
+    // Only when asked for, it doesn't capture anything
+    if (config::video.capture == synthetic::NAME) {
+      sources[source::SYNTHETIC] = true;
+    }
 #ifdef SUNSHINE_BUILD_CUDA
     if ((config::video.capture.empty() && sources.none()) || config::video.capture == "nvfbc") {
       if (verify_nvfbc()) {
@@ -996,18 +1840,69 @@ namespace platf {
     return std::make_unique<deinit_t>();
   }
 
+  /**
+   * @brief Sleeps on an absolute timerfd deadline, with the timer slack of the sleeping thread cut to 1 ns.
+   * Otherwise the default slack of 50 us is added to every wakeup.
+   */
   class linux_high_precision_timer: public high_precision_timer {
   public:
+    explicit linux_high_precision_timer(std::chrono::nanoseconds spin):
+        spin {spin} {
+      fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+      if (fd < 0) {
+        BOOST_LOG(warning) << "timerfd_create() failed, falling back to nanosleep(): "sv << strerror(errno);
+      }
+    }
+
+    ~linux_high_precision_timer() override {
+      if (fd >= 0) {
+        close(fd);
+      }
+    }
+
     void sleep_for(const std::chrono::nanoseconds &duration) override {
-      std::this_thread::sleep_for(duration);
+      sleep_until(std::chrono::steady_clock::now() + duration);
+    }
+
+    void sleep_until(const std::chrono::steady_clock::time_point &deadline) override {
+      // The slack belongs to the thread, and a timer may sleep on another thread than the one that created it
+      thread_local bool slack_reduced = false;
+      if (!slack_reduced) {
+        prctl(PR_SET_TIMERSLACK, 1UL);
+        slack_reduced = true;
+      }
+
+      auto wakeup = deadline - spin;
+      if (wakeup > std::chrono::steady_clock::now()) {
+        // steady_clock is CLOCK_MONOTONIC, so its time points are deadlines the timerfd understands
+        auto since_epoch = std::chrono::duration_cast<std::chrono::nanoseconds>(wakeup.time_since_epoch());
+        itimerspec spec {};
+        spec.it_value.tv_sec = since_epoch.count() / 1000000000;
+        spec.it_value.tv_nsec = since_epoch.count() % 1000000000;
+
+        if (fd < 0 || timerfd_settime(fd, TFD_TIMER_ABSTIME, &spec, nullptr) < 0) {
+          std::this_thread::sleep_until(wakeup);
+        } else {
+          std::uint64_t expirations;
+          while (read(fd, &expirations, sizeof(expirations)) < 0 && errno == EINTR) {}
+        }
+      }
+
+      while (std::chrono::steady_clock::now() < deadline) {
+        // Spin through the wakeup latency
+      }
     }
 
     operator bool() override {
       return true;
     }
+
+  private:
+    int fd;
+    std::chrono::nanoseconds spin;
   };
 
-  std::unique_ptr<high_precision_timer> create_high_precision_timer() {
-    return std::make_unique<linux_high_precision_timer>();
+  std::unique_ptr<high_precision_timer> create_high_precision_timer(std::chrono::nanoseconds spin) {
+    return std::make_unique<linux_high_precision_timer>(spin);
   }
 }  // namespace platf
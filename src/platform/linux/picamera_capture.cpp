@@ -5,25 +5,45 @@
 
 // standard includes
 #include <algorithm>
+#include <cctype>
 #include <chrono>
+#include <cstdlib>
 #include <cstring>
 #include <filesystem>
+#include <map>
 #include <memory>
+#include <mutex>
+#include <optional>
 #include <string>
-#include <thread>
 #include <vector>
 
+// platform includes
+#include <fcntl.h>
+
 // lib includes
 extern "C" {
 #include <libavcodec/avcodec.h>
 #include <libavformat/avformat.h>
+#include <libavutil/hwcontext.h>
+#include <libavutil/hwcontext_drm.h>
 #include <libavutil/imgutils.h>
 #include <libswscale/swscale.h>
 }
 
 // local includes
+#include "src/config.h"
+#include "src/globals.h"
 #include "src/logging.h"
+#include "src/platform/linux/frame_tap.h"
 #include "src/platform/linux/picamera_capture.h"
+#include "src/platform/linux/picamera_composite.h"
+#include "src/platform/linux/v4l2.h"
+#include "src/trace.h"
+#include "src/utility.h"
+
+#ifdef SUNSHINE_BUILD_LIBCAMERA
+  #include "src/platform/linux/libcamera_capture.h"
+#endif
 
 using namespace std::literals;
 
@@ -38,15 +58,266 @@ namespace platf::picamera {
 			BOOST_LOG(error) << "PiCamera: " << fn << " failed: " << err_buf;
 		}
 
+		/**
+		 * @brief Map a decoder output format to one the encoder accepts without conversion.
+		 * @param format The decoder output format.
+		 * @return The matching pix_fmt_e, or nothing when the frame must be converted to BGRA.
+		 */
+		std::optional<pix_fmt_e> native_pix_fmt(AVPixelFormat format) {
+			switch (format) {
+				case AV_PIX_FMT_NV12:
+					return pix_fmt_e::nv12;
+				case AV_PIX_FMT_YUV420P:
+					return pix_fmt_e::yuv420p;
+				case AV_PIX_FMT_YUYV422:
+					return pix_fmt_e::yuyv422;
+				default:
+					return std::nullopt;
+			}
+		}
+
+		/**
+		 * @brief Map a V4L2 pixel format to the format of the images we hand out.
+		 * @param fourcc The negotiated V4L2 pixel format.
+		 * @return The matching pix_fmt_e, or nothing for formats the encoder can't take as-is.
+		 */
+		std::optional<pix_fmt_e> native_pix_fmt(std::uint32_t fourcc) {
+			switch (fourcc) {
+				case V4L2_PIX_FMT_NV12:
+					return pix_fmt_e::nv12;
+				case V4L2_PIX_FMT_YUV420:
+					return pix_fmt_e::yuv420p;
+				case V4L2_PIX_FMT_YUYV:
+					return pix_fmt_e::yuyv422;
+				default:
+					return std::nullopt;
+			}
+		}
+
+		/**
+		 * @brief Lay out an image the way consumers of img_t expect it.
+		 * Planes follow each other without padding, with the pitch derived from the width.
+		 * @return The size of the image, or a negative AVERROR.
+		 */
+		int image_layout(AVPixelFormat fmt, int width, int height, std::uint8_t *base, std::uint8_t *planes[4], int linesizes[4]) {
+			if (auto err = av_image_fill_linesizes(linesizes, fmt, width); err < 0) {
+				return err;
+			}
+
+			return av_image_fill_pointers(planes, fmt, height, base, linesizes);
+		}
+
+		/**
+		 * @brief Name of the v4l2 demuxer input_format for a compressed V4L2 format.
+		 * @param fourcc The V4L2 pixel format.
+		 * @return The FFmpeg codec name, or nullptr to let the demuxer choose.
+		 */
+		const char *input_format_name(std::uint32_t fourcc) {
+			switch (fourcc) {
+				case V4L2_PIX_FMT_MJPEG:
+				case V4L2_PIX_FMT_JPEG:
+					return "mjpeg";
+				case V4L2_PIX_FMT_H264:
+					return "h264";
+				default:
+					return nullptr;
+			}
+		}
+
+		/**
+		 * @brief Convert a presentation timestamp from the demuxer back to the driver's timestamp.
+		 * @param stream The stream of the packet or frame.
+		 * @param pts The presentation timestamp of a packet or frame.
+		 * @return The timestamp, or nothing if the demuxer didn't provide one.
+		 */
+		std::optional<std::chrono::steady_clock::time_point> driver_timestamp(const AVStream *stream, std::int64_t pts) {
+			if (pts == AV_NOPTS_VALUE) {
+				return std::nullopt;
+			}
+
+			auto us = std::chrono::microseconds {av_rescale_q(pts, stream->time_base, AVRational {1, 1000000})};
+			return std::chrono::steady_clock::time_point {std::chrono::duration_cast<std::chrono::steady_clock::duration>(us)};
+		}
+
+		/**
+		 * @brief Get the capture time of a packet or frame.
+		 * The v4l2 demuxer passes on the driver's buffer timestamp, which is on the
+		 * steady clock for any modern driver. Anything else is replaced with the current time.
+		 * @param stream The stream of the packet or frame.
+		 * @param pts The presentation timestamp of the packet or frame.
+		 */
+		std::chrono::steady_clock::time_point capture_timestamp(const AVStream *stream, std::int64_t pts) {
+			auto now = std::chrono::steady_clock::now();
+			auto timestamp = driver_timestamp(stream, pts);
+			if (!timestamp || *timestamp > now || now - *timestamp > 1s) {
+				return now;
+			}
+
+			return *timestamp;
+		}
+
+		/**
+		 * @brief Check if an H.264 access unit holds an IDR slice.
+		 * @param data The access unit in Annex B.
+		 * @param size The size of the access unit.
+		 * @return `true` if the client can start decoding at this access unit.
+		 */
+		bool contains_idr(const std::uint8_t *data, std::size_t size) {
+			for (std::size_t x = 0; x + 3 < size; ++x) {
+				// The NAL unit header follows the 00 00 01 of the start code
+				if (data[x] == 0 && data[x + 1] == 0 && data[x + 2] == 1) {
+					if ((data[x + 3] & 0x1F) == 5) {
+						return true;
+					}
+					x += 2;
+				}
+			}
+
+			return false;
+		}
+
+		// Formats probed in order of preference, raw YUV is captured directly and needs no decoding
+		const std::vector<std::uint32_t> CAMERA_FOURCCS {
+			V4L2_PIX_FMT_NV12,
+			V4L2_PIX_FMT_YUV420,
+			V4L2_PIX_FMT_YUYV,
+			V4L2_PIX_FMT_MJPEG,
+			V4L2_PIX_FMT_JPEG,
+			V4L2_PIX_FMT_H264,
+		};
+
+		std::mutex capabilities_mutex;
+		std::map<std::string, v4l2::capabilities_t> capabilities_cache;
+
+		/**
+		 * @brief Probe every V4L2 node and refresh the capability cache.
+		 * @return Capabilities of the camera nodes, in device number order.
+		 */
+		std::vector<v4l2::capabilities_t> probe_cameras() {
+			std::vector<std::pair<int, std::string>> nodes;
+
+			std::error_code ec;
+			for (auto &entry : std::filesystem::directory_iterator {"/dev", ec}) {
+				auto name = entry.path().filename().string();
+				if (name.rfind("video", 0) != 0 || name.size() == 5 || !std::all_of(std::begin(name) + 5, std::end(name), [](char c) {
+					  return std::isdigit((unsigned char) c);
+				  })) {
+					continue;
+				}
+
+				nodes.emplace_back(std::stoi(name.substr(5)), entry.path().string());
+			}
+			std::sort(std::begin(nodes), std::end(nodes));
+
+			std::vector<v4l2::capabilities_t> cameras;
+			for (auto &[_, path] : nodes) {
+				if (auto caps = v4l2::probe(path)) {
+					cameras.emplace_back(std::move(*caps));
+				}
+			}
+
+			std::lock_guard lg {capabilities_mutex};
+			capabilities_cache.clear();
+			for (auto &caps : cameras) {
+				capabilities_cache.emplace(caps.path, caps);
+			}
+
+			return cameras;
+		}
+
+		/**
+		 * @brief Get the capabilities of a camera, probing it only if it isn't cached yet.
+		 * @param path The device node.
+		 * @return The capabilities, or nothing if the node isn't a camera.
+		 */
+		std::optional<v4l2::capabilities_t> camera_capabilities(const std::string &path) {
+			{
+				std::lock_guard lg {capabilities_mutex};
+				if (auto it = capabilities_cache.find(path); it != std::end(capabilities_cache)) {
+					return it->second;
+				}
+			}
+
+			auto caps = v4l2::probe(path);
+			if (caps) {
+				std::lock_guard lg {capabilities_mutex};
+				capabilities_cache.emplace(path, *caps);
+			}
+
+			return caps;
+		}
+
+		/**
+		 * @brief Recycled, 64-byte aligned image buffers of a fixed size.
+		 * Buffers are pre-faulted when first allocated and never freed before the arena,
+		 * so once the capture pool has warmed up no allocations happen per frame.
+		 * Slots of a large frame are backed by huge pages, see util::alloc_aligned().
+		 */
+		class frame_arena_t {
+		public:
+			explicit frame_arena_t(std::size_t slot_size):
+					slot_size {(slot_size + util::BUFFER_ALIGNMENT - 1) / util::BUFFER_ALIGNMENT * util::BUFFER_ALIGNMENT} {
+				// The capture pool holds at most a dozen images
+				free_slots.reserve(16);
+				slots.reserve(16);
+			}
+
+			~frame_arena_t() {
+				for (auto slot : slots) {
+					util::free_aligned(slot, slot_size);
+				}
+			}
+
+			frame_arena_t(const frame_arena_t &) = delete;
+			frame_arena_t &operator=(const frame_arena_t &) = delete;
+
+			std::uint8_t *acquire() {
+				std::lock_guard lg {mutex};
+
+				if (!free_slots.empty()) {
+					auto slot = free_slots.back();
+					free_slots.pop_back();
+					return slot;
+				}
+
+				auto slot = (std::uint8_t *) util::alloc_aligned(slot_size);
+				if (!slot) {
+					return nullptr;
+				}
+
+				// Touch every page now rather than on the first captured frame
+				std::memset(slot, 0, slot_size);
+				slots.emplace_back(slot);
+
+				return slot;
+			}
+
+			void release(std::uint8_t *slot) {
+				std::lock_guard lg {mutex};
+				free_slots.emplace_back(slot);
+			}
+
+			const std::size_t slot_size;
+
+		private:
+			std::mutex mutex;
+			std::vector<std::uint8_t *> slots;
+			std::vector<std::uint8_t *> free_slots;
+		};
+
 		struct picamera_frame_t: public img_t {
-			picamera_frame_t() {
+			picamera_frame_t(std::shared_ptr<frame_arena_t> arena, std::uint8_t *slot):
+					arena {std::move(arena)} {
+				data = slot;
 				pixel_pitch = 4;
 			}
 
 			~picamera_frame_t() override {
-				delete[] data;
+				arena->release(data);
 				data = nullptr;
 			}
+
+			std::shared_ptr<frame_arena_t> arena;
 		};
 
 		class format_context_t {
@@ -55,16 +326,20 @@ namespace platf::picamera {
 				close();
 			}
 
-			bool open(const std::string &device, const video::config_t &cfg) {
+			bool open(const std::string &device, const v4l2::mode_t &mode) {
 				AVDictionary *options = nullptr;
 
-				if (cfg.width > 0 && cfg.height > 0) {
-					std::string size = std::to_string(cfg.width) + "x" + std::to_string(cfg.height);
+				if (mode.width > 0 && mode.height > 0) {
+					std::string size = std::to_string(mode.width) + "x" + std::to_string(mode.height);
 					av_dict_set(&options, "video_size", size.c_str(), 0);
 				}
 
-				if (cfg.framerate > 0) {
-					av_dict_set(&options, "framerate", std::to_string(cfg.framerate).c_str(), 0);
+				if (mode.framerate > 0) {
+					av_dict_set(&options, "framerate", std::to_string(mode.framerate).c_str(), 0);
+				}
+
+				if (auto input_format = input_format_name(mode.fourcc)) {
+					av_dict_set(&options, "input_format", input_format, 0);
 				}
 
 				auto input_fmt = av_find_input_format("v4l2");
@@ -131,17 +406,59 @@ namespace platf::picamera {
 				}
 			}
 
-			bool open(AVCodecParameters *params) {
+			/**
+			 * @brief Open the best decoder for the stream.
+			 * The V4L2 M2M hardware decoder is preferred when FFmpeg has one for the codec.
+			 * @param params The stream parameters.
+			 * @param target_width Width the frames will be encoded at.
+			 * @param target_height Height the frames will be encoded at.
+			 */
+			bool open(AVCodecParameters *params, int target_width, int target_height) {
 				if (!params) {
 					return false;
 				}
 
+				auto descriptor = avcodec_descriptor_get(params->codec_id);
+				if (descriptor) {
+					auto hw_name = std::string {descriptor->name} + "_v4l2m2m";
+					if (auto hw_decoder = avcodec_find_decoder_by_name(hw_name.c_str()); hw_decoder && open(hw_decoder, params, 0)) {
+						BOOST_LOG(info) << "PiCamera: decoding with "sv << hw_name;
+						return true;
+					}
+				}
+
 				auto decoder = avcodec_find_decoder(params->codec_id);
 				if (!decoder) {
 					BOOST_LOG(error) << "PiCamera: decoder not available";
 					return false;
 				}
 
+				// Decoding at a reduced resolution is far cheaper than decoding everything and scaling down afterwards
+				int lowres = 0;
+				while (lowres < decoder->max_lowres && target_width > 0 && target_height > 0 &&
+				       (params->width >> (lowres + 1)) >= target_width && (params->height >> (lowres + 1)) >= target_height) {
+					++lowres;
+				}
+
+				if (!open(decoder, params, lowres)) {
+					BOOST_LOG(error) << "PiCamera: failed to open decoder";
+					return false;
+				}
+
+				BOOST_LOG(info) << "PiCamera: decoding with "sv << decoder->name << (lowres ? " at 1/"s + std::to_string(1 << lowres) + " resolution"s : ""s);
+				return true;
+			}
+
+			AVCodecContext *get() {
+				return ctx;
+			}
+
+		private:
+			bool open(const AVCodec *decoder, AVCodecParameters *params, int lowres) {
+				if (ctx) {
+					avcodec_free_context(&ctx);
+				}
+
 				ctx = avcodec_alloc_context3(decoder);
 				if (!ctx) {
 					BOOST_LOG(error) << "PiCamera: failed to allocate decoder context";
@@ -153,19 +470,17 @@ namespace platf::picamera {
 					return false;
 				}
 
+				ctx->lowres = lowres;
+				ctx->flags |= AV_CODEC_FLAG_LOW_DELAY;
+
 				if (avcodec_open2(ctx, decoder, nullptr) < 0) {
-					BOOST_LOG(error) << "PiCamera: failed to open decoder";
+					avcodec_free_context(&ctx);
 					return false;
 				}
 
 				return true;
 			}
 
-			AVCodecContext *get() {
-				return ctx;
-			}
-
-		private:
 			AVCodecContext *ctx {nullptr};
 		};
 
@@ -194,22 +509,189 @@ namespace platf::picamera {
 			SwsContext *ctx {nullptr};
 		};
 
+		/**
+		 * @brief The opened demuxer, decoder and scaler of a compressed camera stream.
+		 * Opening these takes hundreds of milliseconds, so they outlive the display that
+		 * created them and are handed to the next session asking for the same mode.
+		 */
+		struct decode_pipeline_t {
+			~decode_pipeline_t() {
+				av_packet_free(&packet);
+				av_frame_free(&frame);
+				format.close();
+			}
+
+			format_context_t format;
+			codec_context_t codec;
+			scale_context_t scaler;
+			std::shared_ptr<frame_arena_t> arena;
+			AVPixelFormat output_fmt {AV_PIX_FMT_BGRA};
+			AVPacket *packet {nullptr};
+			AVFrame *frame {nullptr};
+			int width {};
+			int height {};
+
+			// Packets captured in [stale_after, stale_before) were buffered while parked
+			std::chrono::steady_clock::time_point stale_after;
+			std::chrono::steady_clock::time_point stale_before;
+		};
+
+		// How long an idle camera is kept open for the next session
+		constexpr auto WARM_CAMERA_TIMEOUT = 60s;
+
+		/**
+		 * @brief Identifies what a parked camera was opened for.
+		 * Only a session asking for exactly the same can pick it up.
+		 */
+		struct warm_key_t {
+			std::string device;
+			v4l2::mode_t mode;
+
+			// Direct V4L2 capture exports DMABUFs, FFmpeg decoding depends on the client size
+			bool export_dmabuf;
+			int target_width;
+			int target_height;
+
+			// Low latency mode changes the number of driver buffers
+			bool low_latency;
+
+			bool operator==(const warm_key_t &other) const {
+				return device == other.device && mode.fourcc == other.mode.fourcc && mode.width == other.mode.width &&
+				       mode.height == other.mode.height && mode.framerate == other.mode.framerate &&
+				       export_dmabuf == other.export_dmabuf && target_width == other.target_width && target_height == other.target_height &&
+				       low_latency == other.low_latency;
+			}
+		};
+
+		struct warm_camera_t {
+			warm_key_t key;
+			std::chrono::steady_clock::time_point parked;
+
+			// Exactly one of these is set, depending on how the camera was captured from
+			std::shared_ptr<v4l2::device_t> device;
+			std::unique_ptr<decode_pipeline_t> pipeline;
+		};
+
+		std::mutex warm_cameras_mutex;
+		std::map<std::string, warm_camera_t> warm_cameras;
+
+		/**
+		 * @brief Close cameras that have been idle for longer than WARM_CAMERA_TIMEOUT.
+		 */
+		void expire_warm_cameras() {
+			std::vector<warm_camera_t> expired;
+			{
+				std::lock_guard lg {warm_cameras_mutex};
+
+				auto now = std::chrono::steady_clock::now();
+				for (auto it = std::begin(warm_cameras); it != std::end(warm_cameras);) {
+					if (now - it->second.parked >= WARM_CAMERA_TIMEOUT) {
+						BOOST_LOG(debug) << "PiCamera: closing idle "sv << it->first;
+						expired.emplace_back(std::move(it->second));
+						it = warm_cameras.erase(it);
+					} else {
+						++it;
+					}
+				}
+			}
+
+			// Closing the devices can block, so expired is only destroyed once the lock is released
+		}
+
+		/**
+		 * @brief Keep an opened camera around for the next session.
+		 * @param key What the camera was opened for.
+		 * @param device The streaming V4L2 device, for direct capture.
+		 * @param pipeline The opened FFmpeg pipeline, for compressed streams.
+		 */
+		void park_warm_camera(warm_key_t key, std::shared_ptr<v4l2::device_t> device, std::unique_ptr<decode_pipeline_t> pipeline) {
+			std::optional<warm_camera_t> replaced;
+			{
+				std::lock_guard lg {warm_cameras_mutex};
+
+				auto path = key.device;
+				if (auto it = warm_cameras.find(path); it != std::end(warm_cameras)) {
+					replaced = std::move(it->second);
+					warm_cameras.erase(it);
+				}
+
+				warm_cameras.emplace(path, warm_camera_t {std::move(key), std::chrono::steady_clock::now(), std::move(device), std::move(pipeline)});
+			}
+
+			task_pool.pushDelayed(&expire_warm_cameras, WARM_CAMERA_TIMEOUT + 1s);
+		}
+
+		/**
+		 * @brief Take the parked camera for a device.
+		 * A camera parked for a different mode is closed, as the device can't be opened twice.
+		 * @param key What the session wants to open.
+		 * @return The parked camera if it matches @p key.
+		 */
+		std::optional<warm_camera_t> take_warm_camera(const warm_key_t &key) {
+			std::optional<warm_camera_t> warm;
+			{
+				std::lock_guard lg {warm_cameras_mutex};
+
+				auto it = warm_cameras.find(key.device);
+				if (it == std::end(warm_cameras)) {
+					return std::nullopt;
+				}
+
+				warm = std::move(it->second);
+				warm_cameras.erase(it);
+			}
+
+			if (!(warm->key == key)) {
+				BOOST_LOG(debug) << "PiCamera: closing "sv << key.device << " to open it in a different mode"sv;
+				return std::nullopt;
+			}
+
+			return warm;
+		}
+
 		class picamera_display_t: public platf::display_t {
 		public:
-			explicit picamera_display_t(std::string device_path):
-					device(std::move(device_path)) {
+			picamera_display_t(std::string device_path, platf::mem_type_e hwdevice_type):
+					device(std::move(device_path)),
+					hwdevice_type {hwdevice_type} {
 				width = 1280;
 				height = 720;
 			}
 
 			~picamera_display_t() override {
-				format.close();
+				if (pipeline && reusable) {
+					park_warm_camera({device, mode, false, target_width, target_height, low_latency}, nullptr, std::move(pipeline));
+				}
 			}
 
-					bool init(const video::config_t &cfg) {
-						delay = std::chrono::nanoseconds {1s} / std::max(1, cfg.framerate);
+			bool init(const v4l2::mode_t &mode, int target_width, int target_height) {
+				this->mode = mode;
+				this->target_width = target_width;
+				this->target_height = target_height;
+				low_latency = config::video.picamera.low_latency;
+
+				if (auto warm = take_warm_camera({device, mode, false, target_width, target_height, low_latency}); warm && warm->pipeline) {
+					pipeline = std::move(warm->pipeline);
+
+					// The driver kept capturing while nobody was reading, those frames are stale now
+					avcodec_flush_buffers(pipeline->codec.get());
+					pipeline->stale_after = warm->parked - 1s;
+					pipeline->stale_before = std::chrono::steady_clock::now();
 
-						if (!format.open(device, cfg)) {
+					width = pipeline->width;
+					height = pipeline->height;
+					env_width = width;
+					env_height = height;
+
+					BOOST_LOG(info) << "PiCamera: resumed warm capture from "sv << device;
+					reusable = true;
+					return true;
+				}
+
+				pipeline = std::make_unique<decode_pipeline_t>();
+				auto &format = pipeline->format;
+				auto &codec = pipeline->codec;
+				if (!format.open(device, mode)) {
 					return false;
 				}
 
@@ -218,35 +700,73 @@ namespace platf::picamera {
 					return false;
 				}
 
-				width = stream->codecpar->width;
-				height = stream->codecpar->height;
+				if (!codec.open(stream->codecpar, target_width, target_height)) {
+					return false;
+				}
+
+				auto &frame = pipeline->frame;
+				pipeline->packet = av_packet_alloc();
+				frame = av_frame_alloc();
+				if (!pipeline->packet || !frame) {
+					BOOST_LOG(error) << "PiCamera: failed to allocate packet/frame";
+					return false;
+				}
+
+				// Hardware and reduced resolution decoders only settle on their output once they have a frame
+				auto status = capture_e::timeout;
+				for (int x = 0; x < 30 && status == capture_e::timeout; ++x) {
+					status = decode_frame();
+				}
+				if (status != capture_e::ok) {
+					BOOST_LOG(error) << "PiCamera: no frame decoded from "sv << device;
+					return false;
+				}
+
+				width = frame->width;
+				height = frame->height;
 				env_width = width;
 				env_height = height;
 
-				if (!codec.open(stream->codecpar)) {
+				if (width != target_width || height != target_height) {
+					BOOST_LOG(info) << "PiCamera: "sv << device << " decodes to "sv << width << 'x' << height << ", frames will be scaled to "sv << target_width << 'x' << target_height << " in software"sv;
+				}
+
+				// Size the buffers for the images this stream produces
+				auto &output_fmt = pipeline->output_fmt;
+				output_fmt = native_pix_fmt(static_cast<AVPixelFormat>(frame->format)) ? static_cast<AVPixelFormat>(frame->format) : AV_PIX_FMT_BGRA;
+				av_frame_unref(frame);
+				int linesizes[4];
+				std::uint8_t *planes[4];
+				auto slot_size = image_layout(output_fmt, width, height, nullptr, planes, linesizes);
+				if (slot_size < 0) {
+					log_ffmpeg_error("av_image_fill_pointers", slot_size);
 					return false;
 				}
+				pipeline->arena = std::make_shared<frame_arena_t>(slot_size);
+				pipeline->width = width;
+				pipeline->height = height;
 
 				BOOST_LOG(info) << "PiCamera: capturing from " << device;
+				reusable = true;
 				return true;
 			}
 
 			capture_e capture(const push_captured_image_cb_t &push_captured_image_cb, const pull_free_image_cb_t &pull_free_image_cb, bool *cursor) override {
 				(void) cursor;
 
-				auto next_frame = std::chrono::steady_clock::now();
-				sleep_overshoot_logger.reset();
-
+				// av_read_frame() blocks until the driver delivers a buffer, which paces the loop
 				while (true) {
-					auto now = std::chrono::steady_clock::now();
-					if (next_frame > now) {
-						std::this_thread::sleep_for(next_frame - now);
-						sleep_overshoot_logger.first_point(next_frame);
-						sleep_overshoot_logger.second_point_now_and_log();
-					}
-					next_frame += delay;
-					if (next_frame < now) {
-						next_frame = now + delay;
+					if (!frame_wanted()) {
+						auto status = skip_frame();
+						if (status != capture_e::ok && status != capture_e::timeout) {
+							reusable = false;
+							return status;
+						}
+
+						if (!push_captured_image_cb(nullptr, false)) {
+							return capture_e::ok;
+						}
+						continue;
 					}
 
 					std::shared_ptr<platf::img_t> img_out;
@@ -264,29 +784,48 @@ namespace platf::picamera {
 							return capture_e::ok;
 						}
 					} else {
+						// Whatever went wrong stays wrong, so don't hand this pipeline to the next session
+						reusable = false;
 						return status;
 					}
 				}
 			}
 
 			std::shared_ptr<img_t> alloc_img() override {
-				auto image = std::make_shared<picamera_frame_t>();
+				auto &arena = pipeline->arena;
+				auto slot = arena->acquire();
+				if (!slot) {
+					BOOST_LOG(error) << "PiCamera: failed to allocate image buffer";
+					return nullptr;
+				}
+
+				auto image = std::make_shared<picamera_frame_t>(arena, slot);
+				image->width = width;
 				image->row_pitch = width * 4;
 				image->height = height;
-				image->data = new std::uint8_t[static_cast<size_t>(image->row_pitch) * image->height];
 				return image;
 			}
 
 			int dummy_img(img_t *img) override {
-				if (!img) {
+				if (!img || !img->data) {
 					return -1;
 				}
-				if (!img->data) {
-					img->row_pitch = width * 4;
-					img->height = height;
-					img->data = new std::uint8_t[static_cast<size_t>(img->row_pitch) * img->height];
+
+				auto output_fmt = pipeline->output_fmt;
+				int linesizes[4];
+				std::uint8_t *planes[4];
+				if (image_layout(output_fmt, width, height, img->data, planes, linesizes) < 0) {
+					return -1;
 				}
-				std::memset(img->data, 0, static_cast<size_t>(img->row_pitch) * img->height);
+
+				ptrdiff_t black_linesizes[4] {linesizes[0], linesizes[1], linesizes[2], linesizes[3]};
+				av_image_fill_black(planes, black_linesizes, output_fmt, AVCOL_RANGE_MPEG, width, height);
+
+				img->width = width;
+				img->height = height;
+				img->pixel_pitch = output_fmt == AV_PIX_FMT_BGRA ? 4 : output_fmt == AV_PIX_FMT_YUYV422 ? 2 : 1;
+				img->row_pitch = linesizes[0];
+				img->pix_fmt = native_pix_fmt(output_fmt);
 				return 0;
 			}
 
@@ -299,41 +838,64 @@ namespace platf::picamera {
 				return true;
 			}
 
-		private:
-			capture_e read_frame(platf::img_t &img) {
-				AVPacket packet;
-				av_init_packet(&packet);
-				packet.data = nullptr;
-				packet.size = 0;
+			bool is_live_source() override {
+				return true;
+			}
 
-				int result = av_read_frame(format.get(), &packet);
-				if (result < 0) {
-					if (result == AVERROR(EAGAIN)) {
-						return capture_e::timeout;
-					}
-					log_ffmpeg_error("av_read_frame", result);
-					return capture_e::error;
+			double source_framerate() override {
+				return mode.framerate;
+			}
+
+			bool hot_switch(const std::string &display_name, const ::video::config_t &config) override {
+				auto next = std::dynamic_pointer_cast<picamera_display_t>(create_display(hwdevice_type, display_name, config));
+				if (!next) {
+					return false;
 				}
 
-				if (packet.stream_index != format.index()) {
-					av_packet_unref(&packet);
-					return capture_e::timeout;
+				// The images of the capture pool are filled from the new camera, so their layout mustn't change
+				if (next->width != width || next->height != height || next->pipeline->output_fmt != pipeline->output_fmt) {
+					BOOST_LOG(info) << "PiCamera: "sv << display_name << " delivers different frames than "sv << device << ", the encoders are rebuilt"sv;
+					return false;
 				}
 
-				result = avcodec_send_packet(codec.get(), &packet);
-				av_packet_unref(&packet);
-				if (result < 0) {
-					log_ffmpeg_error("avcodec_send_packet", result);
-					return capture_e::error;
+				// The old camera is parked when next is destroyed, so switching back is quick
+				std::swap(device, next->device);
+				std::swap(mode, next->mode);
+				std::swap(pipeline, next->pipeline);
+				std::swap(reusable, next->reusable);
+
+				BOOST_LOG(info) << "PiCamera: switched to "sv << device << " without rebuilding the encoders"sv;
+				return true;
+			}
+
+		private:
+			/**
+			 * @brief Read the next packet from the device and decode it into frame.
+			 * @return capture_e::ok when frame holds a decoded picture.
+			 */
+			capture_e decode_frame() {
+				auto &codec = pipeline->codec;
+				auto packet = pipeline->packet;
+				auto frame = pipeline->frame;
+
+				{
+					trace::scope_t span {trace::stage_e::camera_read, -1};
+					if (auto status = read_packet(); status != capture_e::ok) {
+						return status;
+					}
 				}
 
-				std::unique_ptr<AVFrame, decltype(&av_frame_free)> frame(av_frame_alloc(), &av_frame_free);
-				if (!frame) {
-					BOOST_LOG(error) << "PiCamera: failed to allocate frame";
+				decode_time_logger.first_point_now();
+				trace::scope_t span {trace::stage_e::camera_decode, -1};
+
+				int result = avcodec_send_packet(codec.get(), packet);
+				av_packet_unref(packet);
+				if (result < 0) {
+					log_ffmpeg_error("avcodec_send_packet", result);
 					return capture_e::error;
 				}
 
-				result = avcodec_receive_frame(codec.get(), frame.get());
+				result = avcodec_receive_frame(codec.get(), frame);
 				if (result == AVERROR(EAGAIN)) {
 					return capture_e::timeout;
 				}
@@ -342,57 +904,797 @@ namespace platf::picamera {
 					return capture_e::error;
 				}
 
-				width = frame->width;
-				height = frame->height;
-				env_width = width;
-				env_height = height;
+				decode_time_logger.second_point_now_and_log();
+				return capture_e::ok;
+			}
+
+			/**
+			 * @brief Read the next packet worth decoding into the pipeline's packet.
+			 * Packets buffered while the pipeline was parked are skipped, and so are packets the
+			 * driver queued up while we were busy when low latency mode allows dropping them.
+			 * @return capture_e::ok when packet holds data of the video stream.
+			 */
+			capture_e read_packet() {
+				auto &format = pipeline->format;
+				auto packet = pipeline->packet;
+
+				// Only intra-only streams can lose packets without corrupting the frames that follow
+				auto descriptor = avcodec_descriptor_get(format.stream()->codecpar->codec_id);
+				auto can_drop = low_latency && descriptor && (descriptor->props & AV_CODEC_PROP_INTRA_ONLY);
+				auto max_age = std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double> {1.5 / std::max(1.0, mode.framerate)});
+
+				int dropped = 0;
+				while (true) {
+					int result = av_read_frame(format.get(), packet);
+					if (result < 0) {
+						if (result == AVERROR(EAGAIN)) {
+							return capture_e::timeout;
+						}
+						log_ffmpeg_error("av_read_frame", result);
+						return capture_e::error;
+					}
+
+					if (packet->stream_index != format.index()) {
+						av_packet_unref(packet);
+						return capture_e::timeout;
+					}
+
+					auto timestamp = driver_timestamp(format.stream(), packet->pts);
+					auto now = std::chrono::steady_clock::now();
+
+					// Skip what the driver buffered while the pipeline was parked, without decoding it
+					if (pipeline->stale_before != std::chrono::steady_clock::time_point {}) {
+						if (timestamp && *timestamp >= pipeline->stale_after && *timestamp < pipeline->stale_before) {
+							av_packet_unref(packet);
+							continue;
+						}
 
-				if (!scaler.configure(frame->width, frame->height, static_cast<AVPixelFormat>(frame->format), frame->width, frame->height)) {
+						pipeline->stale_before = {};
+					}
+
+					// A newer frame is already waiting in the driver if this one is older than a frame interval
+					if (can_drop && timestamp && *timestamp <= now && now - *timestamp > max_age && now - *timestamp < 1s) {
+						av_packet_unref(packet);
+						++dropped;
+						continue;
+					}
+
+					break;
+				}
+
+				if (low_latency) {
+					queue_depth_logger.collect_and_log(dropped + 1);
+				}
+
+				return capture_e::ok;
+			}
+
+			/**
+			 * @brief Take the next frame off the device without converting it.
+			 * Intra-only streams aren't even decoded, anything else is so the frames that follow still decode.
+			 * @return capture_e::ok when a frame was skipped.
+			 */
+			capture_e skip_frame() {
+				auto descriptor = avcodec_descriptor_get(pipeline->format.stream()->codecpar->codec_id);
+				if (descriptor && (descriptor->props & AV_CODEC_PROP_INTRA_ONLY)) {
+					trace::scope_t span {trace::stage_e::camera_read, -1};
+					auto status = read_packet();
+					av_packet_unref(pipeline->packet);
+					return status;
+				}
+
+				auto status = decode_frame();
+				av_frame_unref(pipeline->frame);
+				return status;
+			}
+
+			capture_e read_frame(platf::img_t &img) {
+				if (auto status = decode_frame(); status != capture_e::ok) {
+					return status;
+				}
+
+				auto frame = pipeline->frame;
+				auto output_fmt = pipeline->output_fmt;
+				auto &scaler = pipeline->scaler;
+
+				// The decoder's buffer pool gets its buffer back as soon as we're done copying
+				auto fg = util::fail_guard([frame]() {
+					av_frame_unref(frame);
+				});
+
+				auto frame_timestamp = capture_timestamp(pipeline->format.stream(), frame->best_effort_timestamp);
+
+				// YUV straight from the sensor is passed through, anything else is converted to BGRA
+				auto native_fmt = native_pix_fmt(static_cast<AVPixelFormat>(frame->format));
+				auto dst_fmt = native_fmt ? static_cast<AVPixelFormat>(frame->format) : AV_PIX_FMT_BGRA;
+
+				uint8_t *dst_data[4] {};
+				int dst_linesize[4] {};
+				auto size = image_layout(dst_fmt, frame->width, frame->height, img.data, dst_data, dst_linesize);
+				if (size < 0) {
+					log_ffmpeg_error("av_image_fill_pointers", size);
 					return capture_e::error;
 				}
 
-				if (!img.data || img.row_pitch != frame->width * 4 || img.height != frame->height) {
-					delete[] img.data;
-					img.row_pitch = frame->width * 4;
-					img.height = frame->height;
-					img.data = new std::uint8_t[static_cast<size_t>(img.row_pitch) * img.height];
+				if (dst_fmt != output_fmt || frame->width != width || frame->height != height || static_cast<std::size_t>(size) > pipeline->arena->slot_size) {
+					BOOST_LOG(info) << "PiCamera: stream format changed, reinitializing";
+					return capture_e::reinit;
 				}
 
 				img.width = frame->width;
 				img.height = frame->height;
-				img.pixel_pitch = 4;
-
-				uint8_t *dst_data[4] {img.data, nullptr, nullptr, nullptr};
-				int dst_linesize[4] {img.row_pitch, 0, 0, 0};
+				img.pixel_pitch = !native_fmt ? 4 : *native_fmt == pix_fmt_e::yuyv422 ? 2 : 1;
+				img.row_pitch = dst_linesize[0];
+
+				trace::scope_t span {trace::stage_e::camera_scale, -1};
+				if (native_fmt) {
+					av_image_copy(dst_data, dst_linesize, (const std::uint8_t **) frame->data, frame->linesize, dst_fmt, frame->width, frame->height);
+					img.pix_fmt = native_fmt;
+				} else {
+					if (!scaler.configure(frame->width, frame->height, static_cast<AVPixelFormat>(frame->format), frame->width, frame->height)) {
+						return capture_e::error;
+					}
 
-				if (sws_scale(scaler.get(), frame->data, frame->linesize, 0, frame->height, dst_data, dst_linesize) <= 0) {
-					BOOST_LOG(error) << "PiCamera: sws_scale failed";
-					return capture_e::error;
+					if (sws_scale(scaler.get(), frame->data, frame->linesize, 0, frame->height, dst_data, dst_linesize) <= 0) {
+						BOOST_LOG(error) << "PiCamera: sws_scale failed";
+						return capture_e::error;
+					}
+					img.pix_fmt.reset();
 				}
 
-				img.frame_timestamp = std::chrono::steady_clock::now();
+				img.frame_timestamp = frame_timestamp;
 				return capture_e::ok;
 			}
 
 			std::string device;
-			format_context_t format;
-			codec_context_t codec;
-			scale_context_t scaler;
-			std::chrono::nanoseconds delay {std::chrono::nanoseconds {1s} / 30};
+			platf::mem_type_e hwdevice_type;
+			v4l2::mode_t mode {};
+			int target_width {};
+			int target_height {};
+			std::unique_ptr<decode_pipeline_t> pipeline;
+			bool low_latency {false};
+
+			// Only a display that initialised and never failed hands its camera to the next session
+			bool reusable {false};
+			logging::time_delta_periodic_logger decode_time_logger = {debug, "PiCamera frame decode"};
+			logging::min_max_avg_periodic_logger<int> queue_depth_logger = {debug, "PiCamera frames queued", ""};
 		};
-	}  // namespace
+		// DRM_FORMAT_MOD_LINEAR, V4L2 MMAP buffers are always linear
+		constexpr std::uint64_t DRM_FORMAT_MOD_LINEAR = 0;
 
-	bool initialize() {
-		return std::filesystem::exists(DEFAULT_DEVICE.data());
+		// Number of driver buffers, enough for the encoder to hold a frame while the sensor fills the next ones
+		constexpr int V4L2_BUFFER_COUNT = 6;
+
+		// Fewest buffers that keep the sensor streaming, one held by the encoder, one ready and one being filled
+		constexpr int V4L2_LOW_LATENCY_BUFFER_COUNT = 3;
+
+		struct v4l2_img_t: public img_t {
+			~v4l2_img_t() override {
+				// data points into the driver mapping owned by the lease
+				data = nullptr;
+			}
+
+			std::shared_ptr<v4l2::buffer_lease_t> lease;
+		};
+
+		class dmabuf_encode_device_t: public avcodec_encode_device_t {
+		public:
+			dmabuf_encode_device_t() {
+				data = (void *) init_hw_device;
+			}
+
+			~dmabuf_encode_device_t() override {
+				av_buffer_unref(&hw_frames_ctx);
+				av_frame_free(&frame);
+			}
+
+			/**
+			 * @brief Create a DRM hwdevice without opening a DRM node.
+			 * The encoder only needs the frame descriptors, so no render device is required.
+			 */
+			static int init_hw_device(platf::avcodec_encode_device_t *, AVBufferRef **hw_device_buf) {
+				auto buf = av_hwdevice_ctx_alloc(AV_HWDEVICE_TYPE_DRM);
+				if (!buf) {
+					return -1;
+				}
+
+				auto device_ctx = (AVDRMDeviceContext *) ((AVHWDeviceContext *) buf->data)->hwctx;
+				device_ctx->fd = -1;
+
+				if (auto err = av_hwdevice_ctx_init(buf); err < 0) {
+					log_ffmpeg_error("av_hwdevice_ctx_init", err);
+					av_buffer_unref(&buf);
+					return -1;
+				}
+
+				*hw_device_buf = buf;
+				return 0;
+			}
+
+			int set_frame(AVFrame *frame, AVBufferRef *hw_frames_ctx) override {
+				this->frame = frame;
+				this->hw_frames_ctx = av_buffer_ref(hw_frames_ctx);
+
+				return this->hw_frames_ctx ? 0 : -1;
+			}
+
+			int convert(platf::img_t &img) override {
+				auto dmabuf_img = dynamic_cast<v4l2_img_t *>(&img);
+				if (!dmabuf_img || !dmabuf_img->lease) {
+					BOOST_LOG(error) << "PiCamera: expected a DMABUF image";
+					return -1;
+				}
+
+				auto &lease = dmabuf_img->lease;
+				auto &buffer = lease->buffer();
+				if (buffer.dmabuf_fd.el < 0) {
+					return -1;
+				}
+
+				auto desc = (AVDRMFrameDescriptor *) av_mallocz(sizeof(AVDRMFrameDescriptor));
+				if (!desc) {
+					return -1;
+				}
+
+				desc->nb_objects = 1;
+				desc->objects[0].fd = buffer.dmabuf_fd.el;
+				desc->objects[0].size = buffer.length;
+				desc->objects[0].format_modifier = DRM_FORMAT_MOD_LINEAR;
+
+				// DRM and V4L2 share the fourcc codes for NV12, YU12 and YUYV
+				auto &layer = desc->layers[0];
+				desc->nb_layers = 1;
+				layer.format = format.fourcc;
+
+				auto luma_size = (ptrdiff_t) format.bytesperline * format.height;
+				switch (format.fourcc) {
+					case V4L2_PIX_FMT_NV12:
+						layer.nb_planes = 2;
+						layer.planes[0] = {0, 0, (ptrdiff_t) format.bytesperline};
+						layer.planes[1] = {0, luma_size, (ptrdiff_t) format.bytesperline};
+						break;
+					case V4L2_PIX_FMT_YUV420:
+						layer.nb_planes = 3;
+						layer.planes[0] = {0, 0, (ptrdiff_t) format.bytesperline};
+						layer.planes[1] = {0, luma_size, (ptrdiff_t) format.bytesperline / 2};
+						layer.planes[2] = {0, luma_size + luma_size / 4, (ptrdiff_t) format.bytesperline / 2};
+						break;
+					default:
+						layer.nb_planes = 1;
+						layer.planes[0] = {0, 0, (ptrdiff_t) format.bytesperline};
+						break;
+				}
+
+				// The driver buffer goes back to the queue once the encoder drops its last reference to the frame
+				auto opaque = new std::shared_ptr<v4l2::buffer_lease_t>(lease);
+				auto buf = av_buffer_create((std::uint8_t *) desc, sizeof(*desc), release_descriptor, opaque, 0);
+				if (!buf) {
+					delete opaque;
+					av_free(desc);
+					return -1;
+				}
+
+				av_buffer_unref(&frame->buf[0]);
+				frame->buf[0] = buf;
+				frame->data[0] = (std::uint8_t *) desc;
+
+				av_buffer_unref(&frame->hw_frames_ctx);
+				frame->hw_frames_ctx = av_buffer_ref(hw_frames_ctx);
+
+				return 0;
+			}
+
+			v4l2::format_t format {};
+
+		private:
+			static void release_descriptor(void *opaque, std::uint8_t *data) {
+				delete (std::shared_ptr<v4l2::buffer_lease_t> *) opaque;
+				av_free(data);
+			}
+
+			AVBufferRef *hw_frames_ctx {};
+		};
+
+		/**
+		 * @brief The tap of picamera_frame_tap, kept across sessions so consumers stay connected.
+		 * @return The tap, or nullptr if none is set or its socket couldn't be bound.
+		 */
+		std::shared_ptr<frame_tap::tap_t> shared_frame_tap() {
+			static std::mutex mutex;
+			static std::string path;
+			static std::shared_ptr<frame_tap::tap_t> tap;
+
+			std::lock_guard lg {mutex};
+			if (path != config::video.picamera.frame_tap) {
+				path = config::video.picamera.frame_tap;
+				tap.reset();
+				if (!path.empty()) {
+					tap = frame_tap::start(path);
+				}
+			}
+
+			return tap;
+		}
+
+		/**
+		 * @brief Capture uncompressed frames straight from the V4L2 driver.
+		 * Capture is driven by the driver signalling a filled buffer, and images point into the
+		 * driver's buffers. With DMABUF export, frames never touch the CPU at all.
+		 */
+		class v4l2_display_t: public platf::display_t {
+		public:
+			~v4l2_display_t() override {
+				if (device && reusable) {
+					warm_key_t key {device->path(), mode, export_dmabuf, target_width, target_height, low_latency};
+					park_warm_camera(std::move(key), std::move(device), nullptr);
+				}
+			}
+
+			bool init(const std::string &device_path, const v4l2::mode_t &mode, bool export_dmabuf, int target_width, int target_height) {
+				this->mode = mode;
+				this->export_dmabuf = export_dmabuf;
+				this->target_width = target_width;
+				this->target_height = target_height;
+				low_latency = config::video.picamera.low_latency;
+				delay = std::chrono::nanoseconds {std::chrono::nanoseconds {1s}.count() / (std::int64_t) std::max(1.0, mode.framerate)};
+				tap = shared_frame_tap();
+
+				if (auto warm = take_warm_camera({device_path, mode, export_dmabuf, target_width, target_height, low_latency}); warm && warm->device) {
+					device = std::move(warm->device);
+
+					// The driver kept filling buffers while nobody was reading, hand them straight back
+					std::shared_ptr<v4l2::buffer_lease_t> stale;
+					for (int x = 0; x < V4L2_BUFFER_COUNT && device->dequeue(0ms, stale) == capture_e::ok; ++x) {
+						stale.reset();
+					}
+
+					width = device->format().width;
+					height = device->format().height;
+					env_width = width;
+					env_height = height;
+
+					BOOST_LOG(info) << "PiCamera: resumed warm V4L2 capture from "sv << device_path;
+					reusable = true;
+					return true;
+				}
+
+				device = v4l2::device_t::open(device_path);
+				if (!device) {
+					return false;
+				}
+
+				if (!device->set_format(mode.width, mode.height, {mode.fourcc})) {
+					BOOST_LOG(warning) << "PiCamera: "sv << device_path << " rejected "sv << v4l2::fourcc_to_string(mode.fourcc) << ' ' << mode.width << 'x' << mode.height;
+					return false;
+				}
+
+				if ((device->format().width != target_width || device->format().height != target_height) && !scale_on_device()) {
+					BOOST_LOG(info) << "PiCamera: "sv << device_path << " can't deliver "sv << target_width << 'x' << target_height << ", frames will be scaled in software"sv;
+
+					if (!device->set_format(mode.width, mode.height, {mode.fourcc})) {
+						return false;
+					}
+				}
+
+				device->set_framerate(mode.framerate);
+
+				if (!device->start(low_latency ? V4L2_LOW_LATENCY_BUFFER_COUNT : V4L2_BUFFER_COUNT, export_dmabuf)) {
+					return false;
+				}
+
+				width = device->format().width;
+				height = device->format().height;
+				env_width = width;
+				env_height = height;
+
+				BOOST_LOG(info) << "PiCamera: direct V4L2 capture from "sv << device_path << (export_dmabuf ? " with DMABUF export"sv : ""sv) << (low_latency ? " in low latency mode"sv : ""sv);
+				reusable = true;
+				return true;
+			}
+
+			capture_e capture(const push_captured_image_cb_t &push_captured_image_cb, const pull_free_image_cb_t &pull_free_image_cb, bool *cursor) override {
+				(void) cursor;
+
+				// Allow a few frame intervals before reporting a timeout to the encoder
+				auto timeout = std::chrono::duration_cast<std::chrono::milliseconds>(delay * 4) + 1ms;
+
+				while (true) {
+					if (!frame_wanted()) {
+						auto status = skip_frame(timeout);
+						if (status != capture_e::ok && status != capture_e::timeout) {
+							reusable = false;
+							return status;
+						}
+
+						if (!push_captured_image_cb(nullptr, false)) {
+							return capture_e::ok;
+						}
+						continue;
+					}
+
+					std::shared_ptr<platf::img_t> img_out;
+					if (!pull_free_image_cb(img_out)) {
+						return capture_e::interrupted;
+					}
+
+					auto status = next_frame(*img_out, timeout);
+					if (status == capture_e::ok) {
+						if (!push_captured_image_cb(std::move(img_out), true)) {
+							return capture_e::ok;
+						}
+					} else if (status == capture_e::timeout) {
+						if (!push_captured_image_cb(std::move(img_out), false)) {
+							return capture_e::ok;
+						}
+					} else {
+						reusable = false;
+						return status;
+					}
+				}
+			}
+
+			std::shared_ptr<img_t> alloc_img() override {
+				auto img = std::make_shared<v4l2_img_t>();
+				img->width = width;
+				img->height = height;
+				img->pixel_pitch = 1;
+				img->row_pitch = device->format().bytesperline;
+
+				imgs.emplace_back(img);
+				return img;
+			}
+
+			int dummy_img(img_t *img) override {
+				// Any frame from the sensor will do, images can only point into driver buffers
+				auto status = next_frame(*img, 1s);
+				if (status != capture_e::ok) {
+					BOOST_LOG(error) << "PiCamera: no frame from "sv << device->path() << " to prime the encoder";
+					return -1;
+				}
+
+				return 0;
+			}
+
+			std::unique_ptr<avcodec_encode_device_t> make_avcodec_encode_device(pix_fmt_e pix_fmt) override {
+				(void) pix_fmt;
+
+				if (!export_dmabuf) {
+					return std::make_unique<avcodec_encode_device_t>();
+				}
+
+				auto encode_device = std::make_unique<dmabuf_encode_device_t>();
+				encode_device->format = device->format();
+
+				return encode_device;
+			}
+
+			bool is_codec_supported(std::string_view, const video::config_t &) override {
+				return true;
+			}
+
+			bool is_live_source() override {
+				return true;
+			}
+
+			double source_framerate() override {
+				return mode.framerate;
+			}
+
+			bool hot_switch(const std::string &display_name, const ::video::config_t &config) override {
+				auto next = std::dynamic_pointer_cast<v4l2_display_t>(create_display(export_dmabuf ? platf::mem_type_e::drm : platf::mem_type_e::system, display_name, config));
+				if (!next) {
+					return false;
+				}
+
+				// The encoders were set up for the frame layout of this camera, DMABUF frames are described by it too
+				auto &format = device->format();
+				auto &next_format = next->device->format();
+				if (next->export_dmabuf != export_dmabuf || next_format.fourcc != format.fourcc || next_format.width != format.width ||
+				    next_format.height != format.height || next_format.bytesperline != format.bytesperline) {
+					BOOST_LOG(info) << "PiCamera: "sv << display_name << " delivers different frames than "sv << device->path() << ", the encoders are rebuilt"sv;
+					return false;
+				}
+
+				// Images still leasing buffers of the old camera keep it open until they are recaptured,
+				// and it's parked when next is destroyed, so switching back is quick
+				std::swap(device, next->device);
+				std::swap(mode, next->mode);
+				std::swap(delay, next->delay);
+				std::swap(reusable, next->reusable);
+
+				BOOST_LOG(info) << "PiCamera: switched to "sv << device->path() << " without rebuilding the encoders"sv;
+				return true;
+			}
+
+		private:
+			/**
+			 * @brief Let the camera or ISP crop and scale to the client's resolution.
+			 * The sensor area is cropped to the target aspect ratio first, so the frames aren't distorted.
+			 * @return `true` if the device now delivers frames at the target size.
+			 */
+			bool scale_on_device() {
+				auto cropped = device->set_crop(target_width, target_height);
+				if (device->set_format(target_width, target_height, {mode.fourcc}) &&
+				    device->format().width == target_width && device->format().height == target_height) {
+					BOOST_LOG(info) << "PiCamera: "sv << device->path() << " scales to "sv << target_width << 'x' << target_height << (cropped ? " after cropping"sv : ""sv);
+					return true;
+				}
+
+				if (cropped) {
+					device->reset_crop();
+				}
+
+				return false;
+			}
+
+			/**
+			 * @brief Hand driver buffers held by idle pool images back to the driver.
+			 * The capture pool keeps recently used images around, so without this their
+			 * leases would starve the driver of buffers to capture into.
+			 */
+			void reclaim_buffers() {
+				for (auto it = std::begin(imgs); it != std::end(imgs);) {
+					auto img = it->lock();
+					if (!img) {
+						it = imgs.erase(it);
+						continue;
+					}
+
+					// Only the pool and this function hold the image, so nobody is reading from it
+					if (img.use_count() == 2) {
+						img->lease.reset();
+					}
+
+					++it;
+				}
+			}
+
+			/**
+			 * @brief Hand the next frame straight back to the driver.
+			 * The tap still gets it, only the encoders have no image left for it.
+			 */
+			capture_e skip_frame(std::chrono::milliseconds timeout) {
+				reclaim_buffers();
+
+				std::shared_ptr<v4l2::buffer_lease_t> lease;
+				trace::scope_t span {trace::stage_e::camera_read, -1};
+				auto status = device->dequeue(timeout, lease);
+				if (status == capture_e::ok && tap) {
+					std::span<const std::uint8_t> data {(const std::uint8_t *) lease->buffer().start, lease->bytesused};
+					tap->publish(device->format().fourcc, width, height, device->format().bytesperline, data, lease->timestamp, lease);
+				}
+
+				return status;
+			}
+
+			capture_e next_frame(platf::img_t &img, std::chrono::milliseconds timeout) {
+				auto &v4l2_img = (v4l2_img_t &) img;
+				v4l2_img.lease.reset();
+				v4l2_img.data = nullptr;
+
+				reclaim_buffers();
+
+				std::shared_ptr<v4l2::buffer_lease_t> lease;
+				trace::scope_t span {trace::stage_e::camera_read, -1};
+				auto status = device->dequeue(timeout, lease);
+				if (status != capture_e::ok) {
+					return status;
+				}
+
+				// Frames that queued up while the encoder was busy are handed straight back to the driver
+				if (low_latency) {
+					int dropped = 0;
+					std::shared_ptr<v4l2::buffer_lease_t> newer;
+					while (dropped < V4L2_BUFFER_COUNT && device->dequeue(0ms, newer) == capture_e::ok) {
+						lease = std::move(newer);
+						++dropped;
+					}
+
+					queue_depth_logger.collect_and_log(dropped + 1);
+				}
+
+				v4l2_img.data = (std::uint8_t *) lease->buffer().start;
+				v4l2_img.width = width;
+				v4l2_img.height = height;
+				v4l2_img.row_pitch = device->format().bytesperline;
+				v4l2_img.pixel_pitch = device->format().fourcc == V4L2_PIX_FMT_YUYV ? 2 : 1;
+				v4l2_img.pix_fmt = native_pix_fmt(device->format().fourcc);
+				v4l2_img.frame_timestamp = lease->timestamp;
+
+				// The tap holds on to the lease until it copied the frame out
+				if (tap) {
+					std::span<const std::uint8_t> data {(const std::uint8_t *) lease->buffer().start, lease->bytesused};
+					tap->publish(device->format().fourcc, width, height, device->format().bytesperline, data, lease->timestamp, lease);
+				}
+
+				v4l2_img.lease = std::move(lease);
+
+				return capture_e::ok;
+			}
+
+			std::shared_ptr<v4l2::device_t> device;
+			std::shared_ptr<frame_tap::tap_t> tap;
+			std::vector<std::weak_ptr<v4l2_img_t>> imgs;
+			std::chrono::nanoseconds delay {std::chrono::nanoseconds {1s} / 30};
+			logging::min_max_avg_periodic_logger<int> queue_depth_logger = {debug, "PiCamera frames queued", ""};
+			v4l2::mode_t mode {};
+			int target_width {};
+			int target_height {};
+			bool export_dmabuf {false};
+			bool low_latency {false};
+
+			// Only a display that initialised and never failed hands its camera to the next session
+			bool reusable {false};
+		};
+
+		/**
+		 * @brief Stream the H.264 a camera encodes itself, as the driver delivers it.
+		 * The v4l2 demuxer hands out one access unit per driver buffer, which is exactly a frame for the client.
+		 */
+		class passthrough_display_t: public platf::encoded_display_t {
+		public:
+			~passthrough_display_t() override {
+				av_packet_free(&packet);
+			}
+
+			bool init(const std::string &device, const v4l2::mode_t &mode, int bitrate_kbps) {
+				// A camera parked by a decoding session holds the device open, whatever mode it was parked in
+				take_warm_camera({device, mode, false, mode.width, mode.height, config::video.picamera.low_latency});
+
+				if (!format.open(device, mode)) {
+					return false;
+				}
+
+				auto stream = format.stream();
+				if (!stream || stream->codecpar->codec_id != AV_CODEC_ID_H264) {
+					BOOST_LOG(error) << "PiCamera: "sv << device << " doesn't deliver H.264"sv;
+					return false;
+				}
+
+				packet = av_packet_alloc();
+				if (!packet) {
+					BOOST_LOG(error) << "PiCamera: failed to allocate packet";
+					return false;
+				}
+
+				// The demuxer keeps its descriptor to itself, controls are set through one of our own
+				control_fd = file_t {::open(device.c_str(), O_RDWR | O_NONBLOCK | O_CLOEXEC)};
+				if (control_fd.el < 0 || !v4l2::set_control(control_fd.el, V4L2_CID_MPEG_VIDEO_BITRATE, bitrate_kbps * 1000)) {
+					BOOST_LOG(info) << "PiCamera: "sv << device << " keeps the bitrate it chooses itself"sv;
+				}
+
+				width = mode.width;
+				height = mode.height;
+				this->device = device;
+
+				BOOST_LOG(info) << "PiCamera: passing the H.264 of "sv << device << " through at "sv << width << 'x' << height << " @ "sv << mode.framerate << " fps"sv;
+				return true;
+			}
+
+			capture_e next_frame(std::vector<std::uint8_t> &frame_data, bool &idr, std::optional<std::chrono::steady_clock::time_point> &frame_timestamp) override {
+				// av_read_frame() blocks until the driver delivers a buffer, which paces the stream
+				int result = av_read_frame(format.get(), packet);
+				if (result < 0) {
+					if (result == AVERROR(EAGAIN)) {
+						return capture_e::timeout;
+					}
+					log_ffmpeg_error("av_read_frame", result);
+					return capture_e::error;
+				}
+
+				auto fg = util::fail_guard([this]() {
+					av_packet_unref(packet);
+				});
+
+				if (packet->stream_index != format.index()) {
+					return capture_e::timeout;
+				}
+
+				frame_data.assign(packet->data, packet->data + packet->size);
+
+				// The demuxer only flags key frames for drivers that do, so the slices are looked at as well
+				idr = (packet->flags & AV_PKT_FLAG_KEY) || contains_idr(packet->data, packet->size);
+				frame_timestamp = capture_timestamp(format.stream(), packet->pts);
+
+				return capture_e::ok;
+			}
+
+			bool request_idr_frame() override {
+				if (control_fd.el >= 0 && v4l2::set_control(control_fd.el, V4L2_CID_MPEG_VIDEO_FORCE_KEY_FRAME, 1)) {
+					return true;
+				}
+
+				if (!idr_unsupported) {
+					BOOST_LOG(warning) << "PiCamera: "sv << device << " can't be asked for a key frame, the stream recovers at the next one it sends"sv;
+					idr_unsupported = true;
+				}
+
+				return false;
+			}
+
+		private:
+			std::string device;
+			format_context_t format;
+			AVPacket *packet {nullptr};
+			file_t control_fd;
+
+			// Warn only once, cameras without the control never get it
+			bool idr_unsupported {false};
+		};
+
+		/**
+		 * @brief Pick the H.264 mode a stream is passed through with.
+		 * @param device The device node, or empty for the first camera.
+		 * @param config The stream configuration.
+		 * @return The resolved device and its mode, or nothing if the stream has to be encoded by us.
+		 */
+		std::optional<std::pair<std::string, v4l2::mode_t>> passthrough_mode(const std::string &device, const video::config_t &config) {
+			if (!config::video.picamera.passthrough || config.videoFormat != 0 || config.dynamicRange || config.chromaSamplingType) {
+				return std::nullopt;
+			}
+
+			auto resolved = device.empty() ? display_names().front() : device;
+			if (resolved == composite::NAME) {
+				return std::nullopt;
+			}
+
+#ifdef SUNSHINE_BUILD_LIBCAMERA
+			// The ISP outputs uncompressed frames only
+			if (csi::is_camera(resolved)) {
+				return std::nullopt;
+			}
+#endif
+
+			auto caps = camera_capabilities(resolved);
+			if (!caps) {
+				return std::nullopt;
+			}
+
+			// Frames that are passed through can't be scaled, the camera has to encode at the size the client decodes
+			auto exact_caps = *caps;
+			for (auto &format : exact_caps.formats) {
+				std::erase_if(format.sizes, [&](const v4l2::frame_size_t &size) {
+					return !size.contains(config.width, config.height);
+				});
+			}
+
+			auto mode = v4l2::closest_mode(exact_caps, config.width, config.height, config.framerate, {V4L2_PIX_FMT_H264});
+			if (!mode) {
+				return std::nullopt;
+			}
+
+			return std::pair {std::move(resolved), *mode};
+		}
+	}  // namespace
+
+	bool initialize() {
+#ifdef SUNSHINE_BUILD_LIBCAMERA
+		if (!csi::display_names().empty()) {
+			return true;
+		}
+#endif
+
+		return !probe_cameras().empty();
 	}
 
 	std::vector<std::string> display_names() {
 		std::vector<std::string> devices;
-		for (int idx = 0; idx < 8; ++idx) {
-			auto path = "/dev/video" + std::to_string(idx);
-			if (std::filesystem::exists(path)) {
-				devices.emplace_back(path);
-			}
+
+		// The composite is what the user set up to stream, so it comes before the cameras it's made of
+		if (!config::video.picamera.composite.empty()) {
+			devices.emplace_back(composite::NAME);
+		}
+
+#ifdef SUNSHINE_BUILD_LIBCAMERA
+		// CSI cameras come next, on current Raspberry Pi OS libcamera is the only way to reach them
+		for (auto &name : csi::display_names()) {
+			devices.emplace_back(std::move(name));
+		}
+#endif
+
+		for (auto &caps : probe_cameras()) {
+			BOOST_LOG(debug) << "PiCamera: found "sv << caps.card << " ("sv << caps.driver << ") at "sv << caps.path;
+			devices.emplace_back(caps.path);
 		}
 		if (devices.empty()) {
 			devices.emplace_back(std::string {DEFAULT_DEVICE});
@@ -400,15 +1702,73 @@ namespace platf::picamera {
 		return devices;
 	}
 
-	std::shared_ptr<platf::display_t> create_display(const std::string &device, const video::config_t &config) {
-		auto resolved = device.empty() ? std::string {DEFAULT_DEVICE} : device;
-		auto display = std::make_shared<picamera_display_t>(resolved);
-		if (!display->init(config)) {
+	std::shared_ptr<platf::display_t> create_display(platf::mem_type_e hwdevice_type, const std::string &device, const video::config_t &config) {
+		auto resolved = device;
+		if (resolved.empty()) {
+			auto names = display_names();
+			resolved = names.front();
+		}
+
+		if (resolved == composite::NAME) {
+			return composite::create_display(hwdevice_type, config);
+		}
+
+#ifdef SUNSHINE_BUILD_LIBCAMERA
+		if (csi::is_camera(resolved)) {
+			return csi::create_display(hwdevice_type, resolved, config);
+		}
+#endif
+
+		auto caps = camera_capabilities(resolved);
+		if (!caps) {
+			BOOST_LOG(error) << "PiCamera: "sv << resolved << " is not a video capture device";
+			return nullptr;
+		}
+
+		std::string reason;
+		auto mode = v4l2::closest_mode(*caps, config.width, config.height, config.framerate, CAMERA_FOURCCS, &reason);
+		if (!mode) {
+			BOOST_LOG(error) << "PiCamera: "sv << resolved << " offers no supported pixel format";
+			return nullptr;
+		}
+
+		BOOST_LOG(info) << "PiCamera: selected "sv << v4l2::fourcc_to_string(mode->fourcc) << ' ' << mode->width << 'x' << mode->height << " @ "sv << mode->framerate << " fps on "sv << caps->card << ", because "sv << reason;
+
+		// Uncompressed formats are captured directly, the FFmpeg path is left for compressed streams
+		if (v4l2::is_raw_yuv(mode->fourcc)) {
+			auto display = std::make_shared<v4l2_display_t>();
+			if (display->init(resolved, *mode, hwdevice_type == platf::mem_type_e::drm, config.width, config.height)) {
+				return display;
+			}
+
+			BOOST_LOG(info) << "PiCamera: direct V4L2 capture unavailable, falling back to decoding through FFmpeg";
+		}
+
+		auto display = std::make_shared<picamera_display_t>(resolved, hwdevice_type);
+		if (!display->init(*mode, config.width, config.height)) {
 			BOOST_LOG(error) << "PiCamera: failed to initialise capture";
 			return nullptr;
 		}
 		return display;
 	}
 
-}  // namespace platf::picamera
+	bool has_encoded_display(const std::string &device, const video::config_t &config) {
+		return passthrough_mode(device, config).has_value();
+	}
+
+	std::unique_ptr<platf::encoded_display_t> create_encoded_display(const std::string &device, const video::config_t &config) {
+		auto mode = passthrough_mode(device, config);
+		if (!mode) {
+			return nullptr;
+		}
+
+		auto display = std::make_unique<passthrough_display_t>();
+		if (!display->init(mode->first, mode->second, config.bitrate)) {
+			BOOST_LOG(error) << "PiCamera: failed to open "sv << mode->first << " for H.264 passthrough"sv;
+			return nullptr;
+		}
 
+		return display;
+	}
+
+}  // namespace platf::picamera
@@ -13,19 +13,45 @@ namespace platf::picamera {
 
   /**
    * @brief Factory for PiCamera-based display capture.
+   * @param hwdevice_type The memory type expected by the encoder.
+   * With `mem_type_e::drm`, driver buffers are exported as DMABUFs and handed to the encoder without a copy.
+   * @param device The V4L2 device node.
+   * @param config The stream configuration.
+   * A camera released by the previous display is reused when it was opened for the same mode,
+   * which skips opening the device and probing the stream again.
    * @return PiCamera capture implementation.
    */
-  std::shared_ptr<platf::display_t> create_display(const std::string &device, const video::config_t &config);
+  std::shared_ptr<platf::display_t> create_display(platf::mem_type_e hwdevice_type, const std::string &device, const video::config_t &config);
+
+  /**
+   * @brief Check if a stream is passed through from the H.264 output of a camera.
+   * Requires the picamera_passthrough option, an H.264 SDR 4:2:0 stream and a camera
+   * offering H.264 at exactly the resolution of the stream.
+   * @param device The V4L2 device node, or empty for the first camera.
+   * @param config The stream configuration.
+   * @return `true` if create_encoded_display() should be used for the stream.
+   */
+  bool has_encoded_display(const std::string &device, const video::config_t &config);
+
+  /**
+   * @brief Open the H.264 output of a camera, its packets are streamed without decoding them.
+   * @param device The V4L2 device node, or empty for the first camera.
+   * @param config The stream configuration.
+   * @return The encoded display, or nullptr if the camera couldn't be opened.
+   */
+  std::unique_ptr<platf::encoded_display_t> create_encoded_display(const std::string &device, const video::config_t &config);
 
   /**
    * @brief PiCamera capture specific initialization hook.
-   * @return true on success.
+   * @return true if at least one camera was found.
    */
   bool initialize();
 
   /**
    * @brief Enumerate available PiCamera capture sources.
-   * @return Vector containing a single entry when capture is available.
+   * Nodes are probed with VIDIOC_QUERYCAP/VIDIOC_ENUM_FMT, so ISP, codec and metadata nodes are left out.
+   * The capabilities found are cached for mode selection in create_display().
+   * @return Device nodes of the cameras found.
    */
   std::vector<std::string> display_names();
 
@@ -0,0 +1,427 @@
+/**
+ * @file src/platform/linux/picamera_composite.cpp
+ * @brief Definitions for the composite display, which streams several cameras in one frame.
+ */
+// standard includes
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// lib includes
+extern "C" {
+#include <libavutil/imgutils.h>
+#include <libswscale/swscale.h>
+}
+
+// local includes
+#include "picamera_capture.h"
+#include "picamera_composite.h"
+#include "src/config.h"
+#include "src/logging.h"
+#include "src/utility.h"
+#include "src/video.h"
+#include "src/video_colorspace.h"
+
+using namespace std::literals;
+
+namespace platf::picamera::composite {
+  namespace {
+    // Images every camera passes to the composite, one being captured, the newest one and the one being drawn
+    constexpr int INPUT_IMAGES = 3;
+
+    struct rect_t {
+      int x;
+      int y;
+      int width;
+      int height;
+    };
+
+    // The chroma of NV12 covers 2x2 pixels, so every rectangle starts and ends on even pixels
+    int even(int value) {
+      return value & ~1;
+    }
+
+    /**
+     * @brief Fit an image into a cell, centered and with its aspect ratio kept.
+     * @param cell The cell.
+     * @param width Width of the image.
+     * @param height Height of the image.
+     * @return The area of the cell the image is scaled to.
+     */
+    rect_t fit(const rect_t &cell, int width, int height) {
+      auto scale = std::min((double) cell.width / width, (double) cell.height / height);
+      auto fit_width = std::max(2, even((int) (width * scale)));
+      auto fit_height = std::max(2, even((int) (height * scale)));
+
+      return {cell.x + even((cell.width - fit_width) / 2), cell.y + even((cell.height - fit_height) / 2), fit_width, fit_height};
+    }
+
+    /**
+     * @brief Lay out the cells of the cameras in the frame.
+     * @param layout `grid` or `pip`.
+     * @param count Number of cameras.
+     * @param width Width of the frame.
+     * @param height Height of the frame.
+     * @return The cell of every camera, in the order of picamera_composite.
+     */
+    std::vector<rect_t> layout_cells(std::string_view layout, int count, int width, int height) {
+      std::vector<rect_t> cells;
+
+      if (layout == "pip"sv && count > 1) {
+        // The other cameras are inset from the bottom right corner of the first one, at a quarter of its size
+        auto inset_width = even(width / 4);
+        auto inset_height = even(height / 4);
+        auto margin = std::max(2, even(height / 32));
+
+        cells.emplace_back(rect_t {0, 0, width, height});
+        for (int x = 1; x < count; ++x) {
+          cells.emplace_back(rect_t {
+            std::max(0, width - x * (inset_width + margin)),
+            height - inset_height - margin,
+            inset_width,
+            inset_height
+          });
+        }
+
+        return cells;
+      }
+
+      auto columns = (int) std::ceil(std::sqrt(count));
+      auto rows = (count + columns - 1) / columns;
+      auto cell_width = even(width / columns);
+      auto cell_height = even(height / rows);
+
+      for (int x = 0; x < count; ++x) {
+        cells.emplace_back(rect_t {(x % columns) * cell_width, (x / columns) * cell_height, cell_width, cell_height});
+      }
+
+      return cells;
+    }
+
+    /**
+     * @brief A camera of the composite, captured on a thread of its own.
+     * The newest image is handed to the composite, which draws it until a newer one arrives.
+     */
+    struct input_t {
+      ~input_t() {
+        sws_freeContext(sws);
+      }
+
+      std::string name;
+      std::shared_ptr<display_t> display;
+      rect_t cell;
+
+      // Like the image pool of the encoder, imgs holds every image and only idle images have no other reference.
+      // Cameras hand the buffers of idle images back to their driver.
+      std::mutex mutex;
+      std::vector<std::shared_ptr<img_t>> imgs;
+      std::shared_ptr<img_t> latest;
+      std::shared_ptr<img_t> drawing;
+      img_t *capturing {};
+
+      std::thread thread;
+      std::atomic<bool> ended {false};
+      capture_e status {capture_e::ok};
+
+      // Only used by the thread of the composite
+      SwsContext *sws {};
+    };
+
+    struct composite_img_t: public img_t {
+      std::vector<std::uint8_t> buffer;
+    };
+
+    class composite_display_t: public display_t {
+    public:
+      ~composite_display_t() override {
+        stop_inputs();
+      }
+
+      bool init(const ::video::config_t &config) {
+        width = even(config.width);
+        height = even(config.height);
+        env_width = width;
+        env_height = height;
+        delay = std::chrono::nanoseconds {1s} / std::max(1, config.framerate);
+        full_range = config.encoderCscMode & 0x1;
+        colorspace = ::video::avcodec_colorspace_from_sunshine_colorspace(::video::colorspace_from_client_config(config, false));
+
+        auto &names = config::video.picamera.composite;
+        auto cells = layout_cells(config::video.picamera.composite_layout, (int) names.size(), width, height);
+
+        for (std::size_t x = 0; x < names.size(); ++x) {
+          if (names[x] == NAME) {
+            BOOST_LOG(warning) << "PiCamera: the composite can't contain itself"sv;
+            continue;
+          }
+
+          // The camera is asked for the size of its cell, so it scales on the device where it can
+          auto input_config = config;
+          input_config.width = cells[x].width;
+          input_config.height = cells[x].height;
+
+          auto display = picamera::create_display(mem_type_e::system, names[x], input_config);
+          if (!display) {
+            BOOST_LOG(error) << "PiCamera: couldn't open "sv << names[x] << " for the composite"sv;
+            return false;
+          }
+
+          auto input = std::make_unique<input_t>();
+          input->name = names[x];
+          input->display = std::move(display);
+          input->cell = cells[x];
+          for (int y = 0; y < INPUT_IMAGES; ++y) {
+            auto img = input->display->alloc_img();
+            if (!img) {
+              return false;
+            }
+            input->imgs.emplace_back(std::move(img));
+          }
+
+          inputs.emplace_back(std::move(input));
+        }
+
+        if (inputs.empty()) {
+          BOOST_LOG(error) << "PiCamera: picamera_composite names no cameras"sv;
+          return false;
+        }
+
+        BOOST_LOG(info) << "PiCamera: compositing "sv << inputs.size() << " cameras into "sv << width << 'x' << height << " with the "sv << config::video.picamera.composite_layout << " layout"sv;
+        return true;
+      }
+
+      capture_e capture(const push_captured_image_cb_t &push_captured_image_cb, const pull_free_image_cb_t &pull_free_image_cb, bool *cursor) override {
+        start_inputs();
+        auto stop = util::fail_guard([this]() {
+          stop_inputs();
+        });
+
+        // The first camera sets the pace, the composite is drawn whenever it delivered a frame
+        auto &primary = *inputs.front();
+        auto timeout = delay * 2;
+
+        while (true) {
+          {
+            std::unique_lock ul {primary_mutex};
+            primary_cv.wait_for(ul, timeout, [this]() {
+              return primary_fresh || std::ranges::any_of(inputs, [](auto &input) {
+                       return input->ended.load();
+                     });
+            });
+            primary_fresh = false;
+          }
+
+          // A camera that stopped on its own takes the composite down with it
+          for (auto &input : inputs) {
+            if (input->ended) {
+              BOOST_LOG(warning) << "PiCamera: "sv << input->name << " of the composite stopped capturing"sv;
+              return input->status == capture_e::error ? capture_e::error : capture_e::reinit;
+            }
+          }
+
+          // The inputs keep capturing, only drawing the composite waits for the encoders
+          if (!frame_wanted()) {
+            if (!push_captured_image_cb(nullptr, false)) {
+              return capture_e::ok;
+            }
+            continue;
+          }
+
+          std::shared_ptr<img_t> img_out;
+          if (!pull_free_image_cb(img_out)) {
+            return capture_e::interrupted;
+          }
+
+          draw(*img_out);
+
+          // The composite is as old as the frame of the first camera in it, the drawing image is only replaced by draw()
+          img_out->frame_timestamp = primary.drawing ? primary.drawing->frame_timestamp : std::chrono::steady_clock::now();
+          if (!push_captured_image_cb(std::move(img_out), true)) {
+            return capture_e::ok;
+          }
+        }
+      }
+
+      std::shared_ptr<img_t> alloc_img() override {
+        auto img = std::make_shared<composite_img_t>();
+        img->buffer.resize((std::size_t) width * height * 3 / 2);
+        img->data = img->buffer.data();
+        img->width = width;
+        img->height = height;
+        img->pixel_pitch = 1;
+        img->row_pitch = width;
+        img->pix_fmt = pix_fmt_e::nv12;
+
+        clear(*img);
+        return img;
+      }
+
+      int dummy_img(img_t *img) override {
+        if (!img || !img->data) {
+          return -1;
+        }
+
+        clear(*img);
+        return 0;
+      }
+
+      std::unique_ptr<avcodec_encode_device_t> make_avcodec_encode_device(pix_fmt_e pix_fmt) override {
+        return std::make_unique<avcodec_encode_device_t>();
+      }
+
+      bool is_codec_supported(std::string_view, const ::video::config_t &) override {
+        return true;
+      }
+
+      bool is_live_source() override {
+        return true;
+      }
+
+    private:
+      void start_inputs() {
+        stopping = false;
+
+        for (auto &input : inputs) {
+          input->ended = false;
+          input->thread = std::thread {[this, input = input.get()]() {
+            auto status = input->display->capture(
+              [this, input](std::shared_ptr<img_t> &&img, bool frame_captured) {
+                {
+                  std::lock_guard lg {input->mutex};
+                  input->capturing = nullptr;
+                  if (frame_captured) {
+                    input->latest = std::move(img);
+                  }
+                }
+
+                if (frame_captured && input == inputs.front().get()) {
+                  {
+                    std::lock_guard lg {primary_mutex};
+                    primary_fresh = true;
+                  }
+                  primary_cv.notify_one();
+                }
+
+                return !stopping.load();
+              },
+              [this, input](std::shared_ptr<img_t> &img_out) {
+                // The camera captures into one image at a time, so one of the others is always idle
+                std::lock_guard lg {input->mutex};
+                auto img = std::ranges::find_if(input->imgs, [input](auto &candidate) {
+                  return candidate != input->latest && candidate != input->drawing && candidate.get() != input->capturing;
+                });
+                if (stopping || img == std::end(input->imgs)) {
+                  return false;
+                }
+
+                input->capturing = img->get();
+                img_out = *img;
+                return true;
+              },
+              nullptr
+            );
+
+            {
+              std::lock_guard lg {input->mutex};
+              input->status = status;
+            }
+            input->ended = true;
+            primary_cv.notify_one();
+          }};
+        }
+      }
+
+      void stop_inputs() {
+        stopping = true;
+        for (auto &input : inputs) {
+          if (input->thread.joinable()) {
+            input->thread.join();
+          }
+        }
+      }
+
+      void clear(img_t &img) {
+        // Black in the range the client decodes
+        std::memset(img.data, full_range ? 0 : 16, (std::size_t) img.row_pitch * img.height);
+        std::memset(img.data + (std::size_t) img.row_pitch * img.height, 128, (std::size_t) img.row_pitch * img.height / 2);
+      }
+
+      void draw(img_t &out) {
+        for (auto &input : inputs) {
+          {
+            std::lock_guard lg {input->mutex};
+            if (input->latest) {
+              input->drawing = std::move(input->latest);
+            }
+          }
+
+          // The newest image stays with the composite, a camera that's behind is drawn from its last frame
+          if (input->drawing && input->drawing->data) {
+            blit(*input, *input->drawing, out);
+          }
+        }
+      }
+
+      void blit(input_t &input, const img_t &img, img_t &out) {
+        auto format = img.pix_fmt ? ::video::map_av_pix_fmt(*img.pix_fmt) : AV_PIX_FMT_BGR0;
+        auto rect = fit(input.cell, img.width, img.height);
+
+        auto sws = sws_getCachedContext(input.sws, img.width, img.height, format, rect.width, rect.height, AV_PIX_FMT_NV12, SWS_BILINEAR, nullptr, nullptr, nullptr);
+        if (!sws) {
+          return;
+        }
+
+        // Cameras that deliver RGB are converted to the colorspace the client asked for
+        if (sws != input.sws && format == AV_PIX_FMT_BGR0) {
+          sws_setColorspaceDetails(sws, sws_getCoefficients(SWS_CS_DEFAULT), 0, sws_getCoefficients(colorspace.software_format), colorspace.range - 1, 0, 1 << 16, 1 << 16);
+        }
+        input.sws = sws;
+
+        int src_linesize[4];
+        std::uint8_t *src_data[4];
+        if (av_image_fill_linesizes(src_linesize, format, img.row_pitch / std::max(1, img.pixel_pitch)) < 0 ||
+            av_image_fill_pointers(src_data, format, img.height, img.data, src_linesize) < 0) {
+          return;
+        }
+
+        auto luma = out.data + (std::size_t) rect.y * out.row_pitch + rect.x;
+        auto chroma = out.data + (std::size_t) out.row_pitch * out.height + (std::size_t) rect.y / 2 * out.row_pitch + rect.x;
+        std::uint8_t *dst_data[4] {luma, chroma};
+        int dst_linesize[4] {out.row_pitch, out.row_pitch};
+
+        sws_scale(sws, src_data, src_linesize, 0, img.height, dst_data, dst_linesize);
+      }
+
+      std::vector<std::unique_ptr<input_t>> inputs;
+      std::atomic<bool> stopping {false};
+
+      std::mutex primary_mutex;
+      std::condition_variable primary_cv;
+      bool primary_fresh {false};
+
+      std::chrono::nanoseconds delay {std::chrono::nanoseconds {1s} / 30};
+      ::video::avcodec_colorspace_t colorspace {};
+      bool full_range {false};
+    };
+  }  // namespace
+
+  std::shared_ptr<display_t> create_display(mem_type_e hwdevice_type, const ::video::config_t &config) {
+    if (hwdevice_type != mem_type_e::system) {
+      BOOST_LOG(debug) << "PiCamera: the composite only draws to system memory"sv;
+      return nullptr;
+    }
+
+    auto display = std::make_shared<composite_display_t>();
+    if (!display->init(config)) {
+      return nullptr;
+    }
+
+    return display;
+  }
+}  // namespace platf::picamera::composite
@@ -0,0 +1,32 @@
+/**
+ * @file src/platform/linux/picamera_composite.h
+ * @brief Declarations for the composite display, which streams several cameras in one frame.
+ */
+#pragma once
+
+// standard includes
+#include <memory>
+#include <string>
+#include <string_view>
+
+// local includes
+#include "src/platform/common.h"
+
+namespace platf::picamera::composite {
+  /**
+   * @brief Name of the composite display, listed along the cameras while picamera_composite names any.
+   */
+  constexpr std::string_view NAME = "composite";
+
+  /**
+   * @brief Create a display that captures every camera of picamera_composite and lays them out in one frame.
+   * With the `grid` layout the cameras share the frame in tiles of equal size, with `pip` the first camera
+   * fills the frame and the others are inset along its bottom edge. Every camera keeps its aspect ratio.
+   * Cameras are captured to system memory and scaled into an NV12 frame, only encoders that take
+   * frames from system memory can use it.
+   * @param hwdevice_type The memory type expected by the encoder.
+   * @param config The stream configuration.
+   * @return The display, or nullptr if a camera couldn't be opened.
+   */
+  std::shared_ptr<display_t> create_display(mem_type_e hwdevice_type, const ::video::config_t &config);
+}  // namespace platf::picamera::composite
@@ -0,0 +1,251 @@
+/**
+ * @file src/platform/linux/pipewire.cpp
+ * @brief Definitions for native PipeWire audio capture.
+ */
+// standard includes
+#include <algorithm>
+#include <condition_variable>
+#include <cstring>
+#include <mutex>
+#include <vector>
+
+// lib includes
+#include <pipewire/pipewire.h>
+#include <spa/param/audio/format-utils.h>
+
+// local includes
+#include "pipewire.h"
+#include "src/logging.h"
+#include "src/utility.h"
+
+using namespace std::literals;
+
+namespace pipewire {
+  // Indexed the same way as the PulseAudio channel positions of the audio stream mapping
+  constexpr spa_audio_channel position_mapping[] {
+    SPA_AUDIO_CHANNEL_FL,
+    SPA_AUDIO_CHANNEL_FR,
+    SPA_AUDIO_CHANNEL_FC,
+    SPA_AUDIO_CHANNEL_LFE,
+    SPA_AUDIO_CHANNEL_RL,
+    SPA_AUDIO_CHANNEL_RR,
+    SPA_AUDIO_CHANNEL_SL,
+    SPA_AUDIO_CHANNEL_SR,
+  };
+
+  // Audio packets the ring holds before the oldest samples are dropped
+  constexpr auto RING_PACKETS = 8;
+
+  // How long sample() waits for the graph before the sink is considered idle
+  constexpr auto SAMPLE_TIMEOUT = 100ms;
+
+  using thread_loop_t = util::safe_ptr<pw_thread_loop, pw_thread_loop_destroy>;
+  using stream_t = util::safe_ptr<pw_stream, pw_stream_destroy>;
+
+  class mic_pw_t: public platf::mic_t {
+  public:
+    ~mic_pw_t() override {
+      if (loop) {
+        pw_thread_loop_stop(loop.get());
+      }
+
+      // The stream must go before the loop it runs on
+      stream.reset();
+      loop.reset();
+    }
+
+    int init(const std::uint8_t *mapping, int channels, std::uint32_t sample_rate, std::uint32_t frame_size, const std::string &sink_name, bool continuous_audio) {
+      this->sample_rate = sample_rate;
+      this->channels = channels;
+      this->continuous_audio = continuous_audio;
+      ring.resize((std::size_t) frame_size * channels * RING_PACKETS);
+
+      loop.reset(pw_thread_loop_new("sunshine-audio", nullptr));
+      if (!loop) {
+        BOOST_LOG(error) << "pw_thread_loop_new() failed"sv;
+        return -1;
+      }
+
+      auto props = pw_properties_new(
+        PW_KEY_MEDIA_TYPE,
+        "Audio",
+        PW_KEY_MEDIA_CATEGORY,
+        "Capture",
+        PW_KEY_APP_NAME,
+        "sunshine",
+        PW_KEY_STREAM_CAPTURE_SINK,
+        "true",
+        nullptr
+      );
+
+      // Ask for a quantum of exactly one audio packet
+      pw_properties_setf(props, PW_KEY_NODE_LATENCY, "%u/%u", frame_size, sample_rate);
+#ifdef PW_KEY_TARGET_OBJECT
+      pw_properties_set(props, PW_KEY_TARGET_OBJECT, sink_name.c_str());
+#else
+      pw_properties_set(props, PW_KEY_NODE_TARGET, sink_name.c_str());
+#endif
+
+      stream.reset(pw_stream_new_simple(pw_thread_loop_get_loop(loop.get()), "sunshine-record", props, &stream_events, this));
+      if (!stream) {
+        BOOST_LOG(error) << "pw_stream_new_simple() failed"sv;
+        return -1;
+      }
+
+      spa_audio_info_raw info {};
+      info.format = SPA_AUDIO_FORMAT_F32;
+      info.rate = sample_rate;
+      info.channels = channels;
+      for (int x = 0; x < channels; ++x) {
+        info.position[x] = position_mapping[mapping[x]];
+      }
+
+      std::uint8_t pod_buffer[1024];
+      spa_pod_builder builder = SPA_POD_BUILDER_INIT(pod_buffer, sizeof(pod_buffer));
+      const spa_pod *params[] {spa_format_audio_raw_build(&builder, SPA_PARAM_EnumFormat, &info)};
+
+      auto flags = (pw_stream_flags) (PW_STREAM_FLAG_AUTOCONNECT | PW_STREAM_FLAG_MAP_BUFFERS | PW_STREAM_FLAG_RT_PROCESS);
+      if (pw_stream_connect(stream.get(), PW_DIRECTION_INPUT, PW_ID_ANY, flags, params, 1) < 0) {
+        BOOST_LOG(error) << "Couldn't connect PipeWire stream to ["sv << sink_name << ']';
+        return -1;
+      }
+
+      if (pw_thread_loop_start(loop.get()) < 0) {
+        BOOST_LOG(error) << "pw_thread_loop_start() failed"sv;
+        return -1;
+      }
+
+      BOOST_LOG(info) << "Capturing ["sv << sink_name << "] through PipeWire with a quantum of "sv << frame_size << '/' << sample_rate;
+      return 0;
+    }
+
+    platf::capture_e sample(std::vector<float> &sample_buf) override {
+      std::unique_lock lg {lock};
+
+      auto ready = cv.wait_for(lg, SAMPLE_TIMEOUT, [&]() {
+        return failed || filled >= sample_buf.size();
+      });
+
+      if (failed) {
+        return platf::capture_e::reinit;
+      }
+
+      if (!ready) {
+        // An idle sink doesn't run the graph
+        if (continuous_audio) {
+          std::fill(std::begin(sample_buf), std::end(sample_buf), 0.0f);
+          return platf::capture_e::ok;
+        }
+
+        return platf::capture_e::timeout;
+      }
+
+      for (auto &sample : sample_buf) {
+        sample = ring[read_pos];
+        read_pos = (read_pos + 1) % ring.size();
+      }
+      filled -= sample_buf.size();
+
+      // Samples still waiting in the ring add to what the graph reported
+      latency_logger.collect_and_log(graph_latency_ms + (double) filled / channels * 1000.0 / sample_rate);
+
+      return platf::capture_e::ok;
+    }
+
+  private:
+    static void on_process(void *userdata) {
+      auto mic = (mic_pw_t *) userdata;
+
+      auto buffer = pw_stream_dequeue_buffer(mic->stream.get());
+      if (!buffer) {
+        return;
+      }
+
+      auto &data = buffer->buffer->datas[0];
+      if (data.data) {
+        auto offset = std::min(data.chunk->offset, data.maxsize);
+        auto size = std::min(data.chunk->size, data.maxsize - offset);
+        mic->push((const float *) ((const std::uint8_t *) data.data + offset), size / sizeof(float));
+      }
+
+      pw_stream_queue_buffer(mic->stream.get(), buffer);
+    }
+
+    static void on_state_changed(void *userdata, pw_stream_state old, pw_stream_state state, const char *error) {
+      auto mic = (mic_pw_t *) userdata;
+
+      BOOST_LOG(debug) << "PipeWire stream state: "sv << pw_stream_state_as_string(state);
+      if (state == PW_STREAM_STATE_ERROR || (old == PW_STREAM_STATE_STREAMING && state == PW_STREAM_STATE_UNCONNECTED)) {
+        // The sink went away, capture has to start over with the current sink
+        BOOST_LOG(warning) << "PipeWire capture stopped: "sv << (error ? error : "disconnected");
+
+        std::lock_guard lg {mic->lock};
+        mic->failed = true;
+        mic->cv.notify_one();
+      }
+    }
+
+    void push(const float *samples, std::size_t count) {
+      pw_time time {};
+      pw_stream_get_time_n(stream.get(), &time, sizeof(time));
+
+      std::lock_guard lg {lock};
+      if (time.rate.denom) {
+        graph_latency_ms = time.delay * 1000.0 * time.rate.num / time.rate.denom;
+      }
+
+      for (std::size_t x = 0; x < count; ++x) {
+        ring[(read_pos + filled) % ring.size()] = samples[x];
+
+        // The encoder fell behind, drop the oldest sample
+        if (filled == ring.size()) {
+          read_pos = (read_pos + 1) % ring.size();
+        } else {
+          ++filled;
+        }
+      }
+
+      cv.notify_one();
+    }
+
+    static constexpr pw_stream_events stream_events = [] {
+      pw_stream_events events {};
+      events.version = PW_VERSION_STREAM_EVENTS;
+      events.state_changed = on_state_changed;
+      events.process = on_process;
+      return events;
+    }();
+
+    thread_loop_t loop;
+    stream_t stream;
+
+    std::uint32_t sample_rate;
+    int channels;
+    bool continuous_audio;
+
+    // Filled by the PipeWire data thread, emptied by sample()
+    std::mutex lock;
+    std::condition_variable cv;
+    std::vector<float> ring;
+    std::size_t read_pos = 0;
+    std::size_t filled = 0;
+    bool failed = false;
+    double graph_latency_ms = 0;
+
+    logging::min_max_avg_periodic_logger<double> latency_logger {debug, "Audio capture latency", "ms"};
+  };
+
+  std::unique_ptr<platf::mic_t> microphone(const std::uint8_t *mapping, int channels, std::uint32_t sample_rate, std::uint32_t frame_size, const std::string &sink_name, bool continuous_audio) {
+    static std::once_flag pw_init_flag;
+    std::call_once(pw_init_flag, []() {
+      pw_init(nullptr, nullptr);
+    });
+
+    auto mic = std::make_unique<mic_pw_t>();
+    if (mic->init(mapping, channels, sample_rate, frame_size, sink_name, continuous_audio)) {
+      return nullptr;
+    }
+
+    return mic;
+  }
+}  // namespace pipewire
@@ -0,0 +1,29 @@
+/**
+ * @file src/platform/linux/pipewire.h
+ * @brief Declarations for native PipeWire audio capture.
+ */
+#pragma once
+
+// standard includes
+#include <cstdint>
+#include <memory>
+#include <string>
+
+// local includes
+#include "src/platform/common.h"
+
+namespace pipewire {
+  /**
+   * @brief Capture what plays on a sink through a native PipeWire stream.
+   * The stream asks the graph for a quantum of one audio packet, so samples don't wait in
+   * the buffers of the PulseAudio compatibility layer.
+   * @param mapping Channel mapping, indexed the same way as the PulseAudio channel positions.
+   * @param channels Number of channels.
+   * @param sample_rate Sample rate in Hz.
+   * @param frame_size Samples per channel in each audio packet.
+   * @param sink_name Node name of the sink to capture.
+   * @param continuous_audio Return silence when the sink stops producing samples, instead of timing out.
+   * @return The microphone, or nullptr if the PipeWire daemon can't be reached.
+   */
+  std::unique_ptr<platf::mic_t> microphone(const std::uint8_t *mapping, int channels, std::uint32_t sample_rate, std::uint32_t frame_size, const std::string &sink_name, bool continuous_audio);
+}  // namespace pipewire
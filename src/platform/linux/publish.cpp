@@ -7,6 +7,7 @@
 #include <thread>
 
 // local includes
+#include "mdns.h"
 #include "misc.h"
 #include "src/logging.h"
 #include "src/network.h"
@@ -418,9 +419,19 @@ namespace platf::publish {
     }
   };
 
+  /**
+   * @brief Publish through the built-in responder, for images that don't run avahi-daemon.
+   */
+  std::unique_ptr<::platf::deinit_t> start_builtin() {
+    auto instance_name = net::mdns_instance_name(platf::get_host_name());
+
+    BOOST_LOG(info) << "Avahi isn't available, publishing with the built-in mDNS responder"sv;
+    return mdns::start({instance_name, instance_name, net::map_port(nvhttp::PORT_HTTP)});
+  }
+
   [[nodiscard]] std::unique_ptr<::platf::deinit_t> start() {
     if (avahi::init_client()) {
-      return nullptr;
+      return start_builtin();
     }
 
     int avhi_error;
@@ -439,6 +450,11 @@ namespace platf::publish {
     );
 
     if (!client) {
+      if (avhi_error == avahi::ERR_NO_DAEMON) {
+        poll.reset();
+        return start_builtin();
+      }
+
       BOOST_LOG(error) << "Failed to create client: "sv << avahi::strerror(avhi_error);
       return nullptr;
     }
@@ -0,0 +1,225 @@
+/**
+ * @file src/platform/linux/uring.cpp
+ * @brief Definitions for a minimal io_uring used to submit socket sends.
+ */
+// standard includes
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+
+// platform includes
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+// local includes
+#include "src/logging.h"
+#include "uring.h"
+
+using namespace std::literals;
+
+namespace uring {
+  // Failed io_uring_enter() calls wait_cqe() sits out, about 1 ms each, before giving up on the ring
+  constexpr int WAIT_CQE_RETRIES = 100;
+
+  namespace {
+    int io_uring_setup(unsigned entries, io_uring_params *params) {
+      return (int) syscall(__NR_io_uring_setup, entries, params);
+    }
+
+    int io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+      return (int) syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, nullptr, 0);
+    }
+
+    int io_uring_register(int fd, unsigned opcode, const void *arg, unsigned nr_args) {
+      return (int) syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+    }
+
+    unsigned load_acquire(unsigned *p) {
+      return std::atomic_ref<unsigned> {*p}.load(std::memory_order_acquire);
+    }
+
+    void store_release(unsigned *p, unsigned value) {
+      std::atomic_ref<unsigned> {*p}.store(value, std::memory_order_release);
+    }
+
+    template<class T>
+    T *offset(void *base, std::uint32_t off) {
+      return (T *) ((std::uint8_t *) base + off);
+    }
+  }  // namespace
+
+  std::unique_ptr<ring_t> ring_t::create(unsigned entries) {
+    io_uring_params params {};
+    file_t fd {io_uring_setup(entries, &params)};
+    if (fd.el < 0) {
+      // ENOSYS on kernels without io_uring, EPERM when it's disabled by sysctl or seccomp
+      BOOST_LOG(debug) << "io_uring_setup() failed: "sv << errno;
+      return nullptr;
+    }
+
+    std::unique_ptr<ring_t> ring {new ring_t};
+    ring->ring_fd = std::move(fd);
+
+    ring->sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+      ring->sq_size = ring->cq_size = std::max(ring->sq_size, ring->cq_size);
+    }
+
+    ring->sq_ptr = mmap(nullptr, ring->sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->ring_fd.el, IORING_OFF_SQ_RING);
+    if (ring->sq_ptr == MAP_FAILED) {
+      ring->sq_ptr = nullptr;
+      BOOST_LOG(warning) << "Couldn't map io_uring submission queue: "sv << errno;
+      return nullptr;
+    }
+
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+      ring->cq_ptr = ring->sq_ptr;
+    } else {
+      ring->cq_ptr = mmap(nullptr, ring->cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->ring_fd.el, IORING_OFF_CQ_RING);
+      if (ring->cq_ptr == MAP_FAILED) {
+        ring->cq_ptr = nullptr;
+        BOOST_LOG(warning) << "Couldn't map io_uring completion queue: "sv << errno;
+        return nullptr;
+      }
+    }
+
+    ring->sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+    auto sqes = mmap(nullptr, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->ring_fd.el, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED) {
+      BOOST_LOG(warning) << "Couldn't map io_uring submission entries: "sv << errno;
+      return nullptr;
+    }
+    ring->sqes = (io_uring_sqe *) sqes;
+
+    ring->sq_head = offset<unsigned>(ring->sq_ptr, params.sq_off.head);
+    ring->sq_tail = offset<unsigned>(ring->sq_ptr, params.sq_off.tail);
+    ring->sq_array = offset<unsigned>(ring->sq_ptr, params.sq_off.array);
+    ring->sq_mask = *offset<unsigned>(ring->sq_ptr, params.sq_off.ring_mask);
+    ring->sq_entries = params.sq_entries;
+
+    ring->cq_head = offset<unsigned>(ring->cq_ptr, params.cq_off.head);
+    ring->cq_tail = offset<unsigned>(ring->cq_ptr, params.cq_off.tail);
+    ring->cqes = offset<io_uring_cqe>(ring->cq_ptr, params.cq_off.cqes);
+    ring->cq_mask = *offset<unsigned>(ring->cq_ptr, params.cq_off.ring_mask);
+
+    // Kernels before 5.6 can't tell us which opcodes they support, treat them as supporting none
+    ring->supported_ops.resize(IORING_OP_LAST);
+    constexpr auto probe_size = sizeof(io_uring_probe) + IORING_OP_LAST * sizeof(io_uring_probe_op);
+    auto probe_buf = std::make_unique<std::uint8_t[]>(probe_size);
+    std::memset(probe_buf.get(), 0, probe_size);
+
+    auto probe = (io_uring_probe *) probe_buf.get();
+    if (io_uring_register(ring->ring_fd.el, IORING_REGISTER_PROBE, probe, IORING_OP_LAST) == 0) {
+      for (int x = 0; x < std::min<int>(probe->ops_len, IORING_OP_LAST); ++x) {
+        ring->supported_ops[probe->ops[x].op] = probe->ops[x].flags & IO_URING_OP_SUPPORTED;
+      }
+    }
+
+    return ring;
+  }
+
+  ring_t::~ring_t() {
+    if (sqes) {
+      munmap(sqes, sqes_size);
+    }
+    if (cq_ptr && cq_ptr != sq_ptr) {
+      munmap(cq_ptr, cq_size);
+    }
+    if (sq_ptr) {
+      munmap(sq_ptr, sq_size);
+    }
+  }
+
+  bool ring_t::supports(std::uint8_t opcode) const {
+    return opcode < supported_ops.size() && supported_ops[opcode];
+  }
+
+  bool ring_t::register_socket(int fd) {
+    if (fd == registered_fd) {
+      return true;
+    }
+
+    if (registered_fd >= 0) {
+      io_uring_register(ring_fd.el, IORING_UNREGISTER_FILES, nullptr, 0);
+      registered_fd = -1;
+    }
+
+    if (io_uring_register(ring_fd.el, IORING_REGISTER_FILES, &fd, 1) != 0) {
+      BOOST_LOG(debug) << "Couldn't register socket with io_uring: "sv << errno;
+      return false;
+    }
+
+    registered_fd = fd;
+    return true;
+  }
+
+  io_uring_sqe *ring_t::get_sqe() {
+    auto head = load_acquire(sq_head);
+    auto tail = *sq_tail + pending;
+    if (tail - head >= sq_entries) {
+      return nullptr;
+    }
+
+    auto index = tail & sq_mask;
+    sq_array[index] = index;
+    ++pending;
+
+    auto sqe = &sqes[index];
+    std::memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+  }
+
+  int ring_t::enter(unsigned wait_nr) {
+    // Submit everything the kernel hasn't consumed yet, including entries left over by an earlier failure
+    auto to_submit = *sq_tail - load_acquire(sq_head);
+    if (io_uring_enter(ring_fd.el, to_submit, wait_nr, wait_nr ? IORING_ENTER_GETEVENTS : 0) < 0) {
+      return errno;
+    }
+
+    return 0;
+  }
+
+  void ring_t::submit_and_wait(unsigned wait_nr) {
+    store_release(sq_tail, *sq_tail + pending);
+    pending = 0;
+
+    // Errors are picked up again by wait_cqe()
+    enter(wait_nr);
+  }
+
+  bool ring_t::wait_cqe(io_uring_cqe &cqe_out) {
+    int failures = 0;
+    while (!pop_cqe(cqe_out)) {
+      auto err = enter(1);
+      if (err && err != EINTR) {
+        // EAGAIN and EBUSY clear up once the kernel frees resources or completions are reaped, anything else doesn't
+        if (++failures > WAIT_CQE_RETRIES) {
+          BOOST_LOG(warning) << "io_uring_enter() keeps failing: "sv << err;
+          return false;
+        }
+        BOOST_LOG(verbose) << "io_uring_enter() failed: "sv << err;
+
+        struct pollfd pfd;
+        pfd.fd = ring_fd.el;
+        pfd.events = POLLIN;
+        poll(&pfd, 1, 1);
+      }
+    }
+
+    return true;
+  }
+
+  bool ring_t::pop_cqe(io_uring_cqe &cqe_out) {
+    auto head = *cq_head;
+    if (head == load_acquire(cq_tail)) {
+      return false;
+    }
+
+    cqe_out = cqes[head & cq_mask];
+    store_release(cq_head, head + 1);
+    return true;
+  }
+}  // namespace uring
@@ -0,0 +1,104 @@
+/**
+ * @file src/platform/linux/uring.h
+ * @brief Declarations for a minimal io_uring used to submit socket sends.
+ */
+#pragma once
+
+// standard includes
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// platform includes
+#include <linux/io_uring.h>
+
+// local includes
+#include "misc.h"
+
+namespace uring {
+  /**
+   * @brief A single-threaded submission/completion ring.
+   * Talks to the kernel through the raw system calls, so no liburing is needed.
+   */
+  class ring_t {
+  public:
+    /**
+     * @brief Set up a ring.
+     * @param entries Number of submission queue entries.
+     * @return The ring, or nullptr if the kernel doesn't support io_uring or it's disabled.
+     */
+    static std::unique_ptr<ring_t> create(unsigned entries);
+
+    ~ring_t();
+
+    ring_t(const ring_t &) = delete;
+    ring_t &operator=(const ring_t &) = delete;
+
+    /**
+     * @brief Check if the kernel supports an opcode.
+     * @param opcode The IORING_OP_* opcode.
+     * @return `true` if the opcode is supported.
+     */
+    bool supports(std::uint8_t opcode) const;
+
+    /**
+     * @brief Register a socket, so submissions skip the file table lookup.
+     * Only one socket is registered at a time, registering another replaces it.
+     * @param fd The socket.
+     * @return `true` if the socket is registered, use IOSQE_FIXED_FILE with index 0 to refer to it.
+     */
+    bool register_socket(int fd);
+
+    /**
+     * @brief Get the next free submission queue entry.
+     * @return The cleared entry, or nullptr if the submission queue is full.
+     */
+    io_uring_sqe *get_sqe();
+
+    /**
+     * @brief Submit the pending entries and wait for completions in a single system call.
+     * @param wait_nr Number of completions to wait for.
+     */
+    void submit_and_wait(unsigned wait_nr);
+
+    /**
+     * @brief Take the next completion off the completion queue, waiting for it if needed.
+     * @param cqe_out The completion.
+     * @return `false` if io_uring_enter() kept failing, the ring shouldn't be used anymore then.
+     * @note Only call this for submitted entries.
+     */
+    bool wait_cqe(io_uring_cqe &cqe_out);
+
+  private:
+    ring_t() = default;
+
+    bool pop_cqe(io_uring_cqe &cqe_out);
+    int enter(unsigned wait_nr);
+
+    file_t ring_fd;
+    int registered_fd {-1};
+
+    void *sq_ptr {nullptr};
+    std::size_t sq_size {0};
+    void *cq_ptr {nullptr};
+    std::size_t cq_size {0};
+    io_uring_sqe *sqes {nullptr};
+    std::size_t sqes_size {0};
+
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_array;
+    unsigned sq_mask;
+    unsigned sq_entries;
+
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    io_uring_cqe *cqes;
+    unsigned cq_mask;
+
+    // Entries filled by get_sqe() but not submitted yet
+    unsigned pending {0};
+
+    std::vector<bool> supported_ops;
+  };
+}  // namespace uring
@@ -0,0 +1,625 @@
+/**
+ * @file src/platform/linux/v4l2.cpp
+ * @brief Definitions for direct V4L2 capture device access.
+ */
+// standard includes
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <tuple>
+
+// platform includes
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+
+// local includes
+#include "src/logging.h"
+#include "v4l2.h"
+
+using namespace std::literals;
+
+namespace v4l2 {
+  namespace {
+    int xioctl(int fd, unsigned long request, void *arg) {
+      int result;
+      do {
+        result = ioctl(fd, request, arg);
+      } while (result < 0 && errno == EINTR);
+
+      return result;
+    }
+  }  // namespace
+
+  std::string fourcc_to_string(std::uint32_t fourcc) {
+    std::string result(4, ' ');
+    for (int x = 0; x < 4; ++x) {
+      result[x] = (char) ((fourcc >> (x * 8)) & 0xFF);
+    }
+
+    return result;
+  }
+
+  bool is_raw_yuv(std::uint32_t fourcc) {
+    return fourcc == V4L2_PIX_FMT_NV12 || fourcc == V4L2_PIX_FMT_YUV420 || fourcc == V4L2_PIX_FMT_YUYV;
+  }
+
+  namespace {
+    frame_size_t enum_framerates(int fd, std::uint32_t fourcc, int width, int height) {
+      frame_size_t size {width, height, width, height, 1, 1};
+
+      v4l2_frmivalenum ival {};
+      ival.pixel_format = fourcc;
+      ival.width = width;
+      ival.height = height;
+      for (ival.index = 0; xioctl(fd, VIDIOC_ENUM_FRAMEINTERVALS, &ival) == 0; ++ival.index) {
+        if (ival.type == V4L2_FRMIVAL_TYPE_DISCRETE) {
+          if (ival.discrete.numerator) {
+            size.framerates.emplace_back((double) ival.discrete.denominator / ival.discrete.numerator);
+          }
+          continue;
+        }
+
+        // For stepwise and continuous intervals, the fastest and slowest rates bound what's possible
+        if (ival.stepwise.min.numerator) {
+          size.framerates.emplace_back((double) ival.stepwise.min.denominator / ival.stepwise.min.numerator);
+        }
+        if (ival.stepwise.max.numerator) {
+          size.framerates.emplace_back((double) ival.stepwise.max.denominator / ival.stepwise.max.numerator);
+        }
+        size.interval_step = 0.0;
+        if (ival.type == V4L2_FRMIVAL_TYPE_STEPWISE && ival.stepwise.step.denominator) {
+          size.interval_step = (double) ival.stepwise.step.numerator / ival.stepwise.step.denominator;
+        }
+        break;
+      }
+
+      std::sort(std::begin(size.framerates), std::end(size.framerates));
+      return size;
+    }
+
+    std::vector<frame_size_t> enum_frame_sizes(int fd, const std::string &path, std::uint32_t fourcc) {
+      std::vector<frame_size_t> sizes;
+
+      v4l2_frmsizeenum fsize {};
+      fsize.pixel_format = fourcc;
+      for (fsize.index = 0; xioctl(fd, VIDIOC_ENUM_FRAMESIZES, &fsize) == 0; ++fsize.index) {
+        if (fsize.type == V4L2_FRMSIZE_TYPE_DISCRETE) {
+          sizes.emplace_back(enum_framerates(fd, fourcc, fsize.discrete.width, fsize.discrete.height));
+          continue;
+        }
+
+        auto &sw = fsize.stepwise;
+        auto size = enum_framerates(fd, fourcc, sw.max_width, sw.max_height);
+        size.width = sw.min_width;
+        size.height = sw.min_height;
+        size.step_width = sw.step_width;
+        size.step_height = sw.step_height;
+
+        // Sensors often run faster at smaller sizes, so the rates are queried again at the size that's picked
+        size.framerates_at = [path, fourcc](int width, int height) {
+          file_t fd {::open(path.c_str(), O_RDWR | O_NONBLOCK | O_CLOEXEC)};
+          if (fd.el < 0) {
+            return frame_size_t {width, height, width, height, 1, 1};
+          }
+
+          return enum_framerates(fd.el, fourcc, width, height);
+        };
+        sizes.emplace_back(std::move(size));
+        break;
+      }
+
+      return sizes;
+    }
+
+    /**
+     * @brief Frame rate closest to the request, preferring rates at or above it.
+     */
+    double closest_framerate(const frame_size_t &size, int framerate) {
+      auto &framerates = size.framerates;
+      if (framerates.empty()) {
+        return framerate;
+      }
+
+      if (size.interval_step) {
+        auto rate = std::clamp<double>(framerate, framerates.front(), framerates.back());
+        if (*size.interval_step <= 0) {
+          return rate;
+        }
+
+        // Snap the interval to a step, rounding towards the faster rate
+        auto shortest = 1 / framerates.back();
+        auto steps = std::floor((1 / rate - shortest) / *size.interval_step + 1e-6);
+        return 1 / (shortest + steps * *size.interval_step);
+      }
+
+      for (auto rate : framerates) {
+        // Allow for NTSC rates, 59.94 satisfies a request for 60
+        if (rate >= framerate - 0.5) {
+          return rate;
+        }
+      }
+
+      return framerates.back();
+    }
+  }  // namespace
+
+  std::optional<capabilities_t> probe(const std::string &path) {
+    file_t fd {::open(path.c_str(), O_RDWR | O_NONBLOCK | O_CLOEXEC)};
+    if (fd.el < 0) {
+      return std::nullopt;
+    }
+
+    v4l2_capability caps {};
+    if (xioctl(fd.el, VIDIOC_QUERYCAP, &caps) < 0) {
+      return std::nullopt;
+    }
+
+    // Skip ISP and codec nodes, those are memory-to-memory devices rather than cameras
+    auto device_caps = (caps.capabilities & V4L2_CAP_DEVICE_CAPS) ? caps.device_caps : caps.capabilities;
+    if (!(device_caps & V4L2_CAP_VIDEO_CAPTURE) || !(device_caps & V4L2_CAP_STREAMING) ||
+        (device_caps & (V4L2_CAP_VIDEO_M2M | V4L2_CAP_VIDEO_M2M_MPLANE))) {
+      return std::nullopt;
+    }
+
+    capabilities_t result;
+    result.path = path;
+    result.card = (const char *) caps.card;
+    result.driver = (const char *) caps.driver;
+    result.bus_info = (const char *) caps.bus_info;
+
+    v4l2_fmtdesc fmtdesc {};
+    fmtdesc.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    for (fmtdesc.index = 0; xioctl(fd.el, VIDIOC_ENUM_FMT, &fmtdesc) == 0; ++fmtdesc.index) {
+      result.formats.emplace_back(format_desc_t {
+        fmtdesc.pixelformat,
+        (fmtdesc.flags & V4L2_FMT_FLAG_COMPRESSED) != 0,
+        enum_frame_sizes(fd.el, path, fmtdesc.pixelformat),
+      });
+    }
+
+    // Metadata nodes of multi-node drivers report capture caps without any image formats
+    if (result.formats.empty()) {
+      return std::nullopt;
+    }
+
+    for (auto &format : result.formats) {
+      for (auto &size : format.sizes) {
+        BOOST_LOG(debug) << "V4L2: "sv << path << ' ' << fourcc_to_string(format.fourcc) << ' '
+                         << size.width << 'x' << size.height
+                         << (size.max_width != size.width || size.max_height != size.height ? " - "s + std::to_string(size.max_width) + 'x' + std::to_string(size.max_height) : ""s)
+                         << " @ "sv << (size.framerates.empty() ? 0.0 : size.framerates.back()) << " fps max"sv;
+      }
+    }
+
+    return result;
+  }
+
+  std::optional<mode_t> closest_mode(const capabilities_t &caps, int width, int height, int framerate, const std::vector<std::uint32_t> &fourccs, std::string *reason) {
+    std::optional<mode_t> best;
+    std::tuple<double, bool, bool, std::int64_t, std::size_t, double> best_score;
+
+    for (std::size_t preference = 0; preference < fourccs.size(); ++preference) {
+      auto format = std::find_if(std::begin(caps.formats), std::end(caps.formats), [&](const auto &format) {
+        return format.fourcc == fourccs[preference];
+      });
+      if (format == std::end(caps.formats)) {
+        continue;
+      }
+
+      for (auto &size : format->sizes) {
+        mode_t mode {format->fourcc, size.width, size.height};
+
+        bool exact = size.contains(width, height);
+        if (exact) {
+          mode.width = width;
+          mode.height = height;
+        } else {
+          // Get as close as the stepwise range allows
+          auto step_w = std::max(1, size.step_width);
+          auto step_h = std::max(1, size.step_height);
+          mode.width = size.width + (std::clamp(width, size.width, size.max_width) - size.width) / step_w * step_w;
+          mode.height = size.height + (std::clamp(height, size.height, size.max_height) - size.height) / step_h * step_h;
+        }
+
+        mode.framerate = closest_framerate(size, framerate);
+        if (size.framerates_at) {
+          if (auto at_size = size.framerates_at(mode.width, mode.height); !at_size.framerates.empty()) {
+            mode.framerate = closest_framerate(at_size, framerate);
+          }
+        }
+
+        // 59.94 fps is as good as 60 here
+        auto shortfall = framerate - mode.framerate;
+        if (shortfall <= 0.5) {
+          shortfall = 0;
+        }
+
+        // Lower is better for each element
+        std::tuple<double, bool, bool, std::int64_t, std::size_t, double> score {
+          shortfall,
+          !exact,
+          mode.width < width || mode.height < height,
+          std::abs((std::int64_t) mode.width * mode.height - (std::int64_t) width * height),
+          preference,
+          std::abs(mode.framerate - framerate),
+        };
+
+        if (!best || score < best_score) {
+          best = mode;
+          best_score = score;
+        }
+      }
+    }
+
+    if (best && reason) {
+      auto requested = std::to_string(width) + 'x' + std::to_string(height);
+      if (std::get<0>(best_score) > 0) {
+        *reason = "no mode reaches "s + std::to_string(framerate) + " fps, this one is the fastest"s;
+      } else if (!std::get<1>(best_score)) {
+        *reason = "it matches "s + requested + " @ "s + std::to_string(framerate) + " fps"s;
+      } else if (!std::get<2>(best_score)) {
+        *reason = "it's the closest mode reaching "s + std::to_string(framerate) + " fps, frames are scaled down to "s + requested;
+      } else {
+        *reason = "only smaller modes reach "s + std::to_string(framerate) + " fps, frames are scaled up to "s + requested;
+      }
+    }
+
+    return best;
+  }
+
+  bool set_control(int fd, std::uint32_t id, std::int32_t value) {
+    v4l2_control control {};
+    control.id = id;
+    control.value = value;
+
+    return xioctl(fd, VIDIOC_S_CTRL, &control) == 0;
+  }
+
+  rect_t centered_crop(const rect_t &bounds, int width, int height) {
+    if (width <= 0 || height <= 0 || bounds.width <= 0 || bounds.height <= 0) {
+      return bounds;
+    }
+
+    // Compare width / height ratios without losing precision
+    int crop_width = bounds.width;
+    int crop_height = bounds.height;
+    if ((std::int64_t) bounds.width * height > (std::int64_t) bounds.height * width) {
+      crop_width = (int) ((std::int64_t) bounds.height * width / height);
+    } else {
+      crop_height = (int) ((std::int64_t) bounds.width * height / width);
+    }
+
+    // Chroma subsampling needs even dimensions and offsets
+    crop_width &= ~1;
+    crop_height &= ~1;
+
+    return {
+      bounds.left + (((bounds.width - crop_width) / 2) & ~1),
+      bounds.top + (((bounds.height - crop_height) / 2) & ~1),
+      crop_width,
+      crop_height,
+    };
+  }
+
+  buffer_lease_t::buffer_lease_t(std::shared_ptr<device_t> device, const v4l2_buffer &buf):
+      index {buf.index},
+      bytesused {buf.bytesused},
+      sequence {buf.sequence},
+      device {std::move(device)} {
+    if ((buf.flags & V4L2_BUF_FLAG_TIMESTAMP_MASK) == V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC) {
+      // CLOCK_MONOTONIC is the clock backing std::chrono::steady_clock on Linux
+      timestamp = std::chrono::steady_clock::time_point {
+        std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::seconds {buf.timestamp.tv_sec} + std::chrono::microseconds {buf.timestamp.tv_usec})
+      };
+    } else {
+      timestamp = std::chrono::steady_clock::now();
+    }
+  }
+
+  buffer_lease_t::~buffer_lease_t() {
+    device->queue(index);
+  }
+
+  const buffer_t &buffer_lease_t::buffer() const {
+    return device->buffer(index);
+  }
+
+  device_t::device_t(std::string path, file_t &&fd):
+      device_path {std::move(path)},
+      device_fd {std::move(fd)} {
+  }
+
+  device_t::~device_t() {
+    stop();
+  }
+
+  std::shared_ptr<device_t> device_t::open(const std::string &path) {
+    file_t fd {::open(path.c_str(), O_RDWR | O_NONBLOCK | O_CLOEXEC)};
+    if (fd.el < 0) {
+      BOOST_LOG(error) << "V4L2: couldn't open "sv << path << ": "sv << strerror(errno);
+      return nullptr;
+    }
+
+    v4l2_capability caps {};
+    if (xioctl(fd.el, VIDIOC_QUERYCAP, &caps) < 0) {
+      BOOST_LOG(error) << "V4L2: "sv << path << " is not a V4L2 device: "sv << strerror(errno);
+      return nullptr;
+    }
+
+    auto device_caps = (caps.capabilities & V4L2_CAP_DEVICE_CAPS) ? caps.device_caps : caps.capabilities;
+    if (!(device_caps & V4L2_CAP_VIDEO_CAPTURE) || !(device_caps & V4L2_CAP_STREAMING)) {
+      BOOST_LOG(warning) << "V4L2: "sv << path << " ["sv << (const char *) caps.card << "] does not support streaming video capture"sv;
+      return nullptr;
+    }
+
+    BOOST_LOG(debug) << "V4L2: opened "sv << path << " ["sv << (const char *) caps.card << "] driver: "sv << (const char *) caps.driver;
+
+    return std::shared_ptr<device_t>(new device_t(path, std::move(fd)));
+  }
+
+  bool device_t::set_format(int width, int height, const std::vector<std::uint32_t> &fourccs) {
+    v4l2_format current {};
+    current.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    if (xioctl(device_fd.el, VIDIOC_G_FMT, &current) < 0) {
+      BOOST_LOG(error) << "V4L2: VIDIOC_G_FMT failed: "sv << strerror(errno);
+      return false;
+    }
+
+    for (auto fourcc : fourccs) {
+      v4l2_format format = current;
+      if (width > 0 && height > 0) {
+        format.fmt.pix.width = width;
+        format.fmt.pix.height = height;
+      }
+      format.fmt.pix.pixelformat = fourcc;
+      format.fmt.pix.field = V4L2_FIELD_NONE;
+      format.fmt.pix.bytesperline = 0;
+
+      if (xioctl(device_fd.el, VIDIOC_S_FMT, &format) < 0) {
+        BOOST_LOG(debug) << "V4L2: VIDIOC_S_FMT "sv << fourcc_to_string(fourcc) << " failed: "sv << strerror(errno);
+        continue;
+      }
+
+      // The driver is free to substitute a format of its own choosing
+      if (format.fmt.pix.pixelformat != fourcc) {
+        continue;
+      }
+
+      fmt.fourcc = format.fmt.pix.pixelformat;
+      fmt.width = format.fmt.pix.width;
+      fmt.height = format.fmt.pix.height;
+      fmt.bytesperline = format.fmt.pix.bytesperline;
+      fmt.sizeimage = format.fmt.pix.sizeimage;
+
+      BOOST_LOG(info) << "V4L2: negotiated "sv << fmt.width << 'x' << fmt.height << ' ' << fourcc_to_string(fmt.fourcc) << " on "sv << device_path;
+      return true;
+    }
+
+    return false;
+  }
+
+  bool device_t::set_framerate(double framerate) {
+    if (framerate <= 0) {
+      return false;
+    }
+
+    v4l2_streamparm parm {};
+    parm.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    if (xioctl(device_fd.el, VIDIOC_G_PARM, &parm) < 0 || !(parm.parm.capture.capability & V4L2_CAP_TIMEPERFRAME)) {
+      return false;
+    }
+
+    // Keep fractional rates such as 59.94 intact
+    parm.parm.capture.timeperframe.numerator = 1000;
+    parm.parm.capture.timeperframe.denominator = (std::uint32_t) std::lround(framerate * 1000);
+    if (xioctl(device_fd.el, VIDIOC_S_PARM, &parm) < 0) {
+      BOOST_LOG(warning) << "V4L2: VIDIOC_S_PARM failed: "sv << strerror(errno);
+      return false;
+    }
+
+    return true;
+  }
+
+  bool device_t::set_crop(int width, int height) {
+    v4l2_selection sel {};
+    sel.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    sel.target = V4L2_SEL_TGT_CROP_BOUNDS;
+    if (xioctl(device_fd.el, VIDIOC_G_SELECTION, &sel) < 0) {
+      BOOST_LOG(debug) << "V4L2: "sv << device_path << " doesn't support cropping: "sv << strerror(errno);
+      return false;
+    }
+
+    auto crop = centered_crop({sel.r.left, sel.r.top, (int) sel.r.width, (int) sel.r.height}, width, height);
+    if (crop.width == (int) sel.r.width && crop.height == (int) sel.r.height) {
+      // Nothing to crop, the aspect ratios already match
+      return true;
+    }
+
+    sel.target = V4L2_SEL_TGT_CROP;
+    sel.flags = V4L2_SEL_FLAG_LE;
+    sel.r = {crop.left, crop.top, (std::uint32_t) crop.width, (std::uint32_t) crop.height};
+    if (xioctl(device_fd.el, VIDIOC_S_SELECTION, &sel) < 0) {
+      BOOST_LOG(debug) << "V4L2: VIDIOC_S_SELECTION failed: "sv << strerror(errno);
+      return false;
+    }
+
+    BOOST_LOG(debug) << "V4L2: cropping "sv << device_path << " to "sv << sel.r.width << 'x' << sel.r.height << '+' << sel.r.left << '+' << sel.r.top;
+    return true;
+  }
+
+  void device_t::reset_crop() {
+    v4l2_selection sel {};
+    sel.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    sel.target = V4L2_SEL_TGT_CROP_DEFAULT;
+    if (xioctl(device_fd.el, VIDIOC_G_SELECTION, &sel) < 0) {
+      return;
+    }
+
+    sel.target = V4L2_SEL_TGT_CROP;
+    xioctl(device_fd.el, VIDIOC_S_SELECTION, &sel);
+  }
+
+  bool device_t::start(int buffer_count, bool export_dmabuf) {
+    v4l2_requestbuffers req {};
+    req.count = buffer_count;
+    req.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    req.memory = V4L2_MEMORY_MMAP;
+    if (xioctl(device_fd.el, VIDIOC_REQBUFS, &req) < 0) {
+      BOOST_LOG(error) << "V4L2: VIDIOC_REQBUFS failed: "sv << strerror(errno);
+      return false;
+    }
+
+    if (req.count == 0) {
+      BOOST_LOG(error) << "V4L2: driver didn't allocate any buffers"sv;
+      return false;
+    }
+
+    buffers.resize(req.count);
+    for (std::uint32_t x = 0; x < req.count; ++x) {
+      v4l2_buffer buf {};
+      buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+      buf.memory = V4L2_MEMORY_MMAP;
+      buf.index = x;
+      if (xioctl(device_fd.el, VIDIOC_QUERYBUF, &buf) < 0) {
+        BOOST_LOG(error) << "V4L2: VIDIOC_QUERYBUF failed: "sv << strerror(errno);
+        stop();
+        return false;
+      }
+
+      auto &buffer = buffers[x];
+      buffer.length = buf.length;
+      buffer.start = mmap(nullptr, buf.length, PROT_READ | PROT_WRITE, MAP_SHARED, device_fd.el, buf.m.offset);
+      if (buffer.start == MAP_FAILED) {
+        BOOST_LOG(error) << "V4L2: couldn't map buffer: "sv << strerror(errno);
+        buffer.start = nullptr;
+        stop();
+        return false;
+      }
+
+      if (export_dmabuf) {
+        v4l2_exportbuffer expbuf {};
+        expbuf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        expbuf.index = x;
+        expbuf.flags = O_RDONLY | O_CLOEXEC;
+        if (xioctl(device_fd.el, VIDIOC_EXPBUF, &expbuf) < 0) {
+          BOOST_LOG(error) << "V4L2: VIDIOC_EXPBUF failed: "sv << strerror(errno);
+          stop();
+          return false;
+        }
+
+        buffer.dmabuf_fd.el = expbuf.fd;
+      }
+    }
+
+    for (std::uint32_t x = 0; x < req.count; ++x) {
+      queue(x);
+    }
+
+    v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    if (xioctl(device_fd.el, VIDIOC_STREAMON, &type) < 0) {
+      BOOST_LOG(error) << "V4L2: VIDIOC_STREAMON failed: "sv << strerror(errno);
+      stop();
+      return false;
+    }
+
+    streaming = true;
+    return true;
+  }
+
+  void device_t::stop() {
+    if (streaming) {
+      v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+      xioctl(device_fd.el, VIDIOC_STREAMOFF, &type);
+      streaming = false;
+    }
+
+    if (buffers.empty()) {
+      return;
+    }
+
+    for (auto &buffer : buffers) {
+      if (buffer.start) {
+        munmap(buffer.start, buffer.length);
+      }
+    }
+    buffers.clear();
+    queued = 0;
+
+    v4l2_requestbuffers req {};
+    req.count = 0;
+    req.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    req.memory = V4L2_MEMORY_MMAP;
+    xioctl(device_fd.el, VIDIOC_REQBUFS, &req);
+  }
+
+  void device_t::queue(std::uint32_t index) {
+    if (index >= buffers.size()) {
+      return;
+    }
+
+    v4l2_buffer buf {};
+    buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    buf.memory = V4L2_MEMORY_MMAP;
+    buf.index = index;
+    if (xioctl(device_fd.el, VIDIOC_QBUF, &buf) < 0) {
+      BOOST_LOG(error) << "V4L2: VIDIOC_QBUF failed: "sv << strerror(errno);
+      return;
+    }
+
+    ++queued;
+  }
+
+  platf::capture_e device_t::dequeue(std::chrono::milliseconds timeout, std::shared_ptr<buffer_lease_t> &lease_out) {
+    // With every buffer checked out, the driver has nowhere to write the next frame
+    if (queued == 0) {
+      return platf::capture_e::timeout;
+    }
+
+    pollfd pfd {device_fd.el, POLLIN, 0};
+    auto status = poll(&pfd, 1, (int) timeout.count());
+    if (status < 0) {
+      if (errno == EINTR) {
+        return platf::capture_e::timeout;
+      }
+
+      BOOST_LOG(error) << "V4L2: poll failed: "sv << strerror(errno);
+      return platf::capture_e::error;
+    }
+
+    if (status == 0) {
+      return platf::capture_e::timeout;
+    }
+
+    if (pfd.revents & (POLLERR | POLLHUP)) {
+      BOOST_LOG(error) << "V4L2: "sv << device_path << " stopped streaming"sv;
+      return platf::capture_e::reinit;
+    }
+
+    v4l2_buffer buf {};
+    buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    buf.memory = V4L2_MEMORY_MMAP;
+    if (xioctl(device_fd.el, VIDIOC_DQBUF, &buf) < 0) {
+      if (errno == EAGAIN) {
+        return platf::capture_e::timeout;
+      }
+
+      BOOST_LOG(error) << "V4L2: VIDIOC_DQBUF failed: "sv << strerror(errno);
+      return platf::capture_e::error;
+    }
+
+    --queued;
+
+    auto lease = std::make_shared<buffer_lease_t>(shared_from_this(), buf);
+    if (buf.flags & V4L2_BUF_FLAG_ERROR) {
+      // Dropping the lease hands the corrupted buffer straight back to the driver
+      return platf::capture_e::timeout;
+    }
+
+    lease_out = std::move(lease);
+    return platf::capture_e::ok;
+  }
+}  // namespace v4l2
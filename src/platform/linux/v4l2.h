@@ -0,0 +1,280 @@
+/**
+ * @file src/platform/linux/v4l2.h
+ * @brief Declarations for direct V4L2 capture device access.
+ */
+#pragma once
+
+// standard includes
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// platform includes
+#include <linux/videodev2.h>
+
+// local includes
+#include "misc.h"
+#include "src/platform/common.h"
+
+namespace v4l2 {
+  /**
+   * @brief Convert a fourcc code to a printable string.
+   * @param fourcc The fourcc code.
+   * @return The four characters of the code.
+   */
+  std::string fourcc_to_string(std::uint32_t fourcc);
+
+  /**
+   * @brief Check if a fourcc describes an uncompressed format we can hand to an encoder as-is.
+   * @param fourcc The V4L2 pixel format.
+   * @return `true` if the format is NV12, YUV420 or YUYV.
+   */
+  bool is_raw_yuv(std::uint32_t fourcc);
+
+  struct frame_size_t {
+    // Smallest size, the only size for discrete frame sizes
+    int width;
+    int height;
+
+    // Stepwise frame sizes accept anything up to max_width x max_height in steps of step_width x step_height
+    int max_width;
+    int max_height;
+    int step_width;
+    int step_height;
+
+    // Frame rates supported at this size, in frames per second
+    // For stepwise and continuous frame intervals, the slowest and the fastest rate
+    std::vector<double> framerates;
+
+    // Set for stepwise and continuous frame intervals, the intervals between the slowest and the fastest rate
+    // are supported in steps of this many seconds, zero for continuous ones
+    std::optional<double> interval_step;
+
+    // Set for stepwise frame sizes, whose frame rates are probed at the largest size.
+    // Queries the frame rates supported at another size in the range.
+    std::function<frame_size_t(int width, int height)> framerates_at;
+
+    bool contains(int w, int h) const {
+      return w >= width && w <= max_width && h >= height && h <= max_height &&
+             (w - width) % std::max(1, step_width) == 0 && (h - height) % std::max(1, step_height) == 0;
+    }
+  };
+
+  struct format_desc_t {
+    std::uint32_t fourcc;
+    bool compressed;
+    std::vector<frame_size_t> sizes;
+  };
+
+  /**
+   * @brief Everything we need to know about a capture node to pick a mode without opening it again.
+   */
+  struct capabilities_t {
+    std::string path;
+    std::string card;
+    std::string driver;
+    std::string bus_info;
+    std::vector<format_desc_t> formats;
+  };
+
+  struct mode_t {
+    std::uint32_t fourcc;
+    int width;
+    int height;
+    double framerate;
+  };
+
+  /**
+   * @brief Query the identity, formats, frame sizes and frame rates of a device node.
+   * @param path The device node.
+   * @return The capabilities, or nothing if the node isn't a streaming video capture device.
+   */
+  std::optional<capabilities_t> probe(const std::string &path);
+
+  /**
+   * @brief Pick the mode closest to what the client asked for.
+   * The frame rate comes first: sensors list their binned and cropped modes as smaller frame sizes,
+   * and a mode that reaches the requested rate beats a larger one that can't, however much scaling it needs.
+   * If no mode reaches it, the fastest modes win.
+   * Among those, modes matching the requested size exactly win, then modes covering it so frames are only
+   * scaled down, then the closest size, then formats earlier in @p fourccs, then the frame rate closest to the request.
+   * @param caps The probed capabilities.
+   * @param width Requested width.
+   * @param height Requested height.
+   * @param framerate Requested frame rate.
+   * @param fourccs Acceptable pixel formats in order of preference.
+   * @param reason If not nullptr, receives why the mode was chosen.
+   * @return The chosen mode, or nothing if no acceptable format is offered.
+   */
+  std::optional<mode_t> closest_mode(const capabilities_t &caps, int width, int height, int framerate, const std::vector<std::uint32_t> &fourccs, std::string *reason = nullptr);
+
+  /**
+   * @brief Set a control of a device node.
+   * Controls belong to the device rather than the file descriptor, so this works while the node streams through another one.
+   * @param fd A file descriptor of the device node.
+   * @param id The control, e.g. V4L2_CID_MPEG_VIDEO_FORCE_KEY_FRAME.
+   * @param value The value to set.
+   * @return `true` if the driver accepted the value.
+   */
+  bool set_control(int fd, std::uint32_t id, std::int32_t value);
+
+  struct rect_t {
+    int left;
+    int top;
+    int width;
+    int height;
+  };
+
+  /**
+   * @brief Fit a centered crop with the aspect ratio of the target into the crop bounds.
+   * Cropping first leaves the scaler with a uniform scale, so the picture isn't distorted.
+   * @param bounds The area the device can crop from.
+   * @param width Target width.
+   * @param height Target height.
+   * @return The largest crop rectangle with the target aspect ratio, with even dimensions.
+   */
+  rect_t centered_crop(const rect_t &bounds, int width, int height);
+
+  struct format_t {
+    std::uint32_t fourcc;
+    int width;
+    int height;
+    std::uint32_t bytesperline;
+    std::uint32_t sizeimage;
+  };
+
+  struct buffer_t {
+    void *start;
+    std::size_t length;
+
+    // DMABUF exported with VIDIOC_EXPBUF, or -1 if the buffer wasn't exported
+    file_t dmabuf_fd;
+  };
+
+  class device_t;
+
+  /**
+   * @brief A dequeued driver buffer.
+   * The buffer is handed back to the driver when the last reference to the lease is dropped.
+   */
+  class buffer_lease_t {
+  public:
+    buffer_lease_t(std::shared_ptr<device_t> device, const v4l2_buffer &buf);
+    ~buffer_lease_t();
+
+    buffer_lease_t(const buffer_lease_t &) = delete;
+    buffer_lease_t &operator=(const buffer_lease_t &) = delete;
+
+    const buffer_t &buffer() const;
+
+    std::uint32_t index;
+    std::uint32_t bytesused;
+    std::uint32_t sequence;
+    std::chrono::steady_clock::time_point timestamp;
+
+  private:
+    std::shared_ptr<device_t> device;
+  };
+
+  class device_t: public std::enable_shared_from_this<device_t> {
+  public:
+    /**
+     * @brief Open a V4L2 video capture node.
+     * @param path The device node, e.g. /dev/video0.
+     * @return The device, or nullptr if it isn't a streaming capture device.
+     */
+    static std::shared_ptr<device_t> open(const std::string &path);
+
+    ~device_t();
+
+    /**
+     * @brief Negotiate the capture format.
+     * @param width Requested width, or 0 to keep the current width.
+     * @param height Requested height, or 0 to keep the current height.
+     * @param fourccs Acceptable pixel formats in order of preference.
+     * @return `true` if the driver accepted one of the formats.
+     */
+    bool set_format(int width, int height, const std::vector<std::uint32_t> &fourccs);
+
+    /**
+     * @brief Request a frame interval from the driver.
+     * @param framerate Frames per second.
+     * @return `true` if the driver supports setting the frame interval.
+     */
+    bool set_framerate(double framerate);
+
+    /**
+     * @brief Crop the sensor area to the aspect ratio of a target size.
+     * @param width Target width.
+     * @param height Target height.
+     * @return `true` if the driver supports cropping and accepted a crop rectangle.
+     */
+    bool set_crop(int width, int height);
+
+    /**
+     * @brief Restore the default crop rectangle of the device.
+     */
+    void reset_crop();
+
+    /**
+     * @brief Allocate, map and queue the driver buffers, then start streaming.
+     * @param buffer_count Number of buffers to request from the driver.
+     * @param export_dmabuf Export each buffer as a DMABUF file descriptor.
+     * @return `true` on success.
+     */
+    bool start(int buffer_count, bool export_dmabuf);
+
+    /**
+     * @brief Stop streaming and release the driver buffers.
+     * @note No leases may be outstanding when calling this.
+     */
+    void stop();
+
+    /**
+     * @brief Wait for the driver to fill a buffer and dequeue it.
+     * @param timeout Maximum time to wait.
+     * @param lease_out The dequeued buffer on success.
+     * @return capture_e::ok, capture_e::timeout, capture_e::reinit if the device stopped streaming
+     *         (it was unplugged or reset, reopening it may recover), or capture_e::error.
+     */
+    platf::capture_e dequeue(std::chrono::milliseconds timeout, std::shared_ptr<buffer_lease_t> &lease_out);
+
+    const format_t &format() const {
+      return fmt;
+    }
+
+    const buffer_t &buffer(std::uint32_t index) const {
+      return buffers[index];
+    }
+
+    int fd() const {
+      return device_fd.el;
+    }
+
+    const std::string &path() const {
+      return device_path;
+    }
+
+  private:
+    friend class buffer_lease_t;
+
+    device_t(std::string path, file_t &&fd);
+
+    void queue(std::uint32_t index);
+
+    std::string device_path;
+    file_t device_fd;
+    format_t fmt {};
+
+    std::vector<buffer_t> buffers;
+    std::atomic<int> queued {0};
+    bool streaming {false};
+  };
+}  // namespace v4l2
@@ -5,8 +5,10 @@
 // standard includes
 #include <fcntl.h>
 #include <format>
+#include <mutex>
 #include <sstream>
 #include <string>
+#include <sys/stat.h>
 
 extern "C" {
 #include <libavcodec/avcodec.h>
@@ -100,26 +102,14 @@ namespace va {
     int init(int in_width, int in_height, file_t &&render_device) {
       file = std::move(render_device);
 
-      if (!gbm::create_device) {
-        BOOST_LOG(warning) << "libgbm not initialized"sv;
-        return -1;
-      }
-
       this->data = (void *) vaapi_init_avcodec_hardware_input_buffer;
 
-      gbm.reset(gbm::create_device(file.el));
-      if (!gbm) {
-        char string[1024];
-        BOOST_LOG(error) << "Couldn't create GBM device: ["sv << strerror_r(errno, string, sizeof(string)) << ']';
+      shared_display = egl::shared_display(file.el);
+      if (!shared_display) {
         return -1;
       }
 
-      display = egl::make_display(gbm.get());
-      if (!display) {
-        return -1;
-      }
-
-      auto ctx_opt = egl::make_ctx(display.get());
+      auto ctx_opt = egl::make_ctx(shared_display->display.get());
       if (!ctx_opt) {
         return -1;
       }
@@ -132,6 +122,11 @@ namespace va {
       return 0;
     }
 
+    bool reuse_hwframes() override {
+      // Every session on the render node gets the same hardware device context
+      return true;
+    }
+
     /**
      * @brief Finds a supported VA entrypoint for the given VA profile.
      * @param profile The profile to match.
@@ -352,7 +347,7 @@ namespace va {
         }
       }
 
-      auto nv12_opt = egl::import_target(display.get(), std::move(fds), sds[0], sds[1]);
+      auto nv12_opt = egl::import_target(shared_display->display.get(), std::move(fds), sds[0], sds[1]);
       if (!nv12_opt) {
         return -1;
       }
@@ -375,8 +370,7 @@ namespace va {
     va::display_t::pointer va_display;
     file_t file;
 
-    gbm::gbm_t gbm;
-    egl::display_t display;
+    std::shared_ptr<egl::shared_display_t> shared_display;
     egl::ctx_t ctx;
 
     // This must be destroyed before display_t to ensure the GPU
@@ -406,22 +400,18 @@ namespace va {
 
       if (descriptor.sequence == 0) {
         // For dummy images, use a blank RGB texture instead of importing a DMA-BUF
-        rgb = egl::create_blank(img);
+        blank = egl::create_blank(img);
+        rgb = &blank;
       } else if (descriptor.sequence > sequence) {
         sequence = descriptor.sequence;
 
-        rgb = egl::rgb_t {};
-
-        auto rgb_opt = egl::import_source(display.get(), descriptor.sd);
-
-        if (!rgb_opt) {
+        rgb = sources.import_source(shared_display->display.get(), descriptor.sd);
+        if (!rgb) {
           return -1;
         }
-
-        rgb = std::move(*rgb_opt);
       }
 
-      sws.load_vram(descriptor, offset_x, offset_y, rgb->tex[0]);
+      sws.load_vram(descriptor, offset_x, offset_y, (*rgb)->tex[0], shared_display->display.get());
 
       sws.convert(nv12->buf);
       return 0;
@@ -441,7 +431,9 @@ namespace va {
     }
 
     std::uint64_t sequence;
-    egl::rgb_t rgb;
+    egl::import_cache_t sources;
+    egl::rgb_t blank;
+    egl::rgb_t *rgb = nullptr;
 
     int offset_x, offset_y;
   };
@@ -494,8 +486,38 @@ namespace va {
     av_freep(&priv);
   }
 
+  /**
+   * Initializing a VADisplay can take over 100 ms, so the hardware device context of a render node
+   * is kept for the lifetime of the process and shared by every session, including the ones that
+   * follow a reinitialization of the display.
+   */
+  struct shared_device_t {
+    std::mutex lock;
+    dev_t rdev = 0;
+    video::avcodec_buffer_t device;
+  };
+
+  static shared_device_t shared_device;
+
   int vaapi_init_avcodec_hardware_input_buffer(platf::avcodec_encode_device_t *base, AVBufferRef **hw_device_buf) {
     auto va = (va::va_t *) base;
+
+    struct stat st;
+    if (fstat(va->file.el, &st)) {
+      st.st_rdev = 0;
+    }
+
+    std::lock_guard lg {shared_device.lock};
+    if (shared_device.device && st.st_rdev && shared_device.rdev == st.st_rdev) {
+      *hw_device_buf = av_buffer_ref(shared_device.device.get());
+      if (!*hw_device_buf) {
+        return -1;
+      }
+
+      va->va_display = ((AVVAAPIDeviceContext *) ((AVHWDeviceContext *) (*hw_device_buf)->data)->hwctx)->display;
+      return 0;
+    }
+
     auto fd = dup(va->file.el);
 
     auto *priv = (VAAPIDevicePriv *) av_mallocz(sizeof(VAAPIDevicePriv));
@@ -546,6 +568,11 @@ namespace va {
       return err;
     }
 
+    if (st.st_rdev) {
+      shared_device.rdev = st.st_rdev;
+      shared_device.device.reset(av_buffer_ref(*hw_device_buf));
+    }
+
     return 0;
   }
 
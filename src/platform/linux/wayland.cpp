@@ -3,6 +3,7 @@
  * @brief Definitions for Wayland capture.
  */
 // standard includes
+#include <algorithm>
 #include <cstdlib>
 
 // platform includes
@@ -203,6 +204,8 @@ namespace wl {
       this->interface[XDG_OUTPUT] = true;
     } else if (!std::strcmp(interface, zwlr_screencopy_manager_v1_interface.name)) {
       BOOST_LOG(info) << "Found interface: "sv << interface << '(' << id << ") version "sv << version;
+      // copy_with_damage needs version 2, linux_dmabuf events version 3
+      version = std::min<std::uint32_t>(version, zwlr_screencopy_manager_v1_interface.version);
       screencopy_manager = (zwlr_screencopy_manager_v1 *) wl_registry_bind(registry, id, &zwlr_screencopy_manager_v1_interface, version);
 
       this->interface[WLR_EXPORT_DMABUF] = true;
@@ -258,17 +261,25 @@ namespace wl {
     return true;
   }
 
-  // Cleanup GBM
+  // Release the buffer pool
   void dmabuf_t::cleanup_gbm() {
-    if (current_bo) {
-      gbm_bo_destroy(current_bo);
-      current_bo = nullptr;
-    }
+    for (auto &buffer : pool) {
+      if (buffer.wl_buffer) {
+        wl_buffer_destroy(buffer.wl_buffer);
+      }
 
-    if (current_wl_buffer) {
-      wl_buffer_destroy(current_wl_buffer);
-      current_wl_buffer = nullptr;
+      if (buffer.fd >= 0) {
+        close(buffer.fd);
+      }
+
+      if (buffer.bo) {
+        gbm_bo_destroy(buffer.bo);
+      }
+
+      buffer = pool_buffer_t {};
     }
+
+    pool_index = 0;
   }
 
   dmabuf_t::dmabuf_t():
@@ -375,39 +386,58 @@ namespace wl {
       return;
     }
 
-    // Create GBM buffer
-    current_bo = gbm_bo_create(gbm_device, dmabuf_info.width, dmabuf_info.height, dmabuf_info.format, GBM_BO_USE_RENDERING);
-    if (!current_bo) {
-      BOOST_LOG(error) << "Failed to create GBM buffer"sv;
-      zwlr_screencopy_frame_v1_destroy(frame);
-      status = REINIT;
-      return;
-    }
+    // The buffers only fit frames of the layout they were allocated for
+    if (pool_info.format != dmabuf_info.format || pool_info.width != dmabuf_info.width || pool_info.height != dmabuf_info.height) {
+      cleanup_gbm();
 
-    // Get buffer info
-    int fd = gbm_bo_get_fd(current_bo);
-    if (fd < 0) {
-      BOOST_LOG(error) << "Failed to get buffer FD"sv;
-      gbm_bo_destroy(current_bo);
-      current_bo = nullptr;
-      zwlr_screencopy_frame_v1_destroy(frame);
-      status = REINIT;
-      return;
+      pool_info.format = dmabuf_info.format;
+      pool_info.width = dmabuf_info.width;
+      pool_info.height = dmabuf_info.height;
     }
 
-    uint32_t stride = gbm_bo_get_stride(current_bo);
-    uint64_t modifier = gbm_bo_get_modifier(current_bo);
+    auto &buffer = pool[pool_index];
+    if (!buffer.bo) {
+      // Create GBM buffer
+      buffer.bo = gbm_bo_create(gbm_device, dmabuf_info.width, dmabuf_info.height, dmabuf_info.format, GBM_BO_USE_RENDERING);
+      if (!buffer.bo) {
+        BOOST_LOG(error) << "Failed to create GBM buffer"sv;
+        zwlr_screencopy_frame_v1_destroy(frame);
+        status = REINIT;
+        return;
+      }
+
+      // Get buffer info
+      buffer.fd = gbm_bo_get_fd(buffer.bo);
+      if (buffer.fd < 0) {
+        BOOST_LOG(error) << "Failed to get buffer FD"sv;
+        gbm_bo_destroy(buffer.bo);
+        buffer.bo = nullptr;
+        zwlr_screencopy_frame_v1_destroy(frame);
+        status = REINIT;
+        return;
+      }
+
+      buffer.stride = gbm_bo_get_stride(buffer.bo);
+      buffer.modifier = gbm_bo_get_modifier(buffer.bo);
 
-    // Store in surface descriptor for later use
+      BOOST_LOG(debug) << "Allocated screencopy buffer "sv << pool_index << " of "sv << POOL_SIZE;
+    }
+
+    // Store in surface descriptor for later use, the pool keeps its own descriptor
     auto next_frame = get_next_frame();
-    next_frame->sd.fds[0] = fd;
-    next_frame->sd.pitches[0] = stride;
+    next_frame->sd.fds[0] = dup(buffer.fd);
+    next_frame->sd.pitches[0] = buffer.stride;
     next_frame->sd.offsets[0] = 0;
-    next_frame->sd.modifier = modifier;
+    next_frame->sd.modifier = buffer.modifier;
+
+    if (buffer.wl_buffer) {
+      copy(frame, buffer.wl_buffer);
+      return;
+    }
 
     // Create linux-dmabuf buffer
     auto params = zwp_linux_dmabuf_v1_create_params(dmabuf_interface);
-    zwp_linux_buffer_params_v1_add(params, fd, 0, 0, stride, modifier >> 32, modifier & 0xffffffff);
+    zwp_linux_buffer_params_v1_add(params, buffer.fd, 0, 0, buffer.stride, buffer.modifier >> 32, buffer.modifier & 0xffffffff);
 
     // Add listener for buffer creation
     zwp_linux_buffer_params_v1_add_listener(params, &params_listener, frame);
@@ -416,6 +446,18 @@ namespace wl {
     zwp_linux_buffer_params_v1_create(params, dmabuf_info.width, dmabuf_info.height, dmabuf_info.format, 0);
   }
 
+  void dmabuf_t::copy(zwlr_screencopy_frame_v1 *frame, struct wl_buffer *wl_buffer) {
+    damage_rects.clear();
+
+    // With damage, the compositor holds the frame back until the output changes
+    with_damage = zwlr_screencopy_frame_v1_get_version(frame) >= ZWLR_SCREENCOPY_FRAME_V1_COPY_WITH_DAMAGE_SINCE_VERSION;
+    if (with_damage) {
+      zwlr_screencopy_frame_v1_copy_with_damage(frame, wl_buffer);
+    } else {
+      zwlr_screencopy_frame_v1_copy(frame, wl_buffer);
+    }
+  }
+
   // Buffer done callback - time to create buffer
   void dmabuf_t::buffer_done(zwlr_screencopy_frame_v1 *frame) {
     auto next_frame = get_next_frame();
@@ -450,11 +492,12 @@ namespace wl {
     auto frame = static_cast<zwlr_screencopy_frame_v1 *>(data);
     auto self = static_cast<dmabuf_t *>(zwlr_screencopy_frame_v1_get_user_data(frame));
 
-    // Store for cleanup
-    self->current_wl_buffer = buffer;
+    // Kept in the pool, so the next frames in this buffer copy right away
+    self->pool[self->pool_index].wl_buffer = buffer;
+    zwp_linux_buffer_params_v1_destroy(params);
 
     // Start the actual copy
-    zwlr_screencopy_frame_v1_copy(frame, buffer);
+    self->copy(frame, buffer);
   }
 
   // Buffer params failed callback
@@ -485,13 +528,22 @@ namespace wl {
     current_frame->destroy();
     current_frame = get_next_frame();
 
-    // Keep the GBM buffer alive but destroy the Wayland objects
-    if (current_wl_buffer) {
-      wl_buffer_destroy(current_wl_buffer);
-      current_wl_buffer = nullptr;
+    if (with_damage) {
+      // Damage is in buffer coordinates
+      if (y_invert) {
+        for (auto &rect : damage_rects) {
+          rect.y = (int) pool_info.height - rect.y - rect.height;
+        }
+      }
+
+      current_frame->damage = std::move(damage_rects);
+      damage_rects = {};
+    } else {
+      current_frame->damage.reset();
     }
 
-    cleanup_gbm();
+    // The compositor copies the next frame into the next buffer of the pool
+    pool_index = (pool_index + 1) % POOL_SIZE;
 
     zwlr_screencopy_frame_v1_destroy(frame);
     status = READY;
@@ -516,7 +568,9 @@ namespace wl {
     std::uint32_t y,
     std::uint32_t width,
     std::uint32_t height
-  ) {};
+  ) {
+    damage_rects.emplace_back(platf::rect_t {(int) x, (int) y, (int) width, (int) height});
+  }
 
   void frame_t::destroy() {
     for (auto x = 0; x < 4; ++x) {
@@ -5,7 +5,10 @@
 #pragma once
 
 // standard includes
+#include <array>
 #include <bitset>
+#include <optional>
+#include <vector>
 
 #ifdef SUNSHINE_BUILD_WAYLAND
   #include <linux-dmabuf-unstable-v1.h>
@@ -31,6 +34,9 @@ namespace wl {
     void destroy();
 
     egl::surface_descriptor_t sd;
+
+    // Areas the compositor reported as changed, unset if it couldn't tell
+    std::optional<std::vector<platf::rect_t>> damage;
   };
 
   class dmabuf_t {
@@ -70,9 +76,22 @@ namespace wl {
     zwlr_screencopy_frame_v1_listener listener;
 
   private:
+    // A buffer the compositor copies frames into, kept as long as the frame layout doesn't change
+    struct pool_buffer_t {
+      struct gbm_bo *bo {nullptr};
+      struct wl_buffer *wl_buffer {nullptr};
+      int fd {-1};
+      std::uint32_t stride;
+      std::uint64_t modifier;
+    };
+
+    // The encoder may still read the previous frames while the compositor copies the next one
+    static constexpr std::size_t POOL_SIZE = 3;
+
     bool init_gbm();
     void cleanup_gbm();
     void create_and_copy_dmabuf(zwlr_screencopy_frame_v1 *frame);
+    void copy(zwlr_screencopy_frame_v1 *frame, struct wl_buffer *wl_buffer);
 
     zwp_linux_dmabuf_v1 *dmabuf_interface {nullptr};
 
@@ -92,9 +111,20 @@ namespace wl {
     } dmabuf_info;
 
     struct gbm_device *gbm_device {nullptr};
-    struct gbm_bo *current_bo {nullptr};
-    struct wl_buffer *current_wl_buffer {nullptr};
+
+    std::array<pool_buffer_t, POOL_SIZE> pool;
+    std::size_t pool_index {0};
+
+    // Layout the buffers of the pool were allocated with
+    struct {
+      std::uint32_t format;
+      std::uint32_t width;
+      std::uint32_t height;
+    } pool_info {};
+
     bool y_invert {false};
+    bool with_damage {false};
+    std::vector<platf::rect_t> damage_rects;
   };
 
   class monitor_t {
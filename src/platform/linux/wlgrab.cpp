@@ -20,10 +20,7 @@ namespace wl {
   static int env_height;
 
   struct img_t: public platf::img_t {
-    ~img_t() override {
-      delete[] data;
-      data = nullptr;
-    }
+    util::aligned_ptr_t<std::uint8_t> buffer;
   };
 
   class wlr_t: public platf::display_t {
@@ -89,8 +86,12 @@ namespace wl {
     inline platf::capture_e snapshot(const pull_free_image_cb_t &pull_free_image_cb, std::shared_ptr<platf::img_t> &img_out, std::chrono::milliseconds timeout, bool cursor) {
       auto to = std::chrono::steady_clock::now() + timeout;
 
+      // A frame that timed out is still being waited for, the compositor only copies it once the output changes
+      if (dmabuf.status != dmabuf_t::WAITING) {
+        dmabuf.listen(interface.screencopy_manager, interface.dmabuf_interface, output, cursor);
+      }
+
       // Dispatch events until we get a new frame or the timeout expires
-      dmabuf.listen(interface.screencopy_manager, interface.dmabuf_interface, output, cursor);
       do {
         auto remaining_time_ms = std::chrono::duration_cast<std::chrono::milliseconds>(to - std::chrono::steady_clock::now());
         if (remaining_time_ms.count() < 0 || !display.dispatch(remaining_time_ms)) {
@@ -114,6 +115,7 @@ namespace wl {
     platf::mem_type_e mem_type;
 
     std::chrono::nanoseconds delay;
+    std::unique_ptr<platf::high_precision_timer> timer = platf::create_high_precision_timer(platf::CAPTURE_TIMER_SPIN);
 
     wl::display_t display;
     interface_t interface;
@@ -133,16 +135,23 @@ namespace wl {
         auto now = std::chrono::steady_clock::now();
 
         if (next_frame > now) {
-          std::this_thread::sleep_for(next_frame - now);
+          timer->sleep_until(next_frame);
           sleep_overshoot_logger.first_point(next_frame);
           sleep_overshoot_logger.second_point_now_and_log();
         }
 
-        next_frame += delay;
+        next_frame += delay + take_phase_shift();
         if (next_frame < now) {  // some major slowdown happened; we couldn't keep up
           next_frame = now + delay;
         }
 
+        if (!frame_wanted()) {
+          if (!push_captured_image_cb(nullptr, false)) {
+            return platf::capture_e::ok;
+          }
+          continue;
+        }
+
         std::shared_ptr<platf::img_t> img_out;
         auto status = snapshot(pull_free_image_cb, img_out, 1000ms, *cursor);
         switch (status) {
@@ -177,9 +186,8 @@ namespace wl {
 
       auto current_frame = dmabuf.current_frame;
 
-      auto rgb_opt = egl::import_source(egl_display.get(), current_frame->sd);
-
-      if (!rgb_opt) {
+      auto rgb = sources.import_source(egl_display.get(), current_frame->sd);
+      if (!rgb) {
         return platf::capture_e::reinit;
       }
 
@@ -187,7 +195,7 @@ namespace wl {
         return platf::capture_e::interrupted;
       }
 
-      gl::ctx.BindTexture(GL_TEXTURE_2D, (*rgb_opt)->tex[0]);
+      gl::ctx.BindTexture(GL_TEXTURE_2D, (*rgb)->tex[0]);
 
       // Don't remove these lines, see https://github.com/LizardByte/Sunshine/issues/453
       int w, h;
@@ -195,7 +203,8 @@ namespace wl {
       gl::ctx.GetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &h);
       BOOST_LOG(debug) << "width and height: w "sv << w << " h "sv << h;
 
-      gl::ctx.GetTextureSubImage((*rgb_opt)->tex[0], 0, 0, 0, 0, width, height, 1, GL_BGRA, GL_UNSIGNED_BYTE, img_out->height * img_out->row_pitch, img_out->data);
+      gl::ctx.GetTextureSubImage((*rgb)->tex[0], 0, 0, 0, 0, width, height, 1, GL_BGRA, GL_UNSIGNED_BYTE, img_out->height * img_out->row_pitch, img_out->data);
+      img_out->damage = current_frame->damage;
       gl::ctx.BindTexture(GL_TEXTURE_2D, 0);
 
       return platf::capture_e::ok;
@@ -243,13 +252,17 @@ namespace wl {
       img->height = height;
       img->pixel_pitch = 4;
       img->row_pitch = img->pixel_pitch * width;
-      img->data = new std::uint8_t[height * img->row_pitch];
+      img->buffer = util::make_aligned<std::uint8_t>(height * img->row_pitch);
+      img->data = img->buffer.get();
 
       return img;
     }
 
     egl::display_t egl_display;
     egl::ctx_t ctx;
+
+    // Destroyed before the context its textures live in
+    egl::import_cache_t sources;
   };
 
   class wlr_vram_t: public wlr_t {
@@ -263,16 +276,23 @@ namespace wl {
         auto now = std::chrono::steady_clock::now();
 
         if (next_frame > now) {
-          std::this_thread::sleep_for(next_frame - now);
+          timer->sleep_until(next_frame);
           sleep_overshoot_logger.first_point(next_frame);
           sleep_overshoot_logger.second_point_now_and_log();
         }
 
-        next_frame += delay;
+        next_frame += delay + take_phase_shift();
         if (next_frame < now) {  // some major slowdown happened; we couldn't keep up
           next_frame = now + delay;
         }
 
+        if (!frame_wanted()) {
+          if (!push_captured_image_cb(nullptr, false)) {
+            return platf::capture_e::ok;
+          }
+          continue;
+        }
+
         std::shared_ptr<platf::img_t> img_out;
         auto status = snapshot(pull_free_image_cb, img_out, 1000ms, *cursor);
         switch (status) {
@@ -317,6 +337,7 @@ namespace wl {
       img->sequence = sequence;
 
       img->sd = current_frame->sd;
+      img->damage = current_frame->damage;
 
       // Prevent dmabuf from closing the file descriptors.
       std::fill_n(current_frame->sd.fds, 4, -1);
@@ -3,8 +3,13 @@
  * @brief Definitions for x11 capture.
  */
 // standard includes
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
 #include <fstream>
+#include <optional>
 #include <thread>
+#include <tuple>
 
 // plaform includes
 #include <sys/ipc.h>
@@ -14,6 +19,7 @@
 #include <X11/X.h>
 #include <X11/Xlib.h>
 #include <X11/Xutil.h>
+#include <xcb/damage.h>
 #include <xcb/shm.h>
 #include <xcb/xfixes.h>
 
@@ -25,6 +31,7 @@
 #include "src/globals.h"
 #include "src/logging.h"
 #include "src/platform/common.h"
+#include "src/platform/cursor_blend.h"
 #include "src/task_pool.h"
 #include "src/video.h"
 #include "vaapi.h"
@@ -158,6 +165,8 @@ namespace platf {
 
   namespace xcb {
     static xcb_extension_t *shm_id;
+    static xcb_extension_t *damage_id;
+    static xcb_extension_t *xfixes_id;
 
     _FN(shm_get_image_reply, xcb_shm_get_image_reply_t *, (xcb_connection_t * c, xcb_shm_get_image_cookie_t cookie, xcb_generic_error_t **e));
 
@@ -165,6 +174,19 @@ namespace platf {
 
     _FN(shm_attach, xcb_void_cookie_t, (xcb_connection_t * c, xcb_shm_seg_t shmseg, uint32_t shmid, uint8_t read_only));
 
+    _FN(damage_query_version, xcb_damage_query_version_cookie_t, (xcb_connection_t * c, uint32_t client_major_version, uint32_t client_minor_version));
+    _FN(damage_query_version_reply, xcb_damage_query_version_reply_t *, (xcb_connection_t * c, xcb_damage_query_version_cookie_t cookie, xcb_generic_error_t **e));
+    _FN(damage_create, xcb_void_cookie_t, (xcb_connection_t * c, xcb_damage_damage_t damage, xcb_drawable_t drawable, uint8_t level));
+    _FN(damage_subtract, xcb_void_cookie_t, (xcb_connection_t * c, xcb_damage_damage_t damage, xcb_xfixes_region_t repair, xcb_xfixes_region_t parts));
+
+    _FN(xfixes_query_version, xcb_xfixes_query_version_cookie_t, (xcb_connection_t * c, uint32_t client_major_version, uint32_t client_minor_version));
+    _FN(xfixes_query_version_reply, xcb_xfixes_query_version_reply_t *, (xcb_connection_t * c, xcb_xfixes_query_version_cookie_t cookie, xcb_generic_error_t **e));
+    _FN(xfixes_create_region, xcb_void_cookie_t, (xcb_connection_t * c, xcb_xfixes_region_t region, uint32_t rectangles_len, const xcb_rectangle_t *rectangles));
+    _FN(xfixes_fetch_region, xcb_xfixes_fetch_region_cookie_t, (xcb_connection_t * c, xcb_xfixes_region_t region));
+    _FN(xfixes_fetch_region_reply, xcb_xfixes_fetch_region_reply_t *, (xcb_connection_t * c, xcb_xfixes_fetch_region_cookie_t cookie, xcb_generic_error_t **e));
+    _FN(xfixes_fetch_region_rectangles, xcb_rectangle_t *, (const xcb_xfixes_fetch_region_reply_t *R));
+    _FN(xfixes_fetch_region_rectangles_length, int, (const xcb_xfixes_fetch_region_reply_t *R));
+
     _FN(get_extension_data, xcb_query_extension_reply_t *, (xcb_connection_t * c, xcb_extension_t *ext));
 
     _FN(get_setup, xcb_setup_t *, (xcb_connection_t * c));
@@ -173,6 +195,7 @@ namespace platf {
     _FN(connect, xcb_connection_t *, (const char *displayname, int *screenp));
     _FN(setup_roots_iterator, xcb_screen_iterator_t, (const xcb_setup_t *R));
     _FN(generate_id, std::uint32_t, (xcb_connection_t * c));
+    _FN(poll_for_event, xcb_generic_event_t *, (xcb_connection_t * c));
 
     int init_shm() {
       static void *handle {nullptr};
@@ -227,6 +250,7 @@ namespace platf {
         {(dyn::apiproc *) &connect, "xcb_connect"},
         {(dyn::apiproc *) &setup_roots_iterator, "xcb_setup_roots_iterator"},
         {(dyn::apiproc *) &generate_id, "xcb_generate_id"},
+        {(dyn::apiproc *) &poll_for_event, "xcb_poll_for_event"},
       };
 
       if (dyn::load(handle, funcs)) {
@@ -237,6 +261,56 @@ namespace platf {
       return 0;
     }
 
+    int init_damage() {
+      static void *damage_handle {nullptr};
+      static void *xfixes_handle {nullptr};
+      static bool funcs_loaded = false;
+
+      if (funcs_loaded) {
+        return 0;
+      }
+
+      if (!damage_handle) {
+        damage_handle = dyn::handle({"libxcb-damage.so.0", "libxcb-damage.so"});
+        if (!damage_handle) {
+          return -1;
+        }
+      }
+
+      if (!xfixes_handle) {
+        xfixes_handle = dyn::handle({"libxcb-xfixes.so.0", "libxcb-xfixes.so"});
+        if (!xfixes_handle) {
+          return -1;
+        }
+      }
+
+      std::vector<std::tuple<dyn::apiproc *, const char *>> damage_funcs {
+        {(dyn::apiproc *) &damage_id, "xcb_damage_id"},
+        {(dyn::apiproc *) &damage_query_version, "xcb_damage_query_version"},
+        {(dyn::apiproc *) &damage_query_version_reply, "xcb_damage_query_version_reply"},
+        {(dyn::apiproc *) &damage_create, "xcb_damage_create"},
+        {(dyn::apiproc *) &damage_subtract, "xcb_damage_subtract"},
+      };
+
+      std::vector<std::tuple<dyn::apiproc *, const char *>> xfixes_funcs {
+        {(dyn::apiproc *) &xfixes_id, "xcb_xfixes_id"},
+        {(dyn::apiproc *) &xfixes_query_version, "xcb_xfixes_query_version"},
+        {(dyn::apiproc *) &xfixes_query_version_reply, "xcb_xfixes_query_version_reply"},
+        {(dyn::apiproc *) &xfixes_create_region, "xcb_xfixes_create_region"},
+        {(dyn::apiproc *) &xfixes_fetch_region, "xcb_xfixes_fetch_region"},
+        {(dyn::apiproc *) &xfixes_fetch_region_reply, "xcb_xfixes_fetch_region_reply"},
+        {(dyn::apiproc *) &xfixes_fetch_region_rectangles, "xcb_xfixes_fetch_region_rectangles"},
+        {(dyn::apiproc *) &xfixes_fetch_region_rectangles_length, "xcb_xfixes_fetch_region_rectangles_length"},
+      };
+
+      if (dyn::load(damage_handle, damage_funcs) || dyn::load(xfixes_handle, xfixes_funcs)) {
+        return -1;
+      }
+
+      funcs_loaded = true;
+      return 0;
+    }
+
 #undef _FN
   }  // namespace xcb
 
@@ -245,6 +319,7 @@ namespace platf {
 
   using xcb_connect_t = util::dyn_safe_ptr<xcb_connection_t, &xcb::disconnect>;
   using xcb_img_t = util::c_ptr<xcb_shm_get_image_reply_t>;
+  using xcb_region_t = util::c_ptr<xcb_xfixes_fetch_region_reply_t>;
 
   using ximg_t = util::safe_ptr<XImage, freeImage>;
   using xcursor_t = util::safe_ptr<XFixesCursorImage, freeX>;
@@ -307,63 +382,57 @@ namespace platf {
   };
 
   struct shm_img_t: public img_t {
-    ~shm_img_t() override {
-      delete[] data;
-      data = nullptr;
-    }
+    util::aligned_ptr_t<std::uint8_t> buffer;
   };
 
-  static void blend_cursor(Display *display, img_t &img, int offsetX, int offsetY) {
-    xcursor_t overlay {x11::fix::GetCursorImage(display)};
-
-    if (!overlay) {
-      BOOST_LOG(error) << "Couldn't get cursor from XFixesGetCursorImage"sv;
-      return;
-    }
-
-    overlay->x -= overlay->xhot;
-    overlay->y -= overlay->yhot;
+  static void blend_cursor(XFixesCursorImage &overlay, img_t &img, int offsetX, int offsetY) {
+    overlay.x -= overlay.xhot;
+    overlay.y -= overlay.yhot;
 
-    overlay->x -= offsetX;
-    overlay->y -= offsetY;
+    overlay.x -= offsetX;
+    overlay.y -= offsetY;
 
-    overlay->x = std::max((short) 0, overlay->x);
-    overlay->y = std::max((short) 0, overlay->y);
+    overlay.x = std::max((short) 0, overlay.x);
+    overlay.y = std::max((short) 0, overlay.y);
 
-    auto pixels = (int *) img.data;
+    auto pixels = (std::uint32_t *) img.data;
 
     auto screen_height = img.height;
     auto screen_width = img.width;
 
-    auto delta_height = std::min<uint16_t>(overlay->height, std::max(0, screen_height - overlay->y));
-    auto delta_width = std::min<uint16_t>(overlay->width, std::max(0, screen_width - overlay->x));
-    for (auto y = 0; y < delta_height; ++y) {
-      auto overlay_begin = &overlay->pixels[y * overlay->width];
-      auto overlay_end = &overlay->pixels[y * overlay->width + delta_width];
+    auto delta_height = std::min<uint16_t>(overlay.height, std::max(0, screen_height - overlay.y));
+    auto delta_width = std::min<uint16_t>(overlay.width, std::max(0, screen_width - overlay.x));
 
-      auto pixels_begin = &pixels[(y + overlay->y) * (img.row_pitch / img.pixel_pitch) + overlay->x];
+    // XFixes hands out every pixel in an unsigned long, pack the visible part into 32 bits for the blend
+    std::vector<std::uint32_t> cursor(delta_width * delta_height);
+    for (auto y = 0; y < delta_height; ++y) {
+      std::copy_n(&overlay.pixels[y * overlay.width], delta_width, &cursor[y * delta_width]);
+    }
 
-      std::for_each(overlay_begin, overlay_end, [&](long pixel) {
-        int *pixel_p = (int *) &pixel;
+    platf::blend_cursor(
+      &pixels[overlay.y * (img.row_pitch / img.pixel_pitch) + overlay.x],
+      img.row_pitch / img.pixel_pitch,
+      cursor.data(),
+      delta_width,
+      delta_width,
+      delta_height
+    );
+  }
 
-        auto colors_in = (uint8_t *) pixels_begin;
+  static void blend_cursor(Display *display, img_t &img, int offsetX, int offsetY) {
+    xcursor_t overlay {x11::fix::GetCursorImage(display)};
 
-        auto alpha = (*(uint *) pixel_p) >> 24u;
-        if (alpha == 255) {
-          *pixels_begin = *pixel_p;
-        } else {
-          auto colors_out = (uint8_t *) pixel_p;
-          colors_in[0] = colors_out[0] + (colors_in[0] * (255 - alpha) + 255 / 2) / 255;
-          colors_in[1] = colors_out[1] + (colors_in[1] * (255 - alpha) + 255 / 2) / 255;
-          colors_in[2] = colors_out[2] + (colors_in[2] * (255 - alpha) + 255 / 2) / 255;
-        }
-        ++pixels_begin;
-      });
+    if (!overlay) {
+      BOOST_LOG(error) << "Couldn't get cursor from XFixesGetCursorImage"sv;
+      return;
     }
+
+    blend_cursor(*overlay, img, offsetX, offsetY);
   }
 
   struct x11_attr_t: public display_t {
     std::chrono::nanoseconds delay;
+    std::unique_ptr<high_precision_timer> timer = create_high_precision_timer(CAPTURE_TIMER_SPIN);
 
     x11::xdisplay_t xdisplay;
     Window xwindow;
@@ -465,16 +534,23 @@ namespace platf {
         auto now = std::chrono::steady_clock::now();
 
         if (next_frame > now) {
-          std::this_thread::sleep_for(next_frame - now);
+          timer->sleep_until(next_frame);
           sleep_overshoot_logger.first_point(next_frame);
           sleep_overshoot_logger.second_point_now_and_log();
         }
 
-        next_frame += delay;
+        next_frame += delay + take_phase_shift();
         if (next_frame < now) {  // some major slowdown happened; we couldn't keep up
           next_frame = now + delay;
         }
 
+        if (!frame_wanted()) {
+          if (!push_captured_image_cb(nullptr, false)) {
+            return platf::capture_e::ok;
+          }
+          continue;
+        }
+
         std::shared_ptr<platf::img_t> img_out;
         auto status = snapshot(pull_free_image_cb, img_out, 1000ms, *cursor);
         switch (status) {
@@ -568,6 +644,9 @@ namespace platf {
   };
 
   struct shm_attr_t: public x11_attr_t {
+    // Above this many rectangles, fetching the whole frame at once is cheaper
+    static constexpr std::size_t MAX_DAMAGE_RECTS = 32;
+
     x11::xdisplay_t shm_xdisplay;  // Prevent race condition with x11_attr_t::xdisplay
     xcb_connect_t xcb;
     xcb_screen_t *display;
@@ -575,8 +654,19 @@ namespace platf {
 
     shm_id_t shm_id;
 
+    // The frame, followed by room for the damaged rectangles when the DAMAGE extension is used
     shm_data_t data;
 
+    // Damage of the root window and the region it is moved into, both 0 without the DAMAGE extension
+    xcb_damage_damage_t damage {};
+    xcb_xfixes_region_t damage_region {};
+
+    // The frame in the segment is complete, so only damaged parts have to be fetched
+    bool frame_complete = false;
+
+    // Position and serial of the cursor in the last snapshot, unset when it wasn't drawn
+    std::optional<std::tuple<short, short, unsigned long>> last_cursor;
+
     task_pool_util::TaskPool::task_id_t refresh_task_id;
 
     void delayed_refresh() {
@@ -604,16 +694,23 @@ namespace platf {
         auto now = std::chrono::steady_clock::now();
 
         if (next_frame > now) {
-          std::this_thread::sleep_for(next_frame - now);
+          timer->sleep_until(next_frame);
           sleep_overshoot_logger.first_point(next_frame);
           sleep_overshoot_logger.second_point_now_and_log();
         }
 
-        next_frame += delay;
+        next_frame += delay + take_phase_shift();
         if (next_frame < now) {  // some major slowdown happened; we couldn't keep up
           next_frame = now + delay;
         }
 
+        if (!frame_wanted()) {
+          if (!push_captured_image_cb(nullptr, false)) {
+            return platf::capture_e::ok;
+          }
+          continue;
+        }
+
         std::shared_ptr<platf::img_t> img_out;
         auto status = snapshot(pull_free_image_cb, img_out, 1000ms, *cursor);
         switch (status) {
@@ -640,21 +737,135 @@ namespace platf {
       return capture_e::ok;
     }
 
+    /**
+     * @brief Fetch a part of the screen into the segment.
+     * @param rect The part of the root window to fetch.
+     * @param offset Where the part goes in the segment, its rows are packed.
+     * @return The cookie of the request.
+     */
+    xcb_shm_get_image_cookie_t get_image(const xcb_rectangle_t &rect, std::uint32_t offset) {
+      return xcb::shm_get_image_unchecked(xcb.get(), display->root, rect.x, rect.y, rect.width, rect.height, ~0, XCB_IMAGE_FORMAT_Z_PIXMAP, seg, offset);
+    }
+
+    bool get_frame() {
+      xcb_rectangle_t rect {(std::int16_t) offset_x, (std::int16_t) offset_y, (std::uint16_t) width, (std::uint16_t) height};
+      xcb_img_t img_reply {xcb::shm_get_image_reply(xcb.get(), get_image(rect, 0), nullptr)};
+
+      frame_complete = (bool) img_reply;
+      return frame_complete;
+    }
+
+    /**
+     * @brief Bring the frame in the segment up to date with the damaged parts of the screen.
+     * @return 1 if the frame changed, 0 if nothing was damaged, -1 on error.
+     */
+    int update_damaged() {
+      // With the non-empty report level there is one DamageNotify per batch of damage, the damage is fetched below
+      while (auto event = xcb::poll_for_event(xcb.get())) {
+        std::free(event);
+      }
+
+      xcb::damage_subtract(xcb.get(), damage, XCB_NONE, damage_region);
+      xcb_region_t region {xcb::xfixes_fetch_region_reply(xcb.get(), xcb::xfixes_fetch_region(xcb.get(), damage_region), nullptr)};
+      if (!region) {
+        return -1;
+      }
+
+      if (!frame_complete) {
+        return get_frame() ? 1 : -1;
+      }
+
+      auto rects = xcb::xfixes_fetch_region_rectangles(region.get());
+      auto count = xcb::xfixes_fetch_region_rectangles_length(region.get());
+
+      // Regions are made of rectangles that don't overlap, so the clipped ones fit behind the frame
+      std::vector<xcb_rectangle_t> damaged;
+      std::size_t area = 0;
+      for (int x = 0; x < count; ++x) {
+        auto &rect = rects[x];
+
+        auto left = std::max<int>(rect.x, offset_x);
+        auto top = std::max<int>(rect.y, offset_y);
+        auto right = std::min<int>(rect.x + rect.width, offset_x + width);
+        auto bottom = std::min<int>(rect.y + rect.height, offset_y + height);
+        if (left >= right || top >= bottom) {
+          continue;
+        }
+
+        damaged.emplace_back(xcb_rectangle_t {(std::int16_t) left, (std::int16_t) top, (std::uint16_t) (right - left), (std::uint16_t) (bottom - top)});
+        area += (std::size_t) (right - left) * (bottom - top);
+      }
+
+      if (damaged.empty()) {
+        return 0;
+      }
+
+      if (damaged.size() > MAX_DAMAGE_RECTS || area * 2 > (std::size_t) width * height) {
+        return get_frame() ? 1 : -1;
+      }
+
+      // Send every request before waiting for the first reply
+      std::vector<xcb_shm_get_image_cookie_t> cookies;
+      auto offset = frame_size();
+      for (auto &rect : damaged) {
+        cookies.emplace_back(get_image(rect, offset));
+        offset += rect.width * rect.height * 4;
+      }
+
+      offset = frame_size();
+      for (std::size_t x = 0; x < damaged.size(); ++x) {
+        auto &rect = damaged[x];
+
+        xcb_img_t img_reply {xcb::shm_get_image_reply(xcb.get(), cookies[x], nullptr)};
+        if (!img_reply) {
+          frame_complete = false;
+          return -1;
+        }
+
+        auto src = (std::uint8_t *) data.data + offset;
+        auto dst = (std::uint8_t *) data.data + ((rect.y - offset_y) * width + (rect.x - offset_x)) * 4;
+        for (int y = 0; y < rect.height; ++y) {
+          std::memcpy(dst + y * width * 4, src + y * rect.width * 4, rect.width * 4);
+        }
+
+        offset += rect.width * rect.height * 4;
+      }
+
+      return 1;
+    }
+
     capture_e snapshot(const pull_free_image_cb_t &pull_free_image_cb, std::shared_ptr<platf::img_t> &img_out, std::chrono::milliseconds timeout, bool cursor) {
       // The whole X server changed, so we must reinit everything
       if (xattr.width != env_width || xattr.height != env_height) {
         BOOST_LOG(warning) << "X dimensions changed in SHM mode, request reinit"sv;
         return capture_e::reinit;
       } else {
-        auto img_cookie = xcb::shm_get_image_unchecked(xcb.get(), display->root, offset_x, offset_y, width, height, ~0, XCB_IMAGE_FORMAT_Z_PIXMAP, seg, 0);
         auto frame_timestamp = std::chrono::steady_clock::now();
 
-        xcb_img_t img_reply {xcb::shm_get_image_reply(xcb.get(), img_cookie, nullptr)};
-        if (!img_reply) {
+        auto changed = damage ? update_damaged() : (get_frame() ? 1 : -1);
+        if (changed < 0) {
           BOOST_LOG(error) << "Could not get image reply"sv;
           return capture_e::reinit;
         }
 
+        xcursor_t overlay;
+        if (cursor) {
+          overlay.reset(x11::fix::GetCursorImage(shm_xdisplay.get()));
+          if (!overlay) {
+            BOOST_LOG(error) << "Couldn't get cursor from XFixesGetCursorImage"sv;
+          }
+        }
+
+        // Without damage, only a moved or changed cursor makes a new frame
+        std::optional<std::tuple<short, short, unsigned long>> cursor_state;
+        if (overlay) {
+          cursor_state = std::make_tuple(overlay->x, overlay->y, overlay->cursor_serial);
+        }
+        if (!changed && cursor_state == last_cursor) {
+          return capture_e::timeout;
+        }
+        last_cursor = cursor_state;
+
         if (!pull_free_image_cb(img_out)) {
           return platf::capture_e::interrupted;
         }
@@ -662,8 +873,8 @@ namespace platf {
         std::copy_n((std::uint8_t *) data.data, frame_size(), img_out->data);
         img_out->frame_timestamp = frame_timestamp;
 
-        if (cursor) {
-          blend_cursor(shm_xdisplay.get(), *img_out, offset_x, offset_y);
+        if (overlay) {
+          blend_cursor(*overlay, *img_out, offset_x, offset_y);
         }
 
         return capture_e::ok;
@@ -676,7 +887,8 @@ namespace platf {
       img->height = height;
       img->pixel_pitch = 4;
       img->row_pitch = img->pixel_pitch * width;
-      img->data = new std::uint8_t[height * img->row_pitch];
+      img->buffer = util::make_aligned<std::uint8_t>(height * img->row_pitch);
+      img->data = img->buffer.get();
 
       return img;
     }
@@ -706,7 +918,10 @@ namespace platf {
       display = iter.data;
       seg = xcb::generate_id(xcb.get());
 
-      shm_id.id = shmget(IPC_PRIVATE, frame_size(), IPC_CREAT | 0777);
+      init_damage();
+
+      // Damaged rectangles are fetched behind the frame
+      shm_id.id = shmget(IPC_PRIVATE, damage ? frame_size() * 2 : frame_size(), IPC_CREAT | 0777);
       if (shm_id.id == -1) {
         BOOST_LOG(error) << "shmget failed"sv;
         return -1;
@@ -727,6 +942,28 @@ namespace platf {
     std::uint32_t frame_size() {
       return width * height * 4;
     }
+
+    // Without the DAMAGE extension, every frame is fetched in full
+    void init_damage() {
+      if (xcb::init_damage() ||
+          !xcb::get_extension_data(xcb.get(), xcb::damage_id)->present ||
+          !xcb::get_extension_data(xcb.get(), xcb::xfixes_id)->present) {
+        BOOST_LOG(info) << "Missing DAMAGE extension, fetching every frame in full"sv;
+        return;
+      }
+
+      // Both extensions need to know the version of the client before anything else, regions need XFixes 2
+      std::free(xcb::xfixes_query_version_reply(xcb.get(), xcb::xfixes_query_version(xcb.get(), 2, 0), nullptr));
+      std::free(xcb::damage_query_version_reply(xcb.get(), xcb::damage_query_version(xcb.get(), 1, 1), nullptr));
+
+      damage_region = xcb::generate_id(xcb.get());
+      xcb::xfixes_create_region(xcb.get(), damage_region, 0, nullptr);
+
+      damage = xcb::generate_id(xcb.get());
+      xcb::damage_create(xcb.get(), damage, display->root, XCB_DAMAGE_REPORT_LEVEL_NON_EMPTY);
+
+      BOOST_LOG(debug) << "Fetching only the damaged parts of the screen"sv;
+    }
   };
 
   std::shared_ptr<display_t> x11_display(platf::mem_type_e hwdevice_type, const std::string &display_name, const ::video::config_t &config) {
@@ -90,10 +90,12 @@
   @synchronized(self) {
     AVCaptureVideoDataOutput *videoOutput = [[AVCaptureVideoDataOutput alloc] init];
 
+    // IOSurface backed buffers from the output's pool go to VideoToolbox as they are, without a copy into a surface of its own
     [videoOutput setVideoSettings:@{
       (NSString *) kCVPixelBufferPixelFormatTypeKey: [NSNumber numberWithUnsignedInt:self.pixelFormat],
       (NSString *) kCVPixelBufferWidthKey: [NSNumber numberWithInt:self.frameWidth],
       (NSString *) kCVPixelBufferHeightKey: [NSNumber numberWithInt:self.frameHeight],
+      (NSString *) kCVPixelBufferIOSurfacePropertiesKey: @{},
       (NSString *) AVVideoScalingModeKey: AVVideoScalingModeResizeAspect,
     }];
 
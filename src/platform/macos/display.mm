@@ -2,6 +2,9 @@
  * @file src/platform/macos/display.mm
  * @brief Definitions for display capture on macOS.
  */
+// platform includes
+#include <sys/utsname.h>
+
 // local includes
 #include "src/config.h"
 #include "src/logging.h"
@@ -10,6 +13,7 @@
 #include "src/platform/macos/av_video.h"
 #include "src/platform/macos/misc.h"
 #include "src/platform/macos/nv12_zero_device.h"
+#include "src/platform/synthetic_display.h"
 
 // Avoid conflict between AVFoundation and libavutil both defining AVMediaType
 #define AVMediaType AVMediaType_FFmpeg
@@ -152,6 +156,10 @@ namespace platf {
   };
 
   std::shared_ptr<display_t> display(platf::mem_type_e hwdevice_type, const std::string &display_name, const video::config_t &config) {
+    if (config::video.capture == synthetic::NAME) {
+      return synthetic::display(hwdevice_type, config);
+    }
+
     if (hwdevice_type != platf::mem_type_e::system && hwdevice_type != platf::mem_type_e::videotoolbox) {
       BOOST_LOG(error) << "Could not initialize display with the given hw device type."sv;
       return nullptr;
@@ -193,7 +201,20 @@ namespace platf {
     return display;
   }
 
+  bool has_encoded_display(const std::string &, const video::config_t &) {
+    // No capture backend here encodes the frames itself
+    return false;
+  }
+
+  std::unique_ptr<encoded_display_t> encoded_display(const std::string &, const video::config_t &) {
+    return nullptr;
+  }
+
   std::vector<std::string> display_names(mem_type_e hwdevice_type) {
+    if (config::video.capture == synthetic::NAME) {
+      return synthetic::display_names();
+    }
+
     __block std::vector<std::string> display_names;
 
     auto display_array = [AVVideo displayNames];
@@ -215,4 +236,14 @@ namespace platf {
     // We don't track GPU state, so we will always reenumerate. Fortunately, it is fast on macOS.
     return true;
   }
+
+  std::string encoder_environment_id() {
+    // VideoToolbox is part of the OS, so the OS build and hardware identify it
+    struct utsname name;
+    if (uname(&name)) {
+      return {};
+    }
+
+    return std::string {name.release} + ' ' + name.version + ' ' + name.machine;
+  }
 }  // namespace platf
@@ -464,6 +464,15 @@ const KeyCodeMap kKeyCodesMap[] = {
     // Unimplemented
   }
 
+  void flush_input(input_t &input) {
+    // Input is injected as it arrives
+  }
+
+  std::uint64_t gamepad_reports_coalesced(input_t &input) {
+    // Gamepads are unsupported
+    return 0;
+  }
+
   /**
    * @brief Allocates a context to store per-client input data.
    * @param input The global input context.
@@ -494,6 +503,10 @@ const KeyCodeMap kKeyCodesMap[] = {
     // Unimplemented feature - platform_caps::pen_touch
   }
 
+  void flush_client_input(client_input_t *input) {
+    // Unimplemented feature - platform_caps::pen_touch
+  }
+
   /**
    * @brief Sends a gamepad touch event to the OS.
    * @param input The global input context.
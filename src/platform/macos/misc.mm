@@ -9,6 +9,7 @@
 #endif
 
 // standard includes
+#include <cstring>
 #include <fcntl.h>
 #include <ifaddrs.h>
 
@@ -17,6 +18,9 @@
 #include <dlfcn.h>
 #include <Foundation/Foundation.h>
 #include <mach-o/dyld.h>
+#include <mach/mach.h>
+#include <pthread.h>
+#include <sys/mman.h>
 #include <net/if_dl.h>
 #include <pwd.h>
 
@@ -214,6 +218,52 @@ namespace platf {
     // Unimplemented
   }
 
+  void pin_thread(int cpu) {
+    // Unimplemented, macOS only takes affinity hints
+  }
+
+  thermal_state_t thermal_state() {
+    // Unimplemented
+    return {};
+  }
+
+  void set_thread_name(const std::string &name) {
+    pthread_setname_np(name.c_str());
+  }
+
+  std::vector<thread_cpu_time_t> thread_cpu_times() {
+    // Unimplemented
+    return {};
+  }
+
+  std::optional<std::uint64_t> resident_memory() {
+    mach_task_basic_info_data_t info;
+    mach_msg_type_number_t count = MACH_TASK_BASIC_INFO_COUNT;
+    if (task_info(mach_task_self(), MACH_TASK_BASIC_INFO, (task_info_t) &info, &count) != KERN_SUCCESS) {
+      return std::nullopt;
+    }
+
+    return info.resident_size;
+  }
+
+  std::optional<std::uint64_t> available_memory() {
+    // Unimplemented
+    return std::nullopt;
+  }
+
+  bool lock_memory(const void *addr, std::size_t size) {
+    if (mlock(addr, size)) {
+      BOOST_LOG(debug) << "Couldn't lock "sv << size << " bytes in RAM: "sv << std::strerror(errno);
+      return false;
+    }
+
+    return true;
+  }
+
+  void unlock_memory(const void *addr, std::size_t size) {
+    munlock(addr, size);
+  }
+
   void streaming_will_start() {
     // Nothing to do
   }
@@ -301,6 +351,16 @@ namespace platf {
     return false;
   }
 
+  bool recv_batch(recv_batch_info_t &recv_info) {
+    // Fall back to receiving one datagram at a time
+    return false;
+  }
+
+  size_t send_batch_max_blocks(size_t block_size) {
+    // Keep batches within 64K, like the other platforms
+    return std::clamp<size_t>(64 * 1024 / block_size, 1, 64);
+  }
+
   bool send(send_info_t &send_info) {
     auto sockfd = (int) send_info.native_socket;
     struct msghdr msg = {};
@@ -507,6 +567,36 @@ namespace platf {
     return std::make_unique<qos_t>(sockfd, reset_options);
   }
 
+  bool enable_socket_txtime(uintptr_t native_socket) {
+    // No per-packet transmit times on this platform
+    return false;
+  }
+
+  bool enable_socket_zerocopy(uintptr_t native_socket) {
+    // Sends always copy on this platform
+    return false;
+  }
+
+  bool wait_zerocopy(uintptr_t native_socket, zerocopy_state_t &state, std::chrono::milliseconds timeout) {
+    state.pending = 0;
+    return true;
+  }
+
+  int socket_send_queue_bytes(uintptr_t native_socket) {
+    int queued;
+    socklen_t queued_len = sizeof(queued);
+    if (getsockopt((int) native_socket, SOL_SOCKET, SO_NWRITE, &queued, &queued_len) != 0) {
+      return -1;
+    }
+
+    return queued;
+  }
+
+  int probe_path_mtu(const boost::asio::ip::address &address, int max_size) {
+    // macOS doesn't report what it learns from ICMP on UDP sockets
+    return -1;
+  }
+
   std::string get_host_name() {
     try {
       return boost::asio::ip::host_name();
@@ -527,7 +617,7 @@ namespace platf {
     }
   };
 
-  std::unique_ptr<high_precision_timer> create_high_precision_timer() {
+  std::unique_ptr<high_precision_timer> create_high_precision_timer(std::chrono::nanoseconds spin) {
     return std::make_unique<macos_high_precision_timer>();
   }
 }  // namespace platf
@@ -0,0 +1,149 @@
+/**
+ * @file src/platform/synthetic_display.cpp
+ * @brief Definitions for the synthetic capture backend, a display that draws its own frames.
+ */
+// standard includes
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <thread>
+
+// local includes
+#include "src/logging.h"
+#include "src/video.h"
+#include "synthetic_display.h"
+
+using namespace std::literals;
+
+namespace platf::synthetic {
+  namespace {
+    // Rows of the pattern before it repeats
+    constexpr int PATTERN_ROWS = 64;
+
+    // Pixels the pattern moves to the left every frame
+    constexpr int STEP = 8;
+
+    struct synthetic_img_t: public img_t {
+      std::vector<std::uint8_t> buffer;
+    };
+
+    class synthetic_display_t: public display_t {
+    public:
+      explicit synthetic_display_t(const ::video::config_t &config):
+          delay {std::chrono::nanoseconds {1s} / config.framerate} {
+        width = config.width;
+        height = config.height;
+        env_width = width;
+        env_height = height;
+
+        // Every row is stored twice side by side, so a row starting at any offset is one copy
+        pattern.resize((std::size_t) PATTERN_ROWS * width * 2);
+        for (int y = 0; y < PATTERN_ROWS; ++y) {
+          auto row = &pattern[(std::size_t) y * width * 2];
+          for (int x = 0; x < width; ++x) {
+            // A blue gradient under a checkerboard, the edges give the encoder something to work on
+            std::uint32_t b = x * 255 / width;
+            std::uint32_t g = (y * 4) & 0xFF;
+            std::uint32_t r = ((x / 16 + y / 16) & 1) ? 0xFF : 0x20;
+
+            row[x] = row[x + width] = b | g << 8 | r << 16;
+          }
+        }
+      }
+
+      capture_e capture(const push_captured_image_cb_t &push_captured_image_cb, const pull_free_image_cb_t &pull_free_image_cb, bool *cursor) override {
+        auto next_frame = std::chrono::steady_clock::now();
+
+        sleep_overshoot_logger.reset();
+
+        while (true) {
+          auto now = std::chrono::steady_clock::now();
+
+          if (next_frame > now) {
+            timer->sleep_until(next_frame);
+            sleep_overshoot_logger.first_point(next_frame);
+            sleep_overshoot_logger.second_point_now_and_log();
+          }
+
+          next_frame += delay + take_phase_shift();
+          if (next_frame < now) {  // some major slowdown happened; we couldn't keep up
+            next_frame = now + delay;
+          }
+
+          std::shared_ptr<platf::img_t> img_out;
+          if (!pull_free_image_cb(img_out)) {
+            return capture_e::interrupted;
+          }
+
+          draw(*img_out);
+
+          if (!push_captured_image_cb(std::move(img_out), true)) {
+            return capture_e::ok;
+          }
+        }
+      }
+
+      std::shared_ptr<img_t> alloc_img() override {
+        auto img = std::make_shared<synthetic_img_t>();
+        img->buffer.resize((std::size_t) width * height * 4);
+        img->data = img->buffer.data();
+        img->width = width;
+        img->height = height;
+        img->pixel_pitch = 4;
+        img->row_pitch = width * 4;
+
+        return img;
+      }
+
+      int dummy_img(img_t *img) override {
+        if (!img || !img->data) {
+          return -1;
+        }
+
+        std::memset(img->data, 0, (std::size_t) img->row_pitch * img->height);
+        return 0;
+      }
+
+      std::unique_ptr<avcodec_encode_device_t> make_avcodec_encode_device(pix_fmt_e pix_fmt) override {
+        return std::make_unique<avcodec_encode_device_t>();
+      }
+
+    private:
+      void draw(img_t &img) {
+        // The frame is on the glass once it's due, drawing it counts as capturing it
+        img.frame_timestamp = std::chrono::steady_clock::now();
+
+        auto offset = (int) ((frame++ * STEP) % width);
+        for (int y = 0; y < height; ++y) {
+          auto row = &pattern[(std::size_t) (y % PATTERN_ROWS) * width * 2];
+          std::memcpy(img.data + (std::size_t) y * img.row_pitch, row + (offset + y) % width, (std::size_t) width * 4);
+        }
+      }
+
+      std::chrono::nanoseconds delay;
+      std::unique_ptr<high_precision_timer> timer = create_high_precision_timer(CAPTURE_TIMER_SPIN);
+
+      std::vector<std::uint32_t> pattern;
+      std::uint64_t frame = 0;
+    };
+  }  // namespace
+
+  std::shared_ptr<display_t> display(mem_type_e hwdevice_type, const ::video::config_t &config) {
+    if (hwdevice_type != mem_type_e::system) {
+      BOOST_LOG(debug) << "Synthetic display only draws to system memory"sv;
+      return nullptr;
+    }
+
+    if (config.width <= 0 || config.height <= 0 || config.framerate <= 0) {
+      BOOST_LOG(error) << "Synthetic display needs a resolution and a frame rate, got "sv << config.width << 'x' << config.height << '@' << config.framerate;
+      return nullptr;
+    }
+
+    BOOST_LOG(info) << "Drawing synthetic frames at "sv << config.width << 'x' << config.height << '@' << config.framerate;
+    return std::make_shared<synthetic_display_t>(config);
+  }
+
+  std::vector<std::string> display_names() {
+    return {std::string {NAME}};
+  }
+}  // namespace platf::synthetic
@@ -0,0 +1,37 @@
+/**
+ * @file src/platform/synthetic_display.h
+ * @brief Declarations for the synthetic capture backend, a display that draws its own frames.
+ */
+#pragma once
+
+// standard includes
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// local includes
+#include "common.h"
+
+namespace platf::synthetic {
+  /**
+   * @brief Name of the backend in the `capture` option, and of the only display it offers.
+   */
+  constexpr std::string_view NAME = "synthetic";
+
+  /**
+   * @brief Create a display that draws a moving test pattern at the resolution and frame rate of the stream.
+   * Nothing on the host is captured, so the whole pipeline can be benchmarked on machines without a screen.
+   * Frames are drawn to system memory, only encoders that take frames from there can use it.
+   * @param hwdevice_type The memory type expected by the encoder.
+   * @param config The stream configuration.
+   * @return The display, or nullptr if the encoder doesn't take frames from system memory.
+   */
+  std::shared_ptr<display_t> display(mem_type_e hwdevice_type, const ::video::config_t &config);
+
+  /**
+   * @brief Enumerate the displays of the synthetic backend.
+   * @return The one synthetic display.
+   */
+  std::vector<std::string> display_names();
+}  // namespace platf::synthetic
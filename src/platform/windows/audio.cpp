@@ -276,6 +276,44 @@ namespace platf::audio {
     },
   };
 
+  /**
+   * @brief Initialize a loopback stream with the smallest period the audio engine supports.
+   * This only works when the audio engine doesn't have to convert the captured audio.
+   * @return The audio client, or nullptr if the device can't stream at a lower period than the default one.
+   */
+  audio_client_t make_low_latency_audio_client(device_t &device, WAVEFORMATEXTENSIBLE &capture_waveformat) {
+    // IAudioClient3 is only available from Windows 10 on
+    audio_client_t audio_client;
+    auto status = device->Activate(IID_IAudioClient3, CLSCTX_ALL, nullptr, (void **) &audio_client);
+    if (FAILED(status)) {
+      return nullptr;
+    }
+
+    auto audio_client3 = (IAudioClient3 *) audio_client.get();
+
+    UINT32 default_period, fundamental_period, min_period, max_period;
+    status = audio_client3->GetSharedModeEnginePeriod((LPWAVEFORMATEX) &capture_waveformat, &default_period, &fundamental_period, &min_period, &max_period);
+    if (FAILED(status) || min_period >= default_period) {
+      return nullptr;
+    }
+
+    status = audio_client3->InitializeSharedAudioStream(
+      AUDCLNT_STREAMFLAGS_LOOPBACK | AUDCLNT_STREAMFLAGS_EVENTCALLBACK,
+      min_period,
+      (LPWAVEFORMATEX) &capture_waveformat,
+      nullptr
+    );
+
+    if (FAILED(status)) {
+      BOOST_LOG(debug) << "Couldn't initialize low latency audio stream: [0x"sv << util::hex(status).to_string_view() << ']';
+      return nullptr;
+    }
+
+    BOOST_LOG(info) << "Audio capture period is "sv << min_period << " frames instead of "sv << default_period;
+
+    return audio_client;
+  }
+
   audio_client_t make_audio_client(device_t &device, const format_t &format) {
     audio_client_t audio_client;
     auto status = device->Activate(
@@ -294,6 +332,9 @@ namespace platf::audio {
     WAVEFORMATEXTENSIBLE capture_waveformat =
       create_waveformat(sample_format_e::f32, format.channel_count, format.capture_waveformat_channel_mask);
 
+    // Set when the audio engine mixes in the capture format, so no conversion is needed
+    bool engine_format = false;
+
     {
       wave_format_t mixer_waveformat;
       status = audio_client->GetMixFormat(&mixer_waveformat);
@@ -308,6 +349,9 @@ namespace platf::audio {
           mixer_waveformat->cbSize >= 22) {
         auto waveformatext_pointer = reinterpret_cast<const WAVEFORMATEXTENSIBLE *>(mixer_waveformat.get());
         capture_waveformat.dwChannelMask = waveformatext_pointer->dwChannelMask;
+        engine_format = waveformatext_pointer->SubFormat == KSDATAFORMAT_SUBTYPE_IEEE_FLOAT &&
+                        mixer_waveformat->wBitsPerSample == 32 &&
+                        mixer_waveformat->nSamplesPerSec == 48000;
       }
 
       BOOST_LOG(info) << "Audio mixer format is "sv << mixer_waveformat->wBitsPerSample << "-bit, "sv
@@ -315,6 +359,14 @@ namespace platf::audio {
                       << ((mixer_waveformat->nSamplesPerSec != 48000) ? "will be resampled to 48000 by Windows"sv : "no resampling needed"sv);
     }
 
+    if (engine_format) {
+      if (auto low_latency_audio_client = make_low_latency_audio_client(device, capture_waveformat)) {
+        BOOST_LOG(info) << "Audio capture format is "sv << logging::bracket(waveformat_to_pretty_string(capture_waveformat));
+
+        return low_latency_audio_client;
+      }
+    }
+
     status = audio_client->Initialize(
       AUDCLNT_SHAREMODE_SHARED,
       AUDCLNT_STREAMFLAGS_LOOPBACK | AUDCLNT_STREAMFLAGS_EVENTCALLBACK |
@@ -180,6 +180,9 @@ namespace platf::dxgi {
 
     std::unique_ptr<high_precision_timer> timer = create_high_precision_timer();
 
+    // Time from DWM presenting a frame to it being handed to the encoder (at loglevel debug)
+    logging::time_delta_periodic_logger handoff_latency_logger = {debug, "Frame capture to encode handoff"};
+
     typedef enum _D3DKMT_SCHEDULINGPRIORITYCLASS {
       D3DKMT_SCHEDULINGPRIORITYCLASS_IDLE,  ///< Idle priority class
       D3DKMT_SCHEDULINGPRIORITYCLASS_BELOW_NORMAL,  ///< Below normal priority class
@@ -262,6 +265,16 @@ namespace platf::dxgi {
     texture2d_t texture;
   };
 
+  /**
+   * @brief How often the capture thread had to wait for an encoder to release a shared image texture.
+   */
+  struct texture_lock_stats_t {
+    std::uint64_t locks;
+    std::uint64_t stalls;  ///< Locks that found the texture held by an encoder
+    std::chrono::steady_clock::duration stall_time;
+    std::chrono::steady_clock::time_point logged = std::chrono::steady_clock::now();
+  };
+
   /**
    * Display component for devices that use hardware encoders.
    */
@@ -279,6 +292,8 @@ namespace platf::dxgi {
     std::unique_ptr<nvenc_encode_device_t> make_nvenc_encode_device(pix_fmt_e pix_fmt) override;
 
     std::atomic<uint32_t> next_image_id;
+
+    texture_lock_stats_t texture_lock_stats {};
   };
 
   /**
@@ -349,6 +364,7 @@ namespace platf::dxgi {
     winrt::Windows::Graphics::Capture::Direct3D11CaptureFrame produced_frame {nullptr}, consumed_frame {nullptr};
     SRWLOCK frame_lock = SRWLOCK_INIT;
     CONDITION_VARIABLE frame_present_cv;
+    bool dirty_regions = false;  ///< Frames come with the regions that changed since the previous one
 
     void on_frame_arrived(winrt::Windows::Graphics::Capture::Direct3D11CaptureFramePool const &sender, winrt::Windows::Foundation::IInspectable const &);
 
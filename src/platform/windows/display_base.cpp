@@ -4,9 +4,11 @@
  */
 // standard includes
 #include <cmath>
+#include <sstream>
 #include <thread>
 
 // platform includes
+#include <avrt.h>
 #include <initguid.h>
 
 // lib includes
@@ -34,6 +36,7 @@ typedef enum _D3DKMT_GPU_PREFERENCE_QUERY_STATE: DWORD {
 #include "src/display_device.h"
 #include "src/logging.h"
 #include "src/platform/common.h"
+#include "src/platform/synthetic_display.h"
 #include "src/video.h"
 
 namespace platf {
@@ -238,7 +241,23 @@ namespace platf::dxgi {
       SetThreadExecutionState(ES_CONTINUOUS);
     });
 
+    // Let MMCSS schedule the capture thread ahead of regular work, so waking up for
+    // the next frame isn't delayed behind the game it's capturing.
+    DWORD task_index = 0;
+    auto mmcss_task_handle = AvSetMmThreadCharacteristicsW(L"Capture", &task_index);
+    if (mmcss_task_handle) {
+      AvSetMmThreadPriority(mmcss_task_handle, AVRT_PRIORITY_HIGH);
+    } else {
+      BOOST_LOG(warning) << "Couldn't associate capture thread with Capture MMCSS task [0x"sv << util::hex(GetLastError()).to_string_view() << ']';
+    }
+    auto revert_mmcss = util::fail_guard([mmcss_task_handle]() {
+      if (mmcss_task_handle) {
+        AvRevertMmThreadCharacteristics(mmcss_task_handle);
+      }
+    });
+
     sleep_overshoot_logger.reset();
+    handoff_latency_logger.reset();
 
     while (true) {
       // This will return false if the HDR state changes or for any number of other
@@ -253,6 +272,8 @@ namespace platf::dxgi {
 
       // Try to continue frame pacing group, snapshot() is called with zero timeout after waiting for client frame interval
       if (frame_pacing_group_start) {
+        *frame_pacing_group_start += take_phase_shift();
+
         const uint32_t seconds = (uint64_t) frame_pacing_group_frames * client_frame_rate_adjusted.Denominator / client_frame_rate_adjusted.Numerator;
         const uint32_t remainder = (uint64_t) frame_pacing_group_frames * client_frame_rate_adjusted.Denominator % client_frame_rate_adjusted.Numerator;
         const auto sleep_target = *frame_pacing_group_start +
@@ -327,8 +348,16 @@ namespace platf::dxgi {
           }
           break;
         case platf::capture_e::ok:
-          if (!push_captured_image_cb(std::move(img_out), true)) {
-            return capture_e::ok;
+          {
+            // Measured from the DWM present time the frame pacing is anchored to
+            auto frame_timestamp = img_out ? img_out->frame_timestamp : std::nullopt;
+            if (!push_captured_image_cb(std::move(img_out), true)) {
+              return capture_e::ok;
+            }
+            if (frame_timestamp) {
+              handoff_latency_logger.first_point(*frame_timestamp);
+              handoff_latency_logger.second_point_now_and_log();
+            }
           }
           break;
         default:
@@ -1002,6 +1031,10 @@ namespace platf {
    * @param hwdevice_type enables possible use of hardware encoder
    */
   std::shared_ptr<display_t> display(mem_type_e hwdevice_type, const std::string &display_name, const video::config_t &config) {
+    if (config::video.capture == synthetic::NAME) {
+      return synthetic::display(hwdevice_type, config);
+    }
+
     if (config::video.capture == "ddx" || config::video.capture.empty()) {
       if (hwdevice_type == mem_type_e::dxgi) {
         auto disp = std::make_shared<dxgi::display_ddup_vram_t>();
@@ -1038,7 +1071,20 @@ namespace platf {
     return nullptr;
   }
 
+  bool has_encoded_display(const std::string &, const video::config_t &) {
+    // No capture backend here encodes the frames itself
+    return false;
+  }
+
+  std::unique_ptr<encoded_display_t> encoded_display(const std::string &, const video::config_t &) {
+    return nullptr;
+  }
+
   std::vector<std::string> display_names(mem_type_e) {
+    if (config::video.capture == synthetic::NAME) {
+      return synthetic::display_names();
+    }
+
     std::vector<std::string> display_names;
 
     HRESULT status;
@@ -1134,4 +1180,29 @@ namespace platf {
       return false;
     }
   }
+
+  std::string encoder_environment_id() {
+    dxgi::factory1_t factory;
+    if (FAILED(CreateDXGIFactory1(IID_IDXGIFactory1, (void **) &factory))) {
+      return {};
+    }
+
+    std::stringstream id;
+    dxgi::adapter_t::pointer adapter_p;
+    for (int x = 0; factory->EnumAdapters1(x, &adapter_p) != DXGI_ERROR_NOT_FOUND; ++x) {
+      dxgi::adapter_t adapter {adapter_p};
+      DXGI_ADAPTER_DESC1 adapter_desc;
+      adapter->GetDesc1(&adapter_desc);
+
+      // The user mode driver version changes with every driver update
+      LARGE_INTEGER umd_version {};
+      adapter->CheckInterfaceSupport(__uuidof(IDXGIDevice), &umd_version);
+
+      id << util::hex(adapter_desc.VendorId).to_string_view() << ':'
+         << util::hex(adapter_desc.DeviceId).to_string_view() << ':'
+         << umd_version.QuadPart << ' ';
+    }
+
+    return id.str();
+  }
 }  // namespace platf
@@ -6,6 +6,7 @@
 #include "display.h"
 #include "misc.h"
 #include "src/logging.h"
+#include "src/platform/cursor_blend.h"
 
 namespace platf {
   using namespace std::literals;
@@ -13,10 +14,7 @@ namespace platf {
 
 namespace platf::dxgi {
   struct img_t: public ::platf::img_t {
-    ~img_t() override {
-      delete[] data;
-      data = nullptr;
-    }
+    util::aligned_ptr_t<std::uint8_t> buffer;
   };
 
   void blend_cursor_monochrome(const cursor_t &cursor, img_t &img) {
@@ -81,21 +79,6 @@ namespace platf::dxgi {
     }
   }
 
-  void apply_color_alpha(int *img_pixel_p, int cursor_pixel) {
-    auto colors_out = (std::uint8_t *) &cursor_pixel;
-    auto colors_in = (std::uint8_t *) img_pixel_p;
-
-    // TODO: When use of IDXGIOutput5 is implemented, support different color formats
-    auto alpha = colors_out[3];
-    if (alpha == 255) {
-      *img_pixel_p = cursor_pixel;
-    } else {
-      colors_in[0] = colors_out[0] + (colors_in[0] * (255 - alpha) + 255 / 2) / 255;
-      colors_in[1] = colors_out[1] + (colors_in[1] * (255 - alpha) + 255 / 2) / 255;
-      colors_in[2] = colors_out[2] + (colors_in[2] * (255 - alpha) + 255 / 2) / 255;
-    }
-  }
-
   void apply_color_masked(int *img_pixel_p, int cursor_pixel) {
     // TODO: When use of IDXGIOutput5 is implemented, support different color formats
     auto alpha = ((std::uint8_t *) &cursor_pixel)[3];
@@ -136,17 +119,25 @@ namespace platf::dxgi {
 
     auto img_data = (int *) img.data;
 
+    if (!masked) {
+      platf::blend_cursor(
+        (std::uint32_t *) &img_data[img_skip_y * (img.row_pitch / img.pixel_pitch) + img_skip_x],
+        img.row_pitch / img.pixel_pitch,
+        (const std::uint32_t *) &cursor_img_data[cursor_skip_x],
+        cursor.shape_info.Width,
+        delta_width,
+        delta_height
+      );
+      return;
+    }
+
     for (int i = 0; i < delta_height; ++i) {
       auto cursor_begin = &cursor_img_data[i * cursor.shape_info.Width + cursor_skip_x];
       auto cursor_end = &cursor_begin[delta_width];
 
       auto img_pixel_p = &img_data[(i + img_skip_y) * (img.row_pitch / img.pixel_pitch) + img_skip_x];
       std::for_each(cursor_begin, cursor_end, [&](int cursor_pixel) {
-        if (masked) {
-          apply_color_masked(img_pixel_p, cursor_pixel);
-        } else {
-          apply_color_alpha(img_pixel_p, cursor_pixel);
-        }
+        apply_color_masked(img_pixel_p, cursor_pixel);
         ++img_pixel_p;
       });
     }
@@ -343,15 +334,18 @@ namespace platf::dxgi {
       img->row_pitch = img->pixel_pitch * img->width;
     }
 
+    auto ram_img = (img_t *) img;
+
     // Reallocate the image buffer if the pitch changes
     if (!dummy && img->row_pitch != img_info.RowPitch) {
       img->row_pitch = img_info.RowPitch;
-      delete img->data;
+      ram_img->buffer.reset();
       img->data = nullptr;
     }
 
     if (!img->data) {
-      img->data = new std::uint8_t[img->row_pitch * height];
+      ram_img->buffer = util::make_aligned<std::uint8_t>(img->row_pitch * height);
+      img->data = ram_img->buffer.get();
     }
 
     return 0;
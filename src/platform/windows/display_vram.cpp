@@ -4,6 +4,9 @@
  */
 // standard includes
 #include <cmath>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
 
 // platform includes
 #include <d3dcompiler.h>
@@ -22,6 +25,8 @@ extern "C" {
 #include "display.h"
 #include "misc.h"
 #include "src/config.h"
+#include "src/crypto.h"
+#include "src/file_handler.h"
 #include "src/logging.h"
 #include "src/nvenc/nvenc_config.h"
 #include "src/nvenc/nvenc_d3d11_native.h"
@@ -193,16 +198,39 @@ namespace platf::dxgi {
       }
     }
 
-    bool lock() {
+    /**
+     * @brief Lock the texture, counting the times the capture thread had to wait for an encoder.
+     * @param stats The counters, periodically logged and cleared.
+     */
+    bool lock(texture_lock_stats_t &stats) {
       if (_locked) {
         return true;
       }
-      HRESULT status = _mutex->AcquireSync(0, INFINITE);
+
+      // The key only waits for another device holding it, not for that device's GPU work
+      ++stats.locks;
+      HRESULT status = _mutex->AcquireSync(0, 0);
+      if (status == static_cast<HRESULT>(WAIT_TIMEOUT)) {
+        ++stats.stalls;
+        auto stall_start = std::chrono::steady_clock::now();
+        status = _mutex->AcquireSync(0, INFINITE);
+        stats.stall_time += std::chrono::steady_clock::now() - stall_start;
+      }
+
       if (status == S_OK) {
         _locked = true;
       } else {
         BOOST_LOG(error) << "Failed to acquire texture mutex [0x"sv << util::hex(status).to_string_view() << ']';
       }
+
+      auto now = std::chrono::steady_clock::now();
+      if (now - stats.logged > 20s) {
+        BOOST_LOG(debug) << "Capture texture locks: "sv << stats.stalls << " of "sv << stats.locks << " waited on an encoder for "sv
+                         << std::chrono::duration<double, std::milli>(stats.stall_time).count() << "ms in total"sv;
+        stats = {};
+        stats.logged = now;
+      }
+
       return _locked;
     }
   };
@@ -349,8 +377,56 @@ namespace platf::dxgi {
     return cursor_img;
   }
 
+  /**
+   * @brief Read shader bytecode compiled by an earlier run.
+   * @param path The cache file.
+   * @return The bytecode, or nullptr if it isn't cached.
+   */
+  blob_t read_cached_shader(const std::filesystem::path &path) {
+    std::ifstream in(path, std::ios::binary | std::ios::ate);
+    if (!in) {
+      return nullptr;
+    }
+
+    auto size = (std::size_t) in.tellg();
+    blob_t::pointer blob_p;
+    if (size == 0 || FAILED(D3DCreateBlob(size, &blob_p))) {
+      return nullptr;
+    }
+
+    blob_t blob {blob_p};
+    in.seekg(0);
+    if (!in.read((char *) blob->GetBufferPointer(), size)) {
+      return nullptr;
+    }
+
+    return blob;
+  }
+
+  void write_cached_shader(const std::filesystem::path &path, const blob_t &blob) {
+    std::error_code ec;
+    std::filesystem::create_directories(path.parent_path(), ec);
+
+    // Written under another name first, so a concurrent reader never sees half of it
+    auto tmp = path;
+    tmp += ".tmp";
+    {
+      std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+      if (!out || !out.write((const char *) blob->GetBufferPointer(), blob->GetBufferSize())) {
+        BOOST_LOG(debug) << "Couldn't write shader cache ["sv << tmp.string() << ']';
+        return;
+      }
+    }
+
+    std::filesystem::rename(tmp, path, ec);
+    if (ec) {
+      std::filesystem::remove(tmp, ec);
+    }
+  }
+
   blob_t compile_shader(LPCSTR file, LPCSTR entrypoint, LPCSTR shader_model) {
     blob_t::pointer msg_p = nullptr;
+    blob_t::pointer preprocessed_p;
     blob_t::pointer compiled_p;
 
     DWORD flags = D3DCOMPILE_ENABLE_STRICTNESS;
@@ -359,8 +435,37 @@ namespace platf::dxgi {
     flags |= D3DCOMPILE_DEBUG | D3DCOMPILE_SKIP_OPTIMIZATION;
 #endif
 
-    auto wFile = from_utf8(file);
-    auto status = D3DCompileFromFile(wFile.c_str(), nullptr, D3D_COMPILE_STANDARD_FILE_INCLUDE, entrypoint, shader_model, flags, 0, &compiled_p, &msg_p);
+    auto source = file_handler::read_file(file);
+    if (source.empty()) {
+      BOOST_LOG(error) << "Couldn't read ["sv << file << ']';
+      return nullptr;
+    }
+
+    // Preprocessing pulls in the included files, so the cache key covers them as well
+    auto status = D3DPreprocess(source.data(), source.size(), file, nullptr, D3D_COMPILE_STANDARD_FILE_INCLUDE, &preprocessed_p, &msg_p);
+    if (msg_p) {
+      BOOST_LOG(warning) << std::string_view {(const char *) msg_p->GetBufferPointer(), msg_p->GetBufferSize() - 1};
+      msg_p->Release();
+      msg_p = nullptr;
+    }
+
+    if (status) {
+      BOOST_LOG(error) << "Couldn't preprocess ["sv << file << "] [0x"sv << util::hex(status).to_string_view() << ']';
+      return nullptr;
+    }
+
+    blob_t preprocessed {preprocessed_p};
+    std::string_view preprocessed_view {(const char *) preprocessed->GetBufferPointer(), preprocessed->GetBufferSize()};
+
+    std::stringstream key;
+    key << preprocessed_view << '\0' << entrypoint << '\0' << shader_model << '\0' << flags << '\0' << D3DCOMPILER_DLL_A << D3D_COMPILER_VERSION;
+    auto cache_path = platf::appdata() / "shader_cache" / (util::hex_vec(crypto::hash(key.str())) + ".cso");
+
+    if (auto cached = read_cached_shader(cache_path)) {
+      return cached;
+    }
+
+    status = D3DCompile(preprocessed_view.data(), preprocessed_view.size(), file, nullptr, nullptr, entrypoint, shader_model, flags, 0, &compiled_p, &msg_p);
 
     if (msg_p) {
       BOOST_LOG(warning) << std::string_view {(const char *) msg_p->GetBufferPointer(), msg_p->GetBufferSize() - 1};
@@ -372,7 +477,10 @@ namespace platf::dxgi {
       return nullptr;
     }
 
-    return blob_t {compiled_p};
+    blob_t compiled {compiled_p};
+    write_cached_shader(cache_path, compiled);
+
+    return compiled;
   }
 
   blob_t compile_pixel_shader(LPCSTR file) {
@@ -1078,8 +1186,13 @@ namespace platf::dxgi {
         return false;
       }
 
+      auto nvenc_config = config::video.nv;
+      if (!split_encode) {
+        nvenc_config.split_encode = nvenc::nvenc_split_encode::disabled;
+      }
+
       auto nvenc_colorspace = nvenc::nvenc_colorspace_from_sunshine_colorspace(colorspace);
-      if (!nvenc_d3d->create_encoder(config::video.nv, client_config, nvenc_colorspace, buffer_format)) {
+      if (!nvenc_d3d->create_encoder(nvenc_config, client_config, nvenc_colorspace, buffer_format)) {
         return false;
       }
 
@@ -1337,7 +1450,7 @@ namespace platf::dxgi {
       // This image is shared between capture direct3d device and encoders direct3d devices,
       // we must acquire lock before doing anything to it.
       texture_lock_helper lock_helper(d3d_img->capture_mutex.get());
-      if (!lock_helper.lock()) {
+      if (!lock_helper.lock(texture_lock_stats)) {
         BOOST_LOG(error) << "Failed to lock capture texture";
         return {nullptr, nullptr};
       }
@@ -1676,7 +1789,7 @@ namespace platf::dxgi {
     d3d_img->blank = false;  // image is always ready for capture
     if (complete_img(d3d_img.get(), false) == 0) {
       texture_lock_helper lock_helper(d3d_img->capture_mutex.get());
-      if (lock_helper.lock()) {
+      if (lock_helper.lock(texture_lock_stats)) {
         device_ctx->CopyResource(d3d_img->capture_texture.get(), src.get());
       } else {
         BOOST_LOG(error) << "Failed to lock capture texture";
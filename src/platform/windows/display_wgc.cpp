@@ -137,6 +137,15 @@ namespace platf::dxgi {
     } catch (winrt::hresult_error &e) {
       BOOST_LOG(warning) << "Screen capture may not be fully supported on this device for this release of Windows: failed to disable border around capture area: [0x"sv << util::hex(e.code()).to_string_view() << ']';
     }
+    try {
+      // Lets us tell frames that only repeat the previous one apart, without comparing them
+      if (winrt::ApiInformation::IsPropertyPresent(L"Windows.Graphics.Capture.GraphicsCaptureSession", L"DirtyRegionMode")) {
+        capture_session.DirtyRegionMode(winrt::GraphicsCaptureDirtyRegionMode::ReportAndRender);
+        dirty_regions = true;
+      }
+    } catch (winrt::hresult_error &e) {
+      BOOST_LOG(debug) << "Dirty regions aren't available for screen capture: [0x"sv << util::hex(e.code()).to_string_view() << ']';
+    }
     try {
       capture_session.StartCapture();
     } catch (winrt::hresult_error &e) {
@@ -200,6 +209,12 @@ namespace platf::dxgi {
       return capture_e::timeout;
     }
 
+    // Nothing changed, so the encoder can keep using the image of the previous frame
+    if (dirty_regions && consumed_frame.DirtyRegions().Size() == 0) {
+      release_frame();
+      return capture_e::timeout;
+    }
+
     auto capture_access = consumed_frame.Surface().as<winrt::IDirect3DDxgiInterfaceAccess>();
     if (capture_access == nullptr) {
       return capture_e::error;
@@ -8,6 +8,7 @@
 #include <Windows.h>
 
 // standard includes
+#include <atomic>
 #include <cmath>
 #include <thread>
 
@@ -55,6 +56,10 @@ namespace platf {
     void *userdata
   );
 
+  class vigem_t;
+  void send_report(vigem_t *vigem, int nr);
+  void send_reports(vigem_t *vigem);
+
   struct gp_touch_context_t {
     uint8_t pointerIndex;
     uint16_t x;
@@ -79,6 +84,12 @@ namespace platf {
     thread_pool_util::ThreadPool::task_id_t repeat_task {};
     std::chrono::steady_clock::time_point last_report_ts;
 
+    // The report changed since it was last sent, and goes out on the next flush_input()
+    bool report_dirty;
+    // The report is held back until gamepad_report_interval has passed since last_submit
+    bool report_deferred;
+    std::chrono::steady_clock::time_point last_submit;
+
     gamepad_feedback_msg_t last_rumble;
     gamepad_feedback_msg_t last_rgb_led;
   };
@@ -220,6 +231,9 @@ namespace platf {
 
       gamepad.client_relative_index = id.clientRelativeIndex;
       gamepad.last_report_ts = std::chrono::steady_clock::now();
+      gamepad.report_dirty = false;
+      gamepad.report_deferred = false;
+      gamepad.last_submit = {};
 
       // Establish a connect to the ViGEm driver if we don't have one yet
       if (!client) {
@@ -284,6 +298,11 @@ namespace platf {
     void free_target(int nr) {
       auto &gamepad = gamepads[nr];
 
+      // The last state is usually the neutral one, which releases whatever the client still held
+      if (gamepad.report_dirty) {
+        send_report(this, nr);
+      }
+
       if (gamepad.repeat_task) {
         task_pool.cancel(gamepad.repeat_task);
         gamepad.repeat_task = nullptr;
@@ -392,6 +411,9 @@ namespace platf {
     std::vector<gamepad_context_t> gamepads;
 
     client_t client;
+
+    // Reports dropped because they were unchanged or a newer state replaced them before they were sent
+    std::atomic<std::uint64_t> reports_coalesced {0};
   };
 
   void CALLBACK x360_notify(
@@ -406,7 +428,7 @@ namespace platf {
       << "largeMotor: "sv << (int) largeMotor << std::endl
       << "smallMotor: "sv << (int) smallMotor;
 
-    task_pool.push(&vigem_t::rumble, (vigem_t *) userdata, target, largeMotor, smallMotor);
+    task_pool.push(thread_pool_util::priority_e::input, &vigem_t::rumble, (vigem_t *) userdata, target, largeMotor, smallMotor);
   }
 
   void CALLBACK ds4_notify(
@@ -424,8 +446,8 @@ namespace platf {
       << util::hex(led_color.Green).to_string_view() << ' '
       << util::hex(led_color.Blue).to_string_view() << std::endl;
 
-    task_pool.push(&vigem_t::rumble, (vigem_t *) userdata, target, largeMotor, smallMotor);
-    task_pool.push(&vigem_t::set_rgb_led, (vigem_t *) userdata, target, led_color.Red, led_color.Green, led_color.Blue);
+    task_pool.push(thread_pool_util::priority_e::input, &vigem_t::rumble, (vigem_t *) userdata, target, largeMotor, smallMotor);
+    task_pool.push(thread_pool_util::priority_e::input, &vigem_t::set_rgb_led, (vigem_t *) userdata, target, led_color.Red, led_color.Green, led_color.Blue);
   }
 
   struct input_raw_t {
@@ -438,6 +460,9 @@ namespace platf {
     decltype(CreateSyntheticPointerDevice) *fnCreateSyntheticPointerDevice;
     decltype(InjectSyntheticPointerInput) *fnInjectSyntheticPointerInput;
     decltype(DestroySyntheticPointerDevice) *fnDestroySyntheticPointerDevice;
+
+    // Mouse and keyboard events held back until flush_input(), to go out in a single SendInput() call
+    std::vector<INPUT> pending_inputs;
   };
 
   input_t input() {
@@ -460,19 +485,34 @@ namespace platf {
 
   /**
    * @brief Calls SendInput() and switches input desktops if required.
-   * @param i The `INPUT` struct to send.
+   * @param inputs The `INPUT` structs to send, they're cleared once sent.
    */
-  void send_input(INPUT &i) {
-  retry:
-    auto send = SendInput(1, &i, sizeof(INPUT));
-    if (send != 1) {
-      auto hDesk = syncThreadDesktop();
-      if (_lastKnownInputDesktop != hDesk) {
-        _lastKnownInputDesktop = hDesk;
-        goto retry;
+  void send_input(std::vector<INPUT> &inputs) {
+    UINT sent = 0;
+    while (sent < inputs.size()) {
+      sent += SendInput((UINT) (inputs.size() - sent), &inputs[sent], sizeof(INPUT));
+      if (sent < inputs.size()) {
+        // The rest of the events go to the new input desktop
+        auto hDesk = syncThreadDesktop();
+        if (_lastKnownInputDesktop != hDesk) {
+          _lastKnownInputDesktop = hDesk;
+          continue;
+        }
+        BOOST_LOG(error) << "Couldn't send input"sv;
+        break;
       }
-      BOOST_LOG(error) << "Couldn't send input"sv;
     }
+
+    inputs.clear();
+  }
+
+  /**
+   * @brief Queue an `INPUT` struct until flush_input().
+   * @param input The global input context.
+   * @param i The `INPUT` struct to send.
+   */
+  void queue_input(input_t &input, const INPUT &i) {
+    ((input_raw_t *) input.get())->pending_inputs.push_back(i);
   }
 
   /**
@@ -516,7 +556,7 @@ namespace platf {
     mi.dx = scaled_x;
     mi.dy = scaled_y;
 
-    send_input(i);
+    queue_input(input, i);
   }
 
   void move_mouse(input_t &input, int deltaX, int deltaY) {
@@ -529,7 +569,7 @@ namespace platf {
     mi.dx = deltaX;
     mi.dy = deltaY;
 
-    send_input(i);
+    queue_input(input, i);
   }
 
   util::point_t get_mouse_loc(input_t &input) {
@@ -566,7 +606,7 @@ namespace platf {
       mi.mouseData = XBUTTON2;
     }
 
-    send_input(i);
+    queue_input(input, i);
   }
 
   void scroll(input_t &input, int distance) {
@@ -578,7 +618,7 @@ namespace platf {
     mi.dwFlags = MOUSEEVENTF_WHEEL;
     mi.mouseData = distance;
 
-    send_input(i);
+    queue_input(input, i);
   }
 
   void hscroll(input_t &input, int distance) {
@@ -590,7 +630,23 @@ namespace platf {
     mi.dwFlags = MOUSEEVENTF_HWHEEL;
     mi.mouseData = distance;
 
-    send_input(i);
+    queue_input(input, i);
+  }
+
+  void flush_input(input_t &input) {
+    auto raw = (input_raw_t *) input.get();
+    if (!raw->pending_inputs.empty()) {
+      send_input(raw->pending_inputs);
+    }
+
+    if (raw->vigem) {
+      send_reports(raw->vigem);
+    }
+  }
+
+  std::uint64_t gamepad_reports_coalesced(input_t &input) {
+    auto vigem = ((input_raw_t *) input.get())->vigem;
+    return vigem ? vigem->reports_coalesced.load(std::memory_order_relaxed) : 0;
   }
 
   void keyboard_update(input_t &input, uint16_t modcode, bool release, uint8_t flags) {
@@ -645,7 +701,7 @@ namespace platf {
       ki.dwFlags |= KEYEVENTF_KEYUP;
     }
 
-    send_input(i);
+    queue_input(input, i);
   }
 
   struct client_input_raw_t: public client_input_t {
@@ -896,6 +952,11 @@ namespace platf {
   void touch_update(client_input_t *input, const touch_port_t &touch_port, const touch_input_t &touch) {
     auto raw = (client_input_raw_t *) input;
 
+    // Mouse and keyboard events that came before must reach the OS first
+    if (!raw->global->pending_inputs.empty()) {
+      send_input(raw->global->pending_inputs);
+    }
+
     // Bail if we're not running on an OS that supports virtual touch input
     if (!raw->global->fnCreateSyntheticPointerDevice ||
         !raw->global->fnInjectSyntheticPointerInput ||
@@ -1022,6 +1083,11 @@ namespace platf {
   void pen_update(client_input_t *input, const touch_port_t &touch_port, const pen_input_t &pen) {
     auto raw = (client_input_raw_t *) input;
 
+    // Mouse and keyboard events that came before must reach the OS first
+    if (!raw->global->pending_inputs.empty()) {
+      send_input(raw->global->pending_inputs);
+    }
+
     // Bail if we're not running on an OS that supports virtual pen input
     if (!raw->global->fnCreateSyntheticPointerDevice ||
         !raw->global->fnInjectSyntheticPointerInput ||
@@ -1132,6 +1198,10 @@ namespace platf {
     }
   }
 
+  void flush_client_input(client_input_t *input) {
+    // Touch and pen input is injected as it arrives
+  }
+
   void unicode(input_t &input, char *utf8, int size) {
     // We can do no worse than one UTF-16 character per byte of UTF-8
     WCHAR wide[size];
@@ -1143,20 +1213,20 @@ namespace platf {
 
     // Send all key down events
     for (int i = 0; i < chars; i++) {
-      INPUT input {};
-      input.type = INPUT_KEYBOARD;
-      input.ki.wScan = wide[i];
-      input.ki.dwFlags = KEYEVENTF_UNICODE;
-      send_input(input);
+      INPUT key {};
+      key.type = INPUT_KEYBOARD;
+      key.ki.wScan = wide[i];
+      key.ki.dwFlags = KEYEVENTF_UNICODE;
+      queue_input(input, key);
     }
 
     // Send all key up events
     for (int i = 0; i < chars; i++) {
-      INPUT input {};
-      input.type = INPUT_KEYBOARD;
-      input.ki.wScan = wide[i];
-      input.ki.dwFlags = KEYEVENTF_UNICODE | KEYEVENTF_KEYUP;
-      send_input(input);
+      INPUT key {};
+      key.type = INPUT_KEYBOARD;
+      key.ki.wScan = wide[i];
+      key.ki.dwFlags = KEYEVENTF_UNICODE | KEYEVENTF_KEYUP;
+      queue_input(input, key);
     }
   }
 
@@ -1452,6 +1522,10 @@ namespace platf {
       auto now = std::chrono::steady_clock::now();
       auto delta_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(now - gamepad.last_report_ts);
 
+      gamepad.report_dirty = false;
+      gamepad.report_deferred = false;
+      gamepad.last_submit = now;
+
       // Timestamp is reported in 5.333us units
       gamepad.report.ds4.Report.wTimestamp += (uint16_t) (delta_ns.count() / 5333);
 
@@ -1468,6 +1542,86 @@ namespace platf {
     }
   }
 
+  /**
+   * @brief Sends the current report of a gamepad to the virtual device.
+   * @param vigem The global ViGEm context object.
+   * @param nr The global gamepad index.
+   */
+  void send_report(vigem_t *vigem, int nr) {
+    auto &gamepad = vigem->gamepads[nr];
+    if (!gamepad.gp) {
+      return;
+    }
+
+    if (vigem_target_get_type(gamepad.gp.get()) != Xbox360Wired) {
+      ds4_update_ts_and_send(vigem, nr);
+      return;
+    }
+
+    if (gamepad.repeat_task) {
+      task_pool.cancel(gamepad.repeat_task);
+      gamepad.repeat_task = nullptr;
+    }
+
+    gamepad.report_dirty = false;
+    gamepad.report_deferred = false;
+    gamepad.last_submit = std::chrono::steady_clock::now();
+
+    auto status = vigem_target_x360_update(vigem->client.get(), gamepad.gp.get(), gamepad.report.x360);
+    if (!VIGEM_SUCCESS(status)) {
+      BOOST_LOG(warning) << "Couldn't send gamepad input to ViGEm ["sv << util::hex(status).to_string_view() << ']';
+    }
+  }
+
+  /**
+   * @brief Marks the report of a gamepad to be sent by the next flush_input().
+   * @details Updates that arrive before the report goes out are merged into it.
+   * @param vigem The global ViGEm context object.
+   * @param gamepad The gamepad, its report already updated.
+   * @param previous The report before the update.
+   */
+  void queue_report(vigem_t *vigem, gamepad_context_t &gamepad, const decltype(gamepad_context_t::report) &previous) {
+    // An unchanged report only matters to keep the DS4 timestamp moving, which the repeat task does
+    if (!gamepad.report_dirty && !memcmp(&previous, &gamepad.report, sizeof(previous))) {
+      vigem->reports_coalesced.fetch_add(1, std::memory_order_relaxed);
+      return;
+    }
+
+    // This replaces a report that wasn't sent yet
+    if (gamepad.report_dirty) {
+      vigem->reports_coalesced.fetch_add(1, std::memory_order_relaxed);
+    }
+    gamepad.report_dirty = true;
+  }
+
+  /**
+   * @brief Sends the reports that changed since they were last sent, at most once per gamepad_report_interval.
+   * @param vigem The global ViGEm context object.
+   */
+  void send_reports(vigem_t *vigem) {
+    auto now = std::chrono::steady_clock::now();
+
+    for (int nr = 0; nr < vigem->gamepads.size(); ++nr) {
+      auto &gamepad = vigem->gamepads[nr];
+      if (!gamepad.gp || !gamepad.report_dirty || gamepad.report_deferred) {
+        continue;
+      }
+
+      auto due = gamepad.last_submit + config::input.gamepad_report_interval;
+      if (now >= due) {
+        send_report(vigem, nr);
+        continue;
+      }
+
+      // Send whatever the state is by then, the DS4 timestamp repeat is rescheduled from there
+      if (gamepad.repeat_task) {
+        task_pool.cancel(gamepad.repeat_task);
+      }
+      gamepad.report_deferred = true;
+      gamepad.repeat_task = task_pool.pushDelayed(send_report, due - now, vigem, nr).task_id;
+    }
+  }
+
   /**
    * @brief Updates virtual gamepad with the provided gamepad state.
    * @param input The input context.
@@ -1487,18 +1641,13 @@ namespace platf {
       return;
     }
 
-    VIGEM_ERROR status;
-
+    auto previous = gamepad.report;
     if (vigem_target_get_type(gamepad.gp.get()) == Xbox360Wired) {
       x360_update_state(gamepad, gamepad_state);
-      status = vigem_target_x360_update(vigem->client.get(), gamepad.gp.get(), gamepad.report.x360);
-      if (!VIGEM_SUCCESS(status)) {
-        BOOST_LOG(warning) << "Couldn't send gamepad input to ViGEm ["sv << util::hex(status).to_string_view() << ']';
-      }
     } else {
       ds4_update_state(gamepad, gamepad_state);
-      ds4_update_ts_and_send(vigem, nr);
     }
+    queue_report(vigem, gamepad, previous);
   }
 
   /**
@@ -1524,6 +1673,7 @@ namespace platf {
       return;
     }
 
+    auto previous = gamepad.report;
     auto &report = gamepad.report.ds4.Report;
 
     uint8_t pointerIndex;
@@ -1604,7 +1754,7 @@ namespace platf {
       }
     }
 
-    ds4_update_ts_and_send(vigem, touch.id.globalIndex);
+    queue_report(vigem, gamepad, previous);
   }
 
   /**
@@ -1630,8 +1780,9 @@ namespace platf {
       return;
     }
 
+    auto previous = gamepad.report;
     ds4_update_motion(gamepad, motion.motionType, motion.x, motion.y, motion.z);
-    ds4_update_ts_and_send(vigem, motion.id.globalIndex);
+    queue_report(vigem, gamepad, previous);
   }
 
   /**
@@ -1660,6 +1811,7 @@ namespace platf {
     // For details on the report format of these battery level fields, see:
     // https://github.com/torvalds/linux/blob/946c6b59c56dc6e7d8364a8959cb36bf6d10bc37/drivers/hid/hid-playstation.c#L2305-L2314
 
+    auto previous = gamepad.report;
     auto &report = gamepad.report.ds4.Report;
 
     // Update the battery state if it is known
@@ -1704,7 +1856,7 @@ namespace platf {
       }
     }
 
-    ds4_update_ts_and_send(vigem, battery.id.globalIndex);
+    queue_report(vigem, gamepad, previous);
   }
 
   void freeInput(void *p) {
@@ -21,6 +21,7 @@
 #include <dwmapi.h>
 #include <iphlpapi.h>
 #include <iterator>
+#include <psapi.h>
 #include <timeapi.h>
 #include <UserEnv.h>
 #include <WinSock2.h>
@@ -1037,6 +1038,9 @@ namespace platf {
       case thread_priority_e::critical:
         win32_priority = THREAD_PRIORITY_HIGHEST;
         break;
+      case thread_priority_e::realtime:
+        win32_priority = THREAD_PRIORITY_TIME_CRITICAL;
+        break;
       default:
         BOOST_LOG(error) << "Unknown thread priority: "sv << (int) priority;
         return;
@@ -1048,6 +1052,59 @@ namespace platf {
     }
   }
 
+  void pin_thread(int cpu) {
+    if (!SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR) 1 << cpu)) {
+      auto winerr = GetLastError();
+      BOOST_LOG(warning) << "Unable to pin thread to CPU "sv << cpu << ": "sv << winerr;
+    }
+  }
+
+  thermal_state_t thermal_state() {
+    // Unimplemented, Windows doesn't report the temperature without WMI
+    return {};
+  }
+
+  void set_thread_name(const std::string &name) {
+    SetThreadDescription(GetCurrentThread(), from_utf8(name).c_str());
+  }
+
+  std::vector<thread_cpu_time_t> thread_cpu_times() {
+    // Unimplemented
+    return {};
+  }
+
+  std::optional<std::uint64_t> resident_memory() {
+    PROCESS_MEMORY_COUNTERS counters;
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+      return std::nullopt;
+    }
+
+    return counters.WorkingSetSize;
+  }
+
+  std::optional<std::uint64_t> available_memory() {
+    MEMORYSTATUSEX status {sizeof(status)};
+    if (!GlobalMemoryStatusEx(&status)) {
+      return std::nullopt;
+    }
+
+    return status.ullAvailPhys;
+  }
+
+  bool lock_memory(const void *addr, std::size_t size) {
+    // Limited by the minimum working set of the process
+    if (!VirtualLock((LPVOID) addr, size)) {
+      BOOST_LOG(debug) << "Couldn't lock "sv << size << " bytes in RAM: "sv << GetLastError();
+      return false;
+    }
+
+    return true;
+  }
+
+  void unlock_memory(const void *addr, std::size_t size) {
+    VirtualUnlock((LPVOID) addr, size);
+  }
+
   void streaming_will_start() {
     static std::once_flag load_wlanapi_once_flag;
     std::call_once(load_wlanapi_once_flag, []() {
@@ -1451,6 +1508,21 @@ namespace platf {
     return WSASendMsg((SOCKET) send_info.native_socket, &msg, 0, &bytes_sent, nullptr, nullptr) != SOCKET_ERROR;
   }
 
+  bool recv_batch(recv_batch_info_t &recv_info) {
+    // Fall back to receiving one datagram at a time
+    return false;
+  }
+
+  size_t send_batch_max_blocks(size_t block_size) {
+    // Send less than 64K in a single batch.
+    // On Windows, batches above 64K seem to bypass SO_SNDBUF regardless of its size,
+    // appear in "Other I/O" and begin waiting for interrupts.
+    // This gives inconsistent performance so we'd rather avoid it.
+    // Also don't exceed 64 packets, which can happen when Moonlight requests
+    // unusually small packet size.
+    return std::clamp<size_t>(64 * 1024 / block_size, 1, 64);
+  }
+
   bool send(send_info_t &send_info) {
     WSAMSG msg;
 
@@ -1665,6 +1737,31 @@ namespace platf {
     return std::make_unique<qos_t>(flow_id);
   }
 
+  bool enable_socket_txtime(uintptr_t native_socket) {
+    // No per-packet transmit times on this platform
+    return false;
+  }
+
+  bool enable_socket_zerocopy(uintptr_t native_socket) {
+    // Sends always copy on this platform
+    return false;
+  }
+
+  bool wait_zerocopy(uintptr_t native_socket, zerocopy_state_t &state, std::chrono::milliseconds timeout) {
+    state.pending = 0;
+    return true;
+  }
+
+  int socket_send_queue_bytes(uintptr_t native_socket) {
+    // Winsock doesn't expose the send queue of UDP sockets
+    return -1;
+  }
+
+  int probe_path_mtu(const boost::asio::ip::address &address, int max_size) {
+    // Winsock doesn't report what it learns from ICMP on UDP sockets
+    return -1;
+  }
+
   int64_t qpc_counter() {
     LARGE_INTEGER performance_counter;
     if (QueryPerformanceCounter(&performance_counter)) {
@@ -1795,7 +1892,7 @@ namespace platf {
     HANDLE timer = nullptr;
   };
 
-  std::unique_ptr<high_precision_timer> create_high_precision_timer() {
+  std::unique_ptr<high_precision_timer> create_high_precision_timer(std::chrono::nanoseconds spin) {
     return std::make_unique<win32_high_precision_timer>();
   }
 }  // namespace platf
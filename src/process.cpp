@@ -5,9 +5,14 @@
 #define BOOST_BIND_GLOBAL_PLACEHOLDERS
 
 // standard includes
+#include <algorithm>
+#include <chrono>
 #include <filesystem>
+#include <mutex>
+#include <sstream>
 #include <string>
 #include <thread>
+#include <unordered_map>
 #include <vector>
 
 // lib includes
@@ -45,10 +50,27 @@ namespace proc {
   namespace pt = boost::property_tree;
 
   proc_t proc;
+  std::atomic<std::uint64_t> apps_generation;
+
+  namespace {
+    /**
+     * @brief The launch started by `proc::execute_async(...)`.
+     */
+    struct {
+      std::mutex mutex {};
+      std::shared_future<void> launched {};
+      std::atomic<int> app_id {0};
+      std::atomic<bool> pending {false};
+      std::atomic<int> result {0};
+      std::atomic<std::size_t> prep_cmds_done {0};
+      std::atomic<std::size_t> prep_cmds_total {0};
+    } LAUNCH;
+  }  // namespace
 
   class deinit_t: public platf::deinit_t {
   public:
     ~deinit_t() {
+      wait_for_launch();
       proc.terminate();
     }
   };
@@ -193,36 +215,76 @@ namespace proc {
       terminate();
     });
 
-    for (; _app_prep_it != std::end(_app.prep_cmds); ++_app_prep_it) {
-      auto &cmd = *_app_prep_it;
+    while (_app_prep_it != std::end(_app.prep_cmds)) {
+      // Consecutive commands marked parallel run at the same time, the others wait for everything before them
+      auto group_end = std::next(_app_prep_it);
+      if (_app_prep_it->parallel) {
+        group_end = std::find_if(_app_prep_it, std::end(_app.prep_cmds), [](const cmd_t &cmd) {
+          return !cmd.parallel;
+        });
+      }
 
-      // Skip empty commands
-      if (cmd.do_cmd.empty()) {
-        continue;
+      struct running_t {
+        const cmd_t *cmd;
+        boost::process::v1::child child;
+        std::error_code ec;
+        std::chrono::steady_clock::time_point start;
+      };
+
+      std::vector<running_t> running;
+      auto started_end = _app_prep_it;
+      auto failed = false;
+      for (; started_end != group_end; ++started_end) {
+        auto &cmd = *started_end;
+
+        // Skip empty commands
+        if (cmd.do_cmd.empty()) {
+          continue;
+        }
+
+        boost::filesystem::path working_dir = _app.working_dir.empty() ?
+                                                find_working_directory(cmd.do_cmd, _env) :
+                                                boost::filesystem::path(_app.working_dir);
+        BOOST_LOG(info) << "Executing Do Cmd: ["sv << cmd.do_cmd << ']' << (cmd.parallel ? " in parallel"sv : ""sv);
+        auto start = std::chrono::steady_clock::now();
+        auto child = platf::run_command(cmd.elevated, true, cmd.do_cmd, working_dir, _env, _pipe.get(), ec, nullptr);
+
+        if (ec) {
+          BOOST_LOG(error) << "Couldn't run ["sv << cmd.do_cmd << "]: System: "sv << ec.message();
+          // We don't want any prep commands failing launch of the desktop.
+          // This is to prevent the issue where users reboot their PC and need to log in with Sunshine.
+          // permission_denied is typically returned when the user impersonation fails, which can happen when user is not signed in yet.
+          if (!(_app.cmd.empty() && ec == std::errc::permission_denied)) {
+            failed = true;
+            break;
+          }
+        }
+
+        running.push_back({&cmd, std::move(child), ec, start});
       }
 
-      boost::filesystem::path working_dir = _app.working_dir.empty() ?
-                                              find_working_directory(cmd.do_cmd, _env) :
-                                              boost::filesystem::path(_app.working_dir);
-      BOOST_LOG(info) << "Executing Do Cmd: ["sv << cmd.do_cmd << ']';
-      auto child = platf::run_command(cmd.elevated, true, cmd.do_cmd, working_dir, _env, _pipe.get(), ec, nullptr);
+      for (auto &[cmd, child, child_ec, start] : running) {
+        child.wait();
+        auto ret = child.exit_code();
+        BOOST_LOG(info) << "Do Cmd ["sv << cmd->do_cmd << "] finished in "sv
+                        << std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count() << " ms"sv;
 
-      if (ec) {
-        BOOST_LOG(error) << "Couldn't run ["sv << cmd.do_cmd << "]: System: "sv << ec.message();
-        // We don't want any prep commands failing launch of the desktop.
-        // This is to prevent the issue where users reboot their PC and need to log in with Sunshine.
-        // permission_denied is typically returned when the user impersonation fails, which can happen when user is not signed in yet.
-        if (!(_app.cmd.empty() && ec == std::errc::permission_denied)) {
-          return -1;
+        if (ret != 0 && child_ec != std::errc::permission_denied) {
+          BOOST_LOG(error) << '[' << cmd->do_cmd << "] failed with code ["sv << ret << ']';
+          failed = true;
         }
       }
 
-      child.wait();
-      auto ret = child.exit_code();
-      if (ret != 0 && ec != std::errc::permission_denied) {
-        BOOST_LOG(error) << '[' << cmd.do_cmd << "] failed with code ["sv << ret << ']';
+      if (failed) {
+        // The rest of a parallel group went ahead regardless, so the commands that started are undone too
+        if (std::next(_app_prep_it) != group_end) {
+          _app_prep_it = started_end;
+        }
         return -1;
       }
+
+      _app_prep_it = group_end;
+      LAUNCH.prep_cmds_done = std::distance(_app_prep_begin, _app_prep_it);
     }
 
     for (auto &cmd : _app.detached) {
@@ -261,6 +323,11 @@ namespace proc {
   }
 
   int proc_t::running() {
+    // The launch thread owns the process until the app started
+    if (LAUNCH.pending) {
+      return LAUNCH.app_id;
+    }
+
 #ifndef _WIN32
     // On POSIX OSes, we must periodically wait for our children to avoid
     // them becoming zombies. This must be synchronized carefully with
@@ -532,13 +599,41 @@ namespace proc {
     return result.checksum();
   }
 
+  /**
+   * @brief Get the SHA-256 of a file, hashing it again only once it changed.
+   * @param filename The path of the file.
+   * @return The hash, or nullopt if it couldn't be calculated.
+   */
+  std::optional<std::string> cached_sha256(const std::string &filename) {
+    // Hashes by path, along with the last write time of the file they were calculated from
+    static std::mutex lock;
+    static std::unordered_map<std::string, std::pair<std::filesystem::file_time_type, std::string>> hashes;
+
+    std::error_code ec;
+    auto last_write_time = std::filesystem::last_write_time(filename, ec);
+    if (ec) {
+      return calculate_sha256(filename);
+    }
+
+    std::lock_guard lg {lock};
+    if (auto it = hashes.find(filename); it != hashes.end() && it->second.first == last_write_time) {
+      return it->second.second;
+    }
+
+    auto hash = calculate_sha256(filename);
+    if (hash) {
+      hashes.insert_or_assign(filename, std::make_pair(last_write_time, *hash));
+    }
+    return hash;
+  }
+
   std::tuple<std::string, std::string> calculate_app_id(const std::string &app_name, std::string app_image_path, int index) {
     // Generate id by hashing name with image data if present
     std::vector<std::string> to_hash;
     to_hash.push_back(app_name);
     auto file_path = validate_app_image_path(app_image_path);
     if (file_path != DEFAULT_APP_IMAGE_PATH) {
-      auto file_hash = calculate_sha256(file_path);
+      auto file_hash = cached_sha256(file_path);
       if (file_hash) {
         to_hash.push_back(file_hash.value());
       } else {
@@ -563,6 +658,133 @@ namespace proc {
     return std::make_tuple(id_no_index, id_with_index);
   }
 
+  /**
+   * @brief Parse the node of a single app in apps.json.
+   * @param this_env The environment variables are expanded from.
+   * @param app_node The node of the app.
+   * @return The app, without its id.
+   */
+  proc::ctx_t parse_app(boost::process::v1::native_environment &this_env, const pt::ptree &app_node) {
+    proc::ctx_t ctx;
+
+    auto prep_nodes_opt = app_node.get_child_optional("prep-cmd"s);
+    auto detached_nodes_opt = app_node.get_child_optional("detached"s);
+    auto exclude_global_prep = app_node.get_optional<bool>("exclude-global-prep-cmd"s);
+    auto output = app_node.get_optional<std::string>("output"s);
+    auto name = parse_env_val(this_env, app_node.get<std::string>("name"s));
+    auto cmd = app_node.get_optional<std::string>("cmd"s);
+    auto image_path = app_node.get_optional<std::string>("image-path"s);
+    auto working_dir = app_node.get_optional<std::string>("working-dir"s);
+    auto elevated = app_node.get_optional<bool>("elevated"s);
+    auto auto_detach = app_node.get_optional<bool>("auto-detach"s);
+    auto wait_all = app_node.get_optional<bool>("wait-all"s);
+    auto exit_timeout = app_node.get_optional<int>("exit-timeout"s);
+
+    std::vector<proc::cmd_t> prep_cmds;
+    if (!exclude_global_prep.value_or(false)) {
+      prep_cmds.reserve(config::sunshine.prep_cmds.size());
+      for (auto &prep_cmd : config::sunshine.prep_cmds) {
+        auto do_cmd = parse_env_val(this_env, prep_cmd.do_cmd);
+        auto undo_cmd = parse_env_val(this_env, prep_cmd.undo_cmd);
+
+        prep_cmds.emplace_back(
+          std::move(do_cmd),
+          std::move(undo_cmd),
+          std::move(prep_cmd.elevated)
+        );
+        prep_cmds.back().parallel = prep_cmd.parallel;
+      }
+    }
+
+    if (prep_nodes_opt) {
+      auto &prep_nodes = *prep_nodes_opt;
+
+      prep_cmds.reserve(prep_cmds.size() + prep_nodes.size());
+      for (auto &[_, prep_node] : prep_nodes) {
+        auto do_cmd = prep_node.get_optional<std::string>("do"s);
+        auto undo_cmd = prep_node.get_optional<std::string>("undo"s);
+        auto elevated = prep_node.get_optional<bool>("elevated");
+        auto parallel = prep_node.get_optional<bool>("parallel");
+
+        prep_cmds.emplace_back(
+          parse_env_val(this_env, do_cmd.value_or("")),
+          parse_env_val(this_env, undo_cmd.value_or("")),
+          std::move(elevated.value_or(false))
+        );
+        prep_cmds.back().parallel = parallel.value_or(false);
+      }
+    }
+
+    std::vector<std::string> detached;
+    if (detached_nodes_opt) {
+      auto &detached_nodes = *detached_nodes_opt;
+
+      detached.reserve(detached_nodes.size());
+      for (auto &[_, detached_val] : detached_nodes) {
+        detached.emplace_back(parse_env_val(this_env, detached_val.get_value<std::string>()));
+      }
+    }
+
+    if (output) {
+      ctx.output = parse_env_val(this_env, *output);
+    }
+
+    if (cmd) {
+      ctx.cmd = parse_env_val(this_env, *cmd);
+    }
+
+    if (working_dir) {
+      ctx.working_dir = parse_env_val(this_env, *working_dir);
+#ifdef _WIN32
+      // The working directory, unlike the command itself, should not be quoted
+      // when it contains spaces. Unlike POSIX, Windows forbids quotes in paths,
+      // so we can safely strip them all out here to avoid confusing the user.
+      boost::erase_all(ctx.working_dir, "\"");
+#endif
+    }
+
+    if (image_path) {
+      ctx.image_path = parse_env_val(this_env, *image_path);
+    }
+
+    ctx.elevated = elevated.value_or(false);
+    ctx.auto_detach = auto_detach.value_or(true);
+    ctx.wait_all = wait_all.value_or(true);
+    ctx.exit_timeout = std::chrono::seconds {exit_timeout.value_or(5)};
+
+    ctx.name = std::move(name);
+    ctx.prep_cmds = std::move(prep_cmds);
+    ctx.detached = std::move(detached);
+
+    return ctx;
+  }
+
+  /**
+   * @brief Apps parsed before, reused by parse() as long as their node and the environment stay the same.
+   */
+  struct parsed_apps_t {
+    std::mutex lock;
+
+    // The env node of apps.json and the global prep commands, every app depends on them
+    std::string env_key;
+
+    // Parsed apps by their serialized node
+    std::unordered_map<std::string, proc::ctx_t> apps;
+  };
+
+  parsed_apps_t parsed_apps;
+
+  /**
+   * @brief Serialize a property tree, to tell if it changed.
+   * @param tree The tree.
+   * @return The tree as compact JSON.
+   */
+  std::string serialize(const pt::ptree &tree) {
+    std::stringstream ss;
+    pt::write_json(ss, tree, false);
+    return ss.str();
+  }
+
   std::optional<proc::proc_t> parse(const std::string &file_name) {
     pt::ptree tree;
 
@@ -574,6 +796,18 @@ namespace proc {
 
       auto this_env = boost::this_process::environment();
 
+      // Apps only have to be parsed again if they, the environment or the global prep commands changed
+      std::lock_guard lg {parsed_apps.lock};
+      auto env_key = serialize(env_vars);
+      for (auto &prep_cmd : config::sunshine.prep_cmds) {
+        env_key += prep_cmd.do_cmd + '\0' + prep_cmd.undo_cmd + '\0' + (prep_cmd.elevated ? '1' : '0') + (prep_cmd.parallel ? '1' : '0');
+      }
+      if (env_key != parsed_apps.env_key) {
+        parsed_apps.apps.clear();
+        parsed_apps.env_key = std::move(env_key);
+      }
+      decltype(parsed_apps.apps) parsed;
+
       for (auto &[name, val] : env_vars) {
         this_env[name] = parse_env_val(this_env, val.get_value<std::string>());
       }
@@ -582,91 +816,12 @@ namespace proc {
       std::vector<proc::ctx_t> apps;
       int i = 0;
       for (auto &[_, app_node] : apps_node) {
-        proc::ctx_t ctx;
-
-        auto prep_nodes_opt = app_node.get_child_optional("prep-cmd"s);
-        auto detached_nodes_opt = app_node.get_child_optional("detached"s);
-        auto exclude_global_prep = app_node.get_optional<bool>("exclude-global-prep-cmd"s);
-        auto output = app_node.get_optional<std::string>("output"s);
-        auto name = parse_env_val(this_env, app_node.get<std::string>("name"s));
-        auto cmd = app_node.get_optional<std::string>("cmd"s);
-        auto image_path = app_node.get_optional<std::string>("image-path"s);
-        auto working_dir = app_node.get_optional<std::string>("working-dir"s);
-        auto elevated = app_node.get_optional<bool>("elevated"s);
-        auto auto_detach = app_node.get_optional<bool>("auto-detach"s);
-        auto wait_all = app_node.get_optional<bool>("wait-all"s);
-        auto exit_timeout = app_node.get_optional<int>("exit-timeout"s);
-
-        std::vector<proc::cmd_t> prep_cmds;
-        if (!exclude_global_prep.value_or(false)) {
-          prep_cmds.reserve(config::sunshine.prep_cmds.size());
-          for (auto &prep_cmd : config::sunshine.prep_cmds) {
-            auto do_cmd = parse_env_val(this_env, prep_cmd.do_cmd);
-            auto undo_cmd = parse_env_val(this_env, prep_cmd.undo_cmd);
-
-            prep_cmds.emplace_back(
-              std::move(do_cmd),
-              std::move(undo_cmd),
-              std::move(prep_cmd.elevated)
-            );
-          }
-        }
-
-        if (prep_nodes_opt) {
-          auto &prep_nodes = *prep_nodes_opt;
-
-          prep_cmds.reserve(prep_cmds.size() + prep_nodes.size());
-          for (auto &[_, prep_node] : prep_nodes) {
-            auto do_cmd = prep_node.get_optional<std::string>("do"s);
-            auto undo_cmd = prep_node.get_optional<std::string>("undo"s);
-            auto elevated = prep_node.get_optional<bool>("elevated");
-
-            prep_cmds.emplace_back(
-              parse_env_val(this_env, do_cmd.value_or("")),
-              parse_env_val(this_env, undo_cmd.value_or("")),
-              std::move(elevated.value_or(false))
-            );
-          }
-        }
-
-        std::vector<std::string> detached;
-        if (detached_nodes_opt) {
-          auto &detached_nodes = *detached_nodes_opt;
-
-          detached.reserve(detached_nodes.size());
-          for (auto &[_, detached_val] : detached_nodes) {
-            detached.emplace_back(parse_env_val(this_env, detached_val.get_value<std::string>()));
-          }
-        }
-
-        if (output) {
-          ctx.output = parse_env_val(this_env, *output);
-        }
-
-        if (cmd) {
-          ctx.cmd = parse_env_val(this_env, *cmd);
-        }
-
-        if (working_dir) {
-          ctx.working_dir = parse_env_val(this_env, *working_dir);
-#ifdef _WIN32
-          // The working directory, unlike the command itself, should not be quoted
-          // when it contains spaces. Unlike POSIX, Windows forbids quotes in paths,
-          // so we can safely strip them all out here to avoid confusing the user.
-          boost::erase_all(ctx.working_dir, "\"");
-#endif
-        }
+        auto key = serialize(app_node);
+        auto cached = parsed_apps.apps.find(key);
+        proc::ctx_t ctx = cached != parsed_apps.apps.end() ? cached->second : parse_app(this_env, app_node);
+        parsed.emplace(std::move(key), ctx);
 
-        if (image_path) {
-          ctx.image_path = parse_env_val(this_env, *image_path);
-        }
-
-        ctx.elevated = elevated.value_or(false);
-        ctx.auto_detach = auto_detach.value_or(true);
-        ctx.wait_all = wait_all.value_or(true);
-        ctx.exit_timeout = std::chrono::seconds {exit_timeout.value_or(5)};
-
-        auto possible_ids = calculate_app_id(name, ctx.image_path, i++);
+        auto possible_ids = calculate_app_id(ctx.name, ctx.image_path, i++);
         if (ids.count(std::get<0>(possible_ids)) == 0) {
           // Avoid using index to generate id if possible
           ctx.id = std::get<0>(possible_ids);
@@ -676,13 +831,11 @@ namespace proc {
         }
         ids.insert(ctx.id);
 
-        ctx.name = std::move(name);
-        ctx.prep_cmds = std::move(prep_cmds);
-        ctx.detached = std::move(detached);
-
         apps.emplace_back(std::move(ctx));
       }
 
+      parsed_apps.apps = std::move(parsed);
+
       return proc::proc_t {
         std::move(this_env),
         std::move(apps)
@@ -694,11 +847,74 @@ namespace proc {
     return std::nullopt;
   }
 
+  int execute_async(int app_id, std::shared_ptr<rtsp_stream::launch_session_t> launch_session) {
+    auto &apps = proc.get_apps();
+    auto app = std::find_if(apps.begin(), apps.end(), [&app_id](const auto &ctx) {
+      return ctx.id == std::to_string(app_id);
+    });
+
+    if (app == apps.end()) {
+      BOOST_LOG(error) << "Couldn't find app with ID ["sv << app_id << ']';
+      return 404;
+    }
+
+    std::lock_guard lock {LAUNCH.mutex};
+
+    // nvhttp refuses to launch while an app runs, this only waits if one was just terminated
+    if (LAUNCH.launched.valid()) {
+      LAUNCH.launched.wait();
+    }
+
+    LAUNCH.app_id = app_id;
+    LAUNCH.result = 0;
+    LAUNCH.prep_cmds_done = 0;
+    LAUNCH.prep_cmds_total = app->prep_cmds.size();
+    LAUNCH.pending = true;
+    LAUNCH.launched = std::async(std::launch::async, [app_id, launch_session = std::move(launch_session)]() {
+      // The app and its prep commands expect the display in its new mode
+      display_device::wait_for_configuration();
+
+      auto start = std::chrono::steady_clock::now();
+      LAUNCH.result = proc.execute(app_id, launch_session);
+      LAUNCH.pending = false;
+
+      BOOST_LOG(info) << "Launch of app ["sv << app_id << "] "sv << (LAUNCH.result ? "failed"sv : "finished"sv) << " after "sv
+                      << std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count() << " ms"sv;
+    }).share();
+
+    return 0;
+  }
+
+  void wait_for_launch() {
+    std::shared_future<void> launched;
+    {
+      std::lock_guard lock {LAUNCH.mutex};
+      launched = LAUNCH.launched;
+    }
+
+    if (launched.valid()) {
+      launched.wait();
+    }
+  }
+
+  launch_status_t launch_status() {
+    return {
+      LAUNCH.app_id,
+      LAUNCH.pending,
+      LAUNCH.result,
+      LAUNCH.prep_cmds_done,
+      LAUNCH.prep_cmds_total,
+    };
+  }
+
   void refresh(const std::string &file_name) {
     auto proc_opt = proc::parse(file_name);
 
     if (proc_opt) {
+      // The launch thread uses the apps being replaced
+      wait_for_launch();
       proc = std::move(*proc_opt);
+      ++apps_generation;
     }
   }
 }  // namespace proc
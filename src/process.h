@@ -9,6 +9,8 @@
 #endif
 
 // standard includes
+#include <atomic>
+#include <future>
 #include <optional>
 #include <unordered_map>
 
@@ -114,6 +116,36 @@ namespace proc {
     std::vector<cmd_t>::const_iterator _app_prep_begin;
   };
 
+  /**
+   * @brief Progress of the launch started by `execute_async(...)`.
+   */
+  struct launch_status_t {
+    int app_id;  ///< App of the last launch, 0 if nothing was launched
+    bool pending;  ///< The prep commands or the app are still starting
+    int result;  ///< Result of `proc_t::execute(...)` once the launch finished
+    std::size_t prep_cmds_done;
+    std::size_t prep_cmds_total;
+  };
+
+  /**
+   * @brief Launch an app on a separate thread, so the client gets its response before slow prep commands finish.
+   * The app counts as running while it launches. Capture waits for the launch with `wait_for_launch()`,
+   * so only the first video frame waits for it. A launch that fails terminates the app like before,
+   * which ends its sessions.
+   * @param app_id The app to launch.
+   * @param launch_session The session the app is launched for.
+   * @return 0, or 404 if there is no app with that ID.
+   */
+  int execute_async(int app_id, std::shared_ptr<rtsp_stream::launch_session_t> launch_session);
+
+  /**
+   * @brief Wait until the launch started by `execute_async(...)` has finished.
+   * @note Returns right away if no launch is pending. Call it before terminating the app or replacing `proc`.
+   */
+  void wait_for_launch();
+
+  launch_status_t launch_status();
+
   /**
    * @brief Calculate a stable id based on name and image data
    * @return Tuple of id calculated without index (for use if no collision) and one with.
@@ -139,4 +171,9 @@ namespace proc {
   void terminate_process_group(boost::process::v1::child &proc, boost::process::v1::group &group, std::chrono::seconds exit_timeout);
 
   extern proc_t proc;
+
+  /**
+   * @brief Incremented every time refresh() loads the apps, so responses built from them can be cached.
+   */
+  extern std::atomic<std::uint64_t> apps_generation;
 }  // namespace proc
@@ -95,6 +95,34 @@
     #pragma GCC pop_options
   #endif
 
+#elif defined(__aarch64__) || defined(__arm__)
+
+  // Compile a variant for NEON, which 32-bit builds for older Raspberry Pi models leave out of the baseline
+  #if defined(__arm__)
+    #if defined(__clang__)
+      #pragma clang attribute push(__attribute__((target("neon"))), apply_to = function)
+    #else
+      #pragma GCC push_options
+      #pragma GCC target("fpu=neon")
+    #endif
+  #endif
+  #define ISA_SUFFIX _neon
+  #define OBLAS_NEON
+  #include "../third-party/nanors/rs.c"
+  #undef OBLAS_NEON
+  #undef ISA_SUFFIX
+  #if defined(__arm__)
+    #if defined(__clang__)
+      #pragma clang attribute pop
+    #else
+      #pragma GCC pop_options
+    #endif
+  #endif
+
+  #if defined(__linux__)
+    #include <sys/auxv.h>
+  #endif
+
 #endif
 
 // Compile a default variant
@@ -116,6 +144,23 @@ reed_solomon_new_t reed_solomon_new_fn;
 reed_solomon_release_t reed_solomon_release_fn;
 reed_solomon_encode_t reed_solomon_encode_fn;
 reed_solomon_decode_t reed_solomon_decode_fn;
+const char *reed_solomon_isa;
+
+#if defined(__aarch64__) || defined(__arm__)
+/**
+ * @brief Check if the CPU has NEON.
+ * @details NEON is part of the aarch64 baseline, 32-bit ARM CPUs report it in the auxiliary vector.
+ */
+static int cpu_supports_neon(void) {
+  #if defined(__aarch64__)
+  return 1;
+  #elif defined(__linux__) && defined(HWCAP_NEON)
+  return (getauxval(AT_HWCAP) & HWCAP_NEON) != 0;
+  #else
+  return 0;
+  #endif
+}
+#endif
 
 /**
  * @brief This initializes the RS function pointers to the best vectorized version available.
@@ -129,18 +174,30 @@ void reed_solomon_init(void) {
     reed_solomon_encode_fn = reed_solomon_encode_avx512;
     reed_solomon_decode_fn = reed_solomon_decode_avx512;
     reed_solomon_init_avx512();
+    reed_solomon_isa = "avx512";
   } else if (__builtin_cpu_supports("avx2")) {
     reed_solomon_new_fn = reed_solomon_new_avx2;
     reed_solomon_release_fn = reed_solomon_release_avx2;
     reed_solomon_encode_fn = reed_solomon_encode_avx2;
     reed_solomon_decode_fn = reed_solomon_decode_avx2;
     reed_solomon_init_avx2();
+    reed_solomon_isa = "avx2";
   } else if (__builtin_cpu_supports("ssse3")) {
     reed_solomon_new_fn = reed_solomon_new_ssse3;
     reed_solomon_release_fn = reed_solomon_release_ssse3;
     reed_solomon_encode_fn = reed_solomon_encode_ssse3;
     reed_solomon_decode_fn = reed_solomon_decode_ssse3;
     reed_solomon_init_ssse3();
+    reed_solomon_isa = "ssse3";
+  } else
+#elif defined(__aarch64__) || defined(__arm__)
+  if (cpu_supports_neon()) {
+    reed_solomon_new_fn = reed_solomon_new_neon;
+    reed_solomon_release_fn = reed_solomon_release_neon;
+    reed_solomon_encode_fn = reed_solomon_encode_neon;
+    reed_solomon_decode_fn = reed_solomon_decode_neon;
+    reed_solomon_init_neon();
+    reed_solomon_isa = "neon";
   } else
 #endif
   {
@@ -149,5 +206,6 @@ void reed_solomon_init(void) {
     reed_solomon_encode_fn = reed_solomon_encode_def;
     reed_solomon_decode_fn = reed_solomon_decode_def;
     reed_solomon_init_def();
+    reed_solomon_isa = "default";
   }
 }
@@ -20,6 +20,15 @@ extern reed_solomon_release_t reed_solomon_release_fn;
 extern reed_solomon_encode_t reed_solomon_encode_fn;
 extern reed_solomon_decode_t reed_solomon_decode_fn;
 
+// Name of the variant reed_solomon_init() picked, e.g. "avx2" or "neon"
+extern const char *reed_solomon_isa;
+
+// The portable variant, always built, so the vectorized ones can be checked against it
+reed_solomon *reed_solomon_new_def(int data_shards, int parity_shards);
+void reed_solomon_release_def(reed_solomon *rs);
+int reed_solomon_encode_def(reed_solomon *rs, uint8_t **shards, int nr_shards, int bs);
+void reed_solomon_init_def(void);
+
 #define reed_solomon_new reed_solomon_new_fn
 #define reed_solomon_release reed_solomon_release_fn
 #define reed_solomon_encode reed_solomon_encode_fn
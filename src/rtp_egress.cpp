@@ -0,0 +1,695 @@
+/**
+ * @file src/rtp_egress.cpp
+ * @brief Definitions for the RTP egress, which serves the encoded video to standard RTSP players.
+ */
+// standard includes
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <cstring>
+#include <format>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <unordered_map>
+
+// lib includes
+#include <boost/algorithm/string.hpp>
+#include <boost/asio.hpp>
+#include <Simple-Web-Server/crypto.hpp>
+
+// local includes
+#include "config.h"
+#include "crypto.h"
+#include "httpcommon.h"
+#include "logging.h"
+#include "network.h"
+#include "rtp_egress.h"
+#include "thread_safe.h"
+#include "utility.h"
+
+using namespace std::literals;
+
+namespace rtp_egress {
+  namespace asio = boost::asio;
+  using asio::ip::tcp;
+  using asio::ip::udp;
+
+  namespace {
+    // Key frames are requested at most this often, a client asking for one gets it anyway
+    constexpr auto KEY_FRAME_REQUEST_INTERVAL = 1s;
+
+    // Another encoder is only forwarded once the forwarded one stopped sending for this long
+    constexpr auto SOURCE_TIMEOUT = 1s;
+
+    constexpr std::uint8_t PAYLOAD_TYPE = 96;
+
+    std::int64_t to_ns(std::chrono::steady_clock::time_point time) {
+      return std::chrono::duration_cast<std::chrono::nanoseconds>(time.time_since_epoch()).count();
+    }
+
+    /**
+     * @brief Find the next start code.
+     * @return The offset of the `00 00 01`, or the size of the frame if there's none left.
+     */
+    std::size_t find_start_code(std::span<const std::uint8_t> frame, std::size_t from) {
+      for (auto x = from; x + 2 < frame.size(); ++x) {
+        if (frame[x] == 0 && frame[x + 1] == 0 && frame[x + 2] == 1) {
+          return x;
+        }
+      }
+
+      return frame.size();
+    }
+
+    /**
+     * @brief A frame copied by forward(), on its way to the egress thread.
+     */
+    struct frame_t {
+      std::vector<std::uint8_t> data;
+      std::int64_t timestamp;
+      int video_format;
+      bool key_frame;
+      bool last_part;  ///< The last part of a frame sent in parts, its last packet gets the marker bit.
+    };
+
+    /**
+     * @brief A player that set up the stream.
+     */
+    struct viewer_t {
+      std::string session;
+      const void *connection;  ///< The RTSP connection that set it up, the viewer leaves with it.
+      udp::endpoint peer;
+      std::uint32_t ssrc;
+      std::uint16_t sequence;
+      bool playing;
+      bool synced;  ///< Got a key frame, the frames before it can't be decoded.
+    };
+
+    /**
+     * @brief An RTSP request, the header names in lower case.
+     */
+    struct request_t {
+      std::string method;
+      std::string url;
+      std::unordered_map<std::string, std::string> headers;
+
+      std::string_view header(const std::string &name) const {
+        auto it = headers.find(name);
+        return it == std::end(headers) ? std::string_view {} : std::string_view {it->second};
+      }
+    };
+
+    request_t parse_request(std::string_view message) {
+      request_t request;
+
+      auto line_end = message.find("\r\n"sv);
+      std::vector<std::string> parts;
+      boost::split(parts, message.substr(0, line_end), boost::is_any_of(" "), boost::token_compress_on);
+      if (parts.size() >= 2) {
+        request.method = parts[0];
+        request.url = parts[1];
+      }
+
+      while (line_end != std::string_view::npos) {
+        auto begin = line_end + 2;
+        line_end = message.find("\r\n"sv, begin);
+        auto line = message.substr(begin, line_end == std::string_view::npos ? std::string_view::npos : line_end - begin);
+
+        auto colon = line.find(':');
+        if (colon == std::string_view::npos) {
+          continue;
+        }
+
+        auto name = boost::to_lower_copy(std::string {line.substr(0, colon)});
+        request.headers[name] = boost::trim_copy(std::string {line.substr(colon + 1)});
+      }
+
+      return request;
+    }
+
+    class server_t;
+
+    class connection_t: public std::enable_shared_from_this<connection_t> {
+    public:
+      connection_t(asio::io_context &io_context, server_t &server):
+          sock {io_context},
+          server {server} {
+      }
+
+      void read();
+
+      tcp::socket sock;
+
+    private:
+      void handle_header(const boost::system::error_code &ec, std::size_t bytes);
+      void respond(const request_t &request);
+
+      server_t &server;
+      asio::streambuf buffer;
+    };
+
+    class server_t: public platf::deinit_t {
+    public:
+      ~server_t() override;
+
+      int bind(net::af_e af, std::uint16_t port) {
+        auto tcp_protocol = af == net::IPV4 ? tcp::v4() : tcp::v6();
+        auto udp_protocol = af == net::IPV4 ? udp::v4() : udp::v6();
+
+        boost::system::error_code ec;
+        acceptor.open(tcp_protocol, ec);
+        if (!ec) {
+          acceptor.set_option(asio::socket_base::reuse_address {true});
+          acceptor.bind(tcp::endpoint {tcp_protocol, port}, ec);
+        }
+        if (!ec) {
+          acceptor.listen(asio::socket_base::max_listen_connections, ec);
+        }
+        if (!ec) {
+          video_sock.open(udp_protocol, ec);
+        }
+        if (!ec) {
+          video_sock.bind(udp::endpoint {udp_protocol, 0}, ec);
+        }
+        if (!ec) {
+          // A full send buffer drops packets instead of holding up the other players
+          video_sock.non_blocking(true, ec);
+        }
+        if (ec) {
+          BOOST_LOG(error) << "RTP egress: couldn't bind port "sv << port << ": "sv << ec.message();
+          return -1;
+        }
+
+        video_port = video_sock.local_endpoint().port();
+        accept();
+
+        io_thread = std::thread {[this]() {
+          io_context.run();
+        }};
+        egress_thread = std::thread {&server_t::run, this};
+
+        BOOST_LOG(info) << "RTP egress: serving the stream on rtsp://<host>:"sv << port << '/';
+        return 0;
+      }
+
+      bool forward(video::packet_raw_t &packet, const video::config_t &config) {
+        auto now = std::chrono::steady_clock::now();
+        auto first_part = packet.slice_group == 0;
+        auto key_frame = first_part && packet.is_idr();
+
+        // Follow one encoder, another one is only picked up at a key frame once the followed one went quiet
+        auto followed = source.load(std::memory_order_acquire);
+        if (followed != packet.channel_data) {
+          if (followed && to_ns(now) - last_forward.load(std::memory_order_relaxed) < std::chrono::nanoseconds {SOURCE_TIMEOUT}.count()) {
+            return false;
+          }
+          if (!key_frame) {
+            return playing.load(std::memory_order_relaxed) && request_key_frame(now);
+          }
+          if (!source.compare_exchange_strong(followed, packet.channel_data, std::memory_order_acq_rel)) {
+            return false;
+          }
+
+          video_format.store(config.videoFormat, std::memory_order_relaxed);
+          framerate.store(config.framerate, std::memory_order_relaxed);
+          resync.store(true, std::memory_order_relaxed);
+        }
+        last_forward.store(to_ns(now), std::memory_order_relaxed);
+
+        if (!playing.load(std::memory_order_relaxed)) {
+          return false;
+        }
+
+        std::vector<std::uint8_t> data;
+        if (recycled.peek()) {
+          data = std::move(*recycled.pop());
+        }
+        data.assign(packet.data(), packet.data() + packet.data_size());
+
+        frame_t frame {
+          std::move(data),
+          to_ns(packet.frame_timestamp.value_or(now)),
+          config.videoFormat,
+          key_frame,
+          packet.slice_group + 1 == packet.slice_groups,
+        };
+        if (!frames.raise(std::move(frame))) {
+          BOOST_LOG(debug) << "RTP egress fell behind, dropping frame "sv << packet.frame_index();
+          resync.store(true, std::memory_order_relaxed);
+        }
+
+        return awaiting_key_frame.load(std::memory_order_relaxed) && !key_frame && request_key_frame(now);
+      }
+
+      std::string handle(connection_t &connection, const request_t &request) {
+        if (request.method == "OPTIONS"sv) {
+          return response(request, "200 OK"sv, "Public: OPTIONS, DESCRIBE, SETUP, PLAY, TEARDOWN, GET_PARAMETER\r\n"sv);
+        }
+        if (request.method == "GET_PARAMETER"sv || request.method == "SET_PARAMETER"sv) {
+          return response(request, "200 OK"sv);
+        }
+
+        boost::system::error_code ec;
+        auto peer = connection.sock.remote_endpoint(ec).address();
+        if (auto denied = authorize(peer, request)) {
+          return *denied;
+        }
+
+        if (request.method == "DESCRIBE"sv) {
+          return describe(connection, request);
+        }
+        if (request.method == "SETUP"sv) {
+          return setup(connection, request, peer);
+        }
+        if (request.method == "PLAY"sv) {
+          return play(request);
+        }
+        if (request.method == "TEARDOWN"sv) {
+          std::lock_guard lg {viewers_lock};
+          remove_viewers([&request](const viewer_t &viewer) {
+            return viewer.session == request.header("session").substr(0, viewer.session.size());
+          });
+          return response(request, "200 OK"sv);
+        }
+
+        return response(request, "501 Not Implemented"sv);
+      }
+
+      void disconnected(const connection_t *connection) {
+        std::lock_guard lg {viewers_lock};
+        remove_viewers([connection](const viewer_t &viewer) {
+          return viewer.connection == connection;
+        });
+      }
+
+    private:
+      void accept() {
+        auto connection = std::make_shared<connection_t>(io_context, *this);
+        acceptor.async_accept(connection->sock, [this, connection](const boost::system::error_code &ec) {
+          if (ec) {
+            if (ec != asio::error::operation_aborted) {
+              BOOST_LOG(error) << "RTP egress: couldn't accept a connection: "sv << ec.message();
+            }
+            return;
+          }
+
+          connection->read();
+          accept();
+        });
+      }
+
+      static std::string response(const request_t &request, std::string_view status, std::string_view headers = {}, std::string_view body = {}) {
+        auto message = std::format("RTSP/1.0 {}\r\nCSeq: {}\r\nServer: Sunshine\r\n{}", status, request.header("cseq"), headers);
+        if (!body.empty()) {
+          message += std::format("Content-Length: {}\r\n", body.size());
+        }
+        message += "\r\n"sv;
+        message += body;
+        return message;
+      }
+
+      /**
+       * @brief Check the player's address and its credentials, the ones of the web UI.
+       * @return The response that turns the player away, or nothing if it may watch.
+       */
+      std::optional<std::string> authorize(const asio::ip::address &peer, const request_t &request) {
+        auto address = net::addr_to_normalized_string(peer);
+        if (net::from_address(address) > http::origin_web_ui_allowed || config::sunshine.username.empty()) {
+          BOOST_LOG(info) << "RTP egress: ["sv << address << "] -- denied"sv;
+          return response(request, "403 Forbidden"sv);
+        }
+
+        auto auth = request.header("authorization");
+        if (boost::istarts_with(auth, "Basic "sv)) {
+          auto credentials = SimpleWeb::Crypto::Base64::decode(std::string {auth.substr("Basic "sv.length())});
+          auto colon = credentials.find(':');
+          if (colon != std::string::npos) {
+            auto username = credentials.substr(0, colon);
+            auto hash = util::hex(crypto::hash(credentials.substr(colon + 1) + config::sunshine.salt)).to_string();
+            if (boost::iequals(username, config::sunshine.username) && hash == config::sunshine.password) {
+              return std::nullopt;
+            }
+          }
+        }
+
+        return response(request, "401 Unauthorized"sv, "WWW-Authenticate: Basic realm=\"Sunshine\"\r\n"sv);
+      }
+
+      std::string describe(connection_t &connection, const request_t &request) {
+        // Nothing is streamed unless a Moonlight client is streaming
+        auto idle = to_ns(std::chrono::steady_clock::now()) - last_forward.load(std::memory_order_relaxed) > std::chrono::nanoseconds {SOURCE_TIMEOUT}.count();
+        if (!source.load(std::memory_order_relaxed) || idle) {
+          return response(request, "503 Service Unavailable"sv);
+        }
+
+        auto format = video_format.load(std::memory_order_relaxed);
+        if (format != 0 && format != 1) {
+          return response(request, "415 Unsupported Media Type"sv);
+        }
+
+        boost::system::error_code ec;
+        auto local = connection.sock.local_endpoint(ec).address();
+        auto ip_version = local.is_v4() ? 4 : 6;
+        auto sdp = std::format(
+          "v=0\r\n"
+          "o=- 0 0 IN IP{0} {1}\r\n"
+          "s=Sunshine\r\n"
+          "c=IN IP{0} {1}\r\n"
+          "t=0 0\r\n"
+          "m=video 0 RTP/AVP {2}\r\n"
+          "a=rtpmap:{2} {3}/90000\r\n"
+          "{4}"
+          "a=framerate:{5}\r\n"
+          "a=control:stream\r\n",
+          ip_version,
+          local.to_string(),
+          PAYLOAD_TYPE,
+          format == 0 ? "H264"sv : "H265"sv,
+          format == 0 ? std::format("a=fmtp:{} packetization-mode=1\r\n", PAYLOAD_TYPE) : std::string {},
+          framerate.load(std::memory_order_relaxed)
+        );
+
+        auto base = request.url.ends_with('/') ? request.url : request.url + '/';
+        return response(request, "200 OK"sv, std::format("Content-Type: application/sdp\r\nContent-Base: {}\r\n", base), sdp);
+      }
+
+      std::string setup(connection_t &connection, const request_t &request, const asio::ip::address &peer) {
+        // Players behind a WebRTC gateway or on the same LAN take UDP, interleaving on the RTSP connection isn't offered
+        auto transport = request.header("transport");
+        auto client_port = transport.find("client_port="sv);
+        if (transport.find("RTP/AVP/TCP"sv) != std::string_view::npos || client_port == std::string_view::npos) {
+          return response(request, "461 Unsupported Transport"sv);
+        }
+
+        auto ports = transport.substr(client_port + "client_port="sv.length());
+        std::uint16_t rtp_port = 0;
+        std::from_chars(ports.data(), ports.data() + ports.size(), rtp_port);
+        if (!rtp_port) {
+          return response(request, "461 Unsupported Transport"sv);
+        }
+
+        std::lock_guard lg {viewers_lock};
+        if (viewers.size() >= MAX_VIEWERS) {
+          return response(request, "453 Not Enough Bandwidth"sv);
+        }
+
+        std::uint32_t ssrc;
+        auto random = crypto::rand(sizeof(ssrc));
+        std::memcpy(&ssrc, random.data(), sizeof(ssrc));
+
+        auto &viewer = viewers.emplace_back(viewer_t {
+          util::hex_vec(crypto::rand(8)),
+          &connection,
+          udp::endpoint {peer, rtp_port},
+          ssrc,
+          0,
+          false,
+          false,
+        });
+
+        BOOST_LOG(info) << "RTP egress: ["sv << net::addr_to_normalized_string(peer) << "] set up the stream"sv;
+        return response(
+          request,
+          "200 OK"sv,
+          std::format(
+            "Transport: RTP/AVP;unicast;client_port={}-{};server_port={}-{};ssrc={:08X}\r\nSession: {};timeout=60\r\n",
+            rtp_port,
+            rtp_port + 1,
+            video_port,
+            video_port + 1,
+            viewer.ssrc,
+            viewer.session
+          )
+        );
+      }
+
+      std::string play(const request_t &request) {
+        std::lock_guard lg {viewers_lock};
+        auto session = request.header("session");
+        auto viewer = std::find_if(std::begin(viewers), std::end(viewers), [&session](const viewer_t &viewer) {
+          return session.substr(0, viewer.session.size()) == viewer.session;
+        });
+        if (viewer == std::end(viewers)) {
+          return response(request, "454 Session Not Found"sv);
+        }
+
+        if (!viewer->playing) {
+          viewer->playing = true;
+          viewer->synced = false;
+          playing.fetch_add(1, std::memory_order_relaxed);
+          awaiting_key_frame.store(true, std::memory_order_relaxed);
+        }
+
+        return response(request, "200 OK"sv, std::format("Session: {}\r\nRange: npt=0.000-\r\nRTP-Info: url={};seq={}\r\n", viewer->session, request.url, viewer->sequence));
+      }
+
+      template<class F>
+      void remove_viewers(F &&predicate) {
+        auto it = std::remove_if(std::begin(viewers), std::end(viewers), [&](const viewer_t &viewer) {
+          if (!predicate(viewer)) {
+            return false;
+          }
+
+          if (viewer.playing) {
+            playing.fetch_sub(1, std::memory_order_relaxed);
+          }
+          return true;
+        });
+        viewers.erase(it, std::end(viewers));
+      }
+
+      bool request_key_frame(std::chrono::steady_clock::time_point now) {
+        auto last = last_request.load(std::memory_order_relaxed);
+        if (to_ns(now) - last < std::chrono::nanoseconds {KEY_FRAME_REQUEST_INTERVAL}.count()) {
+          return false;
+        }
+
+        return last_request.compare_exchange_strong(last, to_ns(now), std::memory_order_relaxed);
+      }
+
+      void run() {
+        std::vector<payload_t> payloads;
+        std::array<std::uint8_t, 12> header {0x80};
+
+        while (auto frame = frames.pop()) {
+          packetize(frame->data, frame->video_format, MAX_PAYLOAD, payloads);
+
+          // RTP video timestamps count at 90 kHz
+          auto timestamp = util::endian::big((std::uint32_t) (frame->timestamp * 9 / 100000));
+
+          std::lock_guard lg {viewers_lock};
+
+          // A frame didn't make it here, nothing decodes until the next key frame
+          if (resync.exchange(false, std::memory_order_relaxed)) {
+            for (auto &viewer : viewers) {
+              viewer.synced = false;
+            }
+            awaiting_key_frame.store(true, std::memory_order_relaxed);
+          }
+
+          auto all_synced = true;
+          for (auto &viewer : viewers) {
+            if (!viewer.playing) {
+              continue;
+            }
+            if (!viewer.synced && !frame->key_frame) {
+              all_synced = false;
+              continue;
+            }
+            viewer.synced = true;
+
+            auto ssrc = util::endian::big(viewer.ssrc);
+            std::memcpy(&header[4], &timestamp, sizeof(timestamp));
+            std::memcpy(&header[8], &ssrc, sizeof(ssrc));
+            for (std::size_t x = 0; x < payloads.size(); ++x) {
+              auto &payload = payloads[x];
+              auto marker = frame->last_part && x + 1 == payloads.size();
+              auto sequence = util::endian::big(viewer.sequence++);
+              header[1] = PAYLOAD_TYPE | (marker ? 0x80 : 0);
+              std::memcpy(&header[2], &sequence, sizeof(sequence));
+
+              std::array<asio::const_buffer, 3> buffers {
+                asio::buffer(header),
+                asio::buffer(payload.header.data(), payload.header_size),
+                asio::buffer(payload.data.data(), payload.data.size()),
+              };
+
+              // A player that went away is dropped when its RTSP connection closes
+              boost::system::error_code ec;
+              video_sock.send_to(buffers, viewer.peer, 0, ec);
+            }
+          }
+          if (all_synced && frame->key_frame) {
+            awaiting_key_frame.store(false, std::memory_order_relaxed);
+          }
+
+          recycled.raise(std::move(frame->data));
+        }
+      }
+
+      asio::io_context io_context;
+      tcp::acceptor acceptor {io_context};
+      udp::socket video_sock {io_context};
+      std::uint16_t video_port;
+
+      safe::ring_t<frame_t> frames;
+      safe::ring_t<std::vector<std::uint8_t>> recycled;
+
+      // Held by the egress thread while it sends a frame, and by the RTSP thread while players come and go
+      std::mutex viewers_lock;
+      std::vector<viewer_t> viewers;
+
+      std::atomic<int> playing {0};
+      std::atomic<bool> awaiting_key_frame {false};
+      std::atomic<bool> resync {false};
+
+      // The followed encoder and its stream, written by the send threads
+      std::atomic<void *> source {nullptr};
+      std::atomic<std::int64_t> last_forward {0};
+      std::atomic<std::int64_t> last_request {0};
+      std::atomic<int> video_format {-1};
+      std::atomic<int> framerate {0};
+
+      std::thread io_thread;
+      std::thread egress_thread;
+    };
+
+    // Set by start(), streaming only runs while the egress handle lives
+    server_t *egress = nullptr;
+
+    server_t::~server_t() {
+      egress = nullptr;
+
+      frames.stop();
+      io_context.stop();
+      if (egress_thread.joinable()) {
+        egress_thread.join();
+      }
+      if (io_thread.joinable()) {
+        io_thread.join();
+      }
+    }
+
+    void connection_t::read() {
+      asio::async_read_until(sock, buffer, "\r\n\r\n"sv, [self = shared_from_this()](const boost::system::error_code &ec, std::size_t bytes) {
+        self->handle_header(ec, bytes);
+      });
+    }
+
+    void connection_t::handle_header(const boost::system::error_code &ec, std::size_t bytes) {
+      if (ec) {
+        server.disconnected(this);
+        return;
+      }
+
+      auto begin = asio::buffers_begin(buffer.data());
+      auto request = parse_request(std::string {begin, begin + bytes});
+      buffer.consume(bytes);
+
+      // None of the requests served here carries a body, one that comes anyway is skipped
+      std::size_t content_length = 0;
+      auto length = request.header("content-length");
+      std::from_chars(length.data(), length.data() + length.size(), content_length);
+      if (content_length > buffer.size()) {
+        asio::async_read(sock, buffer, asio::transfer_exactly(content_length - buffer.size()), [self = shared_from_this(), request = std::move(request), content_length](const boost::system::error_code &ec, std::size_t) {
+          if (ec) {
+            self->server.disconnected(self.get());
+            return;
+          }
+
+          self->buffer.consume(content_length);
+          self->respond(request);
+        });
+        return;
+      }
+
+      buffer.consume(content_length);
+      respond(request);
+    }
+
+    void connection_t::respond(const request_t &request) {
+      auto message = std::make_shared<std::string>(server.handle(*this, request));
+      asio::async_write(sock, asio::buffer(*message), [self = shared_from_this(), message](const boost::system::error_code &ec, std::size_t) {
+        if (ec) {
+          self->server.disconnected(self.get());
+          return;
+        }
+
+        self->read();
+      });
+    }
+  }  // namespace
+
+  void packetize(std::span<const std::uint8_t> frame, int video_format, std::size_t max_payload, std::vector<payload_t> &payloads) {
+    payloads.clear();
+
+    auto nal_header_size = video_format == 1 ? 2 : 1;
+    for (auto start = find_start_code(frame, 0); start < frame.size();) {
+      auto begin = start + 3;
+      auto next = find_start_code(frame, begin);
+
+      // The zero before a 4 byte start code isn't part of the NAL unit, which never ends in a zero byte
+      auto end = next;
+      while (end > begin && frame[end - 1] == 0) {
+        --end;
+      }
+      start = next;
+
+      auto nal = frame.subspan(begin, end - begin);
+      if (nal.size() <= max_payload) {
+        if (!nal.empty()) {
+          payloads.push_back({{}, 0, nal});
+        }
+        continue;
+      }
+
+      // The fragments carry the NAL unit header in their own headers
+      payload_t fragment {};
+      if (video_format == 1) {
+        fragment.header = {(std::uint8_t) ((nal[0] & 0x81) | (49 << 1)), nal[1], (std::uint8_t) ((nal[0] >> 1) & 0x3F)};
+        fragment.header_size = 3;
+      } else {
+        fragment.header = {(std::uint8_t) ((nal[0] & 0xE0) | 28), (std::uint8_t) (nal[0] & 0x1F), 0};
+        fragment.header_size = 2;
+      }
+
+      auto chunk = max_payload - fragment.header_size;
+      auto data = nal.subspan(nal_header_size);
+      for (std::size_t offset = 0; offset < data.size(); offset += chunk) {
+        auto &payload = payloads.emplace_back(fragment);
+        payload.data = data.subspan(offset, std::min(chunk, data.size() - offset));
+
+        auto &flags = payload.header[fragment.header_size - 1];
+        if (offset == 0) {
+          flags |= 0x80;
+        }
+        if (offset + chunk >= data.size()) {
+          flags |= 0x40;
+        }
+      }
+    }
+  }
+
+  std::unique_ptr<platf::deinit_t> start() {
+    if (!config::stream.rtsp_egress_port) {
+      return nullptr;
+    }
+
+    auto server = std::make_unique<server_t>();
+    if (server->bind(net::af_from_enum_string(config::sunshine.address_family), (std::uint16_t) config::stream.rtsp_egress_port)) {
+      return nullptr;
+    }
+
+    egress = server.get();
+    return server;
+  }
+
+  bool forward(video::packet_raw_t &packet, const video::config_t &config) {
+    if (!egress) {
+      return false;
+    }
+
+    return egress->forward(packet, config);
+  }
+}  // namespace rtp_egress
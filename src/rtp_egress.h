@@ -0,0 +1,68 @@
+/**
+ * @file src/rtp_egress.h
+ * @brief Declarations for the RTP egress, which serves the encoded video to standard RTSP players.
+ *
+ * Players such as ffmpeg, VLC, GStreamer or a WebRTC gateway in front of a browser dashboard connect over plain
+ * RTSP and receive the frames a Moonlight session is already streaming as RTP over UDP, packetized per RFC 6184
+ * (H.264) or RFC 7798 (HEVC). Watching never starts a capture or an encoder of its own, so a player only costs
+ * the packetization.
+ */
+#pragma once
+
+// standard includes
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <vector>
+
+// local includes
+#include "platform/common.h"
+#include "video.h"
+
+namespace rtp_egress {
+  /**
+   * @brief Largest RTP payload sent, so the packets fit the MTU of any network.
+   */
+  constexpr std::size_t MAX_PAYLOAD = 1400;
+
+  /**
+   * @brief Players watching at the same time, later ones are turned away.
+   */
+  constexpr std::size_t MAX_VIEWERS = 16;
+
+  /**
+   * @brief An RTP payload, a whole NAL unit or a fragment of one.
+   */
+  struct payload_t {
+    std::array<std::uint8_t, 3> header;  ///< Fragmentation unit header, sent before the data.
+    std::uint8_t header_size;  ///< Bytes of `header` in use, 0 for a whole NAL unit.
+    std::span<const std::uint8_t> data;  ///< The NAL unit, or the part of it in this fragment.
+  };
+
+  /**
+   * @brief Split an Annex B frame into RTP payloads.
+   * NAL units that fit are sent whole, larger ones in fragmentation units (FU-A for H.264, FU for HEVC).
+   * @param frame The frame, its NAL units preceded by start codes.
+   * @param video_format 0 - H.264, 1 - HEVC.
+   * @param max_payload Largest payload, headers included.
+   * @param payloads Cleared, then filled with the payloads, which point into `frame`.
+   */
+  void packetize(std::span<const std::uint8_t> frame, int video_format, std::size_t max_payload, std::vector<payload_t> &payloads);
+
+  /**
+   * @brief Start the RTSP server on the `rtsp_egress_port` setting.
+   * @return A handle that stops the server when destroyed, or nullptr if it's disabled or the port couldn't be bound.
+   */
+  [[nodiscard]] std::unique_ptr<platf::deinit_t> start();
+
+  /**
+   * @brief Forward a packet the video broadcast thread is about to send to the players.
+   * Only the packets of one encoder are forwarded at a time. While a player is watching, the packet is copied to a
+   * buffer that is handed to the egress thread without waiting for it.
+   * @param packet The packet.
+   * @param config The video configuration of the encoder.
+   * @return `true` if a player waits for a key frame to start decoding.
+   */
+  bool forward(video::packet_raw_t &packet, const video::config_t &config);
+}  // namespace rtp_egress
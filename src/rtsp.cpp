@@ -12,7 +12,9 @@ extern "C" {
 // standard includes
 #include <array>
 #include <cctype>
+#include <chrono>
 #include <format>
+#include <mutex>
 #include <set>
 #include <unordered_map>
 #include <utility>
@@ -215,7 +217,8 @@ namespace rtsp_stream {
       iv[10] = 'C';  // Client originated
       iv[11] = 'R';  // RTSP
 
-      std::vector<uint8_t> plaintext;
+      // Every connection carries a single message, so the buffer is shared by all of them
+      static thread_local std::vector<uint8_t> plaintext;
       if (socket->session->rtsp_cipher->decrypt(std::string_view {(const char *) header->tag, sizeof(header->tag) + bytes}, plaintext, &iv)) {
         BOOST_LOG(error) << "Failed to verify RTSP message tag"sv;
 
@@ -434,13 +437,28 @@ namespace rtsp_stream {
     }
 
     void handle_msg(tcp::socket &sock, launch_session_t &session, msg_t &&req) {
-      auto func = _map_cmd_cb.find(req->message.request.command);
+      auto received = std::chrono::steady_clock::now();
+      if (session.handshake_start == std::chrono::steady_clock::time_point {}) {
+        session.handshake_start = received;
+      }
+
+      std::string command {req->message.request.command};
+
+      auto func = _map_cmd_cb.find(command);
       if (func != std::end(_map_cmd_cb)) {
         func->second(this, sock, session, std::move(req));
       } else {
         cmd_not_found(sock, session, std::move(req));
       }
 
+      auto handled = std::chrono::steady_clock::now();
+      BOOST_LOG(debug) << "RTSP: "sv << command << " handled in "sv << std::chrono::duration<double, std::milli>(handled - received).count()
+                       << "ms, "sv << std::chrono::duration<double, std::milli>(handled - session.handshake_start).count() << "ms into the handshake"sv;
+
+      if (command == "PLAY"sv) {
+        BOOST_LOG(info) << "RTSP handshake completed in "sv << std::chrono::duration<double, std::milli>(handled - session.handshake_start).count() << "ms"sv;
+      }
+
       boost::system::error_code ec;
       sock.shutdown(boost::asio::socket_base::shutdown_type::shutdown_both, ec);
     }
@@ -688,9 +706,10 @@ namespace rtsp_stream {
       iv[10] = 'H';  // Host originated
       iv[11] = 'R';  // RTSP
 
-      // Allocate the message with an empty header and reserved space for the payload
+      // Start the message with an empty header, the buffer keeps its capacity between responses
       auto payload_length = serialized_len + payload.second;
-      std::vector<uint8_t> message(sizeof(encrypted_rtsp_header_t));
+      static thread_local std::vector<uint8_t> message;
+      message.assign(sizeof(encrypted_rtsp_header_t), 0);
       message.reserve(message.size() + payload_length);
 
       // Copy the complete plaintext into the message
@@ -743,57 +762,57 @@ namespace rtsp_stream {
     respond(sock, session, &option, 200, "OK", req->sequenceNumber, {});
   }
 
-  void cmd_describe(rtsp_server_t *server, tcp::socket &sock, launch_session_t &session, msg_t &&req) {
-    OPTION_ITEM option {};
-
-    // I know these string literals will not be modified
-    option.option = const_cast<char *>("CSeq");
+  /**
+   * @brief The parts of the DESCRIBE response that don't depend on the client.
+   * They only change when the encoders are probed again.
+   */
+  struct describe_payload_t {
+    int hevc_mode;
+    int av1_mode;
+    bool ref_frames_invalidation;
 
-    auto seqn_str = std::to_string(req->sequenceNumber);
-    option.content = const_cast<char *>(seqn_str.c_str());
+    // Everything before the encryption flags
+    std::string capabilities;
 
-    std::stringstream ss;
+    // Everything between the encryption flags and the surround parameters of the session
+    std::string codecs;
 
-    // Tell the client about our supported features
-    ss << "a=x-ss-general.featureFlags:" << (uint32_t) platf::get_capabilities() << std::endl;
-
-    // Always request new control stream encryption if the client supports it
-    uint32_t encryption_flags_supported = SS_ENC_CONTROL_V2 | SS_ENC_AUDIO;
-    uint32_t encryption_flags_requested = SS_ENC_CONTROL_V2;
-
-    // Determine the encryption desired for this remote endpoint
-    auto encryption_mode = net::encryption_mode_for_address(sock.remote_endpoint().address());
-    if (encryption_mode != config::ENCRYPTION_MODE_NEVER) {
-      // Advertise support for video encryption if it's not disabled
-      encryption_flags_supported |= SS_ENC_VIDEO;
+    // The surround parameters of the audio stream configurations
+    std::string audio;
+  };
 
-      // If it's mandatory, also request it to enable use if the client
-      // didn't explicitly opt in, but it otherwise has support.
-      if (encryption_mode == config::ENCRYPTION_MODE_MANDATORY) {
-        encryption_flags_requested |= SS_ENC_VIDEO | SS_ENC_AUDIO;
-      }
+  std::mutex describe_payload_mutex;
+  std::optional<describe_payload_t> describe_payload;
+
+  /**
+   * @brief Get the prebuilt DESCRIBE payload, rebuilding it if the probed codecs changed.
+   */
+  const describe_payload_t &get_describe_payload() {
+    if (describe_payload &&
+        describe_payload->hevc_mode == video::active_hevc_mode &&
+        describe_payload->av1_mode == video::active_av1_mode &&
+        describe_payload->ref_frames_invalidation == video::last_encoder_probe_supported_ref_frames_invalidation) {
+      return *describe_payload;
     }
 
-    // Report supported and required encryption flags
-    ss << "a=x-ss-general.encryptionSupported:" << encryption_flags_supported << std::endl;
-    ss << "a=x-ss-general.encryptionRequested:" << encryption_flags_requested << std::endl;
+    auto &payload = describe_payload.emplace();
+    payload.hevc_mode = video::active_hevc_mode;
+    payload.av1_mode = video::active_av1_mode;
+    payload.ref_frames_invalidation = video::last_encoder_probe_supported_ref_frames_invalidation;
 
-    if (video::last_encoder_probe_supported_ref_frames_invalidation) {
-      ss << "a=x-nv-video[0].refPicInvalidation:1"sv << std::endl;
-    }
+    // Tell the client about our supported features
+    payload.capabilities = std::format("a=x-ss-general.featureFlags:{}\n", (uint32_t) platf::get_capabilities());
 
-    if (video::active_hevc_mode != 1) {
-      ss << "sprop-parameter-sets=AAAAAU"sv << std::endl;
+    if (payload.ref_frames_invalidation) {
+      payload.codecs += "a=x-nv-video[0].refPicInvalidation:1\n"sv;
     }
 
-    if (video::active_av1_mode != 1) {
-      ss << "a=rtpmap:98 AV1/90000"sv << std::endl;
+    if (payload.hevc_mode != 1) {
+      payload.codecs += "sprop-parameter-sets=AAAAAU\n"sv;
     }
 
-    if (!session.surround_params.empty()) {
-      // If we have our own surround parameters, advertise them twice first
-      ss << "a=fmtp:97 surround-params="sv << session.surround_params << std::endl;
-      ss << "a=fmtp:97 surround-params="sv << session.surround_params << std::endl;
+    if (payload.av1_mode != 1) {
+      payload.codecs += "a=rtpmap:98 AV1/90000\n"sv;
     }
 
     for (int x = 0; x < audio::MAX_STREAM_CONFIG; ++x) {
@@ -814,16 +833,82 @@ namespace rtsp_stream {
         mapping_p = mapping;
       }
 
-      ss << "a=fmtp:97 surround-params="sv << stream_config.channelCount << stream_config.streams << stream_config.coupledStreams;
+      payload.audio += std::format("a=fmtp:97 surround-params={}{}{}", stream_config.channelCount, stream_config.streams, stream_config.coupledStreams);
 
-      std::for_each_n(mapping_p, stream_config.channelCount, [&ss](std::uint8_t digit) {
-        ss << (char) (digit + '0');
+      std::for_each_n(mapping_p, stream_config.channelCount, [&payload](std::uint8_t digit) {
+        payload.audio += (char) (digit + '0');
       });
 
-      ss << std::endl;
+      payload.audio += '\n';
+    }
+
+    return payload;
+  }
+
+  void prebuild_describe_payload() {
+    std::lock_guard lg {describe_payload_mutex};
+    get_describe_payload();
+  }
+
+  void cmd_describe(rtsp_server_t *server, tcp::socket &sock, launch_session_t &session, msg_t &&req) {
+    OPTION_ITEM option {};
+
+    // I know these string literals will not be modified
+    option.option = const_cast<char *>("CSeq");
+
+    auto seqn_str = std::to_string(req->sequenceNumber);
+    option.content = const_cast<char *>(seqn_str.c_str());
+
+    // Always request new control stream encryption if the client supports it
+    uint32_t encryption_flags_supported = SS_ENC_CONTROL_V2 | SS_ENC_AUDIO;
+    uint32_t encryption_flags_requested = SS_ENC_CONTROL_V2;
+
+    // Determine the encryption desired for this remote endpoint
+    auto encryption_mode = net::encryption_mode_for_address(sock.remote_endpoint().address());
+    if (encryption_mode != config::ENCRYPTION_MODE_NEVER) {
+      // Advertise support for video encryption if it's not disabled
+      encryption_flags_supported |= SS_ENC_VIDEO;
+
+      // Software AES caps the bitrate of slow hosts, clients that can may take ChaCha20-Poly1305 instead
+      if (config::stream.chacha20_video && !crypto::aes_hardware()) {
+        encryption_flags_supported |= stream::SS_ENC_VIDEO_CHACHA20;
+      }
+
+      // If it's mandatory, also request it to enable use if the client
+      // didn't explicitly opt in, but it otherwise has support.
+      if (encryption_mode == config::ENCRYPTION_MODE_MANDATORY) {
+        encryption_flags_requested |= SS_ENC_VIDEO | SS_ENC_AUDIO;
+      }
     }
 
-    respond(sock, session, &option, 200, "OK", req->sequenceNumber, ss.str());
+    // The response buffer keeps its capacity between handshakes
+    static thread_local std::string response;
+
+    {
+      std::lock_guard lg {describe_payload_mutex};
+      auto &payload = get_describe_payload();
+
+      response.assign(payload.capabilities);
+
+      // Report supported and required encryption flags
+      response += std::format("a=x-ss-general.encryptionSupported:{}\n", encryption_flags_supported);
+      response += std::format("a=x-ss-general.encryptionRequested:{}\n", encryption_flags_requested);
+
+      response += payload.codecs;
+
+      if (!session.surround_params.empty()) {
+        // If we have our own surround parameters, advertise them twice first
+        for (int x = 0; x < 2; ++x) {
+          response += "a=fmtp:97 surround-params="sv;
+          response += session.surround_params;
+          response += '\n';
+        }
+      }
+
+      response += payload.audio;
+    }
+
+    respond(sock, session, &option, 200, "OK", req->sequenceNumber, response);
   }
 
   void cmd_setup(rtsp_server_t *server, tcp::socket &sock, launch_session_t &session, msg_t &&req) {
@@ -885,17 +970,14 @@ namespace rtsp_stream {
     respond(sock, session, &seqn, 200, "OK", req->sequenceNumber, {});
   }
 
-  void cmd_announce(rtsp_server_t *server, tcp::socket &sock, launch_session_t &session, msg_t &&req) {
-    OPTION_ITEM option {};
-
-    // I know these string literals will not be modified
-    option.option = const_cast<char *>("CSeq");
-
-    auto seqn_str = std::to_string(req->sequenceNumber);
-    option.content = const_cast<char *>(seqn_str.c_str());
-
-    std::string_view payload {req->payload, (size_t) req->payloadLength};
-
+  /**
+   * @brief Parse the SDP payload of an ANNOUNCE request into its attributes.
+   * Lines are separated by any run of CR and LF, a line that isn't terminated is ignored.
+   * @param payload The SDP payload, the attributes returned point into it.
+   * @param client Receives the session name, the `s=` line.
+   * @return The `a=name:value` attributes, by name.
+   */
+  std::unordered_map<std::string_view, std::string_view> parse_sdp(const std::string_view &payload, std::string_view &client) {
     std::vector<std::string_view> lines;
 
     auto whitespace = [](char ch) {
@@ -917,7 +999,6 @@ namespace rtsp_stream {
       }
     }
 
-    std::string_view client;
     std::unordered_map<std::string_view, std::string_view> args;
 
     for (auto line : lines) {
@@ -926,17 +1007,36 @@ namespace rtsp_stream {
         client = line.substr(2);
       } else if (type == "a=") {
         auto pos = line.find(':');
+        if (pos == std::string_view::npos) {
+          continue;
+        }
 
         auto name = line.substr(2, pos - 2);
         auto val = line.substr(pos + 1);
 
-        if (val[val.size() - 1] == ' ') {
-          val = val.substr(0, val.size() - 1);
+        // The value of an attribute can be empty
+        if (!val.empty() && val.back() == ' ') {
+          val.remove_suffix(1);
         }
         args.emplace(name, val);
       }
     }
 
+    return args;
+  }
+
+  void cmd_announce(rtsp_server_t *server, tcp::socket &sock, launch_session_t &session, msg_t &&req) {
+    OPTION_ITEM option {};
+
+    // I know these string literals will not be modified
+    option.option = const_cast<char *>("CSeq");
+
+    auto seqn_str = std::to_string(req->sequenceNumber);
+    option.content = const_cast<char *>(seqn_str.c_str());
+
+    std::string_view client;
+    auto args = parse_sdp(std::string_view {req->payload, (size_t) req->payloadLength}, client);
+
     // Initialize any omitted parameters to defaults
     args.try_emplace("x-nv-video[0].encoderCscMode"sv, "0"sv);
     args.try_emplace("x-nv-vqos[0].bitStreamFormat"sv, "0"sv);
@@ -974,6 +1074,11 @@ namespace rtsp_stream {
       config.videoQosType = util::from_view(args.at("x-nv-vqos[0].qosTrafficType"sv));
       config.encryptionFlagsEnabled = util::from_view(args.at("x-ss-general.encryptionEnabled"sv));
 
+      // ChaCha20-Poly1305 is only offered by hosts that encrypt AES in software and opted in
+      if (!config::stream.chacha20_video || crypto::aes_hardware()) {
+        config.encryptionFlagsEnabled &= ~stream::SS_ENC_VIDEO_CHACHA20;
+      }
+
       // Legacy clients use nvFeatureFlags to indicate support for audio encryption
       if (util::from_view(args.at("x-nv-general.featureFlags"sv)) & 0x20) {
         config.encryptionFlagsEnabled |= SS_ENC_AUDIO;
@@ -991,6 +1096,9 @@ namespace rtsp_stream {
       config.monitor.dynamicRange = util::from_view(args.at("x-nv-video[0].dynamicRangeMode"sv));
       config.monitor.chromaSamplingType = util::from_view(args.at("x-ss-video[0].chromaSamplingType"sv));
       config.monitor.enableIntraRefresh = util::from_view(args.at("x-ss-video[0].intraRefresh"sv));
+      if (config::video.intra_refresh) {
+        config.monitor.enableIntraRefresh = 1;
+      }
 
       configuredBitrateKbps = util::from_view(args.at("x-ml-video.configuredBitrateKbps"sv));
     } catch (std::out_of_range &) {
@@ -1087,6 +1195,14 @@ namespace rtsp_stream {
       return;
     }
 
+    // The bitrate is final, so the client can be attached to its simulcast rung
+    stream::simulcast::attach(config.monitor);
+
+    // With nothing capturing yet, the display opens while the client connects to the streams
+    if (server->session_count() == 0 && !config::stream.video_fanout && config::stream.simulcast.empty()) {
+      video::prepare_display(config.monitor);
+    }
+
     auto stream_session = stream::session::alloc(config, session);
     server->insert(stream_session);
 
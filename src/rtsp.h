@@ -6,6 +6,7 @@
 
 // standard includes
 #include <atomic>
+#include <chrono>
 
 // local includes
 #include "crypto.h"
@@ -25,6 +26,7 @@ namespace rtsp_stream {
 
     bool host_audio;
     std::string unique_id;
+    std::string client_uuid;  // UUID of the paired client, empty if it couldn't be told apart
     int width;
     int height;
     int fps;
@@ -39,6 +41,9 @@ namespace rtsp_stream {
     std::optional<crypto::cipher::gcm_t> rtsp_cipher;
     std::string rtsp_url_scheme;
     uint32_t rtsp_iv_counter;
+
+    // When the first RTSP message of this session arrived, for logging the setup time of every stage
+    std::chrono::steady_clock::time_point handshake_start {};
   };
 
   void launch_session_raise(std::shared_ptr<launch_session_t> launch_session);
@@ -60,6 +65,12 @@ namespace rtsp_stream {
    */
   void terminate_sessions();
 
+  /**
+   * @brief Build the client independent part of the DESCRIBE response ahead of the first handshake.
+   * @note Call after probing the encoders, a later probe that changes the codec support rebuilds it on demand.
+   */
+  void prebuild_describe_payload();
+
   /**
    * @brief Runs the RTSP server loop.
    */
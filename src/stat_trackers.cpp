@@ -15,4 +15,11 @@ namespace stat_trackers {
     return boost::format("%1$.2f");
   }
 
+  std::size_t thread_shard(std::size_t shards) {
+    static std::atomic<std::size_t> next_thread;
+    thread_local const auto thread = next_thread.fetch_add(1, std::memory_order_relaxed);
+
+    return thread % shards;
+  }
+
 }  // namespace stat_trackers
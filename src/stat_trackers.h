@@ -5,7 +5,13 @@
 #pragma once
 
 // standard includes
+#include <algorithm>
+#include <array>
+#include <atomic>
 #include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
 #include <functional>
 #include <limits>
 
@@ -50,4 +56,154 @@ namespace stat_trackers {
     } data;
   };
 
+  /**
+   * @brief Get the shard the calling thread records into.
+   * Threads are numbered in the order they first record, so the first few threads never share a shard.
+   * @param shards The number of shards.
+   * @return The index of the shard.
+   */
+  std::size_t thread_shard(std::size_t shards);
+
+  /**
+   * @brief Histogram of latencies with log-linear buckets, from 1 microsecond to `2^Octaves` microseconds.
+   * Each doubling of the latency is split in `BucketsPerOctave` buckets of equal width, so a bucket
+   * spans at most `1 / BucketsPerOctave` of its lower bound.
+   *
+   * Recording is lock-free: each thread counts into its own shard of atomic counters, so threads
+   * don't bounce a cache line between them. Readers merge the shards, and may do so while samples
+   * are being recorded.
+   */
+  template<int Octaves, int BucketsPerOctave = 8, int Shards = 4>
+  class log_linear_histogram {
+  public:
+    static constexpr int bucket_count = Octaves * BucketsPerOctave;
+
+    using snapshot_t = std::array<std::uint64_t, bucket_count>;
+
+    /**
+     * @brief Count one sample.
+     * @param latency The sample, clamped to the range of the histogram.
+     */
+    void record(std::chrono::nanoseconds latency) {
+      auto &shard = shards[Shards > 1 ? thread_shard(Shards) : 0];
+
+      // Readers don't need to see the counts in order
+      shard.buckets[bucket(latency)].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Merge the shards into plain counts.
+     * @return The number of samples in each bucket.
+     */
+    snapshot_t snapshot() const {
+      snapshot_t counts {};
+      for (auto &shard : shards) {
+        for (int x = 0; x < bucket_count; ++x) {
+          counts[x] += shard.buckets[x].load(std::memory_order_relaxed);
+        }
+      }
+
+      return counts;
+    }
+
+    /**
+     * @brief Get a percentile of the recorded samples.
+     * @param fraction The percentile as a fraction, e.g. 0.99 for p99.
+     * @return Upper bound in milliseconds of the bucket holding the percentile, 0 if nothing was recorded.
+     */
+    double percentile(double fraction) const {
+      return percentile(snapshot(), fraction);
+    }
+
+    /**
+     * @brief Get a percentile of a snapshot, so several percentiles can be read from the same samples.
+     * @param counts The snapshot.
+     * @param fraction The percentile as a fraction, e.g. 0.99 for p99.
+     * @return Upper bound in milliseconds of the bucket holding the percentile, 0 if the snapshot is empty.
+     */
+    static double percentile(const snapshot_t &counts, double fraction) {
+      std::uint64_t total = 0;
+      for (auto count : counts) {
+        total += count;
+      }
+      if (!total) {
+        return 0;
+      }
+
+      auto rank = std::max<std::uint64_t>(1, (std::uint64_t) std::ceil(fraction * total));
+
+      std::uint64_t seen = 0;
+      for (int x = 0; x < bucket_count; ++x) {
+        seen += counts[x];
+        if (seen >= rank) {
+          return upper_bound(x);
+        }
+      }
+
+      return upper_bound(bucket_count - 1);
+    }
+
+    /**
+     * @brief Get the number of recorded samples.
+     * @return The number of samples.
+     */
+    std::uint64_t count() const {
+      std::uint64_t total = 0;
+      for (auto count : snapshot()) {
+        total += count;
+      }
+
+      return total;
+    }
+
+    /**
+     * @brief Forget the recorded samples.
+     * Samples recorded concurrently may or may not be kept.
+     */
+    void reset() {
+      for (auto &shard : shards) {
+        for (auto &count : shard.buckets) {
+          count.store(0, std::memory_order_relaxed);
+        }
+      }
+    }
+
+  private:
+    static int bucket(std::chrono::nanoseconds latency) {
+      auto us = std::chrono::duration<double, std::micro>(latency).count();
+      if (us < 1) {
+        return 0;
+      }
+
+      // us = mantissa * 2^exponent, with mantissa in [0.5, 1)
+      int exponent;
+      auto mantissa = std::frexp(us, &exponent);
+
+      auto octave = exponent - 1;
+      if (octave >= Octaves) {
+        return bucket_count - 1;
+      }
+
+      return octave * BucketsPerOctave + (int) ((mantissa * 2 - 1) * BucketsPerOctave);
+    }
+
+    static double upper_bound(int bucket) {
+      auto octave = bucket / BucketsPerOctave;
+      auto step = bucket % BucketsPerOctave + 1;
+
+      return std::ldexp(1 + (double) step / BucketsPerOctave, octave) / 1000;
+    }
+
+    struct alignas(64) shard_t {
+      std::array<std::atomic<std::uint64_t>, bucket_count> buckets {};
+    };
+
+    std::array<shard_t, Shards> shards {};
+  };
+
+  /**
+   * @brief Latency histogram spanning 1 microsecond to about 16 seconds.
+   */
+  using latency_histogram_t = log_linear_histogram<24>;
+
 }  // namespace stat_trackers
@@ -4,9 +4,14 @@
  */
 
 // standard includes
+#include <cmath>
+#include <cstdlib>
 #include <fstream>
 #include <future>
+#include <map>
+#include <numeric>
 #include <queue>
+#include <tuple>
 
 // lib includes
 #include <boost/endian/arithmetic.hpp>
@@ -25,14 +30,22 @@ extern "C" {
 #include "globals.h"
 #include "input.h"
 #include "logging.h"
+#include "memory_budget.h"
+#include "metrics.h"
 #include "network.h"
+#include "nvhttp.h"
 #include "platform/common.h"
 #include "process.h"
+#include "rtp_egress.h"
+#include "stat_trackers.h"
 #include "stream.h"
 #include "sync.h"
 #include "system_tray.h"
+#include "thread_pool.h"
 #include "thread_safe.h"
+#include "trace.h"
 #include "utility.h"
+#include "video_dvr.h"
 
 #define IDX_START_A 0
 #define IDX_START_B 1
@@ -239,6 +252,9 @@ namespace stream {
 
   constexpr std::size_t MAX_AUDIO_PACKET_SIZE = 1400;
 
+  // How far audio capture may run ahead of the RTP timestamps before they jump to catch up
+  constexpr auto MAX_AUDIO_CLOCK_DRIFT = 20ms;
+
   using audio_aes_t = std::array<char, round_to_pkcs7_padded(MAX_AUDIO_PACKET_SIZE)>;
 
   using av_session_id_t = std::variant<asio::ip::address, std::string>;  // IP address or SS-Ping-Payload from RTSP handshake
@@ -281,7 +297,12 @@ namespace stream {
     //   session refers to broadcast_ctx_t
     //   broadcast_ctx_t refers to control_server_t
     // Therefore, iterate is implemented further down the source file
-    void iterate(std::chrono::milliseconds timeout);
+    /**
+     * @brief Wait for an event on the control stream, and handle it along with all events ready after it.
+     * @param timeout How long to wait for the first event.
+     * @return The number of events handled.
+     */
+    int iterate(std::chrono::milliseconds timeout);
 
     /**
      * @brief Call the handler for a given control stream message.
@@ -324,6 +345,284 @@ namespace stream {
     net::host_t _host;
   };
 
+  // There are 2 bits for FEC block count for a maximum of 4 FEC blocks
+  constexpr auto MAX_FEC_BLOCKS = 4;
+
+  // Video is paced to leave this many times faster than the stream's bitrate, leaving room for IDR frames
+  constexpr std::uint64_t PACING_BITRATE_MULTIPLE = 20;
+
+  // Zero-copy sends complete as soon as the packets leave the host, this long means they're stuck
+  constexpr auto ZEROCOPY_TIMEOUT = 50ms;
+
+  namespace fec {
+    using rs_t = util::safe_ptr<reed_solomon, [](reed_solomon *rs) {
+      reed_solomon_release(rs);
+    }>;
+
+    // Frames of a steady stream need a handful of shard counts, this only bounds streams that keep changing them
+    constexpr std::size_t MAX_CACHED_CODERS = 1024;
+
+    /**
+     * @brief Coder for a shard count, shared by every FEC block and session that needs it.
+     * Building a coder inverts its encoding matrix, while encoding only reads it.
+     * @param data_shards The number of data shards.
+     * @param parity_shards The number of parity shards.
+     * @return The coder, or nullptr if it couldn't be built.
+     */
+    std::shared_ptr<reed_solomon> cached_coder(size_t data_shards, size_t parity_shards) {
+      static std::mutex lock;
+      static std::map<std::pair<size_t, size_t>, std::shared_ptr<reed_solomon>> coders;
+
+      std::lock_guard lg {lock};
+
+      auto key = std::pair {data_shards, parity_shards};
+      if (auto it = coders.find(key); it != std::end(coders)) {
+        return it->second;
+      }
+
+      auto rs = reed_solomon_new(data_shards, parity_shards);
+      if (!rs) {
+        return nullptr;
+      }
+
+      // Callers keep the coders they use alive, so the cache can simply start over
+      if (coders.size() >= MAX_CACHED_CODERS) {
+        coders.clear();
+      }
+
+      std::shared_ptr<reed_solomon> coder {rs, reed_solomon_release};
+      coders.emplace(key, coder);
+      return coder;
+    }
+
+    /**
+     * @brief Shard memory for one FEC block, reused from frame to frame.
+     * The buffers are sized for the largest block the protocol allows when first used,
+     * and only grow for abnormally large frames sent without FEC.
+     * With a memory budget they only grow as large as the blocks sent so far, and are locked in RAM.
+     */
+    struct buffers_t {
+      buffers_t() = default;
+      buffers_t(const buffers_t &) = delete;
+      buffers_t &operator=(const buffers_t &) = delete;
+
+      ~buffers_t() {
+        release(shards);
+        release(headers);
+      }
+
+      void reserve(size_t nr_shards, size_t blocksize, size_t prefixsize) {
+        if (!memory_budget::enabled()) {
+          nr_shards = std::max<size_t>(nr_shards, DATA_SHARDS_MAX);
+        }
+
+        // At most the zero-padded final data shard and the parity shards are stored here
+        if (shards.size() < nr_shards * blocksize) {
+          replace(shards, nr_shards * blocksize);
+        }
+        if (headers.size() < nr_shards * prefixsize) {
+          replace(headers, nr_shards * prefixsize);
+        }
+        if (shards_p.size() < nr_shards) {
+          shards_p = util::buffer_t<uint8_t *> {nr_shards};
+        }
+        if (payload_buffers.capacity() < 2) {
+          payload_buffers.reserve(2);
+        }
+      }
+
+      static void release(util::buffer_t<char> &buffer) {
+        memory_budget::unlock(buffer.begin(), buffer.size());
+        memory_budget::account(memory_budget::subsystem_e::fec_buffers, -(std::int64_t) buffer.size());
+      }
+
+      static void replace(util::buffer_t<char> &buffer, size_t size) {
+        release(buffer);
+        buffer = util::buffer_t<char> {size};
+        memory_budget::lock(buffer.begin(), buffer.size());
+        memory_budget::account(memory_budget::subsystem_e::fec_buffers, (std::int64_t) buffer.size());
+      }
+
+      util::buffer_t<char> shards;
+      util::buffer_t<char> headers;
+      util::buffer_t<uint8_t *> shards_p;
+      std::vector<platf::buffer_descriptor_t> payload_buffers;
+
+      // Consecutive frames mostly need the same shard counts, so the last coder is kept without a cache lookup
+      std::shared_ptr<reed_solomon> rs;
+      size_t rs_data_shards {};
+      size_t rs_parity_shards {};
+    };
+
+    /**
+     * @brief An encoded FEC block.
+     * It only points into the payload and the buffers_t the block was encoded with.
+     */
+    struct fec_t {
+      size_t data_shards;
+      size_t nr_shards;
+      size_t percentage;
+
+      size_t blocksize;
+      size_t prefixsize;
+      char *headers;
+      uint8_t **shards_p;
+
+      std::vector<platf::buffer_descriptor_t> &payload_buffers;
+
+      char *data(size_t el) {
+        return (char *) shards_p[el];
+      }
+
+      char *prefix(size_t el) {
+        return prefixsize ? &headers[el * prefixsize] : nullptr;
+      }
+
+      size_t size() const {
+        return nr_shards;
+      }
+    };
+
+    struct layout_t {
+      size_t data_shards;
+      size_t parity_shards;
+      size_t percentage;
+
+      size_t nr_shards() const {
+        return data_shards + parity_shards;
+      }
+    };
+
+    /**
+     * @brief Compute how many shards encode() will produce for a payload.
+     * @param payload_size The size of the payload.
+     * @param blocksize The size of each shard.
+     * @param fecpercentage The requested FEC percentage.
+     * @param minparityshards The minimum number of parity shards.
+     * @return The number of data and parity shards, and the effective FEC percentage.
+     */
+    static layout_t layout(size_t payload_size, size_t blocksize, size_t fecpercentage, size_t minparityshards) {
+      auto data_shards = payload_size / blocksize + (payload_size % blocksize != 0 ? 1 : 0);
+      auto parity_shards = (data_shards * fecpercentage + 99) / 100;
+
+      // increase the FEC percentage for this frame if the parity shard minimum is not met
+      if (parity_shards < minparityshards && fecpercentage != 0) {
+        parity_shards = minparityshards;
+        fecpercentage = (100 * parity_shards) / data_shards;
+      }
+
+      return {data_shards, parity_shards, fecpercentage};
+    }
+
+    /**
+     * @brief Get the highest FEC percentage up to the requested one at which a payload fits in a number of FEC blocks.
+     * The payload is split into the blocks the way the video broadcast thread splits frames.
+     * @param payload_size The size of the payload.
+     * @param blocksize The size of each shard.
+     * @param blocks The number of FEC blocks.
+     * @param fecpercentage The requested FEC percentage.
+     * @param minparityshards The minimum number of parity shards.
+     * @return The percentage, or 0 if not even the minimum number of parity shards fits.
+     */
+    size_t fitting_percentage(size_t payload_size, size_t blocksize, size_t blocks, size_t fecpercentage, size_t minparityshards) {
+      // The blocks are aligned to the shard size and the last one takes the rest, so either may hold the most shards
+      auto aligned_size = ((payload_size / blocks + (blocksize - 1)) / blocksize) * blocksize;
+      auto last_size = payload_size > (blocks - 1) * aligned_size ? payload_size - (blocks - 1) * aligned_size : 0;
+      auto data_shards = std::max(aligned_size / blocksize, (last_size + (blocksize - 1)) / blocksize);
+      if (data_shards == 0) {
+        return fecpercentage;
+      }
+      if (data_shards >= DATA_SHARDS_MAX) {
+        return 0;
+      }
+
+      size_t parity_shards = DATA_SHARDS_MAX - data_shards;
+      if (parity_shards < minparityshards) {
+        return 0;
+      }
+
+      return std::min(fecpercentage, parity_shards * 100 / data_shards);
+    }
+
+    static fec_t encode(const std::string_view &payload, size_t blocksize, size_t fecpercentage, size_t minparityshards, size_t prefixsize, buffers_t &buffers) {
+      auto payload_size = payload.size();
+
+      auto pad = payload_size % blocksize != 0;
+
+      auto aligned_data_shards = payload_size / blocksize;
+      auto [data_shards, parity_shards, percentage] = layout(payload_size, blocksize, fecpercentage, minparityshards);
+      if (percentage != fecpercentage) {
+        fecpercentage = percentage;
+
+        BOOST_LOG(verbose) << "Increasing FEC percentage to "sv << fecpercentage << " to meet parity shard minimum"sv << std::endl;
+      }
+
+      auto nr_shards = data_shards + parity_shards;
+      buffers.reserve(nr_shards, blocksize, prefixsize);
+
+      // If we need to store a zero-padded data shard, it comes first
+      // to keep the shards in order
+      auto parity_shard_offset = pad ? 1 : 0;
+      auto &shards = buffers.shards;
+      auto &shards_p = buffers.shards_p;
+      auto &payload_buffers = buffers.payload_buffers;
+      payload_buffers.clear();
+
+      // Point into the payload buffer for all except the final padded data shard
+      auto next = std::begin(payload);
+      for (auto x = 0; x < aligned_data_shards; ++x) {
+        shards_p[x] = (uint8_t *) next;
+        next += blocksize;
+      }
+      payload_buffers.emplace_back(std::begin(payload), aligned_data_shards * blocksize);
+
+      // If the last data shard needs to be zero-padded, we must use the shards buffer
+      if (pad) {
+        shards_p[aligned_data_shards] = (uint8_t *) &shards[0];
+
+        // GCC doesn't figure out that std::copy_n() can be replaced with memcpy() here
+        // and ends up compiling a horribly slow element-by-element copy loop, so we
+        // help it by using memcpy()/memset() directly.
+        auto copy_len = std::min<size_t>(blocksize, std::end(payload) - next);
+        std::memcpy(shards_p[aligned_data_shards], next, copy_len);
+        if (copy_len < blocksize) {
+          // Zero any additional space after the end of the payload
+          std::memset(shards_p[aligned_data_shards] + copy_len, 0, blocksize - copy_len);
+        }
+      }
+
+      // Add a payload buffer describing the part of the shard buffer in use
+      payload_buffers.emplace_back(std::begin(shards), (parity_shard_offset + parity_shards) * blocksize);
+
+      if (fecpercentage != 0) {
+        // Point into our allocated buffer for the parity shards
+        for (auto x = 0; x < parity_shards; ++x) {
+          shards_p[data_shards + x] = (uint8_t *) &shards[(parity_shard_offset + x) * blocksize];
+        }
+
+        // packets = parity_shards + data_shards
+        if (!buffers.rs || buffers.rs_data_shards != data_shards || buffers.rs_parity_shards != parity_shards) {
+          buffers.rs = cached_coder(data_shards, parity_shards);
+          buffers.rs_data_shards = data_shards;
+          buffers.rs_parity_shards = parity_shards;
+        }
+
+        reed_solomon_encode(buffers.rs.get(), shards_p.begin(), nr_shards, blocksize);
+      }
+
+      return {
+        data_shards,
+        nr_shards,
+        fecpercentage,
+        blocksize,
+        prefixsize,
+        buffers.headers.begin(),
+        shards_p.begin(),
+        payload_buffers,
+      };
+    }
+  }  // namespace fec
+
   struct broadcast_ctx_t {
     message_queue_queue_t message_queue_queue;
 
@@ -337,7 +636,92 @@ namespace stream {
     udp::socket video_sock {io_context};
     udp::socket audio_sock {io_context};
 
+    // Send buffer asked for on the video socket, grown for the largest frames of any session
+    std::mutex video_send_buffer_lock;
+    int video_send_buffer = 0;
+
     control_server_t control_server;
+
+    // Zero point of the audio and video RTP timestamps, so clients can line both streams up
+    std::chrono::steady_clock::time_point epoch;
+  };
+
+  struct session_t;
+
+  /**
+   * @brief Sessions sharing the output of a single encoder.
+   * FEC, encryption and pacing still run per session in the video broadcast thread.
+   */
+  struct fanout_t {
+    video::config_t config;
+
+    // Guards the rest, the broadcast thread only holds it to take the viewers of a frame
+    std::mutex lock;
+    std::condition_variable encoder_changed;
+    std::condition_variable frame_sent;
+
+    // Every session watching the stream, the first one runs the encoder
+    std::vector<session_t *> viewers;
+
+    // Frames the broadcast threads are sending to the viewers they took, a leaving session waits for them
+    int sending = 0;
+
+    // What the encoder last told its session about the display, for the viewers joining later
+    std::optional<video::hdr_info_raw_t> hdr;
+    std::optional<input::touch_port_t> touch_port;
+  };
+
+  /**
+   * @brief Video send path statistics of a session, read by session::network_stats().
+   */
+  struct network_telemetry_t {
+    /**
+     * @brief A min_max_avg_tracker that keeps the result of its last interval around.
+     */
+    struct tracked_t {
+      void collect(std::int64_t value) {
+        tracker.collect_and_callback_on_interval(value, [this](std::int64_t stat_min, std::int64_t stat_max, double stat_avg) {
+          last = {stat_min, stat_max, stat_avg};
+        }, 1s);
+      }
+
+      stat_trackers::min_max_avg_tracker<std::int64_t> tracker;
+      session::stat_t last {};
+    };
+
+    // Written by the video broadcast thread, read by the web UI
+    std::mutex lock;
+
+    std::uint64_t bytes_sent = 0;
+    std::uint64_t packets_sent = 0;
+    std::uint64_t frames_sent = 0;
+    std::uint64_t frames_dropped = 0;
+    std::uint64_t frames_lost = 0;
+    std::uint64_t send_batch_fallbacks = 0;
+    std::uint64_t pacing_sleeps = 0;
+    std::uint64_t send_buffer_full = 0;
+
+    tracked_t fec_percentage;
+    tracked_t batch_size;
+    tracked_t pacing_sleep_us;
+    tracked_t send_queue_bytes;
+    tracked_t encryption_us;
+
+    /**
+     * @brief Per stage frame latency.
+     * Only the video broadcast thread records, so the histograms are read without taking the lock.
+     */
+    struct stage_histograms_t {
+      stat_trackers::latency_histogram_t capture;
+      stat_trackers::latency_histogram_t convert;
+      stat_trackers::latency_histogram_t encode;
+      stat_trackers::latency_histogram_t fec;
+      stat_trackers::latency_histogram_t send;
+      stat_trackers::latency_histogram_t total;
+      stat_trackers::latency_histogram_t vsync_phase_error;
+
+      std::chrono::steady_clock::time_point last_log = std::chrono::steady_clock::now();
+    } latency;
   };
 
   struct session_t {
@@ -352,6 +736,25 @@ namespace stream {
 
     std::chrono::steady_clock::time_point pingTimeout;
 
+    // Held while the client dropped off the control stream within resume_grace_period, see resume
+    struct {
+      std::atomic<bool> paused;  ///< Nothing is sent to the client while set
+      std::chrono::steady_clock::time_point deadline;
+
+      // Pings of the client on the video and audio ports, they tell where it reconnected from
+      message_queue_t video_pings;
+      message_queue_t audio_pings;
+      std::optional<udp::endpoint> video_peer;
+      std::optional<udp::endpoint> audio_peer;
+
+      // The peers the client resumed from, taken over by the send threads, which alone write video.peer and audio.peer
+      safe::event_t<udp::endpoint> video_handoff;
+      safe::event_t<udp::endpoint> audio_handoff;
+    } resume;
+
+    // When the RTSP handshake of the session started, the start-up is traced from there
+    std::chrono::steady_clock::time_point handshake_start;
+
     safe::shared_t<broadcast_ctx_t>::ptr_t broadcast_ref;
 
     boost::asio::ip::address localAddress;
@@ -362,13 +765,83 @@ namespace stream {
       int lowseq;
       udp::endpoint peer;
 
-      std::optional<crypto::cipher::gcm_t> cipher;
+      // One context per FEC block, so the blocks of a frame can be sealed in parallel
+      std::optional<std::array<crypto::cipher::gcm_t, MAX_FEC_BLOCKS>> ciphers;
       std::uint64_t gcm_iv_counter;
 
       safe::mail_raw_t::event_t<bool> idr_events;
       safe::mail_raw_t::event_t<std::pair<int64_t, int64_t>> invalidate_ref_frames_events;
 
       std::unique_ptr<platf::deinit_t> qos;
+
+      // Reused across frames, so sending a frame doesn't allocate
+      std::vector<std::string_view> payload_segments;
+      std::vector<uint8_t> payload_buffer;
+      std::array<fec::buffers_t, MAX_FEC_BLOCKS> fec_buffers;
+
+      // FEC percentage of the next frame, adapted by the control stream when adaptive_fec is enabled
+      std::atomic<int> fec_percentage;
+      std::chrono::steady_clock::time_point fec_last_raise;
+      std::chrono::milliseconds fec_clean_time;
+
+      // Bitrate the encoder currently runs at, lowered by the control stream when adaptive_bitrate is enabled
+      safe::mail_raw_t::event_t<int> bitrate_events;
+      std::atomic<int> bitrate_kbps;
+      // Bitrate this client can take, an encoder shared with other sessions runs at the lowest one of them
+      std::atomic<int> target_kbps;
+      std::chrono::steady_clock::time_point bitrate_last_lower;
+      std::chrono::milliseconds bitrate_clean_time;
+
+      // Rate the probe measured the path to the client at, zero until it did
+      std::atomic<std::uint64_t> path_capacity_bps;
+
+      // Largest IP packet the path to the client carries unfragmented, zero until probed
+      std::atomic<int> path_mtu;
+      struct {
+        bool pending;
+        std::chrono::steady_clock::time_point until;
+        std::uint64_t peak_bps;
+        std::atomic<bool> lost;
+      } probe;
+
+      // Set when the session shares an encoder with other sessions watching the same stream
+      std::shared_ptr<fanout_t> fanout;
+
+      // The touch port the encoder raises, and the one the input of the session reads
+      safe::mail_raw_t::event_t<input::touch_port_t> touch_port_events;
+      safe::mail_raw_t::event_t<input::touch_port_t> input_touch_port_events;
+
+      // The encoder frames last came from, and what the client's frame numbers are ahead of the encoder's
+      session_t *frame_source;
+      std::int64_t last_frame_index;
+      std::atomic<std::int64_t> frame_index_offset;
+
+      // Header of the data packets before they're numbered, the fields that stay the same are filled in once
+      video_packet_raw_t packet_template;
+
+      // RTP timestamp of the last frame, the later parts of a frame sent in parts carry it too
+      std::uint32_t frame_rtp_timestamp;
+
+      // Set after a late frame was dropped, frames are dropped until the encoder's recovery frame arrives
+      bool awaiting_recovery;
+      std::chrono::steady_clock::time_point recovery_deadline;
+
+      // The video send thread this session's frames go out on, taken modulo the number of threads
+      std::uint32_t send_shard;
+
+      // Round trip time of the control stream, refreshed whenever the client checks in
+      std::atomic<std::uint32_t> rtt_ms;
+
+      // Phase of the frame interval the frames arrive at the client, see vsync_phase
+      safe::mail_raw_t::event_t<std::chrono::nanoseconds> capture_phase_events;
+      struct {
+        std::chrono::steady_clock::time_point epoch;  ///< Start of the frame grid the phase is taken on
+        std::chrono::steady_clock::time_point settle_until;  ///< Until the phase is learned, or a shift took effect
+        double sum_cos;
+        double sum_sin;
+        std::optional<double> target;  ///< Phase the client presents at, as a fraction of the frame interval
+        double error;  ///< Smoothed distance of the arrivals from the target, as a fraction of the frame interval
+      } vsync;
     } video;
 
     struct {
@@ -384,7 +857,15 @@ namespace stream {
       util::buffer_t<char> shards;
       util::buffer_t<uint8_t *> shards_p;
 
-      audio_fec_packet_t fec_packet;
+      // Headers of the parity shards of an FEC block, contiguous so they go out in a single batch
+      std::array<audio_fec_packet_t, RTPA_FEC_SHARDS> fec_packets;
+      std::vector<platf::buffer_descriptor_t> fec_payloads;
+
+      // Whether the FEC blocks get parity shards, dropped on clean links when adaptive_fec is enabled
+      std::atomic<bool> parity;
+
+      // Packet loss the audio encoder was last told to expect
+      int expected_loss;
       std::unique_ptr<platf::deinit_t> qos;
     } audio;
 
@@ -402,10 +883,19 @@ namespace stream {
 
       platf::feedback_queue_t feedback_queue;
       safe::mail_raw_t::event_t<video::hdr_info_t> hdr_queue;
+
+      // Latest feedback per controller and kind not sent yet, and when it may be sent next
+      std::map<std::tuple<std::uint16_t, platf::gamepad_feedback_e, std::uint8_t>, platf::gamepad_feedback_msg_t> pending_feedback;
+      std::chrono::steady_clock::time_point next_feedback_flush;
     } control;
 
     std::uint32_t launch_session_id;
 
+    // UUID of the paired client, its learned stream profile is kept under it
+    std::string client_uuid;
+
+    network_telemetry_t telemetry;
+
     safe::mail_raw_t::event_t<bool> shutdown_event;
     safe::signal_t controlEnd;
 
@@ -472,6 +962,10 @@ namespace stream {
   int start_broadcast(broadcast_ctx_t &ctx);
   void end_broadcast(broadcast_ctx_t &ctx);
 
+  namespace resume {
+    bool detach(control_server_t &server, session_t *session);
+  }  // namespace resume
+
   static auto broadcast = safe::make_shared<broadcast_ctx_t>(start_broadcast, end_broadcast);
 
   session_t *control_server_t::get_session(const net::peer_t peer, uint32_t connect_data) {
@@ -515,6 +1009,9 @@ namespace stream {
       rtsp_stream::launch_session_clear(session_p->launch_session_id);
 
       session_p->control.peer = peer;
+      if (session_p->resume.paused.load(std::memory_order_relaxed)) {
+        BOOST_LOG(info) << "Client reconnected to its paused session from "sv << peer_addr << ':' << peer_port;
+      }
 
       // Use the local address from the control connection as the source address
       // for other communications to the client. This is necessary to ensure
@@ -534,6 +1031,65 @@ namespace stream {
     return nullptr;
   }
 
+  /**
+   * @brief Decrypt a message of the encrypted control stream.
+   * @param cipher The cipher keyed for the control stream of the session.
+   * @param iv Receives the IV of the message, the buffer is reused between messages.
+   * @param v2 `true` if the client builds the IV as specified by SS_ENC_CONTROL_V2.
+   * @param message The message as it came off the wire, starting with its type.
+   * @param plaintext Receives the secondary header and the payload, at least 4 bytes.
+   * @return 0 on success, -1 if the message is too short for what it holds, -2 if its tag doesn't verify.
+   */
+  int decrypt_control(crypto::cipher::gcm_t &cipher, crypto::aes_t &iv, bool v2, const std::string_view &message, std::vector<uint8_t> &plaintext) {
+    if (message.size() < sizeof(control_encrypted_t)) {
+      return -1;
+    }
+
+    auto header = (control_encrypted_p) message.data();
+
+    auto length = util::endian::little(header->length);
+    auto seq = util::endian::little(header->seq);
+
+    // The length counts the sequence number, the tag and at least the secondary header, all of which must have arrived
+    if (length < (16 + 4 + 4) || length - sizeof(header->seq) > message.size() - sizeof(control_encrypted_t)) {
+      return -1;
+    }
+
+    auto tagged_cipher_length = length - 4;
+    std::string_view tagged_cipher {(char *) header->payload(), (size_t) tagged_cipher_length};
+
+    if (v2) {
+      // We use the deterministic IV construction algorithm specified in NIST SP 800-38D
+      // Section 8.2.1. The sequence number is our "invocation" field and the 'CC' in the
+      // high bytes is the "fixed" field. Because each client provides their own unique
+      // key, our values in the fixed field need only uniquely identify each independent
+      // use of the client's key with AES-GCM in our code.
+      //
+      // The sequence number is 32 bits long which allows for 2^32 control stream messages
+      // to be received from each client before the IV repeats.
+      iv.resize(12);
+      std::copy_n((uint8_t *) &seq, sizeof(seq), std::begin(iv));
+      iv[10] = 'C';  // Client originated
+      iv[11] = 'C';  // Control stream
+    } else {
+      // Nvidia's old style encryption uses a 16-byte IV
+      iv.resize(16);
+
+      iv[0] = (std::uint8_t) seq;
+    }
+
+    if (cipher.decrypt(tagged_cipher, plaintext, &iv)) {
+      return -2;
+    }
+
+    // A cipher can be padded to the secondary header without holding one
+    if (plaintext.size() < 4) {
+      return -1;
+    }
+
+    return 0;
+  }
+
   /**
    * @brief Call the handler for a given control stream message.
    * @param type The message type.
@@ -560,17 +1116,21 @@ namespace stream {
     }
   }
 
-  void control_server_t::iterate(std::chrono::milliseconds timeout) {
+  int control_server_t::iterate(std::chrono::milliseconds timeout) {
     ENetEvent event;
     auto res = enet_host_service(_host.get(), &event, timeout.count());
 
-    if (res > 0) {
+    // Bursts of input queue up several events, handle them all before the sessions are walked again
+    int events = 0;
+    for (; res > 0; res = enet_host_check_events(_host.get(), &event)) {
+      ++events;
+
       auto session = get_session(event.peer, event.data);
       if (!session) {
         BOOST_LOG(warning) << "Rejected connection from ["sv << platf::from_sockaddr((sockaddr *) &event.peer->address.address) << "]: it's not properly set up"sv;
         enet_peer_disconnect_now(event.peer, 0);
 
-        return;
+        continue;
       }
 
       session->pingTimeout = std::chrono::steady_clock::now() + config::stream.ping_timeout;
@@ -580,6 +1140,11 @@ namespace stream {
           {
             net::packet_t packet {event.packet};
 
+            if (packet->dataLength < sizeof(std::uint16_t)) {
+              BOOST_LOG(warning) << "Control: Runt packet"sv;
+              break;
+            }
+
             auto type = *(std::uint16_t *) packet->data;
             std::string_view payload {(char *) packet->data + sizeof(type), packet->dataLength - sizeof(type)};
 
@@ -592,7 +1157,7 @@ namespace stream {
         case ENET_EVENT_TYPE_DISCONNECT:
           BOOST_LOG(info) << "CLIENT DISCONNECTED"sv;
           // No more clients to send video data to ^_^
-          if (session->state == session::state_e::RUNNING) {
+          if (session->state == session::state_e::RUNNING && !resume::detach(*this, session)) {
             session::stop(*session);
           }
           break;
@@ -600,323 +1165,1283 @@ namespace stream {
           break;
       }
     }
+
+    return events;
   }
 
-  namespace fec {
-    using rs_t = util::safe_ptr<reed_solomon, [](reed_solomon *rs) {
-      reed_solomon_release(rs);
-    }>;
+  /**
+   * @brief Combines buffers and inserts new buffers at each slice boundary of the result.
+   * @param result Receives the combined data, its allocation is reused.
+   * @param insert_size The number of bytes to insert.
+   * @param slice_size The number of bytes between insertions.
+   * @param segments The data buffers, in order.
+   * @param insert_template Copied into each inserted buffer, they're zeroed if null.
+   */
+  void gather_and_insert(std::vector<uint8_t> &result, uint64_t insert_size, uint64_t slice_size, const std::vector<std::string_view> &segments, const void *insert_template = nullptr) {
+    uint64_t data_size = 0;
+    for (auto &segment : segments) {
+      data_size += segment.size();
+    }
 
-    struct fec_t {
-      size_t data_shards;
-      size_t nr_shards;
-      size_t percentage;
+    auto pad = data_size % slice_size != 0;
+    auto elements = data_size / slice_size + (pad ? 1 : 0);
 
-      size_t blocksize;
-      size_t prefixsize;
-      util::buffer_t<char> shards;
-      util::buffer_t<char> headers;
-      util::buffer_t<uint8_t *> shards_p;
+    // Reusing the buffer of a previous call doesn't allocate unless this result is larger
+    result.resize(elements * insert_size + data_size);
 
-      std::vector<platf::buffer_descriptor_t> payload_buffers;
+    auto segment = std::begin(segments);
+    uint64_t segment_offset = 0;
+    for (auto x = 0; x < elements; ++x) {
+      auto p = &result[x * (insert_size + slice_size)];
 
-      char *data(size_t el) {
-        return (char *) shards_p[el];
+      // The inserted space may hold data from a previous call
+      if (insert_template) {
+        std::memcpy(p, insert_template, insert_size);
+      } else {
+        std::memset(p, 0, insert_size);
       }
+      p += insert_size;
 
-      char *prefix(size_t el) {
-        return prefixsize ? &headers[el * prefixsize] : nullptr;
+      // For the last iteration, only copy to the end of the data
+      if (x == elements - 1) {
+        slice_size = data_size - (x * slice_size);
       }
 
-      size_t size() const {
-        return nr_shards;
+      // A slice may span several buffers
+      for (auto remaining = slice_size; remaining > 0;) {
+        auto copy_len = std::min<uint64_t>(remaining, segment->size() - segment_offset);
+        std::memcpy(p, segment->data() + segment_offset, copy_len);
+
+        p += copy_len;
+        remaining -= copy_len;
+        segment_offset += copy_len;
+        if (segment_offset == segment->size()) {
+          ++segment;
+          segment_offset = 0;
+        }
       }
-    };
+    }
+  }
 
-    static fec_t encode(const std::string_view &payload, size_t blocksize, size_t fecpercentage, size_t minparityshards, size_t prefixsize) {
-      auto payload_size = payload.size();
+  /**
+   * @brief Combines two buffers and inserts new buffers at each slice boundary of the result.
+   * @param insert_size The number of bytes to insert.
+   * @param slice_size The number of bytes between insertions.
+   * @param data1 The first data buffer.
+   * @param data2 The second data buffer.
+   */
+  void concat_and_insert(std::vector<uint8_t> &result, uint64_t insert_size, uint64_t slice_size, const std::string_view &data1, const std::string_view &data2) {
+    gather_and_insert(result, insert_size, slice_size, {data1, data2});
+  }
 
-      auto pad = payload_size % blocksize != 0;
+  std::vector<uint8_t> concat_and_insert(uint64_t insert_size, uint64_t slice_size, const std::string_view &data1, const std::string_view &data2) {
+    std::vector<uint8_t> result;
+    concat_and_insert(result, insert_size, slice_size, data1, data2);
 
-      auto aligned_data_shards = payload_size / blocksize;
-      auto data_shards = aligned_data_shards + (pad ? 1 : 0);
-      auto parity_shards = (data_shards * fecpercentage + 99) / 100;
+    return result;
+  }
 
-      // increase the FEC percentage for this frame if the parity shard minimum is not met
-      if (parity_shards < minparityshards && fecpercentage != 0) {
-        parity_shards = minparityshards;
-        fecpercentage = (100 * parity_shards) / data_shards;
+  /**
+   * @brief Split a payload into segments with the replacements applied, without copying the payload.
+   * Like replacing in the payload itself, only the first match of each replacement is replaced.
+   * A replacement isn't matched across the boundary of an earlier replacement.
+   * @param segments Receives the segments, after the ones it already holds.
+   * @param payload The payload.
+   * @param replacements The replacements, applied in order.
+   */
+  void split_replacements(std::vector<std::string_view> &segments, const std::string_view &payload, const std::vector<video::packet_raw_t::replace_t> &replacements) {
+    auto first = segments.size();
+    segments.emplace_back(payload);
 
-        BOOST_LOG(verbose) << "Increasing FEC percentage to "sv << fecpercentage << " to meet parity shard minimum"sv << std::endl;
+    // Segments holding replaced data must not be searched again
+    std::vector<bool> replaced(1, false);
+
+    for (auto &replacement : replacements) {
+      for (auto x = first; x < segments.size(); ++x) {
+        if (replaced[x - first]) {
+          continue;
+        }
+
+        auto segment = segments[x];
+        auto pos = segment.find(replacement.old);
+        if (pos == std::string_view::npos) {
+          continue;
+        }
+
+        auto after = segment.substr(pos + replacement.old.size());
+        segments[x] = segment.substr(0, pos);
+        segments.insert(std::begin(segments) + x + 1, {replacement._new, after});
+        replaced.insert(std::begin(replaced) + (x - first) + 1, {true, false});
+        break;
       }
+    }
+  }
 
-      auto nr_shards = data_shards + parity_shards;
+  /**
+   * @brief Pass gamepad feedback data back to the client.
+   * @param session The session object.
+   * @param msg The message to pass.
+   * @return 0 on success.
+   */
+  int send_feedback_msg(session_t *session, platf::gamepad_feedback_msg_t &msg) {
+    if (!session->control.peer) {
+      BOOST_LOG(warning) << "Couldn't send gamepad feedback data, still waiting for PING from Moonlight"sv;
+      // Still waiting for PING from Moonlight
+      return -1;
+    }
 
-      // If we need to store a zero-padded data shard, allocate that first to
-      // to keep the shards in order and reduce buffer fragmentation
-      auto parity_shard_offset = pad ? 1 : 0;
-      util::buffer_t<char> shards {(parity_shard_offset + parity_shards) * blocksize};
-      util::buffer_t<uint8_t *> shards_p {nr_shards};
-      std::vector<platf::buffer_descriptor_t> payload_buffers;
-      payload_buffers.reserve(2);
+    std::string payload;
+    if (msg.type == platf::gamepad_feedback_e::rumble) {
+      control_rumble_t plaintext;
+      plaintext.header.type = packetTypes[IDX_RUMBLE_DATA];
+      plaintext.header.payloadLength = sizeof(plaintext) - sizeof(control_header_v2);
 
-      // Point into the payload buffer for all except the final padded data shard
-      auto next = std::begin(payload);
-      for (auto x = 0; x < aligned_data_shards; ++x) {
-        shards_p[x] = (uint8_t *) next;
-        next += blocksize;
+      auto &data = msg.data.rumble;
+
+      plaintext.useless = 0xC0FFEE;
+      plaintext.id = util::endian::little(msg.id);
+      plaintext.lowfreq = util::endian::little(data.lowfreq);
+      plaintext.highfreq = util::endian::little(data.highfreq);
+
+      BOOST_LOG(verbose) << "Rumble: "sv << msg.id << " :: "sv << util::hex(data.lowfreq).to_string_view() << " :: "sv << util::hex(data.highfreq).to_string_view();
+      std::array<std::uint8_t, sizeof(control_encrypted_t) + crypto::cipher::round_to_pkcs7_padded(sizeof(plaintext)) + crypto::cipher::tag_size>
+        encrypted_payload;
+
+      payload = encode_control(session, util::view(plaintext), encrypted_payload);
+    } else if (msg.type == platf::gamepad_feedback_e::rumble_triggers) {
+      control_rumble_triggers_t plaintext;
+      plaintext.header.type = packetTypes[IDX_RUMBLE_TRIGGER_DATA];
+      plaintext.header.payloadLength = sizeof(plaintext) - sizeof(control_header_v2);
+
+      auto &data = msg.data.rumble_triggers;
+
+      plaintext.id = util::endian::little(msg.id);
+      plaintext.left = util::endian::little(data.left_trigger);
+      plaintext.right = util::endian::little(data.right_trigger);
+
+      BOOST_LOG(verbose) << "Rumble triggers: "sv << msg.id << " :: "sv << util::hex(data.left_trigger).to_string_view() << " :: "sv << util::hex(data.right_trigger).to_string_view();
+      std::array<std::uint8_t, sizeof(control_encrypted_t) + crypto::cipher::round_to_pkcs7_padded(sizeof(plaintext)) + crypto::cipher::tag_size>
+        encrypted_payload;
+
+      payload = encode_control(session, util::view(plaintext), encrypted_payload);
+    } else if (msg.type == platf::gamepad_feedback_e::set_motion_event_state) {
+      control_set_motion_event_t plaintext;
+      plaintext.header.type = packetTypes[IDX_SET_MOTION_EVENT];
+      plaintext.header.payloadLength = sizeof(plaintext) - sizeof(control_header_v2);
+
+      auto &data = msg.data.motion_event_state;
+
+      plaintext.id = util::endian::little(msg.id);
+      plaintext.reportrate = util::endian::little(data.report_rate);
+      plaintext.type = data.motion_type;
+
+      BOOST_LOG(verbose) << "Motion event state: "sv << msg.id << " :: "sv << util::hex(data.report_rate).to_string_view() << " :: "sv << util::hex(data.motion_type).to_string_view();
+      std::array<std::uint8_t, sizeof(control_encrypted_t) + crypto::cipher::round_to_pkcs7_padded(sizeof(plaintext)) + crypto::cipher::tag_size>
+        encrypted_payload;
+
+      payload = encode_control(session, util::view(plaintext), encrypted_payload);
+    } else if (msg.type == platf::gamepad_feedback_e::set_rgb_led) {
+      control_set_rgb_led_t plaintext;
+      plaintext.header.type = packetTypes[IDX_SET_RGB_LED];
+      plaintext.header.payloadLength = sizeof(plaintext) - sizeof(control_header_v2);
+
+      auto &data = msg.data.rgb_led;
+
+      plaintext.id = util::endian::little(msg.id);
+      plaintext.r = data.r;
+      plaintext.g = data.g;
+      plaintext.b = data.b;
+
+      BOOST_LOG(verbose) << "RGB: "sv << msg.id << " :: "sv << util::hex(data.r).to_string_view() << util::hex(data.g).to_string_view() << util::hex(data.b).to_string_view();
+      std::array<std::uint8_t, sizeof(control_encrypted_t) + crypto::cipher::round_to_pkcs7_padded(sizeof(plaintext)) + crypto::cipher::tag_size>
+        encrypted_payload;
+
+      payload = encode_control(session, util::view(plaintext), encrypted_payload);
+    } else if (msg.type == platf::gamepad_feedback_e::set_adaptive_triggers) {
+      control_adaptive_triggers_t plaintext;
+      plaintext.header.type = packetTypes[IDX_SET_ADAPTIVE_TRIGGERS];
+      plaintext.header.payloadLength = sizeof(plaintext) - sizeof(control_header_v2);
+
+      plaintext.id = util::endian::little(msg.id);
+      plaintext.event_flags = msg.data.adaptive_triggers.event_flags;
+      plaintext.type_left = msg.data.adaptive_triggers.type_left;
+      std::ranges::copy(msg.data.adaptive_triggers.left, plaintext.left);
+      plaintext.type_right = msg.data.adaptive_triggers.type_right;
+      std::ranges::copy(msg.data.adaptive_triggers.right, plaintext.right);
+
+      std::array<std::uint8_t, sizeof(control_encrypted_t) + crypto::cipher::round_to_pkcs7_padded(sizeof(plaintext)) + crypto::cipher::tag_size>
+        encrypted_payload;
+
+      payload = encode_control(session, util::view(plaintext), encrypted_payload);
+    } else {
+      BOOST_LOG(error) << "Unknown gamepad feedback message type"sv;
+      return -1;
+    }
+
+    if (session->broadcast_ref->control_server.send(payload, session->control.peer)) {
+      TUPLE_2D(port, addr, platf::from_sockaddr_ex((sockaddr *) &session->control.peer->address.address));
+      BOOST_LOG(warning) << "Couldn't send gamepad feedback to ["sv << addr << ':' << port << ']';
+
+      return -1;
+    }
+
+    return 0;
+  }
+
+  namespace feedback {
+    // Feedback of a session goes out at most this often, updates in between replace each other
+    constexpr auto FLUSH_INTERVAL = 10ms;
+
+    /**
+     * @brief Keep a feedback message until the next flush, replacing an older one of the same kind for the same controller.
+     * @param session The session the message is for.
+     * @param msg The message.
+     */
+    void coalesce(session_t *session, const platf::gamepad_feedback_msg_t &msg) {
+      // Motion events are enabled per sensor, those of one sensor don't replace the other's
+      std::uint8_t subtype = msg.type == platf::gamepad_feedback_e::set_motion_event_state ? msg.data.motion_event_state.motion_type : 0;
+
+      session->control.pending_feedback.insert_or_assign(std::make_tuple(msg.id, msg.type, subtype), msg);
+    }
+
+    /**
+     * @brief Send the pending feedback of a session if its interval passed, in a single flush of the control stream.
+     * @param session The session.
+     * @param now The current time.
+     * @return When the pending feedback is due, if any is left.
+     */
+    std::optional<std::chrono::steady_clock::time_point> flush(session_t *session, std::chrono::steady_clock::time_point now) {
+      auto &pending = session->control.pending_feedback;
+      if (pending.empty()) {
+        return std::nullopt;
       }
-      payload_buffers.emplace_back(std::begin(payload), aligned_data_shards * blocksize);
 
-      // If the last data shard needs to be zero-padded, we must use the shards buffer
-      if (pad) {
-        shards_p[aligned_data_shards] = (uint8_t *) &shards[0];
+      if (now < session->control.next_feedback_flush) {
+        return session->control.next_feedback_flush;
+      }
 
-        // GCC doesn't figure out that std::copy_n() can be replaced with memcpy() here
-        // and ends up compiling a horribly slow element-by-element copy loop, so we
-        // help it by using memcpy()/memset() directly.
-        auto copy_len = std::min<size_t>(blocksize, std::end(payload) - next);
-        std::memcpy(shards_p[aligned_data_shards], next, copy_len);
-        if (copy_len < blocksize) {
-          // Zero any additional space after the end of the payload
-          std::memset(shards_p[aligned_data_shards] + copy_len, 0, blocksize - copy_len);
+      for (auto &[key, msg] : pending) {
+        send_feedback_msg(session, msg);
+      }
+      pending.clear();
+
+      session->broadcast_ref->control_server.flush();
+      session->control.next_feedback_flush = now + FLUSH_INTERVAL;
+      return std::nullopt;
+    }
+  }  // namespace feedback
+
+  int send_hdr_mode(session_t *session, video::hdr_info_t hdr_info) {
+    if (!session->control.peer) {
+      BOOST_LOG(warning) << "Couldn't send HDR mode, still waiting for PING from Moonlight"sv;
+      // Still waiting for PING from Moonlight
+      return -1;
+    }
+
+    control_hdr_mode_t plaintext {};
+    plaintext.header.type = packetTypes[IDX_HDR_MODE];
+    plaintext.header.payloadLength = sizeof(control_hdr_mode_t) - sizeof(control_header_v2);
+
+    plaintext.enabled = hdr_info->enabled;
+    plaintext.metadata = hdr_info->metadata;
+
+    std::array<std::uint8_t, sizeof(control_encrypted_t) + crypto::cipher::round_to_pkcs7_padded(sizeof(plaintext)) + crypto::cipher::tag_size>
+      encrypted_payload;
+
+    auto payload = encode_control(session, util::view(plaintext), encrypted_payload);
+    if (session->broadcast_ref->control_server.send(payload, session->control.peer)) {
+      TUPLE_2D(port, addr, platf::from_sockaddr_ex((sockaddr *) &session->control.peer->address.address));
+      BOOST_LOG(warning) << "Couldn't send HDR mode to ["sv << addr << ':' << port << ']';
+
+      return -1;
+    }
+
+    BOOST_LOG(debug) << "Sent HDR mode: " << hdr_info->enabled;
+    return 0;
+  }
+
+  namespace audio_fec {
+    /**
+     * @brief Protect the audio of a session as the video FEC controller protects its video.
+     * Moonlight only reports loss for video frames, so the parity the controller added above its minimum
+     * stands for the loss of the link. Audio gets parity shards and a loss resilient encoding while there is any,
+     * and neither once the link stayed clean long enough to bring video FEC down to its minimum.
+     * @param session The session of the client.
+     */
+    void follow(session_t *session) {
+      auto expected_loss = std::max(0, session->video.fec_percentage.load() - config::stream.fec_percentage_min);
+
+      auto parity = expected_loss > 0;
+      if (session->audio.parity.exchange(parity) != parity) {
+        BOOST_LOG(debug) << (parity ? "Adding"sv : "Dropping"sv) << " audio FEC parity"sv;
+      }
+
+      if (expected_loss != session->audio.expected_loss) {
+        session->audio.expected_loss = expected_loss;
+        audio::expect_loss(session, expected_loss);
+      }
+    }
+  }  // namespace audio_fec
+
+  namespace fec {
+    // Give the client a chance to report on the last raise before raising again
+    constexpr auto RAISE_HOLDOFF = 500ms;
+
+    // Lower the FEC percentage by one point for each second without loss
+    constexpr auto DECAY_INTERVAL = 1s;
+
+    /**
+     * @brief Get the FEC percentage to send with after the client lost frames despite FEC.
+     * @param current The FEC percentage frames are sent with.
+     * @param since_last_raise How long ago the percentage was last raised.
+     * @return Half as much again, by at least 5 points and at most up to fec_percentage_max,
+     * or nothing while the client may not have reported on the last raise yet.
+     */
+    std::optional<int> raised_percentage(int current, std::chrono::steady_clock::duration since_last_raise) {
+      if (since_last_raise < RAISE_HOLDOFF) {
+        return std::nullopt;
+      }
+
+      return std::min(config::stream.fec_percentage_max, current + std::max(5, current / 2));
+    }
+
+    /**
+     * @brief Get the FEC percentage to send with while the client doesn't lose frames.
+     * @param current The FEC percentage frames are sent with.
+     * @param clean_time How long the client went without loss, the whole intervals that lowered it are taken off.
+     * @return One point lower for each DECAY_INTERVAL, at least fec_percentage_min.
+     */
+    int decayed_percentage(int current, std::chrono::milliseconds &clean_time) {
+      int steps = clean_time / DECAY_INTERVAL;
+      clean_time %= DECAY_INTERVAL;
+
+      return std::max(config::stream.fec_percentage_min, current - steps);
+    }
+
+    /**
+     * @brief Add parity after the client lost frames despite FEC.
+     * @param session The session of the client.
+     * @param reason What the client reported, for logging.
+     */
+    void raise(session_t *session, const std::string_view &reason) {
+      session->video.fec_clean_time = 0ms;
+
+      auto now = std::chrono::steady_clock::now();
+      if (!config::stream.adaptive_fec) {
+        return;
+      }
+
+      auto current = session->video.fec_percentage.load();
+      auto next = raised_percentage(current, now - session->video.fec_last_raise);
+      if (!next) {
+        return;
+      }
+
+      if (*next != current) {
+        BOOST_LOG(debug) << "Raising FEC to "sv << *next << "% after "sv << reason;
+        session->video.fec_percentage = *next;
+        audio_fec::follow(session);
+      }
+      session->video.fec_last_raise = now;
+    }
+
+    /**
+     * @brief Remove parity while the client doesn't lose frames.
+     * @param session The session of the client.
+     * @param clean_time How long the client went without loss.
+     */
+    void decay(session_t *session, std::chrono::milliseconds clean_time) {
+      if (!config::stream.adaptive_fec) {
+        return;
+      }
+
+      session->video.fec_clean_time += clean_time;
+      if (session->video.fec_clean_time < DECAY_INTERVAL) {
+        return;
+      }
+
+      auto current = session->video.fec_percentage.load();
+      auto next = decayed_percentage(current, session->video.fec_clean_time);
+      if (next != current) {
+        BOOST_LOG(verbose) << "Lowering FEC to "sv << next << '%';
+        session->video.fec_percentage = next;
+        audio_fec::follow(session);
+      }
+    }
+  }  // namespace fec
+
+  namespace bitrate {
+    int max_kbps(session_t *session);
+    void apply(session_t *session, const std::string_view &reason);
+  }  // namespace bitrate
+
+  namespace fanout {
+    std::mutex groups_lock;
+    std::vector<std::weak_ptr<fanout_t>> groups;
+
+    bool same_stream(const video::config_t &a, const video::config_t &b) {
+      auto fields = [](const video::config_t &c) {
+        return std::tie(c.width, c.height, c.framerate, c.framerateX100, c.bitrate, c.slicesPerFrame, c.numRefFrames, c.encoderCscMode, c.videoFormat, c.dynamicRange, c.chromaSamplingType, c.enableIntraRefresh);
+      };
+
+      return fields(a) == fields(b);
+    }
+
+    /**
+     * @brief Get the group a session watches the stream with.
+     * @param session The session.
+     * @return The group, or `nullptr` while the session doesn't share an encoder.
+     */
+    std::shared_ptr<fanout_t> group_of(session_t *session) {
+      std::lock_guard lg {groups_lock};
+      return session->video.fanout;
+    }
+
+    /**
+     * @brief Run a function on the sessions watching the stream of this session, while none of them can leave.
+     * @param session The session, or one that just stopped watching.
+     * @param f Called with the sessions, the first one runs the encoder.
+     */
+    template<class F>
+    void with_viewers(session_t *session, F &&f) {
+      auto group = group_of(session);
+      if (!group) {
+        f(std::vector<session_t *> {session});
+        return;
+      }
+
+      std::lock_guard lg {group->lock};
+      if (!group->viewers.empty()) {
+        f(group->viewers);
+      }
+    }
+
+    /**
+     * @brief Run a function on the session running the encoder this session watches.
+     * @param session The session.
+     * @param f Called with the encoding session, while it can't leave.
+     */
+    template<class F>
+    void with_encoder(session_t *session, F &&f) {
+      with_viewers(session, [&](const std::vector<session_t *> &viewers) {
+        f(viewers.front());
+      });
+    }
+
+    /**
+     * @brief Hand a new touch port of the encoder to the input of every session watching it.
+     * @param encoder The session running the encoder.
+     */
+    void share_touch_port(session_t *encoder) {
+      auto touch_port = encoder->video.touch_port_events->pop(0ms);
+      if (!touch_port) {
+        return;
+      }
+
+      auto group = group_of(encoder);
+      if (!group) {
+        encoder->video.input_touch_port_events->raise(*touch_port);
+        return;
+      }
+
+      std::lock_guard lg {group->lock};
+      if (group->viewers.empty() || group->viewers.front() != encoder) {
+        return;
+      }
+
+      group->touch_port = *touch_port;
+      for (auto viewer : group->viewers) {
+        viewer->video.input_touch_port_events->raise(*touch_port);
+      }
+    }
+
+    /**
+     * @brief Pass the HDR mode the encoder told its session about on to the other sessions watching it.
+     * @param session The session the control stream sends the HDR mode to.
+     * @param hdr_info The HDR mode.
+     */
+    void share_hdr(session_t *session, const video::hdr_info_raw_t &hdr_info) {
+      auto group = group_of(session);
+      if (!group) {
+        return;
+      }
+
+      std::lock_guard lg {group->lock};
+      if (group->viewers.empty() || group->viewers.front() != session) {
+        return;
+      }
+
+      group->hdr = hdr_info;
+      for (auto viewer : group->viewers) {
+        if (viewer != session) {
+          viewer->control.hdr_queue->raise(std::make_unique<video::hdr_info_raw_t>(hdr_info));
+        }
+      }
+    }
+
+    /**
+     * @brief Wake a session waiting to take over the encoder, so it notices it stopped.
+     * @param session The session.
+     */
+    void wake(session_t &session) {
+      auto group = group_of(&session);
+      if (!group) {
+        return;
+      }
+
+      std::lock_guard lg {group->lock};
+      group->encoder_changed.notify_all();
+    }
+
+    /**
+     * @brief Watch the stream of an encoder already running for the same video configuration, or start one.
+     * Returns once the session stops. If the session running the encoder stops first, the next viewer takes over.
+     * @param session The session.
+     */
+    void watch(session_t *session) {
+      {
+        std::lock_guard lg {groups_lock};
+
+        std::erase_if(groups, [](const auto &group) {
+          return group.expired();
+        });
+
+        for (auto &weak_group : groups) {
+          auto group = weak_group.lock();
+          if (same_stream(group->config, session->config.monitor)) {
+            session->video.fanout = std::move(group);
+            break;
+          }
+        }
+
+        if (!session->video.fanout) {
+          session->video.fanout = std::make_shared<fanout_t>();
+          session->video.fanout->config = session->config.monitor;
+          groups.emplace_back(session->video.fanout);
+        }
+      }
+
+      auto &group = *session->video.fanout;
+      {
+        std::lock_guard lg {group.lock};
+        group.viewers.emplace_back(session);
+
+        // The new viewer can't decode anything before the next IDR frame, and needs to know about the display
+        if (group.viewers.front() != session) {
+          BOOST_LOG(info) << "Sharing the video encoder with "sv << group.viewers.size() - 1 << " other session(s)"sv;
+          group.viewers.front()->video.idr_events->raise(true);
+
+          if (group.hdr) {
+            session->control.hdr_queue->raise(std::make_unique<video::hdr_info_raw_t>(*group.hdr));
+          }
+          if (group.touch_port) {
+            session->video.input_touch_port_events->raise(*group.touch_port);
+          }
+        }
+      }
+      bitrate::apply(session, "a viewer joining"sv);
+
+      auto fg = util::fail_guard([&]() {
+        {
+          std::unique_lock ul {group.lock};
+
+          auto was_encoder = group.viewers.front() == session;
+          std::erase(group.viewers, session);
+
+          // The broadcast threads may still be sending a frame to the session, or one of its encoder
+          group.frame_sent.wait(ul, [&]() {
+            return group.sending == 0;
+          });
+          if (was_encoder && !group.viewers.empty()) {
+            group.encoder_changed.notify_all();
+          }
+        }
+        bitrate::apply(session, "a viewer leaving"sv);
+      });
+
+      {
+        std::unique_lock ul {group.lock};
+        group.encoder_changed.wait(ul, [&]() {
+          return session->shutdown_event->peek() || (group.viewers.front() == session && group.sending == 0);
+        });
+      }
+      if (session->shutdown_event->peek()) {
+        return;
+      }
+
+      // A viewer taking over from another session starts the encoder at the bitrate the group streams at
+      if (session->video.bitrate_kbps < bitrate::max_kbps(session)) {
+        session->video.bitrate_events->raise(session->video.bitrate_kbps.load());
+      }
+
+      BOOST_LOG(debug) << "Start capturing Video"sv;
+      video::capture(session->mail, session->config.monitor, session);
+    }
+  }  // namespace fanout
+
+  namespace simulcast {
+    using rung_t = config::stream_t::simulcast_rung_t;
+
+    /**
+     * @brief Pick the rung of the ladder closest in size to what a client asked for.
+     * Only rungs within the client's bitrate are considered, a client below all of them gets the cheapest one.
+     * @param rungs The ladder.
+     * @param width Width the client asked for.
+     * @param height Height the client asked for.
+     * @param bitrate Bitrate the client asked for, in Kbps.
+     * @return The rung, or nullptr if the ladder is empty.
+     */
+    const rung_t *closest_rung(const std::vector<rung_t> &rungs, int width, int height, int bitrate) {
+      auto distance = [pixels = (std::int64_t) width * height](const rung_t &rung) {
+        return std::abs((std::int64_t) rung.width * rung.height - pixels);
+      };
+
+      const rung_t *closest = nullptr;
+      for (auto &rung : rungs) {
+        if (rung.bitrate > bitrate) {
+          continue;
+        }
+
+        // Between rungs of the same size the one with more bitrate looks better
+        if (!closest || distance(rung) < distance(*closest) ||
+            (distance(rung) == distance(*closest) && rung.bitrate > closest->bitrate)) {
+          closest = &rung;
+        }
+      }
+
+      if (!closest) {
+        for (auto &rung : rungs) {
+          if (!closest || rung.bitrate < closest->bitrate) {
+            closest = &rung;
+          }
         }
       }
 
-      // Add a payload buffer describing the shard buffer
-      payload_buffers.emplace_back(std::begin(shards), shards.size());
+      return closest;
+    }
+
+    void attach(video::config_t &config) {
+      auto rung = closest_rung(config::stream.simulcast, config.width, config.height, config.bitrate);
+      if (!rung) {
+        return;
+      }
+
+      BOOST_LOG(info) << "Simulcast: streaming "sv << rung->width << 'x' << rung->height << " at "sv << rung->bitrate
+                      << " Kbps to a client asking for "sv << config.width << 'x' << config.height << " at "sv << config.bitrate << " Kbps"sv;
+
+      config.width = rung->width;
+      config.height = rung->height;
+      config.bitrate = rung->bitrate;
+    }
+  }  // namespace simulcast
+
+  namespace late_frames {
+    /**
+     * @brief Time to wait for the recovery frame after dropping a frame, before asking for a key frame.
+     */
+    constexpr auto RECOVERY_TIMEOUT = 500ms;
+
+    /**
+     * @brief Check if a frame waited too long in the send queue to be worth sending.
+     * A frame is only dropped if a newer one is already queued behind it, the last frame always goes out.
+     * @param age Time since the frame was captured, if known.
+     * @param newer_queued Another frame is waiting in the send queue.
+     * @param max_age The max_frame_latency setting, zero never drops a frame.
+     * @return `true` if the frame should be dropped.
+     */
+    bool too_late(std::optional<std::chrono::steady_clock::duration> age, bool newer_queued, std::chrono::milliseconds max_age) {
+      if (max_age == 0ms || !newer_queued || !age) {
+        return false;
+      }
+
+      return *age > max_age;
+    }
+  }  // namespace late_frames
+
+  /**
+   * @brief Ask the encoder of a session to stop referencing a range of frames.
+   * Ranges reported before the encoder got to the previous one are merged into it,
+   * so a burst of loss reports costs a single invalidation spanning all of them.
+   * @param encoder The session owning the encoder.
+   * @param first_frame The first frame to invalidate.
+   * @param last_frame The last frame to invalidate.
+   */
+  void invalidate_ref_frames(session_t *encoder, int64_t first_frame, int64_t last_frame) {
+    encoder->video.invalidate_ref_frames_events->raise_merged(std::make_pair(first_frame, last_frame), [](auto &pending, auto &&frames) {
+      pending.first = std::min(pending.first, frames.first);
+      pending.second = std::max(pending.second, frames.second);
+    });
+  }
+
+  namespace bitrate {
+    // Give the encoder and the client a chance to settle before lowering again
+    constexpr auto LOWER_HOLDOFF = 1s;
+
+    // Raise the bitrate by a step for every interval without loss
+    constexpr auto RESTORE_INTERVAL = 2s;
+
+    /**
+     * @brief Get the highest bitrate a session may stream at.
+     * @param session The session.
+     * @return The bitrate the client asked for, capped by max_bitrate.
+     */
+    int max_kbps(session_t *session) {
+      auto bitrate = session->config.monitor.bitrate;
+      // Leave headroom on a measured path for the parity and the bursts of paced frames
+      if (auto capacity = session->video.path_capacity_bps.load()) {
+        bitrate = std::min<std::uint64_t>(bitrate, std::max<std::uint64_t>(1, capacity * 80 / 100 / 1000));
+      }
+      return config::video.max_bitrate > 0 ? std::min(bitrate, config::video.max_bitrate) : bitrate;
+    }
+
+    /**
+     * @brief Run the encoder this session watches at the lowest bitrate any session watching it can take.
+     * @param session The session, or one that just stopped watching.
+     * @param reason Why the bitrate changes, for logging.
+     */
+    void apply(session_t *session, const std::string_view &reason) {
+      fanout::with_viewers(session, [&](const std::vector<session_t *> &viewers) {
+        auto bitrate_kbps = viewers.front()->video.target_kbps.load();
+        for (auto viewer : viewers) {
+          bitrate_kbps = std::min(bitrate_kbps, viewer->video.target_kbps.load());
+        }
+
+        auto encoder = viewers.front();
+        if (encoder->video.bitrate_kbps.exchange(bitrate_kbps) != bitrate_kbps) {
+          BOOST_LOG(debug) << "Changing bitrate to "sv << bitrate_kbps << " kbps after "sv << reason;
+          encoder->video.bitrate_events->raise(bitrate_kbps);
+        }
+        for (auto viewer : viewers) {
+          viewer->video.bitrate_kbps = bitrate_kbps;
+        }
+      });
+    }
+
+    /**
+     * @brief Change the bitrate a session can take, the encoder it watches follows the lowest of its viewers.
+     * @param session The session.
+     * @param bitrate_kbps The new bitrate, clamped between a quarter of the highest bitrate and the highest bitrate.
+     * @param reason Why the bitrate changes, for logging.
+     */
+    void set(session_t *session, int bitrate_kbps, const std::string_view &reason) {
+      auto max = max_kbps(session);
+      session->video.target_kbps = std::clamp(bitrate_kbps, std::max(1, max / 4), max);
+
+      apply(session, reason);
+    }
+
+    /**
+     * @brief Lower the bitrate after the client lost packets.
+     * @param session The session of the client.
+     */
+    void lower(session_t *session) {
+      session->video.bitrate_clean_time = 0ms;
+
+      auto now = std::chrono::steady_clock::now();
+      if (!config::stream.adaptive_bitrate || now - session->video.bitrate_last_lower < LOWER_HOLDOFF) {
+        return;
+      }
+
+      // Below what the client can take when a slower viewer holds the shared encoder back
+      auto received = std::min(session->video.target_kbps.load(), session->video.bitrate_kbps.load());
+      set(session, received * 85 / 100, "loss report"sv);
+      session->video.bitrate_last_lower = now;
+    }
+
+    /**
+     * @brief Restore the bitrate while the client doesn't lose packets.
+     * @param session The session of the client.
+     * @param clean_time How long the client went without loss.
+     */
+    void restore(session_t *session, std::chrono::milliseconds clean_time) {
+      if (!config::stream.adaptive_bitrate) {
+        return;
+      }
+
+      session->video.bitrate_clean_time += clean_time;
+      if (session->video.bitrate_clean_time < RESTORE_INTERVAL) {
+        return;
+      }
+
+      int steps = session->video.bitrate_clean_time / RESTORE_INTERVAL;
+      session->video.bitrate_clean_time %= RESTORE_INTERVAL;
+
+      auto current = session->video.target_kbps.load();
+      if (current < max_kbps(session)) {
+        set(session, current + steps * max_kbps(session) / 20, "clean stream"sv);
+      }
+    }
+  }  // namespace bitrate
+
+  namespace probe {
+    // How long the first frames of a stream carry the probe
+    constexpr auto DURATION = 2s;
+
+    // Parity the frames carry while probing, the client discards what it doesn't need to recover a frame
+    constexpr int FEC_PERCENTAGE = 100;
+
+    // Pacing ceiling, around 80% of 1Gbps
+    constexpr std::uint64_t DEFAULT_CEILING_BPS = std::giga::num * 80 / 100;
+
+    /**
+     * @brief Estimate the capacity of the path from a probe.
+     * @param peak_bps The fastest rate a frame left at while probing.
+     * @param lost The client lost frames while probing.
+     * @return The capacity, a clean probe shows the path carries at least the peak rate.
+     */
+    std::uint64_t capacity_bps(std::uint64_t peak_bps, bool lost) {
+      return lost ? peak_bps / 2 : peak_bps;
+    }
+
+    /**
+     * @brief Get the rate to pace the frames of a stream at.
+     * @param capacity_bps The measured capacity of the path, zero if unmeasured.
+     * @param bitrate_kbps Bitrate the encoder runs at.
+     * @return A multiple of the bitrate, so a frame leaves well within its frame interval
+     * without bursting beyond what the link needs, but at most the capacity of the path.
+     */
+    std::uint64_t pacing_bps(std::uint64_t capacity_bps, int bitrate_kbps) {
+      auto ceiling = capacity_bps ? std::min(capacity_bps, DEFAULT_CEILING_BPS) : DEFAULT_CEILING_BPS;
+      return std::min<std::uint64_t>(ceiling, (std::uint64_t) bitrate_kbps * 1000 * PACING_BITRATE_MULTIPLE);
+    }
+
+    /**
+     * @brief Start probing on the first frame of a stream if bandwidth_probe is enabled.
+     * @param session The session of the client.
+     * @param now The current time.
+     */
+    void start(session_t *session, std::chrono::steady_clock::time_point now) {
+      auto &probe = session->video.probe;
+      if (!probe.pending) {
+        return;
+      }
+
+      probe.pending = false;
+      probe.until = now + DURATION;
+      probe.peak_bps = 0;
+      probe.lost = false;
+      BOOST_LOG(debug) << "Probing the path to "sv << session->video.peer.address() << " for "sv << DURATION.count() << 's';
+    }
+
+    /**
+     * @brief Check if the frames of a session currently carry the probe.
+     * @param session The session of the client.
+     * @return `true` while probing.
+     */
+    bool active(session_t *session) {
+      return session->video.probe.until != std::chrono::steady_clock::time_point {};
+    }
+
+    /**
+     * @brief Count a frame sent while probing.
+     * @param session The session of the client.
+     * @param bytes Size of the frame on the wire, parity included.
+     * @param send_time Time from the first to the last packet of the frame.
+     * @param pacing_bps Rate the frame was paced at, packets handed to kernel pacing leave no faster.
+     */
+    void sent(session_t *session, std::uint64_t bytes, std::chrono::steady_clock::duration send_time, std::uint64_t pacing_bps) {
+      auto us = std::chrono::duration_cast<std::chrono::microseconds>(send_time).count();
+      auto rate = us > 0 ? std::min(pacing_bps, bytes * 8 * 1000000 / us) : pacing_bps;
+
+      auto &probe = session->video.probe;
+      probe.peak_bps = std::max(probe.peak_bps, rate);
+    }
+
+    /**
+     * @brief End the probe once its time is up, and cap the pacing and the bitrate to what it measured.
+     * @param session The session of the client.
+     * @param now The current time.
+     */
+    void finish(session_t *session, std::chrono::steady_clock::time_point now) {
+      auto &probe = session->video.probe;
+      if (!active(session) || now < probe.until) {
+        return;
+      }
+
+      probe.until = {};
+      if (!probe.peak_bps) {
+        return;
+      }
+
+      auto capacity = capacity_bps(probe.peak_bps, probe.lost);
+      session->video.path_capacity_bps = capacity;
+      BOOST_LOG(info) << "Measured the path to "sv << session->video.peer.address() << " at "sv << capacity / 1000 << " Kbps"sv
+                      << (probe.lost ? " after the client lost frames"sv : ""sv);
+
+      if (session->video.target_kbps > bitrate::max_kbps(session)) {
+        bitrate::set(session, bitrate::max_kbps(session), "bandwidth probe"sv);
+      }
+    }
+  }  // namespace probe
+
+  namespace socket_buffer {
+    // The send buffer never gets smaller than this, nor larger than the max
+    constexpr int MIN_SIZE = 1024 * 1024;
+    constexpr int MAX_SIZE = 64 * 1024 * 1024;
+
+    // A key frame runs to around this many times the budget of an average frame
+    constexpr int KEY_FRAME_FACTOR = 10;
+
+    /**
+     * @brief Get the send buffer a stream needs so a key frame and the frame behind it fit.
+     * @param bitrate_kbps Bitrate of the stream.
+     * @param framerate Frame rate of the stream.
+     * @param fec_percentage Highest FEC percentage the frames may carry.
+     * @return The size in bytes, between MIN_SIZE and MAX_SIZE.
+     */
+    int size_for(int bitrate_kbps, int framerate, int fec_percentage) {
+      auto frame_bytes = (std::int64_t) bitrate_kbps * 1000 / 8 / std::max(1, framerate);
+      auto key_frame_bytes = frame_bytes * KEY_FRAME_FACTOR * (100 + fec_percentage) / 100;
 
-      if (fecpercentage != 0) {
-        // Point into our allocated buffer for the parity shards
-        for (auto x = 0; x < parity_shards; ++x) {
-          shards_p[data_shards + x] = (uint8_t *) &shards[(parity_shard_offset + x) * blocksize];
-        }
+      return (int) std::clamp<std::int64_t>(key_frame_bytes + key_frame_bytes / KEY_FRAME_FACTOR, MIN_SIZE, MAX_SIZE);
+    }
 
-        // packets = parity_shards + data_shards
-        rs_t rs {reed_solomon_new(data_shards, parity_shards)};
+    /**
+     * @brief Grow the send buffer of the video socket to at least the given size.
+     * The socket is shared by all sessions, so it's never shrunk while streaming.
+     * @param ctx The broadcast context.
+     * @param size The size in bytes.
+     */
+    void fit(broadcast_ctx_t &ctx, int size) {
+      std::lock_guard lg {ctx.video_send_buffer_lock};
+      if (size <= ctx.video_send_buffer) {
+        return;
+      }
+      ctx.video_send_buffer = size;
 
-        reed_solomon_encode(rs.get(), shards_p.begin(), nr_shards, blocksize);
+      boost::system::error_code ec;
+      ctx.video_sock.set_option(boost::asio::socket_base::send_buffer_size(size), ec);
+      if (ec) {
+        BOOST_LOG(error) << "Failed to set video socket send buffer size (SO_SNDBUF): "sv << ec.message();
+        return;
       }
 
-      return {
-        data_shards,
-        nr_shards,
-        fecpercentage,
-        blocksize,
-        prefixsize,
-        std::move(shards),
-        util::buffer_t<char> {nr_shards * prefixsize},
-        std::move(shards_p),
-        std::move(payload_buffers),
-      };
+      boost::asio::socket_base::send_buffer_size granted;
+      ctx.video_sock.get_option(granted, ec);
+      auto granted_size = granted.value();
+#ifdef __linux__
+      // Linux caps the buffer at net.core.wmem_max and reports twice what it granted
+      granted_size /= 2;
+#endif
+      if (!ec && granted_size < size) {
+        BOOST_LOG(warning) << "Video socket send buffer capped at "sv << granted_size / 1024 << " KB instead of "sv << size / 1024
+                           << " KB, large frames may be dropped before they leave the host. Raise net.core.wmem_max to avoid this."sv;
+      } else {
+        BOOST_LOG(debug) << "Video socket send buffer set to "sv << size / 1024 << " KB"sv;
+      }
     }
-  }  // namespace fec
 
-  /**
-   * @brief Combines two buffers and inserts new buffers at each slice boundary of the result.
-   * @param insert_size The number of bytes to insert.
-   * @param slice_size The number of bytes between insertions.
-   * @param data1 The first data buffer.
-   * @param data2 The second data buffer.
-   */
-  std::vector<uint8_t> concat_and_insert(uint64_t insert_size, uint64_t slice_size, const std::string_view &data1, const std::string_view &data2) {
-    auto data_size = data1.size() + data2.size();
-    auto pad = data_size % slice_size != 0;
-    auto elements = data_size / slice_size + (pad ? 1 : 0);
+    /**
+     * @brief Grow the send buffer of the video socket for the frames of a session.
+     * @param ctx The broadcast context.
+     * @param session The session.
+     */
+    void fit(broadcast_ctx_t &ctx, session_t *session) {
+      auto fec_percentage = config::stream.adaptive_fec ? config::stream.fec_percentage_max : config::stream.fec_percentage;
+      fec_percentage = std::max(fec_percentage, config::stream.fec_percentage_key_frame);
+      if (config::stream.bandwidth_probe) {
+        fec_percentage = std::max(fec_percentage, probe::FEC_PERCENTAGE);
+      }
 
-    std::vector<uint8_t> result;
-    result.resize(elements * insert_size + data_size);
+      fit(ctx, size_for(session->config.monitor.bitrate, session->config.monitor.framerate, fec_percentage));
+    }
+  }  // namespace socket_buffer
 
-    auto next = std::begin(data1);
-    auto end = std::end(data1);
-    for (auto x = 0; x < elements; ++x) {
-      void *p = &result[x * (insert_size + slice_size)];
+  namespace pmtu {
+    // Probing past the video packets shows how much room the client's packet size leaves, up to jumbo frames
+    constexpr int MAX_PROBE_SIZE = 9000;
 
-      // For the last iteration, only copy to the end of the data
-      if (x == elements - 1) {
-        slice_size = data_size - (x * slice_size);
-      }
+    /**
+     * @brief Probe the path to the client of a session and check that its video packets fit.
+     * The client picks the packet size and sizes its receive buffers and FEC shards by it,
+     * so the packets can't grow past it, the probe only tells whether they are fragmented on the way.
+     * @param session The session, whose video ping arrived.
+     */
+    void probe(session_t *session) {
+      auto address = session->video.peer.address();
+      auto v4 = address.is_v4() || address.to_v6().is_v4_mapped();
 
-      // Test if this slice will extend into the next buffer
-      if (next + slice_size > end) {
-        // Copy the first portion from the first buffer
-        auto copy_len = end - next;
-        std::copy(next, end, (char *) p + insert_size);
+      // Everything a shard is sent with besides the client's packet size
+      int overhead = MAX_RTP_HEADER_SIZE + (session->video.ciphers ? sizeof(video_packet_enc_prefix_t) : 0) + (v4 ? 20 : 40) + 8;
+      int packet_size = session->config.packetsize + overhead;
 
-        // Copy the remaining portion from the second buffer
-        next = std::begin(data2);
-        end = std::end(data2);
-        std::copy(next, next + (slice_size - copy_len), (char *) p + copy_len + insert_size);
-        next += slice_size - copy_len;
+      auto path_mtu = platf::probe_path_mtu(address, std::max(packet_size, MAX_PROBE_SIZE));
+      if (path_mtu <= 0) {
+        BOOST_LOG(debug) << "Couldn't probe the path MTU to "sv << address;
+        return;
+      }
+      session->video.path_mtu = path_mtu;
+
+      if (path_mtu < packet_size) {
+        BOOST_LOG(warning) << "Video packets of "sv << packet_size << " bytes exceed the path MTU of "sv << path_mtu << " bytes to "sv << address
+                           << ", so they are fragmented and losing a fragment loses the packet. Set the packet size of the client to "sv
+                           << path_mtu - overhead << " bytes or less to avoid this."sv;
       } else {
-        std::copy(next, next + slice_size, (char *) p + insert_size);
-        next += slice_size;
+        BOOST_LOG(info) << "Path MTU to "sv << address << " is "sv << path_mtu << " bytes, video packets are "sv << packet_size << " bytes"sv;
       }
     }
+  }  // namespace pmtu
 
-    return result;
-  }
+  namespace client_profile {
+    // Shorter streams end before adaptive bitrate and FEC settle, what they reached says little about the client
+    constexpr auto MIN_DURATION = 1min;
 
-  std::vector<uint8_t> replace(const std::string_view &original, const std::string_view &old, const std::string_view &_new) {
-    std::vector<uint8_t> replaced;
-    replaced.reserve(original.size() + _new.size() - old.size());
+    /**
+     * @brief Start a session from the settings its client streamed with last time.
+     * @param session The session, before it starts.
+     */
+    void apply(session_t *session) {
+      if (!config::stream.learn_client_profiles || session->client_uuid.empty()) {
+        return;
+      }
 
-    auto begin = std::begin(original);
-    auto end = std::end(original);
-    auto next = std::search(begin, end, std::begin(old), std::end(old));
+      auto profile = nvhttp::get_stream_profile(session->client_uuid);
+      if (!profile) {
+        return;
+      }
 
-    std::copy(begin, next, std::back_inserter(replaced));
-    if (next != end) {
-      std::copy(std::begin(_new), std::end(_new), std::back_inserter(replaced));
-      std::copy(next + old.size(), end, std::back_inserter(replaced));
-    }
+      if (config::stream.adaptive_bitrate && profile->bitrate_kbps > 0) {
+        auto max = bitrate::max_kbps(session);
+        session->video.target_kbps = std::clamp(profile->bitrate_kbps, std::max(1, max / 4), max);
+        session->video.bitrate_kbps = session->video.target_kbps.load();
+        session->video.bitrate_events->raise(session->video.bitrate_kbps.load());
+      }
+      if (config::stream.adaptive_fec && profile->fec_percentage >= 0) {
+        session->video.fec_percentage = std::clamp(profile->fec_percentage, config::stream.fec_percentage_min, config::stream.fec_percentage_max);
+      }
 
-    return replaced;
-  }
+      // The path MTU only tells something for the packet size it was probed with
+      if (profile->path_mtu > 0 && profile->packet_size == session->config.packetsize) {
+        session->video.path_mtu = profile->path_mtu;
+      }
 
-  /**
-   * @brief Pass gamepad feedback data back to the client.
-   * @param session The session object.
-   * @param msg The message to pass.
-   * @return 0 on success.
-   */
-  int send_feedback_msg(session_t *session, platf::gamepad_feedback_msg_t &msg) {
-    if (!session->control.peer) {
-      BOOST_LOG(warning) << "Couldn't send gamepad feedback data, still waiting for PING from Moonlight"sv;
-      // Still waiting for PING from Moonlight
-      return -1;
+      BOOST_LOG(info) << "Starting from the learned profile of the client: "sv << session->video.bitrate_kbps.load() << " kbps, "sv
+                      << session->video.fec_percentage.load() << "% FEC, path MTU "sv << session->video.path_mtu.load();
     }
 
-    std::string payload;
-    if (msg.type == platf::gamepad_feedback_e::rumble) {
-      control_rumble_t plaintext;
-      plaintext.header.type = packetTypes[IDX_RUMBLE_DATA];
-      plaintext.header.payloadLength = sizeof(plaintext) - sizeof(control_header_v2);
+    /**
+     * @brief Remember the settings a session ended with for the next stream of its client.
+     * @param session The session, after its threads ended.
+     */
+    void learn(session_t &session) {
+      if (!config::stream.learn_client_profiles || session.client_uuid.empty()) {
+        return;
+      }
 
-      auto &data = msg.data.rumble;
+      if (std::chrono::steady_clock::now() - session.handshake_start < MIN_DURATION) {
+        BOOST_LOG(debug) << "Stream too short to learn from"sv;
+        return;
+      }
 
-      plaintext.useless = 0xC0FFEE;
-      plaintext.id = util::endian::little(msg.id);
-      plaintext.lowfreq = util::endian::little(data.lowfreq);
-      plaintext.highfreq = util::endian::little(data.highfreq);
+      auto profile = nvhttp::get_stream_profile(session.client_uuid).value_or(nvhttp::stream_profile_t {});
+      if (config::stream.adaptive_bitrate) {
+        profile.bitrate_kbps = session.video.target_kbps;
+      }
+      if (config::stream.adaptive_fec) {
+        profile.fec_percentage = session.video.fec_percentage;
+      }
+      if (auto path_mtu = session.video.path_mtu.load()) {
+        profile.packet_size = session.config.packetsize;
+        profile.path_mtu = path_mtu;
+      }
 
-      BOOST_LOG(verbose) << "Rumble: "sv << msg.id << " :: "sv << util::hex(data.lowfreq).to_string_view() << " :: "sv << util::hex(data.highfreq).to_string_view();
-      std::array<std::uint8_t, sizeof(control_encrypted_t) + crypto::cipher::round_to_pkcs7_padded(sizeof(plaintext)) + crypto::cipher::tag_size>
-        encrypted_payload;
+      nvhttp::save_stream_profile(session.client_uuid, profile);
+    }
+  }  // namespace client_profile
 
-      payload = encode_control(session, util::view(plaintext), encrypted_payload);
-    } else if (msg.type == platf::gamepad_feedback_e::rumble_triggers) {
-      control_rumble_triggers_t plaintext;
-      plaintext.header.type = packetTypes[IDX_RUMBLE_TRIGGER_DATA];
-      plaintext.header.payloadLength = sizeof(plaintext) - sizeof(control_header_v2);
+  /**
+   * @brief Keep the frames of a session reaching the client at the same point of its frame interval.
+   * The client doesn't tell when it presents frames, so the phase the arrivals settle on over the first
+   * seconds of the stream is taken for its presentation phase. A frame arrives half a control stream
+   * round trip after its last packet was sent.
+   */
+  namespace vsync_phase {
+    constexpr auto LEARN_DURATION = 3s;
 
-      auto &data = msg.data.rumble_triggers;
+    // A shift shows up in the arrivals once the frames captured after it were encoded and sent
+    constexpr auto SETTLE_DURATION = 500ms;
 
-      plaintext.id = util::endian::little(msg.id);
-      plaintext.left = util::endian::little(data.left_trigger);
-      plaintext.right = util::endian::little(data.right_trigger);
+    // Errors below this fraction of the frame interval are left alone, they are within the jitter of the estimate
+    constexpr double DEADBAND = 0.05;
 
-      BOOST_LOG(verbose) << "Rumble triggers: "sv << msg.id << " :: "sv << util::hex(data.left_trigger).to_string_view() << " :: "sv << util::hex(data.right_trigger).to_string_view();
-      std::array<std::uint8_t, sizeof(control_encrypted_t) + crypto::cipher::round_to_pkcs7_padded(sizeof(plaintext)) + crypto::cipher::tag_size>
-        encrypted_payload;
+    constexpr double SMOOTHING = 0.1;
 
-      payload = encode_control(session, util::view(plaintext), encrypted_payload);
-    } else if (msg.type == platf::gamepad_feedback_e::set_motion_event_state) {
-      control_set_motion_event_t plaintext;
-      plaintext.header.type = packetTypes[IDX_SET_MOTION_EVENT];
-      plaintext.header.payloadLength = sizeof(plaintext) - sizeof(control_header_v2);
+    /**
+     * @brief Wrap a phase difference to [-0.5, 0.5) of a frame interval.
+     */
+    double wrap(double phase) {
+      return phase - std::floor(phase + 0.5);
+    }
 
-      auto &data = msg.data.motion_event_state;
+    /**
+     * @brief Account for the arrival of a frame that was just sent.
+     * @param session The session the frame was sent to.
+     * @param sent When the last packet of the frame was sent.
+     */
+    void update(session_t &session, std::chrono::steady_clock::time_point sent) {
+      auto &vsync = session.video.vsync;
 
-      plaintext.id = util::endian::little(msg.id);
-      plaintext.reportrate = util::endian::little(data.report_rate);
-      plaintext.type = data.motion_type;
+      auto framerate = std::max(1, session.config.monitor.framerate);
+      std::chrono::duration<double> interval {1.0 / framerate};
 
-      BOOST_LOG(verbose) << "Motion event state: "sv << msg.id << " :: "sv << util::hex(data.report_rate).to_string_view() << " :: "sv << util::hex(data.motion_type).to_string_view();
-      std::array<std::uint8_t, sizeof(control_encrypted_t) + crypto::cipher::round_to_pkcs7_padded(sizeof(plaintext)) + crypto::cipher::tag_size>
-        encrypted_payload;
+      auto arrival = sent + std::chrono::milliseconds {session.video.rtt_ms.load()} / 2;
+      if (vsync.epoch == std::chrono::steady_clock::time_point {}) {
+        vsync.epoch = arrival;
+        vsync.settle_until = arrival + LEARN_DURATION;
+      }
 
-      payload = encode_control(session, util::view(plaintext), encrypted_payload);
-    } else if (msg.type == platf::gamepad_feedback_e::set_rgb_led) {
-      control_set_rgb_led_t plaintext;
-      plaintext.header.type = packetTypes[IDX_SET_RGB_LED];
-      plaintext.header.payloadLength = sizeof(plaintext) - sizeof(control_header_v2);
+      auto cycles = std::chrono::duration<double> {arrival - vsync.epoch} / interval;
+      auto phase = cycles - std::floor(cycles);
 
-      auto &data = msg.data.rgb_led;
+      if (!vsync.target) {
+        // The arrivals are averaged on the unit circle, so phases on both sides of zero don't cancel out
+        vsync.sum_cos += std::cos(2 * M_PI * phase);
+        vsync.sum_sin += std::sin(2 * M_PI * phase);
+        if (arrival < vsync.settle_until) {
+          return;
+        }
 
-      plaintext.id = util::endian::little(msg.id);
-      plaintext.r = data.r;
-      plaintext.g = data.g;
-      plaintext.b = data.b;
+        vsync.target = std::atan2(vsync.sum_sin, vsync.sum_cos) / (2 * M_PI);
+        vsync.error = 0;
+        BOOST_LOG(debug) << "Client vsync phase estimated at "sv << (stat_trackers::one_digit_after_decimal() % (wrap(*vsync.target) * 100)).str() << "% of the frame interval"sv;
+      }
 
-      BOOST_LOG(verbose) << "RGB: "sv << msg.id << " :: "sv << util::hex(data.r).to_string_view() << util::hex(data.g).to_string_view() << util::hex(data.b).to_string_view();
-      std::array<std::uint8_t, sizeof(control_encrypted_t) + crypto::cipher::round_to_pkcs7_padded(sizeof(plaintext)) + crypto::cipher::tag_size>
-        encrypted_payload;
+      auto error = wrap(phase - *vsync.target);
+      session.telemetry.latency.vsync_phase_error.record(std::chrono::duration_cast<std::chrono::nanoseconds>(std::abs(error) * interval));
 
-      payload = encode_control(session, util::view(plaintext), encrypted_payload);
-    } else if (msg.type == platf::gamepad_feedback_e::set_adaptive_triggers) {
-      control_adaptive_triggers_t plaintext;
-      plaintext.header.type = packetTypes[IDX_SET_ADAPTIVE_TRIGGERS];
-      plaintext.header.payloadLength = sizeof(plaintext) - sizeof(control_header_v2);
+      vsync.error += (error - vsync.error) * SMOOTHING;
+      if (!config::stream.align_client_vsync || session.video.fanout || arrival < vsync.settle_until || std::abs(vsync.error) < DEADBAND) {
+        return;
+      }
 
-      plaintext.id = util::endian::little(msg.id);
-      plaintext.event_flags = msg.data.adaptive_triggers.event_flags;
-      plaintext.type_left = msg.data.adaptive_triggers.type_left;
-      std::ranges::copy(msg.data.adaptive_triggers.left, plaintext.left);
-      plaintext.type_right = msg.data.adaptive_triggers.type_right;
-      std::ranges::copy(msg.data.adaptive_triggers.right, plaintext.right);
+      // Late frames are captured earlier, a quarter of an interval at a time so the stream doesn't stutter
+      auto shift = std::chrono::duration_cast<std::chrono::nanoseconds>(-std::clamp(vsync.error, -0.25, 0.25) * interval);
+      session.video.capture_phase_events->raise(shift);
 
-      std::array<std::uint8_t, sizeof(control_encrypted_t) + crypto::cipher::round_to_pkcs7_padded(sizeof(plaintext)) + crypto::cipher::tag_size>
-        encrypted_payload;
+      BOOST_LOG(debug) << "Frames arrive "sv << (stat_trackers::one_digit_after_decimal() % (vsync.error * 100)).str() << "% of the frame interval off the client vsync phase, shifting the capture by "sv
+                       << (stat_trackers::two_digits_after_decimal() % std::chrono::duration<double, std::milli> {shift}.count()).str() << "ms"sv;
 
-      payload = encode_control(session, util::view(plaintext), encrypted_payload);
-    } else {
-      BOOST_LOG(error) << "Unknown gamepad feedback message type"sv;
-      return -1;
+      vsync.error = 0;
+      vsync.settle_until = arrival + SETTLE_DURATION;
     }
+  }  // namespace vsync_phase
 
-    if (session->broadcast_ref->control_server.send(payload, session->control.peer)) {
-      TUPLE_2D(port, addr, platf::from_sockaddr_ex((sockaddr *) &session->control.peer->address.address));
-      BOOST_LOG(warning) << "Couldn't send gamepad feedback to ["sv << addr << ':' << port << ']';
+  /**
+   * @brief Keep the pipeline of a session whose client dropped off warm, so the client can reconnect to it.
+   * While paused, capture, encoders and audio keep running but their packets are dropped. The client is
+   * matched by the connect data of its launch session on the control stream, and by its ping payload on
+   * the video and audio ports, as its address may have changed.
+   */
+  namespace resume {
+    /**
+     * @brief Pause a session whose client disconnected from the control stream.
+     * @param server The control server.
+     * @param session The session.
+     * @return `true` if the session waits for its client, `false` if it should stop.
+     */
+    bool detach(control_server_t &server, session_t *session) {
+      if (config::stream.resume_grace_period <= 0ms || !(session->config.mlFeatureFlags & ML_FF_SESSION_ID_V1)) {
+        return false;
+      }
 
-      return -1;
+      {
+        auto lg = server._peer_to_session.lock();
+        server._peer_to_session->erase(session->control.peer);
+      }
+      session->control.peer = nullptr;
+      session->resume.paused.store(true, std::memory_order_release);
+
+      auto now = std::chrono::steady_clock::now();
+      session->resume.deadline = now + config::stream.resume_grace_period;
+      session->pingTimeout = std::max(session->pingTimeout, session->resume.deadline);
+
+      // Route the pings of the client here again
+      auto &message_queue_queue = session->broadcast_ref->message_queue_queue;
+      session->resume.video_pings = std::make_shared<message_queue_t::element_type>(30);
+      session->resume.audio_pings = std::make_shared<message_queue_t::element_type>(30);
+      message_queue_queue->raise(socket_e::video, av_session_id_t {session->video.ping_payload}, session->resume.video_pings);
+      message_queue_queue->raise(socket_e::audio, av_session_id_t {session->audio.ping_payload}, session->resume.audio_pings);
+      session->resume.video_peer.reset();
+      session->resume.audio_peer.reset();
+
+      // Keys held when the client dropped off would repeat until it's back
+      input::reset(session->input);
+
+      BOOST_LOG(info) << "Pausing the session for up to "sv << config::stream.resume_grace_period.count() << "ms while the client reconnects"sv;
+      return true;
     }
 
-    return 0;
-  }
-
-  int send_hdr_mode(session_t *session, video::hdr_info_t hdr_info) {
-    if (!session->control.peer) {
-      BOOST_LOG(warning) << "Couldn't send HDR mode, still waiting for PING from Moonlight"sv;
-      // Still waiting for PING from Moonlight
-      return -1;
+    /**
+     * @brief Stop routing the pings of a session to it.
+     * @param session The session.
+     */
+    void unroute_pings(session_t *session) {
+      auto &message_queue_queue = session->broadcast_ref->message_queue_queue;
+      for (auto [type, pings, payload] : {
+             std::tuple {socket_e::video, &session->resume.video_pings, &session->video.ping_payload},
+             std::tuple {socket_e::audio, &session->resume.audio_pings, &session->audio.ping_payload},
+           }) {
+        if (*pings) {
+          (*pings)->stop();
+          message_queue_queue->raise(type, av_session_id_t {*payload}, nullptr);
+          pings->reset();
+        }
+      }
     }
 
-    control_hdr_mode_t plaintext {};
-    plaintext.header.type = packetTypes[IDX_HDR_MODE];
-    plaintext.header.payloadLength = sizeof(control_hdr_mode_t) - sizeof(control_header_v2);
+    /**
+     * @brief Resume a paused session once its client is back on every stream, or stop it when its grace period is over.
+     * @param session The paused session.
+     * @param now The current time.
+     */
+    void poll(session_t *session, std::chrono::steady_clock::time_point now) {
+      auto latest_ping = [](message_queue_t &pings, std::optional<udp::endpoint> &peer) {
+        while (pings && pings->peek()) {
+          if (auto msg = pings->pop()) {
+            peer = msg->first;
+          }
+        }
+      };
+      latest_ping(session->resume.video_pings, session->resume.video_peer);
+      latest_ping(session->resume.audio_pings, session->resume.audio_peer);
 
-    plaintext.enabled = hdr_info->enabled;
-    plaintext.metadata = hdr_info->metadata;
+      if (!session->control.peer || !session->resume.video_peer || !session->resume.audio_peer) {
+        if (now > session->resume.deadline) {
+          BOOST_LOG(info) << "Client didn't reconnect within "sv << config::stream.resume_grace_period.count() << "ms, ending the session"sv;
+          session::stop(*session);
+        }
 
-    std::array<std::uint8_t, sizeof(control_encrypted_t) + crypto::cipher::round_to_pkcs7_padded(sizeof(plaintext)) + crypto::cipher::tag_size>
-      encrypted_payload;
+        return;
+      }
 
-    auto payload = encode_control(session, util::view(plaintext), encrypted_payload);
-    if (session->broadcast_ref->control_server.send(payload, session->control.peer)) {
-      TUPLE_2D(port, addr, platf::from_sockaddr_ex((sockaddr *) &session->control.peer->address.address));
-      BOOST_LOG(warning) << "Couldn't send HDR mode to ["sv << addr << ':' << port << ']';
+      unroute_pings(session);
 
-      return -1;
-    }
+      auto ref = session->broadcast_ref;
+      auto video_peer = *session->resume.video_peer;
+      auto audio_peer = *session->resume.audio_peer;
+      session->video.qos = platf::enable_socket_qos(ref->video_sock.native_handle(), video_peer.address(), video_peer.port(), platf::qos_data_type_e::video, session->config.videoQosType != 0);
+      session->audio.qos = platf::enable_socket_qos(ref->audio_sock.native_handle(), audio_peer.address(), audio_peer.port(), platf::qos_data_type_e::audio, session->config.audioQosType != 0);
 
-    BOOST_LOG(debug) << "Sent HDR mode: " << hdr_info->enabled;
-    return 0;
-  }
+      // A frame still being sent reads the old peer, the send threads switch over before their next frame or packet
+      session->resume.video_handoff.raise(video_peer);
+      session->resume.audio_handoff.raise(audio_peer);
+      session->resume.paused.store(false, std::memory_order_release);
+
+      // The client lost its reference frames along with the connection
+      fanout::with_encoder(session, [](session_t *encoder) {
+        encoder->video.idr_events->raise(true);
+      });
+
+      BOOST_LOG(info) << "Resuming the session, video to "sv << video_peer.address() << ':' << video_peer.port()
+                      << ", audio to "sv << audio_peer.address() << ':' << audio_peer.port();
+    }
+  }  // namespace resume
 
   void controlBroadcastThread(control_server_t *server) {
     server->map(packetTypes[IDX_PERIODIC_PING], [](session_t *session, const std::string_view &payload) {
       BOOST_LOG(verbose) << "type [IDX_PERIODIC_PING]"sv;
+
+      session->video.rtt_ms = session->control.peer->roundTripTime;
     });
 
     server->map(packetTypes[IDX_START_A], [&](session_t *session, const std::string_view &payload) {
@@ -941,12 +2466,31 @@ namespace stream {
         << "time in milli since last report [" << t.count() << ']' << std::endl
         << "last good frame [" << lastGoodFrame << ']' << std::endl
         << "---end stats---";
+
+      // Clients predating the periodic ping report loss instead
+      session->video.rtt_ms = session->control.peer->roundTripTime;
+
+      if (count > 0) {
+        {
+          std::lock_guard lg {session->telemetry.lock};
+          session->telemetry.frames_lost += count;
+        }
+
+        session->video.probe.lost = true;
+        fec::raise(session, "loss report"sv);
+        bitrate::lower(session);
+      } else {
+        fec::decay(session, std::max(t, 0ms));
+        bitrate::restore(session, std::max(t, 0ms));
+      }
     });
 
     server->map(packetTypes[IDX_REQUEST_IDR_FRAME], [&](session_t *session, const std::string_view &payload) {
       BOOST_LOG(debug) << "type [IDX_REQUEST_IDR_FRAME]"sv;
 
-      session->video.idr_events->raise(true);
+      fanout::with_encoder(session, [](session_t *encoder) {
+        encoder->video.idr_events->raise(true);
+      });
     });
 
     server->map(packetTypes[IDX_INVALIDATE_REF_FRAMES], [&](session_t *session, const std::string_view &payload) {
@@ -959,13 +2503,30 @@ namespace stream {
         << "firstFrame [" << firstFrame << ']' << std::endl
         << "lastFrame [" << lastFrame << ']';
 
-      session->video.invalidate_ref_frames_events->raise(std::make_pair(firstFrame, lastFrame));
+      // Frames the client can't decode are frames FEC failed to recover
+      fec::raise(session, "reference frame invalidation"sv);
+
+      // The client numbers frames differently than a shared encoder once the encoder changed hands
+      auto offset = session->video.frame_index_offset.load();
+      fanout::with_encoder(session, [&](session_t *encoder) {
+        invalidate_ref_frames(encoder, firstFrame - offset, lastFrame - offset);
+      });
     });
 
     server->map(packetTypes[IDX_INPUT_DATA], [&](session_t *session, const std::string_view &payload) {
       BOOST_LOG(debug) << "type [IDX_INPUT_DATA]"sv;
 
+      if (payload.size() < sizeof(int32_t)) {
+        BOOST_LOG(warning) << "Control: Runt packet"sv;
+        return;
+      }
+
       auto tagged_cipher_length = util::endian::big(*(int32_t *) payload.data());
+      if (tagged_cipher_length < (int32_t) crypto::cipher::tag_size || (std::size_t) tagged_cipher_length > payload.size() - sizeof(tagged_cipher_length)) {
+        BOOST_LOG(warning) << "Control: Runt packet"sv;
+        return;
+      }
+
       std::string_view tagged_cipher {payload.data() + sizeof(tagged_cipher_length), (size_t) tagged_cipher_length};
 
       std::vector<uint8_t> plaintext;
@@ -991,43 +2552,15 @@ namespace stream {
     server->map(packetTypes[IDX_ENCRYPTED], [server](session_t *session, const std::string_view &payload) {
       BOOST_LOG(verbose) << "type [IDX_ENCRYPTED]"sv;
 
-      auto header = (control_encrypted_p) (payload.data() - 2);
-
-      auto length = util::endian::little(header->length);
-      auto seq = util::endian::little(header->seq);
-
-      if (length < (16 + 4 + 4)) {
+      // The handler gets the message after its type, the encrypted header starts with the type
+      std::vector<uint8_t> plaintext;
+      auto status = decrypt_control(session->control.cipher, session->control.incoming_iv, session->config.encryptionFlagsEnabled & SS_ENC_CONTROL_V2, std::string_view {payload.data() - 2, payload.size() + 2}, plaintext);
+      if (status == -1) {
         BOOST_LOG(warning) << "Control: Runt packet"sv;
         return;
       }
 
-      auto tagged_cipher_length = length - 4;
-      std::string_view tagged_cipher {(char *) header->payload(), (size_t) tagged_cipher_length};
-
-      auto &cipher = session->control.cipher;
-      auto &iv = session->control.incoming_iv;
-      if (session->config.encryptionFlagsEnabled & SS_ENC_CONTROL_V2) {
-        // We use the deterministic IV construction algorithm specified in NIST SP 800-38D
-        // Section 8.2.1. The sequence number is our "invocation" field and the 'CC' in the
-        // high bytes is the "fixed" field. Because each client provides their own unique
-        // key, our values in the fixed field need only uniquely identify each independent
-        // use of the client's key with AES-GCM in our code.
-        //
-        // The sequence number is 32 bits long which allows for 2^32 control stream messages
-        // to be received from each client before the IV repeats.
-        iv.resize(12);
-        std::copy_n((uint8_t *) &seq, sizeof(seq), std::begin(iv));
-        iv[10] = 'C';  // Client originated
-        iv[11] = 'C';  // Control stream
-      } else {
-        // Nvidia's old style encryption uses a 16-byte IV
-        iv.resize(16);
-
-        iv[0] = (std::uint8_t) seq;
-      }
-
-      std::vector<uint8_t> plaintext;
-      if (cipher.decrypt(tagged_cipher, plaintext, &iv)) {
+      if (status) {
         // something went wrong :(
 
         BOOST_LOG(error) << "Failed to verify tag"sv;
@@ -1055,6 +2588,7 @@ namespace stream {
     });
 
     // This thread handles latency-sensitive control messages
+    platf::set_thread_name("control"s);
     platf::adjust_thread_priority(platf::thread_priority_e::critical);
 
     // Check for both the full shutdown event and the shutdown event for this
@@ -1062,14 +2596,16 @@ namespace stream {
     // termination when we shut down.
     auto shutdown_event = mail::man->event<bool>(mail::shutdown);
     auto broadcast_shutdown_event = mail::man->event<bool>(mail::broadcast_shutdown);
+
+    logging::min_max_avg_periodic_logger<int> events_per_wakeup_logger(debug, "Control: events per wakeup", "");
     while (!shutdown_event->peek() && !broadcast_shutdown_event->peek()) {
       bool has_session_awaiting_peer = false;
 
+      auto now = std::chrono::steady_clock::now();
+      auto next_wakeup = now + 150ms;
       {
         auto lg = server->_sessions.lock();
 
-        auto now = std::chrono::steady_clock::now();
-
         KITTY_WHILE_LOOP(auto pos = std::begin(*server->_sessions), pos != std::end(*server->_sessions), {
           // Don't perform additional session processing if we're shutting down
           if (shutdown_event->peek() || broadcast_shutdown_event->peek()) {
@@ -1078,6 +2614,10 @@ namespace stream {
 
           auto session = *pos;
 
+          if (session->resume.paused.load(std::memory_order_relaxed) && session->state.load(std::memory_order_relaxed) == session::state_e::RUNNING) {
+            resume::poll(session, now);
+          }
+
           if (now > session->pingTimeout) {
             auto address = session->control.peer ? platf::from_sockaddr((sockaddr *) &session->control.peer->address.address) : session->control.expected_peer_address;
             BOOST_LOG(info) << address << ": Ping Timeout"sv;
@@ -1086,6 +2626,7 @@ namespace stream {
 
           if (session->state.load(std::memory_order_acquire) == session::state_e::STOPPING) {
             pos = server->_sessions->erase(pos);
+            resume::unroute_pings(session);
 
             if (session->control.peer) {
               {
@@ -1110,13 +2651,19 @@ namespace stream {
             while (feedback_queue->peek()) {
               auto feedback_msg = feedback_queue->pop();
 
-              send_feedback_msg(session, *feedback_msg);
+              feedback::coalesce(session, *feedback_msg);
+            }
+
+            // Don't sleep past the feedback still held back, so the last update always arrives
+            if (auto due = feedback::flush(session, now)) {
+              next_wakeup = std::min(next_wakeup, *due);
             }
 
             auto &hdr_queue = session->control.hdr_queue;
             while (session->control.peer && hdr_queue->peek()) {
               auto hdr_info = hdr_queue->pop();
 
+              fanout::share_hdr(session, *hdr_info);
               send_hdr_mode(session, std::move(hdr_info));
             }
           }
@@ -1131,7 +2678,11 @@ namespace stream {
         break;
       }
 
-      server->iterate(150ms);
+      auto timeout = std::chrono::ceil<std::chrono::milliseconds>(next_wakeup - std::chrono::steady_clock::now());
+      auto events = server->iterate(std::max(timeout, 0ms));
+      if (events > 0) {
+        events_per_wakeup_logger.collect_and_log(events);
+      }
     }
 
     // Let all remaining connections know the server is shutting down
@@ -1168,8 +2719,10 @@ namespace stream {
   }
 
   void recvThread(broadcast_ctx_t &ctx) {
-    std::map<av_session_id_t, message_queue_t> peer_to_video_session;
-    std::map<av_session_id_t, message_queue_t> peer_to_audio_session;
+    platf::set_thread_name("stream_recv"s);
+
+    std::unordered_map<av_session_id_t, message_queue_t> peer_to_video_session;
+    std::unordered_map<av_session_id_t, message_queue_t> peer_to_audio_session;
 
     auto &video_sock = ctx.video_sock;
     auto &audio_sock = ctx.audio_sock;
@@ -1179,10 +2732,12 @@ namespace stream {
 
     auto &io = ctx.io_context;
 
-    udp::endpoint peer;
+    // Datagrams received per wakeup on each socket
+    constexpr std::size_t max_datagrams = 16;
+    constexpr std::size_t max_datagram_size = 2048;
 
-    std::array<char, 2048> buf[2];
-    std::function<void(const boost::system::error_code, size_t)> recv_func[2];
+    std::vector<char> buf[2] {std::vector<char>(max_datagrams * max_datagram_size), std::vector<char>(max_datagrams * max_datagram_size)};
+    std::function<void(const boost::system::error_code)> recv_func[2];
 
     auto populate_peer_to_session = [&]() {
       while (message_queue_queue->peek()) {
@@ -1208,73 +2763,174 @@ namespace stream {
       }
     };
 
-    auto recv_func_init = [&](udp::socket &sock, int buf_elem, std::map<av_session_id_t, message_queue_t> &peer_to_session) {
-      recv_func[buf_elem] = [&, buf_elem](const boost::system::error_code &ec, size_t bytes) {
+    auto handle_datagram = [&](std::unordered_map<av_session_id_t, message_queue_t> &peer_to_session, std::string_view type_str, const udp::endpoint &peer, std::string_view data) {
+      BOOST_LOG(verbose) << "Recv: "sv << peer.address().to_string() << ':' << peer.port() << " :: " << type_str;
+
+      if (data.size() == 4) {
+        // For legacy PING packets, find the matching session by address.
+        auto it = peer_to_session.find(peer.address());
+        if (it != std::end(peer_to_session)) {
+          BOOST_LOG(debug) << "RAISE: "sv << peer.address().to_string() << ':' << peer.port() << " :: " << type_str;
+          it->second->raise(peer, std::string {data});
+        }
+      } else if (data.size() >= sizeof(SS_PING)) {
+        auto ping = (PSS_PING) data.data();
+
+        // For new PING packets that include a client identifier, search by payload.
+        auto it = peer_to_session.find(std::string {ping->payload, sizeof(ping->payload)});
+        if (it != std::end(peer_to_session)) {
+          BOOST_LOG(debug) << "RAISE: "sv << peer.address().to_string() << ':' << peer.port() << " :: " << type_str;
+          it->second->raise(peer, std::string {data});
+        }
+      }
+    };
+
+    auto recv_func_init = [&](udp::socket &sock, int buf_elem, std::unordered_map<av_session_id_t, message_queue_t> &peer_to_session) {
+      recv_func[buf_elem] = [&, buf_elem](const boost::system::error_code &ec) {
         auto fg = util::fail_guard([&]() {
-          sock.async_receive_from(asio::buffer(buf[buf_elem]), peer, 0, recv_func[buf_elem]);
+          sock.async_wait(udp::socket::wait_read, recv_func[buf_elem]);
         });
 
+        if (ec) {
+          BOOST_LOG(error) << "Couldn't wait for data on udp socket: "sv << ec.message();
+          return;
+        }
+
         auto type_str = buf_elem ? "AUDIO"sv : "VIDEO"sv;
-        BOOST_LOG(verbose) << "Recv: "sv << peer.address().to_string() << ':' << peer.port() << " :: " << type_str;
+        auto &buffer = buf[buf_elem];
 
         populate_peer_to_session();
 
-        // No data, yet no error
-        if (ec == boost::system::errc::connection_refused || ec == boost::system::errc::connection_reset) {
-          return;
-        }
+        // Drain everything that arrived since the last wakeup
+        platf::recv_batch_info_t recv_info {
+          (uintptr_t) sock.native_handle(),
+          buffer.data(),
+          max_datagram_size,
+          max_datagrams,
+        };
+        if (platf::recv_batch(recv_info)) {
+          do {
+            for (size_t i = 0; i < recv_info.datagrams.size(); i++) {
+              auto &datagram = recv_info.datagrams[i];
+              handle_datagram(peer_to_session, type_str, udp::endpoint {datagram.address, datagram.port}, std::string_view {buffer.data() + i * max_datagram_size, datagram.size});
+            }
+          } while (recv_info.datagrams.size() == max_datagrams && platf::recv_batch(recv_info));
 
-        if (ec || !bytes) {
-          BOOST_LOG(error) << "Couldn't receive data from udp socket: "sv << ec.message();
           return;
         }
 
-        if (bytes == 4) {
-          // For legacy PING packets, find the matching session by address.
-          auto it = peer_to_session.find(peer.address());
-          if (it != std::end(peer_to_session)) {
-            BOOST_LOG(debug) << "RAISE: "sv << peer.address().to_string() << ':' << peer.port() << " :: " << type_str;
-            it->second->raise(peer, std::string {buf[buf_elem].data(), bytes});
+        // Batched receive is not available, so receive each datagram individually.
+        // The socket is readable, so the first receive doesn't block even if it only picks up an error.
+        boost::system::error_code recv_ec;
+        do {
+          udp::endpoint peer;
+          auto bytes = sock.receive_from(asio::buffer(buffer.data(), max_datagram_size), peer, 0, recv_ec);
+
+          // No data, yet no error
+          if (recv_ec == boost::system::errc::connection_refused || recv_ec == boost::system::errc::connection_reset) {
+            recv_ec.clear();
+            continue;
           }
-        } else if (bytes >= sizeof(SS_PING)) {
-          auto ping = (PSS_PING) buf[buf_elem].data();
-
-          // For new PING packets that include a client identifier, search by payload.
-          auto it = peer_to_session.find(std::string {ping->payload, sizeof(ping->payload)});
-          if (it != std::end(peer_to_session)) {
-            BOOST_LOG(debug) << "RAISE: "sv << peer.address().to_string() << ':' << peer.port() << " :: " << type_str;
-            it->second->raise(peer, std::string {buf[buf_elem].data(), bytes});
+
+          if (recv_ec || !bytes) {
+            BOOST_LOG(error) << "Couldn't receive data from udp socket: "sv << recv_ec.message();
+            return;
           }
-        }
+
+          handle_datagram(peer_to_session, type_str, peer, std::string_view {buffer.data(), bytes});
+        } while (sock.available(recv_ec) && !recv_ec);
       };
     };
 
     recv_func_init(video_sock, 0, peer_to_video_session);
     recv_func_init(audio_sock, 1, peer_to_audio_session);
 
-    video_sock.async_receive_from(asio::buffer(buf[0]), peer, 0, recv_func[0]);
-    audio_sock.async_receive_from(asio::buffer(buf[1]), peer, 0, recv_func[1]);
+    video_sock.async_wait(udp::socket::wait_read, recv_func[0]);
+    audio_sock.async_wait(udp::socket::wait_read, recv_func[1]);
 
     while (!broadcast_shutdown_event->peek()) {
       io.run();
     }
   }
 
-  void videoBroadcastThread(udp::socket &sock) {
+  /**
+   * @brief Record the stage latencies of a frame that was just sent, and log their percentiles now and then.
+   * @param session The session the frame was sent to.
+   * @param packet The frame.
+   * @param frame_start When the broadcast thread started on the frame.
+   * @param fec_wait Time the broadcast thread waited for parity.
+   */
+  void record_stage_latency(session_t &session, video::packet_raw_t &packet, std::chrono::steady_clock::time_point frame_start, std::chrono::steady_clock::duration fec_wait) {
+    auto now = std::chrono::steady_clock::now();
+    auto &latency = session.telemetry.latency;
+
+    // Repeated frames weren't captured, converted or encoded just now, so only the network stages count
+    std::chrono::steady_clock::duration handoff {};
+    if (packet.stage_timestamps) {
+      auto &stages = *packet.stage_timestamps;
+      latency.capture.record(stages.convert_start - *packet.frame_timestamp);
+      latency.convert.record(stages.encode_start - stages.convert_start);
+      latency.encode.record(stages.encode_end - stages.encode_start);
+      handoff = frame_start - stages.encode_end;
+    }
+    latency.fec.record(handoff + fec_wait);
+    latency.send.record(now - frame_start - fec_wait);
+    if (packet.frame_timestamp) {
+      latency.total.record(now - *packet.frame_timestamp);
+    }
+
+    // Repeated frames go out whenever the encoder repeats them, only captured frames follow the capture phase
+    if (packet.stage_timestamps) {
+      vsync_phase::update(session, now);
+    }
+
+    if (now - latency.last_log < 20s) {
+      return;
+    }
+    latency.last_log = now;
+
+    auto format = [](const stat_trackers::latency_histogram_t &histogram) {
+      using histogram_t = stat_trackers::latency_histogram_t;
+
+      auto counts = histogram.snapshot();
+      return (stat_trackers::two_digits_after_decimal() % histogram_t::percentile(counts, 0.5)).str() + '/' +
+             (stat_trackers::two_digits_after_decimal() % histogram_t::percentile(counts, 0.99)).str();
+    };
+    BOOST_LOG(debug) << "Frame latency p50/p99 [ms]: capture "sv << format(latency.capture)
+                     << ", convert "sv << format(latency.convert)
+                     << ", encode "sv << format(latency.encode)
+                     << ", fec "sv << format(latency.fec)
+                     << ", send "sv << format(latency.send)
+                     << ", total "sv << format(latency.total)
+                     << ", vsync phase error "sv << format(latency.vsync_phase_error);
+  }
+
+  /**
+   * @brief Send the video packets of the sessions of one shard.
+   * @param sock The video socket.
+   * @param video_epoch Zero point of the RTP timestamps.
+   * @param packets The packets of the shard, sending stops once the ring is stopped.
+   * @param zerocopy_send Send with zero-copy, only set when this is the only shard sending on sock.
+   */
+  void videoSendLoop(udp::socket &sock, std::chrono::steady_clock::time_point video_epoch, safe::ring_t<video::packet_t> &packets, bool zerocopy_send) {
     auto shutdown_event = mail::man->event<bool>(mail::broadcast_shutdown);
-    auto packets = mail::man->queue<video::packet_t>(mail::video_packets);
-    auto video_epoch = std::chrono::steady_clock::now();
 
     // Video traffic is sent on this thread
+    platf::set_thread_name("video_send"s);
     platf::adjust_thread_priority(platf::thread_priority_e::high);
 
     logging::min_max_avg_periodic_logger<double> frame_processing_latency_logger(debug, "Frame processing latency", "ms");
+    logging::min_max_avg_periodic_logger<int> fec_percentage_logger(debug, "FEC percentage", "%");
 
     logging::time_delta_periodic_logger frame_send_batch_latency_logger(debug, "Network: each send_batch() latency");
     logging::time_delta_periodic_logger frame_fec_latency_logger(debug, "Network: each FEC block latency");
     logging::time_delta_periodic_logger frame_network_latency_logger(debug, "Network: frame's overall network latency");
 
-    crypto::aes_t iv(12);
+    // A separate IV for each FEC block, because blocks are sealed concurrently
+    std::array<crypto::aes_t, MAX_FEC_BLOCKS> block_ivs;
+    for (auto &iv : block_ivs) {
+      iv.resize(12);
+    }
 
     auto timer = platf::create_high_precision_timer();
     if (!timer || !*timer) {
@@ -1282,309 +2938,685 @@ namespace stream {
       return;
     }
 
+    // Parity for the other FEC blocks of a frame is computed here while the first block is sent
+    thread_pool_util::ThreadPool fec_pool {MAX_FEC_BLOCKS - 1};
+
+    // With kernel pacing, each batch carries the time it's due and the fq qdisc holds it back
+    // until then, so this thread never sleeps between batches
+    bool kernel_pacing = false;
+    if (config::stream.kernel_pacing) {
+      kernel_pacing = platf::enable_socket_txtime(sock.native_handle());
+      if (!kernel_pacing) {
+        BOOST_LOG(warning) << "Kernel packet pacing isn't available, pacing video in user space"sv;
+      }
+    }
+
+    // With zero-copy sends, the kernel reads the packets out of the session's payload and shard buffers
+    // after send_batch() returns, so they're only written again once it reports being done with them
+    platf::zerocopy_state_t zerocopy;
+
     auto ratecontrol_next_frame_start = std::chrono::steady_clock::now();
 
-    while (auto packet = packets->pop()) {
+    while (auto packet = packets.pop()) {
       if (shutdown_event->peek()) {
         break;
       }
 
-      frame_network_latency_logger.first_point_now();
+      auto encoder = (session_t *) packet->channel_data;
 
-      auto session = (session_t *) packet->channel_data;
-      auto lowseq = session->video.lowseq;
+      // The encoder raises the touch port before the first frame of a display
+      if (encoder->video.touch_port_events->peek()) {
+        fanout::share_touch_port(encoder);
+      }
 
-      std::string_view payload {(char *) packet->data(), packet->data_size()};
-      std::vector<uint8_t> payload_with_replacements;
+      // Sessions sharing the encoder get the frame too. The group is only locked to take them,
+      // a session leaving waits until the frames in flight were sent instead
+      std::vector<session_t *> viewers {encoder};
+      auto group = encoder->video.fanout.get();
+      if (group) {
+        std::lock_guard lg {group->lock};
+        viewers = group->viewers;
+
+        // Frames still queued by a session that handed the encoder over go nowhere
+        if (viewers.empty() || viewers.front() != encoder) {
+          viewers.clear();
+        } else {
+          ++group->sending;
+        }
+      }
+      auto sent_fg = util::fail_guard([&]() {
+        if (!group || viewers.empty()) {
+          return;
+        }
 
-      // Apply replacements on the packet payload before performing any other operations.
-      // We need to know the final frame size to calculate the last packet size, and we
-      // must avoid matching replacements against the frame header or any other non-video
-      // part of the payload.
-      if (packet->is_idr() && packet->replacements) {
-        for (auto &replacement : *packet->replacements) {
-          auto frame_old = replacement.old;
-          auto frame_new = replacement._new;
+        std::lock_guard lg {group->lock};
+        if (--group->sending == 0) {
+          group->frame_sent.notify_all();
+        }
+      });
 
-          payload_with_replacements = replace(payload, frame_old, frame_new);
-          payload = {(char *) payload_with_replacements.data(), payload_with_replacements.size()};
+      // Only copied here, the DVR and egress threads write and send them without holding up the viewers
+      if (!viewers.empty()) {
+        auto dvr_wants_key_frame = video::dvr::mirror(*packet, encoder->config.monitor);
+        auto egress_wants_key_frame = rtp_egress::forward(*packet, encoder->config.monitor);
+        if (dvr_wants_key_frame || egress_wants_key_frame) {
+          encoder->video.idr_events->raise(true);
         }
       }
 
-      video_short_frame_header_t frame_header = {};
-      frame_header.headerType = 0x01;  // Short header type
-      frame_header.frameType = packet->is_idr()                     ? 2 :
-                               packet->after_ref_frame_invalidation ? 5 :
-                                                                      1;
-      frame_header.lastPayloadLen = (payload.size() + sizeof(frame_header)) % (session->config.packetsize - sizeof(NV_VIDEO_PACKET));
-      if (frame_header.lastPayloadLen == 0) {
-        frame_header.lastPayloadLen = session->config.packetsize - sizeof(NV_VIDEO_PACKET);
-      }
+      for (auto session : viewers) {
+        frame_network_latency_logger.first_point_now();
+        auto frame_start = std::chrono::steady_clock::now();
+        std::chrono::steady_clock::duration fec_wait {};
 
-      if (packet->frame_timestamp) {
-        auto duration_to_latency = [](const std::chrono::steady_clock::duration &duration) {
-          const auto duration_us = std::chrono::duration_cast<std::chrono::microseconds>(duration).count();
-          return (uint16_t) std::clamp<decltype(duration_us)>((duration_us + 50) / 100, 0, std::numeric_limits<uint16_t>::max());
-        };
+        auto lowseq = session->video.lowseq;
 
-        uint16_t latency = duration_to_latency(std::chrono::steady_clock::now() - *packet->frame_timestamp);
-        frame_header.frame_processing_latency = latency;
-        frame_processing_latency_logger.collect_and_log(latency / 10.);
-      } else {
-        frame_header.frame_processing_latency = 0;
-      }
+        // Encoders that read back slices send a frame in parts, the first one carries the frame header
+        auto partial = packet->slice_groups > 1;
+        auto first_part = packet->slice_group == 0;
+        auto last_part = packet->slice_group + 1 == packet->slice_groups;
 
-      auto fecPercentage = config::stream.fec_percentage;
+        // Keep frame numbers continuous for viewers when another session takes over the shared encoder
+        if (first_part && session->video.frame_source != encoder) {
+          if (session->video.frame_source) {
+            session->video.frame_index_offset = session->video.last_frame_index + 1 - packet->frame_index();
+          }
+          session->video.frame_source = encoder;
+        }
+        auto frame_index = packet->frame_index() + session->video.frame_index_offset;
 
-      // Insert space for packet headers
-      auto blocksize = session->config.packetsize + MAX_RTP_HEADER_SIZE;
-      auto payload_blocksize = blocksize - sizeof(video_packet_raw_t);
-      auto payload_new = concat_and_insert(sizeof(video_packet_raw_t), payload_blocksize, std::string_view {(char *) &frame_header, sizeof(frame_header)}, payload);
+        // The rest of a frame is no use to a session that missed its first part
+        if (!first_part && (session->video.frame_source != encoder || session->video.last_frame_index != frame_index)) {
+          continue;
+        }
 
-      payload = std::string_view {(char *) payload_new.data(), payload_new.size()};
+        // Every frame references the one before it, so after a drop nothing decodes until the encoder recovers
+        if (first_part) {
+          auto now = std::chrono::steady_clock::now();
+          auto age = packet->frame_timestamp ? std::make_optional(now - *packet->frame_timestamp) : std::nullopt;
 
-      // There are 2 bits for FEC block count for a maximum of 4 FEC blocks
-      constexpr auto MAX_FEC_BLOCKS = 4;
+          // Nothing goes to a client that dropped off, and once it's back nothing decodes until a key frame
+          if (session->resume.paused.load(std::memory_order_acquire)) {
+            session->video.awaiting_recovery = true;
+            session->video.recovery_deadline = now + late_frames::RECOVERY_TIMEOUT;
+            continue;
+          }
+          if (auto peer = session->resume.video_handoff.pop(0ms)) {
+            // The network stats read the peer under the telemetry lock
+            std::lock_guard lg {session->telemetry.lock};
+            session->video.peer = *peer;
+          }
 
-      // The max number of data shards per block is found by solving this system of equations for D:
-      // D = 255 - P
-      // P = D * F
-      // which results in the solution:
-      // D = 255 / (1 + F)
-      // multiplied by 100 since F is the percentage as an integer:
-      // D = (255 * 100) / (100 + F)
-      auto max_data_shards_per_fec_block = (DATA_SHARDS_MAX * 100) / (100 + fecPercentage);
+          if (session->video.awaiting_recovery && (packet->is_idr() || packet->after_ref_frame_invalidation)) {
+            session->video.awaiting_recovery = false;
+          } else if (!session->video.awaiting_recovery && late_frames::too_late(age, packets.peek(), config::stream.max_frame_latency)) {
+            BOOST_LOG(debug) << "Dropping frame "sv << frame_index << ", it waited "sv
+                             << std::chrono::duration_cast<std::chrono::milliseconds>(*age).count() << " ms to be sent"sv;
 
-      // Compute the number of FEC blocks needed for this frame using the block size and max shards
-      auto max_data_per_fec_block = max_data_shards_per_fec_block * blocksize;
-      auto fec_blocks_needed = (payload.size() + (max_data_per_fec_block - 1)) / max_data_per_fec_block;
+            session->video.awaiting_recovery = true;
+            session->video.recovery_deadline = now + late_frames::RECOVERY_TIMEOUT;
+            invalidate_ref_frames(encoder, packet->frame_index(), packet->frame_index());
+          }
 
-      // If the number of FEC blocks needed exceeds the protocol limit, turn off FEC for this frame.
-      // For normal FEC percentages, this should only happen for enormous frames (over 800 packets at 20%).
-      if (fec_blocks_needed > MAX_FEC_BLOCKS) {
-        BOOST_LOG(warning) << "Skipping FEC for abnormally large encoded frame (needed "sv << fec_blocks_needed << " FEC blocks)"sv;
-        fecPercentage = 0;
-        fec_blocks_needed = MAX_FEC_BLOCKS;
-      }
+          if (session->video.awaiting_recovery) {
+            // Encoders without reference frame invalidation only recover with a key frame
+            if (now >= session->video.recovery_deadline) {
+              encoder->video.idr_events->raise(true);
+              session->video.recovery_deadline = now + late_frames::RECOVERY_TIMEOUT;
+            }
 
-      std::array<std::string_view, MAX_FEC_BLOCKS> fec_blocks;
-      decltype(fec_blocks)::iterator
-        fec_blocks_begin = std::begin(fec_blocks),
-        fec_blocks_end = std::begin(fec_blocks) + fec_blocks_needed;
+            std::lock_guard lg {session->telemetry.lock};
+            ++session->telemetry.frames_dropped;
+            continue;
+          }
+        }
+        session->video.last_frame_index = frame_index;
+
+        std::string_view payload {(char *) packet->data(), packet->data_size()};
 
-      BOOST_LOG(verbose) << "Generating "sv << fec_blocks_needed << " FEC blocks"sv;
+        // The frame header and the payload are gathered into the packets with a single copy.
+        // The header is filled in below, once the final frame size is known.
+        video_short_frame_header_t frame_header = {};
+        auto &payload_segments = session->video.payload_segments;
+        payload_segments.clear();
+        if (first_part) {
+          payload_segments.emplace_back((char *) &frame_header, sizeof(frame_header));
+        }
 
-      // Align individual FEC blocks to blocksize
-      auto unaligned_size = payload.size() / fec_blocks_needed;
-      auto aligned_size = ((unaligned_size + (blocksize - 1)) / blocksize) * blocksize;
+        // Apply replacements on the packet payload before performing any other operations.
+        // We need to know the final frame size to calculate the last packet size, and we
+        // must avoid matching replacements against the frame header or any other non-video
+        // part of the payload.
+        if (packet->is_idr() && packet->replacements) {
+          split_replacements(payload_segments, payload, *packet->replacements);
+        } else {
+          payload_segments.emplace_back(payload);
+        }
 
-      // If we exceed the 10-bit FEC packet index (which means our frame exceeded 4096 packets),
-      // the frame will be unrecoverable. Log an error for this case.
-      if (aligned_size / blocksize >= 1024) {
-        BOOST_LOG(error) << "Encoder produced a frame too large to send! Is the encoder broken? (needed "sv << (aligned_size / blocksize) << " packets)"sv;
-      }
+        std::size_t payload_size = 0;
+        for (auto &segment : payload_segments) {
+          payload_size += segment.size();
+        }
+
+        // Every part is sent as an FEC block the client waits for, even one the encoder left empty
+        if (payload_size == 0) {
+          static constexpr char zero_padding = 0;
+          payload_segments.emplace_back(&zero_padding, 1);
+          payload_size = 1;
+        }
+
+        frame_header.headerType = 0x01;  // Short header type
+        frame_header.frameType = packet->is_idr()                     ? 2 :
+                                 packet->after_ref_frame_invalidation ? 5 :
+                                                                        1;
+        frame_header.lastPayloadLen = payload_size % (session->config.packetsize - sizeof(NV_VIDEO_PACKET));
+        if (frame_header.lastPayloadLen == 0) {
+          frame_header.lastPayloadLen = session->config.packetsize - sizeof(NV_VIDEO_PACKET);
+        }
+
+        // The size of a frame sent in parts isn't known with its header. Without the length of the last packet
+        // the client keeps its zero padding, which H.264 and HEVC decoders skip as trailing zero bytes.
+        if (partial) {
+          frame_header.lastPayloadLen = 0;
+        }
+
+        if (first_part && packet->frame_timestamp) {
+          auto duration_to_latency = [](const std::chrono::steady_clock::duration &duration) {
+            const auto duration_us = std::chrono::duration_cast<std::chrono::microseconds>(duration).count();
+            return (uint16_t) std::clamp<decltype(duration_us)>((duration_us + 50) / 100, 0, std::numeric_limits<uint16_t>::max());
+          };
 
-      // Split the data into aligned FEC blocks
-      for (int x = 0; x < fec_blocks_needed; ++x) {
-        if (x == fec_blocks_needed - 1) {
-          // The last block must extend to the end of the payload
-          fec_blocks[x] = payload.substr(x * aligned_size);
+          uint16_t latency = duration_to_latency(std::chrono::steady_clock::now() - *packet->frame_timestamp);
+          frame_header.frame_processing_latency = latency;
+          frame_processing_latency_logger.collect_and_log(latency / 10.);
         } else {
-          // Earlier blocks just extend to the next block offset
-          fec_blocks[x] = payload.substr(x * aligned_size, aligned_size);
+          frame_header.frame_processing_latency = 0;
         }
-      }
 
-      try {
-        // Use around 80% of 1Gbps          1Gbps            percent    ms     packet      byte
-        size_t ratecontrol_packets_in_1ms = std::giga::num * 80 / 100 / 1000 / blocksize / 8;
-
-        // Send less than 64K in a single batch.
-        // On Windows, batches above 64K seem to bypass SO_SNDBUF regardless of its size,
-        // appear in "Other I/O" and begin waiting for interrupts.
-        // This gives inconsistent performance so we'd rather avoid it.
-        size_t send_batch_size = 64 * 1024 / blocksize;
-        // Also don't exceed 64 packets, which can happen when Moonlight requests
-        // unusually small packet size.
-        // Generic Segmentation Offload on Linux can't do more than 64.
-        send_batch_size = std::min<size_t>(64, send_batch_size);
-
-        // Don't ignore the last ratecontrol group of the previous frame
-        auto ratecontrol_frame_start = std::max(ratecontrol_next_frame_start, std::chrono::steady_clock::now());
-
-        size_t ratecontrol_frame_packets_sent = 0;
-        size_t ratecontrol_group_packets_sent = 0;
-
-        auto blockIndex = 0;
-        std::for_each(fec_blocks_begin, fec_blocks_end, [&](std::string_view &current_payload) {
-          auto packets = (current_payload.size() + (blocksize - 1)) / blocksize;
-
-          for (int x = 0; x < packets; ++x) {
-            auto *inspect = (video_packet_raw_t *) &current_payload[x * blocksize];
-
-            inspect->packet.frameIndex = packet->frame_index();
-            inspect->packet.streamPacketIndex = ((uint32_t) lowseq + x) << 8;
-
-            // Match multiFecFlags with Moonlight
-            inspect->packet.multiFecFlags = 0x10;
-            inspect->packet.multiFecBlocks = (blockIndex << 4) | ((fec_blocks_needed - 1) << 6);
-
-            inspect->packet.flags = FLAG_CONTAINS_PIC_DATA;
-            if (x == 0) {
-              inspect->packet.flags |= FLAG_SOF;
-            }
-            if (x == packets - 1) {
-              inspect->packet.flags |= FLAG_EOF;
-            }
+        if (first_part) {
+          auto now = std::chrono::steady_clock::now();
+          probe::start(session, now);
+          probe::finish(session, now);
+        }
+
+        // While probing the frames are padded with parity, the client gets them intact either way
+        auto fecPercentage = session->video.fec_percentage.load();
+        if (probe::active(session)) {
+          fecPercentage = std::max(fecPercentage, probe::FEC_PERCENTAGE);
+        }
+
+        // Losing a key frame or the frame that recovers from a loss costs the client another one, so they carry more parity
+        if (packet->is_idr() || packet->after_ref_frame_invalidation) {
+          fecPercentage = std::max(fecPercentage, config::stream.fec_percentage_key_frame);
+        }
+        fec_percentage_logger.collect_and_log(fecPercentage);
+
+        // The last frame may still be on its way out of the buffers this one is about to be written to
+        if (zerocopy_send && zerocopy.pending > 0 && !platf::wait_zerocopy(sock.native_handle(), zerocopy, ZEROCOPY_TIMEOUT)) {
+          BOOST_LOG(warning) << "Zero-copy sends didn't complete within "sv << ZEROCOPY_TIMEOUT.count() << " ms, copying video packets from now on"sv;
+          zerocopy_send = false;
+        }
+        if (zerocopy_send && zerocopy.copied) {
+          BOOST_LOG(info) << "The network device copies zero-copy sends anyway, copying video packets from now on"sv;
+          zerocopy_send = false;
+        }
+
+        // Insert space for packet headers
+        auto blocksize = session->config.packetsize + MAX_RTP_HEADER_SIZE;
+        auto payload_blocksize = blocksize - sizeof(video_packet_raw_t);
+        auto &payload_new = session->video.payload_buffer;
+        auto &packet_template = session->video.packet_template;
+        packet_template.packet.frameIndex = frame_index;
+        gather_and_insert(payload_new, sizeof(video_packet_raw_t), payload_blocksize, payload_segments, &packet_template);
+
+        payload = std::string_view {(char *) payload_new.data(), payload_new.size()};
+
+        // The max number of data shards per block is found by solving this system of equations for D:
+        // D = 255 - P
+        // P = D * F
+        // which results in the solution:
+        // D = 255 / (1 + F)
+        // multiplied by 100 since F is the percentage as an integer:
+        // D = (255 * 100) / (100 + F)
+        auto max_data_shards_per_fec_block = (DATA_SHARDS_MAX * 100) / (100 + fecPercentage);
+
+        // Compute the number of FEC blocks needed for this frame using the block size and max shards
+        auto max_data_per_fec_block = max_data_shards_per_fec_block * blocksize;
+        auto fec_blocks_needed = (payload.size() + (max_data_per_fec_block - 1)) / max_data_per_fec_block;
+
+        // Each part of a frame is one FEC block, and a frame is split into at most the protocol limit of blocks.
+        // What doesn't fit at the requested FEC percentage gets as much parity as still fits in the blocks,
+        // since the large frames are mostly key frames, the ones that are worst to lose.
+        // FEC is only turned off when the data alone fills the blocks (over 1000 packets for a whole frame).
+        if (partial) {
+          if (fec_blocks_needed > 1) {
+            fecPercentage = (int) fec::fitting_percentage(payload.size(), blocksize, 1, fecPercentage, session->config.minRequiredFecPackets);
+            BOOST_LOG(verbose) << "Lowering FEC to "sv << fecPercentage << "% for a part of frame "sv << frame_index << " too large for one FEC block"sv;
+          }
+          fec_blocks_needed = 1;
+        } else if (fec_blocks_needed > MAX_FEC_BLOCKS) {
+          fecPercentage = (int) fec::fitting_percentage(payload.size(), blocksize, MAX_FEC_BLOCKS, fecPercentage, session->config.minRequiredFecPackets);
+          if (fecPercentage == 0) {
+            BOOST_LOG(warning) << "Skipping FEC for abnormally large encoded frame (needed "sv << fec_blocks_needed << " FEC blocks)"sv;
+          } else {
+            BOOST_LOG(verbose) << "Lowering FEC to "sv << fecPercentage << "% for frame "sv << frame_index << " to fit "sv << MAX_FEC_BLOCKS << " FEC blocks"sv;
           }
+          fec_blocks_needed = MAX_FEC_BLOCKS;
+        }
 
-          frame_fec_latency_logger.first_point_now();
-          // If video encryption is enabled, we allocate space for the encryption header before each shard
-          auto shards = fec::encode(current_payload, blocksize, fecPercentage, session->config.minRequiredFecPackets, session->video.cipher ? sizeof(video_packet_enc_prefix_t) : 0);
-          frame_fec_latency_logger.second_point_now_and_log();
+        // Index of this packet's first block within the frame, and of the frame's last block
+        auto first_fec_block = packet->slice_group;
+        auto last_fec_block = partial ? packet->slice_groups - 1 : fec_blocks_needed - 1;
 
-          auto peer_address = session->video.peer.address();
-          auto batch_info = platf::batched_send_info_t {
-            shards.headers.begin(),
-            shards.prefixsize,
-            shards.payload_buffers,
-            shards.blocksize,
-            0,
-            0,
-            (uintptr_t) sock.native_handle(),
-            peer_address,
-            session->video.peer.port(),
-            session->localAddress,
-          };
+        std::array<std::string_view, MAX_FEC_BLOCKS> fec_blocks;
+        decltype(fec_blocks)::iterator
+          fec_blocks_begin = std::begin(fec_blocks),
+          fec_blocks_end = std::begin(fec_blocks) + fec_blocks_needed;
+
+        BOOST_LOG(verbose) << "Generating "sv << fec_blocks_needed << " FEC blocks"sv;
+
+        // Align individual FEC blocks to blocksize
+        auto unaligned_size = payload.size() / fec_blocks_needed;
+        auto aligned_size = ((unaligned_size + (blocksize - 1)) / blocksize) * blocksize;
+
+        // If we exceed the 10-bit FEC packet index (which means our frame exceeded 4096 packets),
+        // the frame will be unrecoverable. Log an error for this case.
+        if (aligned_size / blocksize >= 1024) {
+          BOOST_LOG(error) << "Encoder produced a frame too large to send! Is the encoder broken? (needed "sv << (aligned_size / blocksize) << " packets)"sv;
+        }
+
+        // Split the data into aligned FEC blocks
+        for (int x = 0; x < fec_blocks_needed; ++x) {
+          if (x == fec_blocks_needed - 1) {
+            // The last block must extend to the end of the payload
+            fec_blocks[x] = payload.substr(x * aligned_size);
+          } else {
+            // Earlier blocks just extend to the next block offset
+            fec_blocks[x] = payload.substr(x * aligned_size, aligned_size);
+          }
+        }
+
+        try {
+          std::uint64_t ratecontrol_bitrate = probe::pacing_bps(session->video.path_capacity_bps, encoder->video.bitrate_kbps);
+          //                                 bps                   ms     packet      byte
+          size_t ratecontrol_packets_in_1ms = std::max<std::uint64_t>(1, ratecontrol_bitrate / 1000 / blocksize / 8);
+
+          // Batches larger than a millisecond of packets would only make pacing coarser
+          size_t send_batch_size = std::min<size_t>(platf::send_batch_max_blocks(blocksize), std::max<size_t>(1, ratecontrol_packets_in_1ms));
+
+          // Every batch gets its own transmit time, so smaller batches give finer pacing
+          // without costing a wakeup each. Aim for about a quarter of a millisecond per batch.
+          if (kernel_pacing) {
+            send_batch_size = std::clamp<size_t>(ratecontrol_packets_in_1ms / 4, 1, send_batch_size);
+          }
+
+          // Don't ignore the last ratecontrol group of the previous frame
+          auto ratecontrol_frame_start = std::max(ratecontrol_next_frame_start, std::chrono::steady_clock::now());
+
+          size_t ratecontrol_frame_packets_sent = 0;
+          size_t ratecontrol_group_packets_sent = 0;
+
+          // The packet headers are covered by the parity, so each block needs to know
+          // its first sequence number before any block is encoded
+          std::array<int, MAX_FEC_BLOCKS> fec_block_lowseq;
+          auto frame_highseq = lowseq;
+          for (auto x = 0; x < fec_blocks_needed; ++x) {
+            fec_block_lowseq[x] = frame_highseq;
+            frame_highseq += fec::layout(fec_blocks[x].size(), blocksize, fecPercentage, session->config.minRequiredFecPackets).nr_shards();
+          }
+
+          // Every shard of the frame consumes one IV. Reserve them all up front, so an IV
+          // is never reused even if sending the frame fails halfway.
+          auto gcm_iv_base = session->video.gcm_iv_counter;
+          session->video.gcm_iv_counter += frame_highseq - lowseq;
 
-          size_t next_shard_to_send = 0;
+          // If video encryption is enabled, we allocate space for the encryption header before each shard
+          auto prefixsize = session->video.ciphers ? sizeof(video_packet_enc_prefix_t) : 0;
 
           // RTP video timestamps use a 90 KHz clock and the frame_timestamp from when the frame was captured
           // When a timestamp isn't available (duplicate frames), the timestamp from rate control is used instead.
-          bool frame_is_dupe = false;
-          if (!packet->frame_timestamp) {
-            packet->frame_timestamp = ratecontrol_next_frame_start;
-            frame_is_dupe = true;
-          }
+          // The packet is shared by every viewer, so the fallback stays local to this one.
+          bool frame_is_dupe = !packet->frame_timestamp;
+          auto frame_timestamp = packet->frame_timestamp.value_or(ratecontrol_next_frame_start);
           using rtp_tick = std::chrono::duration<uint32_t, std::ratio<1, 90000>>;
-          uint32_t timestamp = std::chrono::round<rtp_tick>(*packet->frame_timestamp - video_epoch).count();
-
-          // set FEC info now that we know for sure what our percentage will be for this frame
-          for (auto x = 0; x < shards.size(); ++x) {
-            auto *inspect = (video_packet_raw_t *) shards.data(x);
-
-            inspect->packet.fecInfo =
-              (x << 12 |
-               shards.data_shards << 22 |
-               shards.percentage << 4);
-
-            inspect->rtp.header = 0x80 | FLAG_EXTENSION;
-            inspect->rtp.sequenceNumber = util::endian::big<uint16_t>(lowseq + x);
-            inspect->rtp.timestamp = util::endian::big<uint32_t>(timestamp);
-
-            inspect->packet.multiFecBlocks = (blockIndex << 4) | ((fec_blocks_needed - 1) << 6);
-            inspect->packet.frameIndex = packet->frame_index();
-
-            // Encrypt this shard if video encryption is enabled
-            if (session->video.cipher) {
-              // We use the deterministic IV construction algorithm specified in NIST SP 800-38D
-              // Section 8.2.1. The sequence number is our "invocation" field and the 'V' in the
-              // high bytes is the "fixed" field. Because each client provides their own unique
-              // key, our values in the fixed field need only uniquely identify each independent
-              // use of the client's key with AES-GCM in our code.
-              //
-              // The IV counter is 64 bits long which allows for 2^64 encrypted video packets
-              // to be sent to each client before the IV repeats.
-              std::copy_n((uint8_t *) &session->video.gcm_iv_counter, sizeof(session->video.gcm_iv_counter), std::begin(iv));
-              iv[11] = 'V';  // Video stream
-              session->video.gcm_iv_counter++;
-
-              // Encrypt the target buffer in place
-              auto *prefix = (video_packet_enc_prefix_t *) shards.prefix(x);
-              prefix->frameNumber = packet->frame_index();
-              std::copy(std::begin(iv), std::end(iv), prefix->iv);
-              session->video.cipher->encrypt(std::string_view {(char *) inspect, (size_t) blocksize}, prefix->tag, (uint8_t *) inspect, &iv);
+          uint32_t timestamp = first_part ? std::chrono::round<rtp_tick>(frame_timestamp - video_epoch).count() : session->video.frame_rtp_timestamp;
+          session->video.frame_rtp_timestamp = timestamp;
+
+          // Each block writes only its own entry, the futures are done with before it's read
+          std::array<std::chrono::nanoseconds, MAX_FEC_BLOCKS> block_seal_time {};
+
+          auto encode_fec_block = [&](int block_index) {
+            auto &current_payload = fec_blocks[block_index];
+            auto packets = (current_payload.size() + (blocksize - 1)) / blocksize;
+
+            // The headers came from the session's template, only the fields of each packet are left
+            auto multi_fec_blocks = ((first_fec_block + block_index) << 4) | (last_fec_block << 6);
+            auto stream_packet_index = (uint32_t) fec_block_lowseq[block_index];
+            for (int x = 0; x < packets; ++x) {
+              auto *inspect = (video_packet_raw_t *) &current_payload[x * blocksize];
+
+              inspect->packet.streamPacketIndex = (stream_packet_index + x) << 8;
+              inspect->packet.multiFecBlocks = multi_fec_blocks;
+
+              if (x == 0) {
+                inspect->packet.flags |= FLAG_SOF;
+              }
+              if (x == packets - 1) {
+                inspect->packet.flags |= FLAG_EOF;
+              }
             }
 
-            if (x - next_shard_to_send + 1 >= send_batch_size ||
-                x + 1 == shards.size()) {
-              // Do pacing within the frame.
-              // Also trigger pacing before the first send_batch() of the frame
-              // to account for the last send_batch() of the previous frame.
-              if (ratecontrol_group_packets_sent >= ratecontrol_packets_in_1ms ||
-                  ratecontrol_frame_packets_sent == 0) {
-                auto due = ratecontrol_frame_start +
-                           std::chrono::duration_cast<std::chrono::nanoseconds>(1ms) *
-                             ratecontrol_frame_packets_sent / ratecontrol_packets_in_1ms;
-
-                auto now = std::chrono::steady_clock::now();
-                if (now < due) {
-                  timer->sleep_for(due - now);
-                }
+            auto fec_start = std::chrono::steady_clock::now();
+            auto shards = fec::encode(current_payload, blocksize, fecPercentage, session->config.minRequiredFecPackets, prefixsize, session->video.fec_buffers[block_index]);
+
+            // set FEC info now that we know for sure what our percentage will be for this frame
+            auto &iv = block_ivs[block_index];
+            auto block_iv_counter = gcm_iv_base + (fec_block_lowseq[block_index] - fec_block_lowseq[0]);
+            auto seal_start = std::chrono::steady_clock::now();
+            trace::span(trace::stage_e::fec, frame_index, fec_start, seal_start);
+
+            // The parity shards carry parity where the header goes, so these fields are written one by one
+            auto fec_info = shards.data_shards << 22 | shards.percentage << 4;
+            auto rtp_timestamp = util::endian::big<uint32_t>(timestamp);
+            for (auto x = 0; x < shards.size(); ++x) {
+              auto *inspect = (video_packet_raw_t *) shards.data(x);
+
+              inspect->packet.fecInfo = x << 12 | fec_info;
+
+              inspect->rtp.header = 0x80 | FLAG_EXTENSION;
+              inspect->rtp.sequenceNumber = util::endian::big<uint16_t>(fec_block_lowseq[block_index] + x);
+              inspect->rtp.timestamp = rtp_timestamp;
+
+              inspect->packet.multiFecBlocks = multi_fec_blocks;
+              inspect->packet.frameIndex = frame_index;
+
+              // Encrypt this shard if video encryption is enabled
+              if (session->video.ciphers) {
+                // We use the deterministic IV construction algorithm specified in NIST SP 800-38D
+                // Section 8.2.1. The sequence number is our "invocation" field and the 'V' in the
+                // high bytes is the "fixed" field. Because each client provides their own unique
+                // key, our values in the fixed field need only uniquely identify each independent
+                // use of the client's key with AES-GCM in our code.
+                //
+                // The IV counter is 64 bits long which allows for 2^64 encrypted video packets
+                // to be sent to each client before the IV repeats.
+                auto iv_counter = block_iv_counter + x;
+                std::copy_n((uint8_t *) &iv_counter, sizeof(iv_counter), std::begin(iv));
+                iv[11] = 'V';  // Video stream
+
+                // Seal the shard in place, the prefix was reserved in front of it by fec::encode()
+                auto *prefix = (video_packet_enc_prefix_t *) shards.prefix(x);
+                prefix->frameNumber = frame_index;
+                std::copy(std::begin(iv), std::end(iv), prefix->iv);
+                (*session->video.ciphers)[block_index].encrypt(std::string_view {(char *) inspect, (size_t) blocksize}, prefix->tag, (uint8_t *) inspect, &iv);
+              }
+            }
+            if (session->video.ciphers) {
+              auto seal_end = std::chrono::steady_clock::now();
+              block_seal_time[block_index] = seal_end - seal_start;
+              trace::span(trace::stage_e::encrypt, frame_index, seal_start, seal_end);
+            }
+
+            return shards;
+          };
+
+          // Blocks after the first are encoded on the pool, so block N is sent while block N + 1 is encoded
+          std::array<std::future<fec::fec_t>, MAX_FEC_BLOCKS> fec_futures;
+          for (int x = 1; x < fec_blocks_needed; ++x) {
+            fec_futures[x] = fec_pool.push(encode_fec_block, x);
+          }
 
-                ratecontrol_group_packets_sent = 0;
+          // The pool writes into the payload, so it must be done before we leave this frame
+          auto fec_pool_guard = util::fail_guard([&fec_futures]() {
+            for (auto &future : fec_futures) {
+              if (future.valid()) {
+                future.wait();
               }
+            }
+          });
+
+          auto blockIndex = 0;
+          std::for_each(fec_blocks_begin, fec_blocks_end, [&](std::string_view &) {
+            // Only the time spent waiting for parity holds up the frame
+            auto fec_wait_start = std::chrono::steady_clock::now();
+            frame_fec_latency_logger.first_point(fec_wait_start);
+            auto shards = blockIndex == 0 ? encode_fec_block(0) : fec_futures[blockIndex].get();
+            auto fec_wait_end = std::chrono::steady_clock::now();
+            frame_fec_latency_logger.second_point_and_log(fec_wait_end);
+            fec_wait += fec_wait_end - fec_wait_start;
+
+            auto peer_address = session->video.peer.address();
+            auto batch_info = platf::batched_send_info_t {
+              shards.headers,
+              shards.prefixsize,
+              shards.payload_buffers,
+              shards.blocksize,
+              0,
+              0,
+              (uintptr_t) sock.native_handle(),
+              peer_address,
+              session->video.peer.port(),
+              session->localAddress,
+            };
+            batch_info.zerocopy = zerocopy_send ? &zerocopy : nullptr;
+
+            size_t next_shard_to_send = 0;
+
+            for (auto x = 0; x < shards.size(); ++x) {
+              if (x - next_shard_to_send + 1 >= send_batch_size ||
+                  x + 1 == shards.size()) {
+                // Do pacing within the frame.
+                // Also trigger pacing before the first send_batch() of the frame
+                // to account for the last send_batch() of the previous frame.
+                if (kernel_pacing) {
+                  batch_info.txtime = ratecontrol_frame_start +
+                                      std::chrono::duration_cast<std::chrono::nanoseconds>(1ms) *
+                                        ratecontrol_frame_packets_sent / ratecontrol_packets_in_1ms;
+                } else if (ratecontrol_group_packets_sent >= ratecontrol_packets_in_1ms ||
+                           ratecontrol_frame_packets_sent == 0) {
+                  auto due = ratecontrol_frame_start +
+                             std::chrono::duration_cast<std::chrono::nanoseconds>(1ms) *
+                               ratecontrol_frame_packets_sent / ratecontrol_packets_in_1ms;
+
+                  auto now = std::chrono::steady_clock::now();
+                  if (now < due) {
+                    timer->sleep_until(due);
+
+                    std::lock_guard lg {session->telemetry.lock};
+                    ++session->telemetry.pacing_sleeps;
+                    session->telemetry.pacing_sleep_us.collect(std::chrono::duration_cast<std::chrono::microseconds>(due - now).count());
+                  }
+
+                  ratecontrol_group_packets_sent = 0;
+                }
 
-              size_t current_batch_size = x - next_shard_to_send + 1;
-              batch_info.block_offset = next_shard_to_send;
-              batch_info.block_count = current_batch_size;
-
-              frame_send_batch_latency_logger.first_point_now();
-              // Use a batched send if it's supported on this platform
-              if (!platf::send_batch(batch_info)) {
-                // Batched send is not available, so send each packet individually
-                BOOST_LOG(verbose) << "Falling back to unbatched send"sv;
-                for (auto y = 0; y < current_batch_size; y++) {
-                  auto send_info = platf::send_info_t {
-                    shards.prefix(next_shard_to_send + y),
-                    shards.prefixsize,
-                    shards.data(next_shard_to_send + y),
-                    shards.blocksize,
-                    (uintptr_t) sock.native_handle(),
-                    peer_address,
-                    session->video.peer.port(),
-                    session->localAddress,
-                  };
-
-                  platf::send(send_info);
+                size_t current_batch_size = x - next_shard_to_send + 1;
+                batch_info.block_offset = next_shard_to_send;
+                batch_info.block_count = current_batch_size;
+
+                frame_send_batch_latency_logger.first_point_now();
+                trace::scope_t send_span {trace::stage_e::send, frame_index};
+
+                // Use a batched send if it's supported on this platform
+                bool batched = platf::send_batch(batch_info);
+                if (!batched) {
+                  // Batched send is not available, so send each packet individually
+                  BOOST_LOG(verbose) << "Falling back to unbatched send"sv;
+                  for (auto y = 0; y < current_batch_size; y++) {
+                    auto send_info = platf::send_info_t {
+                      shards.prefix(next_shard_to_send + y),
+                      shards.prefixsize,
+                      shards.data(next_shard_to_send + y),
+                      shards.blocksize,
+                      (uintptr_t) sock.native_handle(),
+                      peer_address,
+                      session->video.peer.port(),
+                      session->localAddress,
+                    };
+
+                    platf::send(send_info);
+                  }
+                }
+                frame_send_batch_latency_logger.second_point_now_and_log();
+
+                {
+                  std::lock_guard lg {session->telemetry.lock};
+                  session->telemetry.bytes_sent += current_batch_size * (shards.prefixsize + shards.blocksize);
+                  session->telemetry.packets_sent += current_batch_size;
+                  session->telemetry.send_batch_fallbacks += batched ? 0 : 1;
+                  session->telemetry.batch_size.collect(current_batch_size);
                 }
+                metrics::add(metrics::counter_e::video_bytes_sent, current_batch_size * (shards.prefixsize + shards.blocksize));
+                metrics::add(metrics::counter_e::video_datagrams_sent, current_batch_size);
+
+                ratecontrol_group_packets_sent += current_batch_size;
+                ratecontrol_frame_packets_sent += current_batch_size;
+                next_shard_to_send = x + 1;
               }
-              frame_send_batch_latency_logger.second_point_now_and_log();
+            }
+
+            // remember this in case the next frame comes immediately
+            ratecontrol_next_frame_start = ratecontrol_frame_start +
+                                           std::chrono::duration_cast<std::chrono::nanoseconds>(1ms) *
+                                             ratecontrol_frame_packets_sent / ratecontrol_packets_in_1ms;
+
+            frame_network_latency_logger.second_point_now_and_log();
+
+            BOOST_LOG(verbose) << "Sent Frame seq ["sv << frame_index << "] pts ["sv << timestamp
+                               << "] shards ["sv << shards.size() << "/"sv << shards.percentage << "%]"sv
+                               << (frame_is_dupe ? " Dupe" : "")
+                               << (packet->is_idr() ? " Key" : "")
+                               << (packet->after_ref_frame_invalidation ? " RFI" : "");
+
+            ++blockIndex;
+            lowseq += shards.size();
+          });
+
+          session->video.lowseq = lowseq;
+
+          if (probe::active(session)) {
+            probe::sent(session, (std::uint64_t) ratecontrol_frame_packets_sent * blocksize, std::chrono::steady_clock::now() - ratecontrol_frame_start, ratecontrol_bitrate);
+          }
+
+          if (last_part) {
+            record_stage_latency(*session, *packet, frame_start, fec_wait);
+          }
+
+          {
+            auto send_queue_bytes = platf::socket_send_queue_bytes((uintptr_t) sock.native_handle());
+
+            // Packets sent into a full buffer are dropped in the kernel, before they reach the wire
+            auto buffer_full = false;
+            if (send_queue_bytes > 0) {
+              boost::asio::socket_base::send_buffer_size send_buffer;
+              boost::system::error_code ec;
+              sock.get_option(send_buffer, ec);
+              buffer_full = !ec && send_queue_bytes >= send_buffer.value() * 9 / 10;
+            }
 
-              ratecontrol_group_packets_sent += current_batch_size;
-              ratecontrol_frame_packets_sent += current_batch_size;
-              next_shard_to_send = x + 1;
+            auto seal_time = std::accumulate(std::begin(block_seal_time), std::end(block_seal_time), std::chrono::nanoseconds {});
+
+            std::lock_guard lg {session->telemetry.lock};
+            if (last_part && ++session->telemetry.frames_sent == 1) {
+              BOOST_LOG(info) << "First video frame sent "sv << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - session->handshake_start).count() << "ms after the RTSP handshake started"sv;
+            }
+            session->telemetry.fec_percentage.collect(fecPercentage);
+            if (send_queue_bytes >= 0) {
+              session->telemetry.send_queue_bytes.collect(send_queue_bytes);
+            }
+            if (buffer_full && ++session->telemetry.send_buffer_full == 1) {
+              BOOST_LOG(warning) << "Video socket send buffer of "sv << session->video.peer.address() << " filled up, packets may be dropped before they leave the host"sv;
+            }
+            if (session->video.ciphers) {
+              session->telemetry.encryption_us.collect(std::chrono::duration_cast<std::chrono::microseconds>(seal_time).count());
             }
           }
+        } catch (const std::exception &e) {
+          BOOST_LOG(error) << "Broadcast video failed "sv << e.what();
+          std::this_thread::sleep_for(100ms);
+        }
+      }
+    }
+  }
 
-          // remember this in case the next frame comes immediately
-          ratecontrol_next_frame_start = ratecontrol_frame_start +
-                                         std::chrono::duration_cast<std::chrono::nanoseconds>(1ms) *
-                                           ratecontrol_frame_packets_sent / ratecontrol_packets_in_1ms;
+  /**
+   * @brief Get the number of threads the video of the sessions is spread over.
+   * @return The number of threads, at least 1.
+   */
+  int video_send_threads() {
+    if (config::stream.video_send_threads > 0) {
+      return config::stream.video_send_threads;
+    }
 
-          frame_network_latency_logger.second_point_now_and_log();
+    return std::clamp<int>(std::thread::hardware_concurrency() / 2, 1, 4);
+  }
 
-          BOOST_LOG(verbose) << "Sent Frame seq ["sv << packet->frame_index() << "] pts ["sv << timestamp
-                             << "] shards ["sv << shards.size() << "/"sv << shards.percentage << "%]"sv
-                             << (frame_is_dupe ? " Dupe" : "")
-                             << (packet->is_idr() ? " Key" : "")
-                             << (packet->after_ref_frame_invalidation ? " RFI" : "");
+  void videoBroadcastThread(udp::socket &sock, std::chrono::steady_clock::time_point video_epoch) {
+    auto shutdown_event = mail::man->event<bool>(mail::broadcast_shutdown);
+    auto packets = mail::man->ring<video::packet_t>(mail::video_packets);
 
-          ++blockIndex;
-          lowseq += shards.size();
-        });
+    auto shards = video_send_threads();
 
-        session->video.lowseq = lowseq;
-      } catch (const std::exception &e) {
-        BOOST_LOG(error) << "Broadcast video failed "sv << e.what();
-        std::this_thread::sleep_for(100ms);
+    // The socket reports completed zero-copy sends without saying which thread sent them,
+    // so only a thread sending on its own can tell when its buffers are free again
+    bool zerocopy_send = false;
+    if (config::stream.zerocopy_send) {
+      if (shards > 1) {
+        BOOST_LOG(warning) << "Zero-copy sends need video_send_threads = 1, copying video packets"sv;
+      } else {
+        zerocopy_send = platf::enable_socket_zerocopy(sock.native_handle());
+        if (!zerocopy_send) {
+          BOOST_LOG(warning) << "Zero-copy sends aren't available, copying video packets"sv;
+        }
+      }
+    }
+
+    if (shards == 1) {
+      videoSendLoop(sock, video_epoch, *packets, zerocopy_send);
+      shutdown_event->raise(true);
+      return;
+    }
+
+    // Each session sticks to one shard, so its frames stay in order while the pacing of one
+    // session's frames never holds up the frames of a session on another shard
+    std::vector<std::unique_ptr<safe::ring_t<video::packet_t>>> shard_packets;
+    std::vector<std::thread> shard_threads;
+    for (int x = 0; x < shards; ++x) {
+      auto &ring = shard_packets.emplace_back(std::make_unique<safe::ring_t<video::packet_t>>());
+      shard_threads.emplace_back(videoSendLoop, std::ref(sock), video_epoch, std::ref(*ring), false);
+    }
+
+    // Handing packets on is all this thread does, it shouldn't wait behind the game either
+    platf::set_thread_name("video_fanout"s);
+    platf::adjust_thread_priority(platf::thread_priority_e::high);
+
+    while (auto packet = packets->pop()) {
+      if (shutdown_event->peek()) {
+        break;
+      }
+
+      metrics::set(metrics::gauge_e::video_packet_queue, packets->size());
+
+      auto session = (session_t *) packet->channel_data;
+      auto frame_index = packet->frame_index();
+      if (!shard_packets[session->video.send_shard % shards]->raise(std::move(packet))) {
+        // The client asks for recovery once it notices the missing frame
+        metrics::add(metrics::counter_e::video_packets_dropped);
+        BOOST_LOG(debug) << "Video shard "sv << session->video.send_shard % shards << " fell behind, dropping frame "sv << frame_index;
       }
     }
 
+    for (auto &ring : shard_packets) {
+      ring->stop();
+    }
+    for (auto &thread : shard_threads) {
+      thread.join();
+    }
+
     shutdown_event->raise(true);
   }
 
-  void audioBroadcastThread(udp::socket &sock) {
+  void audioBroadcastThread(udp::socket &sock, std::chrono::steady_clock::time_point audio_epoch) {
     auto shutdown_event = mail::man->event<bool>(mail::broadcast_shutdown);
     auto packets = mail::man->queue<audio::packet_t>(mail::audio_packets);
 
@@ -1605,6 +3637,7 @@ namespace stream {
     audio_packet.rtp.ssrc = 0;
 
     // Audio traffic is sent on this thread
+    platf::set_thread_name("audio_send"s);
     platf::adjust_thread_priority(platf::thread_priority_e::high);
 
     while (auto packet = packets->pop()) {
@@ -1615,6 +3648,23 @@ namespace stream {
       TUPLE_2D_REF(channel_data, packet_data, *packet);
       auto session = (session_t *) channel_data;
 
+      // The timestamps resync to the capture clock once the client is back
+      if (session->resume.paused.load(std::memory_order_acquire)) {
+        continue;
+      }
+      if (auto peer = session->resume.audio_handoff.pop(0ms)) {
+        session->audio.peer = *peer;
+      }
+
+      // Audio RTP timestamps count milliseconds on the clock of the video timestamps. They advance by the
+      // packet duration, so clients see steady timestamps, and only jump ahead to the capture time when
+      // packets were lost before reaching us.
+      auto capture_time = (std::uint32_t) std::chrono::duration_cast<std::chrono::milliseconds>(packet_data.capture_timestamp - audio_epoch).count();
+      if ((std::int32_t) (capture_time - session->audio.timestamp) > MAX_AUDIO_CLOCK_DRIFT.count()) {
+        BOOST_LOG(debug) << "Audio timestamp resynced to the capture clock, "sv << capture_time - session->audio.timestamp << "ms ahead"sv;
+        session->audio.timestamp = capture_time;
+      }
+
       auto sequenceNumber = session->audio.sequenceNumber;
       auto timestamp = session->audio.timestamp;
 
@@ -1649,35 +3699,57 @@ namespace stream {
           session->localAddress,
         };
         platf::send(send_info);
+        metrics::add(metrics::counter_e::audio_packets_sent);
 
-        auto &fec_packet = session->audio.fec_packet;
+        auto &fec_packets = session->audio.fec_packets;
         // initialize the FEC header at the beginning of the FEC block
         if (sequenceNumber % RTPA_DATA_SHARDS == 0) {
-          fec_packet.fecHeader.baseSequenceNumber = util::endian::big(sequenceNumber);
-          fec_packet.fecHeader.baseTimestamp = util::endian::big(timestamp);
+          for (auto &fec_packet : fec_packets) {
+            fec_packet.fecHeader.baseSequenceNumber = util::endian::big(sequenceNumber);
+            fec_packet.fecHeader.baseTimestamp = util::endian::big(timestamp);
+          }
         }
 
-        // generate parity shards at the end of the FEC block
-        if ((sequenceNumber + 1) % RTPA_DATA_SHARDS == 0) {
+        // generate parity shards at the end of the FEC block, unless the link is clean enough to go without
+        if ((sequenceNumber + 1) % RTPA_DATA_SHARDS == 0 && session->audio.parity) {
           reed_solomon_encode(rs.get(), shards_p.begin(), RTPA_TOTAL_SHARDS, bytes);
 
+          auto &fec_payloads = session->audio.fec_payloads;
           for (auto x = 0; x < RTPA_FEC_SHARDS; ++x) {
-            fec_packet.rtp.sequenceNumber = util::endian::big<std::uint16_t>(sequenceNumber + x + 1);
-            fec_packet.fecHeader.fecShardIndex = x;
-
-            auto send_info = platf::send_info_t {
-              (const char *) &fec_packet,
-              sizeof(fec_packet),
-              (const char *) shards_p[RTPA_DATA_SHARDS + x],
-              (size_t) bytes,
-              (uintptr_t) sock.native_handle(),
-              peer_address,
-              session->audio.peer.port(),
-              session->localAddress,
-            };
-            platf::send(send_info);
-            BOOST_LOG(verbose) << "Audio FEC ["sv << (sequenceNumber & ~(RTPA_DATA_SHARDS - 1)) << ' ' << x << "] ::  send..."sv;
+            fec_packets[x].rtp.sequenceNumber = util::endian::big<std::uint16_t>(sequenceNumber + x + 1);
+            fec_payloads[x] = {(const char *) shards_p[RTPA_DATA_SHARDS + x], (size_t) bytes};
+          }
+
+          // The parity shards are ready at the same time, so they share a single syscall
+          auto batch_info = platf::batched_send_info_t {
+            (const char *) fec_packets.data(),
+            sizeof(audio_fec_packet_t),
+            fec_payloads,
+            (size_t) bytes,
+            0,
+            RTPA_FEC_SHARDS,
+            (uintptr_t) sock.native_handle(),
+            peer_address,
+            session->audio.peer.port(),
+            session->localAddress,
+          };
+
+          if (!platf::send_batch(batch_info)) {
+            for (auto x = 0; x < RTPA_FEC_SHARDS; ++x) {
+              auto send_info = platf::send_info_t {
+                (const char *) &fec_packets[x],
+                sizeof(audio_fec_packet_t),
+                fec_payloads[x].buffer,
+                fec_payloads[x].size,
+                (uintptr_t) sock.native_handle(),
+                peer_address,
+                session->audio.peer.port(),
+                session->localAddress,
+              };
+              platf::send(send_info);
+            }
           }
+          BOOST_LOG(verbose) << "Audio FEC ["sv << (sequenceNumber & ~(RTPA_DATA_SHARDS - 1)) << "] ::  send..."sv;
         }
       } catch (const std::exception &e) {
         BOOST_LOG(error) << "Broadcast audio failed "sv << e.what();
@@ -1709,12 +3781,9 @@ namespace stream {
       return -1;
     }
 
-    // Set video socket send buffer size (SO_SENDBUF) to 1MB
-    try {
-      ctx.video_sock.set_option(boost::asio::socket_base::send_buffer_size(1024 * 1024));
-    } catch (...) {
-      BOOST_LOG(error) << "Failed to set video socket send buffer size (SO_SENDBUF)";
-    }
+    // Each session grows the send buffer to fit its frames once it connects
+    ctx.video_send_buffer = 0;
+    socket_buffer::fit(ctx, socket_buffer::MIN_SIZE);
 
     ctx.video_sock.bind(udp::endpoint(protocol, video_port), ec);
     if (ec) {
@@ -1739,8 +3808,9 @@ namespace stream {
 
     ctx.message_queue_queue = std::make_shared<message_queue_queue_t::element_type>(30);
 
-    ctx.video_thread = std::thread {videoBroadcastThread, std::ref(ctx.video_sock)};
-    ctx.audio_thread = std::thread {audioBroadcastThread, std::ref(ctx.audio_sock)};
+    ctx.epoch = std::chrono::steady_clock::now();
+    ctx.video_thread = std::thread {videoBroadcastThread, std::ref(ctx.video_sock), ctx.epoch};
+    ctx.audio_thread = std::thread {audioBroadcastThread, std::ref(ctx.audio_sock), ctx.epoch};
     ctx.control_thread = std::thread {controlBroadcastThread, &ctx.control_server};
 
     ctx.recv_thread = std::thread {recvThread, std::ref(ctx)};
@@ -1753,7 +3823,7 @@ namespace stream {
 
     broadcast_shutdown_event->raise(true);
 
-    auto video_packets = mail::man->queue<video::packet_t>(mail::video_packets);
+    auto video_packets = mail::man->ring<video::packet_t>(mail::video_packets);
     auto audio_packets = mail::man->queue<audio::packet_t>(mail::audio_packets);
 
     // Minimize delay stopping video/audio threads
@@ -1848,10 +3918,29 @@ namespace stream {
       return;
     }
 
+    BOOST_LOG(debug) << "Video ping received "sv << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - session->handshake_start).count() << "ms after the RTSP handshake started"sv;
+
+    socket_buffer::fit(*ref, session);
+
+    // A path MTU learned for this client and packet size needs no probe
+    if (config::stream.path_mtu_probe && !session->video.path_mtu) {
+      pmtu::probe(session);
+    }
+
     // Enable local prioritization and QoS tagging on video traffic if requested by the client
     auto address = session->video.peer.address();
     session->video.qos = platf::enable_socket_qos(ref->video_sock.native_handle(), address, session->video.peer.port(), platf::qos_data_type_e::video, session->config.videoQosType != 0);
 
+    // The first frame should show the app rather than what it replaces. A launch that fails
+    // terminates the app, which ends the session.
+    proc::wait_for_launch();
+
+    // Clients on the same simulcast rung share its encoder
+    if (config::stream.video_fanout || !config::stream.simulcast.empty()) {
+      fanout::watch(session);
+      return;
+    }
+
     BOOST_LOG(debug) << "Start capturing Video"sv;
     video::capture(session->mail, session->config.monitor, session);
   }
@@ -1880,6 +3969,70 @@ namespace stream {
   namespace session {
     std::atomic_uint running_sessions;
 
+    // Sessions reported by network_stats()
+    sync_util::sync_t<std::vector<session_t *>> telemetry_sessions;
+
+    std::vector<network_stats_t> network_stats() {
+      std::vector<network_stats_t> stats;
+
+      auto percentiles = [](const stat_trackers::latency_histogram_t &histogram) {
+        using histogram_t = stat_trackers::latency_histogram_t;
+
+        auto counts = histogram.snapshot();
+        return percentiles_t {histogram_t::percentile(counts, 0.5), histogram_t::percentile(counts, 0.99)};
+      };
+
+      auto lg = telemetry_sessions.lock();
+      for (auto session : *telemetry_sessions) {
+        std::lock_guard telemetry_lg {session->telemetry.lock};
+        auto &telemetry = session->telemetry;
+
+        stats.push_back(network_stats_t {
+          session->launch_session_id,
+          session->video.peer.address().to_string(),
+          telemetry.bytes_sent,
+          telemetry.packets_sent,
+          telemetry.frames_sent,
+          telemetry.frames_dropped,
+          telemetry.frames_lost,
+          telemetry.send_batch_fallbacks,
+          telemetry.pacing_sleeps,
+          telemetry.send_buffer_full,
+          telemetry.fec_percentage.last,
+          telemetry.batch_size.last,
+          telemetry.pacing_sleep_us.last,
+          telemetry.send_queue_bytes.last,
+          telemetry.encryption_us.last,
+          {
+            percentiles(telemetry.latency.capture),
+            percentiles(telemetry.latency.convert),
+            percentiles(telemetry.latency.encode),
+            percentiles(telemetry.latency.fec),
+            percentiles(telemetry.latency.send),
+            percentiles(telemetry.latency.total),
+            percentiles(telemetry.latency.vsync_phase_error),
+          },
+          session->video.bitrate_kbps.load(),
+          session->video.path_mtu.load(),
+          audio::encode_stats(session),
+        });
+      }
+
+      return stats;
+    }
+
+    bool set_bitrate(std::uint32_t launch_session_id, int bitrate_kbps) {
+      auto lg = telemetry_sessions.lock();
+      for (auto session : *telemetry_sessions) {
+        if (session->launch_session_id == launch_session_id) {
+          bitrate::set(session, bitrate_kbps, "API request"sv);
+          return true;
+        }
+      }
+
+      return false;
+    }
+
     state_e state(session_t &session) {
       return session.state.load(std::memory_order_relaxed);
     }
@@ -1893,6 +4046,7 @@ namespace stream {
       }
 
       session.shutdown_event->raise(true);
+      fanout::wake(session);
     }
 
     void join(session_t &session) {
@@ -1910,6 +4064,11 @@ namespace stream {
         task_pool.cancel(force_kill);
       });
 
+      {
+        auto lg = telemetry_sessions.lock();
+        std::erase(*telemetry_sessions, &session);
+      }
+
       BOOST_LOG(debug) << "Waiting for video to end..."sv;
       session.videoThread.join();
       BOOST_LOG(debug) << "Waiting for audio to end..."sv;
@@ -1920,6 +4079,8 @@ namespace stream {
       BOOST_LOG(debug) << "Resetting Input..."sv;
       input::reset(session.input);
 
+      client_profile::learn(session);
+
       // If this is the last session, invoke the platform callbacks
       if (--running_sessions == 0) {
         bool revert_display_config {config::video.dd.config_revert_on_disconnect};
@@ -1937,6 +4098,7 @@ namespace stream {
         }
 
         platf::streaming_will_stop();
+        memory_budget::log_footprints();
       }
 
       BOOST_LOG(debug) << "Session ended"sv;
@@ -1959,6 +4121,11 @@ namespace stream {
         session.broadcast_ref->control_server._sessions->push_back(&session);
       }
 
+      {
+        auto lg = telemetry_sessions.lock();
+        telemetry_sessions->push_back(&session);
+      }
+
       auto addr = boost::asio::ip::make_address(addr_string);
       session.video.peer.address(addr);
       session.video.peer.port(0);
@@ -1988,9 +4155,12 @@ namespace stream {
       auto session = std::make_shared<session_t>();
 
       auto mail = std::make_shared<safe::mail_raw_t>();
+      mail->depth = memory_budget::queue_depth();
 
       session->shutdown_event = mail->event<bool>(mail::shutdown);
       session->launch_session_id = launch_session.id;
+      session->client_uuid = launch_session.client_uuid;
+      session->handshake_start = launch_session.handshake_start;
 
       session->config = config;
 
@@ -2004,15 +4174,53 @@ namespace stream {
       };
 
       session->video.idr_events = mail->event<bool>(mail::idr);
+      session->video.touch_port_events = mail->event<input::touch_port_t>(mail::touch_port);
+      session->video.input_touch_port_events = mail->event<input::touch_port_t>(mail::input_touch_port);
       session->video.invalidate_ref_frames_events = mail->event<std::pair<int64_t, int64_t>>(mail::invalidate_ref_frames);
       session->video.lowseq = 0;
+      session->video.fec_percentage = config::stream.fec_percentage;
+      if (config::stream.adaptive_fec) {
+        session->video.fec_percentage = std::clamp(config::stream.fec_percentage, config::stream.fec_percentage_min, config::stream.fec_percentage_max);
+      }
+      session->video.fec_clean_time = 0ms;
+      session->video.bitrate_events = mail->event<int>(mail::bitrate);
+      session->video.bitrate_kbps = bitrate::max_kbps(session.get());
+      session->video.target_kbps = session->video.bitrate_kbps.load();
+      session->video.bitrate_clean_time = 0ms;
+      session->video.path_capacity_bps = 0;
+      session->video.path_mtu = 0;
+      client_profile::apply(session.get());
+      session->video.probe.pending = config::stream.bandwidth_probe;
+      session->video.probe.until = {};
+      session->video.frame_source = nullptr;
+      session->video.last_frame_index = 0;
+      session->video.frame_rtp_timestamp = 0;
+      session->video.packet_template = {};
+      // Match multiFecFlags with Moonlight
+      session->video.packet_template.packet.multiFecFlags = 0x10;
+      session->video.packet_template.packet.flags = FLAG_CONTAINS_PIC_DATA;
+      session->video.awaiting_recovery = false;
+      session->video.frame_index_offset = 0;
+      session->video.rtt_ms = 0;
+      session->resume.paused = false;
+      session->video.capture_phase_events = mail->event<std::chrono::nanoseconds>(mail::capture_phase);
+      session->video.vsync = {};
+
+      // Spread sessions over the video send threads in turn
+      static std::atomic<std::uint32_t> next_send_shard;
+      session->video.send_shard = next_send_shard++;
       session->video.ping_payload = launch_session.av_ping_payload;
       if (config.encryptionFlagsEnabled & SS_ENC_VIDEO) {
-        BOOST_LOG(info) << "Video encryption enabled"sv;
-        session->video.cipher = crypto::cipher::gcm_t {
-          launch_session.gcm_key,
-          false
-        };
+        auto aead = (config.encryptionFlagsEnabled & SS_ENC_VIDEO_CHACHA20) ? crypto::cipher::aead_e::chacha20_poly1305 : crypto::cipher::aead_e::aes_128_gcm;
+        BOOST_LOG(info) << "Video encryption enabled"sv << (aead == crypto::cipher::aead_e::chacha20_poly1305 ? " with ChaCha20-Poly1305"sv : ""sv);
+        session->video.ciphers.emplace();
+        for (auto &cipher : *session->video.ciphers) {
+          cipher = crypto::cipher::gcm_t {
+            launch_session.gcm_key,
+            false,
+            aead
+          };
+        }
         session->video.gcm_iv_counter = 0;
       }
 
@@ -2030,13 +4238,20 @@ namespace stream {
       session->audio.shards = std::move(shards);
       session->audio.shards_p = std::move(shards_p);
 
-      session->audio.fec_packet.rtp.header = 0x80;
-      session->audio.fec_packet.rtp.packetType = 127;
-      session->audio.fec_packet.rtp.timestamp = 0;
-      session->audio.fec_packet.rtp.ssrc = 0;
+      for (auto x = 0; x < RTPA_FEC_SHARDS; ++x) {
+        auto &fec_packet = session->audio.fec_packets[x];
+        fec_packet.rtp.header = 0x80;
+        fec_packet.rtp.packetType = 127;
+        fec_packet.rtp.timestamp = 0;
+        fec_packet.rtp.ssrc = 0;
 
-      session->audio.fec_packet.fecHeader.payloadType = 97;
-      session->audio.fec_packet.fecHeader.ssrc = 0;
+        fec_packet.fecHeader.fecShardIndex = x;
+        fec_packet.fecHeader.payloadType = 97;
+        fec_packet.fecHeader.ssrc = 0;
+      }
+      session->audio.fec_payloads.resize(RTPA_FEC_SHARDS);
+      session->audio.parity = true;
+      session->audio.expected_loss = 0;
 
       session->audio.cipher = crypto::cipher::cbc_t {
         launch_session.gcm_key,
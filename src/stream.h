@@ -5,7 +5,10 @@
 #pragma once
 
 // standard includes
+#include <cstdint>
+#include <string>
 #include <utility>
+#include <vector>
 
 // lib includes
 #include <boost/asio.hpp>
@@ -20,6 +23,14 @@ namespace stream {
   constexpr auto CONTROL_PORT = 10;
   constexpr auto AUDIO_STREAM_PORT = 11;
 
+  /**
+   * @brief Encryption flag of clients that decrypt the video with ChaCha20-Poly1305 instead of AES-GCM.
+   * An experimental extension of the protocol, only offered next to SS_ENC_VIDEO by hosts without AES instructions
+   * that enabled config::stream.chacha20_video. The key comes from crypto::chacha20_video_key(), the IVs and tags
+   * are the ones of AES-GCM.
+   */
+  constexpr std::uint32_t SS_ENC_VIDEO_CHACHA20 = 0x80;
+
   struct session_t;
 
   struct config_t {
@@ -38,6 +49,16 @@ namespace stream {
     std::optional<int> gcmap;
   };
 
+  namespace simulcast {
+    /**
+     * @brief Attach a client to the closest rung of the simulcast ladder, if one is configured.
+     * The client then streams the resolution and bitrate of the rung, and shares its encoder with the other
+     * clients on the same rung.
+     * @param config The video configuration the client asked for, changed to the rung.
+     */
+    void attach(video::config_t &config);
+  }  // namespace simulcast
+
   namespace session {
     enum class state_e : int {
       STOPPED,  ///< The session is stopped
@@ -46,6 +67,82 @@ namespace stream {
       RUNNING,  ///< The session is running
     };
 
+    /**
+     * @brief Minimum, maximum and average of a value over the last reporting interval.
+     */
+    struct stat_t {
+      std::int64_t min;
+      std::int64_t max;
+      double avg;
+    };
+
+    /**
+     * @brief Median and tail of a latency, in milliseconds.
+     */
+    struct percentiles_t {
+      double p50;
+      double p99;
+    };
+
+    /**
+     * @brief Latency of each stage a frame goes through, since the session started.
+     */
+    struct stage_latency_t {
+      percentiles_t capture;  ///< Capture until the conversion starts
+      percentiles_t convert;
+      percentiles_t encode;
+      percentiles_t fec;  ///< Encoder output until parity is ready, including the hand-off to the broadcast thread
+      percentiles_t send;
+      percentiles_t total;  ///< Capture until the last packet of the frame is sent
+      percentiles_t vsync_phase_error;  ///< Distance of the estimated arrival at the client from its presentation phase
+    };
+
+    /**
+     * @brief Snapshot of the video send path of a session.
+     */
+    struct network_stats_t {
+      std::uint32_t launch_session_id;
+      std::string client_address;
+
+      std::uint64_t bytes_sent;
+      std::uint64_t packets_sent;
+      std::uint64_t frames_sent;
+      std::uint64_t frames_dropped;  ///< Frames dropped for waiting longer than max_frame_latency to be sent.
+      std::uint64_t frames_lost;  ///< Frames the client reported lost
+      std::uint64_t send_batch_fallbacks;  ///< Batches sent one packet at a time because send_batch() failed
+      std::uint64_t pacing_sleeps;
+      std::uint64_t send_buffer_full;  ///< Frames after which the socket send buffer was nearly full, so later packets may have been dropped
+
+      stat_t fec_percentage;
+      stat_t batch_size;  ///< Packets per send_batch() call
+      stat_t pacing_sleep_us;
+      stat_t send_queue_bytes;  ///< Socket send queue after each frame, not reported on every platform
+      stat_t encryption_us;  ///< Time spent sealing the shards of each frame
+
+      stage_latency_t latency;
+
+      int bitrate_kbps;  ///< Bitrate the encoder of the session currently runs at
+      int path_mtu;  ///< Largest IP packet the path to the client carries unfragmented, 0 if it wasn't probed
+
+      std::optional<audio::encode_stats_t> audio;  ///< Audio encoder the session receives packets from, if any
+    };
+
+    /**
+     * @brief Get the network statistics of all running sessions.
+     * @return One snapshot per session.
+     */
+    std::vector<network_stats_t> network_stats();
+
+    /**
+     * @brief Change the bitrate of a running session without restarting its encoder.
+     * The bitrate is clamped between a quarter of the bitrate the client asked for and the bitrate it asked for.
+     * An encoder shared with other sessions runs at the lowest bitrate any of them was set to.
+     * @param launch_session_id The launch session id of the session.
+     * @param bitrate_kbps The new bitrate, in kbps.
+     * @return `false` if no running session has that launch session id.
+     */
+    bool set_bitrate(std::uint32_t launch_session_id, int bitrate_kbps);
+
     std::shared_ptr<session_t> alloc(config_t &config, rtsp_stream::launch_session_t &launch_session);
     int start(session_t &session, const std::string &addr_string);
     void stop(session_t &session);
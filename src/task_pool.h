@@ -9,11 +9,12 @@
 #include <deque>
 #include <functional>
 #include <future>
+#include <map>
 #include <mutex>
 #include <optional>
 #include <type_traits>
+#include <unordered_map>
 #include <utility>
-#include <vector>
 
 // local includes
 #include "move_by_copy.h"
@@ -64,8 +65,13 @@ namespace task_pool_util {
     };
 
   protected:
+    typedef std::multimap<__time_point, __task> __timer_tasks;
+
     std::deque<__task> _tasks;
-    std::vector<std::pair<__time_point, __task>> _timer_tasks;
+
+    // Ordered by deadline, the index finds a timer by its id so it can be delayed or cancelled without a scan
+    __timer_tasks _timer_tasks;
+    std::unordered_map<task_id_t, __timer_tasks::iterator> _timer_index;
     std::mutex _task_mutex;
 
   public:
@@ -73,48 +79,35 @@ namespace task_pool_util {
 
     TaskPool(TaskPool &&other) noexcept:
         _tasks {std::move(other._tasks)},
-        _timer_tasks {std::move(other._timer_tasks)} {
+        _timer_tasks {std::move(other._timer_tasks)},
+        _timer_index {std::move(other._timer_index)} {
     }
 
     TaskPool &operator=(TaskPool &&other) noexcept {
       std::swap(_tasks, other._tasks);
       std::swap(_timer_tasks, other._timer_tasks);
+      std::swap(_timer_index, other._timer_index);
 
       return *this;
     }
 
     template<class Function, class... Args>
     auto push(Function &&newTask, Args &&...args) {
-      static_assert(std::is_invocable_v<Function, Args &&...>, "arguments don't match the function");
-
-      using __return = std::invoke_result_t<Function, Args &&...>;
-      using task_t = std::packaged_task<__return()>;
-
-      auto bind = [task = std::forward<Function>(newTask), tuple_args = std::make_tuple(std::forward<Args>(args)...)]() mutable {
-        return std::apply(task, std::move(tuple_args));
-      };
-
-      task_t task(std::move(bind));
-
-      auto future = task.get_future();
+      auto [task, future] = package(std::forward<Function>(newTask), std::forward<Args>(args)...);
 
       std::lock_guard<std::mutex> lg(_task_mutex);
-      _tasks.emplace_back(toRunnable(std::move(task)));
+      _tasks.emplace_back(std::move(task));
 
-      return future;
+      return std::move(future);
     }
 
     void pushDelayed(std::pair<__time_point, __task> &&task) {
       std::lock_guard lg(_task_mutex);
 
-      auto it = _timer_tasks.cbegin();
-      for (; it < _timer_tasks.cend(); ++it) {
-        if (std::get<0>(*it) < task.first) {
-          break;
-        }
-      }
+      task_id_t task_id = &*task.second;
 
-      _timer_tasks.emplace(it, task.first, std::move(task.second));
+      // Timers with the same deadline run in the order they were pushed
+      _timer_index.emplace(task_id, _timer_tasks.emplace(task.first, std::move(task.second)));
     }
 
     /**
@@ -158,62 +151,43 @@ namespace task_pool_util {
     void delay(task_id_t task_id, std::chrono::duration<X, Y> duration) {
       std::lock_guard<std::mutex> lg(_task_mutex);
 
-      auto it = _timer_tasks.begin();
-      for (; it < _timer_tasks.cend(); ++it) {
-        const __task &task = std::get<1>(*it);
-
-        if (&*task == task_id) {
-          std::get<0>(*it) = std::chrono::steady_clock::now() + duration;
-
-          break;
-        }
-      }
-
-      if (it == _timer_tasks.cend()) {
+      auto index = _timer_index.find(task_id);
+      if (index == std::end(_timer_index)) {
         return;
       }
 
-      // smaller time goes to the back
-      auto prev = it - 1;
-      while (it > _timer_tasks.cbegin()) {
-        if (std::get<0>(*it) > std::get<0>(*prev)) {
-          std::swap(*it, *prev);
-        }
-
-        --prev;
-        --it;
-      }
+      // Moving the node keeps the task where it is, only its position in the timers changes
+      auto node = _timer_tasks.extract(index->second);
+      node.key() = std::chrono::steady_clock::now() + duration;
+      index->second = _timer_tasks.insert(std::move(node));
     }
 
     bool cancel(task_id_t task_id) {
       std::lock_guard lg(_task_mutex);
 
-      auto it = _timer_tasks.begin();
-      for (; it < _timer_tasks.cend(); ++it) {
-        const __task &task = std::get<1>(*it);
-
-        if (&*task == task_id) {
-          _timer_tasks.erase(it);
-
-          return true;
-        }
+      auto index = _timer_index.find(task_id);
+      if (index == std::end(_timer_index)) {
+        return false;
       }
 
-      return false;
+      _timer_tasks.erase(index->second);
+      _timer_index.erase(index);
+
+      return true;
     }
 
     std::optional<std::pair<__time_point, __task>> pop(task_id_t task_id) {
       std::lock_guard lg(_task_mutex);
 
-      auto pos = std::find_if(std::begin(_timer_tasks), std::end(_timer_tasks), [&task_id](const auto &t) {
-        return t.second.get() == task_id;
-      });
-
-      if (pos == std::end(_timer_tasks)) {
+      auto index = _timer_index.find(task_id);
+      if (index == std::end(_timer_index)) {
         return std::nullopt;
       }
 
-      return std::move(*pos);
+      auto node = _timer_tasks.extract(index->second);
+      _timer_index.erase(index);
+
+      return std::pair {node.key(), std::move(node.mapped())};
     }
 
     std::optional<__task> pop() {
@@ -225,10 +199,10 @@ namespace task_pool_util {
         return task;
       }
 
-      if (!_timer_tasks.empty() && std::get<0>(_timer_tasks.back()) <= std::chrono::steady_clock::now()) {
-        __task task = std::move(std::get<1>(_timer_tasks.back()));
-        _timer_tasks.pop_back();
-        return task;
+      if (!_timer_tasks.empty() && _timer_tasks.begin()->first <= std::chrono::steady_clock::now()) {
+        auto node = _timer_tasks.extract(_timer_tasks.begin());
+        _timer_index.erase(&*node.mapped());
+        return std::move(node.mapped());
       }
 
       return std::nullopt;
@@ -237,7 +211,7 @@ namespace task_pool_util {
     bool ready() {
       std::lock_guard<std::mutex> lg(_task_mutex);
 
-      return !_tasks.empty() || (!_timer_tasks.empty() && std::get<0>(_timer_tasks.back()) <= std::chrono::steady_clock::now());
+      return !_tasks.empty() || (!_timer_tasks.empty() && _timer_tasks.begin()->first <= std::chrono::steady_clock::now());
     }
 
     std::optional<__time_point> next() {
@@ -247,7 +221,30 @@ namespace task_pool_util {
         return std::nullopt;
       }
 
-      return std::get<0>(_timer_tasks.back());
+      return _timer_tasks.begin()->first;
+    }
+
+  protected:
+    /**
+     * @brief Bind a task to its arguments.
+     * @return The runnable task and the future of its result.
+     */
+    template<class Function, class... Args>
+    auto package(Function &&newTask, Args &&...args) {
+      static_assert(std::is_invocable_v<Function, Args &&...>, "arguments don't match the function");
+
+      using __return = std::invoke_result_t<Function, Args &&...>;
+      using task_t = std::packaged_task<__return()>;
+
+      auto bind = [task = std::forward<Function>(newTask), tuple_args = std::make_tuple(std::forward<Args>(args)...)]() mutable {
+        return std::apply(task, std::move(tuple_args));
+      };
+
+      task_t task(std::move(bind));
+
+      auto future = task.get_future();
+
+      return std::pair {toRunnable(std::move(task)), std::move(future)};
     }
 
   private:
@@ -0,0 +1,137 @@
+/**
+ * @file src/thread_pool.cpp
+ * @brief Definitions for the thread pool system.
+ */
+// local includes
+#include "thread_pool.h"
+#include "platform/common.h"
+
+namespace thread_pool_util {
+  namespace {
+    // The pool and worker of the calling thread, so tasks pushed from a task stay on its worker
+    thread_local ThreadPool *local_pool = nullptr;
+    thread_local std::size_t local_worker = 0;
+  }  // namespace
+
+  void ThreadPool::start(int threads, std::vector<int> cpus) {
+    _cpus = std::move(cpus);
+    _continue = true;
+
+    while (_workers.size() < (std::size_t) threads) {
+      _workers.emplace_back(std::make_unique<worker_t>());
+    }
+    _worker_count.store(_workers.size(), std::memory_order_release);
+
+    _thread.resize(threads);
+
+    for (std::size_t x = 0; x < _thread.size(); ++x) {
+      _thread[x] = std::thread(&ThreadPool::_main, this, x);
+    }
+  }
+
+  void ThreadPool::stop() {
+    std::lock_guard lg(_lock);
+
+    _continue = false;
+    _cv.notify_all();
+  }
+
+  void ThreadPool::join() {
+    for (auto &t : _thread) {
+      t.join();
+    }
+  }
+
+  void ThreadPool::enqueue(priority_e priority, __task &&task) {
+    auto count = _worker_count.load(std::memory_order_acquire);
+    if (!count) {
+      std::lock_guard lg(_task_mutex);
+      _tasks.emplace_back(std::move(task));
+    } else {
+      auto id = local_pool == this ? local_worker : _next_worker.fetch_add(1, std::memory_order_relaxed) % count;
+      auto &worker = *_workers[id];
+
+      std::lock_guard lg(worker.lock);
+      worker.tasks[(std::size_t) priority].emplace_back(std::move(task));
+      ++_pending;
+    }
+
+    std::lock_guard lg(_lock);
+    _cv.notify_one();
+  }
+
+  std::optional<ThreadPool::__task> ThreadPool::take(std::size_t id) {
+    // Due timers and tasks queued before the pool started are late already
+    if (auto task = TaskPool::pop()) {
+      return task;
+    }
+
+    if (!_pending) {
+      return std::nullopt;
+    }
+
+    auto count = _worker_count.load(std::memory_order_acquire);
+    for (std::size_t priority = 0; priority < (std::size_t) priority_e::_size; ++priority) {
+      for (std::size_t x = 0; x < count; ++x) {
+        auto &worker = *_workers[(id + x) % count];
+
+        std::lock_guard lg(worker.lock);
+        auto &tasks = worker.tasks[priority];
+        if (tasks.empty()) {
+          continue;
+        }
+
+        // A worker runs its own tasks in order, thieves take the most recent ones
+        __task task;
+        if (x == 0) {
+          task = std::move(tasks.front());
+          tasks.pop_front();
+        } else {
+          task = std::move(tasks.back());
+          tasks.pop_back();
+        }
+
+        --_pending;
+        return task;
+      }
+    }
+
+    return std::nullopt;
+  }
+
+  void ThreadPool::_main(std::size_t id) {
+    local_pool = this;
+    local_worker = id;
+
+    if (!_cpus.empty()) {
+      platf::pin_thread(_cpus[id % _cpus.size()]);
+    }
+
+    while (_continue) {
+      if (auto task = take(id)) {
+        (*task)->run();
+      } else {
+        std::unique_lock uniq_lock(_lock);
+
+        if (_pending || ready()) {
+          continue;
+        }
+
+        if (!_continue) {
+          break;
+        }
+
+        if (auto tp = next()) {
+          _cv.wait_until(uniq_lock, *tp);
+        } else {
+          _cv.wait(uniq_lock);
+        }
+      }
+    }
+
+    // Execute remaining tasks
+    while (auto task = take(id)) {
+      (*task)->run();
+    }
+  }
+}  // namespace thread_pool_util
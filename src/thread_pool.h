@@ -5,38 +5,70 @@
 #pragma once
 
 // standard includes
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <memory>
 #include <thread>
+#include <vector>
 
 // local includes
 #include "task_pool.h"
 
 namespace thread_pool_util {
+  /**
+   * @brief The order in which queued tasks are picked up, whatever worker they were queued on.
+   */
+  enum class priority_e : int {
+    input,  ///< Input handling and feedback to the client, runs ahead of everything else
+    control,  ///< Streaming and session control, the default
+    housekeeping,  ///< Teardown and other work nobody waits for
+    _size
+  };
+
   /**
    * Allow threads to execute unhindered while keeping full control over the threads.
+   * Every worker has its own deques, a worker that runs out of tasks steals from the others.
    */
   class ThreadPool: public task_pool_util::TaskPool {
   public:
     typedef TaskPool::__task __task;
 
   private:
+    struct worker_t {
+      std::mutex lock;
+      std::array<std::deque<__task>, (std::size_t) priority_e::_size> tasks;
+    };
+
     std::vector<std::thread> _thread;
 
+    // Only grows in start(), _worker_count is published once the workers exist
+    std::vector<std::unique_ptr<worker_t>> _workers;
+    std::atomic<std::size_t> _worker_count {0};
+    std::atomic<std::size_t> _next_worker {0};
+
+    // Tasks queued on the workers that nobody picked up yet
+    std::atomic<std::size_t> _pending {0};
+
+    std::vector<int> _cpus;
+
     std::condition_variable _cv;
     std::mutex _lock;
 
-    bool _continue;
+    std::atomic<bool> _continue;
 
   public:
     ThreadPool():
         _continue {false} {
     }
 
-    explicit ThreadPool(int threads):
-        _thread(threads),
-        _continue {true} {
-      for (auto &t : _thread) {
-        t = std::thread(&ThreadPool::_main, this);
-      }
+    /**
+     * @param threads The number of workers.
+     * @param cpus The CPUs the workers are pinned to in turn, empty to leave them to the scheduler.
+     */
+    explicit ThreadPool(int threads, std::vector<int> cpus = {}):
+        _continue {false} {
+      start(threads, std::move(cpus));
     }
 
     ~ThreadPool() noexcept {
@@ -50,11 +82,15 @@ namespace thread_pool_util {
 
     template<class Function, class... Args>
     auto push(Function &&newTask, Args &&...args) {
-      std::lock_guard lg(_lock);
-      auto future = TaskPool::push(std::forward<Function>(newTask), std::forward<Args>(args)...);
+      return push(priority_e::control, std::forward<Function>(newTask), std::forward<Args>(args)...);
+    }
 
-      _cv.notify_one();
-      return future;
+    template<class Function, class... Args>
+    auto push(priority_e priority, Function &&newTask, Args &&...args) {
+      auto [task, future] = package(std::forward<Function>(newTask), std::forward<Args>(args)...);
+
+      enqueue(priority, std::move(task));
+      return std::move(future);
     }
 
     void pushDelayed(std::pair<__time_point, __task> &&task) {
@@ -73,57 +109,28 @@ namespace thread_pool_util {
       return future;
     }
 
-    void start(int threads) {
-      _continue = true;
+    /**
+     * @param threads The number of workers.
+     * @param cpus The CPUs the workers are pinned to in turn, empty to leave them to the scheduler.
+     */
+    void start(int threads, std::vector<int> cpus = {});
 
-      _thread.resize(threads);
+    void stop();
 
-      for (auto &t : _thread) {
-        t = std::thread(&ThreadPool::_main, this);
-      }
-    }
-
-    void stop() {
-      std::lock_guard lg(_lock);
-
-      _continue = false;
-      _cv.notify_all();
-    }
+    void join();
 
-    void join() {
-      for (auto &t : _thread) {
-        t.join();
-      }
-    }
-
-  public:
-    void _main() {
-      while (_continue) {
-        if (auto task = this->pop()) {
-          (*task)->run();
-        } else {
-          std::unique_lock uniq_lock(_lock);
-
-          if (ready()) {
-            continue;
-          }
-
-          if (!_continue) {
-            break;
-          }
-
-          if (auto tp = next()) {
-            _cv.wait_until(uniq_lock, *tp);
-          } else {
-            _cv.wait(uniq_lock);
-          }
-        }
-      }
-
-      // Execute remaining tasks
-      while (auto task = this->pop()) {
-        (*task)->run();
-      }
-    }
+  private:
+    /**
+     * @brief Queue a task on the calling worker, or on the next worker when called from outside the pool.
+     * Tasks queued before the pool is started wait in the shared queue.
+     */
+    void enqueue(priority_e priority, __task &&task);
+
+    /**
+     * @brief Take the next task for a worker: due timers, then the highest priority task of its own deques or another worker's.
+     */
+    std::optional<__task> take(std::size_t worker);
+
+    void _main(std::size_t worker);
   };
 }  // namespace thread_pool_util
@@ -7,9 +7,13 @@
 // standard includes
 #include <array>
 #include <atomic>
+#include <bit>
+#include <chrono>
 #include <condition_variable>
+#include <deque>
 #include <functional>
 #include <map>
+#include <memory>
 #include <mutex>
 #include <vector>
 
@@ -34,6 +38,27 @@ namespace safe {
       } else {
         _status = status_t {std::forward<Args>(args)...};
       }
+      _raised.store((bool) _status, std::memory_order_release);
+
+      _cv.notify_all();
+    }
+
+    // Like raise(), but a value that hasn't been popped yet is folded together with the new one by merge(pending, value)
+    template<class F>
+    void raise_merged(T value, F &&merge) {
+      static_assert(std::is_same_v<std::optional<T>, status_t>, "raise_merged needs the status to be an optional");
+
+      std::lock_guard lg {_lock};
+      if (!_continue) {
+        return;
+      }
+
+      if (_status) {
+        merge(*_status, std::move(value));
+      } else {
+        _status = std::move(value);
+      }
+      _raised.store(true, std::memory_order_release);
 
       _cv.notify_all();
     }
@@ -56,12 +81,18 @@ namespace safe {
 
       auto val = std::move(_status);
       _status = util::false_v<status_t>;
+      _raised.store(false, std::memory_order_relaxed);
       return val;
     }
 
     // pop and view should not be used interchangeably
     template<class Rep, class Period>
     status_t pop(std::chrono::duration<Rep, Period> delay) {
+      // Polling an event that hasn't been raised doesn't need the lock
+      if (delay <= delay.zero() && !peek()) {
+        return util::false_v<status_t>;
+      }
+
       std::unique_lock ul {_lock};
 
       if (!_continue) {
@@ -76,6 +107,7 @@ namespace safe {
 
       auto val = std::move(_status);
       _status = util::false_v<status_t>;
+      _raised.store(false, std::memory_order_relaxed);
       return val;
     }
 
@@ -101,6 +133,10 @@ namespace safe {
     // pop and view should not be used interchangeably
     template<class Rep, class Period>
     status_t view(std::chrono::duration<Rep, Period> delay) {
+      if (delay <= delay.zero() && !peek()) {
+        return util::false_v<status_t>;
+      }
+
       std::unique_lock ul {_lock};
 
       if (!_continue) {
@@ -117,7 +153,7 @@ namespace safe {
     }
 
     bool peek() {
-      return _continue && (bool) _status;
+      return _continue.load(std::memory_order_relaxed) && _raised.load(std::memory_order_acquire);
     }
 
     void stop() {
@@ -134,6 +170,7 @@ namespace safe {
       _continue = true;
 
       _status = util::false_v<status_t>;
+      _raised.store(false, std::memory_order_relaxed);
     }
 
     [[nodiscard]] bool running() const {
@@ -141,9 +178,12 @@ namespace safe {
     }
 
   private:
-    bool _continue {true};
+    std::atomic_bool _continue {true};
     status_t _status {util::false_v<status_t>};
 
+    // Whether _status is set, so peek() doesn't have to read it without the lock
+    std::atomic_bool _raised {false};
+
     std::condition_variable _cv;
     std::mutex _lock;
   };
@@ -271,16 +311,22 @@ namespace safe {
       }
 
       _queue.emplace_back(std::forward<Args>(args)...);
+      _ready.store(true, std::memory_order_release);
 
       _cv.notify_all();
     }
 
     bool peek() {
-      return _continue && !_queue.empty();
+      return _continue.load(std::memory_order_relaxed) && _ready.load(std::memory_order_acquire);
     }
 
     template<class Rep, class Period>
     status_t pop(std::chrono::duration<Rep, Period> delay) {
+      // Polling an empty queue doesn't need the lock
+      if (delay <= delay.zero() && !peek()) {
+        return util::false_v<status_t>;
+      }
+
       std::unique_lock ul {_lock};
 
       if (!_continue) {
@@ -294,7 +340,8 @@ namespace safe {
       }
 
       auto val = std::move(_queue.front());
-      _queue.erase(std::begin(_queue));
+      _queue.pop_front();
+      _ready.store(!_queue.empty(), std::memory_order_relaxed);
 
       return val;
     }
@@ -315,12 +362,13 @@ namespace safe {
       }
 
       auto val = std::move(_queue.front());
-      _queue.erase(std::begin(_queue));
+      _queue.pop_front();
+      _ready.store(!_queue.empty(), std::memory_order_relaxed);
 
       return val;
     }
 
-    std::vector<T> &unsafe() {
+    std::deque<T> &unsafe() {
       return _queue;
     }
 
@@ -337,13 +385,167 @@ namespace safe {
     }
 
   private:
-    bool _continue {true};
+    std::atomic_bool _continue {true};
     std::uint32_t _max_elements;
 
+    // Whether _queue holds an element, so peek() doesn't have to read it without the lock
+    std::atomic_bool _ready {false};
+
     std::mutex _lock;
     std::condition_variable _cv;
 
-    std::vector<T> _queue;
+    // Popped from the front for every element, which a vector does in O(n)
+    std::deque<T> _queue;
+  };
+
+  /**
+   * @brief A bounded queue of preallocated slots, pushed to and popped from without taking a lock.
+   * Any number of threads may raise(), but only a single thread may pop().
+   * The mutex is only taken to wake the consumer when it's waiting for an element.
+   */
+  template<class T>
+  class ring_t {
+  public:
+    using status_t = util::optional_t<T>;
+
+    ring_t(std::uint32_t max_elements = 32):
+        _mask {std::bit_ceil(max_elements) - 1},
+        _slots {std::make_unique<slot_t[]>(_mask + 1)} {
+      for (std::uint64_t x = 0; x <= _mask; ++x) {
+        _slots[x].seq.store(x, std::memory_order_relaxed);
+      }
+    }
+
+    /**
+     * @brief Push an element, without ever waiting for the consumer.
+     * @return `false` if the element was dropped, because the ring is full or stopped.
+     */
+    template<class... Args>
+    bool raise(Args &&...args) {
+      if (!_continue.load(std::memory_order_relaxed)) {
+        return false;
+      }
+
+      // Claim a slot. A slot is free for position pos once its sequence is pos.
+      auto pos = _tail.load(std::memory_order_relaxed);
+      slot_t *slot;
+      while (true) {
+        slot = &_slots[pos & _mask];
+        auto diff = (std::int64_t) (slot->seq.load(std::memory_order_acquire) - pos);
+        if (diff == 0) {
+          if (_tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+            break;
+          }
+        } else if (diff < 0) {
+          // The consumer hasn't emptied this slot since the last lap
+          return false;
+        } else {
+          pos = _tail.load(std::memory_order_relaxed);
+        }
+      }
+
+      slot->val = T {std::forward<Args>(args)...};
+      slot->seq.store(pos + 1, std::memory_order_release);
+
+      // Pairs with the fence in pop_impl(), either we see the consumer waiting or it sees the element
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      if (_waiting.load(std::memory_order_relaxed)) {
+        std::lock_guard lg {_lock};
+        _cv.notify_all();
+      }
+
+      return true;
+    }
+
+    bool peek() {
+      return _continue && ready();
+    }
+
+    /**
+     * @brief Elements waiting to be popped, only exact on the consumer thread.
+     */
+    [[nodiscard]] std::size_t size() const {
+      return _tail.load(std::memory_order_relaxed) - _head;
+    }
+
+    template<class Rep, class Period>
+    status_t pop(std::chrono::duration<Rep, Period> delay) {
+      auto deadline = std::chrono::steady_clock::now() + delay;
+      return pop_impl([&](std::unique_lock<std::mutex> &ul) {
+        return _cv.wait_until(ul, deadline) == std::cv_status::no_timeout;
+      });
+    }
+
+    status_t pop() {
+      return pop_impl([&](std::unique_lock<std::mutex> &ul) {
+        _cv.wait(ul);
+        return true;
+      });
+    }
+
+    void stop() {
+      std::lock_guard lg {_lock};
+
+      _continue = false;
+
+      _cv.notify_all();
+    }
+
+    [[nodiscard]] bool running() const {
+      return _continue;
+    }
+
+  private:
+    struct slot_t {
+      std::atomic<std::uint64_t> seq;
+      T val;
+    };
+
+    bool ready() const {
+      return _slots[_head & _mask].seq.load(std::memory_order_acquire) == _head + 1;
+    }
+
+    template<class F>
+    status_t pop_impl(F &&wait) {
+      while (_continue) {
+        if (ready()) {
+          auto &slot = _slots[_head & _mask];
+          status_t val = std::move(slot.val);
+          slot.val = T {};
+
+          // Hand the slot back to the producers for the next lap
+          slot.seq.store(_head + _mask + 1, std::memory_order_release);
+          ++_head;
+
+          return val;
+        }
+
+        std::unique_lock ul {_lock};
+        _waiting.store(true, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+
+        bool woken = ready() || !_continue || wait(ul);
+        _waiting.store(false, std::memory_order_relaxed);
+        if (!woken) {
+          break;
+        }
+      }
+
+      return util::false_v<status_t>;
+    }
+
+    std::atomic_bool _continue {true};
+    std::atomic_bool _waiting {false};
+
+    std::uint64_t _mask;
+    std::unique_ptr<slot_t[]> _slots;
+
+    // Keep the producer and consumer positions on separate cache lines
+    alignas(64) std::atomic<std::uint64_t> _tail {0};
+    alignas(64) std::uint64_t _head {0};
+
+    std::mutex _lock;
+    std::condition_variable _cv;
   };
 
   template<class T>
@@ -471,32 +673,42 @@ namespace safe {
 
   using signal_t = event_t<bool>;
 
+  // Mail slots are numbered from 0 up to this
+  constexpr std::size_t MAX_MAIL = 16;
+
+  /**
+   * @brief The id of a mail slot, typed with the post it holds so looking it up with another type doesn't compile.
+   * @tparam Post The post, e.g. `safe::event_t<bool>`.
+   * @tparam Index The slot of the post.
+   */
+  template<class Post, std::size_t Index>
+  struct mail_id_t {
+    static_assert(Index < MAX_MAIL, "mail index out of range");
+  };
+
   class mail_raw_t;
   using mail_t = std::shared_ptr<mail_raw_t>;
 
-  void cleanup(mail_raw_t *);
+  void cleanup(mail_raw_t *, std::size_t index);
 
   template<class T>
   class post_t: public T {
   public:
     template<class... Args>
-    post_t(mail_t mail, Args &&...args):
+    post_t(mail_t mail, std::size_t index, Args &&...args):
         T(std::forward<Args>(args)...),
-        mail {std::move(mail)} {
+        mail {std::move(mail)},
+        index {index} {
     }
 
     mail_t mail;
+    std::size_t index;
 
     ~post_t() {
-      cleanup(mail.get());
+      cleanup(mail.get(), index);
     }
   };
 
-  template<class T>
-  inline auto lock(const std::weak_ptr<void> &wp) {
-    return std::reinterpret_pointer_cast<typename T::element_type>(wp.lock());
-  }
-
   class mail_raw_t: public std::enable_shared_from_this<mail_raw_t> {
   public:
     template<class T>
@@ -506,55 +718,59 @@ namespace safe {
     using queue_t = std::shared_ptr<post_t<queue_t<T>>>;
 
     template<class T>
-    event_t<T> event(const std::string_view &id) {
-      std::lock_guard lg {mutex};
+    using ring_t = std::shared_ptr<post_t<ring_t<T>>>;
 
-      auto it = id_to_post.find(id);
-      if (it != std::end(id_to_post)) {
-        return lock<event_t<T>>(it->second);
-      }
+    template<class T, std::size_t Index>
+    event_t<T> event(const mail_id_t<safe::event_t<T>, Index> &) {
+      return post<safe::event_t<T>>(Index);
+    }
 
-      auto post = std::make_shared<typename event_t<T>::element_type>(shared_from_this());
-      id_to_post.emplace(std::pair<std::string, std::weak_ptr<void>> {std::string {id}, post});
+    template<class T, std::size_t Index>
+    queue_t<T> queue(const mail_id_t<safe::queue_t<T>, Index> &) {
+      return post<safe::queue_t<T>>(Index, depth);
+    }
 
-      return post;
+    template<class T, std::size_t Index>
+    ring_t<T> ring(const mail_id_t<safe::ring_t<T>, Index> &) {
+      return post<safe::ring_t<T>>(Index, depth);
     }
 
-    template<class T>
-    queue_t<T> queue(const std::string_view &id) {
+    /**
+     * @brief Free the slot of a post, unless it has been taken by a new post already.
+     */
+    void cleanup(std::size_t index) {
       std::lock_guard lg {mutex};
 
-      auto it = id_to_post.find(id);
-      if (it != std::end(id_to_post)) {
-        return lock<queue_t<T>>(it->second);
+      if (slots[index].expired()) {
+        slots[index].reset();
       }
-
-      auto post = std::make_shared<typename queue_t<T>::element_type>(shared_from_this(), 32);
-      id_to_post.emplace(std::pair<std::string, std::weak_ptr<void>> {std::string {id}, post});
-
-      return post;
     }
 
-    void cleanup() {
-      std::lock_guard lg {mutex};
+    std::mutex mutex;
 
-      for (auto it = std::begin(id_to_post); it != std::end(id_to_post); ++it) {
-        auto &weak = it->second;
+    std::array<std::weak_ptr<void>, MAX_MAIL> slots;
 
-        if (weak.expired()) {
-          id_to_post.erase(it);
+    // Elements of the queues and rings posted from now on
+    std::uint32_t depth = 32;
 
-          return;
-        }
+  private:
+    template<class T, class... Args>
+    std::shared_ptr<post_t<T>> post(std::size_t index, Args &&...args) {
+      std::lock_guard lg {mutex};
+
+      auto &slot = slots[index];
+      if (auto existing = slot.lock()) {
+        return std::static_pointer_cast<post_t<T>>(existing);
       }
-    }
 
-    std::mutex mutex;
+      auto post = std::make_shared<post_t<T>>(shared_from_this(), index, std::forward<Args>(args)...);
+      slot = post;
 
-    std::map<std::string, std::weak_ptr<void>, std::less<>> id_to_post;
+      return post;
+    }
   };
 
-  inline void cleanup(mail_raw_t *mail) {
-    mail->cleanup();
+  inline void cleanup(mail_raw_t *mail, std::size_t index) {
+    mail->cleanup(index);
   }
 }  // namespace safe
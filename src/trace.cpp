@@ -0,0 +1,210 @@
+/**
+ * @file src/trace.cpp
+ * @brief Definitions for tracing the stages of the streaming pipeline.
+ */
+// standard includes
+#include <algorithm>
+#include <array>
+#include <format>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <vector>
+
+// local includes
+#include "logging.h"
+#include "trace.h"
+
+using namespace std::literals;
+
+namespace trace {
+  namespace detail {
+    std::atomic<bool> enabled {false};
+  }  // namespace detail
+
+  namespace {
+    constexpr std::string_view stage_names[] {
+      "capture"sv,
+      "convert"sv,
+      "encode"sv,
+      "fec"sv,
+      "encrypt"sv,
+      "send"sv,
+      "camera_read"sv,
+      "camera_decode"sv,
+      "camera_scale"sv,
+      "input_receive"sv,
+      "input_inject"sv,
+    };
+    static_assert(std::size(stage_names) == (std::size_t) stage_e::_size);
+
+    /**
+     * @brief A span, every field is atomic so the ring can be read while its thread overwrites it.
+     */
+    struct event_t {
+      std::atomic<std::int64_t> begin_ns;
+      std::atomic<std::int64_t> duration_ns;
+      std::atomic<std::int64_t> frame;
+      std::atomic<stage_e> stage;
+      std::atomic<std::uint32_t> generation;
+    };
+
+    /**
+     * @brief The spans of one thread, only that thread writes to it.
+     */
+    struct ring_t {
+      int tid;
+
+      // Events below head are complete, claimed is bumped before an event is overwritten
+      std::atomic<std::uint64_t> head {0};
+      std::atomic<std::uint64_t> claimed {0};
+      std::array<event_t, RING_SIZE> events;
+    };
+
+    std::mutex rings_lock;
+    std::vector<std::shared_ptr<ring_t>> rings;
+    int next_tid = 1;
+
+    // Every trace has its own generation, spans of the previous ones are left out of the export
+    std::atomic<std::uint32_t> generation {0};
+    std::atomic<std::int64_t> trace_start_ns {0};
+
+    std::int64_t to_ns(std::chrono::steady_clock::time_point point) {
+      return std::chrono::duration_cast<std::chrono::nanoseconds>(point.time_since_epoch()).count();
+    }
+
+    ring_t &local_ring() {
+      thread_local std::shared_ptr<ring_t> ring;
+      if (!ring) {
+        ring = std::make_shared<ring_t>();
+
+        std::lock_guard lg {rings_lock};
+        ring->tid = next_tid++;
+        rings.emplace_back(ring);
+      }
+
+      return *ring;
+    }
+
+    struct exported_t {
+      int tid;
+      std::int64_t begin_ns;
+      std::int64_t duration_ns;
+      std::int64_t frame;
+      stage_e stage;
+      std::uint32_t generation;
+    };
+
+    void copy_ring(const ring_t &ring, std::uint32_t current, std::vector<exported_t> &out) {
+      auto head = ring.head.load(std::memory_order_acquire);
+      auto first = head > RING_SIZE ? head - RING_SIZE : 0;
+
+      auto begin = out.size();
+      for (auto x = first; x < head; ++x) {
+        auto &event = ring.events[x % RING_SIZE];
+        out.emplace_back(exported_t {
+          ring.tid,
+          event.begin_ns.load(std::memory_order_relaxed),
+          event.duration_ns.load(std::memory_order_relaxed),
+          event.frame.load(std::memory_order_relaxed),
+          event.stage.load(std::memory_order_relaxed),
+          event.generation.load(std::memory_order_relaxed),
+        });
+      }
+
+      // Events the thread started to overwrite while they were copied may be torn
+      std::atomic_thread_fence(std::memory_order_acquire);
+      auto claimed = ring.claimed.load(std::memory_order_relaxed);
+      auto valid = claimed > RING_SIZE ? claimed - RING_SIZE : 0;
+
+      if (valid > first) {
+        out.erase(std::begin(out) + begin, std::begin(out) + begin + std::min(valid - first, head - first));
+      }
+
+      auto stale = std::remove_if(std::begin(out) + begin, std::end(out), [current](const exported_t &event) {
+        return event.generation != current;
+      });
+      out.erase(stale, std::end(out));
+    }
+  }  // namespace
+
+  void set_enabled(bool enable) {
+    std::lock_guard lg {rings_lock};
+    if (enable == enabled()) {
+      return;
+    }
+
+    if (enable) {
+      // Rings only referenced from here belong to threads that are gone
+      std::erase_if(rings, [](const auto &ring) {
+        return ring.use_count() == 1;
+      });
+      trace_start_ns = to_ns(std::chrono::steady_clock::now());
+      ++generation;
+    }
+
+    detail::enabled = enable;
+    BOOST_LOG(info) << "Pipeline tracing "sv << (enable ? "started"sv : "stopped"sv);
+  }
+
+  void span(stage_e stage, std::int64_t frame, std::chrono::steady_clock::time_point begin, std::chrono::steady_clock::time_point end) {
+    if (!enabled()) {
+      return;
+    }
+
+    auto &ring = local_ring();
+    auto index = ring.head.load(std::memory_order_relaxed);
+
+    ring.claimed.store(index + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    auto &event = ring.events[index % RING_SIZE];
+    event.begin_ns.store(to_ns(begin), std::memory_order_relaxed);
+    event.duration_ns.store(std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin).count(), std::memory_order_relaxed);
+    event.frame.store(frame, std::memory_order_relaxed);
+    event.stage.store(stage, std::memory_order_relaxed);
+    event.generation.store(generation.load(std::memory_order_relaxed), std::memory_order_relaxed);
+
+    ring.head.store(index + 1, std::memory_order_release);
+  }
+
+  std::string dump() {
+    std::vector<exported_t> events;
+    std::int64_t start_ns;
+    {
+      std::lock_guard lg {rings_lock};
+      start_ns = trace_start_ns;
+      for (auto &ring : rings) {
+        copy_ring(*ring, generation, events);
+      }
+    }
+
+    std::string out = R"({"displayTimeUnit":"ms","traceEvents":[)";
+    out.reserve(out.size() + events.size() * 128);
+
+    // Timestamps and durations are in microseconds, relative to the start of the trace
+    auto separator = ""sv;
+    for (auto &event : events) {
+      auto category = event.stage >= stage_e::input_receive ? "input"sv : "video"sv;
+      std::format_to(
+        std::back_inserter(out),
+        R"({}{{"name":"{}","cat":"{}","ph":"X","pid":1,"tid":{},"ts":{:.3f},"dur":{:.3f})",
+        separator,
+        stage_names[(std::size_t) event.stage],
+        category,
+        event.tid,
+        (event.begin_ns - start_ns) / 1000.0,
+        event.duration_ns / 1000.0
+      );
+
+      if (event.frame >= 0) {
+        std::format_to(std::back_inserter(out), R"(,"args":{{"frame":{}}})", event.frame);
+      }
+      out += '}';
+      separator = ","sv;
+    }
+    out += "]}";
+
+    return out;
+  }
+}  // namespace trace
@@ -0,0 +1,103 @@
+/**
+ * @file src/trace.h
+ * @brief Declarations for tracing the stages of the streaming pipeline.
+ */
+#pragma once
+
+// standard includes
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+/**
+ * @brief Spans of the pipeline stages, recorded per thread and exported in the Chrome JSON trace format.
+ * Perfetto (https://ui.perfetto.dev) and chrome://tracing both open the export.
+ */
+namespace trace {
+  enum class stage_e : std::uint8_t {
+    capture,  ///< From the frame being captured until it is handed to the encoders
+    convert,  ///< Color conversion of a captured frame
+    encode,  ///< Encoding a converted frame
+    fec,  ///< Parity of a FEC block
+    encrypt,  ///< Sealing the shards of a FEC block
+    send,  ///< Handing a batch of shards to the socket
+    camera_read,  ///< Reading a frame from a V4L2 camera, including the wait for the driver to deliver it
+    camera_decode,  ///< Decoding a compressed camera frame
+    camera_scale,  ///< Copying or converting a decoded camera frame into a capture image
+    input_receive,  ///< From an input message being received until the input thread injects it
+    input_inject,  ///< Sending a batch of input to the OS
+    _size
+  };
+
+  // Spans recorded per thread, older spans are overwritten once a thread has recorded that many
+  constexpr std::size_t RING_SIZE = 16384;
+
+  namespace detail {
+    extern std::atomic<bool> enabled;
+  }  // namespace detail
+
+  /**
+   * @brief Whether spans are being recorded.
+   */
+  inline bool enabled() {
+    return detail::enabled.load(std::memory_order_relaxed);
+  }
+
+  /**
+   * @brief Start or stop recording spans.
+   * Starting a trace discards the spans of the previous one.
+   * @param enable Whether to record spans.
+   */
+  void set_enabled(bool enable);
+
+  /**
+   * @brief Record a span on the ring of the calling thread.
+   * @param stage The pipeline stage.
+   * @param frame The frame number, or -1 if the span doesn't belong to a frame.
+   * @param begin Start of the span.
+   * @param end End of the span.
+   */
+  void span(stage_e stage, std::int64_t frame, std::chrono::steady_clock::time_point begin, std::chrono::steady_clock::time_point end);
+
+  /**
+   * @brief Record the span of a scope.
+   * @examples
+   * {
+   *   trace::scope_t span {trace::stage_e::convert, frame_nr};
+   *   session->convert(*img);
+   * }
+   * @examples_end
+   */
+  class scope_t {
+  public:
+    scope_t(stage_e stage, std::int64_t frame):
+        stage {stage},
+        frame {frame} {
+      if (enabled()) {
+        begin = std::chrono::steady_clock::now();
+      }
+    }
+
+    ~scope_t() {
+      if (begin != std::chrono::steady_clock::time_point {}) {
+        span(stage, frame, begin, std::chrono::steady_clock::now());
+      }
+    }
+
+    scope_t(const scope_t &) = delete;
+    scope_t &operator=(const scope_t &) = delete;
+
+  private:
+    stage_e stage;
+    std::int64_t frame;
+    std::chrono::steady_clock::time_point begin;
+  };
+
+  /**
+   * @brief Export the recorded spans of every thread.
+   * Recording carries on while the spans are exported.
+   * @return The trace as a Chrome JSON trace object.
+   */
+  std::string dump();
+}  // namespace trace
@@ -3,6 +3,8 @@
  * @brief Definitions for UPnP port mapping.
  */
 // standard includes
+#include <algorithm>
+#include <optional>
 #include <stddef.h>  // workaround for type_t error in miniupnpc 2.3.3, see https://github.com/miniupnp/miniupnp/commit/e263ab6f56c382e10fed31347ec68095d691a0e8
 
 // lib includes
@@ -35,6 +37,16 @@ namespace upnp {
     std::string description;
   };
 
+  /**
+   * @brief An IGD found by discovery, kept to refresh the mappings without discovering it again.
+   */
+  struct igd_t {
+    IGDdatas data;
+    urls_t urls;
+    std::string lan_addr;
+    std::chrono::steady_clock::time_point discovered;
+  };
+
   static std::string_view status_string(int status) {
     switch (status) {
       case 0:
@@ -62,6 +74,12 @@ namespace upnp {
 #endif
   }
 
+  std::chrono::seconds retry_interval(int failures) {
+    // Past 5 doublings the delay is capped anyway, don't let the shift overflow
+    auto delay = RETRY_INTERVAL * (1 << std::clamp(failures - 1, 0, 5));
+    return std::min<std::chrono::seconds>(delay, REFRESH_INTERVAL);
+  }
+
   class deinit_t: public platf::deinit_t {
   public:
     deinit_t() {
@@ -296,68 +314,112 @@ namespace upnp {
     }
 
     /**
-     * @brief Maintains UPnP port forwarding rules
+     * @brief Discovers an IPv4 IGD and maps all ports through it.
+     * @param address_family The address families Sunshine listens on.
+     * @return The IGD, or `std::nullopt` if none was found.
      */
-    void upnp_thread_proc() {
+    std::optional<igd_t> discover_and_map(net::af_e address_family) {
       auto shutdown_event = mail::man->event<bool>(mail::shutdown);
-      bool mapped = false;
-      IGDdatas data;
-      urls_t mapped_urls;
-      auto address_family = net::af_from_enum_string(config::sunshine.address_family);
 
-      // Refresh UPnP rules every few minutes. They can be lost if the router reboots,
-      // WAN IP address changes, or various other conditions.
-      do {
-        int err = 0;
-        device_t device {upnpDiscover(2000, nullptr, nullptr, 0, IPv4, 2, &err)};
-        if (!device || err) {
-          BOOST_LOG(warning) << "Couldn't discover any IPv4 UPNP devices"sv;
-          mapped = false;
-          continue;
-        }
+      int err = 0;
+      device_t device {upnpDiscover(2000, nullptr, nullptr, 0, IPv4, 2, &err)};
+      if (!device || err) {
+        BOOST_LOG(warning) << "Couldn't discover any IPv4 UPNP devices"sv;
+        return std::nullopt;
+      }
 
-        for (auto dev = device.get(); dev != nullptr; dev = dev->pNext) {
-          BOOST_LOG(debug) << "Found device: "sv << dev->descURL;
-        }
+      for (auto dev = device.get(); dev != nullptr; dev = dev->pNext) {
+        BOOST_LOG(debug) << "Found device: "sv << dev->descURL;
+      }
+
+      std::array<char, INET6_ADDRESS_STRLEN> lan_addr;
 
-        std::array<char, INET6_ADDRESS_STRLEN> lan_addr;
+      igd_t igd;
+      auto status = upnp::UPNP_GetValidIGDStatus(device, &igd.urls, &igd.data, lan_addr);
+      if (status != 1 && status != 2) {
+        BOOST_LOG(error) << status_string(status);
+        return std::nullopt;
+      }
 
-        urls_t urls;
-        auto status = upnp::UPNP_GetValidIGDStatus(device, &urls, &data, lan_addr);
-        if (status != 1 && status != 2) {
-          BOOST_LOG(error) << status_string(status);
-          mapped = false;
-          continue;
-        }
+      igd.lan_addr = lan_addr.data();
+      igd.discovered = std::chrono::steady_clock::now();
 
-        std::string lan_addr_str {lan_addr.data()};
+      BOOST_LOG(debug) << "Found valid IGD device: "sv << igd.urls->rootdescURL;
 
-        BOOST_LOG(debug) << "Found valid IGD device: "sv << urls->rootdescURL;
+      for (auto it = std::begin(mappings); it != std::end(mappings) && !shutdown_event->peek(); ++it) {
+        map_upnp_port(igd.data, igd.urls, igd.lan_addr, *it);
+      }
 
-        for (auto it = std::begin(mappings); it != std::end(mappings) && !shutdown_event->peek(); ++it) {
-          map_upnp_port(data, urls, lan_addr_str, *it);
-        }
+      // If we are listening on IPv6 and the IGD has an IPv6 firewall enabled, try to create IPv6 firewall pinholes
+      if (address_family == net::af_e::BOTH && create_ipv6_pinholes()) {
+        BOOST_LOG(debug) << "Successfully opened IPv6 pinholes on the IGD"sv;
+      }
+
+      return igd;
+    }
+
+    /**
+     * @brief Renews all port mappings through an IGD found before.
+     * @param igd The IGD.
+     * @return `false` if the IGD didn't accept any of them, it is likely gone.
+     */
+    bool refresh_mappings(const igd_t &igd) {
+      auto shutdown_event = mail::man->event<bool>(mail::shutdown);
+
+      bool any_mapped = false;
+      for (auto it = std::begin(mappings); it != std::end(mappings) && !shutdown_event->peek(); ++it) {
+        any_mapped = map_upnp_port(igd.data, igd.urls, igd.lan_addr, *it) || any_mapped;
+      }
+
+      return any_mapped || shutdown_event->peek();
+    }
+
+    /**
+     * @brief Maintains UPnP port forwarding rules
+     */
+    void upnp_thread_proc() {
+      auto shutdown_event = mail::man->event<bool>(mail::shutdown);
+      auto address_family = net::af_from_enum_string(config::sunshine.address_family);
 
-        if (!mapped) {
-          BOOST_LOG(info) << "Completed UPnP port mappings to "sv << lan_addr_str << " via "sv << urls->rootdescURL;
+      std::optional<igd_t> igd;
+      bool mapped_once = false;
+      int failures = 0;
+
+      // Refresh UPnP rules every few minutes. They can be lost if the router reboots,
+      // WAN IP address changes, or various other conditions. Discovery takes seconds,
+      // so the IGD found last is reused until it stops answering.
+      std::chrono::seconds wait;
+      do {
+        if (igd && std::chrono::steady_clock::now() - igd->discovered >= REDISCOVERY_INTERVAL) {
+          igd.reset();
+        } else if (igd && !refresh_mappings(*igd)) {
+          BOOST_LOG(warning) << "UPnP IGD stopped accepting port mappings, discovering it again"sv;
+          igd.reset();
         }
 
-        // If we are listening on IPv6 and the IGD has an IPv6 firewall enabled, try to create IPv6 firewall pinholes
-        if (address_family == net::af_e::BOTH) {
-          if (create_ipv6_pinholes() && !mapped) {
+        if (!igd) {
+          igd = discover_and_map(address_family);
+
+          if (igd && !mapped_once) {
             // Only log the first time through
-            BOOST_LOG(info) << "Successfully opened IPv6 pinholes on the IGD"sv;
+            BOOST_LOG(info) << "Completed UPnP port mappings to "sv << igd->lan_addr << " via "sv << igd->urls->rootdescURL;
+            mapped_once = true;
           }
         }
 
-        mapped = true;
-        mapped_urls = std::move(urls);
-      } while (!shutdown_event->view(REFRESH_INTERVAL));
+        if (igd) {
+          failures = 0;
+          wait = REFRESH_INTERVAL;
+        } else {
+          wait = retry_interval(++failures);
+          BOOST_LOG(debug) << "Retrying UPnP discovery in "sv << wait.count() << " seconds"sv;
+        }
+      } while (!shutdown_event->view(wait));
 
-      if (mapped) {
+      if (igd) {
         // Unmap ports upon termination
         BOOST_LOG(info) << "Unmapping UPNP ports..."sv;
-        unmap_all_upnp_ports(mapped_urls, data);
+        unmap_all_upnp_ports(igd->urls, igd->data);
       }
     }
 
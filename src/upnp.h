@@ -20,6 +20,16 @@ namespace upnp {
   constexpr auto PORT_MAPPING_LIFETIME = 3600s;
   constexpr auto REFRESH_INTERVAL = 120s;
 
+  /**
+   * @brief Time between full discoveries while the IGD keeps answering, so a new LAN address is picked up.
+   */
+  constexpr auto REDISCOVERY_INTERVAL = 1800s;
+
+  /**
+   * @brief First delay before retrying when no IGD could be found, doubled up to REFRESH_INTERVAL on each failure.
+   */
+  constexpr auto RETRY_INTERVAL = 5s;
+
   using device_t = util::safe_ptr<UPNPDev, freeUPNPDevlist>;
 
   KITTY_USING_MOVE_T(urls_t, UPNPUrls, , {
@@ -40,5 +50,12 @@ namespace upnp {
    */
   int UPNP_GetValidIGDStatus(device_t &device, urls_t *urls, IGDdatas *data, std::array<char, INET6_ADDRESS_STRLEN> &lan_addr);
 
+  /**
+   * @brief Get the delay before the next discovery after it failed a number of times in a row.
+   * @param failures The number of discoveries that failed in a row, at least 1.
+   * @return The delay, from RETRY_INTERVAL doubling up to REFRESH_INTERVAL.
+   */
+  std::chrono::seconds retry_interval(int failures);
+
   [[nodiscard]] std::unique_ptr<platf::deinit_t> start();
 }  // namespace upnp
@@ -0,0 +1,119 @@
+/**
+ * @file src/utility.cpp
+ * @brief Definitions for utility functions.
+ */
+// standard includes
+#include <cstdint>
+#include <cstdlib>
+
+#ifdef __linux__
+  #include <fstream>
+
+  // platform includes
+  #include <sys/mman.h>
+  #include <unistd.h>
+#elif defined(_WIN32)
+  #include <malloc.h>
+#endif
+
+// local includes
+#include "utility.h"
+
+namespace util {
+  namespace {
+    constexpr std::size_t round_up(std::size_t size, std::size_t multiple) {
+      return (size + multiple - 1) / multiple * multiple;
+    }
+
+#ifdef __linux__
+    std::size_t page_size() {
+      static const auto size = (std::size_t) sysconf(_SC_PAGESIZE);
+      return size;
+    }
+
+    /**
+     * @brief Size of a transparent huge page, 2 MiB on x86 but larger on kernels with 16 KiB or 64 KiB pages.
+     */
+    std::size_t huge_page_size() {
+      static const auto size = []() -> std::size_t {
+        std::ifstream in {"/sys/kernel/mm/transparent_hugepage/hpage_pmd_size"};
+
+        std::size_t size = 0;
+        if (!(in >> size) || size == 0) {
+          return 2 * 1024 * 1024;
+        }
+
+        return size;
+      }();
+
+      return size;
+    }
+
+    /**
+     * @brief Map a buffer starting on a huge page boundary.
+     * The mapping ends on the first page after the buffer, so only the huge pages the buffer
+     * covers in full are promoted, and the tail never costs a whole huge page of RAM.
+     */
+    void *map_huge(std::size_t size) {
+      auto huge = huge_page_size();
+      auto length = round_up(size, page_size());
+
+      auto mapping = (std::uint8_t *) mmap(nullptr, length + huge, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      if (mapping == MAP_FAILED) {
+        return nullptr;
+      }
+
+      // Trim the mapping to the aligned range
+      auto start = (std::uint8_t *) round_up((std::uintptr_t) mapping, huge);
+      if (start != mapping) {
+        munmap(mapping, start - mapping);
+      }
+      auto tail = (mapping + length + huge) - (start + length);
+      if (tail) {
+        munmap(start + length, tail);
+      }
+
+      // Kernels without transparent huge pages refuse the advice, the buffer works all the same
+      madvise(start, length, MADV_HUGEPAGE);
+
+      return start;
+    }
+#endif
+  }  // namespace
+
+  void *alloc_aligned(std::size_t size) {
+#ifdef __linux__
+    if (size >= huge_page_size()) {
+      return map_huge(size);
+    }
+#endif
+
+    // Aligned allocations must be a multiple of the alignment
+    size = round_up(std::max<std::size_t>(size, 1), BUFFER_ALIGNMENT);
+
+#ifdef _WIN32
+    return _aligned_malloc(size, BUFFER_ALIGNMENT);
+#else
+    return std::aligned_alloc(BUFFER_ALIGNMENT, size);
+#endif
+  }
+
+  void free_aligned(void *ptr, std::size_t size) {
+    if (!ptr) {
+      return;
+    }
+
+#ifdef __linux__
+    if (size >= huge_page_size()) {
+      munmap(ptr, round_up(size, page_size()));
+      return;
+    }
+#endif
+
+#ifdef _WIN32
+    _aligned_free(ptr);
+#else
+    std::free(ptr);
+#endif
+  }
+}  // namespace util
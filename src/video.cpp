@@ -3,13 +3,28 @@
  * @brief Definitions for video.
  */
 // standard includes
+#include <algorithm>
+#include <array>
 #include <atomic>
 #include <bitset>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <functional>
+#include <future>
 #include <list>
+#include <map>
+#include <mutex>
+#include <numeric>
+#include <optional>
+#include <set>
+#include <sstream>
 #include <thread>
 
 // lib includes
 #include <boost/pointer_cast.hpp>
+#include <nlohmann/json.hpp>
 
 extern "C" {
 #include <libavutil/imgutils.h>
@@ -22,13 +37,21 @@ extern "C" {
 #include "cbs.h"
 #include "config.h"
 #include "display_device.h"
+#include "file_handler.h"
 #include "globals.h"
 #include "input.h"
 #include "logging.h"
+#include "memory_budget.h"
+#include "metrics.h"
 #include "nvenc/nvenc_base.h"
 #include "platform/common.h"
 #include "sync.h"
+#include "thread_pool.h"
+#include "trace.h"
 #include "video.h"
+#include "video_convert.h"
+#include "video_governor.h"
+#include "video_scheduler.h"
 
 #ifdef _WIN32
 extern "C" {
@@ -118,42 +141,93 @@ namespace video {
 
   }  // namespace qsv
 
+  namespace amd {
+    // Usages amd_usage = auto picks from, from the highest quality to the lowest latency
+    constexpr std::array<std::string_view, 3> auto_usages {"lowlatency_high_quality"sv, "lowlatency"sv, "ultralowlatency"sv};
+
+    // Encode latencies of auto_usages measured by the last probe, by video format
+    std::array<std::vector<amd_usage_latency_t>, 3> usage_latencies;
+
+    // Set while the probe measures a usage
+    std::string usage_override;
+
+    /**
+     * @brief Get the usage option of a stream.
+     * @param config The stream configuration.
+     * @param configured The usage amd_usage sets for the codec of the stream.
+     */
+    std::string usage(const config_t &config, const std::optional<int> &configured) {
+      if (!usage_override.empty()) {
+        return usage_override;
+      }
+
+      if (config::video.amd.amd_usage_auto) {
+        return pick_amd_usage(usage_latencies[std::clamp(config.videoFormat, 0, 2)], config.width, config.height, config.framerate);
+      }
+
+      return configured ? std::to_string(*configured) : "ultralowlatency"s;
+    }
+  }  // namespace amd
+
   util::Either<avcodec_buffer_t, int> dxgi_init_avcodec_hardware_input_buffer(platf::avcodec_encode_device_t *);
   util::Either<avcodec_buffer_t, int> vaapi_init_avcodec_hardware_input_buffer(platf::avcodec_encode_device_t *);
   util::Either<avcodec_buffer_t, int> cuda_init_avcodec_hardware_input_buffer(platf::avcodec_encode_device_t *);
   util::Either<avcodec_buffer_t, int> vt_init_avcodec_hardware_input_buffer(platf::avcodec_encode_device_t *);
+  util::Either<avcodec_buffer_t, int> drm_init_avcodec_hardware_input_buffer(platf::avcodec_encode_device_t *);
 
   class avcodec_software_encode_device_t: public platf::avcodec_encode_device_t {
   public:
     int convert(platf::img_t &img) override {
-      // If we need to add aspect ratio padding, we need to scale into an intermediate output buffer
+      // With aspect ratio padding, the image only covers part of the frame
       bool requires_padding = (sw_frame->width != sws_output_frame->width || sw_frame->height != sws_output_frame->height);
 
-      // Setup the input frame using the caller's img_t
-      sws_input_frame->data[0] = img.data;
-      sws_input_frame->linesize[0] = img.row_pitch;
+      // Capture backends may hand us YUV directly instead of BGR0
+      auto input_format = img.pix_fmt ? map_av_pix_fmt(*img.pix_fmt) : AV_PIX_FMT_BGR0;
+      if (input_format == AV_PIX_FMT_NONE) {
+        BOOST_LOG(error) << "Unsupported image pixel format: "sv << platf::from_pix_fmt(*img.pix_fmt);
+        return -1;
+      }
 
-      // Perform color conversion and scaling to the final size
-      auto status = sws_scale_frame(sws.get(), requires_padding ? sws_output_frame.get() : sw_frame.get(), sws_input_frame.get());
-      if (status < 0) {
-        char string[AV_ERROR_MAX_STRING_SIZE];
-        BOOST_LOG(error) << "Couldn't scale frame: "sv << av_make_error_string(string, AV_ERROR_MAX_STRING_SIZE, status);
+      if (input_format != sws_input_frame->format) {
+        if (init_sws(input_format)) {
+          return -1;
+        }
+        apply_colorspace();
+      }
+
+      // Setup the input frame using the caller's img_t
+      int linesizes[4];
+      if (av_image_fill_linesizes(linesizes, input_format, img.row_pitch / std::max(1, img.pixel_pitch)) < 0 ||
+          av_image_fill_pointers(sws_input_frame->data, input_format, img.height, img.data, linesizes) < 0) {
+        BOOST_LOG(error) << "Couldn't map image planes"sv;
         return -1;
       }
+      std::copy_n(linesizes, 4, sws_input_frame->linesize);
 
-      // If we require aspect ratio padding, copy the output frame into the final padded frame
+      // With aspect ratio padding, the image goes straight into the area of sw_frame inside the padding
+      auto target = sw_frame.get();
       if (requires_padding) {
-        auto fmt_desc = av_pix_fmt_desc_get((AVPixelFormat) sws_output_frame->format);
-        auto planes = av_pix_fmt_count_planes((AVPixelFormat) sws_output_frame->format);
-        for (int plane = 0; plane < planes; plane++) {
-          auto shift_h = plane == 0 ? 0 : fmt_desc->log2_chroma_h;
-          auto shift_w = plane == 0 ? 0 : fmt_desc->log2_chroma_w;
-          auto offset = ((offsetW >> shift_w) * fmt_desc->comp[plane].step) + (offsetH >> shift_h) * sw_frame->linesize[plane];
-
-          // Copy line-by-line to preserve leading padding for each row
-          for (int line = 0; line < sws_output_frame->height >> shift_h; line++) {
-            memcpy(sw_frame->data[plane] + offset + (line * sw_frame->linesize[plane]), sws_output_frame->data[plane] + (line * sws_output_frame->linesize[plane]), (size_t) (sws_output_frame->width >> shift_w) * fmt_desc->comp[plane].step);
-          }
+        if (make_padded_view()) {
+          return -1;
+        }
+        target = padded_view.get();
+      }
+      auto release_padded_view = util::fail_guard([this]() {
+        av_frame_unref(padded_view.get());
+      });
+
+      // Skip the conversion entirely when the image is already in the encoder's format
+      if (input_format == sw_frame->format && sws_input_frame->width == sw_frame->width && sws_input_frame->height == sw_frame->height) {
+        av_image_copy(sw_frame->data, sw_frame->linesize, (const std::uint8_t **) sws_input_frame->data, sws_input_frame->linesize, input_format, sw_frame->width, sw_frame->height);
+      } else if (use_fast_convert(input_format)) {
+        fast_convert(*target);
+      } else {
+        // Perform color conversion and scaling to the final size
+        auto status = sws_scale_frame(sws.get(), target, sws_input_frame.get());
+        if (status < 0) {
+          char string[AV_ERROR_MAX_STRING_SIZE];
+          BOOST_LOG(error) << "Couldn't scale frame: "sv << av_make_error_string(string, AV_ERROR_MAX_STRING_SIZE, status);
+          return -1;
         }
       }
 
@@ -191,6 +265,99 @@ namespace video {
     void apply_colorspace() override {
       auto avcodec_colorspace = avcodec_colorspace_from_sunshine_colorspace(colorspace);
       sws_setColorspaceDetails(sws.get(), sws_getCoefficients(SWS_CS_DEFAULT), 0, sws_getCoefficients(avcodec_colorspace.software_format), avcodec_colorspace.range - 1, 0, 1 << 16, 1 << 16);
+      coefficients = convert::coefficients_from_colorspace(colorspace);
+    }
+
+    /**
+     * @brief Check if the vectorized converter can replace libswscale for an image.
+     * It only handles BGR0 to 8 bit 4:2:0 or 4:4:4 and YUYV to 8 bit 4:2:0, without scaling.
+     * 4:4:4 needs no chroma filter and YUYV is only repacked, so those are taken even where the
+     * converter isn't vectorized, the plain loops beat libswscale there.
+     */
+    bool use_fast_convert(AVPixelFormat input_format) {
+      if (sws_input_frame->width != sws_output_frame->width || sws_input_frame->height != sws_output_frame->height) {
+        return false;
+      }
+
+      auto yuv420 = sw_frame->format == AV_PIX_FMT_NV12 || sw_frame->format == AV_PIX_FMT_YUV420P;
+
+      // Cameras deliver limited range, which the repacked samples keep
+      if (input_format == AV_PIX_FMT_YUYV422) {
+        return yuv420 && !colorspace.full_range;
+      }
+
+      return input_format == AV_PIX_FMT_BGR0 && (sw_frame->format == AV_PIX_FMT_YUV444P || (convert::accelerated && yuv420));
+    }
+
+    /**
+     * @brief Convert with video::convert, in horizontal slices spread over slice_pool.
+     * @param target The frame, or the view of it, that is converted into.
+     */
+    void fast_convert(AVFrame &target) {
+      auto width = sws_input_frame->width;
+      auto height = sws_input_frame->height;
+
+      // Slices start on even rows, so each one has its own chroma rows
+      auto slices = slice_pool ? std::clamp(height / 2, 1, config::video.min_threads) : 1;
+      auto slice_height = ((height + slices - 1) / slices + 1) & ~1;
+
+      auto yuyv = sws_input_frame->format == AV_PIX_FMT_YUYV422;
+      auto yuv444 = sw_frame->format == AV_PIX_FMT_YUV444P;
+      auto convert_slice = [&](int y) {
+        std::uint8_t *planes[3];
+        for (int plane = 0; plane < 3; ++plane) {
+          planes[plane] = target.data[plane] ? target.data[plane] + (plane == 0 || yuv444 ? y : y / 2) * target.linesize[plane] : nullptr;
+        }
+
+        auto src = sws_input_frame->data[0] + y * sws_input_frame->linesize[0];
+        auto rows = std::min(slice_height, height - y);
+        if (yuyv) {
+          if (sw_frame->format == AV_PIX_FMT_NV12) {
+            convert::yuyv_to_nv12(src, sws_input_frame->linesize[0], planes, target.linesize, width, rows);
+          } else {
+            convert::yuyv_to_i420(src, sws_input_frame->linesize[0], planes, target.linesize, width, rows);
+          }
+        } else if (yuv444) {
+          convert::bgr0_to_yuv444p(src, sws_input_frame->linesize[0], planes, target.linesize, width, rows, coefficients);
+        } else if (sw_frame->format == AV_PIX_FMT_NV12) {
+          convert::bgr0_to_nv12(src, sws_input_frame->linesize[0], planes, target.linesize, width, rows, coefficients);
+        } else {
+          convert::bgr0_to_i420(src, sws_input_frame->linesize[0], planes, target.linesize, width, rows, coefficients);
+        }
+      };
+
+      std::vector<std::future<void>> futures;
+      for (auto y = slice_height; y < height; y += slice_height) {
+        futures.emplace_back(slice_pool->push(convert_slice, y));
+      }
+
+      convert_slice(0);
+      for (auto &future : futures) {
+        future.get();
+      }
+    }
+
+    /**
+     * @brief Point padded_view at the area of sw_frame inside the aspect ratio padding.
+     * @return 0 on success.
+     */
+    int make_padded_view() {
+      if (av_frame_ref(padded_view.get(), sw_frame.get()) < 0) {
+        return -1;
+      }
+
+      auto fmt_desc = av_pix_fmt_desc_get((AVPixelFormat) sw_frame->format);
+      auto planes = av_pix_fmt_count_planes((AVPixelFormat) sw_frame->format);
+      for (int plane = 0; plane < planes; plane++) {
+        auto shift_h = plane == 0 ? 0 : fmt_desc->log2_chroma_h;
+        auto shift_w = plane == 0 ? 0 : fmt_desc->log2_chroma_w;
+        padded_view->data[plane] += ((offsetW >> shift_w) * fmt_desc->comp[plane].step) + (offsetH >> shift_h) * sw_frame->linesize[plane];
+      }
+
+      padded_view->width = sws_output_frame->width;
+      padded_view->height = sws_output_frame->height;
+
+      return 0;
     }
 
     /**
@@ -230,9 +397,14 @@ namespace video {
       sws_input_frame.reset(av_frame_alloc());
       sws_input_frame->width = in_width;
       sws_input_frame->height = in_height;
-      sws_input_frame->format = AV_PIX_FMT_BGR0;
 
       sws_output_frame.reset(av_frame_alloc());
+      padded_view.reset(av_frame_alloc());
+
+      // libswscale splits the image over min_threads itself, fast_convert() needs threads of its own
+      if ((convert::accelerated || format == AV_PIX_FMT_YUV444P) && config::video.min_threads > 1) {
+        slice_pool = std::make_unique<thread_pool_util::ThreadPool>(config::video.min_threads - 1);
+      }
       sws_output_frame->width = out_width;
       sws_output_frame->height = out_height;
       sws_output_frame->format = format;
@@ -241,6 +413,17 @@ namespace video {
       offsetW = (frame->width - out_width) / 2;
       offsetH = (frame->height - out_height) / 2;
 
+      return init_sws(AV_PIX_FMT_BGR0);
+    }
+
+    /**
+     * @brief (Re)create the scaler for a given input pixel format.
+     * @param input_format The pixel format of the captured images.
+     * @return 0 on success.
+     */
+    int init_sws(AVPixelFormat input_format) {
+      sws_input_frame->format = input_format;
+
       sws.reset(sws_alloc_context());
       if (!sws) {
         return -1;
@@ -253,7 +436,8 @@ namespace video {
       av_dict_set_int(&options, "dstw", sws_output_frame->width, 0);
       av_dict_set_int(&options, "dsth", sws_output_frame->height, 0);
       av_dict_set_int(&options, "dst_format", sws_output_frame->format, 0);
-      av_dict_set_int(&options, "sws_flags", SWS_LANCZOS | SWS_ACCURATE_RND, 0);
+      // Where the vectorized converter exists, the CPU is too slow to afford Lanczos when scaling
+      av_dict_set_int(&options, "sws_flags", convert::accelerated ? SWS_FAST_BILINEAR : SWS_LANCZOS | SWS_ACCURATE_RND, 0);
       av_dict_set_int(&options, "threads", config::video.min_threads, 0);
 
       auto status = av_opt_set_dict(sws.get(), &options);
@@ -280,6 +464,11 @@ namespace video {
     avcodec_frame_t sw_frame;
     avcodec_frame_t sws_input_frame;
     avcodec_frame_t sws_output_frame;
+    avcodec_frame_t padded_view;
+    convert::coefficients_t coefficients;
+
+    // Runs the slices of fast_convert() besides the first one
+    std::unique_ptr<thread_pool_util::ThreadPool> slice_pool;
     sws_t sws;
 
     // Offset of input image to output frame in pixels
@@ -300,6 +489,9 @@ namespace video {
     ALWAYS_REPROBE = 1 << 9,  ///< This is an encoder of last resort and we want to aggressively probe for a better one
     YUV444_SUPPORT = 1 << 10,  ///< Encoder may support 4:4:4 chroma sampling depending on hardware
     ASYNC_TEARDOWN = 1 << 11,  ///< Encoder supports async teardown on a different thread
+    SYSTEM_MEMORY_INPUT = 1 << 12,  ///< Encoder also accepts frames in system memory when the capture backend can't provide hardware frames
+    INTRA_REFRESH = 1 << 13,  ///< Encoder can recover from loss with intra-refresh instead of an IDR frame
+    DYNAMIC_BITRATE = 1 << 14,  ///< Encoder can change its bitrate while streaming
   };
 
   class avcodec_encode_session_t: public encode_session_t {
@@ -335,6 +527,13 @@ namespace video {
       vps = std::move(other.vps);
 
       inject = other.inject;
+      intra_refresh = other.intra_refresh;
+      dynamic_bitrate = other.dynamic_bitrate;
+      rfi_needs_confirmation = other.rfi_needs_confirmation;
+      last_idr_frame = other.last_idr_frame;
+      recyclable = other.recyclable;
+      pts_offset = other.pts_offset;
+      last_pts = other.last_pts;
 
       return *this;
     }
@@ -362,9 +561,48 @@ namespace video {
       }
     }
 
-    void invalidate_ref_frames(int64_t first_frame, int64_t last_frame) override {
-      BOOST_LOG(error) << "Encoder doesn't support reference frame invalidation";
+    bool set_bitrate(int bitrate_kbps) override {
+      if (!dynamic_bitrate || !avcodec_ctx) {
+        return false;
+      }
+
+      // The FFmpeg wrappers pick the new rate control settings up with the next frame
+      auto &ctx = avcodec_ctx;
+      std::int64_t bitrate = (std::int64_t) bitrate_kbps * 1000;
+      bool vbr = ctx->bit_rate != ctx->rc_max_rate;
+
+      // Scale the VBV with the bitrate, so it keeps holding the same number of frames
+      if (ctx->rc_buffer_size) {
+        ctx->rc_buffer_size = (int) (ctx->rc_buffer_size * bitrate / ctx->rc_max_rate);
+      }
+      ctx->rc_max_rate = bitrate;
+      ctx->bit_rate = vbr ? bitrate - 1 : bitrate;
+      if (ctx->rc_min_rate) {
+        ctx->rc_min_rate = bitrate;
+      }
+
+      return true;
+    }
+
+    bool invalidate_ref_frames(int64_t first_frame, int64_t last_frame) override {
+      if (intra_refresh) {
+        // The running intra-refresh heals the lost frames, so tell the client to carry on decoding
+        BOOST_LOG(debug) << "Recovering frames "sv << first_frame << '-' << last_frame << " with intra-refresh"sv;
+        rfi_needs_confirmation = true;
+        return false;
+      }
+
+      // The client asks for invalidation of every frame it received before the IDR frame arrived,
+      // those frames are already superseded and don't need another IDR frame
+      if (last_idr_frame > last_frame) {
+        BOOST_LOG(debug) << "Frames "sv << first_frame << '-' << last_frame << " already recovered by IDR frame "sv << last_idr_frame;
+        metrics::add(metrics::counter_e::idr_frames_avoided);
+        return false;
+      }
+
+      BOOST_LOG(debug) << "Encoder doesn't support reference frame invalidation, generating IDR"sv;
       request_idr_frame();
+      return true;
     }
 
     avcodec_ctx_t avcodec_ctx;
@@ -377,6 +615,28 @@ namespace video {
 
     // inject sps/vps data into idr pictures
     int inject;
+
+    // The encoder runs a rolling intra-refresh, so lost frames don't need an IDR frame
+    bool intra_refresh = false;
+
+    // The codec rereads the rate control settings of the context before each frame
+    bool dynamic_bitrate = false;
+
+    // Mark the next packet as the recovery point of an invalidation request
+    bool rfi_needs_confirmation = false;
+
+    // Frame number of the last IDR frame that came out of the encoder
+    int64_t last_idr_frame = -1;
+
+    // The encoder holds no frames back, so the session can be handed to the next stream with the same parameters
+    bool recyclable = false;
+
+    // A recycled session keeps the timeline of the encoder, map the frame numbers of the stream onto it
+    int64_t pts_offset = 0;
+    int64_t last_pts = 0;
+
+    // Time from handing a frame to the encoder until its packet comes out
+    logging::time_delta_periodic_logger encode_latency_logger = {debug, "Encoder latency"};
   };
 
   class nvenc_encode_session_t: public encode_session_t {
@@ -389,6 +649,12 @@ namespace video {
       if (!device) {
         return -1;
       }
+
+      // The encoder may still be reading the previous frame from the input surface
+      if (device->nvenc && !device->nvenc->wait_for_input()) {
+        return -1;
+      }
+
       return device->convert(img);
     }
 
@@ -400,26 +666,39 @@ namespace video {
       force_idr = false;
     }
 
-    void invalidate_ref_frames(int64_t first_frame, int64_t last_frame) override {
+    bool invalidate_ref_frames(int64_t first_frame, int64_t last_frame) override {
       if (!device || !device->nvenc) {
-        return;
+        return false;
       }
 
       if (!device->nvenc->invalidate_ref_frames(first_frame, last_frame)) {
         force_idr = true;
       }
+
+      return force_idr;
     }
 
-    nvenc::nvenc_encoded_frame encode_frame(uint64_t frame_index) {
+    bool set_bitrate(int bitrate_kbps) override {
       if (!device || !device->nvenc) {
-        return {};
+        return false;
+      }
+
+      return device->nvenc->set_bitrate(bitrate_kbps);
+    }
+
+    bool submit_frame(uint64_t frame_index, nvenc::nvenc_base::encoded_frame_cb_t on_encoded) {
+      if (!device || !device->nvenc) {
+        return false;
       }
 
-      auto result = device->nvenc->encode_frame(frame_index, force_idr);
+      auto result = device->nvenc->submit_frame(frame_index, force_idr, std::move(on_encoded));
       force_idr = false;
       return result;
     }
 
+    // Buffers of the encoded frames, shared with the packets that are still on their way out
+    std::shared_ptr<frame_buffer_pool_t> frame_buffers = std::make_shared<frame_buffer_pool_t>();
+
   private:
     std::unique_ptr<platf::nvenc_encode_device_t> device;
     bool force_idr = false;
@@ -428,7 +707,7 @@ namespace video {
   struct sync_session_ctx_t {
     safe::signal_t *join_event;
     safe::mail_raw_t::event_t<bool> shutdown_event;
-    safe::mail_raw_t::queue_t<packet_t> packets;
+    safe::mail_raw_t::ring_t<packet_t> packets;
     safe::mail_raw_t::event_t<bool> idr_events;
     safe::mail_raw_t::event_t<hdr_info_t> hdr_events;
     safe::mail_raw_t::event_t<input::touch_port_t> touch_port_events;
@@ -449,6 +728,12 @@ namespace video {
   struct capture_ctx_t {
     img_event_t images;
     config_t config;
+
+    // Lets the capture thread ask the encoder for an IDR frame
+    safe::mail_raw_t::event_t<bool> idr_events;
+
+    // Lets the session shift the capture, so its frames reach the client at a steady phase
+    safe::mail_raw_t::event_t<std::chrono::nanoseconds> phase_events;
   };
 
   struct capture_thread_async_ctx_t {
@@ -510,7 +795,7 @@ namespace video {
       {},  // Fallback options
       "h264_nvenc"s,
     },
-    PARALLEL_ENCODING | REF_FRAMES_INVALIDATION | YUV444_SUPPORT | ASYNC_TEARDOWN  // flags
+    PARALLEL_ENCODING | REF_FRAMES_INVALIDATION | YUV444_SUPPORT | ASYNC_TEARDOWN | INTRA_REFRESH | DYNAMIC_BITRATE  // flags
   };
 #elif !defined(__APPLE__)
   encoder_t nvenc {
@@ -607,7 +892,7 @@ namespace video {
       {},  // Fallback options
       "h264_nvenc"s,
     },
-    PARALLEL_ENCODING
+    PARALLEL_ENCODING | DYNAMIC_BITRATE
   };
 #endif
 
@@ -632,6 +917,10 @@ namespace video {
         {"async_depth"s, 1},
         {"low_delay_brc"s, 1},
         {"low_power"s, 1},
+        // Keep the driver from placing I and B frames of its own at scene changes, every frame stays a P frame until an IDR is requested
+        {"b_strategy"s, 0},
+        {"adaptive_i"s, 0},
+        {"adaptive_b"s, 0},
       },
       {
         // SDR-specific options
@@ -662,6 +951,9 @@ namespace video {
         {"low_power"s, 1},
         {"recovery_point_sei"s, 0},
         {"pic_timing_sei"s, 0},
+        {"b_strategy"s, 0},
+        {"adaptive_i"s, 0},
+        {"adaptive_b"s, 0},
       },
       {
         // SDR-specific options
@@ -700,6 +992,9 @@ namespace video {
         {"vcm"s, 1},
         {"pic_timing_sei"s, 0},
         {"max_dec_frame_buffering"s, 1},
+        {"b_strategy"s, 0},
+        {"adaptive_i"s, 0},
+        {"adaptive_b"s, 0},
       },
       {
         // SDR-specific options
@@ -746,7 +1041,9 @@ namespace video {
         {"preencode"s, &config::video.amd.amd_preanalysis},
         {"quality"s, &config::video.amd.amd_quality_av1},
         {"rc"s, &config::video.amd.amd_rc_av1},
-        {"usage"s, &config::video.amd.amd_usage_av1},
+        {"usage"s, [](const config_t &cfg) {
+           return amd::usage(cfg, config::video.amd.amd_usage_av1);
+         }},
         {"enforce_hrd"s, &config::video.amd.amd_enforce_hrd},
       },
       {},  // SDR-specific options
@@ -772,7 +1069,9 @@ namespace video {
         {"preencode"s, &config::video.amd.amd_preanalysis},
         {"quality"s, &config::video.amd.amd_quality_hevc},
         {"rc"s, &config::video.amd.amd_rc_hevc},
-        {"usage"s, &config::video.amd.amd_usage_hevc},
+        {"usage"s, [](const config_t &cfg) {
+           return amd::usage(cfg, config::video.amd.amd_usage_hevc);
+         }},
         {"vbaq"s, &config::video.amd.amd_vbaq},
         {"enforce_hrd"s, &config::video.amd.amd_enforce_hrd},
         {"level"s, [](const config_t &cfg) {
@@ -809,7 +1108,9 @@ namespace video {
         {"preencode"s, &config::video.amd.amd_preanalysis},
         {"quality"s, &config::video.amd.amd_quality_h264},
         {"rc"s, &config::video.amd.amd_rc_h264},
-        {"usage"s, &config::video.amd.amd_usage_h264},
+        {"usage"s, [](const config_t &cfg) {
+           return amd::usage(cfg, config::video.amd.amd_usage_h264);
+         }},
         {"vbaq"s, &config::video.amd.amd_vbaq},
         {"enforce_hrd"s, &config::video.amd.amd_enforce_hrd},
       },
@@ -841,27 +1142,27 @@ namespace video {
     ),
     {
       // libsvtav1 takes different presets than libx264/libx265.
-      // We set an infinite GOP length, use a low delay prediction structure,
-      // force I frames to be key frames, and set max bitrate to default to work
-      // around a FFmpeg bug with CBR mode.
+      // The realtime profile sets an infinite GOP length, a low delay prediction
+      // structure without lookahead, forces I frames to be key frames, and sets
+      // max bitrate to default to work around a FFmpeg bug with CBR mode.
       {
-        {"svtav1-params"s, "keyint=-1:pred-struct=1:force-key-frames=1:mbr=0"s},
+        {"svtav1-params"s, [](const config_t &cfg) {
+           return svtav1_realtime_params(cfg.width, cfg.height, config::video.min_threads);
+         }},
         {"preset"s, &config::video.sw.svtav1_preset},
       },
       {},  // SDR-specific options
       {},  // HDR-specific options
       {},  // YUV444 SDR-specific options
       {},  // YUV444 HDR-specific options
-      {},  // Fallback options
+      {
+        // Fallback options, for SVT-AV1 versions that don't know the realtime parameters
+        {"svtav1-params"s, "keyint=-1:pred-struct=1:force-key-frames=1:mbr=0"s},
+      },
 
-#ifdef ENABLE_BROKEN_AV1_ENCODER
-           // Due to bugs preventing on-demand IDR frames from working and very poor
-           // real-time encoding performance, we do not enable libsvtav1 by default.
-           // It is only suitable for testing AV1 until the IDR frame issue is fixed.
+      // The software encoder is H264_ONLY, so AV1 is only probed, and picked when no
+      // hardware encoder passes, if av1_mode asks for AV1 to be advertised.
       "libsvtav1"s,
-#else
-      {},
-#endif
     },
     {
       // x265's Info SEI is so long that it causes the IDR picture data to be
@@ -894,7 +1195,7 @@ namespace video {
       {},  // Fallback options
       "libx264"s,
     },
-    H264_ONLY | PARALLEL_ENCODING | ALWAYS_REPROBE | YUV444_SUPPORT
+    H264_ONLY | PARALLEL_ENCODING | ALWAYS_REPROBE | YUV444_SUPPORT | INTRA_REFRESH | DYNAMIC_BITRATE
   };
 
 #ifdef __linux__
@@ -956,6 +1257,59 @@ namespace video {
   };
 #endif
 
+#ifdef __linux__
+  encoder_t v4l2m2m {
+    "v4l2m2m"sv,
+    std::make_unique<encoder_platform_formats_avcodec>(
+      AV_HWDEVICE_TYPE_DRM,
+      AV_HWDEVICE_TYPE_NONE,
+      AV_PIX_FMT_DRM_PRIME,
+      AV_PIX_FMT_NV12,
+      AV_PIX_FMT_NONE,
+      AV_PIX_FMT_NONE,
+      AV_PIX_FMT_NONE,
+      drm_init_avcodec_hardware_input_buffer
+    ),
+    {
+      // There are no V4L2 M2M AV1 encoders
+      {},  // Common options
+      {},  // SDR-specific options
+      {},  // HDR-specific options
+      {},  // YUV444 SDR-specific options
+      {},  // YUV444 HDR-specific options
+      {},  // Fallback options
+      {},
+    },
+    {
+      // Common options
+      {
+        {"num_output_buffers"s, 4},
+        {"num_capture_buffers"s, 4},
+      },
+      {},  // SDR-specific options
+      {},  // HDR-specific options
+      {},  // YUV444 SDR-specific options
+      {},  // YUV444 HDR-specific options
+      {},  // Fallback options
+      "hevc_v4l2m2m"s,
+    },
+    {
+      // Common options
+      {
+        {"num_output_buffers"s, 4},
+        {"num_capture_buffers"s, 4},
+      },
+      {},  // SDR-specific options
+      {},  // HDR-specific options
+      {},  // YUV444 SDR-specific options
+      {},  // YUV444 HDR-specific options
+      {},  // Fallback options
+      "h264_v4l2m2m"s,
+    },
+    LIMITED_GOP_SIZE | PARALLEL_ENCODING | SINGLE_SLICE_ONLY | SYSTEM_MEMORY_INPUT
+  };
+#endif
+
 #ifdef __APPLE__
   encoder_t videotoolbox {
     "videotoolbox"sv,
@@ -1034,6 +1388,7 @@ namespace video {
 #endif
 #ifdef __linux__
     &vaapi,
+    &v4l2m2m,
 #endif
 #ifdef __APPLE__
     &videotoolbox,
@@ -1042,96 +1397,742 @@ namespace video {
   };
 
   static encoder_t *chosen_encoder;
+
+  // Admits the sessions encoding on their own to the chosen encoder, and orders their frames on it
+  static scheduler::scheduler_t encode_scheduler;
+
   int active_hevc_mode;
   int active_av1_mode;
   bool last_encoder_probe_supported_ref_frames_invalidation = false;
   std::array<bool, 3> last_encoder_probe_supported_yuv444_for_codec = {};
 
-  void reset_display(std::shared_ptr<platf::display_t> &disp, const platf::mem_type_e &type, const std::string &display_name, const config_t &config) {
-    // We try this twice, in case we still get an error on reinitialization
-    for (int x = 0; x < 2; ++x) {
-      disp.reset();
-      disp = platf::display(type, display_name, config);
-      if (disp) {
-        break;
-      }
+  // Set while chosen_encoder was picked from cached probe results that no session has opened yet
+  static std::atomic_bool chosen_encoder_cached;
 
-      // The capture code depends on us to sleep between failures
-      std::this_thread::sleep_for(200ms);
-    }
-  }
+  // Set when cached probe results turned out to be wrong, so the next probe can't be skipped
+  static std::atomic_bool encoder_cache_stale;
+
+  // Serializes probes, with lazy probing the first one can come from any of the HTTP servers
+  static std::mutex probe_mutex;
 
   /**
-   * @brief Update the list of display names before or during a stream.
-   * @details This will attempt to keep `current_display_index` pointing at the same display.
-   * @param dev_type The encoder device type used for display lookup.
-   * @param display_names The list of display names to repopulate.
-   * @param current_display_index The current display index or -1 if not yet known.
+   * @brief Check if the probe measures the AMF usages of an encoder, for amd_usage = auto.
    */
-  void refresh_displays(platf::mem_type_e dev_type, std::vector<std::string> &display_names, int &current_display_index) {
-    // It is possible that the output name may be empty even if it wasn't before (device disconnected) or vice-versa
-    const auto output_name {display_device::map_output_name(config::video.output_name)};
-    std::string current_display_name;
+  bool measures_amd_usages(const encoder_t &encoder) {
+    return encoder.name == "amdvce"sv && config::video.amd.amd_usage_auto;
+  }
 
-    // If we have a current display index, let's start with that
-    if (current_display_index >= 0 && current_display_index < display_names.size()) {
-      current_display_name = display_names.at(current_display_index);
+  namespace encoder_cache {
+    std::string path() {
+      return (platf::appdata() / "encoder_cache.json").string();
     }
 
-    // Refresh the display names
-    auto old_display_names = std::move(display_names);
-    display_names = platf::display_names(dev_type);
+    /**
+     * @brief Find the encoder that a setting belongs to.
+     * @return The name of the encoder, or an empty string if the setting isn't specific to one encoder.
+     */
+    std::string_view setting_owner(const std::string_view &setting) {
+      for (auto &[encoder, prefix] : config::encoder_option_prefixes) {
+        if (setting.starts_with(prefix)) {
+          return encoder;
+        }
+      }
 
-    // If we now have no displays, let's put the old display array back and fail
-    if (display_names.empty() && !old_display_names.empty()) {
-      BOOST_LOG(error) << "No displays were found after reenumeration!"sv;
-      display_names = std::move(old_display_names);
-      return;
-    } else if (display_names.empty()) {
-      display_names.emplace_back(output_name);
+      return {};
     }
 
-    // We now have a new display name list, so reset the index back to 0
-    current_display_index = 0;
-
-    // If we had a name previously, let's try to find it in the new list
-    if (!current_display_name.empty()) {
-      for (int x = 0; x < display_names.size(); ++x) {
-        if (display_names[x] == current_display_name) {
-          current_display_index = x;
-          return;
+    /**
+     * @brief Hash the configured settings accepted by the filter, independent of the order they were set in.
+     */
+    template<class F>
+    std::string settings_hash(F &&filter) {
+      std::map<std::string_view, std::string_view> settings;
+      for (auto &[name, value] : config::modified_config_settings) {
+        if (filter(name)) {
+          settings.emplace(name, value);
         }
       }
 
-      // The old display was removed, so we'll start back at the first display again
-      BOOST_LOG(warning) << "Previous active display ["sv << current_display_name << "] is no longer present"sv;
-    } else {
-      for (int x = 0; x < display_names.size(); ++x) {
-        if (display_names[x] == output_name) {
-          current_display_index = x;
-          return;
-        }
+      std::string flat;
+      for (auto &[name, value] : settings) {
+        flat.append(name).append(1, '=').append(value).append(1, '\n');
       }
-    }
-  }
 
-  void captureThread(
-    std::shared_ptr<safe::queue_t<capture_ctx_t>> capture_ctx_queue,
-    sync_util::sync_t<std::weak_ptr<platf::display_t>> &display_wp,
-    safe::signal_t &reinit_event,
-    const encoder_t &encoder
-  ) {
-    std::vector<capture_ctx_t> capture_ctxs;
+      std::stringstream hash;
+      hash << std::hex << std::hash<std::string> {}(flat);
+      return hash.str();
+    }
 
-    auto fg = util::fail_guard([&]() {
-      capture_ctx_queue->stop();
+    /**
+     * @brief Hash the settings only the encoder uses, a change to them only invalidates its own probe results.
+     */
+    std::string encoder_settings_hash(const encoder_t &encoder) {
+      return settings_hash([&encoder](const std::string &name) {
+        return setting_owner(name) == encoder.name;
+      });
+    }
 
-      // Stop all sessions listening to this thread
-      for (auto &capture_ctx : capture_ctxs) {
-        capture_ctx.images->stop();
-      }
-      for (auto &capture_ctx : capture_ctx_queue->unsafe()) {
-        capture_ctx.images->stop();
+    /**
+     * @brief Build the key cached probe results are valid for.
+     * @return The key, or an empty string if probe results can't be cached on this system.
+     */
+    std::string key() {
+      auto environment = platf::encoder_environment_id();
+      if (environment.empty()) {
+        return {};
+      }
+
+      // Encoder options come from all over the config, so any change to the settings that aren't specific
+      // to one encoder invalidates the cache. The settings that can change while streaming are never used by the probe.
+      auto config_hash = settings_hash([](const std::string &name) {
+        return !config::is_live_setting(name) && setting_owner(name).empty();
+      });
+
+      std::stringstream key;
+      key << PROJECT_VERSION << ' ' << PROJECT_VERSION_COMMIT << '|'
+          << LIBAVCODEC_IDENT << '|'
+          << environment << '|'
+          << config::video.encoder << ' ' << config::video.capture << ' '
+          << config::video.adapter_name << ' ' << config::video.output_name << ' '
+          << config::video.hevc_mode << ' ' << config::video.av1_mode << '|'
+          << config_hash;
+      return key.str();
+    }
+
+    /**
+     * @brief validate_encoder() results of a previous run, stored in the appdata directory.
+     */
+    class cache_t {
+    public:
+      cache_t():
+          _key {key()} {
+        if (_key.empty()) {
+          return;
+        }
+
+        try {
+          auto tree = nlohmann::json::parse(file_handler::read_file(path().c_str()));
+          if (tree.at("key").get<std::string>() == _key) {
+            _encoders = tree.at("encoders");
+          }
+        } catch (const nlohmann::json::exception &) {
+          // Missing or corrupt, it's rewritten once the encoders are probed
+        }
+      }
+
+      /**
+       * @brief Apply the cached probe results for an encoder.
+       * @param encoder The encoder to update.
+       * @return The cached result of validate_encoder(), or std::nullopt if there is none.
+       */
+      std::optional<bool> load(encoder_t &encoder) {
+        auto it = _encoders.find(std::string {encoder.name});
+        if (it == _encoders.end()) {
+          return std::nullopt;
+        }
+
+        try {
+          if (it->at("settings").get<std::string>() != encoder_settings_hash(encoder)) {
+            return std::nullopt;
+          }
+
+          encoder.h264.capabilities = std::bitset<encoder_t::MAX_FLAGS> {it->at("h264").get<unsigned long>()};
+          encoder.hevc.capabilities = std::bitset<encoder_t::MAX_FLAGS> {it->at("hevc").get<unsigned long>()};
+          encoder.av1.capabilities = std::bitset<encoder_t::MAX_FLAGS> {it->at("av1").get<unsigned long>()};
+
+          if (measures_amd_usages(encoder)) {
+            if (!it->contains("amd_usage")) {
+              return std::nullopt;
+            }
+
+            for (std::size_t video_format = 0; video_format < amd::usage_latencies.size(); ++video_format) {
+              auto &latencies = amd::usage_latencies[video_format];
+              latencies.clear();
+              for (auto &usage : it->at("amd_usage").at(video_format)) {
+                latencies.push_back({usage.at("usage").get<std::string>(), usage.at("latency_ms").get<double>()});
+              }
+            }
+          }
+
+          _hits.emplace(encoder.name);
+          return it->at("passed").get<bool>();
+        } catch (const nlohmann::json::exception &) {
+          return std::nullopt;
+        }
+      }
+
+      void store(const encoder_t &encoder, bool passed) {
+        if (_key.empty()) {
+          return;
+        }
+
+        _encoders[std::string {encoder.name}] = {
+          {"passed", passed},
+          {"settings", encoder_settings_hash(encoder)},
+          {"h264", encoder.h264.capabilities.to_ulong()},
+          {"hevc", encoder.hevc.capabilities.to_ulong()},
+          {"av1", encoder.av1.capabilities.to_ulong()},
+        };
+
+        if (measures_amd_usages(encoder)) {
+          auto usages = nlohmann::json::array();
+          for (auto &latencies : amd::usage_latencies) {
+            auto &by_format = usages.emplace_back(nlohmann::json::array());
+            for (auto &latency : latencies) {
+              by_format.push_back({{"usage", latency.usage}, {"latency_ms", latency.latency_ms}});
+            }
+          }
+          _encoders[std::string {encoder.name}]["amd_usage"] = usages;
+        }
+        _dirty = true;
+      }
+
+      bool hit(const encoder_t &encoder) const {
+        return _hits.contains(encoder.name);
+      }
+
+      void save() {
+        if (!_dirty) {
+          return;
+        }
+
+        nlohmann::json tree;
+        tree["key"] = _key;
+        tree["encoders"] = _encoders;
+        if (file_handler::write_file(path().c_str(), tree.dump(2))) {
+          BOOST_LOG(warning) << "Couldn't write encoder cache to "sv << path();
+        }
+        _dirty = false;
+      }
+
+    private:
+      std::string _key;
+      nlohmann::json _encoders = nlohmann::json::object();
+      std::set<std::string_view> _hits;
+      bool _dirty = false;
+    };
+  }  // namespace encoder_cache
+
+  /**
+   * @brief Forget the cached probe results once the encoder they picked fails to open.
+   */
+  void invalidate_encoder_cache() {
+    if (!chosen_encoder_cached.exchange(false)) {
+      return;
+    }
+
+    BOOST_LOG(warning) << "Encoder chosen from cached probe results failed, encoders will be probed again"sv;
+
+    std::error_code ec;
+    std::filesystem::remove(encoder_cache::path(), ec);
+    encoder_cache_stale = true;
+  }
+
+  std::unique_ptr<platf::encode_device_t> make_encode_device(platf::display_t &disp, const encoder_t &encoder, const config_t &config);
+  std::unique_ptr<encode_session_t> make_encode_session(platf::display_t *disp, const encoder_t &encoder, const config_t &config, int width, int height, std::unique_ptr<platf::encode_device_t> encode_device);
+
+  /**
+   * @brief A display opened by prepare_display() ahead of the capture thread.
+   */
+  struct prepared_display_t {
+    platf::mem_type_e dev_type;
+    config_t config;
+    const encoder_t *encoder;
+
+    // The name of the display and the display itself, once it's open
+    std::future<std::pair<std::string, std::shared_ptr<platf::display_t>>> display;
+
+    // The encode session opened on the display after it, nullptr if there's none
+    std::future<std::unique_ptr<encode_session_t>> session;
+  };
+
+  /**
+   * @brief The encode session of a prepared display the capture thread took, waiting for the encode thread.
+   */
+  struct prepared_session_t {
+    const encoder_t *encoder;
+    config_t config;
+    std::weak_ptr<platf::display_t> display;
+    std::future<std::unique_ptr<encode_session_t>> session;
+  };
+
+  std::mutex prepared_display_mutex;
+  std::optional<prepared_display_t> prepared_display;
+  std::optional<prepared_session_t> prepared_session;
+
+  /**
+   * @brief Take the display opened by prepare_display(), if it's the one the capture thread is about to open.
+   * @return The display, or nullptr if none was prepared for this display and configuration.
+   */
+  std::shared_ptr<platf::display_t> take_prepared_display(const platf::mem_type_e &type, const std::string &display_name, const config_t &config) {
+    std::optional<prepared_display_t> prepared;
+    {
+      std::lock_guard lg {prepared_display_mutex};
+      prepared.swap(prepared_display);
+    }
+
+    // Only the parameters the display is opened with need to match
+    if (!prepared || prepared->dev_type != type ||
+        prepared->config.width != config.width ||
+        prepared->config.height != config.height ||
+        prepared->config.framerate != config.framerate ||
+        prepared->config.framerateX100 != config.framerateX100 ||
+        prepared->config.dynamicRange != config.dynamicRange) {
+      return nullptr;
+    }
+
+    auto [name, disp] = prepared->display.get();
+    if (name != display_name || !disp) {
+      return nullptr;
+    }
+
+    // The encode thread takes the session once it starts on this display
+    std::optional<prepared_session_t> previous;
+    {
+      std::lock_guard lg {prepared_display_mutex};
+      previous.swap(prepared_session);
+      prepared_session = prepared_session_t {prepared->encoder, prepared->config, disp, std::move(prepared->session)};
+    }
+
+    BOOST_LOG(debug) << "Using the display opened during the RTSP handshake"sv;
+    return disp;
+  }
+
+  void reset_display(std::shared_ptr<platf::display_t> &disp, const platf::mem_type_e &type, const std::string &display_name, const config_t &config) {
+    disp.reset();
+    disp = take_prepared_display(type, display_name, config);
+    if (disp) {
+      return;
+    }
+
+    // We try this twice, in case we still get an error on reinitialization
+    for (int x = 0; x < 2; ++x) {
+      disp.reset();
+      disp = platf::display(type, display_name, config);
+      if (disp) {
+        break;
+      }
+
+      // The capture code depends on us to sleep between failures
+      std::this_thread::sleep_for(200ms);
+    }
+  }
+
+  /**
+   * @brief Update the list of display names before or during a stream.
+   * @details This will attempt to keep `current_display_index` pointing at the same display.
+   * @param dev_type The encoder device type used for display lookup.
+   * @param display_names The list of display names to repopulate.
+   * @param current_display_index The current display index or -1 if not yet known.
+   */
+  void refresh_displays(platf::mem_type_e dev_type, std::vector<std::string> &display_names, int &current_display_index) {
+    // It is possible that the output name may be empty even if it wasn't before (device disconnected) or vice-versa
+    const auto output_name {display_device::map_output_name(config::video.output_name)};
+    std::string current_display_name;
+
+    // If we have a current display index, let's start with that
+    if (current_display_index >= 0 && current_display_index < display_names.size()) {
+      current_display_name = display_names.at(current_display_index);
+    }
+
+    // Refresh the display names
+    auto old_display_names = std::move(display_names);
+    display_names = platf::display_names(dev_type);
+
+    // If we now have no displays, let's put the old display array back and fail
+    if (display_names.empty() && !old_display_names.empty()) {
+      BOOST_LOG(error) << "No displays were found after reenumeration!"sv;
+      display_names = std::move(old_display_names);
+      return;
+    } else if (display_names.empty()) {
+      display_names.emplace_back(output_name);
+    }
+
+    // We now have a new display name list, so reset the index back to 0
+    current_display_index = 0;
+
+    // If we had a name previously, let's try to find it in the new list
+    if (!current_display_name.empty()) {
+      for (int x = 0; x < display_names.size(); ++x) {
+        if (display_names[x] == current_display_name) {
+          current_display_index = x;
+          return;
+        }
+      }
+
+      // The old display was removed, so we'll start back at the first display again
+      BOOST_LOG(warning) << "Previous active display ["sv << current_display_name << "] is no longer present"sv;
+    } else {
+      for (int x = 0; x < display_names.size(); ++x) {
+        if (display_names[x] == output_name) {
+          current_display_index = x;
+          return;
+        }
+      }
+    }
+  }
+
+  /**
+   * @brief Switch a live source to another display without rebuilding the encoders built for it.
+   * @param disp The display being captured.
+   * @param requested The display index requested by `mail::switch_display`.
+   * @param dev_type The encoder device type used for display lookup.
+   * @param display_names The list of display names, refreshed before switching.
+   * @param display_p The current display index, it points at the requested display afterwards either way.
+   * @param config The video config of the stream.
+   * @return `true` if the display captures from the requested display now, `false` if it has to be reinitialized.
+   */
+  bool hot_switch_display(platf::display_t &disp, int requested, platf::mem_type_e dev_type, std::vector<std::string> &display_names, int &display_p, const config_t &config) {
+    refresh_displays(dev_type, display_names, display_p);
+
+    auto next_p = std::clamp(requested, 0, (int) display_names.size() - 1);
+    if (next_p == display_p) {
+      return false;
+    }
+
+    auto switched = disp.hot_switch(display_names[next_p], config);
+    display_p = next_p;
+
+    return switched;
+  }
+
+  std::string svtav1_realtime_params(int width, int height, int threads) {
+    // Tiles are given as log2 of their count, each of them should stay at least 256 pixels across
+    // and there's no gain in more tiles than threads
+    auto log2_floor = [](int x) {
+      int log2 = 0;
+      while (x > 1) {
+        x >>= 1;
+        ++log2;
+      }
+      return log2;
+    };
+
+    auto tile_threads = log2_floor(std::max(1, threads));
+    auto tile_columns = std::min({tile_threads, log2_floor(std::max(1, width / 256)), 6});
+    auto tile_rows = std::min({tile_threads - tile_columns, log2_floor(std::max(1, height / 256)), 6});
+
+    return "keyint=-1:pred-struct=1:force-key-frames=1:mbr=0:lookahead=0:scd=0:enable-tf=0:tile-columns="s +
+           std::to_string(tile_columns) + ":tile-rows="s + std::to_string(tile_rows);
+  }
+
+  std::string pick_amd_usage(const std::vector<amd_usage_latency_t> &latencies, int width, int height, int framerate) {
+    if (latencies.empty()) {
+      return "ultralowlatency"s;
+    }
+
+    auto scale = (double) width * height / (1920 * 1080);
+    auto budget = 1000.0 / std::max(1, framerate) / 2;
+    for (auto &latency : latencies) {
+      if (latency.latency_ms * scale <= budget) {
+        return latency.usage;
+      }
+    }
+
+    return std::min_element(std::begin(latencies), std::end(latencies), [](auto &a, auto &b) {
+             return a.latency_ms < b.latency_ms;
+           })
+      ->usage;
+  }
+
+  int reprobe_encoders() {
+    // Encoders whose settings didn't change reuse their cached results
+    encoder_cache_stale = true;
+    return probe_encoders();
+  }
+
+  void prepare_display(const config_t &config) {
+    if (!chosen_encoder) {
+      return;
+    }
+
+    auto encoder = chosen_encoder;
+    auto dev_type = encoder->platform_formats->dev_type;
+
+    // The capture thread gets the display as soon as it's open, even while the session is still opening
+    std::promise<std::pair<std::string, std::shared_ptr<platf::display_t>>> display_promise;
+    auto display = display_promise.get_future();
+    auto session = std::async(std::launch::async, [encoder, dev_type, config, display_promise = std::move(display_promise)]() mutable -> std::unique_ptr<encode_session_t> {
+      auto start = std::chrono::steady_clock::now();
+
+      std::vector<std::string> display_names;
+      int display_p = -1;
+      refresh_displays(dev_type, display_names, display_p);
+
+      // A display that encodes the stream itself is opened by capture(), it can't be shared with a display for our encoder
+      if (platf::has_encoded_display(display_names[display_p], config)) {
+        display_promise.set_value({display_names[display_p], nullptr});
+        return nullptr;
+      }
+
+      auto disp = platf::display(dev_type, display_names[display_p], config);
+      BOOST_LOG(debug) << "Display opened ahead of capture in "sv << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() << "ms"sv;
+      display_promise.set_value({display_names[display_p], disp});
+
+      // Encoders that share the capture thread open their session there, once per display
+      if (!disp || !(encoder->flags & PARALLEL_ENCODING)) {
+        return nullptr;
+      }
+
+      start = std::chrono::steady_clock::now();
+      auto encode_device = make_encode_device(*disp, *encoder, config);
+      if (!encode_device) {
+        return nullptr;
+      }
+
+      auto session = make_encode_session(disp.get(), *encoder, config, disp->width, disp->height, std::move(encode_device));
+      if (session) {
+        BOOST_LOG(debug) << "Encoder opened ahead of capture in "sv << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() << "ms"sv;
+      }
+
+      return session;
+    });
+
+    // A display or session that was never taken is closed outside the lock, it may still be opening
+    std::optional<prepared_display_t> previous;
+    std::optional<prepared_session_t> previous_session;
+    {
+      std::lock_guard lg {prepared_display_mutex};
+      previous.swap(prepared_display);
+      previous_session.swap(prepared_session);
+      prepared_display = prepared_display_t {dev_type, config, encoder, std::move(display), std::move(session)};
+    }
+  }
+
+  int frame_damage_t::damaged_tiles(const platf::img_t &img) {
+    auto cols = (img.width + TILE_SIZE - 1) / TILE_SIZE;
+    auto rows = (img.height + TILE_SIZE - 1) / TILE_SIZE;
+
+    if (img.damage) {
+      // Hashes of older images don't tell what changed in between
+      reset();
+
+      std::vector<bool> tiles(cols * rows);
+      for (auto &rect : *img.damage) {
+        auto x_begin = std::clamp(rect.x, 0, img.width);
+        auto x_end = std::clamp(rect.x + rect.width, 0, img.width);
+        auto y_begin = std::clamp(rect.y, 0, img.height);
+        auto y_end = std::clamp(rect.y + rect.height, 0, img.height);
+        if (x_begin >= x_end || y_begin >= y_end) {
+          continue;
+        }
+
+        for (int y = y_begin / TILE_SIZE; y * TILE_SIZE < y_end; ++y) {
+          for (int x = x_begin / TILE_SIZE; x * TILE_SIZE < x_end; ++x) {
+            tiles[y * cols + x] = true;
+          }
+        }
+      }
+
+      return (int) std::count(std::begin(tiles), std::end(tiles), true);
+    }
+
+    // Multi-planar formats and images in GPU memory can't be hashed as a single BGR plane
+    if (!img.data || img.pix_fmt || img.pixel_pitch <= 0) {
+      reset();
+      return cols * rows;
+    }
+
+    if (img.width != width || img.height != height) {
+      reset();
+      width = img.width;
+      height = img.height;
+    }
+
+    bool first_frame = tile_hashes.empty();
+    std::vector<std::uint64_t> hashes(cols * rows, 0xcbf29ce484222325);
+
+    auto tile_bytes = (std::size_t) TILE_SIZE * img.pixel_pitch;
+    auto row_bytes = (std::size_t) img.width * img.pixel_pitch;
+    for (int y = 0; y < img.height; ++y) {
+      auto row = img.data + (std::size_t) y * img.row_pitch;
+      auto tile_hash = hashes.data() + (y / TILE_SIZE) * cols;
+
+      for (std::size_t offset = 0; offset < row_bytes; offset += tile_bytes, ++tile_hash) {
+        auto end = std::min(offset + tile_bytes, row_bytes);
+        auto hash = *tile_hash;
+
+        // Mixing 8 bytes at a time keeps up with the memory bandwidth
+        auto x = offset;
+        for (; x + 8 <= end; x += 8) {
+          std::uint64_t word;
+          std::memcpy(&word, row + x, 8);
+          hash = (hash ^ word) * 0x100000001b3;
+          hash ^= hash >> 29;
+        }
+        for (; x < end; ++x) {
+          hash = (hash ^ row[x]) * 0x100000001b3;
+        }
+
+        *tile_hash = hash;
+      }
+    }
+
+    int damaged = 0;
+    for (std::size_t x = 0; x < hashes.size(); ++x) {
+      if (first_frame || hashes[x] != tile_hashes[x]) {
+        ++damaged;
+      }
+    }
+    tile_hashes = std::move(hashes);
+
+    return damaged;
+  }
+
+  void frame_damage_t::reset() {
+    tile_hashes.clear();
+  }
+
+  img_pool_t::img_pool_t(std::size_t capacity, std::chrono::steady_clock::duration trim_timeout):
+      shared {std::make_shared<shared_t>(capacity)},
+      trim_timeout {trim_timeout} {
+    for (int x = (int) capacity - 1; x >= 0; --x) {
+      empty_slots.push_back(x);
+    }
+  }
+
+  std::shared_ptr<platf::img_t> img_pool_t::acquire(const alloc_img_f &alloc_img) {
+    if (free_slots.empty()) {
+      collect();
+    }
+
+    int index;
+    if (!free_slots.empty()) {
+      index = free_slots.front();
+      free_slots.pop_front();
+    } else if (!empty_slots.empty()) {
+      index = empty_slots.back();
+
+      auto &slot = shared->slots[index];
+      slot.img = alloc_img();
+      if (!slot.img) {
+        return nullptr;
+      }
+      empty_slots.pop_back();
+      ++allocations;
+    } else {
+      ++exhausted;
+      return nullptr;
+    }
+
+    auto &slot = shared->slots[index];
+    slot.generation = generation;
+
+    auto in_use = shared->in_use.fetch_add(1, std::memory_order_relaxed) + 1;
+    peak_in_use = std::max(peak_in_use, in_use);
+
+    // The deleter runs on whichever thread drops the last reference, and hands the image back to its slot
+    auto img = slot.img.get();
+    std::shared_ptr<platf::img_t> img_out {img, [shared = shared, index, owner = std::move(slot.img)](platf::img_t *) mutable {
+      auto &slot = shared->slots[index];
+      slot.img = std::move(owner);
+
+      int head = shared->returned.load(std::memory_order_relaxed);
+      do {
+        slot.next = head;
+      } while (!shared->returned.compare_exchange_weak(head, index, std::memory_order_release, std::memory_order_relaxed));
+
+      shared->in_use.fetch_sub(1, std::memory_order_relaxed);
+    }};
+
+    trim();
+    return img_out;
+  }
+
+  void img_pool_t::collect() {
+    // Taking the whole stack at once leaves no room for ABA problems
+    int index = shared->returned.exchange(-1, std::memory_order_acquire);
+    while (index >= 0) {
+      auto &slot = shared->slots[index];
+      auto next = slot.next;
+
+      if (slot.generation == generation) {
+        free_slots.push_front(index);
+      } else {
+        // Allocated before reset(), it may reference the old display
+        slot.img.reset();
+        empty_slots.push_back(index);
+      }
+
+      index = next;
+    }
+  }
+
+  void img_pool_t::reset() {
+    ++generation;
+
+    for (auto index : free_slots) {
+      shared->slots[index].img.reset();
+      empty_slots.push_back(index);
+    }
+    free_slots.clear();
+    in_use_timestamps.clear();
+
+    collect();
+  }
+
+  void img_pool_t::trim() {
+    auto in_use = shared->in_use.load(std::memory_order_relaxed);
+
+    // remember the timestamp of currently used count
+    const auto now = std::chrono::steady_clock::now();
+    if (in_use_timestamps.size() <= in_use) {
+      in_use_timestamps.resize(in_use + 1);
+    }
+    in_use_timestamps[in_use] = now;
+
+    // keep as many images as were used recently, based on last used timestamp and trim timeout
+    size_t trim_target = in_use;
+    for (size_t x = in_use; x < in_use_timestamps.size(); ++x) {
+      if (in_use_timestamps[x] && now - *in_use_timestamps[x] < trim_timeout) {
+        trim_target = x;
+      }
+    }
+
+    // trim the least recently used free images above the trim target
+    while (!free_slots.empty() && free_slots.size() + in_use > trim_target) {
+      auto index = free_slots.back();
+      free_slots.pop_back();
+
+      shared->slots[index].img.reset();
+      empty_slots.push_back(index);
+    }
+    in_use_timestamps.resize(trim_target + 1);
+  }
+
+  bool img_pool_t::full() const {
+    return shared->in_use.load(std::memory_order_relaxed) >= shared->slots.size();
+  }
+
+  img_pool_t::stats_t img_pool_t::stats() const {
+    auto in_use = shared->in_use.load(std::memory_order_relaxed);
+
+    return stats_t {
+      shared->slots.size() - empty_slots.size(),
+      in_use,
+      peak_in_use,
+      allocations,
+      exhausted,
+    };
+  }
+
+  void captureThread(
+    std::shared_ptr<safe::queue_t<capture_ctx_t>> capture_ctx_queue,
+    sync_util::sync_t<std::weak_ptr<platf::display_t>> &display_wp,
+    safe::signal_t &reinit_event,
+    const encoder_t &encoder
+  ) {
+    std::vector<capture_ctx_t> capture_ctxs;
+
+    auto fg = util::fail_guard([&]() {
+      capture_ctx_queue->stop();
+
+      // Stop all sessions listening to this thread
+      for (auto &capture_ctx : capture_ctxs) {
+        capture_ctx.images->stop();
+      }
+      for (auto &capture_ctx : capture_ctx_queue->unsafe()) {
+        capture_ctx.images->stop();
       }
     });
 
@@ -1149,100 +2150,78 @@ namespace video {
     std::vector<std::string> display_names;
     int display_p = -1;
     refresh_displays(encoder.platform_formats->dev_type, display_names, display_p);
-    auto disp = platf::display(encoder.platform_formats->dev_type, display_names[display_p], capture_ctxs.front().config);
+    auto disp = take_prepared_display(encoder.platform_formats->dev_type, display_names[display_p], capture_ctxs.front().config);
+    if (!disp) {
+      disp = platf::display(encoder.platform_formats->dev_type, display_names[display_p], capture_ctxs.front().config);
+    }
     if (!disp) {
       return;
     }
     display_wp = disp;
 
-    constexpr auto capture_buffer_size = 12;
-    std::list<std::shared_ptr<platf::img_t>> imgs(capture_buffer_size);
-
-    std::vector<std::optional<std::chrono::steady_clock::time_point>> imgs_used_timestamps;
-    const std::chrono::seconds trim_timeot = 3s;
-    auto trim_imgs = [&]() {
-      // count allocated and used within current pool
-      size_t allocated_count = 0;
-      size_t used_count = 0;
-      for (const auto &img : imgs) {
-        if (img) {
-          allocated_count += 1;
-          if (img.use_count() > 1) {
-            used_count += 1;
-          }
-        }
-      }
+    // Most backends capture 4 bytes per pixel
+    auto image_size = [&disp]() {
+      return (std::size_t) disp->width * disp->height * 4;
+    };
 
-      // remember the timestamp of currently used count
-      const auto now = std::chrono::steady_clock::now();
-      if (imgs_used_timestamps.size() <= used_count) {
-        imgs_used_timestamps.resize(used_count + 1);
-      }
-      imgs_used_timestamps[used_count] = now;
+    // One image being captured, one being encoded and one waiting for the encoder at the very least
+    auto capture_buffer_size = memory_budget::buffers(memory_budget::subsystem_e::capture_images, image_size(), 3, 12);
+    img_pool_t img_pool {capture_buffer_size};
 
-      // decide whether to trim allocated unused above the currently used count
-      // based on last used timestamp and universal timeout
-      size_t trim_target = used_count;
-      for (size_t i = used_count; i < imgs_used_timestamps.size(); i++) {
-        if (imgs_used_timestamps[i] && now - *imgs_used_timestamps[i] < trim_timeot) {
-          trim_target = i;
-        }
-      }
+    // Memory of the pool last accounted for, the footprint follows the allocated images
+    std::int64_t pool_footprint = 0;
+    auto pool_footprint_fg = util::fail_guard([&pool_footprint]() {
+      memory_budget::account(memory_budget::subsystem_e::capture_images, -pool_footprint);
+    });
 
-      // trim allocated unused above the newly decided trim target
-      if (allocated_count > trim_target) {
-        size_t to_trim = allocated_count - trim_target;
-        // prioritize trimming least recently used
-        for (auto it = imgs.rbegin(); it != imgs.rend(); it++) {
-          auto &img = *it;
-          if (img && img.use_count() == 1) {
-            img.reset();
-            to_trim -= 1;
-            if (to_trim == 0) {
-              break;
-            }
-          }
+    // Frames the encoders couldn't take are dropped by the backend before it grabs or converts them
+    auto watch_img_pool = [&img_pool](platf::display_t &disp) {
+      disp.set_frame_wanted_cb([&img_pool]() {
+        if (img_pool.full()) {
+          metrics::add(metrics::counter_e::frames_dropped_at_source);
+          return false;
         }
-        // forget timestamps that no longer relevant
-        imgs_used_timestamps.resize(trim_target + 1);
-      }
+
+        return true;
+      });
     };
+    watch_img_pool(*disp);
 
+    // Displays can be parked and captured from by another thread, which mustn't reach this pool
+    auto unwatch_img_pool = util::fail_guard([&disp]() {
+      if (disp) {
+        disp->set_frame_wanted_cb(nullptr);
+      }
+    });
+
+    auto pool_stats_logger = std::chrono::steady_clock::now();
     auto pull_free_image_callback = [&](std::shared_ptr<platf::img_t> &img_out) -> bool {
       img_out.reset();
       while (capture_ctx_queue->running()) {
-        // pick first allocated but unused
-        for (auto it = imgs.begin(); it != imgs.end(); it++) {
-          if (*it && it->use_count() == 1) {
-            img_out = *it;
-            if (it != imgs.begin()) {
-              // move image to the front of the list to prioritize its reusal
-              imgs.erase(it);
-              imgs.push_front(img_out);
-            }
-            break;
-          }
-        }
-        // otherwise pick first unallocated
-        if (!img_out) {
-          for (auto it = imgs.begin(); it != imgs.end(); it++) {
-            if (!*it) {
-              // allocate image
-              *it = disp->alloc_img();
-              img_out = *it;
-              if (it != imgs.begin()) {
-                // move image to the front of the list to prioritize its reusal
-                imgs.erase(it);
-                imgs.push_front(img_out);
-              }
-              break;
-            }
-          }
-        }
+        img_out = img_pool.acquire([&disp]() {
+          return disp->alloc_img();
+        });
+
         if (img_out) {
-          // trim allocated but unused portion of the pool based on timeouts
-          trim_imgs();
           img_out->frame_timestamp.reset();
+
+          auto stats = img_pool.stats();
+          metrics::set(metrics::gauge_e::image_pool_allocated, stats.allocated);
+          metrics::set(metrics::gauge_e::image_pool_in_use, stats.in_use);
+
+          auto footprint = (std::int64_t) (stats.allocated * image_size());
+          if (footprint != pool_footprint) {
+            memory_budget::account(memory_budget::subsystem_e::capture_images, footprint - pool_footprint);
+            pool_footprint = footprint;
+          }
+
+          auto now = std::chrono::steady_clock::now();
+          if (now - pool_stats_logger > 20s) {
+            pool_stats_logger = now;
+
+            BOOST_LOG(debug) << "Capture image pool: "sv << stats.allocated << " allocated, "sv << stats.in_use << " in use, peak "sv
+                             << stats.peak_in_use << ", "sv << stats.allocations << " allocations, exhausted "sv << stats.exhausted << " times"sv;
+          }
           return true;
         } else {
           // sleep and retry if image pool is full
@@ -1253,12 +2232,28 @@ namespace video {
     };
 
     // Capture takes place on this thread
+    platf::set_thread_name("capture"s);
     platf::adjust_thread_priority(platf::thread_priority_e::critical);
 
+    frame_damage_t frame_damage;
+
     while (capture_ctx_queue->running()) {
       bool artificial_reinit = false;
+      frame_damage.reset();
 
       auto push_captured_image_callback = [&](std::shared_ptr<platf::img_t> &&img, bool frame_captured) -> bool {
+        if (frame_captured) {
+          metrics::add(metrics::counter_e::frames_captured);
+        }
+        if (frame_captured && img->frame_timestamp) {
+          trace::span(trace::stage_e::capture, -1, *img->frame_timestamp, std::chrono::steady_clock::now());
+        }
+
+        // The encoders repeat the last frame at the minimum framerate, so a frame identical to it needs no encoding
+        if (frame_captured && config::video.skip_unchanged_frames && !frame_damage.damaged_tiles(*img)) {
+          frame_captured = false;
+        }
+
         KITTY_WHILE_LOOP(auto capture_ctx = std::begin(capture_ctxs), capture_ctx != std::end(capture_ctxs), {
           if (!capture_ctx->images->running()) {
             capture_ctx = capture_ctxs.erase(capture_ctx);
@@ -1279,6 +2274,16 @@ namespace video {
 
         while (capture_ctx_queue->peek()) {
           capture_ctxs.emplace_back(std::move(*capture_ctx_queue->pop()));
+
+          // The new session hasn't seen any frame yet
+          frame_damage.reset();
+        }
+
+        // Sessions sharing the capture have clients of their own, so only a single session moves it
+        for (auto &capture_ctx : capture_ctxs) {
+          if (auto shift = capture_ctx.phase_events->pop(0ms); shift && capture_ctxs.size() == 1) {
+            disp->shift_phase(*shift);
+          }
         }
 
         if (switch_display_event->peek()) {
@@ -1295,6 +2300,16 @@ namespace video {
         status = platf::capture_e::reinit;
 
         artificial_reinit = false;
+
+        // Cameras delivering the same frames as the current one are switched under the running encoders
+        if (disp->is_live_source() && switch_display_event->peek() &&
+            hot_switch_display(*disp, *switch_display_event->pop(), encoder.platform_formats->dev_type, display_names, display_p, capture_ctxs.front().config)) {
+          for (auto &capture_ctx : capture_ctxs) {
+            capture_ctx.idr_events->raise(true);
+          }
+
+          continue;
+        }
       }
 
       switch (status) {
@@ -1303,9 +2318,7 @@ namespace video {
             reinit_event.raise(true);
 
             // Some classes of images contain references to the display --> display won't delete unless img is deleted
-            for (auto &img : imgs) {
-              img.reset();
-            }
+            img_pool.reset();
 
             // display_wp is modified in this thread only
             // Wait for the other shared_ptr's of display to be destroyed.
@@ -1328,9 +2341,13 @@ namespace video {
                 ++capture_ctx;
               });
 
+              // Free the images the encoders returned in the meantime
+              img_pool.reset();
+
               std::this_thread::sleep_for(20ms);
             }
 
+            disp->set_frame_wanted_cb(nullptr);
             while (capture_ctx_queue->running()) {
               // Release the display before reenumerating displays, since some capture backends
               // only support a single display session per device/application.
@@ -1355,6 +2372,7 @@ namespace video {
             }
 
             display_wp = disp;
+            watch_img_pool(*disp);
 
             reinit_event.reset();
             continue;
@@ -1371,15 +2389,23 @@ namespace video {
     }
   }
 
-  int encode_avcodec(int64_t frame_nr, avcodec_encode_session_t &session, safe::mail_raw_t::queue_t<packet_t> &packets, void *channel_data, std::optional<std::chrono::steady_clock::time_point> frame_timestamp) {
+  int encode_avcodec(int64_t frame_nr, avcodec_encode_session_t &session, safe::mail_raw_t::ring_t<packet_t> &packets, void *channel_data, std::optional<std::chrono::steady_clock::time_point> frame_timestamp) {
     auto &frame = session.device->frame;
-    frame->pts = frame_nr;
+
+    // Frame numbers start over when a recycled session serves another stream, but pts must keep increasing
+    if (frame_nr + session.pts_offset <= session.last_pts) {
+      session.pts_offset = session.last_pts + 1 - frame_nr;
+    }
+    frame->pts = session.last_pts = frame_nr + session.pts_offset;
 
     auto &ctx = session.avcodec_ctx;
 
     auto &sps = session.sps;
     auto &vps = session.vps;
 
+    auto encode_start = std::chrono::steady_clock::now();
+    session.encode_latency_logger.first_point(encode_start);
+
     // send the frame to the encoder
     auto ret = avcodec_send_frame(ctx.get(), frame);
     if (ret < 0) {
@@ -1400,8 +2426,12 @@ namespace video {
         return ret;
       }
 
+      av_packet->pts -= session.pts_offset;
+      av_packet->dts -= session.pts_offset;
+
       if (av_packet->flags & AV_PKT_FLAG_KEY) {
         BOOST_LOG(debug) << "Frame "sv << frame_nr << ": IDR Keyframe (AV_FRAME_FLAG_KEY)"sv;
+        session.last_idr_frame = av_packet->pts;
       }
 
       if ((frame->flags & AV_FRAME_FLAG_KEY) && !(av_packet->flags & AV_PKT_FLAG_KEY)) {
@@ -1434,38 +2464,89 @@ namespace video {
       }
 
       if (av_packet && av_packet->pts == frame_nr) {
+        auto encode_end = std::chrono::steady_clock::now();
+
         packet->frame_timestamp = frame_timestamp;
+        if (frame_timestamp && session.convert_timestamp) {
+          packet->stage_timestamps = {*session.convert_timestamp, encode_start, encode_end};
+        }
+        session.encode_latency_logger.second_point_and_log(encode_end);
+        trace::span(trace::stage_e::encode, frame_nr, encode_start, encode_end);
+
+        metrics::add(metrics::counter_e::frames_encoded);
+        metrics::add(metrics::counter_e::encode_us, std::chrono::duration_cast<std::chrono::microseconds>(encode_end - encode_start).count());
+      }
+
+      if (session.rfi_needs_confirmation) {
+        packet->after_ref_frame_invalidation = true;
+        session.rfi_needs_confirmation = false;
       }
 
       packet->replacements = &session.replacements;
       packet->channel_data = channel_data;
-      packets->raise(std::move(packet));
+      if (!packets->raise(std::move(packet))) {
+        metrics::add(metrics::counter_e::video_packets_dropped);
+      }
     }
 
     return 0;
   }
 
-  int encode_nvenc(int64_t frame_nr, nvenc_encode_session_t &session, safe::mail_raw_t::queue_t<packet_t> &packets, void *channel_data, std::optional<std::chrono::steady_clock::time_point> frame_timestamp) {
-    auto encoded_frame = session.encode_frame(frame_nr);
-    if (encoded_frame.data.empty()) {
-      BOOST_LOG(error) << "NvENC returned empty packet";
-      return -1;
-    }
+  int encode_nvenc(int64_t frame_nr, nvenc_encode_session_t &session, safe::mail_raw_t::ring_t<packet_t> &packets, void *channel_data, std::optional<std::chrono::steady_clock::time_point> frame_timestamp) {
+    auto encode_start = std::chrono::steady_clock::now();
+    auto convert_timestamp = session.convert_timestamp;
+    auto frame_buffers = session.frame_buffers;
 
-    if (frame_nr != encoded_frame.frame_index) {
-      BOOST_LOG(error) << "NvENC frame index mismatch " << frame_nr << " " << encoded_frame.frame_index;
-    }
+    // The frame is packetized from the completion thread, while this thread carries on with the next one
+    auto submitted = session.submit_frame(frame_nr, [=](nvenc::nvenc_encoded_frame &&encoded_frame) {
+      // Only a whole frame is never empty, a part of it can be when the encoder made fewer slices than asked for
+      if (encoded_frame.data.empty() && encoded_frame.slice_groups == 1) {
+        BOOST_LOG(error) << "NvENC returned empty packet";
+        return;
+      }
+
+      if (frame_nr != encoded_frame.frame_index) {
+        BOOST_LOG(error) << "NvENC frame index mismatch " << frame_nr << " " << encoded_frame.frame_index;
+      }
+
+      // The only copy before packetization, into a buffer that already has the capacity
+      auto frame_data = frame_buffers->take();
+      frame_data.assign(std::begin(encoded_frame.data), std::end(encoded_frame.data));
+
+      auto packet = std::make_unique<packet_raw_generic>(std::move(frame_data), encoded_frame.frame_index, encoded_frame.idr);
+      packet->pool = frame_buffers;
+      packet->channel_data = channel_data;
+      packet->after_ref_frame_invalidation = encoded_frame.after_ref_frame_invalidation;
+      packet->slice_group = encoded_frame.slice_group;
+      packet->slice_groups = encoded_frame.slice_groups;
+      packet->frame_timestamp = frame_timestamp;
+
+      // The frame's encode ends with its last part
+      if (encoded_frame.slice_group + 1 == encoded_frame.slice_groups) {
+        auto encode_end = std::chrono::steady_clock::now();
+        trace::span(trace::stage_e::encode, frame_nr, encode_start, encode_end);
+
+        if (frame_timestamp && convert_timestamp) {
+          packet->stage_timestamps = {*convert_timestamp, encode_start, encode_end};
+        }
+
+        metrics::add(metrics::counter_e::frames_encoded);
+        metrics::add(metrics::counter_e::encode_us, std::chrono::duration_cast<std::chrono::microseconds>(encode_end - encode_start).count());
+      }
+      if (!packets->raise(std::move(packet))) {
+        metrics::add(metrics::counter_e::video_packets_dropped);
+      }
+    });
 
-    auto packet = std::make_unique<packet_raw_generic>(std::move(encoded_frame.data), encoded_frame.frame_index, encoded_frame.idr);
-    packet->channel_data = channel_data;
-    packet->after_ref_frame_invalidation = encoded_frame.after_ref_frame_invalidation;
-    packet->frame_timestamp = frame_timestamp;
-    packets->raise(std::move(packet));
+    if (!submitted) {
+      BOOST_LOG(error) << "NvENC couldn't submit frame " << frame_nr;
+      return -1;
+    }
 
     return 0;
   }
 
-  int encode(int64_t frame_nr, encode_session_t &session, safe::mail_raw_t::queue_t<packet_t> &packets, void *channel_data, std::optional<std::chrono::steady_clock::time_point> frame_timestamp) {
+  int encode(int64_t frame_nr, encode_session_t &session, safe::mail_raw_t::ring_t<packet_t> &packets, void *channel_data, std::optional<std::chrono::steady_clock::time_point> frame_timestamp) {
     if (auto avcodec_session = dynamic_cast<avcodec_encode_session_t *>(&session)) {
       return encode_avcodec(frame_nr, *avcodec_session, packets, channel_data, frame_timestamp);
     } else if (auto nvenc_session = dynamic_cast<nvenc_encode_session_t *>(&session)) {
@@ -1475,6 +2556,68 @@ namespace video {
     return -1;
   }
 
+  /**
+   * @brief Check if an encoder accepts a given input pixel format.
+   * @param codec The encoder.
+   * @param pix_fmt The pixel format.
+   * @return `true` if the pixel format is listed by the encoder.
+   */
+  bool codec_supports_pix_fmt(const AVCodec *codec, AVPixelFormat pix_fmt) {
+    if (!codec->pix_fmts) {
+      return false;
+    }
+
+    for (auto fmt = codec->pix_fmts; *fmt != AV_PIX_FMT_NONE; ++fmt) {
+      if (*fmt == pix_fmt) {
+        return true;
+      }
+    }
+
+    return false;
+  }
+
+  /**
+   * @brief Hardware frames contexts of the encode devices that share their hardware device context between sessions.
+   * The surfaces of a finished session go back to the pool, so the next session with the same
+   * resolution and format starts with them already allocated.
+   */
+  class hwframes_cache_t {
+  public:
+    static constexpr std::size_t max_entries = 4;
+
+    avcodec_buffer_t find(AVBufferRef *device, AVPixelFormat format, AVPixelFormat sw_format, int width, int height) {
+      std::lock_guard lg {lock};
+
+      for (auto &frames : entries) {
+        auto frames_ctx = (AVHWFramesContext *) frames->data;
+        if (frames_ctx->device_ref->data == device->data &&
+            frames_ctx->format == format &&
+            frames_ctx->sw_format == sw_format &&
+            frames_ctx->width == width &&
+            frames_ctx->height == height) {
+          return avcodec_buffer_t {av_buffer_ref(frames.get())};
+        }
+      }
+
+      return nullptr;
+    }
+
+    void keep(AVBufferRef *frames) {
+      std::lock_guard lg {lock};
+
+      if (entries.size() == max_entries) {
+        entries.pop_front();
+      }
+      entries.emplace_back(av_buffer_ref(frames));
+    }
+
+  private:
+    std::mutex lock;
+    std::deque<avcodec_buffer_t> entries;
+  };
+
+  static hwframes_cache_t hwframes_cache;
+
   std::unique_ptr<avcodec_encode_session_t> make_avcodec_encode_session(
     platf::display_t *disp,
     const encoder_t &encoder,
@@ -1513,6 +2656,29 @@ namespace video {
       return nullptr;
     }
 
+    // Feed the encoder from system memory if the capture backend has no hardware frames for it,
+    // or if this FFmpeg build can't take the hardware frames (e.g. V4L2 M2M without DRM PRIME input)
+    bool system_memory_input = false;
+    if (hardware && (encoder.flags & SYSTEM_MEMORY_INPUT) &&
+        (!encode_device->data || !codec_supports_pix_fmt(codec, platform_formats->avcodec_dev_pix_fmt))) {
+      BOOST_LOG(debug) << video_format.name << ": using system memory input"sv;
+
+      hardware = false;
+      system_memory_input = true;
+    }
+
+    // The sliced profile trades compression for latency, which suits live camera sources best
+    auto sw_profile = config::video.sw.profile;
+    bool sliced_profile = !hardware && video_format.name == "libx264"s &&
+                          (sw_profile == config::video_t::sw_t::profile_e::sliced ||
+                           (sw_profile == config::video_t::sw_t::profile_e::automatic && disp->is_live_source()));
+    if (sliced_profile) {
+      BOOST_LOG(info) << video_format.name << ": using the sliced low latency profile"sv;
+    }
+
+    // Only x264 can take intra-refresh through FFmpeg, other encoders keep recovering with IDR frames
+    bool intra_refresh = video_format.name == "libx264"s && (sliced_profile || config.enableIntraRefresh == 1);
+
     auto colorspace = encode_device->colorspace;
     auto sw_fmt = (colorspace.bit_depth == 8 && config.chromaSamplingType == 0)  ? platform_formats->avcodec_pix_fmt_8bit :
                   (colorspace.bit_depth == 8 && config.chromaSamplingType == 1)  ? platform_formats->avcodec_pix_fmt_yuv444_8bit :
@@ -1571,6 +2737,13 @@ namespace video {
 
       ctx->keyint_min = std::numeric_limits<int>::max();
 
+      if (intra_refresh) {
+        // Intra-refresh sweeps a column of intra blocks across the picture once per GOP,
+        // so the stream heals from loss within a second without the size spike of a periodic IDR frame
+        ctx->gop_size = config.framerate;
+        ctx->keyint_min = config.framerate;
+      }
+
       // Some client decoders have limits on the number of reference frames
       if (config.numRefFrames) {
         if (video_format[encoder_t::REF_FRAMES_RESTRICT]) {
@@ -1629,8 +2802,16 @@ namespace video {
         }
 
         // Initialize avcodec hardware frames
-        {
-          avcodec_buffer_t frame_ref {av_hwframe_ctx_alloc(encoding_stream_context.get())};
+        avcodec_buffer_t frame_ref;
+        if (encode_device->reuse_hwframes()) {
+          frame_ref = hwframes_cache.find(encoding_stream_context.get(), ctx->pix_fmt, sw_fmt, ctx->width, ctx->height);
+        }
+
+        if (frame_ref) {
+          BOOST_LOG(debug) << "Reusing hardware frames of a previous session"sv;
+          ctx->hw_frames_ctx = av_buffer_ref(frame_ref.get());
+        } else {
+          frame_ref.reset(av_hwframe_ctx_alloc(encoding_stream_context.get()));
 
           auto frame_ctx = (AVHWFramesContext *) frame_ref->data;
           frame_ctx->format = ctx->pix_fmt;
@@ -1646,6 +2827,10 @@ namespace video {
             return nullptr;
           }
 
+          if (encode_device->reuse_hwframes()) {
+            hwframes_cache.keep(frame_ref.get());
+          }
+
           ctx->hw_frames_ctx = av_buffer_ref(frame_ref.get());
         }
 
@@ -1657,6 +2842,11 @@ namespace video {
         // most efficient encode, but we may want to provide more slices than
         // requested to ensure we have enough parallelism for good performance.
         ctx->slices = std::max(config.slicesPerFrame, config::video.min_threads);
+
+        if (sliced_profile) {
+          // Give every core a slice of each frame, frame threads would add a frame of latency per thread
+          ctx->slices = std::max<int>(ctx->slices, std::thread::hardware_concurrency());
+        }
       }
 
       if (encoder.flags & SINGLE_SLICE_ONLY) {
@@ -1717,6 +2907,16 @@ namespace video {
           handle_option(option);
         }
       }
+      if (sliced_profile) {
+        // Override the tune, so no lookahead or scenecut keyframe can delay or inflate a frame
+        av_dict_set(&options, "x264-params", "sliced-threads=1:sync-lookahead=0:rc-lookahead=0:scenecut=0", 0);
+      }
+      if (intra_refresh) {
+        av_dict_set_int(&options, "intra-refresh", 1, 0);
+
+        // Keyframes requested by the client must still be full IDR frames
+        av_dict_set_int(&options, "forced-idr", 1, 0);
+      }
 
       auto bitrate = ((config::video.max_bitrate > 0) ? std::min(config.bitrate, config::video.max_bitrate) : config.bitrate) * 1000;
       BOOST_LOG(info) << "Streaming bitrate is " << bitrate;
@@ -1735,7 +2935,10 @@ namespace video {
       }
 
       if (!(encoder.flags & NO_RC_BUF_LIMIT)) {
-        if (!hardware && (ctx->slices > 1 || config.videoFormat == 1)) {
+        if (sliced_profile) {
+          // Size the VBV for a single frame, so no frame takes longer than a frame interval to send
+          ctx->rc_buffer_size = bitrate / config.framerate;
+        } else if (!hardware && (ctx->slices > 1 || config.videoFormat == 1)) {
           // Use a larger rc_buffer_size for software encoding when slices are enabled,
           // because libx264 can severely degrade quality if the buffer is too small.
           // libx265 encounters this issue more frequently, so always scale the
@@ -1823,7 +3026,7 @@ namespace video {
 
     std::unique_ptr<platf::avcodec_encode_device_t> encode_device_final;
 
-    if (!encode_device->data) {
+    if ((!encode_device->data || system_memory_input) && !encode_device->converts_to_system_memory()) {
       auto software_encode_device = std::make_unique<avcodec_software_encode_device_t>();
 
       if (software_encode_device->init(width, height, frame.get(), sw_fmt, hardware)) {
@@ -1849,6 +3052,13 @@ namespace video {
       // 0 ==> don't inject, 1 ==> inject for h264, 2 ==> inject for hevc
       config.videoFormat <= 1 ? (1 - (int) video_format[encoder_t::VUI_PARAMETERS]) * (1 + config.videoFormat) : 0
     );
+    session->intra_refresh = intra_refresh;
+
+    // libx265 and VAAPI only read the rate control settings when the codec is opened
+    session->dynamic_bitrate = (encoder.flags & DYNAMIC_BITRATE) && video_format.name != "libx265"s;
+
+    // Software encoders without lookahead don't depend on the display and have nothing buffered between frames
+    session->recyclable = !hardware && (sliced_profile || config::video.sw.sw_tune == "zerolatency"s);
 
     return session;
   }
@@ -1873,6 +3083,231 @@ namespace video {
     return nullptr;
   }
 
+  /**
+   * @brief Tears encode sessions down off the encoder threads.
+   * A single worker handles the teardowns in order. Once it's stuck, e.g. on a hung driver,
+   * or falls too far behind, a teardown gets a thread of its own so streaming isn't held up.
+   */
+  class encoder_teardown_t {
+  public:
+    // Teardowns waiting for the worker before new ones get a thread of their own
+    static constexpr std::size_t MAX_PENDING = 4;
+
+    // A teardown taking longer than this is considered hung
+    static constexpr auto HANG_TIMEOUT = 5s;
+
+    void push(std::unique_ptr<encode_session_t> session) {
+      std::unique_lock lg {lock};
+
+      auto now = std::chrono::steady_clock::now();
+      bool hung = busy_since && now - *busy_since > HANG_TIMEOUT;
+      if (hung || queue.size() >= MAX_PENDING) {
+        ++overflows;
+        lg.unlock();
+
+        BOOST_LOG(warning) << "Encoder teardown worker is "sv << (hung ? "hung"sv : "behind"sv) << ", tearing down on a new thread"sv;
+        std::thread {[session = std::move(session)]() mutable {
+          teardown(session);
+        }}.detach();
+        return;
+      }
+
+      queue.emplace_back(std::move(session));
+      if (!worker_started) {
+        // The worker may never return from a hung driver, so it can't be joined
+        std::thread {&encoder_teardown_t::worker_main, this}.detach();
+        worker_started = true;
+      }
+      cv.notify_one();
+    }
+
+  private:
+    static std::chrono::milliseconds teardown(std::unique_ptr<encode_session_t> &session) {
+      BOOST_LOG(info) << "Starting async encoder teardown";
+      auto start = std::chrono::steady_clock::now();
+      session.reset();
+      auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+      BOOST_LOG(info) << "Async encoder teardown complete in "sv << elapsed.count() << "ms"sv;
+
+      return elapsed;
+    }
+
+    void worker_main() {
+      std::unique_lock lg {lock};
+      while (true) {
+        cv.wait(lg, [this]() {
+          return !queue.empty();
+        });
+
+        auto session = std::move(queue.front());
+        queue.pop_front();
+        busy_since = std::chrono::steady_clock::now();
+        lg.unlock();
+
+        auto elapsed = teardown(session);
+
+        lg.lock();
+        busy_since.reset();
+        ++completed;
+        slowest = std::max(slowest, elapsed);
+        BOOST_LOG(debug) << "Encoder teardowns: "sv << completed << " completed, "sv << queue.size() << " pending, "sv
+                         << overflows << " on their own thread, slowest "sv << slowest.count() << "ms"sv;
+      }
+    }
+
+    std::mutex lock;
+    std::condition_variable cv;
+    std::deque<std::unique_ptr<encode_session_t>> queue;
+    bool worker_started = false;
+    std::optional<std::chrono::steady_clock::time_point> busy_since;
+
+    std::uint64_t completed = 0;
+    std::uint64_t overflows = 0;
+    std::chrono::milliseconds slowest {};
+  };
+
+  // Never destroyed, the detached worker may still use it at exit
+  encoder_teardown_t &encoder_teardown = *new encoder_teardown_t;
+
+  /**
+   * @brief An encode session kept open after its stream ended, for the next stream with the same parameters.
+   */
+  struct recycled_session_t {
+    std::unique_ptr<avcodec_encode_session_t> session;
+    const encoder_t *encoder;
+    config_t config;
+    int width;
+    int height;
+    std::uint64_t generation;
+  };
+
+  // How long an idle session is kept open before it's torn down
+  constexpr auto RECYCLE_TIMEOUT = 10s;
+
+  std::mutex recycled_session_lock;
+  std::optional<recycled_session_t> recycled_session;
+  std::uint64_t recycled_session_generation = 0;
+
+  bool same_encode_parameters(const config_t &a, const config_t &b) {
+    auto params = [](const config_t &c) {
+      return std::tie(c.width, c.height, c.framerate, c.framerateX100, c.bitrate, c.slicesPerFrame, c.numRefFrames, c.encoderCscMode, c.videoFormat, c.dynamicRange, c.chromaSamplingType, c.enableIntraRefresh);
+    };
+
+    return params(a) == params(b);
+  }
+
+  /**
+   * @brief Keep an encode session open for the next stream if its encoder allows it, or tear it down.
+   * @param session The session of the stream that ended.
+   * @param encoder The encoder of the session.
+   * @param config The parameters the session was opened with.
+   * @param width The width of the display the session encoded.
+   * @param height The height of the display the session encoded.
+   * @param reusable `false` if the stream ended because the session failed.
+   */
+  void release_encode_session(std::unique_ptr<encode_session_t> session, const encoder_t &encoder, const config_t &config, int width, int height, bool reusable) {
+    auto avcodec_session = dynamic_cast<avcodec_encode_session_t *>(session.get());
+    if (!reusable || !avcodec_session || !avcodec_session->recyclable) {
+      if (encoder.flags & ASYNC_TEARDOWN) {
+        encoder_teardown.push(std::move(session));
+      }
+      return;
+    }
+
+    std::unique_ptr<avcodec_encode_session_t> recyclable {avcodec_session};
+    session.release();
+
+    std::optional<recycled_session_t> replaced;
+    std::uint64_t generation;
+    {
+      std::lock_guard lg {recycled_session_lock};
+      replaced = std::move(recycled_session);
+      generation = ++recycled_session_generation;
+      recycled_session = recycled_session_t {std::move(recyclable), &encoder, config, width, height, generation};
+    }
+
+    // Tear the session down after a while, unless a stream took it or another session replaced it
+    task_pool.pushDelayed([generation]() {
+      std::optional<recycled_session_t> expired;
+      {
+        std::lock_guard lg {recycled_session_lock};
+        if (recycled_session && recycled_session->generation == generation) {
+          expired = std::move(recycled_session);
+          recycled_session.reset();
+        }
+      }
+
+      if (expired) {
+        BOOST_LOG(debug) << "Closing idle recycled encoder session"sv;
+      }
+    },
+                          RECYCLE_TIMEOUT);
+  }
+
+  /**
+   * @brief Take the session kept open by an earlier stream if it was opened with the same parameters.
+   * @param encoder The encoder of the new stream.
+   * @param config The parameters of the new stream.
+   * @param width The width of the display of the new stream.
+   * @param height The height of the display of the new stream.
+   * @return The session, or nullptr if there's none that matches.
+   */
+  std::unique_ptr<encode_session_t> take_recycled_session(const encoder_t &encoder, const config_t &config, int width, int height) {
+    std::optional<recycled_session_t> recycled;
+    {
+      std::lock_guard lg {recycled_session_lock};
+      recycled = std::move(recycled_session);
+      recycled_session.reset();
+    }
+
+    if (!recycled) {
+      return nullptr;
+    }
+
+    if (recycled->encoder != &encoder || recycled->width != width || recycled->height != height || !same_encode_parameters(recycled->config, config)) {
+      // The parameters changed, so the next stream is unlikely to match either
+      return nullptr;
+    }
+
+    auto &session = recycled->session;
+
+    // The new stream starts its frame numbers over and needs an IDR frame to start decoding
+    session->last_idr_frame = -1;
+    session->rfi_needs_confirmation = false;
+    session->request_idr_frame();
+    session->set_bitrate(config::video.max_bitrate > 0 ? std::min(config.bitrate, config::video.max_bitrate) : config.bitrate);
+
+    BOOST_LOG(info) << "Reusing encoder session of the previous stream"sv;
+    return std::move(session);
+  }
+
+  /**
+   * @brief Take the session prepare_display() opened on a display, if the stream encodes that display with its parameters.
+   * @param encoder The encoder of the stream.
+   * @param config The parameters of the stream.
+   * @param disp The display the stream encodes.
+   * @return The session, or nullptr if none was opened for this display and these parameters.
+   */
+  std::unique_ptr<encode_session_t> take_prepared_session(const encoder_t &encoder, const config_t &config, const std::shared_ptr<platf::display_t> &disp) {
+    std::optional<prepared_session_t> prepared;
+    {
+      std::lock_guard lg {prepared_display_mutex};
+      prepared.swap(prepared_session);
+    }
+
+    // The session is closed if the capture thread reopened the display or the parameters changed since the announce
+    if (!prepared || prepared->encoder != &encoder || prepared->display.lock() != disp || !same_encode_parameters(prepared->config, config)) {
+      return nullptr;
+    }
+
+    auto session = prepared->session.get();
+    if (session) {
+      BOOST_LOG(debug) << "Using the encoder opened during the RTSP handshake"sv;
+    }
+
+    return session;
+  }
+
   void encode_run(
     int &frame_nr,  // Store progress of the frame number
     safe::mail_t mail,
@@ -1884,37 +3319,62 @@ namespace video {
     const encoder_t &encoder,
     void *channel_data
   ) {
-    auto session = make_encode_session(disp.get(), encoder, config, disp->width, disp->height, std::move(encode_device));
+    auto session = take_prepared_session(encoder, config, disp);
+    if (!session) {
+      session = take_recycled_session(encoder, config, disp->width, disp->height);
+    }
+    if (!session) {
+      session = make_encode_session(disp.get(), encoder, config, disp->width, disp->height, std::move(encode_device));
+    }
     if (!session) {
+      encode_scheduler.open_failed();
+      invalidate_encoder_cache();
       return;
     }
+    chosen_encoder_cached = false;
 
     // As a workaround for NVENC hangs and to generally speed up encoder reinit,
-    // we will complete the encoder teardown in a separate thread if supported.
+    // we will complete the encoder teardown on the teardown worker if supported.
     // This will move expensive processing off the encoder thread to allow us
     // to restart encoding as soon as possible. For cases where the NVENC driver
-    // hang occurs, this thread may probably never exit, but it will allow
+    // hang occurs, the teardown may probably never finish, but it will allow
     // streaming to continue without requiring a full restart of Sunshine.
-    auto fail_guard = util::fail_guard([&encoder, &session] {
-      if (encoder.flags & ASYNC_TEARDOWN) {
-        std::thread encoder_teardown_thread {[session = std::move(session)]() mutable {
-          BOOST_LOG(info) << "Starting async encoder teardown";
-          session.reset();
-          BOOST_LOG(info) << "Async encoder teardown complete";
-        }};
-        encoder_teardown_thread.detach();
-      }
+    bool session_ok = false;
+    auto fail_guard = util::fail_guard([&] {
+      release_encode_session(std::move(session), encoder, config, disp->width, disp->height, session_ok);
     });
 
     // set max frame time based on client-requested target framerate.
     double minimum_fps_target = (config::video.minimum_fps_target > 0.0) ? config::video.minimum_fps_target : config.framerate;
+
+    // A camera slower than the stream has nothing but repeats of its last frame to offer in between
+    if (auto source_fps = disp->source_framerate(); source_fps > 0.0 && source_fps < minimum_fps_target) {
+      BOOST_LOG(info) << "Source delivers "sv << source_fps << " fps, the encoder won't repeat frames faster than that"sv;
+      minimum_fps_target = source_fps;
+    }
     std::chrono::duration<double, std::milli> max_frametime {1000.0 / minimum_fps_target};
     BOOST_LOG(info) << "Minimum FPS target set to ~"sv << (minimum_fps_target / 2) << "fps ("sv << max_frametime.count() * 2 << "ms)"sv;
 
+    // Frames are due at the client one frame time after they were captured
+    auto frame_time = std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(1.0 / std::max(1, config.framerate)));
+    auto frame_pixels = (std::uint64_t) config.width * config.height;
+    int admitted_frame_count = 0;
+
+    // The frame the last key frame was requested for, loss reports for the frames before it need nothing else
+    int64_t last_idr_frame_nr = -1;
+
     auto shutdown_event = mail->event<bool>(mail::shutdown);
-    auto packets = mail::man->queue<packet_t>(mail::video_packets);
+    auto packets = mail::man->ring<packet_t>(mail::video_packets);
     auto idr_events = mail->event<bool>(mail::idr);
     auto invalidate_ref_frames_events = mail->event<std::pair<int64_t, int64_t>>(mail::invalidate_ref_frames);
+    auto bitrate_events = mail->event<int>(mail::bitrate);
+
+    // The bitrate of the stream, before the quality level takes its share of it
+    int requested_bitrate_kbps = config.bitrate;
+    std::optional<governor::governor_t> quality_governor;
+    if (config::video.adaptive_quality) {
+      quality_governor.emplace(config.framerate, config::video.thermal_limit);
+    }
 
     {
       // Load a dummy image into the AVFrame to ensure we have something to encode
@@ -1941,27 +3401,66 @@ namespace video {
 
       bool requested_idr_frame = false;
 
-      while (invalidate_ref_frames_events->peek()) {
-        if (auto frames = invalidate_ref_frames_events->pop(0ms)) {
-          session->invalidate_ref_frames(frames->first, frames->second);
+      // A burst of loss reports arrives merged into a single range spanning all of them
+      if (auto invalidated_frames = invalidate_ref_frames_events->pop(0ms)) {
+        if (invalidated_frames->second < last_idr_frame_nr) {
+          // The key frame already requested after these frames recovers the client as well
+          BOOST_LOG(debug) << "Frames "sv << invalidated_frames->first << " to "sv << invalidated_frames->second
+                           << " precede key frame "sv << last_idr_frame_nr << ", not invalidating them"sv;
+          metrics::add(metrics::counter_e::idr_frames_avoided);
+        } else if (session->invalidate_ref_frames(invalidated_frames->first, invalidated_frames->second)) {
+          // Don't let the next frame be dropped, it's the key frame
+          requested_idr_frame = true;
         }
       }
 
-      if (idr_events->peek()) {
+      if (bitrate_events->peek()) {
+        if (auto bitrate_kbps = bitrate_events->pop(0ms)) {
+          requested_bitrate_kbps = *bitrate_kbps;
+          if (quality_governor) {
+            *bitrate_kbps = requested_bitrate_kbps * quality_governor->level().bitrate_percent / 100;
+          }
+
+          if (session->set_bitrate(*bitrate_kbps)) {
+            BOOST_LOG(info) << "Streaming bitrate changed to "sv << *bitrate_kbps << " kbps"sv;
+          } else {
+            BOOST_LOG(warning) << "Encoder can't change its bitrate while streaming"sv;
+          }
+        }
+      }
+
+      if (idr_events->pop(0ms)) {
         requested_idr_frame = true;
-        idr_events->pop();
       }
 
       if (requested_idr_frame) {
         session->request_idr_frame();
+        last_idr_frame_nr = frame_nr;
       }
 
       std::optional<std::chrono::steady_clock::time_point> frame_timestamp;
+      session->convert_timestamp.reset();
+
+      // Other sessions may hold the encoder, the frame due first at its client goes next
+      auto fps_divisor = encode_scheduler.fps_divisor(channel_data);
+      std::optional<scheduler::scheduler_t::turn_t> turn;
 
       // Encode at a minimum FPS to avoid image quality issues with static content
       if (!requested_idr_frame || images->peek()) {
         if (auto img = images->pop(max_frametime)) {
+          // The frames the quality level or the admission to the encoder drop aren't even converted
+          if (!requested_idr_frame && admitted_frame_count++ % fps_divisor != 0) {
+            continue;
+          }
+          if (quality_governor && !requested_idr_frame && !quality_governor->take_frame()) {
+            continue;
+          }
+
           frame_timestamp = img->frame_timestamp;
+          turn.emplace(encode_scheduler.wait_turn(frame_timestamp.value_or(std::chrono::steady_clock::now()) + frame_time * fps_divisor));
+          session->convert_timestamp = std::chrono::steady_clock::now();
+
+          trace::scope_t convert_span {trace::stage_e::convert, frame_nr};
           if (session->convert(*img)) {
             BOOST_LOG(error) << "Could not convert image"sv;
             return;
@@ -1971,13 +3470,36 @@ namespace video {
         }
       }
 
+      if (!turn) {
+        turn.emplace(encode_scheduler.wait_turn(std::chrono::steady_clock::now() + frame_time * fps_divisor));
+      }
+
+      auto encode_start = session->convert_timestamp.value_or(std::chrono::steady_clock::now());
       if (encode(frame_nr++, *session, packets, channel_data, frame_timestamp)) {
         BOOST_LOG(error) << "Could not encode video packet"sv;
         return;
       }
+      turn.reset();
+      encode_scheduler.frame_encoded(frame_pixels, std::chrono::steady_clock::now() - encode_start);
 
       session->request_normal_frame();
+
+      if (quality_governor) {
+        auto now = std::chrono::steady_clock::now();
+        quality_governor->frame_encoded(now - encode_start);
+
+        // The host is sampled about once a second, reading sysfs for every frame isn't worth it
+        if (quality_governor->sample_due(now)) {
+          auto thermal = platf::thermal_state();
+          if (quality_governor->update(now, thermal.temperature, thermal.throttled) &&
+              !session->set_bitrate(requested_bitrate_kbps * quality_governor->level().bitrate_percent / 100)) {
+            BOOST_LOG(debug) << "Encoder can't change its bitrate while streaming, only the frame rate follows the quality level"sv;
+          }
+        }
+      }
     }
+
+    session_ok = true;
   }
 
   input::touch_port_t make_port(platf::display_t *display, const config_t &config) {
@@ -2014,6 +3536,7 @@ namespace video {
     std::unique_ptr<platf::encode_device_t> result;
 
     auto colorspace = colorspace_from_client_config(config, disp.is_hdr());
+    colorspace.tone_map = config::video.hdr_tone_map && disp.is_hdr() && !colorspace_is_hdr(colorspace);
 
     platf::pix_fmt_e pix_fmt;
     if (config.chromaSamplingType == 1) {
@@ -2051,7 +3574,11 @@ namespace video {
     if (dynamic_cast<const encoder_platform_formats_avcodec *>(encoder.platform_formats.get())) {
       result = disp.make_avcodec_encode_device(pix_fmt);
     } else if (dynamic_cast<const encoder_platform_formats_nvenc *>(encoder.platform_formats.get())) {
-      result = disp.make_nvenc_encode_device(pix_fmt);
+      auto nvenc_device = disp.make_nvenc_encode_device(pix_fmt);
+      if (nvenc_device) {
+        nvenc_device->split_encode = encoder.codec_from_config(config)[encoder_t::SPLIT_ENCODE];
+      }
+      result = std::move(nvenc_device);
     }
 
     if (result) {
@@ -2087,8 +3614,10 @@ namespace video {
 
     auto session = make_encode_session(disp, encoder, ctx.config, img.width, img.height, std::move(encode_device));
     if (!session) {
+      invalidate_encoder_cache();
       return std::nullopt;
     }
+    chosen_encoder_cached = false;
 
     // Load the initial image to prepare for encoding
     if (session->convert(img)) {
@@ -2160,6 +3689,13 @@ namespace video {
     auto ec = platf::capture_e::ok;
     while (encode_session_ctx_queue.running()) {
       auto push_captured_image_callback = [&](std::shared_ptr<platf::img_t> &&img, bool frame_captured) -> bool {
+        if (frame_captured) {
+          metrics::add(metrics::counter_e::frames_captured);
+        }
+        if (frame_captured && img->frame_timestamp) {
+          trace::span(trace::stage_e::capture, -1, *img->frame_timestamp, std::chrono::steady_clock::now());
+        }
+
         while (encode_session_ctx_queue.peek()) {
           auto encode_session_ctx = encode_session_ctx_queue.pop();
           if (!encode_session_ctx) {
@@ -2200,6 +3736,11 @@ namespace video {
             ctx->idr_events->pop();
           }
 
+          pos->session->convert_timestamp.reset();
+          if (frame_captured) {
+            pos->session->convert_timestamp = std::chrono::steady_clock::now();
+          }
+
           if (frame_captured && pos->session->convert(*img)) {
             BOOST_LOG(error) << "Could not convert image"sv;
             ctx->shutdown_event->raise(true);
@@ -2207,6 +3748,10 @@ namespace video {
             continue;
           }
 
+          if (pos->session->convert_timestamp) {
+            trace::span(trace::stage_e::convert, ctx->frame_nr, *pos->session->convert_timestamp, std::chrono::steady_clock::now());
+          }
+
           std::optional<std::chrono::steady_clock::time_point> frame_timestamp;
           if (img) {
             frame_timestamp = img->frame_timestamp;
@@ -2239,6 +3784,18 @@ namespace video {
       };
 
       auto status = disp->capture(push_captured_image_callback, pull_free_image_callback, &display_cursor);
+
+      // Cameras delivering the same frames as the current one are switched under the running encoders
+      if (ec == platf::capture_e::reinit && status != platf::capture_e::error && disp->is_live_source() && switch_display_event->peek() &&
+          hot_switch_display(*disp, *switch_display_event->pop(), encoder.platform_formats->dev_type, display_names, display_p, synced_session_ctxs.front()->config)) {
+        for (auto &synced_session : synced_sessions) {
+          synced_session.session->request_idr_frame();
+        }
+
+        ec = platf::capture_e::ok;
+        continue;
+      }
+
       switch (status) {
         case platf::capture_e::reinit:
         case platf::capture_e::error:
@@ -2273,6 +3830,7 @@ namespace video {
     });
 
     // Encoding and capture takes place on this thread
+    platf::set_thread_name("capture_encode"s);
     platf::adjust_thread_priority(platf::thread_priority_e::high);
 
     std::vector<std::string> display_names;
@@ -2298,7 +3856,13 @@ namespace video {
       return;
     }
 
-    ref->capture_ctx_queue->raise(capture_ctx_t {images, config});
+    // The admission holds across reinits, a display change doesn't make room for a session that joined later
+    encode_scheduler.admit(channel_data, config.width, config.height, config.framerate);
+    auto leave_guard = util::fail_guard([&]() {
+      encode_scheduler.leave(channel_data);
+    });
+
+    ref->capture_ctx_queue->raise(capture_ctx_t {images, config, mail->event<bool>(mail::idr), mail->event<std::chrono::nanoseconds>(mail::capture_phase)});
 
     if (!ref->capture_ctx_queue->running()) {
       return;
@@ -2310,6 +3874,7 @@ namespace video {
     auto hdr_event = mail->event<hdr_info_t>(mail::hdr);
 
     // Encoding takes place on this thread
+    platf::set_thread_name("video_encode"s);
     platf::adjust_thread_priority(platf::thread_priority_e::high);
 
     while (!shutdown_event->peek() && images->running()) {
@@ -2364,6 +3929,100 @@ namespace video {
     }
   }
 
+  /**
+   * @brief Stream the frames of a display that encodes them itself, see platf::encoded_display_t.
+   * @param mail The mail of the session.
+   * @param config The stream configuration.
+   * @param channel_data The session, handed on with every packet.
+   * @return `false` if the stream has to be encoded by us instead.
+   */
+  bool capture_encoded(safe::mail_t &mail, const config_t &config, void *channel_data) {
+    std::vector<std::string> display_names;
+    int display_p = -1;
+    refresh_displays(chosen_encoder->platform_formats->dev_type, display_names, display_p);
+    if (!platf::has_encoded_display(display_names[display_p], config)) {
+      return false;
+    }
+
+    auto disp = platf::encoded_display(display_names[display_p], config);
+    if (!disp) {
+      BOOST_LOG(warning) << "Encoding the stream instead of passing the frames of the display through"sv;
+      return false;
+    }
+
+    auto shutdown_event = mail->event<bool>(mail::shutdown);
+    auto packets = mail::man->ring<packet_t>(mail::video_packets);
+    auto idr_events = mail->event<bool>(mail::idr);
+    auto invalidate_ref_frames_events = mail->event<std::pair<int64_t, int64_t>>(mail::invalidate_ref_frames);
+
+    // The display encodes at the size of the stream, so absolute mouse coordinates need no scaling
+    mail->event<input::touch_port_t>(mail::touch_port)->raise(input::touch_port_t {
+      {0, 0, config.width, config.height},
+      disp->width,
+      disp->height,
+      0.0f,
+      0.0f,
+      1.0f,
+    });
+    mail->event<hdr_info_t>(mail::hdr)->raise(std::make_unique<hdr_info_raw_t>(false));
+
+    auto frame_buffers = std::make_shared<frame_buffer_pool_t>();
+
+    // The client can't decode anything before the first key frame
+    bool waiting_for_idr = true;
+    int64_t frame_nr = 1;
+    while (!shutdown_event->peek()) {
+      bool requested_idr_frame = false;
+      if (idr_events->peek()) {
+        requested_idr_frame = true;
+        idr_events->pop();
+      }
+
+      // The reference frames are the display's, so lost frames are recovered from with a key frame
+      while (invalidate_ref_frames_events->peek()) {
+        invalidate_ref_frames_events->pop(0ms);
+        requested_idr_frame = true;
+      }
+
+      if (requested_idr_frame) {
+        disp->request_idr_frame();
+      }
+
+      auto frame_data = frame_buffers->take();
+      bool idr = false;
+      std::optional<std::chrono::steady_clock::time_point> frame_timestamp;
+
+      auto status = disp->next_frame(frame_data, idr, frame_timestamp);
+      if (status == platf::capture_e::timeout) {
+        frame_buffers->give_back(std::move(frame_data));
+        continue;
+      }
+      if (status != platf::capture_e::ok) {
+        BOOST_LOG(error) << "Could not read an encoded frame from the display"sv;
+        break;
+      }
+
+      if (waiting_for_idr && !idr) {
+        frame_buffers->give_back(std::move(frame_data));
+        continue;
+      }
+      waiting_for_idr = false;
+
+      auto packet = std::make_unique<packet_raw_generic>(std::move(frame_data), frame_nr++, idr);
+      packet->pool = frame_buffers;
+      packet->channel_data = channel_data;
+      packet->frame_timestamp = frame_timestamp;
+
+      // The display encodes the frames itself
+      metrics::add(metrics::counter_e::frames_encoded);
+      if (!packets->raise(std::move(packet))) {
+        metrics::add(metrics::counter_e::video_packets_dropped);
+      }
+    }
+
+    return true;
+  }
+
   void capture(
     safe::mail_t mail,
     config_t config,
@@ -2372,6 +4031,13 @@ namespace video {
     auto idr_events = mail->event<bool>(mail::idr);
 
     idr_events->raise(true);
+
+    // The session may have skipped the probe, the display still has to be in its new mode
+    display_device::wait_for_configuration();
+
+    if (capture_encoded(mail, config, channel_data)) {
+      return;
+    }
     if (chosen_encoder->flags & PARALLEL_ENCODING) {
       capture_async(std::move(mail), config, channel_data);
     } else {
@@ -2380,7 +4046,7 @@ namespace video {
       ref->encode_session_ctx_queue.raise(sync_session_ctx_t {
         &join_event,
         mail->event<bool>(mail::shutdown),
-        mail::man->queue<packet_t>(mail::video_packets),
+        mail::man->ring<packet_t>(mail::video_packets),
         std::move(idr_events),
         mail->event<hdr_info_t>(mail::hdr),
         mail->event<input::touch_port_t>(mail::touch_port),
@@ -2419,12 +4085,16 @@ namespace video {
 
     session->request_idr_frame();
 
-    auto packets = mail::man->queue<packet_t>(mail::video_packets);
+    // Probes may run side by side, each collects its packets on a mailbox of its own
+    auto probe_mail = std::make_shared<safe::mail_raw_t>();
+    auto packets = probe_mail->ring<packet_t>(mail::video_packets);
+    auto encode_start = std::chrono::steady_clock::now();
     while (!packets->peek()) {
       if (encode(1, *session, packets, nullptr, {})) {
         return -1;
       }
     }
+    encode_scheduler.probed((std::uint64_t) config.width * config.height, std::chrono::steady_clock::now() - encode_start);
 
     auto packet = packets->pop();
     if (!packet->is_idr()) {
@@ -2450,6 +4120,69 @@ namespace video {
     return flag;
   }
 
+  /**
+   * @brief Probe sessions of an encoder that are opened side by side at most.
+   */
+  constexpr auto PROBE_WORKERS = 3;
+
+  /**
+   * @brief A probe of one codec or mode, run on the display it's given.
+   * It returns `false` if a session failed, so the probe is worth running again on its own.
+   */
+  using probe_case_t = std::function<bool(const std::shared_ptr<platf::display_t> &)>;
+
+  /**
+   * @brief Run probe cases that don't depend on each other side by side, each worker captures from a display of its own.
+   * The encoder may refuse to open that many sessions at once, so the cases that failed next to others are run again alone.
+   * @param disp The display of the first worker, and of the cases run again.
+   * @param encoder The encoder being probed.
+   * @param output_name The display the other workers open.
+   * @param display_config The configuration the other workers open it with.
+   * @param cases The probe cases.
+   */
+  void run_probe_cases(const std::shared_ptr<platf::display_t> &disp, const encoder_t &encoder, const std::string &output_name, const config_t &display_config, const std::vector<probe_case_t> &cases) {
+    // Once the encoder turned down a session, no more probes than it opened run at once
+    auto max_sessions = encode_scheduler.capacity().max_sessions;
+    auto workers = std::min<std::size_t>(cases.size(), max_sessions > 0 ? std::min(PROBE_WORKERS, max_sessions) : PROBE_WORKERS);
+    if (workers <= 1) {
+      for (auto &probe : cases) {
+        probe(disp);
+      }
+      return;
+    }
+
+    std::vector<char> settled(cases.size());
+    std::atomic<std::size_t> next {0};
+    auto work = [&](const std::shared_ptr<platf::display_t> &worker_disp) {
+      for (auto x = next++; x < cases.size(); x = next++) {
+        settled[x] = cases[x](worker_disp);
+      }
+    };
+
+    std::vector<std::future<void>> helpers;
+    for (std::size_t x = 1; x < workers; ++x) {
+      helpers.emplace_back(std::async(std::launch::async, [&]() {
+        std::shared_ptr<platf::display_t> worker_disp;
+        reset_display(worker_disp, encoder.platform_formats->dev_type, output_name, display_config);
+        if (worker_disp) {
+          work(worker_disp);
+        }
+      }));
+    }
+    work(disp);
+
+    for (auto &helper : helpers) {
+      helper.get();
+    }
+
+    for (std::size_t x = 0; x < cases.size(); ++x) {
+      if (!settled[x]) {
+        BOOST_LOG(debug) << "Encoder ["sv << encoder.name << "] probe "sv << x << " failed next to others, running it alone"sv;
+        cases[x](disp);
+      }
+    }
+  }
+
   bool validate_encoder(encoder_t &encoder, bool expect_failure) {
     const auto output_name {display_device::map_output_name(config::video.output_name)};
     std::shared_ptr<platf::display_t> disp;
@@ -2503,73 +4236,122 @@ namespace video {
     encoder.h264[encoder_t::REF_FRAMES_RESTRICT] = max_ref_frames_h264 >= 0;
     encoder.h264[encoder_t::PASSED] = true;
 
-    if (test_hevc) {
-      config_max_ref_frames.videoFormat = 1;
-      config_autoselect.videoFormat = 1;
+    // Each probe case only touches the flags of its own codec, so the cases can run side by side
+    auto probe_codec = [&](const std::shared_ptr<platf::display_t> &disp, encoder_t::codec_t &codec, int video_format) {
+      auto config_codec_max_ref_frames = config_max_ref_frames;
+      auto config_codec_autoselect = config_autoselect;
+      config_codec_max_ref_frames.videoFormat = video_format;
+      config_codec_autoselect.videoFormat = video_format;
 
-      if (disp->is_codec_supported(encoder.hevc.name, config_autoselect)) {
-        auto max_ref_frames_hevc = validate_config(disp, encoder, config_max_ref_frames);
+      if (!disp->is_codec_supported(codec.name, config_codec_autoselect)) {
+        BOOST_LOG(info) << "Encoder ["sv << codec.name << "] is not supported on this GPU"sv;
+        codec.capabilities.reset();
+        return true;
+      }
 
-        // If H.264 succeeded with max ref frames specified, assume that we can count on
-        // HEVC to also succeed with max ref frames specified if HEVC is supported.
-        auto autoselect_hevc = (max_ref_frames_hevc >= 0 || max_ref_frames_h264 >= 0) ?
-                                 max_ref_frames_hevc :
-                                 validate_config(disp, encoder, config_autoselect);
+      codec.capabilities.set();
 
-        for (auto [validate_flag, encoder_flag] : packet_deficiencies) {
-          encoder.hevc[encoder_flag] = (max_ref_frames_hevc & validate_flag && autoselect_hevc & validate_flag);
-        }
+      // Split frame encoding is probed on its own, a driver without it mustn't fail the codec
+      codec[encoder_t::SPLIT_ENCODE] = false;
+      auto max_ref_frames_codec = validate_config(disp, encoder, config_codec_max_ref_frames);
 
-        encoder.hevc[encoder_t::REF_FRAMES_RESTRICT] = max_ref_frames_hevc >= 0;
-        encoder.hevc[encoder_t::PASSED] = max_ref_frames_hevc >= 0 || autoselect_hevc >= 0;
-      } else {
-        BOOST_LOG(info) << "Encoder ["sv << encoder.hevc.name << "] is not supported on this GPU"sv;
-        encoder.hevc.capabilities.reset();
+      // If H.264 succeeded with max ref frames specified, assume that we can count on
+      // this codec to also succeed with max ref frames specified if it is supported.
+      auto autoselect_codec = (max_ref_frames_codec >= 0 || max_ref_frames_h264 >= 0) ?
+                                max_ref_frames_codec :
+                                validate_config(disp, encoder, config_codec_autoselect);
+
+      for (auto [validate_flag, encoder_flag] : packet_deficiencies) {
+        codec[encoder_flag] = (max_ref_frames_codec & validate_flag && autoselect_codec & validate_flag);
       }
+
+      codec[encoder_t::REF_FRAMES_RESTRICT] = max_ref_frames_codec >= 0;
+      codec[encoder_t::PASSED] = max_ref_frames_codec >= 0 || autoselect_codec >= 0;
+      return (bool) codec[encoder_t::PASSED];
+    };
+
+    std::vector<probe_case_t> sdr_cases;
+    if (test_hevc) {
+      sdr_cases.emplace_back([&](const std::shared_ptr<platf::display_t> &disp) {
+        return probe_codec(disp, encoder.hevc, 1);
+      });
     } else {
       // Clear all cap bits for HEVC if we didn't probe it
       encoder.hevc.capabilities.reset();
     }
 
     if (test_av1) {
-      config_max_ref_frames.videoFormat = 2;
-      config_autoselect.videoFormat = 2;
+      sdr_cases.emplace_back([&](const std::shared_ptr<platf::display_t> &disp) {
+        return probe_codec(disp, encoder.av1, 2);
+      });
+    } else {
+      // Clear all cap bits for AV1 if we didn't probe it
+      encoder.av1.capabilities.reset();
+    }
+
+    // H.264 is special because encoders may support YUV 4:4:4 without supporting 10-bit color depth
+    if (encoder.flags & YUV444_SUPPORT) {
+      sdr_cases.emplace_back([&](const std::shared_ptr<platf::display_t> &disp) {
+        config_t config_h264_yuv444 {1920, 1080, 60, 6000, 1000, 1, 0, 1, 0, 0, 1};
+        if (!disp->is_codec_supported(encoder.h264.name, config_h264_yuv444)) {
+          encoder.h264[encoder_t::YUV444] = false;
+          return true;
+        }
+
+        // A failed run may have cleared the flag the encode session checks for
+        encoder.h264[encoder_t::YUV444] = true;
+        encoder.h264[encoder_t::YUV444] = validate_config(disp, encoder, config_h264_yuv444) >= 0;
+        return (bool) encoder.h264[encoder_t::YUV444];
+      });
+    } else {
+      encoder.h264[encoder_t::YUV444] = false;
+    }
 
-      if (disp->is_codec_supported(encoder.av1.name, config_autoselect)) {
-        auto max_ref_frames_av1 = validate_config(disp, encoder, config_max_ref_frames);
+    run_probe_cases(disp, encoder, output_name, config_autoselect, sdr_cases);
+
+    // NVENC split frame encoding needs a newer driver than the rest of the encoder,
+    // so it's probed at a rate where it kicks in and left off where it fails
+    auto split_encode = config::video.nv.split_encode;
+    if (dynamic_cast<const encoder_platform_formats_nvenc *>(encoder.platform_formats.get()) && split_encode != nvenc::nvenc_split_encode::disabled) {
+      auto config_split_encode = config_autoselect;
+      if (split_encode == nvenc::nvenc_split_encode::automatic) {
+        config_split_encode.width = 3840;
+        config_split_encode.height = 2160;
+        config_split_encode.framerate = 120;
+        config_split_encode.framerateX100 = 12000;
+      }
 
-        // If H.264 succeeded with max ref frames specified, assume that we can count on
-        // AV1 to also succeed with max ref frames specified if AV1 is supported.
-        auto autoselect_av1 = (max_ref_frames_av1 >= 0 || max_ref_frames_h264 >= 0) ?
-                                max_ref_frames_av1 :
-                                validate_config(disp, encoder, config_autoselect);
+      auto probe_split_encode = [&](const std::shared_ptr<platf::display_t> &disp, encoder_t::codec_t &codec, int video_format) {
+        auto config = config_split_encode;
+        config.videoFormat = video_format;
 
-        for (auto [validate_flag, encoder_flag] : packet_deficiencies) {
-          encoder.av1[encoder_flag] = (max_ref_frames_av1 & validate_flag && autoselect_av1 & validate_flag);
+        // A codec that can't encode frames this large never reaches the rate, split encoding stays off
+        if (!disp->is_codec_supported(codec.name, config)) {
+          return true;
         }
 
-        encoder.av1[encoder_t::REF_FRAMES_RESTRICT] = max_ref_frames_av1 >= 0;
-        encoder.av1[encoder_t::PASSED] = max_ref_frames_av1 >= 0 || autoselect_av1 >= 0;
-      } else {
-        BOOST_LOG(info) << "Encoder ["sv << encoder.av1.name << "] is not supported on this GPU"sv;
-        encoder.av1.capabilities.reset();
+        codec[encoder_t::SPLIT_ENCODE] = true;
+        codec[encoder_t::SPLIT_ENCODE] = validate_config(disp, encoder, config) >= 0;
+        return (bool) codec[encoder_t::SPLIT_ENCODE];
+      };
+
+      std::vector<probe_case_t> split_encode_cases;
+      if (encoder.hevc[encoder_t::PASSED]) {
+        split_encode_cases.emplace_back([&](const std::shared_ptr<platf::display_t> &disp) {
+          return probe_split_encode(disp, encoder.hevc, 1);
+        });
       }
-    } else {
-      // Clear all cap bits for AV1 if we didn't probe it
-      encoder.av1.capabilities.reset();
+      if (encoder.av1[encoder_t::PASSED]) {
+        split_encode_cases.emplace_back([&](const std::shared_ptr<platf::display_t> &disp) {
+          return probe_split_encode(disp, encoder.av1, 2);
+        });
+      }
+
+      run_probe_cases(disp, encoder, output_name, config_autoselect, split_encode_cases);
     }
 
     // Test HDR and YUV444 support
     {
-      // H.264 is special because encoders may support YUV 4:4:4 without supporting 10-bit color depth
-      if (encoder.flags & YUV444_SUPPORT) {
-        config_t config_h264_yuv444 {1920, 1080, 60, 6000, 1000, 1, 0, 1, 0, 0, 1};
-        encoder.h264[encoder_t::YUV444] = disp->is_codec_supported(encoder.h264.name, config_h264_yuv444) &&
-                                          validate_config(disp, encoder, config_h264_yuv444) >= 0;
-      } else {
-        encoder.h264[encoder_t::YUV444] = false;
-      }
-
       const config_t generic_hdr_config = {1920, 1080, 60, 6000, 1000, 1, 0, 3, 1, 1, 0};
 
       // Reset the display since we're switching from SDR to HDR
@@ -2578,43 +4360,51 @@ namespace video {
         return false;
       }
 
-      auto test_hdr_and_yuv444 = [&](auto &flag_map, auto video_format) {
+      auto test_hdr_and_yuv444 = [&](const std::shared_ptr<platf::display_t> &disp, auto &flag_map, auto video_format) {
         auto config = generic_hdr_config;
         config.videoFormat = video_format;
 
-        if (!flag_map[encoder_t::PASSED]) {
-          return;
-        }
-
         auto encoder_codec_name = encoder.codec_from_config(config).name;
 
+        // A failed run may have cleared the flags the encode session checks for
+        flag_map[encoder_t::DYNAMIC_RANGE] = true;
+        flag_map[encoder_t::YUV444] = true;
+
         // Test 4:4:4 HDR first. If 4:4:4 is supported, 4:2:0 should also be supported.
         config.chromaSamplingType = 1;
-        if ((encoder.flags & YUV444_SUPPORT) &&
-            disp->is_codec_supported(encoder_codec_name, config) &&
-            validate_config(disp, encoder, config) >= 0) {
-          flag_map[encoder_t::DYNAMIC_RANGE] = true;
-          flag_map[encoder_t::YUV444] = true;
-          return;
-        } else {
-          flag_map[encoder_t::YUV444] = false;
+        bool yuv444_supported = (encoder.flags & YUV444_SUPPORT) && disp->is_codec_supported(encoder_codec_name, config);
+        if (yuv444_supported && validate_config(disp, encoder, config) >= 0) {
+          return true;
         }
+        flag_map[encoder_t::YUV444] = false;
 
         // Test 4:2:0 HDR
         config.chromaSamplingType = 0;
-        if (disp->is_codec_supported(encoder_codec_name, config) &&
-            validate_config(disp, encoder, config) >= 0) {
-          flag_map[encoder_t::DYNAMIC_RANGE] = true;
-        } else {
+        if (!disp->is_codec_supported(encoder_codec_name, config)) {
           flag_map[encoder_t::DYNAMIC_RANGE] = false;
+          return !yuv444_supported;
         }
+
+        flag_map[encoder_t::DYNAMIC_RANGE] = validate_config(disp, encoder, config) >= 0;
+        return (bool) flag_map[encoder_t::DYNAMIC_RANGE];
       };
 
       // HDR is not supported with H.264. Don't bother even trying it.
       encoder.h264[encoder_t::DYNAMIC_RANGE] = false;
 
-      test_hdr_and_yuv444(encoder.hevc, 1);
-      test_hdr_and_yuv444(encoder.av1, 2);
+      std::vector<probe_case_t> hdr_cases;
+      if (encoder.hevc[encoder_t::PASSED]) {
+        hdr_cases.emplace_back([&](const std::shared_ptr<platf::display_t> &disp) {
+          return test_hdr_and_yuv444(disp, encoder.hevc, 1);
+        });
+      }
+      if (encoder.av1[encoder_t::PASSED]) {
+        hdr_cases.emplace_back([&](const std::shared_ptr<platf::display_t> &disp) {
+          return test_hdr_and_yuv444(disp, encoder.av1, 2);
+        });
+      }
+
+      run_probe_cases(disp, encoder, output_name, generic_hdr_config, hdr_cases);
     }
 
     encoder.h264[encoder_t::VUI_PARAMETERS] = encoder.h264[encoder_t::VUI_PARAMETERS] && !config::sunshine.flags[config::flag::FORCE_VIDEO_HEADER_REPLACE];
@@ -2631,7 +4421,147 @@ namespace video {
     return true;
   }
 
+  const std::vector<encoder_t *> &all_encoders() {
+    return encoders;
+  }
+
+  std::optional<encoder_benchmark_t> benchmark_encoder(const encoder_t &encoder, const config_t &config, int frames) {
+    const auto output_name {display_device::map_output_name(config::video.output_name)};
+
+    std::shared_ptr<platf::display_t> disp;
+    reset_display(disp, encoder.platform_formats->dev_type, output_name, config);
+    if (!disp || !disp->is_codec_supported(encoder.codec_from_config(config).name, config)) {
+      return std::nullopt;
+    }
+
+    auto encode_device = make_encode_device(*disp, encoder, config);
+    if (!encode_device) {
+      return std::nullopt;
+    }
+
+    auto session = make_encode_session(disp.get(), encoder, config, disp->width, disp->height, std::move(encode_device));
+    if (!session) {
+      return std::nullopt;
+    }
+
+    // Frames are encoded before the next one is captured, so one image will do
+    auto img = disp->alloc_img();
+    if (!img || disp->dummy_img(img.get()) || session->convert(*img)) {
+      return std::nullopt;
+    }
+
+    auto packets = mail::man->ring<packet_t>(mail::video_packets);
+
+    std::vector<double> latencies;
+    latencies.reserve(frames);
+    std::uint64_t bytes = 0;
+    std::int64_t frame_nr = 1;
+    bool failed = false;
+
+    session->request_idr_frame();
+
+    auto push_captured_image_callback = [&](std::shared_ptr<platf::img_t> &&img, bool frame_captured) -> bool {
+      auto start = std::chrono::steady_clock::now();
+
+      // Without a new frame the encoder gets the previous one again, as it does while streaming
+      if ((frame_captured && session->convert(*img)) || encode(frame_nr, *session, packets, nullptr, {})) {
+        failed = true;
+        return false;
+      }
+
+      std::chrono::duration<double, std::milli> latency = std::chrono::steady_clock::now() - start;
+      session->request_normal_frame();
+
+      while (packets->peek()) {
+        auto packet = packets->pop();
+        if (frame_nr > 1) {
+          bytes += packet->data_size();
+        }
+      }
+
+      if (frame_nr++ > 1) {
+        latencies.emplace_back(latency.count());
+      }
+
+      return latencies.size() < (std::size_t) frames;
+    };
+
+    auto pull_free_image_callback = [&img](std::shared_ptr<platf::img_t> &img_out) -> bool {
+      img_out = img;
+      img_out->frame_timestamp.reset();
+      return true;
+    };
+
+    bool cursor = false;
+    auto status = disp->capture(push_captured_image_callback, pull_free_image_callback, &cursor);
+    if (failed || status != platf::capture_e::ok || latencies.empty()) {
+      BOOST_LOG(error) << "Encoder ["sv << encoder.name << "] stopped after "sv << latencies.size() << " frames"sv;
+      return std::nullopt;
+    }
+
+    encoder_benchmark_t result;
+
+    auto total = std::accumulate(std::begin(latencies), std::end(latencies), 0.0);
+    result.latency_mean_ms = total / latencies.size();
+    result.fps = latencies.size() * 1000 / total;
+    result.bitrate_kbps = (double) bytes * 8 / 1000 * config.framerate / latencies.size();
+
+    auto p99 = std::begin(latencies) + (latencies.size() - 1) * 99 / 100;
+    std::nth_element(std::begin(latencies), p99, std::end(latencies));
+    result.latency_p99_ms = *p99;
+
+    return result;
+  }
+
+  /**
+   * @brief Measure the encode latency of each usage amd_usage = auto picks from.
+   * Every GPU generation has a different trade-off between the usages, so it's measured rather than assumed.
+   * @param encoder The encoder, validate_encoder() must have passed it.
+   */
+  void measure_amd_usages(const encoder_t &encoder) {
+    auto reset_override = util::fail_guard([]() {
+      amd::usage_override.clear();
+    });
+
+    for (int video_format = 0; video_format < (int) amd::usage_latencies.size(); ++video_format) {
+      auto &latencies = amd::usage_latencies[video_format];
+      latencies.clear();
+
+      config_t config {1920, 1080, 60, 6000, 1000, 1, 0, video_format, 0, 0, 0};
+      auto &codec = encoder.codec_from_config(config);
+      if (!codec[encoder_t::PASSED]) {
+        continue;
+      }
+
+      for (auto usage : amd::auto_usages) {
+        amd::usage_override = usage;
+
+        auto benchmark = benchmark_encoder(encoder, config, 60);
+        if (!benchmark) {
+          BOOST_LOG(warning) << "Couldn't measure AMF usage ["sv << usage << "] of ["sv << codec.name << ']';
+          continue;
+        }
+
+        BOOST_LOG(info) << "AMF usage ["sv << usage << "] of ["sv << codec.name << "] encodes a 1080p frame in "sv << benchmark->latency_mean_ms << " ms"sv;
+        latencies.push_back({std::string {usage}, benchmark->latency_mean_ms});
+      }
+    }
+  }
+
+  int probe_encoders_lazily() {
+    {
+      std::lock_guard lock {probe_mutex};
+      if (chosen_encoder) {
+        return 0;
+      }
+    }
+
+    return probe_encoders();
+  }
+
   int probe_encoders() {
+    std::lock_guard lock {probe_mutex};
+
     if (!allow_encoder_probing()) {
       // Error already logged
       return -1;
@@ -2640,17 +4570,49 @@ namespace video {
     auto encoder_list = encoders;
 
     // If we already have a good encoder, check to see if another probe is required
-    if (chosen_encoder && !(chosen_encoder->flags & ALWAYS_REPROBE) && !platf::needs_encoder_reenumeration()) {
+    if (chosen_encoder && !(chosen_encoder->flags & ALWAYS_REPROBE) && !platf::needs_encoder_reenumeration() && !encoder_cache_stale) {
       return 0;
     }
 
+    // The encoders are probed against the displays, they have to be in the mode the session asked for
+    display_device::wait_for_configuration();
+
     // Restart encoder selection
     auto previous_encoder = chosen_encoder;
     chosen_encoder = nullptr;
+    chosen_encoder_cached = false;
     active_hevc_mode = config::video.hevc_mode;
     active_av1_mode = config::video.av1_mode;
     last_encoder_probe_supported_ref_frames_invalidation = false;
 
+    // Reuse the probe results of the last run if nothing they depend on has changed,
+    // opening every encoder in every mode takes seconds on slow hardware
+    encoder_cache_stale = false;
+    encoder_cache::cache_t cache;
+    auto save_cache = util::fail_guard([&cache]() {
+      // When nothing passed, the display is more likely at fault than the encoders
+      if (chosen_encoder) {
+        cache.save();
+      }
+    });
+
+    auto probe_encoder = [&](encoder_t *encoder) {
+      if (auto passed = cache.load(*encoder)) {
+        BOOST_LOG(info) << "Using cached probe results for encoder ["sv << encoder->name << ']';
+        return *passed;
+      }
+
+      // If we've used a previous encoder and it's not this one, we expect this encoder to
+      // fail to validate. It will use a slightly different order of checks to more quickly
+      // eliminate failing encoders.
+      auto passed = validate_encoder(*encoder, previous_encoder && previous_encoder != encoder);
+      if (passed && measures_amd_usages(*encoder)) {
+        measure_amd_usages(*encoder);
+      }
+      cache.store(*encoder, passed);
+      return passed;
+    };
+
     auto adjust_encoder_constraints = [&](encoder_t *encoder) {
       // If we can't satisfy both the encoder and codec requirement, prefer the encoder over codec support
       if (active_hevc_mode == 3 && !encoder->hevc[encoder_t::DYNAMIC_RANGE]) {
@@ -2677,7 +4639,7 @@ namespace video {
 
         if (encoder->name == config::video.encoder) {
           // Remove the encoder from the list entirely if it fails validation
-          if (!validate_encoder(*encoder, previous_encoder && previous_encoder != encoder)) {
+          if (!probe_encoder(encoder)) {
             pos = encoder_list.erase(pos);
             break;
           }
@@ -2705,7 +4667,7 @@ namespace video {
         auto encoder = *pos;
 
         // Remove the encoder from the list entirely if it fails validation
-        if (!validate_encoder(*encoder, previous_encoder && previous_encoder != encoder)) {
+        if (!probe_encoder(encoder)) {
           pos = encoder_list.erase(pos);
           continue;
         }
@@ -2739,10 +4701,7 @@ namespace video {
       KITTY_WHILE_LOOP(auto pos = std::begin(encoder_list), pos != std::end(encoder_list), {
         auto encoder = *pos;
 
-        // If we've used a previous encoder and it's not this one, we expect this encoder to
-        // fail to validate. It will use a slightly different order of checks to more quickly
-        // eliminate failing encoders.
-        if (!validate_encoder(*encoder, previous_encoder && previous_encoder != encoder)) {
+        if (!probe_encoder(encoder)) {
           pos = encoder_list.erase(pos);
           continue;
         }
@@ -2771,8 +4730,11 @@ namespace video {
     BOOST_LOG(info);
 
     auto &encoder = *chosen_encoder;
+    chosen_encoder_cached = cache.hit(encoder);
 
-    last_encoder_probe_supported_ref_frames_invalidation = (encoder.flags & REF_FRAMES_INVALIDATION);
+    // Intra-refresh recovery is driven by the client's invalidation requests
+    last_encoder_probe_supported_ref_frames_invalidation = (encoder.flags & REF_FRAMES_INVALIDATION) ||
+                                                           (config::video.intra_refresh && (encoder.flags & INTRA_REFRESH));
     last_encoder_probe_supported_yuv444_for_codec[0] = encoder.h264[encoder_t::PASSED] &&
                                                        encoder.h264[encoder_t::YUV444];
     last_encoder_probe_supported_yuv444_for_codec[1] = encoder.hevc[encoder_t::PASSED] &&
@@ -2848,6 +4810,33 @@ namespace video {
     return hw_device_buf;
   }
 
+  // Linux only declaration
+  typedef int (*drm_init_avcodec_hardware_input_buffer_fn)(platf::avcodec_encode_device_t *encode_device, AVBufferRef **hw_device_buf);
+
+  util::Either<avcodec_buffer_t, int> drm_init_avcodec_hardware_input_buffer(platf::avcodec_encode_device_t *encode_device) {
+    avcodec_buffer_t hw_device_buf;
+
+    // If a V4L2 DMABUF hwdevice
+    if (encode_device->data) {
+      if (((drm_init_avcodec_hardware_input_buffer_fn) encode_device->data)(encode_device, &hw_device_buf)) {
+        return -1;
+      }
+
+      return hw_device_buf;
+    }
+
+    auto render_device = config::video.adapter_name.empty() ? nullptr : config::video.adapter_name.c_str();
+
+    auto status = av_hwdevice_ctx_create(&hw_device_buf, AV_HWDEVICE_TYPE_DRM, render_device, nullptr, 0);
+    if (status < 0) {
+      char string[AV_ERROR_MAX_STRING_SIZE];
+      BOOST_LOG(error) << "Failed to create a DRM device: "sv << av_make_error_string(string, AV_ERROR_MAX_STRING_SIZE, status);
+      return -1;
+    }
+
+    return hw_device_buf;
+  }
+
   util::Either<avcodec_buffer_t, int> cuda_init_avcodec_hardware_input_buffer(platf::avcodec_encode_device_t *encode_device) {
     avcodec_buffer_t hw_device_buf;
 
@@ -2951,6 +4940,8 @@ namespace video {
         return platf::mem_type_e::system;
       case AV_HWDEVICE_TYPE_VIDEOTOOLBOX:
         return platf::mem_type_e::videotoolbox;
+      case AV_HWDEVICE_TYPE_DRM:
+        return platf::mem_type_e::drm;
       default:
         return platf::mem_type_e::unknown;
     }
@@ -2972,6 +4963,8 @@ namespace video {
         return platf::pix_fmt_e::nv12;
       case AV_PIX_FMT_P010:
         return platf::pix_fmt_e::p010;
+      case AV_PIX_FMT_YUYV422:
+        return platf::pix_fmt_e::yuyv422;
       default:
         return platf::pix_fmt_e::unknown;
     }
@@ -2979,4 +4972,27 @@ namespace video {
     return platf::pix_fmt_e::unknown;
   }
 
+  AVPixelFormat map_av_pix_fmt(platf::pix_fmt_e fmt) {
+    switch (fmt) {
+      case platf::pix_fmt_e::ayuv:
+        return AV_PIX_FMT_VUYX;
+      case platf::pix_fmt_e::y410:
+        return AV_PIX_FMT_XV30;
+      case platf::pix_fmt_e::yuv420p10:
+        return AV_PIX_FMT_YUV420P10;
+      case platf::pix_fmt_e::yuv420p:
+        return AV_PIX_FMT_YUV420P;
+      case platf::pix_fmt_e::nv12:
+        return AV_PIX_FMT_NV12;
+      case platf::pix_fmt_e::p010:
+        return AV_PIX_FMT_P010;
+      case platf::pix_fmt_e::yuyv422:
+        return AV_PIX_FMT_YUYV422;
+      default:
+        return AV_PIX_FMT_NONE;
+    }
+
+    return AV_PIX_FMT_NONE;
+  }
+
 }  // namespace video
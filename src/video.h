@@ -4,6 +4,11 @@
  */
 #pragma once
 
+// standard includes
+#include <atomic>
+#include <deque>
+#include <mutex>
+
 // local includes
 #include "input.h"
 #include "platform/common.h"
@@ -47,6 +52,7 @@ namespace video {
 
   platf::mem_type_e map_base_dev_type(AVHWDeviceType type);
   platf::pix_fmt_e map_pix_fmt(AVPixelFormat fmt);
+  AVPixelFormat map_av_pix_fmt(platf::pix_fmt_e fmt);
 
   void free_ctx(AVCodecContext *ctx);
   void free_frame(AVFrame *frame);
@@ -126,6 +132,7 @@ namespace video {
       DYNAMIC_RANGE,  ///< HDR support.
       YUV444,  ///< YUV 4:4:4 support.
       VUI_PARAMETERS,  ///< AMD encoder with VAAPI doesn't add VUI parameters to SPS.
+      SPLIT_ENCODE,  ///< NVENC split frame encoding works with the installed driver.
       MAX_FLAGS  ///< Maximum number of flags.
     };
 
@@ -139,6 +146,7 @@ namespace video {
         _CONVERT(DYNAMIC_RANGE);
         _CONVERT(YUV444);
         _CONVERT(VUI_PARAMETERS);
+        _CONVERT(SPLIT_ENCODE);
         _CONVERT(MAX_FLAGS);
       }
 #undef _CONVERT
@@ -207,7 +215,23 @@ namespace video {
 
     virtual void request_normal_frame() = 0;
 
-    virtual void invalidate_ref_frames(int64_t first_frame, int64_t last_frame) = 0;
+    /**
+     * @brief Recover the client from lost frames.
+     * @param first_frame The first frame the client lost.
+     * @param last_frame The last frame the client lost.
+     * @return `true` if the next frame is encoded as an IDR frame for it.
+     */
+    virtual bool invalidate_ref_frames(int64_t first_frame, int64_t last_frame) = 0;
+
+    /**
+     * @brief Change the bitrate of the running encoder.
+     * @param bitrate_kbps The new bitrate in kilobits per second.
+     * @return `true` on success, `false` if the encoder can't change its bitrate without a new session.
+     */
+    virtual bool set_bitrate(int bitrate_kbps) = 0;
+
+    // When conversion of the current frame started, unset if the frame is a repeat
+    std::optional<std::chrono::steady_clock::time_point> convert_timestamp;
   };
 
   // encoders
@@ -224,6 +248,7 @@ namespace video {
 
 #ifdef __linux__
   extern encoder_t vaapi;
+  extern encoder_t v4l2m2m;
 #endif
 
 #ifdef __APPLE__
@@ -257,6 +282,25 @@ namespace video {
     void *channel_data = nullptr;
     bool after_ref_frame_invalidation = false;
     std::optional<std::chrono::steady_clock::time_point> frame_timestamp;
+
+    /**
+     * @brief Stage boundaries of a newly captured frame, for the per stage latency histograms.
+     */
+    struct stage_timestamps_t {
+      std::chrono::steady_clock::time_point convert_start;
+      std::chrono::steady_clock::time_point encode_start;
+      std::chrono::steady_clock::time_point encode_end;
+    };
+
+    std::optional<stage_timestamps_t> stage_timestamps;
+
+    /**
+     * @brief Position of a partial-frame packet in its frame.
+     * Encoders that read back slices while the rest of the frame is still being encoded send every group of
+     * slices as soon as it's done, in order and with the same frame index. A whole frame is group 0 of 1.
+     */
+    int slice_group = 0;
+    int slice_groups = 1;  ///< Groups the frame is sent in, at most one per FEC block of the frame.
   };
 
   struct packet_raw_avcodec: packet_raw_t {
@@ -287,6 +331,36 @@ namespace video {
     AVPacket *av_packet;
   };
 
+  /**
+   * @brief Recycles the buffers of encoded frames, so a warm pool encodes without allocating.
+   */
+  class frame_buffer_pool_t {
+  public:
+    std::vector<uint8_t> take() {
+      std::lock_guard lg {lock};
+      if (buffers.empty()) {
+        return {};
+      }
+
+      auto buffer = std::move(buffers.back());
+      buffers.pop_back();
+      return buffer;
+    }
+
+    void give_back(std::vector<uint8_t> &&buffer) {
+      std::lock_guard lg {lock};
+      if (buffers.size() < max_buffers) {
+        buffers.emplace_back(std::move(buffer));
+      }
+    }
+
+  private:
+    static constexpr std::size_t max_buffers = 8;
+
+    std::mutex lock;
+    std::vector<std::vector<uint8_t>> buffers;
+  };
+
   struct packet_raw_generic: packet_raw_t {
     packet_raw_generic(std::vector<uint8_t> &&frame_data, int64_t frame_index, bool idr):
         frame_data {std::move(frame_data)},
@@ -294,6 +368,12 @@ namespace video {
         idr {idr} {
     }
 
+    ~packet_raw_generic() override {
+      if (pool) {
+        pool->give_back(std::move(frame_data));
+      }
+    }
+
     bool is_idr() override {
       return idr;
     }
@@ -313,6 +393,7 @@ namespace video {
     std::vector<uint8_t> frame_data;
     int64_t index;
     bool idr;
+    std::shared_ptr<frame_buffer_pool_t> pool;  ///< Takes frame_data back once the packet is sent
   };
 
   using packet_t = std::unique_ptr<packet_raw_t>;
@@ -331,6 +412,120 @@ namespace video {
 
   using hdr_info_t = std::unique_ptr<hdr_info_raw_t>;
 
+  /**
+   * @brief Tracks which parts of a stream of captured images change, by hashing tiles of each image.
+   */
+  class frame_damage_t {
+  public:
+    // Width and height of a tile in pixels
+    static constexpr int TILE_SIZE = 64;
+
+    /**
+     * @brief Compare an image with the previous one.
+     * Images that carry the damage reported by the capture backend aren't hashed.
+     * @param img The captured image.
+     * @return Number of tiles that changed, every tile counts as changed for images that can't be compared.
+     */
+    int damaged_tiles(const platf::img_t &img);
+
+    /**
+     * @brief Forget the previous image, so the next one counts as changed.
+     */
+    void reset();
+
+  private:
+    std::vector<std::uint64_t> tile_hashes;
+    int width = 0;
+    int height = 0;
+  };
+
+  /**
+   * @brief Pool of the images the capture thread fills for the encoders.
+   * Only the capture thread acquires images. The encoders return them without taking a lock
+   * by dropping their last reference, so acquiring and returning an image are O(1).
+   */
+  class img_pool_t {
+  public:
+    /**
+     * @brief Occupancy of the pool.
+     */
+    struct stats_t {
+      std::size_t allocated;  ///< Images currently allocated
+      std::size_t in_use;  ///< Images held by the capture backend or the encoders
+      std::size_t peak_in_use;
+      std::uint64_t allocations;  ///< Images allocated since the pool was created
+      std::uint64_t exhausted;  ///< Times acquire() found every image in use
+    };
+
+    using alloc_img_f = std::function<std::shared_ptr<platf::img_t>()>;
+
+    /**
+     * @param capacity Maximum number of images.
+     * @param trim_timeout Unused images above the recent peak usage are freed after this long.
+     */
+    explicit img_pool_t(std::size_t capacity, std::chrono::steady_clock::duration trim_timeout = std::chrono::seconds {3});
+
+    /**
+     * @brief Take a free image, allocating a new one while the pool isn't full.
+     * The most recently returned image is reused first.
+     * @param alloc_img Allocates an image when no free image is left.
+     * @return The image, or nullptr if every image is in use.
+     */
+    std::shared_ptr<platf::img_t> acquire(const alloc_img_f &alloc_img);
+
+    /**
+     * @brief Free all images that aren't in use and keep images still in use from coming back.
+     * Images can hold references to the display they were allocated for, call this when the display goes away.
+     * Calling it again frees the images returned in the meantime.
+     */
+    void reset();
+
+    /**
+     * @brief Check whether every image is held by the capture backend or the encoders.
+     * Doesn't take a lock, so the backends can ask before they grab a frame nobody could take.
+     * @return `true` if acquire() would have to wait for an encoder to return an image.
+     */
+    bool full() const;
+
+    stats_t stats() const;
+
+  private:
+    struct slot_t {
+      std::shared_ptr<platf::img_t> img;
+      std::uint32_t generation = 0;
+      int next = -1;
+    };
+
+    struct shared_t {
+      explicit shared_t(std::size_t capacity):
+          slots(capacity) {
+      }
+
+      std::vector<slot_t> slots;
+
+      // Stack of slots the encoders returned, linked through slot_t::next
+      std::atomic<int> returned {-1};
+      std::atomic<std::size_t> in_use {0};
+    };
+
+    void collect();
+    void trim();
+
+    std::shared_ptr<shared_t> shared;
+    std::uint32_t generation = 0;
+
+    // Free slots with the most recently used one in front, and slots without image
+    std::deque<int> free_slots;
+    std::vector<int> empty_slots;
+
+    std::chrono::steady_clock::duration trim_timeout;
+    std::vector<std::optional<std::chrono::steady_clock::time_point>> in_use_timestamps;
+
+    std::size_t peak_in_use = 0;
+    std::uint64_t allocations = 0;
+    std::uint64_t exhausted = 0;
+  };
+
   extern int active_hevc_mode;
   extern int active_av1_mode;
   extern bool last_encoder_probe_supported_ref_frames_invalidation;
@@ -342,8 +537,43 @@ namespace video {
     void *channel_data
   );
 
+  /**
+   * @brief Start opening the display and the encoder for a stream in the background, ahead of capture().
+   * The capture thread takes the display if it opens the same display with the same configuration,
+   * otherwise the display is closed again. Once the display is open, the encode session is opened on it
+   * for encoders that run on their own thread, and the encode thread takes it the same way.
+   * @param config The configuration the client announced.
+   * @warning Only call this when no client is streaming, the capture thread doesn't need a new display otherwise.
+   */
+  void prepare_display(const config_t &config);
+
   bool validate_encoder(encoder_t &encoder, bool expect_failure);
 
+  /**
+   * @brief The encoders of this build, in the order they're probed.
+   */
+  const std::vector<encoder_t *> &all_encoders();
+
+  /**
+   * @brief How an encoder performed on a run of frames.
+   */
+  struct encoder_benchmark_t {
+    double latency_mean_ms;  ///< Converting and encoding a frame
+    double latency_p99_ms;
+    double fps;  ///< Frames per second when the encoder is kept busy
+    double bitrate_kbps;  ///< Bitrate of the frames at the frame rate of the configuration
+  };
+
+  /**
+   * @brief Encode frames captured from the display back to back.
+   * The IDR frame the encoder starts with isn't counted.
+   * @param encoder The encoder, validate_encoder() must have passed it for the options of the configuration.
+   * @param config The stream configuration.
+   * @param frames The number of frames to measure.
+   * @return The measurements, or `std::nullopt` if the encoder couldn't encode the frames.
+   */
+  std::optional<encoder_benchmark_t> benchmark_encoder(const encoder_t &encoder, const config_t &config, int frames);
+
   /**
    * @brief Probe encoders and select the preferred encoder.
    * This is called once at startup and each time a stream is launched to
@@ -354,6 +584,53 @@ namespace video {
    */
   int probe_encoders();
 
+  /**
+   * @brief Probe the encoders unless a previous probe already selected one.
+   * With lazy_encoder_probe this runs when the first client connects, in place of the probe at startup.
+   *
+   * @warning This is only safe to call when there is no client actively streaming.
+   */
+  int probe_encoders_lazily();
+
+  /**
+   * @brief Probe the encoders again after their settings changed.
+   * Only the encoders whose settings changed are validated again, the others reuse their cached probe results.
+   *
+   * @warning This is only safe to call when there is no client actively streaming.
+   */
+  int reprobe_encoders();
+
+  /**
+   * @brief Build the SVT-AV1 parameters of the realtime profile the software encoder uses for AV1.
+   * Low delay prediction without lookahead or scene change detection, so every frame leaves the
+   * encoder as soon as it is encoded, and tiles so that the frame can be encoded on min_threads threads.
+   * @param width Width of the stream.
+   * @param height Height of the stream.
+   * @param threads Number of threads the frame should be split across.
+   * @return The value of the svtav1-params option.
+   */
+  std::string svtav1_realtime_params(int width, int height, int threads);
+
+  /**
+   * @brief Encode latency of an AMF usage, measured by the encoder probe when amd_usage is auto.
+   */
+  struct amd_usage_latency_t {
+    std::string usage;  ///< Name of the usage, as the usage option of the AMF encoders takes it
+    double latency_ms;  ///< Converting and encoding a 1080p frame
+  };
+
+  /**
+   * @brief Pick the AMF usage of a stream from the usages the probe measured.
+   * Encode latency is taken to grow with the pixel count, and a usage has to leave half the
+   * frame time to the rest of the pipeline.
+   * @param latencies The measured usages, from the highest quality to the lowest latency.
+   * @param width Width of the stream.
+   * @param height Height of the stream.
+   * @param framerate Frame rate of the stream.
+   * @return The first usage that fits the stream, the fastest one if none does.
+   */
+  std::string pick_amd_usage(const std::vector<amd_usage_latency_t> &latencies, int width, int height, int framerate);
+
   // Several NTSC standard refresh rates are hardcoded here, because their
   // true rate requires a denominator of 1001. ffmpeg's av_d2q() would assume it could
   // reduce 29.97 to 2997/100 but this would be slightly wrong. We also include
@@ -21,6 +21,7 @@ namespace video {
     colorspace_e colorspace;
     bool full_range;
     unsigned bit_depth;
+    bool tone_map = false;  ///< The captured image is BT.2020 with ST 2084 and has to be mapped into this SDR colorspace
   };
 
   bool colorspace_is_hdr(const sunshine_colorspace_t &colorspace);
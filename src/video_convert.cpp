@@ -0,0 +1,297 @@
+/**
+ * @file src/video_convert.cpp
+ * @brief Definitions for converting captured images to YUV on the CPU.
+ */
+// standard includes
+#include <algorithm>
+#include <cmath>
+
+// platform includes
+#if defined(__ARM_NEON)
+  #include <arm_neon.h>
+#endif
+
+// local includes
+#include "video_convert.h"
+
+namespace video::convert {
+  namespace {
+    constexpr int FRACTION_BITS = 14;
+
+    std::uint8_t apply(const std::int16_t (&m)[3], std::int32_t add, int r, int g, int b) {
+      return (std::uint8_t) std::clamp((m[0] * r + m[1] * g + m[2] * b + add) >> FRACTION_BITS, 0, 255);
+    }
+
+    /**
+     * @brief Planes of a 4:2:0 image, with NV12 as planar chroma that's 2 bytes apart.
+     */
+    struct yuv420_t {
+      std::uint8_t *y;
+      std::uint8_t *u;
+      std::uint8_t *v;
+      int y_pitch;
+      int u_pitch;
+      int v_pitch;
+    };
+
+#if defined(__ARM_NEON)
+    int16x8_t widen(uint8x8_t x) {
+      return vreinterpretq_s16_u16(vmovl_u8(x));
+    }
+
+    int16x4_t dot(int16x4_t r, int16x4_t g, int16x4_t b, const std::int16_t (&m)[3], int32x4_t add) {
+      return vshrn_n_s32(vmlal_n_s16(vmlal_n_s16(vmlal_n_s16(add, r, m[0]), g, m[1]), b, m[2]), FRACTION_BITS);
+    }
+
+    uint8x8_t apply(int16x8_t r, int16x8_t g, int16x8_t b, const std::int16_t (&m)[3], std::int32_t add) {
+      auto add_v = vdupq_n_s32(add);
+      auto lo = dot(vget_low_s16(r), vget_low_s16(g), vget_low_s16(b), m, add_v);
+      auto hi = dot(vget_high_s16(r), vget_high_s16(g), vget_high_s16(b), m, add_v);
+
+      return vqmovun_s16(vcombine_s16(lo, hi));
+    }
+
+    /**
+     * @brief Apply one row of the matrix to 16 pixels, one output per pixel.
+     */
+    void component(const uint8x16x4_t &bgr0, std::uint8_t *out, const std::int16_t (&m)[3], std::int32_t add) {
+      vst1_u8(out, apply(widen(vget_low_u8(bgr0.val[2])), widen(vget_low_u8(bgr0.val[1])), widen(vget_low_u8(bgr0.val[0])), m, add));
+      vst1_u8(out + 8, apply(widen(vget_high_u8(bgr0.val[2])), widen(vget_high_u8(bgr0.val[1])), widen(vget_high_u8(bgr0.val[0])), m, add));
+    }
+
+    void luma(const uint8x16x4_t &bgr0, std::uint8_t *y, const coefficients_t &c) {
+      component(bgr0, y, c.y, c.y_add);
+    }
+
+    /**
+     * @brief Rounded average of the 2x2 blocks of two rows of 16 pixels.
+     */
+    int16x8_t average(uint8x16_t row0, uint8x16_t row1) {
+      return vreinterpretq_s16_u16(vrshrq_n_u16(vpadalq_u8(vpaddlq_u8(row0), row1), 2));
+    }
+
+    /**
+     * @brief Convert 16 pixels of two rows at a time.
+     * @return The number of pixels converted, the rest of the rows is left to the scalar loop.
+     */
+    template<bool nv12>
+    int convert_rows_simd(const std::uint8_t *row0, const std::uint8_t *row1, bool luma1, std::uint8_t *y0, std::uint8_t *y1, std::uint8_t *u, std::uint8_t *v, int width, const coefficients_t &c) {
+      int x = 0;
+      for (; x + 16 <= width; x += 16) {
+        auto p0 = vld4q_u8(row0 + x * 4);
+        auto p1 = vld4q_u8(row1 + x * 4);
+
+        luma(p0, y0 + x, c);
+        if (luma1) {
+          luma(p1, y1 + x, c);
+        }
+
+        auto r = average(p0.val[2], p1.val[2]);
+        auto g = average(p0.val[1], p1.val[1]);
+        auto b = average(p0.val[0], p1.val[0]);
+
+        auto u_v = apply(r, g, b, c.u, c.uv_add);
+        auto v_v = apply(r, g, b, c.v, c.uv_add);
+        if constexpr (nv12) {
+          vst2_u8(u + x, (uint8x8x2_t {{u_v, v_v}}));
+        } else {
+          vst1_u8(u + x / 2, u_v);
+          vst1_u8(v + x / 2, v_v);
+        }
+      }
+
+      return x;
+    }
+
+    /**
+     * @brief Convert 16 pixels of a row to 4:4:4 at a time.
+     * @return The number of pixels converted, the rest of the row is left to the scalar loop.
+     */
+    int convert_row_444_simd(const std::uint8_t *row, std::uint8_t *y, std::uint8_t *u, std::uint8_t *v, int width, const coefficients_t &c) {
+      int x = 0;
+      for (; x + 16 <= width; x += 16) {
+        auto p = vld4q_u8(row + x * 4);
+
+        component(p, y + x, c.y, c.y_add);
+        component(p, u + x, c.u, c.uv_add);
+        component(p, v + x, c.v, c.uv_add);
+      }
+
+      return x;
+    }
+
+    /**
+     * @brief Repack 32 YUYV pixels of two rows at a time.
+     * @return The number of pixels repacked, the rest of the rows is left to the scalar loop.
+     */
+    template<bool nv12>
+    int repack_rows_simd(const std::uint8_t *row0, const std::uint8_t *row1, bool luma1, std::uint8_t *y0, std::uint8_t *y1, std::uint8_t *u, std::uint8_t *v, int width) {
+      int x = 0;
+      for (; x + 32 <= width; x += 32) {
+        // Y0 U Y1 V of 16 pixel pairs
+        auto p0 = vld4q_u8(row0 + x * 2);
+        auto p1 = vld4q_u8(row1 + x * 2);
+
+        vst2q_u8(y0 + x, (uint8x16x2_t {{p0.val[0], p0.val[2]}}));
+        if (luma1) {
+          vst2q_u8(y1 + x, (uint8x16x2_t {{p1.val[0], p1.val[2]}}));
+        }
+
+        auto u_v = vrhaddq_u8(p0.val[1], p1.val[1]);
+        auto v_v = vrhaddq_u8(p0.val[3], p1.val[3]);
+        if constexpr (nv12) {
+          vst2q_u8(u + x, (uint8x16x2_t {{u_v, v_v}}));
+        } else {
+          vst1q_u8(u + x / 2, u_v);
+          vst1q_u8(v + x / 2, v_v);
+        }
+      }
+
+      return x;
+    }
+#else
+    template<bool nv12>
+    int repack_rows_simd(const std::uint8_t *, const std::uint8_t *, bool, std::uint8_t *, std::uint8_t *, std::uint8_t *, std::uint8_t *, int) {
+      return 0;
+    }
+
+    template<bool nv12>
+    int convert_rows_simd(const std::uint8_t *, const std::uint8_t *, bool, std::uint8_t *, std::uint8_t *, std::uint8_t *, std::uint8_t *, int, const coefficients_t &) {
+      return 0;
+    }
+
+    int convert_row_444_simd(const std::uint8_t *, std::uint8_t *, std::uint8_t *, std::uint8_t *, int, const coefficients_t &) {
+      return 0;
+    }
+#endif
+
+    template<bool nv12>
+    void bgr0_to_yuv420(const std::uint8_t *src, std::ptrdiff_t src_pitch, const yuv420_t &dst, int width, int height, const coefficients_t &c) {
+      constexpr int uv_step = nv12 ? 2 : 1;
+
+      for (int y = 0; y < height; y += 2) {
+        // The last row of an odd height is its own pair
+        bool luma1 = y + 1 < height;
+        auto row0 = src + y * src_pitch;
+        auto row1 = luma1 ? row0 + src_pitch : row0;
+        auto y0 = dst.y + y * dst.y_pitch;
+        auto y1 = y0 + dst.y_pitch;
+        auto u = dst.u + (y / 2) * dst.u_pitch;
+        auto v = dst.v + (y / 2) * dst.v_pitch;
+
+        auto x = convert_rows_simd<nv12>(row0, row1, luma1, y0, y1, u, v, width, c);
+
+        for (int px = x; px < width; ++px) {
+          auto p0 = row0 + px * 4;
+          auto p1 = row1 + px * 4;
+          y0[px] = apply(c.y, c.y_add, p0[2], p0[1], p0[0]);
+          if (luma1) {
+            y1[px] = apply(c.y, c.y_add, p1[2], p1[1], p1[0]);
+          }
+        }
+
+        for (int cx = x / 2; cx < (width + 1) / 2; ++cx) {
+          // The last column of an odd width is its own pair
+          auto left = cx * 2 * 4;
+          auto right = std::min(cx * 2 + 1, width - 1) * 4;
+
+          int rgb[3];
+          for (int i = 0; i < 3; ++i) {
+            rgb[i] = (row0[left + 2 - i] + row0[right + 2 - i] + row1[left + 2 - i] + row1[right + 2 - i] + 2) >> 2;
+          }
+
+          u[cx * uv_step] = apply(c.u, c.uv_add, rgb[0], rgb[1], rgb[2]);
+          v[cx * uv_step] = apply(c.v, c.uv_add, rgb[0], rgb[1], rgb[2]);
+        }
+      }
+    }
+
+    template<bool nv12>
+    void yuyv_to_yuv420(const std::uint8_t *src, std::ptrdiff_t src_pitch, const yuv420_t &dst, int width, int height) {
+      constexpr int uv_step = nv12 ? 2 : 1;
+
+      for (int y = 0; y < height; y += 2) {
+        // The last row of an odd height is its own pair
+        bool luma1 = y + 1 < height;
+        auto row0 = src + y * src_pitch;
+        auto row1 = luma1 ? row0 + src_pitch : row0;
+        auto y0 = dst.y + y * dst.y_pitch;
+        auto y1 = y0 + dst.y_pitch;
+        auto u = dst.u + (y / 2) * dst.u_pitch;
+        auto v = dst.v + (y / 2) * dst.v_pitch;
+
+        auto x = repack_rows_simd<nv12>(row0, row1, luma1, y0, y1, u, v, width);
+
+        for (int px = x; px < width; ++px) {
+          y0[px] = row0[px * 2];
+          if (luma1) {
+            y1[px] = row1[px * 2];
+          }
+        }
+
+        // Every pixel pair carries one U and one V, even the last pixel of an odd width
+        for (int cx = x / 2; cx < (width + 1) / 2; ++cx) {
+          u[cx * uv_step] = (row0[cx * 4 + 1] + row1[cx * 4 + 1] + 1) >> 1;
+          v[cx * uv_step] = (row0[cx * 4 + 3] + row1[cx * 4 + 3] + 1) >> 1;
+        }
+      }
+    }
+  }  // namespace
+
+  coefficients_t coefficients_from_colorspace(const sunshine_colorspace_t &colorspace) {
+    auto eight_bit = colorspace;
+    eight_bit.bit_depth = 8;
+    auto vectors = color_vectors_from_colorspace(eight_bit, false);
+
+    // The vectors take RGB from 0 to 1, scale them for RGB from 0 to 255 instead
+    auto factor = [](float x) {
+      return (std::int16_t) std::lround(x / 255.0 * (1 << FRACTION_BITS));
+    };
+    auto offset = [](float x) {
+      return (std::int32_t) std::lround(x * (1 << FRACTION_BITS));
+    };
+
+    coefficients_t coefficients;
+    for (int i = 0; i < 3; ++i) {
+      coefficients.y[i] = factor(vectors->color_vec_y[i]);
+      coefficients.u[i] = factor(vectors->color_vec_u[i]);
+      coefficients.v[i] = factor(vectors->color_vec_v[i]);
+    }
+    coefficients.y_add = offset(vectors->color_vec_y[3]);
+    coefficients.uv_add = offset(vectors->color_vec_u[3]);
+
+    return coefficients;
+  }
+
+  void bgr0_to_nv12(const std::uint8_t *src, std::ptrdiff_t src_pitch, std::uint8_t *const dst[2], const int dst_pitch[2], int width, int height, const coefficients_t &coefficients) {
+    bgr0_to_yuv420<true>(src, src_pitch, {dst[0], dst[1], dst[1] + 1, dst_pitch[0], dst_pitch[1], dst_pitch[1]}, width, height, coefficients);
+  }
+
+  void bgr0_to_i420(const std::uint8_t *src, std::ptrdiff_t src_pitch, std::uint8_t *const dst[3], const int dst_pitch[3], int width, int height, const coefficients_t &coefficients) {
+    bgr0_to_yuv420<false>(src, src_pitch, {dst[0], dst[1], dst[2], dst_pitch[0], dst_pitch[1], dst_pitch[2]}, width, height, coefficients);
+  }
+
+  void bgr0_to_yuv444p(const std::uint8_t *src, std::ptrdiff_t src_pitch, std::uint8_t *const dst[3], const int dst_pitch[3], int width, int height, const coefficients_t &c) {
+    for (int y = 0; y < height; ++y) {
+      auto row = src + y * src_pitch;
+      auto y_row = dst[0] + y * dst_pitch[0];
+      auto u_row = dst[1] + y * dst_pitch[1];
+      auto v_row = dst[2] + y * dst_pitch[2];
+
+      for (int x = convert_row_444_simd(row, y_row, u_row, v_row, width, c); x < width; ++x) {
+        auto p = row + x * 4;
+        y_row[x] = apply(c.y, c.y_add, p[2], p[1], p[0]);
+        u_row[x] = apply(c.u, c.uv_add, p[2], p[1], p[0]);
+        v_row[x] = apply(c.v, c.uv_add, p[2], p[1], p[0]);
+      }
+    }
+  }
+
+  void yuyv_to_nv12(const std::uint8_t *src, std::ptrdiff_t src_pitch, std::uint8_t *const dst[2], const int dst_pitch[2], int width, int height) {
+    yuyv_to_yuv420<true>(src, src_pitch, {dst[0], dst[1], dst[1] + 1, dst_pitch[0], dst_pitch[1], dst_pitch[1]}, width, height);
+  }
+
+  void yuyv_to_i420(const std::uint8_t *src, std::ptrdiff_t src_pitch, std::uint8_t *const dst[3], const int dst_pitch[3], int width, int height) {
+    yuyv_to_yuv420<false>(src, src_pitch, {dst[0], dst[1], dst[2], dst_pitch[0], dst_pitch[1], dst_pitch[2]}, width, height);
+  }
+}  // namespace video::convert
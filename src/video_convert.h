@@ -0,0 +1,88 @@
+/**
+ * @file src/video_convert.h
+ * @brief Declarations for converting captured images to YUV on the CPU.
+ */
+#pragma once
+
+// standard includes
+#include <cstddef>
+#include <cstdint>
+
+// local includes
+#include "video_colorspace.h"
+
+namespace video::convert {
+  /**
+   * @brief Set when the conversions below are vectorized on this CPU.
+   * Otherwise they're plain C++, which libswscale beats with its own SIMD code.
+   */
+#if defined(__ARM_NEON)
+  constexpr bool accelerated = true;
+#else
+  constexpr bool accelerated = false;
+#endif
+
+  /**
+   * @brief RGB to YUV matrix in 2.14 fixed point, for 8 bit RGB in and 8 bit YUV out.
+   */
+  struct coefficients_t {
+    std::int16_t y[3];  ///< R, G and B factors of Y
+    std::int16_t u[3];
+    std::int16_t v[3];
+    std::int32_t y_add;  ///< Offset of Y, including rounding
+    std::int32_t uv_add;
+  };
+
+  /**
+   * @brief Get the fixed point matrix of an 8 bit colorspace.
+   */
+  coefficients_t coefficients_from_colorspace(const sunshine_colorspace_t &colorspace);
+
+  /**
+   * @brief Convert a BGR0 image to NV12 with a 2x2 box filter for chroma.
+   * @param src First pixel of the image.
+   * @param src_pitch Bytes per row of the image.
+   * @param dst Y and interleaved UV planes.
+   * @param dst_pitch Bytes per row of each plane.
+   * @param width Width of the image.
+   * @param height Height of the image.
+   * @param coefficients The matrix of the target colorspace.
+   */
+  void bgr0_to_nv12(const std::uint8_t *src, std::ptrdiff_t src_pitch, std::uint8_t *const dst[2], const int dst_pitch[2], int width, int height, const coefficients_t &coefficients);
+
+  /**
+   * @brief Convert a BGR0 image to I420 with a 2x2 box filter for chroma.
+   * @param dst Y, U and V planes.
+   * @param dst_pitch Bytes per row of each plane.
+   * @see bgr0_to_nv12
+   */
+  void bgr0_to_i420(const std::uint8_t *src, std::ptrdiff_t src_pitch, std::uint8_t *const dst[3], const int dst_pitch[3], int width, int height, const coefficients_t &coefficients);
+
+  /**
+   * @brief Convert a BGR0 image to planar 4:4:4, without any chroma filter.
+   * @param dst Y, U and V planes.
+   * @param dst_pitch Bytes per row of each plane.
+   * @see bgr0_to_nv12
+   */
+  void bgr0_to_yuv444p(const std::uint8_t *src, std::ptrdiff_t src_pitch, std::uint8_t *const dst[3], const int dst_pitch[3], int width, int height, const coefficients_t &coefficients);
+
+  /**
+   * @brief Repack a YUYV 4:2:2 image to NV12, chroma is the average of each pair of rows.
+   * The samples are copied as they are, so the image has to be in the colorspace and range of the encoder.
+   * @param src First pixel of the image.
+   * @param src_pitch Bytes per row of the image.
+   * @param dst Y and interleaved UV planes.
+   * @param dst_pitch Bytes per row of each plane.
+   * @param width Width of the image.
+   * @param height Height of the image.
+   */
+  void yuyv_to_nv12(const std::uint8_t *src, std::ptrdiff_t src_pitch, std::uint8_t *const dst[2], const int dst_pitch[2], int width, int height);
+
+  /**
+   * @brief Repack a YUYV 4:2:2 image to I420.
+   * @param dst Y, U and V planes.
+   * @param dst_pitch Bytes per row of each plane.
+   * @see yuyv_to_nv12
+   */
+  void yuyv_to_i420(const std::uint8_t *src, std::ptrdiff_t src_pitch, std::uint8_t *const dst[3], const int dst_pitch[3], int width, int height);
+}  // namespace video::convert
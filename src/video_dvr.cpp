@@ -0,0 +1,573 @@
+/**
+ * @file src/video_dvr.cpp
+ * @brief Definitions for the DVR, which keeps the last minutes of the streamed video in a ring file.
+ */
+// standard includes
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <iomanip>
+#include <optional>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+
+// platform includes
+#ifdef _WIN32
+  #include <windows.h>
+#else
+  #include <fcntl.h>
+  #include <sys/mman.h>
+  #include <unistd.h>
+#endif
+
+// lib includes
+extern "C" {
+#include <libavformat/avformat.h>
+}
+
+// local includes
+#include "config.h"
+#include "logging.h"
+#include "thread_safe.h"
+#include "utility.h"
+#include "video_dvr.h"
+
+using namespace std::literals;
+
+namespace video::dvr {
+  namespace fs = std::filesystem;
+
+  namespace {
+    constexpr char MAGIC[8] {'S', 'U', 'N', 'D', 'V', 'R', 0, 0};
+
+    // Key frames are requested at most this often, a client asking for one gets it anyway
+    constexpr auto KEY_FRAME_REQUEST_INTERVAL = 1s;
+
+    // Another encoder is only mirrored once the mirrored one stopped sending for this long
+    constexpr auto SOURCE_TIMEOUT = 1s;
+
+    std::int64_t to_ns(std::chrono::steady_clock::time_point time) {
+      return std::chrono::duration_cast<std::chrono::nanoseconds>(time.time_since_epoch()).count();
+    }
+
+    /**
+     * @brief A ring mapped from a file, unmapped when destroyed.
+     */
+    class mapped_ring_t: public ring_t {
+    public:
+#ifdef _WIN32
+      mapped_ring_t(HANDLE file, HANDLE mapping, void *view):
+          ring_t {(header_t *) view, (std::uint8_t *) view + RING_OFFSET},
+          file {file},
+          mapping {mapping},
+          view {view} {
+      }
+
+      ~mapped_ring_t() override {
+        UnmapViewOfFile(view);
+        CloseHandle(mapping);
+        CloseHandle(file);
+      }
+
+    private:
+      HANDLE file;
+      HANDLE mapping;
+      void *view;
+#else
+      mapped_ring_t(void *view, std::size_t size):
+          ring_t {(header_t *) view, (std::uint8_t *) view + RING_OFFSET},
+          view {view},
+          size {size} {
+      }
+
+      ~mapped_ring_t() override {
+        munmap(view, size);
+      }
+
+    private:
+      void *view;
+      std::size_t size;
+#endif
+    };
+
+    /**
+     * @brief Map the file, grown or shrunk to `size` bytes.
+     * @return The mapping, or nullptr on failure.
+     */
+    std::unique_ptr<ring_t> map_file(const fs::path &path, std::uint64_t size) {
+#ifdef _WIN32
+      auto file = CreateFileW(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, nullptr, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+      if (file == INVALID_HANDLE_VALUE) {
+        BOOST_LOG(error) << "DVR: couldn't open "sv << path.string() << ": "sv << GetLastError();
+        return nullptr;
+      }
+
+      LARGE_INTEGER file_size;
+      file_size.QuadPart = (LONGLONG) size;
+      auto mapping = SetFilePointerEx(file, file_size, nullptr, FILE_BEGIN) && SetEndOfFile(file) ?
+                       CreateFileMappingW(file, nullptr, PAGE_READWRITE, 0, 0, nullptr) :
+                       nullptr;
+      auto view = mapping ? MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, size) : nullptr;
+      if (!view) {
+        BOOST_LOG(error) << "DVR: couldn't map "sv << path.string() << ": "sv << GetLastError();
+        if (mapping) {
+          CloseHandle(mapping);
+        }
+        CloseHandle(file);
+        return nullptr;
+      }
+
+      return std::make_unique<mapped_ring_t>(file, mapping, view);
+#else
+      auto fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+      if (fd < 0) {
+        BOOST_LOG(error) << "DVR: couldn't open "sv << path.string() << ": "sv << std::strerror(errno);
+        return nullptr;
+      }
+      auto fg = util::fail_guard([fd]() {
+        close(fd);
+      });
+
+      if (ftruncate(fd, (off_t) size) < 0) {
+        BOOST_LOG(error) << "DVR: couldn't size "sv << path.string() << ": "sv << std::strerror(errno);
+        return nullptr;
+      }
+
+      // The mapping keeps the file open
+      auto view = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+      if (view == MAP_FAILED) {
+        BOOST_LOG(error) << "DVR: couldn't map "sv << path.string() << ": "sv << std::strerror(errno);
+        return nullptr;
+      }
+
+      return std::make_unique<mapped_ring_t>(view, size);
+#endif
+    }
+
+    /**
+     * @brief A frame copied by mirror(), on its way to the DVR thread.
+     */
+    struct mirrored_t {
+      record_t record;
+      std::vector<std::uint8_t> data;
+    };
+
+    class recorder_t: public platf::deinit_t {
+    public:
+      recorder_t(std::unique_ptr<ring_t> ring, fs::path path, std::chrono::seconds key_frame_interval):
+          ring {std::move(ring)},
+          path {std::move(path)},
+          key_frame_interval {key_frame_interval} {
+        thread = std::thread {&recorder_t::run, this};
+      }
+
+      ~recorder_t() override;
+
+      bool mirror(packet_raw_t &packet, const config_t &config) {
+        auto now = std::chrono::steady_clock::now();
+        auto first_part = packet.slice_group == 0;
+        auto key_frame = first_part && packet.is_idr();
+
+        // Follow one encoder, another one is only picked up at a key frame once the followed one went quiet
+        auto followed = source.load(std::memory_order_acquire);
+        if (followed != packet.channel_data) {
+          if (followed && to_ns(now) - last_mirror.load(std::memory_order_relaxed) < std::chrono::nanoseconds {SOURCE_TIMEOUT}.count()) {
+            return false;
+          }
+          if (!key_frame) {
+            return request_key_frame(now);
+          }
+          if (!source.compare_exchange_strong(followed, packet.channel_data, std::memory_order_acq_rel)) {
+            return false;
+          }
+
+          BOOST_LOG(debug) << "DVR: mirroring "sv << config.width << 'x' << config.height << " video"sv;
+          resync.store(true, std::memory_order_relaxed);
+        }
+        last_mirror.store(to_ns(now), std::memory_order_relaxed);
+
+        if (key_frame) {
+          last_key_frame = now;
+          resync.store(false, std::memory_order_relaxed);
+        }
+
+        // Nothing decodes after a lost frame until the next key frame, so nothing is mirrored either
+        if (resync.load(std::memory_order_relaxed)) {
+          return request_key_frame(now);
+        }
+
+        std::vector<std::uint8_t> data;
+        if (recycled.peek()) {
+          data = std::move(*recycled.pop());
+        }
+        data.assign(packet.data(), packet.data() + packet.data_size());
+
+        auto timestamp = packet.frame_timestamp.value_or(now);
+        record_t record {
+          0,
+          (key_frame ? KEY_FRAME : 0u) | (first_part ? 0u : CONTINUED),
+          packet.frame_index(),
+          to_ns(timestamp),
+          (std::uint32_t) config.videoFormat,
+          (std::uint16_t) config.width,
+          (std::uint16_t) config.height,
+          (std::uint32_t) config.framerate,
+          0,
+        };
+
+        if (!frames.raise(mirrored_t {record, std::move(data)})) {
+          BOOST_LOG(debug) << "DVR fell behind, dropping frame "sv << record.frame_index;
+          resync.store(true, std::memory_order_relaxed);
+          return request_key_frame(now);
+        }
+
+        if (first_part && key_frame_interval.count() > 0 && now - last_key_frame >= key_frame_interval) {
+          return request_key_frame(now);
+        }
+
+        return false;
+      }
+
+      std::unique_ptr<ring_t> ring;
+      fs::path path;
+
+    private:
+      bool request_key_frame(std::chrono::steady_clock::time_point now) {
+        auto last = last_request.load(std::memory_order_relaxed);
+        if (to_ns(now) - last < std::chrono::nanoseconds {KEY_FRAME_REQUEST_INTERVAL}.count()) {
+          return false;
+        }
+
+        return last_request.compare_exchange_strong(last, to_ns(now), std::memory_order_relaxed);
+      }
+
+      void run() {
+        while (auto frame = frames.pop()) {
+          if (!ring->write(frame->record, frame->data)) {
+            BOOST_LOG(warning) << "DVR: a frame of "sv << frame->data.size() << " bytes doesn't fit in the ring, the ring is too small"sv;
+            resync.store(true, std::memory_order_relaxed);
+          }
+
+          // The buffer goes back to mirror(), so a warm DVR copies frames without allocating
+          recycled.raise(std::move(frame->data));
+        }
+      }
+
+      safe::ring_t<mirrored_t> frames;
+      safe::ring_t<std::vector<std::uint8_t>> recycled;
+
+      // The send threads of other encoders look at these too, when the followed encoder goes quiet
+      std::atomic<void *> source {nullptr};
+      std::atomic<std::int64_t> last_mirror {0};
+      std::atomic<std::int64_t> last_request {0};
+      std::atomic<bool> resync {true};
+
+      // Only touched by the send thread of the followed encoder
+      std::chrono::seconds key_frame_interval;
+      std::chrono::steady_clock::time_point last_key_frame;
+
+      std::thread thread;
+    };
+
+    // Set by start(), streaming only runs while the DVR handle lives
+    recorder_t *recorder = nullptr;
+
+    recorder_t::~recorder_t() {
+      recorder = nullptr;
+
+      frames.stop();
+      thread.join();
+    }
+  }  // namespace
+
+  ring_t::ring_t(header_t *header, std::uint8_t *ring):
+      header {header},
+      ring {ring} {
+  }
+
+  std::unique_ptr<ring_t> ring_t::open(const fs::path &path, std::uint64_t capacity) {
+    capacity = capacity / 8 * 8;
+    if (capacity < record_size(0)) {
+      return nullptr;
+    }
+
+    auto ring = map_file(path, RING_OFFSET + capacity);
+    if (!ring) {
+      return nullptr;
+    }
+
+    auto header = ring->header;
+    if (std::memcmp(header->magic, MAGIC, sizeof(MAGIC)) || header->version != VERSION || header->capacity != capacity) {
+      std::memset(header, 0, sizeof(header_t));
+      std::memcpy(header->magic, MAGIC, sizeof(MAGIC));
+      header->version = VERSION;
+      header->capacity = capacity;
+    }
+
+    return ring;
+  }
+
+  bool ring_t::write(record_t record, std::span<const std::uint8_t> data) {
+    auto capacity = header->capacity;
+    auto size = record_size(data.size());
+    if (size > capacity) {
+      return false;
+    }
+
+    std::lock_guard lg {lock};
+
+    // A record never wraps around, the rest of the ring is skipped instead
+    auto offset = header->head % capacity;
+    if (capacity - offset < size) {
+      if (capacity - offset >= sizeof(record_t)) {
+        record_t padding {};
+        padding.flags = PADDING;
+        std::memcpy(ring + offset, &padding, sizeof(padding));
+      }
+
+      header->head += capacity - offset;
+      offset = 0;
+    }
+
+    record.size = (std::uint32_t) data.size();
+    std::memcpy(ring + offset, &record, sizeof(record));
+    std::memcpy(ring + offset + sizeof(record), data.data(), data.size());
+
+    if (record.flags & KEY_FRAME) {
+      header->key_frame[header->key_frames++ % KEY_FRAMES] = {header->head, record.timestamp};
+    }
+    header->last_timestamp = record.timestamp;
+    header->head += size;
+
+    return true;
+  }
+
+  std::vector<frame_t> ring_t::clip(std::chrono::nanoseconds duration) {
+    std::vector<std::uint8_t> bytes;
+    std::uint64_t start;
+    auto capacity = header->capacity;
+    {
+      std::lock_guard lg {lock};
+
+      auto head = header->head;
+      auto oldest = head > capacity ? head - capacity : 0;
+      auto since = header->last_timestamp - duration.count();
+
+      // Newest key frame first, the first one at or before the start of the clip is the one
+      std::optional<key_frame_t> key_frame;
+      auto key_frames = std::min<std::uint64_t>(header->key_frames, KEY_FRAMES);
+      for (std::uint64_t x = 1; x <= key_frames; ++x) {
+        auto &candidate = header->key_frame[(header->key_frames - x) % KEY_FRAMES];
+        if (candidate.position < oldest) {
+          break;
+        }
+
+        key_frame = candidate;
+        if (candidate.timestamp <= since) {
+          break;
+        }
+      }
+
+      if (!key_frame) {
+        return {};
+      }
+
+      // Copied out, so the DVR thread only waits for the copy and not for the muxer
+      start = key_frame->position;
+      bytes.resize(head - start);
+      auto offset = start % capacity;
+      auto first = std::min<std::uint64_t>(bytes.size(), capacity - offset);
+      std::memcpy(bytes.data(), ring + offset, first);
+      std::memcpy(bytes.data() + first, ring, bytes.size() - first);
+    }
+
+    std::vector<frame_t> frames;
+    std::uint64_t position = start;
+    while (position - start + sizeof(record_t) <= bytes.size()) {
+      record_t record;
+      std::memcpy(&record, bytes.data() + (position - start), sizeof(record));
+
+      if (record.flags & PADDING) {
+        position += capacity - position % capacity;
+        continue;
+      }
+
+      auto data = bytes.data() + (position - start) + sizeof(record_t);
+      position += record_size(record.size);
+      if (position - start > bytes.size()) {
+        break;
+      }
+
+      if (record.flags & CONTINUED) {
+        if (!frames.empty() && frames.back().record.frame_index == record.frame_index) {
+          frames.back().data.insert(frames.back().data.end(), data, data + record.size);
+        }
+        continue;
+      }
+
+      // A clip holds a single stream, the MP4 can't change the format midway
+      if (!frames.empty()) {
+        auto &first = frames.front().record;
+        if (first.video_format != record.video_format || first.width != record.width || first.height != record.height || first.framerate != record.framerate) {
+          break;
+        }
+      }
+
+      frames.push_back({record, std::vector<std::uint8_t>(data, data + record.size)});
+    }
+
+    return frames;
+  }
+
+  int write_mp4(const fs::path &path, const std::vector<frame_t> &frames) {
+    if (frames.empty()) {
+      return -1;
+    }
+
+    auto &first = frames.front().record;
+    AVCodecID codec_id;
+    switch (first.video_format) {
+      case 0:
+        codec_id = AV_CODEC_ID_H264;
+        break;
+      case 1:
+        codec_id = AV_CODEC_ID_HEVC;
+        break;
+      case 2:
+        codec_id = AV_CODEC_ID_AV1;
+        break;
+      default:
+        BOOST_LOG(error) << "DVR: unknown video format "sv << first.video_format;
+        return -1;
+    }
+
+    char err_str[AV_ERROR_MAX_STRING_SIZE] {0};
+
+    AVFormatContext *ctx = nullptr;
+    auto status = avformat_alloc_output_context2(&ctx, nullptr, "mp4", path.string().c_str());
+    if (status < 0) {
+      BOOST_LOG(error) << "DVR: couldn't create the MP4 muxer: "sv << av_make_error_string(err_str, AV_ERROR_MAX_STRING_SIZE, status);
+      return -1;
+    }
+    auto fg = util::fail_guard([&ctx]() {
+      if (ctx->pb) {
+        avio_closep(&ctx->pb);
+      }
+      avformat_free_context(ctx);
+    });
+
+    // The muxer takes the parameter sets from the first key frame, the frames are stored as they were streamed
+    auto stream = avformat_new_stream(ctx, nullptr);
+    stream->codecpar->codec_type = AVMEDIA_TYPE_VIDEO;
+    stream->codecpar->codec_id = codec_id;
+    stream->codecpar->width = first.width;
+    stream->codecpar->height = first.height;
+    stream->time_base = {1, 1000000};
+    stream->avg_frame_rate = {(int) first.framerate, 1};
+
+    status = avio_open(&ctx->pb, path.string().c_str(), AVIO_FLAG_WRITE);
+    if (status < 0) {
+      BOOST_LOG(error) << "DVR: couldn't open "sv << path.string() << ": "sv << av_make_error_string(err_str, AV_ERROR_MAX_STRING_SIZE, status);
+      return -1;
+    }
+
+    status = avformat_write_header(ctx, nullptr);
+    if (status < 0) {
+      BOOST_LOG(error) << "DVR: couldn't write the MP4 header: "sv << av_make_error_string(err_str, AV_ERROR_MAX_STRING_SIZE, status);
+      return -1;
+    }
+
+    auto packet = av_packet_alloc();
+    auto packet_fg = util::fail_guard([&packet]() {
+      av_packet_free(&packet);
+    });
+
+    // Timestamps count microseconds from the first frame, and stay strictly increasing for the muxer
+    std::int64_t last_pts = -1;
+    for (auto &frame : frames) {
+      auto pts = std::max(last_pts + 1, (frame.record.timestamp - first.timestamp) / 1000);
+      last_pts = pts;
+
+      packet->data = (std::uint8_t *) frame.data.data();
+      packet->size = (int) frame.data.size();
+      packet->pts = pts;
+      packet->dts = pts;
+      packet->flags = frame.record.flags & KEY_FRAME ? AV_PKT_FLAG_KEY : 0;
+      packet->stream_index = stream->index;
+      av_packet_rescale_ts(packet, {1, 1000000}, stream->time_base);
+
+      status = av_write_frame(ctx, packet);
+      if (status < 0) {
+        BOOST_LOG(error) << "DVR: couldn't write frame "sv << frame.record.frame_index << ": "sv << av_make_error_string(err_str, AV_ERROR_MAX_STRING_SIZE, status);
+        return -1;
+      }
+    }
+
+    status = av_write_trailer(ctx);
+    if (status < 0) {
+      BOOST_LOG(error) << "DVR: couldn't finish "sv << path.string() << ": "sv << av_make_error_string(err_str, AV_ERROR_MAX_STRING_SIZE, status);
+      return -1;
+    }
+
+    return 0;
+  }
+
+  std::unique_ptr<platf::deinit_t> start() {
+    if (config::sunshine.dvr_file.empty()) {
+      return nullptr;
+    }
+
+    fs::path path = config::sunshine.dvr_file;
+    if (path.is_relative()) {
+      path = platf::appdata() / path;
+    }
+
+    auto ring = ring_t::open(path, (std::uint64_t) config::sunshine.dvr_size << 20);
+    if (!ring) {
+      return nullptr;
+    }
+
+    BOOST_LOG(info) << "DVR: mirroring the streamed video into "sv << path.string() << " ("sv << config::sunshine.dvr_size << " MiB)"sv;
+
+    auto dvr = std::make_unique<recorder_t>(std::move(ring), std::move(path), std::chrono::seconds {config::sunshine.dvr_key_frame_interval});
+    recorder = dvr.get();
+    return dvr;
+  }
+
+  bool mirror(packet_raw_t &packet, const config_t &config) {
+    if (!recorder) {
+      return false;
+    }
+
+    return recorder->mirror(packet, config);
+  }
+
+  fs::path save_clip(std::chrono::seconds duration) {
+    if (!recorder) {
+      throw std::runtime_error("The DVR is disabled");
+    }
+
+    auto frames = recorder->ring->clip(duration);
+    if (frames.empty()) {
+      throw std::runtime_error("The DVR holds no key frame yet");
+    }
+
+    auto t = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
+    auto lt = *std::localtime(&t);
+
+    std::ostringstream name;
+    name << "clip-"sv << std::put_time(&lt, "%Y%m%d-%H%M%S") << ".mp4"sv;
+    auto path = recorder->path.parent_path() / name.str();
+
+    if (write_mp4(path, frames)) {
+      throw std::runtime_error("Couldn't write " + path.string());
+    }
+
+    auto seconds = std::chrono::duration<double>(std::chrono::nanoseconds {frames.back().record.timestamp - frames.front().record.timestamp}).count();
+    BOOST_LOG(info) << "DVR: saved "sv << frames.size() << " frames ("sv << seconds << "s) to "sv << path.string();
+    return path;
+  }
+}  // namespace video::dvr
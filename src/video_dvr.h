@@ -0,0 +1,181 @@
+/**
+ * @file src/video_dvr.h
+ * @brief Declarations for the DVR, which keeps the last minutes of the streamed video in a ring file.
+ *
+ * The encoded frames handed to the video broadcast thread are mirrored into a memory mapped ring file, so a clip of
+ * what was streamed can be saved to MP4 for review without running a second encoder. The file holds a `header_t`,
+ * followed by the ring from `RING_OFFSET` on. Every frame is a `record_t` followed by its data, padded to 8 bytes.
+ * The header indexes the records of the key frames, clips start at one of them.
+ */
+#pragma once
+
+// standard includes
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <vector>
+
+// local includes
+#include "platform/common.h"
+#include "video.h"
+
+namespace video::dvr {
+  /**
+   * @brief Number of key frames the header indexes.
+   */
+  constexpr std::size_t KEY_FRAMES = 1024;
+
+  /**
+   * @brief File format version.
+   */
+  constexpr std::uint32_t VERSION = 1;
+
+  /**
+   * @brief Flags of a record.
+   */
+  enum flag_e : std::uint32_t {
+    KEY_FRAME = 1 << 0,  ///< An IDR frame, decoding can start here.
+    CONTINUED = 1 << 1,  ///< A later part of a frame sent in parts, it belongs to the record before it.
+    PADDING = 1 << 2,  ///< Fills the rest of the ring, the next record starts at the beginning of the ring.
+  };
+
+  /**
+   * @brief Header of a frame in the ring.
+   */
+  struct record_t {
+    std::uint32_t size;  ///< Bytes of frame data following the record.
+    std::uint32_t flags;  ///< flag_e
+    std::int64_t frame_index;  ///< Frame number of the encoder.
+    std::int64_t timestamp;  ///< Capture time in nanoseconds of the steady clock.
+    std::uint32_t video_format;  ///< 0 - H.264, 1 - HEVC, 2 - AV1
+    std::uint16_t width;  ///< Width in pixels.
+    std::uint16_t height;  ///< Height in pixels.
+    std::uint32_t framerate;  ///< Frames per second.
+    std::uint32_t reserved;
+  };
+
+  /**
+   * @brief Position of a key frame in the ring.
+   */
+  struct key_frame_t {
+    std::uint64_t position;  ///< Bytes written to the ring before the key frame.
+    std::int64_t timestamp;  ///< Capture time of the key frame.
+  };
+
+  /**
+   * @brief Header at the start of the file.
+   */
+  struct header_t {
+    char magic[8];  ///< "SUNDVR\0\0"
+    std::uint32_t version;  ///< VERSION
+    std::uint32_t reserved;
+    std::uint64_t capacity;  ///< Bytes of the ring.
+    std::uint64_t head;  ///< Bytes written to the ring since the file was created, the next record goes to `head % capacity`.
+    std::int64_t last_timestamp;  ///< Capture time of the newest frame.
+    std::uint64_t key_frames;  ///< Key frames written since the file was created.
+    key_frame_t key_frame[KEY_FRAMES];  ///< The last key frames, key frame `n` is at `n % KEY_FRAMES`.
+  };
+
+  /**
+   * @brief Offset of the ring from the start of the file, the header is padded to whole pages.
+   */
+  constexpr std::uint64_t RING_OFFSET = (sizeof(header_t) + 4095) / 4096 * 4096;
+
+  /**
+   * @brief A frame read back from the ring, its parts joined.
+   */
+  struct frame_t {
+    record_t record;
+    std::vector<std::uint8_t> data;
+  };
+
+  /**
+   * @brief Size a frame of `size` bytes takes in the ring.
+   * @param size Bytes of frame data.
+   * @return The size of the record and the data, rounded up to 8 bytes.
+   */
+  constexpr std::uint64_t record_size(std::uint64_t size) {
+    return sizeof(record_t) + (size + 7) / 8 * 8;
+  }
+
+  /**
+   * @brief The memory mapped ring file.
+   * Frames are only ever written by one thread, reading a clip back can happen on any thread.
+   */
+  class ring_t {
+  public:
+    virtual ~ring_t() = default;
+
+    /**
+     * @brief Open the ring file, creating it if needed.
+     * An existing file of the same capacity is kept, so clips can be saved of what was streamed before a restart.
+     * @param path Path of the file.
+     * @param capacity Bytes of the ring.
+     * @return The ring, or nullptr if the file couldn't be mapped.
+     */
+    [[nodiscard]] static std::unique_ptr<ring_t> open(const std::filesystem::path &path, std::uint64_t capacity);
+
+    /**
+     * @brief Write a frame, overwriting the oldest frames in the way.
+     * @param record The header of the frame, its size is taken from `data`.
+     * @param data The frame data.
+     * @return `false` if the frame doesn't fit in the ring.
+     */
+    bool write(record_t record, std::span<const std::uint8_t> data);
+
+    /**
+     * @brief Read back the newest frames, starting at a key frame.
+     * The clip starts at the newest key frame that leaves at least `duration` of frames after it, or at the
+     * oldest key frame still in the ring. It ends at the newest frame, or before a key frame that changes the
+     * format, resolution or framerate.
+     * @param duration The duration of the clip.
+     * @return The frames, empty if the ring holds no key frame.
+     */
+    std::vector<frame_t> clip(std::chrono::nanoseconds duration);
+
+  protected:
+    ring_t(header_t *header, std::uint8_t *ring);
+
+    header_t *header;
+    std::uint8_t *ring;
+
+  private:
+    std::mutex lock;
+  };
+
+  /**
+   * @brief Write frames read back from the ring to an MP4 file, without encoding them again.
+   * @param path Path of the MP4 file.
+   * @param frames The frames, starting at a key frame.
+   * @return 0 on success, -1 on failure.
+   */
+  int write_mp4(const std::filesystem::path &path, const std::vector<frame_t> &frames);
+
+  /**
+   * @brief Start mirroring the streamed video into the ring file of the `dvr_file` setting.
+   * @return A handle that stops the DVR when destroyed, or nullptr if the DVR is disabled or the file couldn't be mapped.
+   */
+  [[nodiscard]] std::unique_ptr<platf::deinit_t> start();
+
+  /**
+   * @brief Mirror a packet the video broadcast thread is about to send.
+   * Only the packets of one encoder are mirrored at a time. The packet is copied to a buffer that is handed to
+   * the DVR thread without waiting for it. If the DVR thread doesn't keep up, the frame is dropped and mirroring
+   * resumes at the next key frame.
+   * @param packet The packet.
+   * @param config The video configuration of the encoder.
+   * @return `true` if the DVR needs a key frame, because mirroring resumes at one or the last one is getting old.
+   */
+  bool mirror(packet_raw_t &packet, const config_t &config);
+
+  /**
+   * @brief Save the newest frames of the ring to an MP4 file next to the ring file.
+   * @param duration The duration of the clip, it starts at the key frame before it.
+   * @return The path of the MP4 file.
+   * @throws std::runtime_error If the DVR is disabled, holds no key frame yet, or the file couldn't be written.
+   */
+  std::filesystem::path save_clip(std::chrono::seconds duration);
+}  // namespace video::dvr
@@ -0,0 +1,99 @@
+/**
+ * @file src/video_governor.cpp
+ * @brief Definitions for adapting the quality of a stream to the load and the temperature of the host.
+ */
+// standard includes
+#include <algorithm>
+#include <string>
+
+// local includes
+#include "logging.h"
+#include "video_governor.h"
+
+using namespace std::literals;
+
+namespace video::governor {
+  governor_t::governor_t(int framerate, double temperature_limit):
+      frame_time {1.0 / std::max(1, framerate)},
+      temperature_limit {temperature_limit} {
+  }
+
+  void governor_t::frame_encoded(std::chrono::steady_clock::duration encode_time) {
+    ++frames;
+
+    // A level that drops frames leaves the encoder more time for each of the others
+    if (encode_time > frame_time * level().fps_divisor) {
+      ++overruns;
+    }
+    if (index > 0 && encode_time > frame_time * levels[index - 1].fps_divisor) {
+      ++higher_overruns;
+    }
+  }
+
+  bool governor_t::take_frame() {
+    return frame_count++ % level().fps_divisor == 0;
+  }
+
+  bool governor_t::sample_due(std::chrono::steady_clock::time_point now) const {
+    return now - last_sample >= SAMPLE_INTERVAL;
+  }
+
+  bool governor_t::update(std::chrono::steady_clock::time_point now, std::optional<double> temperature, bool throttled) {
+    auto elapsed = last_sample == std::chrono::steady_clock::time_point {} ? std::chrono::steady_clock::duration {} : now - last_sample;
+    last_sample = now;
+
+    auto overrun_share = frames ? (double) overruns / frames : 0.0;
+    auto higher_overrun_share = frames ? (double) higher_overruns / frames : 0.0;
+    frames = 0;
+    overruns = 0;
+    higher_overruns = 0;
+
+    auto at_temperature = temperature ? " at "s + std::to_string((int) *temperature) + " C"s : ""s;
+
+    std::string reason;
+    if (throttled) {
+      reason = "the host throttling"s + at_temperature;
+    } else if (temperature && *temperature >= temperature_limit) {
+      reason = "the host reaching its temperature limit"s + at_temperature;
+    } else if (overrun_share > OVERRUN_LIMIT) {
+      reason = std::to_string((int) (overrun_share * 100)) + "% of the frames missing their time budget"s;
+    }
+
+    if (!reason.empty()) {
+      calm_time = {};
+
+      if (index + 1 == levels.size() || now - last_lower < LOWER_HOLDOFF) {
+        return false;
+      }
+
+      last_lower = now;
+      step(index + 1, reason);
+      return true;
+    }
+
+    // The next level up has to fit its tighter budget, or the stream would only bounce back down
+    auto cool = !temperature || *temperature < temperature_limit - HYSTERESIS;
+    if (index == 0 || !cool || higher_overrun_share > OVERRUN_LIMIT / 4) {
+      calm_time = {};
+      return false;
+    }
+
+    calm_time += elapsed;
+    if (calm_time < RAISE_INTERVAL) {
+      return false;
+    }
+
+    calm_time = {};
+    step(index - 1, "the host recovered"s + at_temperature);
+    return true;
+  }
+
+  void governor_t::step(std::size_t new_index, const std::string &reason) {
+    BOOST_LOG(info) << "Stream quality "sv << (new_index > index ? "lowered"sv : "raised"sv) << " to level "sv << new_index
+                    << " (1/"sv << levels[new_index].fps_divisor << " of the frames at "sv << levels[new_index].bitrate_percent
+                    << "% of the bitrate) after "sv << reason;
+
+    index = new_index;
+    frame_count = 0;
+  }
+}  // namespace video::governor
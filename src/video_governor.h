@@ -0,0 +1,136 @@
+/**
+ * @file src/video_governor.h
+ * @brief Declarations for adapting the quality of a stream to the load and the temperature of the host.
+ */
+#pragma once
+
+// standard includes
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <optional>
+#include <string>
+
+namespace video::governor {
+  /**
+   * @brief How much of the requested stream is encoded at one quality level.
+   */
+  struct level_t {
+    int fps_divisor;  ///< Only every nth captured frame is encoded.
+    int bitrate_percent;  ///< Share of the requested bitrate the encoder runs at.
+  };
+
+  /**
+   * @brief The levels a stream steps through, level 0 is the stream the client asked for.
+   * The resolution stays, the client's decoder is set up for the size negotiated at the start of the stream.
+   */
+  constexpr std::array levels {
+    level_t {1, 100},
+    level_t {1, 75},
+    level_t {2, 75},
+    level_t {2, 50},
+    level_t {3, 50},
+  };
+
+  /**
+   * @brief Share of the frames over their time budget that counts as an overloaded encoder.
+   */
+  constexpr double OVERRUN_LIMIT = 0.1;
+
+  /**
+   * @brief Degrees below the temperature limit the host has to cool down to before the quality is raised again.
+   */
+  constexpr double HYSTERESIS = 5.0;
+
+  /**
+   * @brief How often the host is sampled and the frame times are judged.
+   */
+  constexpr std::chrono::seconds SAMPLE_INTERVAL {1};
+
+  /**
+   * @brief Time between two steps down, so the encoder shows the effect of the last one first.
+   */
+  constexpr std::chrono::seconds LOWER_HOLDOFF {3};
+
+  /**
+   * @brief Time the host has to stay calm before the quality is raised by one level.
+   */
+  constexpr std::chrono::seconds RAISE_INTERVAL {15};
+
+  /**
+   * @brief Steps the quality of a stream down while the host throttles, runs hot or the encoder misses its
+   * frame time budget, and back up once it recovered.
+   * Fed from the encode loop, one governor per stream.
+   */
+  class governor_t {
+  public:
+    /**
+     * @param framerate Frame rate the client asked for.
+     * @param temperature_limit Temperature in degrees Celsius from which the quality is lowered.
+     */
+    governor_t(int framerate, double temperature_limit);
+
+    /**
+     * @brief Count the time a frame took to convert and encode against the budget of the current level.
+     * @param encode_time The time the frame took.
+     */
+    void frame_encoded(std::chrono::steady_clock::duration encode_time);
+
+    /**
+     * @brief Check if a captured frame is encoded at the current level.
+     * @return `false` for the frames the level drops.
+     */
+    bool take_frame();
+
+    /**
+     * @brief Check if the host should be sampled and passed to update().
+     * @param now The current time.
+     * @return `true` once per SAMPLE_INTERVAL.
+     */
+    bool sample_due(std::chrono::steady_clock::time_point now) const;
+
+    /**
+     * @brief Judge the frames since the last sample along with the state of the host, and step the level.
+     * Every step is logged with the reason for it.
+     * @param now The current time.
+     * @param temperature Temperature of the host in degrees Celsius, if it reports one.
+     * @param throttled The host currently caps its clocks.
+     * @return `true` if the level changed.
+     */
+    bool update(std::chrono::steady_clock::time_point now, std::optional<double> temperature, bool throttled);
+
+    /**
+     * @brief The current quality level.
+     * @return An entry of levels.
+     */
+    const level_t &level() const {
+      return levels[index];
+    }
+
+    /**
+     * @brief Index of the current quality level in levels.
+     * @return The index, 0 for the stream the client asked for.
+     */
+    std::size_t level_index() const {
+      return index;
+    }
+
+  private:
+    void step(std::size_t new_index, const std::string &reason);
+
+    std::chrono::duration<double> frame_time;
+    double temperature_limit;
+
+    std::size_t index = 0;
+    int frame_count = 0;
+
+    // Frames since the last sample, and how many of them missed the budget of this level and of the next higher one
+    int frames = 0;
+    int overruns = 0;
+    int higher_overruns = 0;
+
+    std::chrono::steady_clock::time_point last_sample {};
+    std::chrono::steady_clock::time_point last_lower {};
+    std::chrono::steady_clock::duration calm_time {};
+  };
+}  // namespace video::governor
@@ -0,0 +1,156 @@
+/**
+ * @file src/video_scheduler.cpp
+ * @brief Definitions for sharing the encoder between the sessions of the host.
+ */
+// standard includes
+#include <algorithm>
+
+// local includes
+#include "logging.h"
+#include "video_scheduler.h"
+
+using namespace std::literals;
+
+namespace video::scheduler {
+  namespace {
+    double pixel_rate_of(std::uint64_t pixels, std::chrono::steady_clock::duration encode_time) {
+      auto seconds = std::chrono::duration<double>(encode_time).count();
+      return seconds > 0.0 ? pixels / seconds : 0.0;
+    }
+  }  // namespace
+
+  void scheduler_t::probed(std::uint64_t pixels, std::chrono::steady_clock::duration encode_time) {
+    std::lock_guard lg {lock};
+    probed_rate = std::max(probed_rate, pixel_rate_of(pixels, encode_time));
+  }
+
+  void scheduler_t::frame_encoded(std::uint64_t pixels, std::chrono::steady_clock::duration encode_time) {
+    auto rate = pixel_rate_of(pixels, encode_time);
+    if (rate <= 0.0) {
+      return;
+    }
+
+    std::lock_guard lg {lock};
+    measured_rate = measured_rate > 0.0 ? measured_rate + (rate - measured_rate) * RATE_SMOOTHING : rate;
+  }
+
+  void scheduler_t::open_failed() {
+    std::lock_guard lg {lock};
+    if (sessions.size() > 1) {
+      max_sessions = (int) sessions.size() - 1;
+      BOOST_LOG(warning) << "The encoder opens no more than "sv << max_sessions << " sessions at once"sv;
+    }
+  }
+
+  capacity_t scheduler_t::capacity() const {
+    std::lock_guard lg {lock};
+    return {max_sessions, pixel_rate()};
+  }
+
+  int scheduler_t::admit(const void *id, int width, int height, int framerate) {
+    std::lock_guard lg {lock};
+
+    std::erase_if(sessions, [id](const session_t &session) {
+      return session.id == id;
+    });
+
+    auto &session = sessions.emplace_back(session_t {id, (double) width * height * framerate, fps_divisors.front()});
+    if (sessions.size() == 1) {
+      return session.fps_divisor;
+    }
+
+    if (max_sessions && (int) sessions.size() > max_sessions) {
+      BOOST_LOG(warning) << "Admitting session "sv << sessions.size() << " to an encoder that opened no more than "sv << max_sessions << " at once"sv;
+    }
+
+    auto limit = pixel_rate() * LOAD_LIMIT;
+    if (limit <= 0.0) {
+      return session.fps_divisor;
+    }
+
+    double load = 0.0;
+    for (auto it = std::begin(sessions); it != std::prev(std::end(sessions)); ++it) {
+      load += it->pixel_rate / it->fps_divisor;
+    }
+
+    auto fits = std::find_if(std::begin(fps_divisors), std::end(fps_divisors), [&](int divisor) {
+      return load + session.pixel_rate / divisor <= limit;
+    });
+    if (fits == std::end(fps_divisors)) {
+      session.fps_divisor = fps_divisors.back();
+      BOOST_LOG(warning) << "The encoder is oversubscribed, session "sv << sessions.size() << " gets 1/"sv << session.fps_divisor << " of the frames"sv;
+    } else if (*fits > 1) {
+      session.fps_divisor = *fits;
+      BOOST_LOG(info) << "Session "sv << sessions.size() << " gets 1/"sv << session.fps_divisor << " of the frames to fit the encoder next to the others"sv;
+    }
+
+    return session.fps_divisor;
+  }
+
+  void scheduler_t::leave(const void *id) {
+    std::lock_guard lg {lock};
+
+    std::erase_if(sessions, [id](const session_t &session) {
+      return session.id == id;
+    });
+
+    auto limit = pixel_rate() * LOAD_LIMIT;
+    for (auto &session : sessions) {
+      if (session.fps_divisor == fps_divisors.front()) {
+        continue;
+      }
+
+      double load = 0.0;
+      for (auto &other : sessions) {
+        if (&other != &session) {
+          load += other.pixel_rate / other.fps_divisor;
+        }
+      }
+
+      // Without anyone else on the encoder, a session gets all of it
+      auto divisor = std::find_if(std::begin(fps_divisors), std::end(fps_divisors), [&](int divisor) {
+        return sessions.size() == 1 || load + session.pixel_rate / divisor <= limit;
+      });
+      if (divisor != std::end(fps_divisors) && *divisor < session.fps_divisor) {
+        session.fps_divisor = *divisor;
+        BOOST_LOG(info) << "A session left the encoder, another one gets 1/"sv << session.fps_divisor << " of the frames again"sv;
+      }
+    }
+  }
+
+  int scheduler_t::fps_divisor(const void *id) const {
+    std::lock_guard lg {lock};
+
+    auto it = std::find_if(std::begin(sessions), std::end(sessions), [id](const session_t &session) {
+      return session.id == id;
+    });
+
+    return it == std::end(sessions) ? fps_divisors.front() : it->fps_divisor;
+  }
+
+  scheduler_t::turn_t scheduler_t::wait_turn(std::chrono::steady_clock::time_point deadline) {
+    std::unique_lock ul {lock};
+
+    auto it = waiting.insert(deadline);
+    turn_cv.wait_for(ul, TURN_TIMEOUT, [&]() {
+      return encoding == 0 && it == std::begin(waiting);
+    });
+    waiting.erase(it);
+    ++encoding;
+
+    return turn_t {this};
+  }
+
+  void scheduler_t::end_turn() {
+    {
+      std::lock_guard lg {lock};
+      --encoding;
+    }
+
+    turn_cv.notify_all();
+  }
+
+  double scheduler_t::pixel_rate() const {
+    return std::max(probed_rate, measured_rate);
+  }
+}  // namespace video::scheduler
@@ -0,0 +1,161 @@
+/**
+ * @file src/video_scheduler.h
+ * @brief Declarations for sharing the encoder between the sessions of the host.
+ */
+#pragma once
+
+// standard includes
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <set>
+#include <vector>
+
+namespace video::scheduler {
+  /**
+   * @brief Shares of the captured frames a session is admitted at, 1 for all of them.
+   */
+  inline constexpr std::array fps_divisors {1, 2, 3};
+
+  /**
+   * @brief Share of the encoder's pixel rate the sessions are admitted up to, the rest absorbs key frames.
+   */
+  constexpr double LOAD_LIMIT = 0.9;
+
+  /**
+   * @brief Weight of each encoded frame in the measured pixel rate.
+   */
+  constexpr double RATE_SMOOTHING = 0.05;
+
+  /**
+   * @brief Longest a frame waits for its turn, so a hung encode of one session can't stall the others.
+   */
+  constexpr std::chrono::milliseconds TURN_TIMEOUT {100};
+
+  /**
+   * @brief What the encoder was found to handle.
+   */
+  struct capacity_t {
+    int max_sessions;  ///< Sessions open at once when opening another one failed, 0 until that happens.
+    double pixel_rate;  ///< Pixels per second the encoder was seen to encode, 0 until it was probed or used.
+  };
+
+  /**
+   * @brief Admits the sessions of the host to the encoder at a frame rate it keeps up with,
+   * and lets their frames take turns on it, earliest deadline first.
+   * A session that joins while others stream gets what's left of the encoder, so the others keep their frame rate.
+   */
+  class scheduler_t {
+  public:
+    /**
+     * @brief A frame's turn on the encoder, which ends with this object.
+     */
+    class turn_t {
+    public:
+      explicit turn_t(scheduler_t *scheduler):
+          scheduler {scheduler} {
+      }
+
+      turn_t(turn_t &&other) noexcept:
+          scheduler {other.scheduler} {
+        other.scheduler = nullptr;
+      }
+
+      turn_t(const turn_t &) = delete;
+      turn_t &operator=(const turn_t &) = delete;
+      turn_t &operator=(turn_t &&) = delete;
+
+      ~turn_t() {
+        if (scheduler) {
+          scheduler->end_turn();
+        }
+      }
+
+    private:
+      scheduler_t *scheduler;
+    };
+
+    /**
+     * @brief Count the frame an encoder was probed with.
+     * Probes encode a key frame right after the encoder opened, so only the fastest one is kept.
+     * @param pixels Pixels of the frame.
+     * @param encode_time The time the frame took.
+     */
+    void probed(std::uint64_t pixels, std::chrono::steady_clock::duration encode_time);
+
+    /**
+     * @brief Count the time a frame took to encode in its turn.
+     * @param pixels Pixels of the frame.
+     * @param encode_time The time the frame took.
+     */
+    void frame_encoded(std::uint64_t pixels, std::chrono::steady_clock::duration encode_time);
+
+    /**
+     * @brief Note that the encoder refused to open another session while the admitted ones stream.
+     */
+    void open_failed();
+
+    /**
+     * @brief What the encoder was found to handle so far.
+     * @return The capacity.
+     */
+    capacity_t capacity() const;
+
+    /**
+     * @brief Admit a session, at the highest share of the frames that still fits next to the sessions already streaming.
+     * The first session always gets all of them, the quality governor takes care of an encoder too slow for it alone.
+     * @param id Identifies the session until leave().
+     * @param width Width of the stream.
+     * @param height Height of the stream.
+     * @param framerate Frame rate the client asked for.
+     * @return The entry of fps_divisors the session was admitted at.
+     */
+    int admit(const void *id, int width, int height, int framerate);
+
+    /**
+     * @brief Remove a session, the sessions admitted at a lower frame rate get back what now fits.
+     * @param id The session passed to admit().
+     */
+    void leave(const void *id);
+
+    /**
+     * @brief The share of the frames a session currently gets.
+     * @param id The session passed to admit().
+     * @return The entry of fps_divisors, 1 for sessions that weren't admitted.
+     */
+    int fps_divisor(const void *id) const;
+
+    /**
+     * @brief Wait until no other frame is encoding and no waiting frame is due earlier.
+     * @param deadline Time the frame is due at the client.
+     * @return The turn, it ends when the returned object goes away.
+     */
+    turn_t wait_turn(std::chrono::steady_clock::time_point deadline);
+
+  private:
+    struct session_t {
+      const void *id;
+      double pixel_rate;
+      int fps_divisor;
+    };
+
+    void end_turn();
+    double pixel_rate() const;
+
+    mutable std::mutex lock;
+    std::condition_variable turn_cv;
+
+    int max_sessions = 0;
+    double probed_rate = 0.0;
+    double measured_rate = 0.0;
+
+    // In the order they were admitted
+    std::vector<session_t> sessions;
+
+    // Deadlines of the frames waiting for a turn, and the frames encoding
+    std::multiset<std::chrono::steady_clock::time_point> waiting;
+    int encoding = 0;
+  };
+}  // namespace video::scheduler
@@ -14,12 +14,36 @@ layout(shared) uniform ColorMatrix {
   vec2 range_uv;
 };
 
+// Set when the captured image is HDR (BT.2020 with ST 2084) but the stream is SDR
+uniform bool tone_map;
+
+// BT.2020 to the primaries of the stream
+uniform highp mat3 tone_map_gamut;
+
+highp vec3 to_sdr(highp vec3 pq) {
+  // ST 2084 EOTF, 1.0 is 10000 nits
+  highp vec3 p = pow(pq, vec3(1.0 / 78.84375));
+  highp vec3 rgb = pow(max(p - 0.8359375, 0.0) / (18.8515625 - 18.6875 * p), vec3(1.0 / 0.1593017578125));
+
+  // Relative to SDR reference white at 203 nits, highlights up to 1000 nits are rolled off
+  rgb *= 10000.0 / 203.0;
+  highp float l = dot(vec3(0.2627, 0.6780, 0.0593), rgb);
+  highp float white = 1000.0 / 203.0;
+  rgb *= (1.0 + l / (white * white)) / (1.0 + l);
+
+  return pow(clamp(tone_map_gamut * rgb, 0.0, 1.0), vec3(1.0 / 2.2));
+}
+
 in vec2 tex;
 layout(location = 0) out float color;
 
 void main()
 {
 	vec3 rgb = texture(image, tex).rgb;
+	if (tone_map) {
+		rgb = to_sdr(rgb);
+	}
+
 	float y = dot(color_vec_y.xyz, rgb) + color_vec_y.w;
 
 	color = y * range_y.x + range_y.y;
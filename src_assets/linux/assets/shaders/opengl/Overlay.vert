@@ -0,0 +1,25 @@
+#version 300 es
+
+#ifdef GL_ES
+precision mediump float;
+#endif
+
+// Part of the plane's framebuffer to draw: offset and size, normalized
+uniform vec4 src;
+
+out vec2 tex;
+
+void main()
+{
+	float idHigh = float(gl_VertexID >> 1);
+	float idLow = float(gl_VertexID & int(1));
+
+	float x = idHigh * 4.0 - 1.0;
+	float y = idLow * 4.0 - 1.0;
+
+	float u = idHigh * 2.0;
+	float v = idLow * 2.0;
+
+	gl_Position = vec4(x, y, 0.0, 1.0);
+	tex = src.xy + vec2(u, v) * src.zw;
+}
\ No newline at end of file
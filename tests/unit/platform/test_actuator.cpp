@@ -0,0 +1,68 @@
+/**
+ * @file tests/unit/platform/test_actuator.cpp
+ * @brief Test src/platform/linux/input/actuator.*.
+ */
+#include "../../tests_common.h"
+
+#ifdef __linux__
+  #include <src/platform/linux/input/actuator.h>
+
+using namespace platf::actuator;
+
+TEST(ActuatorMapTest, ParsesControlsAndOutputs) {
+  auto mappings = parse_map(" ls_x=pwm0.1, rt = pwm2.0:1100:1900,a=gpio0.17 ");
+  ASSERT_TRUE(mappings);
+  ASSERT_EQ(mappings->size(), 3);
+
+  auto &stick = (*mappings)[0];
+  EXPECT_EQ(stick.source, source_e::ls_x);
+  EXPECT_EQ(stick.output, output_e::pwm);
+  EXPECT_EQ(stick.chip, 0);
+  EXPECT_EQ(stick.channel, 1);
+  EXPECT_EQ(stick.min_us, 1000);
+  EXPECT_EQ(stick.max_us, 2000);
+
+  auto &trigger = (*mappings)[1];
+  EXPECT_EQ(trigger.source, source_e::rt);
+  EXPECT_EQ(trigger.chip, 2);
+  EXPECT_EQ(trigger.min_us, 1100);
+  EXPECT_EQ(trigger.max_us, 1900);
+
+  auto &button = (*mappings)[2];
+  EXPECT_EQ(button.source, source_e::button);
+  EXPECT_EQ(button.button, platf::A);
+  EXPECT_EQ(button.output, output_e::gpio);
+  EXPECT_EQ(button.channel, 17);
+}
+
+TEST(ActuatorMapTest, RejectsMalformedEntries) {
+  EXPECT_FALSE(parse_map("ls_x"));
+  EXPECT_FALSE(parse_map("wheel=pwm0.0"));
+  EXPECT_FALSE(parse_map("ls_x=pwm0"));
+  EXPECT_FALSE(parse_map("ls_x=pwm0.0:2000:1000"));
+  EXPECT_FALSE(parse_map("ls_x=pwm0.0:1000:30000"));
+  EXPECT_FALSE(parse_map("a=gpio0.17:1000:2000"));
+  EXPECT_FALSE(parse_map("a=led0.1"));
+
+  auto empty = parse_map("");
+  ASSERT_TRUE(empty);
+  EXPECT_TRUE(empty->empty());
+}
+
+TEST(ActuatorMapTest, MapsGamepadStateToPulseWidth) {
+  auto mappings = parse_map("ls_x=pwm0.0,lt=pwm0.1,b=pwm0.2");
+  ASSERT_TRUE(mappings);
+
+  platf::gamepad_state_t state {};
+  EXPECT_EQ(pulse_ns((*mappings)[0], level((*mappings)[0], state)), 1500008);
+  EXPECT_EQ(pulse_ns((*mappings)[1], level((*mappings)[1], state)), 1000000);
+  EXPECT_EQ(pulse_ns((*mappings)[2], level((*mappings)[2], state)), 1000000);
+
+  state.lsX = -32768;
+  state.lt = 255;
+  state.buttonFlags = platf::B;
+  EXPECT_EQ(pulse_ns((*mappings)[0], level((*mappings)[0], state)), 1000000);
+  EXPECT_EQ(pulse_ns((*mappings)[1], level((*mappings)[1], state)), 2000000);
+  EXPECT_EQ(pulse_ns((*mappings)[2], level((*mappings)[2], state)), 2000000);
+}
+#endif
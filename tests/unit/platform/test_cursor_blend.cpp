@@ -0,0 +1,125 @@
+/**
+ * @file tests/unit/platform/test_cursor_blend.cpp
+ * @brief Test src/platform/cursor_blend.*.
+ */
+#include "../../tests_common.h"
+
+#include <chrono>
+#include <random>
+#include <vector>
+
+#include <src/platform/cursor_blend.h>
+
+using namespace std::literals;
+
+namespace {
+  /**
+   * @brief Reference blend, one channel at a time with a real division.
+   */
+  std::uint32_t blend_pixel(std::uint32_t image, std::uint32_t cursor) {
+    auto alpha = cursor >> 24;
+
+    std::uint32_t pixel = 0;
+    for (int shift = 0; shift < 32; shift += 8) {
+      auto color = ((cursor >> shift) & 0xFF) + (((image >> shift) & 0xFF) * (255 - alpha) + 127) / 255;
+      pixel |= std::min<std::uint32_t>(color, 255) << shift;
+    }
+
+    return pixel;
+  }
+
+  /**
+   * @brief Random premultiplied pixels, with fully opaque and fully transparent ones mixed in.
+   */
+  std::vector<std::uint32_t> make_cursor(std::size_t size) {
+    std::mt19937 gen {42};
+    std::uniform_int_distribution<std::uint32_t> dist {0, 255};
+
+    std::vector<std::uint32_t> cursor(size);
+    for (auto &pixel : cursor) {
+      auto alpha = dist(gen) % 3 == 0 ? 255 : dist(gen);
+      pixel = alpha << 24;
+      for (int shift = 0; shift < 24; shift += 8) {
+        pixel |= (dist(gen) * alpha / 255) << shift;
+      }
+    }
+
+    return cursor;
+  }
+}  // namespace
+
+TEST(CursorBlendTest, BlendsPremultipliedPixels) {
+  // Wide enough for the vectorized loop and the remainder
+  constexpr int width = 7;
+
+  std::vector<std::uint32_t> cursor(width);
+  cursor[0] = 0xFF112233;  // opaque
+  cursor[1] = 0x00000000;  // transparent
+  cursor[2] = 0x80404040;  // half transparent
+  cursor[3] = 0x80808080;
+  cursor[4] = 0xFF445566;
+  cursor[5] = 0x00000000;
+  cursor[6] = 0x80404040;
+
+  std::vector<std::uint32_t> image(width, 0xFFC8C8C8);
+
+  platf::blend_cursor(image.data(), width, cursor.data(), width, width, 1);
+
+  EXPECT_EQ(image[0], 0xFF112233);
+  EXPECT_EQ(image[1], 0xFFC8C8C8);
+  EXPECT_EQ(image[2], 0xFFA4A4A4);
+  EXPECT_EQ(image[3], 0xFFE4E4E4);
+  EXPECT_EQ(image[4], 0xFF445566);
+  EXPECT_EQ(image[5], 0xFFC8C8C8);
+  EXPECT_EQ(image[6], 0xFFA4A4A4);
+}
+
+TEST(CursorBlendTest, MatchesReferenceBlend) {
+  // Not a multiple of any vector width, so every loop and the remainder run
+  constexpr int width = 61;
+  constexpr int height = 5;
+
+  auto cursor = make_cursor(width * height);
+  auto image = make_cursor(width * height);
+  auto expected = image;
+
+  platf::blend_cursor(image.data(), width, cursor.data(), width, width, height);
+
+  for (int x = 0; x < width * height; ++x) {
+    EXPECT_EQ(image[x], blend_pixel(expected[x], cursor[x])) << x;
+  }
+}
+
+TEST(CursorBlendTest, OnlyTouchesCursorRectangle) {
+  constexpr int image_width = 8;
+  constexpr int image_height = 4;
+
+  std::vector<std::uint32_t> cursor(2 * 2, 0xFF000000);
+  std::vector<std::uint32_t> image(image_width * image_height, 0xFFFFFFFF);
+
+  platf::blend_cursor(&image[1 * image_width + 5], image_width, cursor.data(), 2, 2, 2);
+
+  for (int y = 0; y < image_height; ++y) {
+    for (int x = 0; x < image_width; ++x) {
+      auto inside = x >= 5 && x < 7 && y >= 1 && y < 3;
+      EXPECT_EQ(image[y * image_width + x], inside ? 0xFF000000 : 0xFFFFFFFF) << x << ',' << y;
+    }
+  }
+}
+
+TEST(CursorBlendTest, Benchmark) {
+  // A large cursor, as seen with accessibility sizes and high DPI displays
+  constexpr int size = 256;
+  constexpr int iterations = 1000;
+
+  auto cursor = make_cursor(size * size);
+  std::vector<std::uint32_t> image(size * size, 0xFF808080);
+
+  auto start = std::chrono::steady_clock::now();
+  for (int x = 0; x < iterations; ++x) {
+    platf::blend_cursor(image.data(), size, cursor.data(), size, size, size);
+  }
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+  BOOST_LOG(tests) << "Cursor blend: "sv << (double) size * size * iterations / elapsed.count() / 1e6 << " Mpixels/s"sv;
+}
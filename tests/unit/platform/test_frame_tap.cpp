@@ -0,0 +1,107 @@
+/**
+ * @file tests/unit/platform/test_frame_tap.cpp
+ * @brief Test src/platform/linux/frame_tap.*.
+ */
+#include "../../tests_common.h"
+
+#ifdef SUNSHINE_BUILD_PICAMERA
+  #include <filesystem>
+  #include <linux/videodev2.h>
+  #include <poll.h>
+  #include <src/platform/linux/frame_tap.h>
+  #include <sys/mman.h>
+  #include <sys/socket.h>
+  #include <sys/un.h>
+  #include <unistd.h>
+
+namespace {
+  /**
+   * @brief Receive a message, and the file descriptor attached to it if any.
+   * @return The size of the message, or -1 if none came in time.
+   */
+  ssize_t receive(int fd, void *message, std::size_t size, int &attached_fd) {
+    pollfd pfd {fd, POLLIN, 0};
+    if (poll(&pfd, 1, 100) <= 0) {
+      return -1;
+    }
+
+    iovec iov {message, size};
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))] {};
+    msghdr msg {};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    auto bytes = recvmsg(fd, &msg, 0);
+    if (auto cmsg = CMSG_FIRSTHDR(&msg); cmsg && cmsg->cmsg_type == SCM_RIGHTS) {
+      std::memcpy(&attached_fd, CMSG_DATA(cmsg), sizeof(int));
+    }
+    return bytes;
+  }
+}  // namespace
+
+TEST(FrameTapTest, RoundsSlotsUpToPages) {
+  EXPECT_EQ(frame_tap::slot_size(0, 4096), 4096);
+  EXPECT_EQ(frame_tap::slot_size(4096 - frame_tap::DATA_OFFSET, 4096), 4096);
+  EXPECT_EQ(frame_tap::slot_size(4096, 4096), 8192);
+}
+
+TEST(FrameTapTest, SharesFramesThroughTheRing) {
+  auto path = (std::filesystem::temp_directory_path() / ("sunshine-frame-tap-" + std::to_string(getpid()))).string();
+  auto tap = frame_tap::start(path);
+  ASSERT_TRUE(tap);
+
+  auto consumer = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+  sockaddr_un addr {};
+  addr.sun_family = AF_UNIX;
+  std::memcpy(addr.sun_path, path.data(), path.size());
+  ASSERT_EQ(connect(consumer, (sockaddr *) &addr, sizeof(addr)), 0);
+
+  auto data = std::make_shared<std::vector<std::uint8_t>>(640 * 480 * 3 / 2, 0x5a);
+  auto timestamp = std::chrono::steady_clock::now();
+
+  // The tap only copies frames once it accepted the consumer
+  frame_tap::ring_t ring {};
+  int memfd = -1;
+  ssize_t bytes = -1;
+  for (int x = 0; x < 50 && bytes < 0; ++x) {
+    tap->publish(V4L2_PIX_FMT_NV12, 640, 480, 640, *data, timestamp, data);
+    bytes = receive(consumer, &ring, sizeof(ring), memfd);
+  }
+  ASSERT_EQ(bytes, sizeof(ring));
+  EXPECT_EQ(ring.type, frame_tap::message_e::ring);
+  EXPECT_EQ(ring.version, frame_tap::VERSION);
+  EXPECT_EQ(ring.slots, frame_tap::SLOTS);
+  ASSERT_GE(memfd, 0);
+
+  frame_tap::frame_t frame {};
+  int unused = -1;
+  ASSERT_EQ(receive(consumer, &frame, sizeof(frame), unused), sizeof(frame));
+  EXPECT_EQ(frame.type, frame_tap::message_e::frame);
+  EXPECT_EQ(frame.generation, ring.generation);
+  EXPECT_EQ(frame.fourcc, V4L2_PIX_FMT_NV12);
+  EXPECT_EQ(frame.width, 640);
+  EXPECT_EQ(frame.height, 480);
+  EXPECT_EQ(frame.stride, 640);
+  EXPECT_EQ(frame.size, data->size());
+  EXPECT_EQ(frame.timestamp, std::chrono::duration_cast<std::chrono::nanoseconds>(timestamp.time_since_epoch()).count());
+
+  // Consumers only get to map the ring for reading
+  auto size = ring.slot_size * ring.slots;
+  EXPECT_EQ(mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, memfd, 0), MAP_FAILED);
+  auto mapping = (std::uint8_t *) mmap(nullptr, size, PROT_READ, MAP_SHARED, memfd, 0);
+  ASSERT_NE(mapping, MAP_FAILED);
+
+  auto slot = mapping + frame.slot * ring.slot_size;
+  EXPECT_EQ(((frame_tap::slot_header_t *) slot)->sequence, frame.sequence + 1);
+  EXPECT_TRUE(std::equal(std::begin(*data), std::end(*data), slot + frame_tap::DATA_OFFSET));
+
+  munmap(mapping, size);
+  close(memfd);
+  close(consumer);
+
+  tap.reset();
+  EXPECT_FALSE(std::filesystem::exists(path));
+}
+#endif
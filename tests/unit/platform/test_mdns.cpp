@@ -0,0 +1,113 @@
+/**
+ * @file tests/unit/platform/test_mdns.cpp
+ * @brief Test src/platform/linux/mdns.*.
+ */
+#include "../../tests_common.h"
+
+#ifdef __linux__
+  #include <src/platform/linux/mdns.h>
+
+namespace {
+  const mdns::service_t SERVICE {"Sunshine-Pi", "sunshine-pi", 47989};
+
+  /**
+   * @brief Build a query with one question per name, encoded without compression.
+   */
+  std::vector<std::uint8_t> make_query(std::uint16_t id, const std::vector<std::string> &names, bool unicast = false) {
+    std::vector<std::uint8_t> packet {(std::uint8_t) (id >> 8), (std::uint8_t) id, 0, 0, 0, (std::uint8_t) names.size(), 0, 0, 0, 0, 0, 0};
+    for (auto &name : names) {
+      std::size_t start = 0;
+      while (start < name.size()) {
+        auto dot = std::min(name.find('.', start), name.size());
+        packet.push_back((std::uint8_t) (dot - start));
+        packet.insert(std::end(packet), std::begin(name) + start, std::begin(name) + dot);
+        start = dot + 1;
+      }
+      packet.insert(std::end(packet), {0, 0, 12, (std::uint8_t) (unicast ? 0x80 : 0), 1});
+    }
+    return packet;
+  }
+}  // namespace
+
+TEST(MdnsTest, ParsesQuestions) {
+  auto query = mdns::parse_query(make_query(0x1234, {"_nvstream._tcp.local", "other.local"}, true));
+  ASSERT_TRUE(query);
+  EXPECT_EQ(query->id, 0x1234);
+  EXPECT_EQ(query->names, (std::vector<std::string> {"_nvstream._tcp.local", "other.local"}));
+  EXPECT_TRUE(query->unicast);
+}
+
+TEST(MdnsTest, FollowsCompressionPointers) {
+  auto packet = make_query(0, {"_nvstream._tcp.local"});
+
+  // A second question pointing at the "_tcp.local" of the first one
+  packet[5] = 2;
+  packet.insert(std::end(packet), {6, 'o', 't', 'h', 'e', 'r', 's', 0xC0, 12 + 10, 0, 12, 0, 1});
+
+  auto query = mdns::parse_query(packet);
+  ASSERT_TRUE(query);
+  EXPECT_EQ(query->names, (std::vector<std::string> {"_nvstream._tcp.local", "others._tcp.local"}));
+}
+
+TEST(MdnsTest, RejectsMalformedPackets) {
+  auto packet = make_query(0, {"_nvstream._tcp.local"});
+
+  // Truncated in the middle of the name
+  EXPECT_FALSE(mdns::parse_query(std::span {packet}.first(16)));
+
+  // A pointer to itself would loop forever
+  std::vector<std::uint8_t> loop {0, 0, 0, 0, 0, 1, 0, 0, 0, 0, 0, 0, 0xC0, 12, 0, 12, 0, 1};
+  EXPECT_FALSE(mdns::parse_query(loop));
+
+  // Responses aren't queries
+  packet[2] = 0x84;
+  EXPECT_FALSE(mdns::parse_query(packet));
+}
+
+TEST(MdnsTest, AnswersForTheServiceAndTheHost) {
+  auto answers = [](const std::string &name) {
+    auto query = mdns::parse_query(make_query(0, {name}));
+    return query && mdns::answers(SERVICE, *query);
+  };
+
+  EXPECT_TRUE(answers("_nvstream._tcp.local"));
+  EXPECT_TRUE(answers("Sunshine-Pi._nvstream._tcp.local"));
+  EXPECT_TRUE(answers("SUNSHINE-PI.local"));
+  EXPECT_TRUE(answers("_services._dns-sd._udp.local"));
+  EXPECT_FALSE(answers("_airplay._tcp.local"));
+  EXPECT_FALSE(answers("other.local"));
+}
+
+TEST(MdnsTest, ResponseHoldsEveryRecord) {
+  auto response = mdns::make_response(SERVICE, {{192, 168, 1, 2}}, 0x1234, false);
+
+  ASSERT_GE(response.size(), 12);
+  EXPECT_EQ(response[0], 0x12);
+  EXPECT_EQ(response[1], 0x34);
+  EXPECT_EQ(response[2] & 0x80, 0x80);
+
+  // PTR for the service list and the service, SRV, TXT and one A record
+  EXPECT_EQ(response[7], 5);
+
+  auto contains = [&](std::vector<std::uint8_t> bytes) {
+    return std::search(std::begin(response), std::end(response), std::begin(bytes), std::end(bytes)) != std::end(response);
+  };
+  EXPECT_TRUE(contains({11, 'S', 'u', 'n', 's', 'h', 'i', 'n', 'e', '-', 'P', 'i', 9, '_', 'n', 'v', 's', 't', 'r', 'e', 'a', 'm'}));
+  EXPECT_TRUE(contains({0, 4, 192, 168, 1, 2}));
+
+  // The SRV record: priority, weight, port and the host
+  EXPECT_TRUE(contains({0, 0, 0, 0, 47989 >> 8, 47989 & 0xFF, 11, 's', 'u', 'n', 's', 'h', 'i', 'n', 'e', '-', 'p', 'i', 5, 'l', 'o', 'c', 'a', 'l', 0}));
+}
+
+TEST(MdnsTest, GoodbyeWithdrawsTheRecords) {
+  auto response = mdns::make_response(SERVICE, {{192, 168, 1, 2}}, 0, true);
+
+  auto contains = [&](std::vector<std::uint8_t> bytes) {
+    return std::search(std::begin(response), std::end(response), std::begin(bytes), std::end(bytes)) != std::end(response);
+  };
+
+  // The A record with a TTL of 0, and no record left with the regular TTL
+  EXPECT_TRUE(contains({0, 0, 0, 0, 0, 4, 192, 168, 1, 2}));
+  EXPECT_FALSE(contains({0, 0, mdns::SERVICE_TTL >> 8, mdns::SERVICE_TTL & 0xFF}));
+}
+#endif
@@ -0,0 +1,38 @@
+/**
+ * @file tests/unit/platform/test_uring.cpp
+ * @brief Test src/platform/linux/uring.*.
+ */
+#include "../../tests_common.h"
+
+#ifdef __linux__
+  #include <src/platform/linux/uring.h>
+
+TEST(UringTest, CompletesSubmissionsInOneCall) {
+  auto ring = uring::ring_t::create(4);
+  if (!ring) {
+    GTEST_SKIP() << "io_uring isn't available";
+  }
+
+  for (std::uint64_t x = 0; x < 4; ++x) {
+    auto sqe = ring->get_sqe();
+    ASSERT_NE(sqe, nullptr);
+    sqe->opcode = IORING_OP_NOP;
+    sqe->user_data = x;
+  }
+  EXPECT_EQ(ring->get_sqe(), nullptr);
+
+  ring->submit_and_wait(4);
+
+  std::uint64_t seen = 0;
+  for (int x = 0; x < 4; ++x) {
+    io_uring_cqe cqe;
+    ring->wait_cqe(cqe);
+    EXPECT_EQ(cqe.res, 0);
+    seen |= 1 << cqe.user_data;
+  }
+  EXPECT_EQ(seen, 0b1111);
+
+  // The submission queue is free again once the kernel consumed the entries
+  EXPECT_NE(ring->get_sqe(), nullptr);
+}
+#endif
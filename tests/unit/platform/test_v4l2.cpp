@@ -0,0 +1,201 @@
+/**
+ * @file tests/unit/platform/test_v4l2.cpp
+ * @brief Test src/platform/linux/v4l2.*.
+ */
+#include "../../tests_common.h"
+
+#ifdef SUNSHINE_BUILD_PICAMERA
+  #include <src/platform/linux/v4l2.h>
+
+namespace {
+  v4l2::frame_size_t discrete(int width, int height, std::vector<double> framerates) {
+    return {width, height, width, height, 1, 1, std::move(framerates)};
+  }
+
+  v4l2::capabilities_t usb_camera() {
+    return {
+      "/dev/video0",
+      "USB Camera",
+      "uvcvideo",
+      "usb-0000:01:00.0-1.2",
+      {
+        {V4L2_PIX_FMT_YUYV, false, {discrete(640, 480, {15, 30}), discrete(1280, 720, {10})}},
+        {V4L2_PIX_FMT_MJPEG, true, {discrete(640, 480, {30}), discrete(1280, 720, {30, 60}), discrete(1920, 1080, {30})}},
+      },
+    };
+  }
+
+  const std::vector<std::uint32_t> fourccs {V4L2_PIX_FMT_NV12, V4L2_PIX_FMT_YUYV, V4L2_PIX_FMT_MJPEG};
+}  // namespace
+
+TEST(V4L2ClosestModeTest, PrefersRawFormatAtExactSize) {
+  auto mode = v4l2::closest_mode(usb_camera(), 640, 480, 30, fourccs);
+  ASSERT_TRUE(mode);
+  EXPECT_EQ(mode->fourcc, V4L2_PIX_FMT_YUYV);
+  EXPECT_EQ(mode->width, 640);
+  EXPECT_EQ(mode->height, 480);
+  EXPECT_DOUBLE_EQ(mode->framerate, 30);
+}
+
+TEST(V4L2ClosestModeTest, PrefersExactSizeOverFormat) {
+  auto mode = v4l2::closest_mode(usb_camera(), 1920, 1080, 30, fourccs);
+  ASSERT_TRUE(mode);
+  EXPECT_EQ(mode->fourcc, V4L2_PIX_FMT_MJPEG);
+  EXPECT_EQ(mode->width, 1920);
+  EXPECT_EQ(mode->height, 1080);
+}
+
+TEST(V4L2ClosestModeTest, PicksFramerateAtOrAboveRequest) {
+  auto mode = v4l2::closest_mode(usb_camera(), 1280, 720, 60, {V4L2_PIX_FMT_MJPEG});
+  ASSERT_TRUE(mode);
+  EXPECT_DOUBLE_EQ(mode->framerate, 60);
+}
+
+TEST(V4L2ClosestModeTest, ClampsToStepwiseRange) {
+  v4l2::capabilities_t caps {
+    "/dev/video0",
+    "mmal service 16.1",
+    "bm2835 mmal",
+    "platform:bcm2835-v4l2-0",
+    {
+      {V4L2_PIX_FMT_NV12, false, {{32, 32, 2592, 1944, 2, 2, {1, 90}, 0.0}}},
+    },
+  };
+
+  auto mode = v4l2::closest_mode(caps, 1920, 1080, 60, fourccs);
+  ASSERT_TRUE(mode);
+  EXPECT_EQ(mode->width, 1920);
+  EXPECT_EQ(mode->height, 1080);
+  EXPECT_DOUBLE_EQ(mode->framerate, 60);
+
+  mode = v4l2::closest_mode(caps, 3840, 2160, 30, fourccs);
+  ASSERT_TRUE(mode);
+  EXPECT_EQ(mode->width, 2592);
+  EXPECT_EQ(mode->height, 1944);
+}
+
+TEST(V4L2ClosestModeTest, SnapsFramerateToIntervalStep) {
+  v4l2::capabilities_t caps {
+    "/dev/video0",
+    "mmal service 16.1",
+    "bm2835 mmal",
+    "platform:bcm2835-v4l2-0",
+    {
+      {V4L2_PIX_FMT_NV12, false, {{32, 32, 2592, 1944, 2, 2, {1, 90}, 1.0 / 90}}},
+    },
+  };
+
+  // Intervals of 1/90 s, 2/90 s, ... leave 90 and 45 fps around 60 and 40, the faster one is picked
+  auto mode = v4l2::closest_mode(caps, 1920, 1080, 60, fourccs);
+  ASSERT_TRUE(mode);
+  EXPECT_NEAR(mode->framerate, 90, 1e-6);
+
+  mode = v4l2::closest_mode(caps, 1920, 1080, 40, fourccs);
+  ASSERT_TRUE(mode);
+  EXPECT_NEAR(mode->framerate, 45, 1e-6);
+
+  // Requests beyond the range are clamped into it
+  mode = v4l2::closest_mode(caps, 1920, 1080, 120, fourccs);
+  ASSERT_TRUE(mode);
+  EXPECT_NEAR(mode->framerate, 90, 1e-6);
+}
+
+TEST(V4L2ClosestModeTest, QueriesFrameratesAtChosenStepwiseSize) {
+  v4l2::frame_size_t size {32, 32, 2592, 1944, 2, 2, {1, 15}, 0.0};
+  std::pair<int, int> queried;
+  size.framerates_at = [&](int width, int height) {
+    queried = {width, height};
+    return v4l2::frame_size_t {width, height, width, height, 1, 1, {1, 60}, 0.0};
+  };
+
+  v4l2::capabilities_t caps {
+    "/dev/video0",
+    "mmal service 16.1",
+    "bm2835 mmal",
+    "platform:bcm2835-v4l2-0",
+    {
+      {V4L2_PIX_FMT_NV12, false, {size}},
+    },
+  };
+
+  // The largest size only reaches 15 fps, the one picked reaches 60
+  auto mode = v4l2::closest_mode(caps, 1280, 720, 60, fourccs);
+  ASSERT_TRUE(mode);
+  EXPECT_EQ(queried, std::make_pair(1280, 720));
+  EXPECT_DOUBLE_EQ(mode->framerate, 60);
+}
+
+TEST(V4L2ClosestModeTest, PrefersFramerateOverSize) {
+  std::string reason;
+
+  // Only the MJPEG modes reach 30 fps at 720p
+  auto mode = v4l2::closest_mode(usb_camera(), 1280, 720, 30, fourccs, &reason);
+  ASSERT_TRUE(mode);
+  EXPECT_EQ(mode->fourcc, V4L2_PIX_FMT_MJPEG);
+  EXPECT_EQ(mode->width, 1280);
+  EXPECT_DOUBLE_EQ(mode->framerate, 30);
+  EXPECT_NE(reason.find("matches"), std::string::npos);
+}
+
+TEST(V4L2ClosestModeTest, PicksBinnedModeForHighFramerate) {
+  v4l2::capabilities_t caps {
+    "/dev/video0",
+    "imx219",
+    "unicam",
+    "platform:fe801000.csi",
+    {
+      {V4L2_PIX_FMT_NV12, false, {discrete(3280, 2464, {15}), discrete(1920, 1080, {30}), discrete(1640, 1232, {40}), discrete(1640, 922, {40}), discrete(640, 480, {90})}},
+    },
+  };
+  std::string reason;
+
+  // The binned full field of view is closest to 1080p among the modes reaching 40 fps
+  auto mode = v4l2::closest_mode(caps, 1920, 1080, 40, fourccs, &reason);
+  ASSERT_TRUE(mode);
+  EXPECT_EQ(mode->width, 1640);
+  EXPECT_EQ(mode->height, 1232);
+  EXPECT_NE(reason.find("scaled up"), std::string::npos);
+
+  // Modes covering the request are scaled down rather than a smaller one scaled up
+  mode = v4l2::closest_mode(caps, 800, 600, 30, fourccs, &reason);
+  ASSERT_TRUE(mode);
+  EXPECT_EQ(mode->width, 1640);
+  EXPECT_EQ(mode->height, 922);
+  EXPECT_NE(reason.find("scaled down"), std::string::npos);
+
+  // Nothing reaches 120 fps, so the fastest mode wins
+  mode = v4l2::closest_mode(caps, 1280, 720, 120, fourccs, &reason);
+  ASSERT_TRUE(mode);
+  EXPECT_EQ(mode->width, 640);
+  EXPECT_DOUBLE_EQ(mode->framerate, 90);
+  EXPECT_NE(reason.find("fastest"), std::string::npos);
+}
+
+TEST(V4L2ClosestModeTest, NoSupportedFormat) {
+  EXPECT_FALSE(v4l2::closest_mode(usb_camera(), 640, 480, 30, {V4L2_PIX_FMT_NV12}));
+}
+
+TEST(V4L2CenteredCropTest, CropsWiderTarget) {
+  auto crop = v4l2::centered_crop({0, 0, 2592, 1944}, 1920, 1080);
+  EXPECT_EQ(crop.width, 2592);
+  EXPECT_EQ(crop.height, 1458);
+  EXPECT_EQ(crop.left, 0);
+  EXPECT_EQ(crop.top, 242);
+}
+
+TEST(V4L2CenteredCropTest, CropsTallerTarget) {
+  auto crop = v4l2::centered_crop({16, 8, 1920, 1080}, 640, 480);
+  EXPECT_EQ(crop.width, 1440);
+  EXPECT_EQ(crop.height, 1080);
+  EXPECT_EQ(crop.left, 256);
+  EXPECT_EQ(crop.top, 8);
+}
+
+TEST(V4L2CenteredCropTest, MatchingAspectRatioKeepsBounds) {
+  auto crop = v4l2::centered_crop({0, 0, 1280, 720}, 1920, 1080);
+  EXPECT_EQ(crop.width, 1280);
+  EXPECT_EQ(crop.height, 720);
+  EXPECT_EQ(crop.left, 0);
+  EXPECT_EQ(crop.top, 0);
+}
+#endif
@@ -66,3 +66,57 @@ TEST_P(AudioTest, TestEncode) {
   timer.join();
   capture.join();
 }
+
+TEST(PacketBufferTest, ReturnsToPool) {
+  auto pool = std::make_shared<buffer_pool_t::element_type>(4);
+
+  {
+    packet_t packet {nullptr, packet_buffer_t {buffer_t {1400}, pool, std::chrono::steady_clock::now()}};
+    packet.second.fake_resize(10);
+
+    // Copies don't take the pooled buffer with them
+    auto copy = packet.second;
+    EXPECT_EQ(copy.size(), 10);
+  }
+
+  auto buffer = pool->pop(0ms);
+  ASSERT_TRUE(buffer);
+  EXPECT_NE(buffer->begin(), nullptr);
+  EXPECT_FALSE(pool->peek());
+}
+
+TEST(ComplexityControllerTest, LowersComplexityThenBandwidth) {
+  complexity_controller_t controller {2, 5ms};
+
+  // Encoding takes half of each packet's duration, a second's worth at a time
+  auto slow_window = [&controller]() {
+    bool changed = false;
+    for (int x = 0; x < 200; ++x) {
+      changed = controller.collect(2500us);
+    }
+    return changed;
+  };
+
+  EXPECT_TRUE(slow_window());
+  EXPECT_EQ(controller.complexity(), 0);
+  EXPECT_FALSE(controller.reduced_bandwidth());
+
+  EXPECT_TRUE(slow_window());
+  EXPECT_EQ(controller.complexity(), 0);
+  EXPECT_TRUE(controller.reduced_bandwidth());
+
+  EXPECT_FALSE(slow_window());
+}
+
+TEST(ComplexityControllerTest, RaisesComplexityAfterCalmWindows) {
+  complexity_controller_t controller {9, 5ms};
+
+  int changes = 0;
+  for (int x = 0; x < 200 * 10; ++x) {
+    changes += controller.collect(100us);
+  }
+
+  // One step per five cheap windows, capped at the Opus maximum
+  EXPECT_EQ(changes, 1);
+  EXPECT_EQ(controller.complexity(), 10);
+}
@@ -0,0 +1,71 @@
+/**
+ * @file tests/unit/test_crypto.cpp
+ * @brief Test src/crypto.*.
+ */
+#include "../tests_common.h"
+
+#include <src/crypto.h>
+
+using crypto::cipher::aead_e;
+
+namespace {
+  crypto::aes_t key {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15};
+
+  // 12 bytes, like the IVs of the video stream
+  crypto::aes_t make_iv(std::uint8_t counter) {
+    crypto::aes_t iv(12);
+    iv[0] = counter;
+    iv[11] = 'V';
+    return iv;
+  }
+}  // namespace
+
+class AeadTest: public ::testing::TestWithParam<aead_e> {};
+
+TEST_P(AeadTest, RoundTrips) {
+  crypto::cipher::gcm_t encrypter {key, false, GetParam()};
+  crypto::cipher::gcm_t decrypter {key, false, GetParam()};
+
+  std::string_view plaintext {"a shard of a video frame"};
+  for (std::uint8_t counter = 0; counter < 3; ++counter) {
+    auto iv = make_iv(counter);
+
+    std::vector<std::uint8_t> tagged_cipher(crypto::cipher::tag_size + plaintext.size());
+    auto bytes = encrypter.encrypt(plaintext, tagged_cipher.data(), &iv);
+    ASSERT_EQ(bytes, (int) plaintext.size());
+
+    std::vector<std::uint8_t> decrypted;
+    ASSERT_EQ(decrypter.decrypt(std::string_view {(char *) tagged_cipher.data(), tagged_cipher.size()}, decrypted, &iv), 0);
+    EXPECT_EQ(std::string_view((char *) decrypted.data(), decrypted.size()), plaintext);
+
+    // A flipped bit fails the tag
+    tagged_cipher.back() ^= 1;
+    EXPECT_NE(decrypter.decrypt(std::string_view {(char *) tagged_cipher.data(), tagged_cipher.size()}, decrypted, &iv), 0);
+  }
+}
+
+INSTANTIATE_TEST_SUITE_P(
+  CryptoTest,
+  AeadTest,
+  ::testing::Values(aead_e::aes_128_gcm, aead_e::chacha20_poly1305)
+);
+
+TEST(CryptoTest, ChaCha20VideoKeyFollowsHkdf) {
+  // HKDF-SHA256 of the key above without salt, computed independently of OpenSSL
+  auto derived = crypto::chacha20_video_key(key);
+  EXPECT_EQ(util::hex_vec(derived, true), "1D7193B7178023F9347EFC12AA0ED2CB464B51D4A993313D946FEDAD09E8C49D");
+}
+
+TEST(CryptoTest, AlgorithmsDontDecryptEachOther) {
+  crypto::cipher::gcm_t gcm {key, false, aead_e::aes_128_gcm};
+  crypto::cipher::gcm_t chacha {key, false, aead_e::chacha20_poly1305};
+
+  std::string_view plaintext {"a shard of a video frame"};
+  auto iv = make_iv(0);
+
+  std::vector<std::uint8_t> tagged_cipher(crypto::cipher::tag_size + plaintext.size());
+  ASSERT_EQ(gcm.encrypt(plaintext, tagged_cipher.data(), &iv), (int) plaintext.size());
+
+  std::vector<std::uint8_t> decrypted;
+  EXPECT_NE(chacha.decrypt(std::string_view {(char *) tagged_cipher.data(), tagged_cipher.size()}, decrypted, &iv), 0);
+}
@@ -0,0 +1,217 @@
+/**
+ * @file tests/unit/test_input_replay.cpp
+ * @brief Benchmark src/input.* by replaying input messages through the input thread.
+ */
+#include "../tests_common.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+#include <boost/endian/conversion.hpp>
+#include <moonlight-common-c/src/Input.h>
+#include <moonlight-common-c/src/Limelight.h>
+#include <src/input.h>
+#include <src/utility.h>
+
+using namespace std::literals;
+
+namespace {
+  using message_t = std::vector<std::uint8_t>;
+
+  // The messages a client sends in one go, e.g. the touch events of one frame
+  using burst_t = std::vector<message_t>;
+
+  constexpr auto BURSTS = 256;
+  constexpr auto MESSAGES_PER_BURST = 8;
+
+  template<class T>
+  message_t make_message(std::uint32_t magic, T packet) {
+    packet.header.size = util::endian::big<std::uint32_t>(sizeof(T) - sizeof(packet.header.size));
+    packet.header.magic = util::endian::little(magic);
+
+    message_t message(sizeof(T));
+    std::memcpy(message.data(), &packet, sizeof(T));
+    return message;
+  }
+
+  void store(netfloat &f, float value) {
+    boost::endian::endian_store<float, sizeof(float), boost::endian::order::little>(f, value);
+  }
+
+  /**
+   * @brief Record bursts of messages, the message generator gets the index of the message in the recording.
+   */
+  template<class F>
+  std::vector<burst_t> record(F &&message) {
+    std::vector<burst_t> bursts(BURSTS);
+    for (int x = 0; x < BURSTS; ++x) {
+      for (int y = 0; y < MESSAGES_PER_BURST; ++y) {
+        bursts[x].emplace_back(message(x * MESSAGES_PER_BURST + y));
+      }
+    }
+
+    return bursts;
+  }
+
+  std::vector<burst_t> record_mouse() {
+    return record([](int x) {
+      // Back and forth, so the cursor ends where it started on a real backend
+      NV_REL_MOUSE_MOVE_PACKET packet {};
+      packet.deltaX = util::endian::big<std::int16_t>(x % 2 ? -3 : 3);
+      packet.deltaY = util::endian::big<std::int16_t>(x % 2 ? -1 : 1);
+      return make_message(MOUSE_MOVE_REL_MAGIC_GEN5, packet);
+    });
+  }
+
+  std::vector<burst_t> record_touch() {
+    return record([](int x) {
+      SS_TOUCH_PACKET packet {};
+      packet.eventType = LI_TOUCH_EVENT_MOVE;
+      packet.pointerId = util::endian::little<std::uint32_t>(0);
+      store(packet.x, (x % 100) / 100.0f);
+      store(packet.y, 0.5f);
+      store(packet.pressureOrDistance, 1.0f);
+      return make_message(SS_TOUCH_MAGIC, packet);
+    });
+  }
+
+  std::vector<burst_t> record_pen() {
+    return record([](int x) {
+      SS_PEN_PACKET packet {};
+      packet.eventType = LI_TOUCH_EVENT_MOVE;
+      packet.toolType = LI_TOOL_TYPE_PEN;
+      store(packet.x, 0.5f);
+      store(packet.y, (x % 100) / 100.0f);
+      store(packet.pressureOrDistance, 0.5f);
+      return make_message(SS_PEN_MAGIC, packet);
+    });
+  }
+
+  std::vector<burst_t> record_motion() {
+    return record([](int x) {
+      SS_CONTROLLER_MOTION_PACKET packet {};
+      packet.controllerNumber = 0;
+      packet.motionType = LI_MOTION_TYPE_GYRO;
+      store(packet.x, std::sin(x / 10.0f));
+      store(packet.y, std::cos(x / 10.0f));
+      store(packet.z, 0.0f);
+      return make_message(SS_CONTROLLER_MOTION_MAGIC, packet);
+    });
+  }
+
+  std::vector<burst_t> record_controller() {
+    return record([](int x) {
+      NV_MULTI_CONTROLLER_PACKET packet {};
+      packet.controllerNumber = util::endian::little<std::int16_t>(0);
+      packet.activeGamepadMask = util::endian::little<std::int16_t>(1);
+      packet.leftStickX = util::endian::little<std::int16_t>((x % 64) * 512);
+      packet.rightTrigger = x % 256;
+      return make_message(MULTI_CONTROLLER_MAGIC_GEN5, packet);
+    });
+  }
+
+  struct result_t {
+    std::uint64_t messages;
+    std::uint64_t batches;
+    std::uint64_t gamepad_reports_coalesced;
+    double events_per_sec;
+    double p99_ms;  ///< Time from the first message of a burst to the whole burst being sent to the OS
+  };
+
+  result_t replay(std::shared_ptr<input::input_t> &input, const std::vector<burst_t> &bursts) {
+    auto before = input::stats();
+
+    std::vector<double> latencies;
+    latencies.reserve(bursts.size());
+
+    std::uint64_t messages = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (auto &burst : bursts) {
+      auto burst_start = std::chrono::steady_clock::now();
+      for (auto &message : burst) {
+        input::passthrough(input, message_t {message});
+      }
+      input::drain();
+
+      latencies.emplace_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - burst_start).count());
+      messages += burst.size();
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    auto after = input::stats();
+
+    std::sort(std::begin(latencies), std::end(latencies));
+    auto p99 = latencies[(std::size_t) std::ceil(latencies.size() * 0.99) - 1];
+
+    EXPECT_EQ(after.messages - before.messages, messages);
+    return {
+      after.messages - before.messages,
+      after.batches - before.batches,
+      after.gamepad_reports_coalesced - before.gamepad_reports_coalesced,
+      messages / elapsed.count(),
+      p99,
+    };
+  }
+}  // namespace
+
+struct InputReplayBenchmark: PlatformTestSuite, testing::WithParamInterface<std::pair<const char *, std::vector<burst_t> (*)()>> {
+  static void SetUpTestSuite() {
+    PlatformTestSuite::SetUpTestSuite();
+    input_deinit = input::init();
+  }
+
+  static void TearDownTestSuite() {
+    input_deinit = {};
+    PlatformTestSuite::TearDownTestSuite();
+  }
+
+  void SetUp() override {
+    input = input::alloc(std::make_shared<safe::mail_raw_t>());
+  }
+
+  void TearDown() override {
+    input::reset(input);
+    input::drain();
+
+    // Gamepads are freed from the input thread
+    input = {};
+    input::drain();
+  }
+
+  std::shared_ptr<input::input_t> input;
+
+private:
+  inline static std::unique_ptr<platf::deinit_t> input_deinit;
+};
+
+INSTANTIATE_TEST_SUITE_P(
+  InputReplay,
+  InputReplayBenchmark,
+  testing::Values(
+    std::pair {"mouse", &record_mouse},
+    std::pair {"touch", &record_touch},
+    std::pair {"pen", &record_pen},
+    std::pair {"motion", &record_motion},
+    std::pair {"controller", &record_controller}
+  ),
+  [](const auto &info) {
+    return std::string {info.param.first};
+  }
+);
+
+TEST_P(InputReplayBenchmark, Replay) {
+  auto [name, recording] = GetParam();
+  auto result = replay(input, recording());
+
+  // Every burst goes out in at least one batch, and a batch holds at least one message
+  EXPECT_GE(result.batches, BURSTS);
+  EXPECT_LE(result.batches, result.messages);
+
+  BOOST_LOG(tests) << name << ": "sv << result.events_per_sec << " events/s, "sv
+                   << (double) result.messages / result.batches << " messages per batch, "sv
+                   << result.gamepad_reports_coalesced << " gamepad reports coalesced, "sv
+                   << "p99 latency "sv << result.p99_ms << " ms"sv;
+}
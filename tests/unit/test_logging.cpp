@@ -11,7 +11,9 @@
 
 namespace {
   std::array log_levels = {
+#ifndef SUNSHINE_NO_VERBOSE_LOG
     std::tuple("verbose", &verbose),
+#endif
     std::tuple("debug", &debug),
     std::tuple("info", &info),
     std::tuple("warning", &warning),
@@ -45,3 +47,14 @@ TEST_P(LogLevelsTest, PutMessage) {
 
   ASSERT_TRUE(log_checker::line_contains(log_file, test_message));
 }
+
+TEST(LogFileTest, LineSeverity) {
+  EXPECT_EQ(logging::line_severity("[2024-05-01 12:00:00.123]: Verbose: message\n"), 0);
+  EXPECT_EQ(logging::line_severity("[2024-05-01 12:00:00.123]: Warning: message"), 3);
+  EXPECT_EQ(logging::line_severity("[2024-05-01 12:00:00.123]: Fatal: message"), 5);
+
+  // The rest of a multi-line message doesn't start with a timestamp
+  EXPECT_FALSE(logging::line_severity("  second line of a message"));
+  EXPECT_FALSE(logging::line_severity("[2024-05-01 12:00:00.123]: Unknown: message"));
+  EXPECT_FALSE(logging::line_severity(""));
+}
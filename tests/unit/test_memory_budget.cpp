@@ -0,0 +1,56 @@
+/**
+ * @file tests/unit/test_memory_budget.cpp
+ * @brief Test src/memory_budget.*.
+ */
+#include "../tests_common.h"
+
+#include <src/config.h>
+#include <src/memory_budget.h>
+
+struct MemoryBudgetTest: testing::Test {
+  void SetUp() override {
+    previous_budget = config::sunshine.memory_budget;
+  }
+
+  void TearDown() override {
+    config::sunshine.memory_budget = previous_budget;
+  }
+
+  int previous_budget;
+};
+
+TEST_F(MemoryBudgetTest, PoolsKeepTheirSizeWithoutABudget) {
+  config::sunshine.memory_budget = 0;
+
+  EXPECT_FALSE(memory_budget::enabled());
+  EXPECT_FALSE(memory_budget::budget());
+  EXPECT_EQ(memory_budget::buffers(memory_budget::subsystem_e::capture_images, 1920 * 1080 * 4, 3, 12), 12);
+  EXPECT_EQ(memory_budget::queue_depth(), 32);
+}
+
+TEST_F(MemoryBudgetTest, PoolsFitTheirShareOfTheBudget) {
+  config::sunshine.memory_budget = 100;
+
+  ASSERT_TRUE(memory_budget::enabled());
+  EXPECT_EQ(memory_budget::budget(), 100ULL * 1024 * 1024);
+  EXPECT_LT(memory_budget::queue_depth(), 32);
+
+  // 60 MiB for the capture images, 7 images of 8 MiB
+  EXPECT_EQ(memory_budget::buffers(memory_budget::subsystem_e::capture_images, 8 * 1024 * 1024, 3, 12), 7);
+
+  // Never fewer than the subsystem needs, never more than without a budget
+  EXPECT_EQ(memory_budget::buffers(memory_budget::subsystem_e::capture_images, 64 * 1024 * 1024, 3, 12), 3);
+  EXPECT_EQ(memory_budget::buffers(memory_budget::subsystem_e::audio_samples, 1024, 4, 32), 32);
+}
+
+TEST_F(MemoryBudgetTest, FootprintKeepsThePeak) {
+  auto subsystem = memory_budget::subsystem_e::fec_buffers;
+  auto before = memory_budget::footprint(subsystem);
+
+  memory_budget::account(subsystem, before.peak + 1000);
+  memory_budget::account(subsystem, -(before.peak + 1000));
+
+  auto after = memory_budget::footprint(subsystem);
+  EXPECT_EQ(after.current, before.current);
+  EXPECT_EQ(after.peak, before.current + before.peak + 1000);
+}
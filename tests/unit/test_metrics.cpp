@@ -0,0 +1,60 @@
+/**
+ * @file tests/unit/test_metrics.cpp
+ * @brief Test src/metrics.*.
+ */
+#include "../tests_common.h"
+
+#include <atomic>
+#include <format>
+#include <src/metrics.h>
+#include <src/platform/common.h>
+#include <string>
+#include <thread>
+
+using namespace std::literals;
+
+TEST(MetricsTest, CountersAreFormattedInTheirUnit) {
+  auto before = metrics::get(metrics::counter_e::audio_encode_us);
+  metrics::add(metrics::counter_e::audio_encode_us, 2'000'000);
+  EXPECT_EQ(metrics::get(metrics::counter_e::audio_encode_us), before + 2'000'000);
+
+  auto out = metrics::format();
+  EXPECT_NE(out.find("# TYPE sunshine_audio_encode_seconds_total counter\n"), std::string::npos);
+  EXPECT_NE(out.find(std::format("sunshine_audio_encode_seconds_total {}\n", (before + 2'000'000) * 1e-6)), std::string::npos);
+}
+
+TEST(MetricsTest, GaugesHoldTheLastValue) {
+  metrics::set(metrics::gauge_e::video_packet_queue, 3);
+  metrics::set(metrics::gauge_e::video_packet_queue, 1);
+
+  auto out = metrics::format();
+  EXPECT_NE(out.find("# TYPE sunshine_video_packet_queue gauge\nsunshine_video_packet_queue 1\n"), std::string::npos);
+}
+
+#ifdef __linux__
+TEST(MetricsTest, ThreadCpuTimeIsReportedByName) {
+  std::atomic_bool done {false};
+  std::thread named([&done]() {
+    platf::set_thread_name("metrics_test"s);
+    while (!done) {
+      // Spin, so the kernel accounts CPU time to the thread
+    }
+  });
+
+  bool found = false;
+  for (int x = 0; x < 200 && !found; ++x) {
+    for (auto &thread : platf::thread_cpu_times()) {
+      found = found || (thread.name == "metrics_test"sv && thread.cpu_time > 0ns);
+    }
+    std::this_thread::sleep_for(10ms);
+  }
+  auto out = metrics::format();
+
+  done = true;
+  named.join();
+
+  EXPECT_TRUE(found);
+  EXPECT_NE(out.find("sunshine_thread_cpu_seconds_total{thread=\"metrics_test\"}"), std::string::npos);
+  EXPECT_GT(platf::resident_memory().value_or(0), 0);
+}
+#endif
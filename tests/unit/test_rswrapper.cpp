@@ -8,6 +8,13 @@ extern "C" {
 
 #include "../tests_common.h"
 
+#include <algorithm>
+#include <array>
+#include <random>
+#include <vector>
+
+using namespace std::literals;
+
 TEST(ReedSolomonWrapperTests, InitTest) {
   reed_solomon_init();
 
@@ -34,3 +41,99 @@ TEST(ReedSolomonWrapperTests, EncodeTest) {
 
   reed_solomon_release(rs);
 }
+
+namespace {
+  // A video FEC block, MTU sized shards with the default 20% parity
+  constexpr int DATA_SHARDS = 80;
+  constexpr int PARITY_SHARDS = 20;
+  constexpr int BLOCKSIZE = 1024;
+
+  struct block_t {
+    block_t():
+        data((DATA_SHARDS + PARITY_SHARDS) * BLOCKSIZE) {
+      for (int x = 0; x < DATA_SHARDS + PARITY_SHARDS; ++x) {
+        shards[x] = data.data() + x * BLOCKSIZE;
+      }
+    }
+
+    block_t(const block_t &) = delete;
+
+    std::vector<uint8_t> data;
+    std::array<uint8_t *, DATA_SHARDS + PARITY_SHARDS> shards;
+  };
+}  // namespace
+
+TEST(ReedSolomonWrapperTests, MatchesPortableVariant) {
+  reed_solomon_init();
+  reed_solomon_init_def();
+
+  block_t block;
+  std::mt19937 gen {42};
+  std::generate_n(std::begin(block.data), DATA_SHARDS * BLOCKSIZE, std::ref(gen));
+  block_t reference;
+  std::copy(std::begin(block.data), std::end(block.data), std::begin(reference.data));
+
+  auto rs = reed_solomon_new(DATA_SHARDS, PARITY_SHARDS);
+  auto rs_def = reed_solomon_new_def(DATA_SHARDS, PARITY_SHARDS);
+  ASSERT_EQ(reed_solomon_encode(rs, block.shards.data(), DATA_SHARDS + PARITY_SHARDS, BLOCKSIZE), 0);
+  ASSERT_EQ(reed_solomon_encode_def(rs_def, reference.shards.data(), DATA_SHARDS + PARITY_SHARDS, BLOCKSIZE), 0);
+  reed_solomon_release(rs);
+  reed_solomon_release_def(rs_def);
+
+  EXPECT_EQ(block.data, reference.data) << "Parity of the "sv << reed_solomon_isa << " variant differs"sv;
+}
+
+TEST(ReedSolomonWrapperTests, DecodesLostShards) {
+  reed_solomon_init();
+
+  block_t block;
+  std::mt19937 gen {7};
+  std::generate_n(std::begin(block.data), DATA_SHARDS * BLOCKSIZE, std::ref(gen));
+
+  auto rs = reed_solomon_new(DATA_SHARDS, PARITY_SHARDS);
+  ASSERT_EQ(reed_solomon_encode(rs, block.shards.data(), DATA_SHARDS + PARITY_SHARDS, BLOCKSIZE), 0);
+  auto sent = block.data;
+
+  // Lose as many data shards as there are parity shards
+  std::array<uint8_t, DATA_SHARDS + PARITY_SHARDS> marks {};
+  for (int x = 0; x < PARITY_SHARDS; ++x) {
+    marks[x * 4] = 1;
+    std::fill_n(block.shards[x * 4], BLOCKSIZE, 0);
+  }
+
+  ASSERT_EQ(reed_solomon_decode(rs, block.shards.data(), marks.data(), DATA_SHARDS + PARITY_SHARDS, BLOCKSIZE), 0);
+  reed_solomon_release(rs);
+
+  EXPECT_TRUE(std::equal(std::begin(sent), std::begin(sent) + DATA_SHARDS * BLOCKSIZE, std::begin(block.data)));
+}
+
+TEST(ReedSolomonWrapperTests, EncodeBenchmark) {
+  reed_solomon_init();
+  reed_solomon_init_def();
+
+  block_t block;
+  std::mt19937 gen {1};
+  std::generate_n(std::begin(block.data), DATA_SHARDS * BLOCKSIZE, std::ref(gen));
+
+  auto throughput = [&](reed_solomon *rs, auto encode) {
+    constexpr auto BLOCKS = 200;
+
+    auto start = std::chrono::steady_clock::now();
+    for (int x = 0; x < BLOCKS; ++x) {
+      encode(rs, block.shards.data(), DATA_SHARDS + PARITY_SHARDS, BLOCKSIZE);
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    return BLOCKS * DATA_SHARDS * BLOCKSIZE / elapsed.count() / (1024 * 1024);
+  };
+
+  auto rs = reed_solomon_new(DATA_SHARDS, PARITY_SHARDS);
+  auto rs_def = reed_solomon_new_def(DATA_SHARDS, PARITY_SHARDS);
+  auto best = throughput(rs, reed_solomon_encode);
+  auto portable = throughput(rs_def, reed_solomon_encode_def);
+  reed_solomon_release(rs);
+  reed_solomon_release_def(rs_def);
+
+  BOOST_LOG(tests) << "Reed-Solomon encode: "sv << reed_solomon_isa << ' ' << best << " MB/s, default "sv << portable << " MB/s"sv;
+  EXPECT_GT(best, 0);
+}
@@ -0,0 +1,80 @@
+/**
+ * @file tests/unit/test_rtp_egress.cpp
+ * @brief Test src/rtp_egress.*.
+ */
+#include "../tests_common.h"
+
+#include <src/rtp_egress.h>
+
+using rtp_egress::packetize;
+using rtp_egress::payload_t;
+
+namespace {
+  /**
+   * @brief Join the fragments back into the NAL unit they came from, its header rebuilt from theirs.
+   */
+  std::vector<std::uint8_t> reassemble(const std::vector<payload_t> &payloads, int video_format) {
+    std::vector<std::uint8_t> nal;
+    if (video_format == 1) {
+      nal = {(std::uint8_t) ((payloads[0].header[0] & 0x81) | ((payloads[0].header[2] & 0x3F) << 1)), payloads[0].header[1]};
+    } else {
+      nal = {(std::uint8_t) ((payloads[0].header[0] & 0xE0) | (payloads[0].header[1] & 0x1F))};
+    }
+
+    for (auto &payload : payloads) {
+      nal.insert(nal.end(), payload.data.begin(), payload.data.end());
+    }
+    return nal;
+  }
+}  // namespace
+
+TEST(RtpEgressTest, SendsSmallNalUnitsWhole) {
+  std::vector<std::uint8_t> frame {0, 0, 0, 1, 0x67, 1, 2, 0, 0, 1, 0x68, 3, 0, 0, 0, 1, 0x65, 4, 5, 6};
+
+  std::vector<payload_t> payloads;
+  packetize(frame, 0, 1400, payloads);
+
+  ASSERT_EQ(payloads.size(), 3);
+  EXPECT_EQ(payloads[0].header_size, 0);
+  EXPECT_EQ(std::vector<std::uint8_t>(payloads[0].data.begin(), payloads[0].data.end()), (std::vector<std::uint8_t> {0x67, 1, 2}));
+  EXPECT_EQ(std::vector<std::uint8_t>(payloads[1].data.begin(), payloads[1].data.end()), (std::vector<std::uint8_t> {0x68, 3}));
+  EXPECT_EQ(std::vector<std::uint8_t>(payloads[2].data.begin(), payloads[2].data.end()), (std::vector<std::uint8_t> {0x65, 4, 5, 6}));
+}
+
+TEST(RtpEgressTest, FragmentsLargeH264NalUnits) {
+  std::vector<std::uint8_t> nal(3000, 0xAB);
+  nal[0] = 0x65;
+  std::vector<std::uint8_t> frame {0, 0, 0, 1};
+  frame.insert(frame.end(), nal.begin(), nal.end());
+
+  std::vector<payload_t> payloads;
+  packetize(frame, 0, 1400, payloads);
+
+  ASSERT_EQ(payloads.size(), 3);
+  for (std::size_t x = 0; x < payloads.size(); ++x) {
+    EXPECT_EQ(payloads[x].header_size, 2);
+    EXPECT_LE(payloads[x].header_size + payloads[x].data.size(), 1400);
+    EXPECT_EQ(payloads[x].header[0], (0x65 & 0xE0) | 28);
+    EXPECT_EQ((payloads[x].header[1] & 0x80) != 0, x == 0);
+    EXPECT_EQ((payloads[x].header[1] & 0x40) != 0, x + 1 == payloads.size());
+  }
+  EXPECT_EQ(reassemble(payloads, 0), nal);
+}
+
+TEST(RtpEgressTest, FragmentsLargeHevcNalUnits) {
+  std::vector<std::uint8_t> nal(2000, 0xCD);
+  nal[0] = 19 << 1;  // IDR_W_RADL
+  nal[1] = 1;
+  std::vector<std::uint8_t> frame {0, 0, 1};
+  frame.insert(frame.end(), nal.begin(), nal.end());
+
+  std::vector<payload_t> payloads;
+  packetize(frame, 1, 1400, payloads);
+
+  ASSERT_EQ(payloads.size(), 2);
+  EXPECT_EQ(payloads[0].header_size, 3);
+  EXPECT_EQ((payloads[0].header[0] >> 1) & 0x3F, 49);
+  EXPECT_EQ(payloads[0].header[2], 0x80 | 19);
+  EXPECT_EQ(payloads[1].header[2], 0x40 | 19);
+  EXPECT_EQ(reassemble(payloads, 1), nal);
+}
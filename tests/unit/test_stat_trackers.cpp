@@ -0,0 +1,81 @@
+/**
+ * @file tests/unit/test_stat_trackers.cpp
+ * @brief Test src/stat_trackers.*.
+ */
+#include "../tests_common.h"
+
+#include <numeric>
+#include <src/stat_trackers.h>
+#include <thread>
+
+using namespace std::literals;
+
+TEST(LatencyHistogramTest, EmptyHistogram) {
+  stat_trackers::latency_histogram_t histogram;
+
+  EXPECT_EQ(histogram.count(), 0);
+  EXPECT_EQ(histogram.percentile(0.5), 0);
+}
+
+TEST(LatencyHistogramTest, PercentilesWithinBucketResolution) {
+  stat_trackers::latency_histogram_t histogram;
+
+  for (int x = 1; x <= 100; ++x) {
+    histogram.record(std::chrono::milliseconds {x});
+  }
+  EXPECT_EQ(histogram.count(), 100);
+
+  // Percentiles are reported as bucket upper bounds, which are at most ~9% above the sample
+  EXPECT_GE(histogram.percentile(0.5), 50);
+  EXPECT_LE(histogram.percentile(0.5), 50 * 1.1);
+  EXPECT_GE(histogram.percentile(0.99), 99);
+  EXPECT_LE(histogram.percentile(0.99), 99 * 1.1);
+  EXPECT_LE(histogram.percentile(0.5), histogram.percentile(0.99));
+}
+
+TEST(LatencyHistogramTest, ClampsOutOfRangeSamples) {
+  stat_trackers::latency_histogram_t histogram;
+
+  histogram.record(0ns);
+  histogram.record(-1ms);
+  histogram.record(1h);
+  EXPECT_EQ(histogram.count(), 3);
+
+  EXPECT_LE(histogram.percentile(0.5), 0.01);
+  EXPECT_GE(histogram.percentile(1), 16000);
+}
+
+TEST(LatencyHistogramTest, BucketsAreLinearWithinAnOctave) {
+  stat_trackers::log_linear_histogram<4, 4, 1> histogram;
+
+  // 8us to 16us is split in 4 buckets of 2us
+  histogram.record(std::chrono::microseconds {9});
+  EXPECT_DOUBLE_EQ(histogram.percentile(1), 0.010);
+
+  histogram.reset();
+  EXPECT_EQ(histogram.count(), 0);
+
+  histogram.record(std::chrono::microseconds {14});
+  EXPECT_DOUBLE_EQ(histogram.percentile(1), 0.016);
+}
+
+TEST(LatencyHistogramTest, MergesSamplesOfAllThreads) {
+  stat_trackers::latency_histogram_t histogram;
+
+  std::vector<std::thread> threads;
+  for (int x = 0; x < 8; ++x) {
+    threads.emplace_back([&histogram, x]() {
+      for (int y = 0; y < 1000; ++y) {
+        histogram.record(std::chrono::milliseconds {x < 4 ? 1 : 100});
+      }
+    });
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+
+  auto counts = histogram.snapshot();
+  EXPECT_EQ(std::accumulate(counts.begin(), counts.end(), std::uint64_t {}), 8000);
+  EXPECT_LE(stat_trackers::latency_histogram_t::percentile(counts, 0.5), 1.1);
+  EXPECT_GE(stat_trackers::latency_histogram_t::percentile(counts, 0.51), 100);
+}
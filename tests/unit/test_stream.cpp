@@ -3,17 +3,56 @@
  * @brief Test src/stream.*
  */
 
+#include <chrono>
 #include <cstdint>
 #include <functional>
+#include <memory>
+#include <optional>
 #include <string>
+#include <thread>
 #include <vector>
 
+extern "C" {
+#include <src/rswrapper.h>
+}
+#include <src/config.h>
+#include <src/video.h>
+
 namespace stream {
   std::vector<uint8_t> concat_and_insert(uint64_t insert_size, uint64_t slice_size, const std::string_view &data1, const std::string_view &data2);
+  void concat_and_insert(std::vector<uint8_t> &result, uint64_t insert_size, uint64_t slice_size, const std::string_view &data1, const std::string_view &data2);
+  void gather_and_insert(std::vector<uint8_t> &result, uint64_t insert_size, uint64_t slice_size, const std::vector<std::string_view> &segments, const void *insert_template = nullptr);
+  void split_replacements(std::vector<std::string_view> &segments, const std::string_view &payload, const std::vector<video::packet_raw_t::replace_t> &replacements);
+
+  namespace fec {
+    std::shared_ptr<reed_solomon> cached_coder(size_t data_shards, size_t parity_shards);
+    size_t fitting_percentage(size_t payload_size, size_t blocksize, size_t blocks, size_t fecpercentage, size_t minparityshards);
+    std::optional<int> raised_percentage(int current, std::chrono::steady_clock::duration since_last_raise);
+    int decayed_percentage(int current, std::chrono::milliseconds &clean_time);
+  }
+
+  namespace simulcast {
+    const config::stream_t::simulcast_rung_t *closest_rung(const std::vector<config::stream_t::simulcast_rung_t> &rungs, int width, int height, int bitrate);
+  }
+
+  namespace probe {
+    std::uint64_t capacity_bps(std::uint64_t peak_bps, bool lost);
+    std::uint64_t pacing_bps(std::uint64_t capacity_bps, int bitrate_kbps);
+  }
+
+  namespace socket_buffer {
+    int size_for(int bitrate_kbps, int framerate, int fec_percentage);
+  }
+
+  namespace late_frames {
+    bool too_late(std::optional<std::chrono::steady_clock::duration> age, bool newer_queued, std::chrono::milliseconds max_age);
+  }
 }
 
 #include "../tests_common.h"
 
+using namespace std::literals;
+
 TEST(ConcatAndInsertTests, ConcatNoInsertionTest) {
   char b1[] = {'a', 'b'};
   char b2[] = {'c', 'd', 'e'};
@@ -37,3 +76,218 @@ TEST(ConcatAndInsertTests, ConcatSmallStrideTest) {
   auto expected = std::vector<uint8_t> {0, 'a', 0, 'b', 0, 'c', 0, 'd', 0, 'e'};
   ASSERT_EQ(res, expected);
 }
+
+TEST(ConcatAndInsertTests, ConcatReusedBufferTest) {
+  char b1[] = {'a', 'b'};
+  char b2[] = {'c', 'd', 'e'};
+  std::vector<uint8_t> res(16, 'x');
+  auto capacity = res.capacity();
+  stream::concat_and_insert(res, 1, 2, std::string_view {b1, sizeof(b1)}, std::string_view {b2, sizeof(b2)});
+  auto expected = std::vector<uint8_t> {0, 'a', 'b', 0, 'c', 'd', 0, 'e'};
+  ASSERT_EQ(res, expected);
+  ASSERT_EQ(res.capacity(), capacity);
+}
+
+TEST(ConcatAndInsertTests, GatherSpanningSegmentsTest) {
+  std::vector<uint8_t> res;
+  stream::gather_and_insert(res, 1, 3, {"a"sv, ""sv, "bcd"sv, "e"sv});
+  auto expected = std::vector<uint8_t> {0, 'a', 'b', 'c', 0, 'd', 'e'};
+  ASSERT_EQ(res, expected);
+}
+
+TEST(ConcatAndInsertTests, GatherCopiesTheInsertTemplate) {
+  std::vector<uint8_t> res;
+  stream::gather_and_insert(res, 2, 2, {"abc"sv}, "xy");
+  auto expected = std::vector<uint8_t> {'x', 'y', 'a', 'b', 'x', 'y', 'c'};
+  ASSERT_EQ(res, expected);
+
+  // Without a template the inserted space is zeroed again
+  stream::gather_and_insert(res, 2, 2, {"abc"sv});
+  expected = std::vector<uint8_t> {0, 0, 'a', 'b', 0, 0, 'c'};
+  ASSERT_EQ(res, expected);
+}
+
+TEST(SplitReplacementsTests, ReplacesFirstMatchOfEach) {
+  std::vector<video::packet_raw_t::replace_t> replacements;
+  replacements.emplace_back("sps"sv, "SPS!"sv);
+  replacements.emplace_back("vps"sv, "VPS!"sv);
+
+  std::vector<std::string_view> segments {"header"sv};
+  stream::split_replacements(segments, "vps sps idr sps"sv, replacements);
+
+  std::string joined;
+  for (auto &segment : segments) {
+    joined += segment;
+  }
+  ASSERT_EQ(joined, "headerVPS! SPS! idr sps");
+}
+
+TEST(SplitReplacementsTests, DoesntMatchReplacedData) {
+  std::vector<video::packet_raw_t::replace_t> replacements;
+  replacements.emplace_back("a"sv, "b"sv);
+  replacements.emplace_back("b"sv, "c"sv);
+
+  std::vector<std::string_view> segments;
+  stream::split_replacements(segments, "xa"sv, replacements);
+
+  std::string joined;
+  for (auto &segment : segments) {
+    joined += segment;
+  }
+  ASSERT_EQ(joined, "xb");
+}
+
+TEST(FecCoderCacheTests, SharesCodersPerShardCount) {
+  reed_solomon_init();
+
+  auto coder = stream::fec::cached_coder(40, 8);
+  ASSERT_NE(coder, nullptr);
+  EXPECT_EQ(stream::fec::cached_coder(40, 8), coder);
+  EXPECT_NE(stream::fec::cached_coder(40, 9), coder);
+  EXPECT_NE(stream::fec::cached_coder(41, 8), coder);
+
+  // Every thread gets the same coder
+  std::shared_ptr<reed_solomon> other;
+  std::thread([&other]() {
+    other = stream::fec::cached_coder(40, 8);
+  }).join();
+  EXPECT_EQ(other, coder);
+}
+
+TEST(FecFittingTests, KeepsThePercentageThatFits) {
+  EXPECT_EQ(stream::fec::fitting_percentage(100 * 1000, 1000, 1, 50, 2), 50);
+  EXPECT_EQ(stream::fec::fitting_percentage(400 * 1000, 1000, 4, 20, 2), 20);
+}
+
+TEST(FecFittingTests, LowersThePercentageOfLargeFrames) {
+  // 200 data shards per block leave room for 55 parity shards
+  EXPECT_EQ(stream::fec::fitting_percentage(800 * 1000, 1000, 4, 50, 2), 27);
+
+  // A partial last shard still counts as one
+  EXPECT_EQ(stream::fec::fitting_percentage(200 * 1000 + 1, 1000, 1, 50, 2), 26);
+}
+
+TEST(FecFittingTests, SkipsFecWhenTheDataFillsTheBlocks) {
+  EXPECT_EQ(stream::fec::fitting_percentage(255 * 4 * 1000, 1000, 4, 50, 2), 0);
+  EXPECT_EQ(stream::fec::fitting_percentage(254 * 1000, 1000, 1, 50, 2), 0);
+}
+
+struct AdaptiveFecTests: testing::Test {
+  void SetUp() override {
+    percentage_min = config::stream.fec_percentage_min;
+    percentage_max = config::stream.fec_percentage_max;
+
+    config::stream.fec_percentage_min = 10;
+    config::stream.fec_percentage_max = 50;
+  }
+
+  void TearDown() override {
+    config::stream.fec_percentage_min = percentage_min;
+    config::stream.fec_percentage_max = percentage_max;
+  }
+
+  int percentage_min;
+  int percentage_max;
+};
+
+TEST_F(AdaptiveFecTests, RaisesByHalfAndAtLeastFivePoints) {
+  EXPECT_EQ(stream::fec::raised_percentage(20, 1s), 30);
+  EXPECT_EQ(stream::fec::raised_percentage(6, 1s), 11);
+}
+
+TEST_F(AdaptiveFecTests, HoldsOffRaisesForHalfASecond) {
+  EXPECT_FALSE(stream::fec::raised_percentage(20, 0ms));
+  EXPECT_FALSE(stream::fec::raised_percentage(20, 499ms));
+  EXPECT_EQ(stream::fec::raised_percentage(20, 500ms), 30);
+}
+
+TEST_F(AdaptiveFecTests, RaisesUpToTheMax) {
+  EXPECT_EQ(stream::fec::raised_percentage(40, 1s), 50);
+  EXPECT_EQ(stream::fec::raised_percentage(50, 1s), 50);
+}
+
+TEST_F(AdaptiveFecTests, DecaysOnePointPerSecond) {
+  auto clean_time = 700ms;
+  EXPECT_EQ(stream::fec::decayed_percentage(20, clean_time), 20);
+  EXPECT_EQ(clean_time, 700ms);
+
+  // Time left over from the last whole second counts towards the next one
+  clean_time += 700ms;
+  EXPECT_EQ(stream::fec::decayed_percentage(20, clean_time), 19);
+  EXPECT_EQ(clean_time, 400ms);
+
+  clean_time = 3500ms;
+  EXPECT_EQ(stream::fec::decayed_percentage(20, clean_time), 17);
+  EXPECT_EQ(clean_time, 500ms);
+}
+
+TEST_F(AdaptiveFecTests, DecaysDownToTheMin) {
+  auto clean_time = 5000ms;
+  EXPECT_EQ(stream::fec::decayed_percentage(12, clean_time), 10);
+
+  clean_time = 1000ms;
+  EXPECT_EQ(stream::fec::decayed_percentage(10, clean_time), 10);
+}
+
+TEST(SimulcastTests, AttachesToTheClosestRungWithinTheBitrate) {
+  std::vector<config::stream_t::simulcast_rung_t> rungs {
+    {1920, 1080, 20000},
+    {1280, 720, 8000},
+    {854, 480, 3000},
+  };
+
+  EXPECT_EQ(stream::simulcast::closest_rung(rungs, 1920, 1080, 50000), &rungs[0]);
+  EXPECT_EQ(stream::simulcast::closest_rung(rungs, 1366, 768, 50000), &rungs[1]);
+  EXPECT_EQ(stream::simulcast::closest_rung(rungs, 3840, 2160, 50000), &rungs[0]);
+
+  // A rung beyond the client's bitrate is skipped for the next one down
+  EXPECT_EQ(stream::simulcast::closest_rung(rungs, 1920, 1080, 10000), &rungs[1]);
+
+  // Below the whole ladder the cheapest rung is streamed
+  EXPECT_EQ(stream::simulcast::closest_rung(rungs, 1920, 1080, 1000), &rungs[2]);
+
+  EXPECT_EQ(stream::simulcast::closest_rung({}, 1920, 1080, 20000), nullptr);
+}
+
+TEST(SimulcastTests, PrefersTheHigherBitrateAtTheSameSize) {
+  std::vector<config::stream_t::simulcast_rung_t> rungs {
+    {1280, 720, 4000},
+    {1280, 720, 8000},
+  };
+
+  EXPECT_EQ(stream::simulcast::closest_rung(rungs, 1280, 720, 10000), &rungs[1]);
+  EXPECT_EQ(stream::simulcast::closest_rung(rungs, 1280, 720, 6000), &rungs[0]);
+}
+
+TEST(LateFramesTests, DropsOnlyWhenANewerFrameIsQueued) {
+  EXPECT_TRUE(stream::late_frames::too_late(80ms, true, 50ms));
+  EXPECT_FALSE(stream::late_frames::too_late(80ms, false, 50ms));
+  EXPECT_FALSE(stream::late_frames::too_late(30ms, true, 50ms));
+}
+
+TEST(LateFramesTests, KeepsEveryFrameWhenDisabled) {
+  EXPECT_FALSE(stream::late_frames::too_late(1s, true, 0ms));
+  EXPECT_FALSE(stream::late_frames::too_late(std::nullopt, true, 50ms));
+}
+
+TEST(ProbeTests, HalvesTheCapacityAfterLoss) {
+  EXPECT_EQ(stream::probe::capacity_bps(400000000, false), 400000000);
+  EXPECT_EQ(stream::probe::capacity_bps(400000000, true), 200000000);
+}
+
+TEST(ProbeTests, PacesWithinTheMeasuredCapacity) {
+  // 20 Mbps paces at 20 times its bitrate, within 80% of 1Gbps
+  EXPECT_EQ(stream::probe::pacing_bps(0, 20000), 400000000);
+  EXPECT_EQ(stream::probe::pacing_bps(100000000, 20000), 100000000);
+  EXPECT_EQ(stream::probe::pacing_bps(0, 100000), 800000000);
+}
+
+TEST(SocketBufferTests, FitsAKeyFrameOfTheStream) {
+  // 150 Mbps at 60 fps averages 312 KB a frame, a key frame with 20% FEC runs to 3.75 MB
+  auto size = stream::socket_buffer::size_for(150000, 60, 20);
+  EXPECT_GE(size, 150000 * 1000 / 8 / 60 * 10 * 120 / 100);
+  EXPECT_LE(size, 64 * 1024 * 1024);
+
+  EXPECT_EQ(stream::socket_buffer::size_for(1000, 60, 20), 1024 * 1024);
+  EXPECT_EQ(stream::socket_buffer::size_for(2000000, 1, 255), 64 * 1024 * 1024);
+}
@@ -0,0 +1,288 @@
+/**
+ * @file tests/unit/test_stream_pipeline.cpp
+ * @brief Benchmark the whole stream, from the synthetic display through the encoder to a loopback client.
+ */
+#include "../tests_common.h"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstring>
+#include <ctime>
+#include <map>
+#include <vector>
+
+#include <boost/asio.hpp>
+#include <moonlight-common-c/src/Limelight-internal.h>
+#include <src/network.h>
+#include <src/platform/synthetic_display.h>
+#include <src/rtsp.h>
+#include <src/stream.h>
+#include <src/utility.h>
+
+using namespace std::literals;
+namespace asio = boost::asio;
+using asio::ip::udp;
+
+namespace {
+  constexpr auto STREAM_DURATION = 4s;
+
+  // Stands in for the ping payload a client gets during the RTSP handshake
+  constexpr auto PING_PAYLOAD = "SynthBenchClient"sv;
+
+  struct stream_mode_t {
+    int width;
+    int height;
+    int fps;
+  };
+
+  /**
+   * @brief The shards of one frame the client received so far.
+   */
+  struct frame_t {
+    std::uint32_t rtp_timestamp;
+
+    // Data shards a FEC block needs and the shards of it that arrived, 4 blocks at most
+    std::array<int, 4> data_shards {};
+    std::array<int, 4> received {};
+    int blocks;
+
+    bool complete = false;
+  };
+
+  /**
+   * @brief A client that pings like Moonlight and reassembles the frames from the FEC headers of the shards.
+   * Every frame is lossless here, so a block is complete once it has as many shards as it has data shards.
+   */
+  class loopback_client_t {
+  public:
+    loopback_client_t(asio::io_context &io, std::chrono::steady_clock::time_point epoch):
+        epoch {epoch},
+        video_sock {io, udp::endpoint {asio::ip::address_v4::loopback(), 0}},
+        audio_sock {io, udp::endpoint {asio::ip::address_v4::loopback(), 0}},
+        ping_timer {io} {
+      ping();
+      receive();
+    }
+
+    void ping() {
+      SS_PING ping {};
+      std::memcpy(ping.payload, PING_PAYLOAD.data(), sizeof(ping.payload));
+      ping.sequenceNumber = util::endian::big<std::uint32_t>(++ping_sequence);
+
+      auto loopback = asio::ip::address_v4::loopback();
+      video_sock.send_to(asio::buffer(&ping, sizeof(ping)), udp::endpoint {loopback, net::map_port(stream::VIDEO_STREAM_PORT)});
+      audio_sock.send_to(asio::buffer(&ping, sizeof(ping)), udp::endpoint {loopback, net::map_port(stream::AUDIO_STREAM_PORT)});
+
+      // Moonlight keeps pinging, and the first pings can arrive before the session listens for them
+      ping_timer.expires_after(100ms);
+      ping_timer.async_wait([this](const boost::system::error_code &ec) {
+        if (!ec) {
+          ping();
+        }
+      });
+    }
+
+    void receive() {
+      video_sock.async_receive(asio::buffer(buffer), [this](const boost::system::error_code &ec, std::size_t size) {
+        if (ec) {
+          return;
+        }
+
+        collect(size);
+        receive();
+      });
+    }
+
+    void collect(std::size_t size) {
+      if (size < sizeof(RTP_PACKET) + 4 + sizeof(NV_VIDEO_PACKET)) {
+        return;
+      }
+
+      auto now = std::chrono::steady_clock::now();
+      bytes += size;
+      ++packets;
+
+      RTP_PACKET rtp;
+      NV_VIDEO_PACKET packet;
+      std::memcpy(&rtp, buffer.data(), sizeof(rtp));
+      std::memcpy(&packet, buffer.data() + sizeof(rtp) + 4, sizeof(packet));
+
+      auto block = (packet.multiFecBlocks >> 4) & 0x3;
+      auto &frame = frames.try_emplace(packet.frameIndex, frame_t {util::endian::big<std::uint32_t>(rtp.timestamp)}).first->second;
+      frame.blocks = ((packet.multiFecBlocks >> 6) & 0x3) + 1;
+      frame.data_shards[block] = (packet.fecInfo >> 22) & 0x3FF;
+      ++frame.received[block];
+
+      if (frame.complete) {
+        return;
+      }
+
+      for (int x = 0; x < frame.blocks; ++x) {
+        if (!frame.data_shards[x] || frame.received[x] < frame.data_shards[x]) {
+          return;
+        }
+      }
+
+      frame.complete = true;
+      ++frames_received;
+
+      // RTP timestamps count the 90 KHz ticks since the stream started from the capture of the frame
+      auto captured = epoch + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double, std::ratio<1, 90000>> {frame.rtp_timestamp});
+      latencies.emplace_back(std::chrono::duration<double, std::milli>(now - captured).count());
+
+      if (first_frame == std::chrono::steady_clock::time_point {}) {
+        first_frame = now;
+      }
+      last_frame = now;
+    }
+
+    std::chrono::steady_clock::time_point epoch;
+
+    udp::socket video_sock;
+    udp::socket audio_sock;
+    asio::steady_timer ping_timer;
+    std::uint32_t ping_sequence = 0;
+
+    std::array<std::uint8_t, 2048> buffer;
+
+    std::map<std::uint32_t, frame_t> frames;
+    std::vector<double> latencies;
+    std::chrono::steady_clock::time_point first_frame;
+    std::chrono::steady_clock::time_point last_frame;
+
+    std::uint64_t frames_received = 0;
+    std::uint64_t packets = 0;
+    std::uint64_t bytes = 0;
+  };
+
+  double percentile(std::vector<double> values, double p) {
+    if (values.empty()) {
+      return 0;
+    }
+
+    auto nth = std::begin(values) + (std::size_t) (p * (values.size() - 1));
+    std::nth_element(std::begin(values), nth, std::end(values));
+    return *nth;
+  }
+}  // namespace
+
+struct StreamPipelineBenchmark: PlatformTestSuite, testing::WithParamInterface<stream_mode_t> {
+  static void SetUpTestSuite() {
+    // The platform picks its capture backends when it's initialized
+    capture = config::video.capture;
+    config::video.capture = platf::synthetic::NAME;
+
+    PlatformTestSuite::SetUpTestSuite();
+    if (video::probe_encoders()) {
+      encoder_found = false;
+    }
+  }
+
+  static void TearDownTestSuite() {
+    PlatformTestSuite::TearDownTestSuite();
+    config::video.capture = capture;
+  }
+
+  void SetUp() override {
+    ping_timeout = config::stream.ping_timeout;
+    audio_stream = config::audio.stream;
+
+    if (!encoder_found) {
+      GTEST_SKIP() << "No encoder takes frames from system memory";
+    }
+
+    // Without a control stream the session would be stopped once the ping timeout runs out
+    config::stream.ping_timeout = STREAM_DURATION + 10s;
+    config::audio.stream = false;
+  }
+
+  void TearDown() override {
+    config::stream.ping_timeout = ping_timeout;
+    config::audio.stream = audio_stream;
+  }
+
+  std::chrono::milliseconds ping_timeout;
+  bool audio_stream;
+
+private:
+  inline static std::string capture;
+  inline static bool encoder_found = true;
+};
+
+INSTANTIATE_TEST_SUITE_P(
+  SyntheticStream,
+  StreamPipelineBenchmark,
+  testing::Values(
+    stream_mode_t {1280, 720, 60},
+    stream_mode_t {1920, 1080, 60}
+  ),
+  [](const auto &info) {
+    return std::to_string(info.param.width) + 'x' + std::to_string(info.param.height) + '_' + std::to_string(info.param.fps);
+  }
+);
+
+TEST_P(StreamPipelineBenchmark, LoopbackClient) {
+  auto [width, height, fps] = GetParam();
+
+  stream::config_t config {};
+  config.monitor = {width, height, fps, fps * 100, 20000, 1, 0, 0, 0, 0, 0, 0};
+  config.audio.packetDuration = 5;
+  config.audio.channels = 2;
+  config.audio.mask = 0x3;
+  config.packetsize = 1024;
+  config.minRequiredFecPackets = 2;
+  config.mlFeatureFlags = ML_FF_SESSION_ID_V1;
+
+  rtsp_stream::launch_session_t launch_session {};
+  launch_session.id = 1;
+  launch_session.gcm_key.resize(16);
+  launch_session.iv.resize(16);
+  launch_session.av_ping_payload = PING_PAYLOAD;
+  launch_session.handshake_start = std::chrono::steady_clock::now();
+
+  auto session = stream::session::alloc(config, launch_session);
+  ASSERT_TRUE(session);
+
+  // The stream starts counting RTP time while the session starts, the latencies below err on the long side by at most this much
+  auto before_start = std::chrono::steady_clock::now();
+  ASSERT_EQ(stream::session::start(*session, "127.0.0.1"), 0);
+  std::chrono::duration<double, std::milli> start_time = std::chrono::steady_clock::now() - before_start;
+
+  asio::io_context io;
+  loopback_client_t client {io, before_start};
+
+  // Process time of every thread, Windows counts wall time here instead
+  auto cpu_start = std::clock();
+  io.run_for(STREAM_DURATION);
+  auto cpu_time = (double) (std::clock() - cpu_start) / CLOCKS_PER_SEC;
+
+  auto stats = stream::session::network_stats();
+
+  stream::session::stop(*session);
+  stream::session::join(*session);
+
+  ASSERT_GT(client.frames_received, 1);
+
+  std::chrono::duration<double> receiving = client.last_frame - client.first_frame;
+  auto frame_rate = (client.frames_received - 1) / receiving.count();
+
+  BOOST_LOG(tests) << width << 'x' << height << '@' << fps << ": "sv << client.frames_received << " frames, "sv
+                   << frame_rate << " frames/s, "sv << client.bytes * 8 / 1000 / receiving.count() << " kbps"sv;
+  BOOST_LOG(tests) << "glass to receive p50/p99 [ms]: "sv << percentile(client.latencies, 0.5) << '/' << percentile(client.latencies, 0.99)
+                   << " (session started within "sv << start_time.count() << " ms)"sv;
+  BOOST_LOG(tests) << "CPU: "sv << cpu_time / std::chrono::duration<double>(STREAM_DURATION).count() * 100 << "% of one core"sv;
+
+  for (auto &stat : stats) {
+    auto format = [](const stream::session::percentiles_t &percentiles) {
+      return std::to_string(percentiles.p50) + '/' + std::to_string(percentiles.p99);
+    };
+
+    BOOST_LOG(tests) << "stage p50/p99 [ms]: capture "sv << format(stat.latency.capture)
+                     << ", convert "sv << format(stat.latency.convert)
+                     << ", encode "sv << format(stat.latency.encode)
+                     << ", fec "sv << format(stat.latency.fec)
+                     << ", send "sv << format(stat.latency.send)
+                     << ", total "sv << format(stat.latency.total);
+  }
+}
@@ -0,0 +1,112 @@
+/**
+ * @file tests/unit/test_task_pool.cpp
+ * @brief Test src/task_pool.*.
+ */
+#include "../tests_common.h"
+
+#include <chrono>
+#include <src/task_pool.h>
+#include <vector>
+
+using namespace std::literals;
+
+namespace {
+  /**
+   * @brief Run every timer that is due, in order.
+   */
+  void run_due(task_pool_util::TaskPool &pool) {
+    while (auto task = pool.pop()) {
+      (*task)->run();
+    }
+  }
+}  // namespace
+
+TEST(TaskPoolTest, TimersRunInDeadlineOrder) {
+  task_pool_util::TaskPool pool;
+  std::vector<int> order;
+
+  auto record = [&order](int x) {
+    order.emplace_back(x);
+  };
+  pool.pushDelayed(record, -1ms, 2);
+  pool.pushDelayed(record, -3ms, 0);
+  pool.pushDelayed(record, -2ms, 1);
+  pool.pushDelayed(record, 1h, 3);
+
+  run_due(pool);
+  EXPECT_EQ(order, (std::vector {0, 1, 2}));
+
+  ASSERT_TRUE(pool.next());
+  EXPECT_GT(*pool.next(), std::chrono::steady_clock::now() + 59min);
+  EXPECT_FALSE(pool.ready());
+}
+
+TEST(TaskPoolTest, DelayMovesTheTimer) {
+  task_pool_util::TaskPool pool;
+  bool ran = false;
+
+  auto run = [&ran]() {
+    ran = true;
+  };
+  auto id = pool.pushDelayed(run, -1ms).task_id;
+
+  pool.delay(id, 1h);
+  EXPECT_FALSE(pool.ready());
+
+  pool.delay(id, -1ms);
+  run_due(pool);
+  EXPECT_TRUE(ran);
+  EXPECT_FALSE(pool.next());
+}
+
+TEST(TaskPoolTest, CancelRemovesTheTimer) {
+  task_pool_util::TaskPool pool;
+
+  auto id = pool.pushDelayed([]() {}, -1ms).task_id;
+  pool.pushDelayed([]() {}, 1h);
+
+  EXPECT_TRUE(pool.cancel(id));
+  EXPECT_FALSE(pool.cancel(id));
+  EXPECT_FALSE(pool.ready());
+  EXPECT_FALSE(pool.pop(id));
+}
+
+TEST(TaskPoolTest, PopByIdTakesTheTimer) {
+  task_pool_util::TaskPool pool;
+
+  auto id = pool.pushDelayed([]() {}, 1h).task_id;
+
+  auto task = pool.pop(id);
+  ASSERT_TRUE(task);
+  EXPECT_EQ(task->second.get(), id);
+  EXPECT_FALSE(pool.next());
+  EXPECT_FALSE(pool.cancel(id));
+}
+
+TEST(TaskPoolTest, RescheduleBenchmark) {
+  constexpr auto TIMERS = 4096;
+  constexpr auto ROUNDS = 16;
+
+  task_pool_util::TaskPool pool;
+
+  std::vector<task_pool_util::TaskPool::task_id_t> ids;
+  for (int x = 0; x < TIMERS; ++x) {
+    ids.emplace_back(pool.pushDelayed([]() {}, 1h + x * 1ms).task_id);
+  }
+
+  // Like key repeat, every timer is pushed back before it fires
+  auto start = std::chrono::steady_clock::now();
+  for (int round = 0; round < ROUNDS; ++round) {
+    for (auto id : ids) {
+      pool.delay(id, 2h);
+    }
+  }
+  std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+
+  for (auto id : ids) {
+    EXPECT_TRUE(pool.cancel(id));
+  }
+  EXPECT_FALSE(pool.next());
+
+  BOOST_LOG(tests) << "delay: "sv << elapsed.count() / (TIMERS * ROUNDS) << " ns with "sv << TIMERS << " timers"sv;
+}
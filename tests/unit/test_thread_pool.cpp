@@ -0,0 +1,107 @@
+/**
+ * @file tests/unit/test_thread_pool.cpp
+ * @brief Test src/thread_pool.*.
+ */
+#include "../tests_common.h"
+
+#include <chrono>
+#include <future>
+#include <mutex>
+#include <src/thread_pool.h>
+#include <thread>
+#include <vector>
+
+using namespace std::literals;
+using thread_pool_util::priority_e;
+
+TEST(ThreadPoolTest, RunsQueuedTasksByPriority) {
+  thread_pool_util::ThreadPool pool {1};
+
+  // Hold the only worker so everything below is queued before it picks up a task
+  std::promise<void> gate;
+  auto blocked = pool.push([future = gate.get_future().share()]() {
+    future.wait();
+  });
+
+  std::mutex lock;
+  std::vector<priority_e> order;
+  auto record = [&](priority_e priority) {
+    std::lock_guard lg {lock};
+    order.emplace_back(priority);
+  };
+
+  std::vector<std::future<void>> futures;
+  for (auto priority : {priority_e::housekeeping, priority_e::control, priority_e::input, priority_e::control}) {
+    futures.emplace_back(pool.push(priority, record, priority));
+  }
+
+  gate.set_value();
+  blocked.get();
+  for (auto &future : futures) {
+    future.get();
+  }
+
+  EXPECT_EQ(order, (std::vector {priority_e::input, priority_e::control, priority_e::control, priority_e::housekeeping}));
+}
+
+TEST(ThreadPoolTest, IdleWorkersStealQueuedTasks) {
+  constexpr auto TASKS = 16;
+
+  thread_pool_util::ThreadPool pool {4};
+
+  // Tasks pushed from a task are queued on its worker, which stays busy until they're done
+  auto outer = pool.push([&pool]() {
+    std::vector<std::future<std::thread::id>> futures;
+    for (int x = 0; x < TASKS; ++x) {
+      futures.emplace_back(pool.push([]() {
+        return std::this_thread::get_id();
+      }));
+    }
+
+    std::vector<std::thread::id> ids;
+    for (auto &future : futures) {
+      ids.emplace_back(future.get());
+    }
+    return std::pair {std::this_thread::get_id(), ids};
+  });
+
+  ASSERT_EQ(outer.wait_for(10s), std::future_status::ready);
+  auto [worker, ids] = outer.get();
+  for (auto &id : ids) {
+    EXPECT_NE(id, worker);
+  }
+}
+
+TEST(ThreadPoolTest, RunsTasksQueuedBeforeStart) {
+  thread_pool_util::ThreadPool pool;
+
+  auto answer = [](int x) {
+    return x;
+  };
+  auto future = pool.push(answer, 42);
+  auto timer = pool.pushDelayed(answer, 1ms, 7);
+
+  pool.start(2, {0});
+  EXPECT_EQ(future.get(), 42);
+  EXPECT_EQ(timer.future.get(), 7);
+}
+
+TEST(ThreadPoolTest, PushBenchmark) {
+  constexpr auto TASKS = 100000;
+
+  thread_pool_util::ThreadPool pool {(int) std::max(2u, std::thread::hardware_concurrency())};
+
+  std::vector<std::future<void>> futures;
+  futures.reserve(TASKS);
+
+  auto start = std::chrono::steady_clock::now();
+  for (int x = 0; x < TASKS; ++x) {
+    futures.emplace_back(pool.push([]() {}));
+  }
+  for (auto &future : futures) {
+    future.get();
+  }
+  std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+
+  BOOST_LOG(tests) << "push and run: "sv << elapsed.count() / TASKS << " ns per task"sv;
+}
@@ -0,0 +1,283 @@
+/**
+ * @file tests/unit/test_thread_safe.cpp
+ * @brief Test src/thread_safe.*.
+ */
+#include "../tests_common.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <src/thread_safe.h>
+#include <thread>
+#include <utility>
+#include <vector>
+
+using namespace std::literals;
+
+TEST(RingTest, PopsInOrder) {
+  safe::ring_t<std::unique_ptr<int>> ring {4};
+
+  for (int x = 0; x < 4; ++x) {
+    EXPECT_TRUE(ring.raise(std::make_unique<int>(x)));
+  }
+
+  for (int x = 0; x < 4; ++x) {
+    auto val = ring.pop();
+    ASSERT_TRUE(val);
+    EXPECT_EQ(*val, x);
+  }
+  EXPECT_FALSE(ring.peek());
+}
+
+TEST(RingTest, DropsWhenFull) {
+  safe::ring_t<std::unique_ptr<int>> ring {2};
+
+  EXPECT_TRUE(ring.raise(std::make_unique<int>(0)));
+  EXPECT_TRUE(ring.raise(std::make_unique<int>(1)));
+  EXPECT_FALSE(ring.raise(std::make_unique<int>(2)));
+
+  EXPECT_EQ(*ring.pop(), 0);
+  EXPECT_TRUE(ring.raise(std::make_unique<int>(3)));
+  EXPECT_EQ(*ring.pop(), 1);
+  EXPECT_EQ(*ring.pop(), 3);
+}
+
+TEST(RingTest, SizeCountsWaitingElements) {
+  safe::ring_t<std::unique_ptr<int>> ring {4};
+  EXPECT_EQ(ring.size(), 0);
+
+  ring.raise(std::make_unique<int>(0));
+  ring.raise(std::make_unique<int>(1));
+  EXPECT_EQ(ring.size(), 2);
+
+  ring.pop();
+  EXPECT_EQ(ring.size(), 1);
+}
+
+TEST(RingTest, PopTimesOut) {
+  safe::ring_t<std::unique_ptr<int>> ring;
+
+  EXPECT_FALSE(ring.pop(10ms));
+  EXPECT_TRUE(ring.running());
+}
+
+TEST(RingTest, StopWakesConsumer) {
+  safe::ring_t<std::unique_ptr<int>> ring;
+
+  std::thread stopper {[&ring]() {
+    std::this_thread::sleep_for(10ms);
+    ring.stop();
+  }};
+
+  EXPECT_FALSE(ring.pop());
+  stopper.join();
+
+  EXPECT_FALSE(ring.running());
+  EXPECT_FALSE(ring.raise(std::make_unique<int>(0)));
+}
+
+TEST(RingTest, ConcurrentProducers) {
+  constexpr int producers = 4;
+  constexpr int per_producer = 10000;
+
+  safe::ring_t<std::unique_ptr<int>> ring {8};
+
+  std::vector<std::thread> threads;
+  for (int p = 0; p < producers; ++p) {
+    threads.emplace_back([&ring, p]() {
+      for (int x = 0; x < per_producer; ++x) {
+        // A dropped element isn't moved from, so retry until the consumer makes room
+        auto val = std::make_unique<int>(p * per_producer + x);
+        while (!ring.raise(std::move(val))) {
+          std::this_thread::yield();
+        }
+      }
+    });
+  }
+
+  // Each producer's elements must come out in the order they went in
+  std::vector<int> next(producers, 0);
+  for (int x = 0; x < producers * per_producer; ++x) {
+    auto val = ring.pop(1s);
+    ASSERT_TRUE(val);
+
+    auto p = *val / per_producer;
+    EXPECT_EQ(*val % per_producer, next[p]);
+    next[p] = *val % per_producer + 1;
+  }
+
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  EXPECT_FALSE(ring.peek());
+}
+
+TEST(QueueTest, PopsInOrder) {
+  safe::queue_t<std::unique_ptr<int>> queue {4};
+
+  for (int x = 0; x < 4; ++x) {
+    queue.raise(std::make_unique<int>(x));
+  }
+
+  for (int x = 0; x < 4; ++x) {
+    auto val = queue.pop();
+    ASSERT_TRUE(val);
+    EXPECT_EQ(*val, x);
+  }
+  EXPECT_FALSE(queue.peek());
+}
+
+TEST(QueueTest, StartsOverWhenFull) {
+  safe::queue_t<int> queue {2};
+
+  queue.raise(0);
+  queue.raise(1);
+  queue.raise(2);
+
+  EXPECT_EQ(*queue.pop(), 2);
+  EXPECT_FALSE(queue.pop(0ms));
+}
+
+namespace {
+  /**
+   * @brief The vector backed queue_t::pop() this replaced, without the locking both have in common.
+   */
+  template<class T>
+  struct vector_queue_t {
+    void raise(T &&val) {
+      if (queue.size() == max_elements) {
+        queue.clear();
+      }
+      queue.emplace_back(std::move(val));
+    }
+
+    T pop() {
+      auto val = std::move(queue.front());
+      queue.erase(std::begin(queue));
+      return val;
+    }
+
+    std::size_t max_elements;
+    std::vector<T> queue;
+  };
+}  // namespace
+
+TEST(QueueTest, PopBenchmark) {
+  // The audio sample queue, holding up to 30 frames of 10 ms stereo samples
+  constexpr std::uint32_t MAX_ELEMENTS = 30;
+  using sample_t = std::vector<std::int16_t>;
+
+  constexpr auto ROUNDS = 2000;
+  auto run = [](auto &&raise, auto &&pop) {
+    auto start = std::chrono::steady_clock::now();
+    for (int x = 0; x < ROUNDS; ++x) {
+      for (std::uint32_t y = 0; y < MAX_ELEMENTS - 1; ++y) {
+        raise(sample_t(960));
+      }
+      for (std::uint32_t y = 0; y < MAX_ELEMENTS - 1; ++y) {
+        pop();
+      }
+    }
+    std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count() / (ROUNDS * (MAX_ELEMENTS - 1));
+  };
+
+  safe::queue_t<sample_t> queue {MAX_ELEMENTS};
+  auto queue_ns = run([&](sample_t &&val) {
+    queue.raise(std::move(val));
+  }, [&]() {
+    return queue.pop();
+  });
+
+  vector_queue_t<sample_t> vector_queue {MAX_ELEMENTS};
+  auto vector_ns = run([&](sample_t &&val) {
+    vector_queue.raise(std::move(val));
+  }, [&]() {
+    return vector_queue.pop();
+  });
+
+  BOOST_LOG(tests) << "queue_t raise and pop: "sv << queue_ns << " ns, vector without locking "sv << vector_ns << " ns"sv;
+  EXPECT_FALSE(queue.peek());
+}
+
+TEST(EventTest, PeekFollowsRaiseAndPop) {
+  safe::event_t<int> event;
+
+  EXPECT_FALSE(event.peek());
+  EXPECT_FALSE(event.pop(0ms));
+
+  event.raise(3);
+  EXPECT_TRUE(event.peek());
+  EXPECT_EQ(event.view(0ms), 3);
+  EXPECT_TRUE(event.peek());
+  EXPECT_EQ(event.pop(0ms), 3);
+  EXPECT_FALSE(event.peek());
+
+  event.raise(4);
+  event.stop();
+  EXPECT_FALSE(event.peek());
+  event.reset();
+  EXPECT_FALSE(event.peek());
+}
+
+TEST(EventTest, RaiseMergedFoldsPendingValues) {
+  safe::event_t<std::pair<int, int>> event;
+  auto span = [](std::pair<int, int> &pending, std::pair<int, int> &&range) {
+    pending.first = std::min(pending.first, range.first);
+    pending.second = std::max(pending.second, range.second);
+  };
+
+  event.raise_merged({5, 6}, span);
+  event.raise_merged({2, 3}, span);
+  event.raise_merged({4, 9}, span);
+  EXPECT_TRUE(event.peek());
+  EXPECT_EQ(event.pop(0ms), std::make_pair(2, 9));
+
+  // Popped values aren't merged into the next one
+  event.raise_merged({7, 7}, span);
+  EXPECT_EQ(event.pop(0ms), std::make_pair(7, 7));
+  EXPECT_FALSE(event.peek());
+
+  event.stop();
+  event.raise_merged({1, 1}, span);
+  EXPECT_FALSE(event.peek());
+}
+
+namespace {
+  constexpr safe::mail_id_t<safe::signal_t, 0> test_signal {};
+  constexpr safe::mail_id_t<safe::queue_t<int>, 1> test_queue {};
+
+  template<class T, class Id>
+  concept event_of = requires(safe::mail_raw_t &mail, Id id) { mail.event<T>(id); };
+}  // namespace
+
+// The post type comes with the id
+static_assert(event_of<bool, decltype(test_signal)>);
+static_assert(!event_of<int, decltype(test_signal)>);
+static_assert(!event_of<int, decltype(test_queue)>);
+
+TEST(MailTest, SharesPostsPerSlot) {
+  auto mail = std::make_shared<safe::mail_raw_t>();
+
+  auto signal = mail->event<bool>(test_signal);
+  auto queue = mail->queue<int>(test_queue);
+  EXPECT_EQ(mail->event<bool>(test_signal), signal);
+  EXPECT_EQ(mail->queue<int>(test_queue), queue);
+
+  signal->raise(true);
+  EXPECT_TRUE(mail->event<bool>(test_signal)->peek());
+  EXPECT_FALSE(queue->peek());
+}
+
+TEST(MailTest, FreesSlotWhenPostDies) {
+  auto mail = std::make_shared<safe::mail_raw_t>();
+
+  auto signal = mail->event<bool>(test_signal);
+  signal->raise(true);
+  signal.reset();
+  EXPECT_TRUE(mail->slots[0].expired());
+
+  // A new post for the slot starts out clear
+  EXPECT_FALSE(mail->event<bool>(test_signal)->peek());
+}
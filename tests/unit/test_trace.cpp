@@ -0,0 +1,91 @@
+/**
+ * @file tests/unit/test_trace.cpp
+ * @brief Test src/trace.*.
+ */
+#include "../tests_common.h"
+
+#include <nlohmann/json.hpp>
+#include <set>
+#include <src/trace.h>
+#include <thread>
+
+using namespace std::literals;
+
+struct TraceTest: testing::Test {
+  void TearDown() override {
+    trace::set_enabled(false);
+  }
+};
+
+TEST_F(TraceTest, SpansAreOnlyRecordedWhileEnabled) {
+  trace::set_enabled(true);
+  auto now = std::chrono::steady_clock::now();
+  trace::span(trace::stage_e::encode, 7, now + 1ms, now + 3ms);
+  trace::set_enabled(false);
+  trace::span(trace::stage_e::encode, 8, now + 4ms, now + 5ms);
+
+  auto events = nlohmann::json::parse(trace::dump())["traceEvents"];
+  ASSERT_EQ(events.size(), 1);
+
+  auto &event = events[0];
+  EXPECT_EQ(event["name"], "encode");
+  EXPECT_EQ(event["cat"], "video");
+  EXPECT_EQ(event["ph"], "X");
+  EXPECT_EQ(event["args"]["frame"], 7);
+  EXPECT_DOUBLE_EQ(event["dur"].get<double>(), 2000.0);
+}
+
+TEST_F(TraceTest, StartingATraceDiscardsThePreviousOne) {
+  trace::set_enabled(true);
+  {
+    trace::scope_t span {trace::stage_e::convert, 1};
+  }
+  trace::set_enabled(false);
+
+  trace::set_enabled(true);
+  {
+    trace::scope_t span {trace::stage_e::input_inject, -1};
+  }
+
+  auto events = nlohmann::json::parse(trace::dump())["traceEvents"];
+  ASSERT_EQ(events.size(), 1);
+  EXPECT_EQ(events[0]["name"], "input_inject");
+  EXPECT_EQ(events[0]["cat"], "input");
+  EXPECT_FALSE(events[0].contains("args"));
+}
+
+TEST_F(TraceTest, EveryThreadHasItsOwnRing) {
+  trace::set_enabled(true);
+
+  std::thread other([]() {
+    for (int x = 0; x < 10; ++x) {
+      trace::scope_t span {trace::stage_e::send, x};
+    }
+  });
+  for (int x = 0; x < 10; ++x) {
+    trace::scope_t span {trace::stage_e::fec, x};
+  }
+  other.join();
+
+  auto events = nlohmann::json::parse(trace::dump())["traceEvents"];
+  ASSERT_EQ(events.size(), 20);
+
+  std::set<int> tids;
+  for (auto &event : events) {
+    tids.emplace(event["tid"].get<int>());
+  }
+  EXPECT_EQ(tids.size(), 2);
+}
+
+TEST_F(TraceTest, RingKeepsTheMostRecentSpans) {
+  trace::set_enabled(true);
+
+  auto now = std::chrono::steady_clock::now();
+  for (std::size_t x = 0; x < trace::RING_SIZE + 10; ++x) {
+    trace::span(trace::stage_e::capture, (std::int64_t) x, now, now);
+  }
+
+  auto events = nlohmann::json::parse(trace::dump())["traceEvents"];
+  ASSERT_EQ(events.size(), trace::RING_SIZE);
+  EXPECT_EQ(events[0]["args"]["frame"], 10);
+}
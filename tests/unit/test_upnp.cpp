@@ -0,0 +1,20 @@
+/**
+ * @file tests/unit/test_upnp.cpp
+ * @brief Test src/upnp.*
+ */
+#include "../tests_common.h"
+
+#include <src/upnp.h>
+
+using namespace std::literals;
+
+TEST(UpnpRetryIntervalTest, DoublesAfterEachFailure) {
+  EXPECT_EQ(upnp::retry_interval(1), upnp::RETRY_INTERVAL);
+  EXPECT_EQ(upnp::retry_interval(2), upnp::RETRY_INTERVAL * 2);
+  EXPECT_EQ(upnp::retry_interval(3), upnp::RETRY_INTERVAL * 4);
+}
+
+TEST(UpnpRetryIntervalTest, CappedAtTheRefreshInterval) {
+  EXPECT_EQ(upnp::retry_interval(6), upnp::REFRESH_INTERVAL);
+  EXPECT_EQ(upnp::retry_interval(1000), upnp::REFRESH_INTERVAL);
+}
@@ -0,0 +1,64 @@
+/**
+ * @file tests/unit/test_utility.cpp
+ * @brief Test src/utility.*.
+ */
+#include "../tests_common.h"
+
+#include <src/utility.h>
+
+namespace {
+  bool aligned(const void *ptr, std::size_t alignment) {
+    return (std::uintptr_t) ptr % alignment == 0;
+  }
+}  // namespace
+
+TEST(AlignedAllocTest, SmallBuffersAreAligned) {
+  for (std::size_t size : {1, 63, 1400, 64 * 1024}) {
+    auto ptr = util::alloc_aligned(size);
+    ASSERT_NE(ptr, nullptr);
+    EXPECT_TRUE(aligned(ptr, util::BUFFER_ALIGNMENT)) << size;
+
+    std::memset(ptr, 0xAA, size);
+    util::free_aligned(ptr, size);
+  }
+}
+
+TEST(AlignedAllocTest, FrameSizedBuffersAreAligned) {
+  // A 1080p RGBA frame spans several huge pages
+  constexpr std::size_t size = 1920 * 1080 * 4;
+
+  auto frame = util::make_aligned<std::uint8_t>(size);
+  ASSERT_TRUE(frame);
+  EXPECT_TRUE(aligned(frame.get(), util::BUFFER_ALIGNMENT));
+  EXPECT_EQ(frame[0], 0);
+  EXPECT_EQ(frame[size - 1], 0);
+
+  std::memset(frame.get(), 0xAA, size);
+  EXPECT_EQ(frame[size - 1], 0xAA);
+}
+
+TEST(AlignedAllocTest, EmptyBuffersCanBeFreed) {
+  util::buffer_t<char> empty {0};
+  EXPECT_EQ(empty.size(), 0);
+  EXPECT_TRUE(aligned(empty.begin(), util::BUFFER_ALIGNMENT));
+
+  util::free_aligned(nullptr, 0);
+}
+
+TEST(BufferTest, CopiesAreAlignedAndZeroed) {
+  util::buffer_t<float> zeroed {100};
+  EXPECT_TRUE(aligned(zeroed.begin(), util::BUFFER_ALIGNMENT));
+  EXPECT_TRUE(std::all_of(zeroed.begin(), zeroed.end(), [](float sample) {
+    return sample == 0;
+  }));
+
+  util::buffer_t<char> buffer {1400, 'x'};
+  auto copy = buffer;
+  EXPECT_NE(copy.begin(), buffer.begin());
+  EXPECT_TRUE(aligned(copy.begin(), util::BUFFER_ALIGNMENT));
+  EXPECT_TRUE(std::equal(buffer.begin(), buffer.end(), copy.begin(), copy.end()));
+
+  auto moved = std::move(copy);
+  EXPECT_EQ(moved.size(), 1400);
+  EXPECT_EQ(copy.size(), 0);
+}
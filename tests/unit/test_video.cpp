@@ -5,6 +5,7 @@
 #include "../tests_common.h"
 
 #include <src/video.h>
+#include <thread>
 
 struct EncoderTest: PlatformTestSuite, testing::WithParamInterface<video::encoder_t *> {
   void SetUp() override {
@@ -34,6 +35,7 @@ INSTANTIATE_TEST_SUITE_P(
 #endif
 #ifdef __linux__
     &video::vaapi,
+    &video::v4l2m2m,
 #endif
 #ifdef __APPLE__
     &video::videotoolbox,
@@ -76,3 +78,205 @@ INSTANTIATE_TEST_SUITE_P(
     std::make_tuple(9498, AVRational {4749, 50})  // from my LG 27GN950
   )
 );
+
+struct PixFmtMappingTest: testing::TestWithParam<std::tuple<AVPixelFormat, platf::pix_fmt_e>> {};
+
+TEST_P(PixFmtMappingTest, RoundTrip) {
+  const auto &[av_fmt, pix_fmt] = GetParam();
+  ASSERT_EQ(video::map_pix_fmt(av_fmt), pix_fmt);
+  ASSERT_EQ(video::map_av_pix_fmt(pix_fmt), av_fmt);
+}
+
+INSTANTIATE_TEST_SUITE_P(
+  PixFmtMappingTests,
+  PixFmtMappingTest,
+  testing::Values(
+    std::make_tuple(AV_PIX_FMT_YUV420P, platf::pix_fmt_e::yuv420p),
+    std::make_tuple(AV_PIX_FMT_YUV420P10, platf::pix_fmt_e::yuv420p10),
+    std::make_tuple(AV_PIX_FMT_NV12, platf::pix_fmt_e::nv12),
+    std::make_tuple(AV_PIX_FMT_P010, platf::pix_fmt_e::p010),
+    std::make_tuple(AV_PIX_FMT_VUYX, platf::pix_fmt_e::ayuv),
+    std::make_tuple(AV_PIX_FMT_XV30, platf::pix_fmt_e::y410),
+    std::make_tuple(AV_PIX_FMT_YUYV422, platf::pix_fmt_e::yuyv422)
+  )
+);
+
+TEST(PixFmtMapping, UnknownFormat) {
+  ASSERT_EQ(video::map_av_pix_fmt(platf::pix_fmt_e::unknown), AV_PIX_FMT_NONE);
+}
+
+struct FrameDamageTest: testing::Test {
+  void SetUp() override {
+    img.width = 200;
+    img.height = 100;
+    img.pixel_pitch = 4;
+    img.row_pitch = img.width * img.pixel_pitch;
+    buffer.resize(img.row_pitch * img.height);
+    img.data = buffer.data();
+  }
+
+  std::vector<std::uint8_t> buffer;
+  platf::img_t img;
+  video::frame_damage_t damage;
+};
+
+TEST_F(FrameDamageTest, CountsChangedTiles) {
+  // 4x2 tiles, the first image is completely new
+  EXPECT_EQ(damage.damaged_tiles(img), 8);
+  EXPECT_EQ(damage.damaged_tiles(img), 0);
+
+  // A single pixel in the last, partial tile
+  buffer[(99 * img.width + 199) * img.pixel_pitch] = 0xff;
+  EXPECT_EQ(damage.damaged_tiles(img), 1);
+  EXPECT_EQ(damage.damaged_tiles(img), 0);
+}
+
+TEST_F(FrameDamageTest, ResetMarksEverythingChanged) {
+  damage.damaged_tiles(img);
+  damage.reset();
+  EXPECT_EQ(damage.damaged_tiles(img), 8);
+}
+
+TEST_F(FrameDamageTest, UncomparableImagesAlwaysChange) {
+  img.pix_fmt = platf::pix_fmt_e::nv12;
+  EXPECT_EQ(damage.damaged_tiles(img), 8);
+  EXPECT_EQ(damage.damaged_tiles(img), 8);
+}
+
+TEST_F(FrameDamageTest, CountsReportedDamage) {
+  // Reported damage is trusted, even for images that can't be compared
+  img.pix_fmt = platf::pix_fmt_e::nv12;
+  img.damage = std::vector<platf::rect_t> {};
+  EXPECT_EQ(damage.damaged_tiles(img), 0);
+
+  // Overlapping rectangles, one of them sticking out of the image
+  img.damage = std::vector<platf::rect_t> {{10, 10, 60, 10}, {60, 0, 10, 10}, {190, 90, 50, 50}, {0, 0, 0, 0}};
+  EXPECT_EQ(damage.damaged_tiles(img), 4);
+}
+
+struct ImgPoolTest: testing::Test {
+  std::shared_ptr<platf::img_t> alloc_img() {
+    ++allocated;
+    return std::make_shared<platf::img_t>();
+  }
+
+  video::img_pool_t::alloc_img_f alloc_img_f = [this]() {
+    return alloc_img();
+  };
+
+  int allocated = 0;
+};
+
+TEST_F(ImgPoolTest, ReusesReturnedImages) {
+  video::img_pool_t pool {2};
+
+  auto img = pool.acquire(alloc_img_f);
+  ASSERT_TRUE(img);
+  auto raw = img.get();
+  img.reset();
+
+  EXPECT_EQ(pool.acquire(alloc_img_f).get(), raw);
+  EXPECT_EQ(allocated, 1);
+}
+
+TEST_F(ImgPoolTest, StopsAtCapacity) {
+  video::img_pool_t pool {2};
+
+  auto first = pool.acquire(alloc_img_f);
+  auto second = pool.acquire(alloc_img_f);
+  EXPECT_TRUE(first && second);
+  EXPECT_FALSE(pool.acquire(alloc_img_f));
+
+  auto stats = pool.stats();
+  EXPECT_EQ(stats.allocated, 2);
+  EXPECT_EQ(stats.in_use, 2);
+  EXPECT_EQ(stats.exhausted, 1);
+}
+
+TEST_F(ImgPoolTest, FullUntilAnImageComesBack) {
+  video::img_pool_t pool {2};
+
+  auto first = pool.acquire(alloc_img_f);
+  EXPECT_FALSE(pool.full());
+  auto second = pool.acquire(alloc_img_f);
+  EXPECT_TRUE(pool.full());
+
+  std::thread {[first = std::move(first)]() mutable {
+    first.reset();
+  }}.join();
+  EXPECT_FALSE(pool.full());
+}
+
+TEST_F(ImgPoolTest, ReturnsFromOtherThreads) {
+  video::img_pool_t pool {2};
+
+  auto img = pool.acquire(alloc_img_f);
+  std::thread {[img = std::move(img)]() mutable {
+    img.reset();
+  }}.join();
+
+  EXPECT_EQ(pool.stats().in_use, 0);
+  EXPECT_TRUE(pool.acquire(alloc_img_f));
+  EXPECT_EQ(allocated, 1);
+}
+
+TEST_F(ImgPoolTest, ResetFreesImagesOnceReturned) {
+  video::img_pool_t pool {2};
+
+  auto kept = pool.acquire(alloc_img_f);
+  std::weak_ptr<platf::img_t> weak = kept->shared_from_this();
+  pool.acquire(alloc_img_f).reset();
+
+  pool.reset();
+  EXPECT_EQ(pool.stats().allocated, 1);
+
+  // An image from before the reset is never handed out again
+  kept.reset();
+  pool.reset();
+  EXPECT_TRUE(weak.expired());
+  EXPECT_EQ(pool.stats().allocated, 0);
+
+  EXPECT_TRUE(pool.acquire(alloc_img_f));
+  EXPECT_EQ(allocated, 3);
+}
+
+TEST(SvtAv1RealtimeParamsTest, TilesFollowTheThreads) {
+  EXPECT_EQ(video::svtav1_realtime_params(1920, 1080, 1), "keyint=-1:pred-struct=1:force-key-frames=1:mbr=0:lookahead=0:scd=0:enable-tf=0:tile-columns=0:tile-rows=0");
+
+  auto params = video::svtav1_realtime_params(1920, 1080, 4);
+  EXPECT_NE(params.find(":tile-columns=2:tile-rows=0"), std::string::npos);
+
+  params = video::svtav1_realtime_params(1920, 1080, 16);
+  EXPECT_NE(params.find(":tile-columns=2:tile-rows=2"), std::string::npos);
+}
+
+TEST(SvtAv1RealtimeParamsTest, TilesStayWideEnough) {
+  // 640 pixels fit 2 tiles of at least 256 pixels, 360 rows only one
+  auto params = video::svtav1_realtime_params(640, 360, 8);
+  EXPECT_NE(params.find(":tile-columns=1:tile-rows=0"), std::string::npos);
+}
+
+TEST(PickAmdUsageTest, PicksTheHighestQualityThatFits) {
+  std::vector<video::amd_usage_latency_t> latencies {
+    {"lowlatency_high_quality", 9},
+    {"lowlatency", 6},
+    {"ultralowlatency", 4},
+  };
+
+  // Half the frame time is 8.3 ms at 60 fps and 4.2 ms at 120 fps, 4K counts four times the 1080p latency
+  EXPECT_EQ(video::pick_amd_usage(latencies, 1920, 1080, 60), "lowlatency");
+  EXPECT_EQ(video::pick_amd_usage(latencies, 1920, 1080, 120), "ultralowlatency");
+  EXPECT_EQ(video::pick_amd_usage(latencies, 1280, 720, 60), "lowlatency_high_quality");
+  EXPECT_EQ(video::pick_amd_usage(latencies, 3840, 2160, 30), "ultralowlatency");
+}
+
+TEST(PickAmdUsageTest, FallsBackToTheFastest) {
+  std::vector<video::amd_usage_latency_t> latencies {
+    {"lowlatency_high_quality", 20},
+    {"lowlatency", 12},
+    {"ultralowlatency", 15},
+  };
+  EXPECT_EQ(video::pick_amd_usage(latencies, 1920, 1080, 60), "lowlatency");
+
+  EXPECT_EQ(video::pick_amd_usage({}, 1920, 1080, 60), "ultralowlatency");
+}
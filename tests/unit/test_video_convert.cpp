@@ -0,0 +1,168 @@
+/**
+ * @file tests/unit/test_video_convert.cpp
+ * @brief Test src/video_convert.*.
+ */
+#include "../tests_common.h"
+
+#include <cmath>
+#include <random>
+#include <vector>
+
+#include <src/video_convert.h>
+
+using namespace video;
+
+namespace {
+  std::vector<std::uint8_t> make_image(int width, int height) {
+    std::mt19937 gen {42};
+    std::uniform_int_distribution<int> dist {0, 255};
+
+    std::vector<std::uint8_t> image(width * height * 4);
+    for (auto &byte : image) {
+      byte = dist(gen);
+    }
+
+    return image;
+  }
+
+  double reference(const float (&vec)[4], const std::uint8_t *bgr0) {
+    return vec[0] * bgr0[2] / 255.0 + vec[1] * bgr0[1] / 255.0 + vec[2] * bgr0[0] / 255.0 + vec[3];
+  }
+}  // namespace
+
+struct VideoConvertTest: testing::TestWithParam<std::pair<int, int>> {};
+
+INSTANTIATE_TEST_SUITE_P(
+  VideoConvert,
+  VideoConvertTest,
+  // Sizes with and without a remainder for the vectorized loop, and odd ones
+  testing::Values(
+    std::pair {64, 4},
+    std::pair {37, 9},
+    std::pair {16, 3},
+    std::pair {1, 1}
+  )
+);
+
+TEST_P(VideoConvertTest, MatchesColorMatrix) {
+  auto [width, height] = GetParam();
+  auto image = make_image(width, height);
+
+  for (auto full_range : {false, true}) {
+    sunshine_colorspace_t colorspace {colorspace_e::rec709, full_range, 8};
+    auto vectors = color_vectors_from_colorspace(colorspace, false);
+    auto coefficients = convert::coefficients_from_colorspace(colorspace);
+
+    int chroma_width = (width + 1) / 2;
+    int chroma_height = (height + 1) / 2;
+    std::vector<std::uint8_t> y(width * height), u(chroma_width * chroma_height), v(chroma_width * chroma_height);
+    std::uint8_t *planes[] {y.data(), u.data(), v.data()};
+    int pitches[] {width, chroma_width, chroma_width};
+
+    convert::bgr0_to_i420(image.data(), width * 4, planes, pitches, width, height, coefficients);
+
+    for (int x = 0; x < width * height; ++x) {
+      EXPECT_NEAR(y[x], std::floor(reference(vectors->color_vec_y, &image[x * 4])), 1) << x;
+    }
+
+    // An opaque single color block gives the exact chroma of that color
+    auto first = &image[0];
+    if (width == 1 && height == 1) {
+      EXPECT_NEAR(u[0], std::floor(reference(vectors->color_vec_u, first)), 1);
+      EXPECT_NEAR(v[0], std::floor(reference(vectors->color_vec_v, first)), 1);
+    }
+  }
+}
+
+TEST_P(VideoConvertTest, Nv12MatchesI420) {
+  auto [width, height] = GetParam();
+  auto image = make_image(width, height);
+  auto coefficients = convert::coefficients_from_colorspace({colorspace_e::rec601, false, 8});
+
+  int chroma_width = (width + 1) / 2;
+  int chroma_height = (height + 1) / 2;
+
+  std::vector<std::uint8_t> y(width * height), u(chroma_width * chroma_height), v(chroma_width * chroma_height);
+  std::uint8_t *i420[] {y.data(), u.data(), v.data()};
+  int i420_pitches[] {width, chroma_width, chroma_width};
+  convert::bgr0_to_i420(image.data(), width * 4, i420, i420_pitches, width, height, coefficients);
+
+  std::vector<std::uint8_t> nv12_y(width * height), nv12_uv(chroma_width * 2 * chroma_height);
+  std::uint8_t *nv12[] {nv12_y.data(), nv12_uv.data()};
+  int nv12_pitches[] {width, chroma_width * 2};
+  convert::bgr0_to_nv12(image.data(), width * 4, nv12, nv12_pitches, width, height, coefficients);
+
+  EXPECT_EQ(y, nv12_y);
+  for (int x = 0; x < chroma_width * chroma_height; ++x) {
+    EXPECT_EQ(u[x], nv12_uv[x * 2]) << x;
+    EXPECT_EQ(v[x], nv12_uv[x * 2 + 1]) << x;
+  }
+}
+
+TEST_P(VideoConvertTest, Yuv444MatchesColorMatrix) {
+  auto [width, height] = GetParam();
+  auto image = make_image(width, height);
+
+  for (auto full_range : {false, true}) {
+    sunshine_colorspace_t colorspace {colorspace_e::bt2020sdr, full_range, 8};
+    auto vectors = color_vectors_from_colorspace(colorspace, false);
+    auto coefficients = convert::coefficients_from_colorspace(colorspace);
+
+    // Pitches wider than the image, so rows can't run into each other unnoticed
+    int pitch = width + 3;
+    std::vector<std::uint8_t> y(pitch * height), u(pitch * height), v(pitch * height);
+    std::uint8_t *planes[] {y.data(), u.data(), v.data()};
+    int pitches[] {pitch, pitch, pitch};
+
+    convert::bgr0_to_yuv444p(image.data(), width * 4, planes, pitches, width, height, coefficients);
+
+    for (int row = 0; row < height; ++row) {
+      for (int x = 0; x < width; ++x) {
+        auto pixel = &image[(row * width + x) * 4];
+        EXPECT_NEAR(y[row * pitch + x], std::floor(reference(vectors->color_vec_y, pixel)), 1) << x << ',' << row;
+        EXPECT_NEAR(u[row * pitch + x], std::floor(reference(vectors->color_vec_u, pixel)), 1) << x << ',' << row;
+        EXPECT_NEAR(v[row * pitch + x], std::floor(reference(vectors->color_vec_v, pixel)), 1) << x << ',' << row;
+      }
+    }
+  }
+}
+
+TEST_P(VideoConvertTest, YuyvIsRepackedTo420) {
+  auto [width, height] = GetParam();
+  int pairs = (width + 1) / 2;
+  int pitch = pairs * 4;
+  auto image = make_image(pitch / 4, height);
+
+  int chroma_width = pairs;
+  int chroma_height = (height + 1) / 2;
+  std::vector<std::uint8_t> y(width * height), u(chroma_width * chroma_height), v(chroma_width * chroma_height);
+  std::uint8_t *i420[] {y.data(), u.data(), v.data()};
+  int i420_pitches[] {width, chroma_width, chroma_width};
+  convert::yuyv_to_i420(image.data(), pitch, i420, i420_pitches, width, height);
+
+  for (int row = 0; row < height; ++row) {
+    for (int x = 0; x < width; ++x) {
+      EXPECT_EQ(y[row * width + x], image[row * pitch + x * 2]) << x << ',' << row;
+    }
+  }
+
+  for (int row = 0; row < chroma_height; ++row) {
+    auto row0 = &image[row * 2 * pitch];
+    auto row1 = row * 2 + 1 < height ? row0 + pitch : row0;
+    for (int x = 0; x < chroma_width; ++x) {
+      EXPECT_EQ(u[row * chroma_width + x], (row0[x * 4 + 1] + row1[x * 4 + 1] + 1) / 2) << x << ',' << row;
+      EXPECT_EQ(v[row * chroma_width + x], (row0[x * 4 + 3] + row1[x * 4 + 3] + 1) / 2) << x << ',' << row;
+    }
+  }
+
+  std::vector<std::uint8_t> nv12_y(width * height), nv12_uv(chroma_width * 2 * chroma_height);
+  std::uint8_t *nv12[] {nv12_y.data(), nv12_uv.data()};
+  int nv12_pitches[] {width, chroma_width * 2};
+  convert::yuyv_to_nv12(image.data(), pitch, nv12, nv12_pitches, width, height);
+
+  EXPECT_EQ(y, nv12_y);
+  for (int x = 0; x < chroma_width * chroma_height; ++x) {
+    EXPECT_EQ(u[x], nv12_uv[x * 2]) << x;
+    EXPECT_EQ(v[x], nv12_uv[x * 2 + 1]) << x;
+  }
+}
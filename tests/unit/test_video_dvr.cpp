@@ -0,0 +1,128 @@
+/**
+ * @file tests/unit/test_video_dvr.cpp
+ * @brief Test src/video_dvr.*.
+ */
+#include "../tests_common.h"
+
+#include <filesystem>
+#include <src/video_dvr.h>
+
+using namespace std::literals;
+using namespace video::dvr;
+
+namespace {
+  constexpr std::int64_t FRAME_NS = 1'000'000'000 / 60;
+
+  /**
+   * @brief A ring in a file of its own, removed when the test ends.
+   */
+  class VideoDvrTest: public ::testing::Test {
+  protected:
+    void SetUp() override {
+      path = std::filesystem::temp_directory_path() / ("sunshine-dvr-" + std::to_string(std::chrono::steady_clock::now().time_since_epoch().count()));
+    }
+
+    void TearDown() override {
+      ring.reset();
+      std::filesystem::remove(path);
+    }
+
+    /**
+     * @brief Write a frame whose data is its index repeated `size` times.
+     */
+    bool write(std::int64_t index, bool key_frame, std::size_t size = 100, std::uint32_t flags = 0) {
+      record_t record {};
+      record.flags = flags | (key_frame ? KEY_FRAME : 0u);
+      record.frame_index = index;
+      record.timestamp = index * FRAME_NS;
+      record.width = 1280;
+      record.height = 720;
+      record.framerate = 60;
+
+      std::vector<std::uint8_t> data(size, (std::uint8_t) index);
+      return ring->write(record, data);
+    }
+
+    std::filesystem::path path;
+    std::unique_ptr<ring_t> ring;
+  };
+}  // namespace
+
+TEST_F(VideoDvrTest, ClipStartsAtTheKeyFrameBeforeTheDuration) {
+  ring = ring_t::open(path, 1 << 20);
+  ASSERT_TRUE(ring);
+
+  for (std::int64_t x = 0; x < 180; ++x) {
+    ASSERT_TRUE(write(x, x % 60 == 0));
+  }
+
+  // The last second reaches back to frame 119, the key frame before it is 60
+  auto frames = ring->clip(1s);
+  ASSERT_EQ(frames.size(), 120);
+  EXPECT_EQ(frames.front().record.frame_index, 60);
+  EXPECT_TRUE(frames.front().record.flags & KEY_FRAME);
+  EXPECT_EQ(frames.back().record.frame_index, 179);
+  EXPECT_EQ(frames.back().data, std::vector<std::uint8_t>(100, 179));
+}
+
+TEST_F(VideoDvrTest, ClipStartsAtTheOldestKeyFrameLeft) {
+  // Room for about 40 frames, so the ring wraps around several times
+  ring = ring_t::open(path, record_size(100) * 40 + 50);
+  ASSERT_TRUE(ring);
+
+  for (std::int64_t x = 0; x < 190; ++x) {
+    ASSERT_TRUE(write(x, x % 30 == 0));
+  }
+
+  // Frame 150 is the oldest key frame that wasn't overwritten, the clip wraps around the end of the ring after it
+  auto frames = ring->clip(1h);
+  ASSERT_EQ(frames.size(), 40);
+  EXPECT_EQ(frames.front().record.frame_index, 150);
+  for (std::size_t x = 0; x < frames.size(); ++x) {
+    EXPECT_EQ(frames[x].record.frame_index, 150 + (std::int64_t) x);
+    EXPECT_EQ(frames[x].data, std::vector<std::uint8_t>(100, (std::uint8_t) (150 + x)));
+  }
+}
+
+TEST_F(VideoDvrTest, JoinsThePartsOfAFrame) {
+  ring = ring_t::open(path, 1 << 20);
+  ASSERT_TRUE(ring);
+
+  ASSERT_TRUE(write(0, true, 10));
+  ASSERT_TRUE(write(0, false, 20, CONTINUED));
+  ASSERT_TRUE(write(1, false, 30));
+
+  auto frames = ring->clip(1s);
+  ASSERT_EQ(frames.size(), 2);
+  EXPECT_EQ(frames[0].data.size(), 30);
+  EXPECT_EQ(frames[1].data.size(), 30);
+}
+
+TEST_F(VideoDvrTest, NoClipWithoutKeyFrame) {
+  ring = ring_t::open(path, 1 << 20);
+  ASSERT_TRUE(ring);
+
+  ASSERT_TRUE(write(0, false));
+  EXPECT_TRUE(ring->clip(1s).empty());
+
+  // Frames that don't fit are refused
+  EXPECT_FALSE(write(1, true, 2 << 20));
+}
+
+TEST_F(VideoDvrTest, KeepsTheRingAcrossRestarts) {
+  ring = ring_t::open(path, 1 << 20);
+  ASSERT_TRUE(ring);
+  ASSERT_TRUE(write(0, true));
+  ASSERT_TRUE(write(1, false));
+
+  ring.reset();
+  ring = ring_t::open(path, 1 << 20);
+  ASSERT_TRUE(ring);
+  EXPECT_EQ(ring->clip(1s).size(), 2);
+
+  // Another capacity starts over
+  ring.reset();
+  ring = ring_t::open(path, 2 << 20);
+  ASSERT_TRUE(ring);
+  EXPECT_TRUE(ring->clip(1s).empty());
+}
@@ -0,0 +1,142 @@
+/**
+ * @file tests/unit/test_video_governor.cpp
+ * @brief Test src/video_governor.*.
+ */
+#include "../tests_common.h"
+
+#include <src/video_governor.h>
+
+using namespace std::literals;
+using video::governor::governor_t;
+
+namespace {
+  constexpr auto FRAMERATE = 60;
+  constexpr auto LIMIT = 80.0;
+
+  /**
+   * @brief Encode a second of frames, each taking the given time, and sample the host after it.
+   */
+  bool encode_second(governor_t &governor, std::chrono::steady_clock::time_point &now, std::chrono::steady_clock::duration encode_time, std::optional<double> temperature = 50.0, bool throttled = false) {
+    for (int x = 0; x < FRAMERATE; ++x) {
+      governor.frame_encoded(encode_time);
+    }
+
+    now += video::governor::SAMPLE_INTERVAL;
+    return governor.update(now, temperature, throttled);
+  }
+}  // namespace
+
+TEST(VideoGovernorTest, KeepsTheStreamOfACalmHost) {
+  governor_t governor {FRAMERATE, LIMIT};
+  auto now = std::chrono::steady_clock::now();
+
+  for (int x = 0; x < 30; ++x) {
+    EXPECT_FALSE(encode_second(governor, now, 5ms));
+  }
+  EXPECT_EQ(governor.level_index(), 0);
+
+  for (int x = 0; x < 10; ++x) {
+    EXPECT_TRUE(governor.take_frame());
+  }
+}
+
+TEST(VideoGovernorTest, LowersOnThrottlingWithHoldoff) {
+  governor_t governor {FRAMERATE, LIMIT};
+  auto now = std::chrono::steady_clock::now();
+
+  EXPECT_TRUE(encode_second(governor, now, 5ms, 60.0, true));
+  EXPECT_EQ(governor.level_index(), 1);
+
+  // The next step waits until the encoder shows the effect of the last one
+  EXPECT_FALSE(encode_second(governor, now, 5ms, 60.0, true));
+  EXPECT_FALSE(encode_second(governor, now, 5ms, 60.0, true));
+  EXPECT_TRUE(encode_second(governor, now, 5ms, 60.0, true));
+  EXPECT_EQ(governor.level_index(), 2);
+}
+
+TEST(VideoGovernorTest, LowersAtTheTemperatureLimit) {
+  governor_t governor {FRAMERATE, LIMIT};
+  auto now = std::chrono::steady_clock::now();
+
+  EXPECT_FALSE(encode_second(governor, now, 5ms, LIMIT - 1));
+  EXPECT_TRUE(encode_second(governor, now, 5ms, LIMIT));
+  EXPECT_EQ(governor.level_index(), 1);
+}
+
+TEST(VideoGovernorTest, LowersWhenFramesMissTheirBudget) {
+  governor_t governor {FRAMERATE, LIMIT};
+  auto now = std::chrono::steady_clock::now();
+
+  // 20 ms is over the 16.7 ms a frame has at 60 fps
+  EXPECT_TRUE(encode_second(governor, now, 20ms));
+  EXPECT_EQ(governor.level_index(), 1);
+}
+
+TEST(VideoGovernorTest, DroppedFramesWidenTheBudget) {
+  governor_t governor {FRAMERATE, LIMIT};
+  auto now = std::chrono::steady_clock::now();
+
+  while (governor.level().fps_divisor == 1) {
+    now += video::governor::LOWER_HOLDOFF;
+    ASSERT_TRUE(encode_second(governor, now, 5ms, std::nullopt, true));
+  }
+
+  EXPECT_TRUE(governor.take_frame());
+  EXPECT_FALSE(governor.take_frame());
+  EXPECT_TRUE(governor.take_frame());
+
+  // Every 2nd frame leaves 33 ms for each, so 20 ms frames are no longer an overrun
+  auto level = governor.level_index();
+  now += video::governor::LOWER_HOLDOFF;
+  EXPECT_FALSE(encode_second(governor, now, 20ms));
+  EXPECT_EQ(governor.level_index(), level);
+}
+
+TEST(VideoGovernorTest, RaisesOnceTheHostRecovered) {
+  governor_t governor {FRAMERATE, LIMIT};
+  auto now = std::chrono::steady_clock::now();
+
+  EXPECT_TRUE(encode_second(governor, now, 5ms, LIMIT + 2));
+  EXPECT_EQ(governor.level_index(), 1);
+
+  // Below the limit but within the hysteresis the level stays
+  for (int x = 0; x < 30; ++x) {
+    EXPECT_FALSE(encode_second(governor, now, 5ms, LIMIT - 2));
+  }
+  EXPECT_EQ(governor.level_index(), 1);
+
+  bool raised = false;
+  for (int x = 0; x < 30 && !raised; ++x) {
+    raised = encode_second(governor, now, 5ms, LIMIT - 10);
+  }
+  EXPECT_TRUE(raised);
+  EXPECT_EQ(governor.level_index(), 0);
+}
+
+TEST(VideoGovernorTest, StaysDownWhileTheHigherLevelWouldOverrun) {
+  governor_t governor {FRAMERATE, LIMIT};
+  auto now = std::chrono::steady_clock::now();
+
+  while (governor.level().fps_divisor == 1) {
+    now += video::governor::LOWER_HOLDOFF;
+    ASSERT_TRUE(encode_second(governor, now, 5ms, std::nullopt, true));
+  }
+  auto level = governor.level_index();
+
+  // 20 ms frames fit every 2nd frame, but not the full frame rate of the level above
+  for (int x = 0; x < 60; ++x) {
+    EXPECT_FALSE(encode_second(governor, now, 20ms));
+  }
+  EXPECT_EQ(governor.level_index(), level);
+}
+
+TEST(VideoGovernorTest, StopsAtTheLowestLevel) {
+  governor_t governor {FRAMERATE, LIMIT};
+  auto now = std::chrono::steady_clock::now();
+
+  for (int x = 0; x < 50; ++x) {
+    now += video::governor::LOWER_HOLDOFF;
+    encode_second(governor, now, 100ms, LIMIT + 10, true);
+  }
+  EXPECT_EQ(governor.level_index(), video::governor::levels.size() - 1);
+}
@@ -0,0 +1,112 @@
+/**
+ * @file tests/unit/test_video_scheduler.cpp
+ * @brief Test src/video_scheduler.*.
+ */
+#include "../tests_common.h"
+
+#include <future>
+
+#include <src/video_scheduler.h>
+
+using namespace std::literals;
+using video::scheduler::scheduler_t;
+
+namespace {
+  // Each stream is 1080p60, the encoder keeps up with a bit less than two of them
+  constexpr auto WIDTH = 1920;
+  constexpr auto HEIGHT = 1080;
+  constexpr auto FRAMERATE = 60;
+
+  void probe(scheduler_t &scheduler) {
+    scheduler.probed((std::uint64_t) WIDTH * HEIGHT, std::chrono::duration_cast<std::chrono::steady_clock::duration>(1s / (FRAMERATE * 1.8)));
+  }
+
+  int session_a, session_b, session_c;
+}  // namespace
+
+TEST(VideoSchedulerTest, AdmitsAllFramesWithoutACapacity) {
+  scheduler_t scheduler;
+
+  EXPECT_EQ(scheduler.admit(&session_a, WIDTH, HEIGHT, FRAMERATE), 1);
+  EXPECT_EQ(scheduler.admit(&session_b, WIDTH, HEIGHT, FRAMERATE), 1);
+  EXPECT_EQ(scheduler.fps_divisor(&session_b), 1);
+}
+
+TEST(VideoSchedulerTest, LowersTheFrameRateOfSessionsThatJoin) {
+  scheduler_t scheduler;
+  probe(scheduler);
+
+  EXPECT_EQ(scheduler.admit(&session_a, WIDTH, HEIGHT, FRAMERATE), 1);
+  EXPECT_EQ(scheduler.admit(&session_b, WIDTH, HEIGHT, FRAMERATE), 2);
+
+  // Nothing fits anymore, the last session gets the fewest frames and the others keep their frame rate
+  EXPECT_EQ(scheduler.admit(&session_c, WIDTH, HEIGHT, FRAMERATE), 3);
+  EXPECT_EQ(scheduler.fps_divisor(&session_a), 1);
+  EXPECT_EQ(scheduler.fps_divisor(&session_b), 2);
+}
+
+TEST(VideoSchedulerTest, TheFirstSessionGetsAllFrames) {
+  scheduler_t scheduler;
+  probe(scheduler);
+
+  EXPECT_EQ(scheduler.admit(&session_a, WIDTH * 2, HEIGHT * 2, FRAMERATE * 2), 1);
+}
+
+TEST(VideoSchedulerTest, RaisesTheFrameRateWhenASessionLeaves) {
+  scheduler_t scheduler;
+  probe(scheduler);
+
+  scheduler.admit(&session_a, WIDTH, HEIGHT, FRAMERATE);
+  scheduler.admit(&session_b, WIDTH, HEIGHT, FRAMERATE);
+  scheduler.admit(&session_c, WIDTH, HEIGHT, FRAMERATE);
+
+  scheduler.leave(&session_a);
+  EXPECT_EQ(scheduler.fps_divisor(&session_b), 1);
+  EXPECT_EQ(scheduler.fps_divisor(&session_c), 2);
+
+  // Sessions that left aren't held back
+  EXPECT_EQ(scheduler.fps_divisor(&session_a), 1);
+}
+
+TEST(VideoSchedulerTest, LearnsTheSessionLimit) {
+  scheduler_t scheduler;
+
+  scheduler.admit(&session_a, WIDTH, HEIGHT, FRAMERATE);
+  scheduler.open_failed();
+  EXPECT_EQ(scheduler.capacity().max_sessions, 0);
+
+  scheduler.admit(&session_b, WIDTH, HEIGHT, FRAMERATE);
+  scheduler.open_failed();
+  EXPECT_EQ(scheduler.capacity().max_sessions, 1);
+}
+
+TEST(VideoSchedulerTest, EarliestDeadlineGoesFirst) {
+  scheduler_t scheduler;
+  auto now = std::chrono::steady_clock::now();
+
+  std::vector<int> order;
+  std::mutex order_lock;
+
+  std::future<void> late, early;
+  {
+    auto turn = scheduler.wait_turn(now);
+
+    late = std::async(std::launch::async, [&]() {
+      auto turn = scheduler.wait_turn(now + 32ms);
+      std::lock_guard lg {order_lock};
+      order.push_back(2);
+    });
+    early = std::async(std::launch::async, [&]() {
+      auto turn = scheduler.wait_turn(now + 16ms);
+      std::lock_guard lg {order_lock};
+      order.push_back(1);
+    });
+
+    // Both frames are waiting before the turn ends
+    std::this_thread::sleep_for(20ms);
+  }
+
+  late.get();
+  early.get();
+  EXPECT_EQ(order, (std::vector<int> {1, 2}));
+}
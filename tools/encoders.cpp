@@ -0,0 +1,125 @@
+/**
+ * @file tools/encoders.cpp
+ * @brief Benchmarks every encoder of the build across codecs, resolutions, YUV 4:4:4 and HDR.
+ */
+// standard includes
+#include <array>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+// local includes
+#include "src/config.h"
+#include "src/globals.h"
+#include "src/logging.h"
+#include "src/platform/common.h"
+#include "src/video.h"
+
+using namespace std::literals;
+
+namespace {
+  constexpr auto FRAMES = 300;
+  constexpr auto FRAMERATE = 60;
+
+  struct resolution_t {
+    int width;
+    int height;
+    int bitrate_kbps;
+  };
+
+  constexpr std::array resolutions {
+    resolution_t {1280, 720, 10000},
+    resolution_t {1920, 1080, 20000},
+    resolution_t {2560, 1440, 35000},
+    resolution_t {3840, 2160, 80000},
+  };
+
+  struct format_t {
+    std::string_view name;
+    int dynamic_range;
+    int chroma_sampling_type;
+  };
+
+  // HDR is encoded in 10-bit like it would be for an HDR display, the colors are only converted to BT.2020 when the display is HDR
+  constexpr std::array formats {
+    format_t {"SDR 4:2:0"sv, 0, 0},
+    format_t {"SDR 4:4:4"sv, 0, 1},
+    format_t {"HDR 4:2:0"sv, 1, 0},
+    format_t {"HDR 4:4:4"sv, 1, 1},
+  };
+
+  bool supports(const video::encoder_t::codec_t &codec, const format_t &format) {
+    return codec[video::encoder_t::PASSED] &&
+           (!format.dynamic_range || codec[video::encoder_t::DYNAMIC_RANGE]) &&
+           (!format.chroma_sampling_type || codec[video::encoder_t::YUV444]);
+  }
+}  // namespace
+
+int main(int argc, char *argv[]) {
+  // Takes the config file and the options on the command line like sunshine does,
+  // e.g. `capture=synthetic sw_preset=veryfast` to compare software presets on a headless host
+  if (config::parse(argc, argv)) {
+    return 1;
+  }
+
+  auto log_deinit = logging::init(config::sunshine.min_log_level, (platf::appdata() / "encoders.log").string());
+
+  mail::man = std::make_shared<safe::mail_raw_t>();
+  task_pool.start(1);
+
+  auto platf_deinit = platf::init();
+  if (!platf_deinit) {
+    BOOST_LOG(error) << "Platform failed to initialize"sv;
+    return 1;
+  }
+
+  std::stringstream table;
+  table << std::left << std::setw(12) << "encoder" << std::setw(8) << "codec" << std::setw(11) << "format" << std::setw(11) << "resolution"
+        << std::right << std::setw(11) << "mean [ms]" << std::setw(10) << "p99 [ms]" << std::setw(8) << "fps" << std::setw(10) << "kbps" << std::setw(10) << "accuracy" << '\n';
+  table << std::fixed << std::setprecision(2);
+
+  for (auto encoder : video::all_encoders()) {
+    if (!config::video.encoder.empty() && config::video.encoder != encoder->name) {
+      continue;
+    }
+
+    // Probe the codecs and formats the encoder supports with the display it'll capture from
+    if (!video::validate_encoder(*encoder, false)) {
+      table << std::left << std::setw(12) << encoder->name << "not available\n";
+      continue;
+    }
+
+    for (int video_format = 0; video_format < 3; ++video_format) {
+      auto &codec = video_format == 0 ? encoder->h264 : video_format == 1 ? encoder->hevc : encoder->av1;
+      auto codec_name = video_format == 0 ? "H.264"sv : video_format == 1 ? "HEVC"sv : "AV1"sv;
+
+      for (auto &format : formats) {
+        if (!supports(codec, format)) {
+          continue;
+        }
+
+        for (auto &resolution : resolutions) {
+          // Rec. 709 in limited range, or BT.2020 for HDR while the display is in HDR mode
+          video::config_t config {resolution.width, resolution.height, FRAMERATE, FRAMERATE * 100, resolution.bitrate_kbps, 1, 0, 1 << 1, video_format, format.dynamic_range, format.chroma_sampling_type, 0};
+
+          table << std::left << std::setw(12) << encoder->name << std::setw(8) << codec_name << std::setw(11) << format.name
+                << std::setw(11) << (std::to_string(resolution.width) + 'x' + std::to_string(resolution.height)) << std::right;
+
+          auto result = video::benchmark_encoder(*encoder, config, FRAMES);
+          if (!result) {
+            table << std::setw(11) << "failed" << '\n';
+            continue;
+          }
+
+          table << std::setw(11) << result->latency_mean_ms << std::setw(10) << result->latency_p99_ms << std::setw(8) << result->fps
+                << std::setw(10) << result->bitrate_kbps << std::setw(9) << result->bitrate_kbps * 100 / resolution.bitrate_kbps << "%\n";
+        }
+      }
+    }
+  }
+
+  std::cout << '\n'
+            << table.str();
+  return 0;
+}
@@ -1,6 +1,7 @@
 import { fileURLToPath, URL } from 'node:url'
 import fs from 'fs';
-import { resolve } from 'path'
+import { join, resolve } from 'path'
+import zlib from 'zlib'
 import { defineConfig } from 'vite'
 import { ViteEjsPlugin } from "vite-plugin-ejs";
 import { codecovVitePlugin } from "@codecov/vite-plugin";
@@ -42,6 +43,46 @@ else {
 
 let header = fs.readFileSync(resolve(assetsSrcPath, "template_header.html"))
 
+/**
+ * Write a brotli and a gzip variant next to each compressible asset, so the web server
+ * can send them without compressing anything at runtime.
+ */
+function precompressAssets() {
+    const compressible = /\.(css|js|json|map|svg|txt)$/;
+
+    const walk = (dir) => {
+        for (const entry of fs.readdirSync(dir, { withFileTypes: true })) {
+            const path = join(dir, entry.name);
+            if (entry.isDirectory()) {
+                walk(path);
+            } else if (compressible.test(entry.name)) {
+                const data = fs.readFileSync(path);
+                const brotli = zlib.brotliCompressSync(data, { params: { [zlib.constants.BROTLI_PARAM_QUALITY]: 11 } });
+                const gzip = zlib.gzipSync(data, { level: 9 });
+
+                // Only keep the variants that save something
+                if (brotli.length < data.length) {
+                    fs.writeFileSync(path + '.br', brotli);
+                }
+                if (gzip.length < data.length) {
+                    fs.writeFileSync(path + '.gz', gzip);
+                }
+            }
+        }
+    };
+
+    return {
+        name: 'precompress-assets',
+        apply: 'build',
+        closeBundle() {
+            const assets = resolve(assetsDstPath, 'assets');
+            if (fs.existsSync(assets)) {
+                walk(assets);
+            }
+        },
+    };
+}
+
 // https://vitejs.dev/config/
 export default defineConfig({
     resolve: {
@@ -53,6 +94,7 @@ export default defineConfig({
     plugins: [
         vue(),
         ViteEjsPlugin({ header }),
+        precompressAssets(),
         // The Codecov vite plugin should be after all other plugins
         codecovVitePlugin({
             enableBundleAnalysis: true,